@@ -6,6 +6,7 @@
 #include "../src/debug.h"
 #include "../src/rtcp.h"
 #include "../src/rtp.h"
+#include "../src/bwe.h"
 
 int janus_log_level = LOG_NONE;
 gboolean janus_log_timestamps = FALSE;
@@ -64,6 +65,16 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	janus_rtcp_fix_ssrc(&ctx0, (char *)copy_data[idx++], size, 1, 2, 2);
 	janus_rtcp_parse(&ctx1, (char *)copy_data[idx++], size);
 	janus_rtcp_remove_nacks((char *)copy_data[idx++], size);
+	/* Transport-wide CC feedback, and the bandwidth estimator it feeds */
+	janus_rtcp_transport_wide_cc_report reports[JANUS_RTCP_TWCC_MAX_FEEDBACK];
+	int reports_num = janus_rtcp_transport_wide_cc_parse((char *)data, size, reports, JANUS_RTCP_TWCC_MAX_FEEDBACK);
+	if (reports_num > 0) {
+		janus_bwe_context *bwe = janus_bwe_context_create();
+		for (idx=0; idx < reports_num; idx++)
+			janus_bwe_context_add_sent(bwe, reports[idx].seq, 1200, 0, 1000 + idx*1000);
+		janus_bwe_context_feedback(bwe, reports, reports_num, G_USEC_PER_SEC + reports_num*1000);
+		janus_bwe_context_destroy(bwe);
+	}
 	/* Functions that allocate new memory */
 	char *output_data = janus_rtcp_filter((char *)data, size, &newlen);
 	GSList *list = janus_rtcp_get_nacks((char *)data, size);
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include "../src/debug.h"
+#include "../src/rtcp.h"
+
+int janus_log_level = LOG_NONE;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+
+/* This is to avoid linking with openSSL */
+int RAND_bytes(uint8_t *key, int len) {
+	return 0;
+}
+
+/* Visitor that checks the messages it's given are within the packet */
+static gboolean visitor(janus_rtcp_header *rtcp, int len, int offset, void *user_data) {
+	int size = *(int *)user_data;
+	if (offset < 0 || len <= 0 || offset + len != size)
+		abort();
+	if (4*(int)ntohs(rtcp->length) + 4 > len)
+		abort();
+	return TRUE;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	/* Sanity Checks */
+	/* Max UDP payload with MTU=1500 */
+	if (size > 1472) return 0;
+	/* libnice checks that a packet length is positive */
+	if (size <= 0) return 0;
+	/* Janus checks for a minimum COMPOUND packet length
+	 * and the RTP header type value */
+	if (!janus_is_rtcp((char *)data, size)) return 0;
+	/* libsrtp checks that an entire COMPOUND packet must
+	 * contain at least a full RTCP header */
+	if (size < 8) return 0;
+
+	/* Targets */
+	int len = size;
+	int walked = janus_rtcp_walk((char *)data, len, visitor, &len);
+	janus_rtcp_summary summary;
+	int messages = janus_rtcp_summarize((char *)data, len, &summary);
+	if (messages != walked)
+		abort();
+	/* All offsets must point to a message within the packet */
+	if (summary.sr >= len || summary.rr >= len || summary.nack >= len || summary.twcc >= len)
+		abort();
+	/* The summary must agree with the helpers built on top of it */
+	if (summary.bye != janus_rtcp_has_bye((char *)data, size) ||
+			summary.fir != janus_rtcp_has_fir((char *)data, size) ||
+			summary.pli != janus_rtcp_has_pli((char *)data, size) ||
+			summary.remb != janus_rtcp_get_remb((char *)data, size))
+		abort();
+	/* Iterate on the NACKs without allocating, and compare with the list */
+	GSList *list = janus_rtcp_get_nacks((char *)data, size), *item = list;
+	janus_rtcp_nack_iter iter;
+	uint16_t seq = 0;
+	if (janus_rtcp_nack_iter_init(&iter, (char *)data, &summary)) {
+		/* The FCI entries must be within the packet */
+		if ((char *)(iter.fci + iter.count) > (char *)data + size)
+			abort();
+		while (janus_rtcp_nack_iter_next(&iter, &seq)) {
+			if (item == NULL || GPOINTER_TO_UINT(item->data) != seq)
+				abort();
+			item = item->next;
+		}
+	}
+	if (item != NULL)
+		abort();
+
+	/* Free resources */
+	if (list) g_slist_free(list);
+	return 0;
+}
@@ -81,6 +81,34 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	janus_rtp_header_extension_parse_video_orientation((char * )data, size, 1, &c, &f, &r1, &r0);
 	janus_rtp_header_extension_parse_dependency_desc((char *)data, size, 1, (uint8_t *)&dd, &sizedd);
 
+	/* Single-pass RTP extensions decoder, and lookups on all possible IDs */
+	janus_rtp_header_extensions exts;
+	if(janus_rtp_header_extensions_parse((char *)data, size, &exts) > 0) {
+		int id = 0;
+		uint8_t idlen = 0;
+		uint64_t abs64 = 0;
+		uint32_t abs32 = 0;
+		for(id = 1; id < 256; id++) {
+			char *ext = janus_rtp_header_extensions_find(&exts, id, &idlen);
+			if(ext != NULL && idlen > 0) {
+				/* Touch the extension data, to check it's within the packet */
+				volatile char first = ext[0], last = ext[idlen-1];
+				(void)first;
+				(void)last;
+			}
+		}
+		janus_rtp_header_extensions_get_mid(&exts, 1, sdes_item, sizeof(sdes_item));
+		janus_rtp_header_extensions_get_rid(&exts, 2, sdes_item, sizeof(sdes_item));
+		janus_rtp_header_extensions_get_audio_level(&exts, 1, NULL, NULL);
+		janus_rtp_header_extensions_get_playout_delay(&exts, 1, NULL, NULL);
+		janus_rtp_header_extensions_get_transport_wide_cc(&exts, 1, &transport_seq_num);
+		janus_rtp_header_extensions_get_abs_send_time(&exts, 1, &abs32);
+		janus_rtp_header_extensions_get_abs_capture_time(&exts, 1, &abs64);
+		janus_rtp_header_extensions_get_video_orientation(&exts, 1, &c, &f, &r1, &r0);
+		sizedd = sizeof(dd);
+		janus_rtp_header_extensions_get_dependency_desc(&exts, 20, (uint8_t *)&dd, &sizedd);
+	}
+
 	/* Extract codec payload */
 	int plen = 0;
 	char *payload = janus_rtp_payload((char *)data, size, &plen);
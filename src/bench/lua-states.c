@@ -0,0 +1,352 @@
+/*! \file    lua-states.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Throughput benchmark for the Lua plugin states pool
+ * \details  Simple benchmark that measures how many scripted messages per
+ * second the Lua plugin can handle when its script is loaded in 1, 4 or 16
+ * independent Lua states (see the \c states property of the plugin). As
+ * the media plugins benchmark does, it loads the actual plugin with a fake
+ * implementation of the Janus callbacks: for each run, the plugin is
+ * initialized with a configuration file pointing to the script and asking
+ * for the right number of states, a set of sessions is created, and then
+ * a configurable number of threads (which play the role of the transport
+ * threads in Janus) send \c handleMessage() requests to those sessions in
+ * a round robin fashion, checking the synchronous responses they get.
+ *
+ * When no script is provided, a built-in one is used, which keeps some
+ * per-session state and does some string processing, as a scripted
+ * application would. Custom scripts must implement all the functions
+ * the plugin requires, and reply synchronously to a
+ * <code>{"request":"double","value":N}</code> message.
+ *
+ * Usage: janus-bench-lua -p plugins/.libs/libjanus_lua.so [-s 1,4,16] [-t 16] [-S 256] [-m 200000] [-f script.lua]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "../plugins/plugin.h"
+#include "../debug.h"
+#include "../utils.h"
+
+int janus_log_level = LOG_ERR;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+int refcount_debug = 0;
+
+/* Script to use when none is provided */
+static const char *bench_script =
+	"sessions = {}\n"
+	"function init(config) end\n"
+	"function destroy() end\n"
+	"function resumeScheduler() end\n"
+	"function createSession(id)\n"
+	"	sessions[id] = { id = id, count = 0 }\n"
+	"end\n"
+	"function destroySession(id)\n"
+	"	sessions[id] = nil\n"
+	"end\n"
+	"function querySession(id)\n"
+	"	return '{}'\n"
+	"end\n"
+	"function handleMessage(id, tr, msg, jsep)\n"
+	"	local s = sessions[id]\n"
+	"	if s == nil then return -1, 'no such session' end\n"
+	"	local request = string.match(msg, '\"request\":%s*\"(%w+)\"')\n"
+	"	local value = tonumber(string.match(msg, '\"value\":%s*(%d+)'))\n"
+	"	if request == nil or value == nil then return -1, 'invalid request' end\n"
+	"	s.count = s.count + 1\n"
+	"	s.last = request\n"
+	"	return 0, string.format('{\"result\":\"%s\",\"value\":%d,\"count\":%d}', request, value * 2, s.count)\n"
+	"end\n"
+	"function setupMedia(id) end\n"
+	"function hangupMedia(id) end\n";
+
+/* Fake core callbacks: the requests we send are all answered synchronously */
+static volatile gint bench_events = 0;
+static int bench_push_event(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep) {
+	g_atomic_int_inc(&bench_events);
+	return 0;
+}
+static int bench_push_event_payload(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, janus_json_payload *payload, json_t *jsep) {
+	g_atomic_int_inc(&bench_events);
+	return 0;
+}
+static void bench_relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet) {
+}
+static void bench_relay_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet) {
+}
+static void bench_relay_data(janus_plugin_session *handle, janus_plugin_data *packet) {
+}
+static void bench_send_pli(janus_plugin_session *handle) {
+}
+static void bench_send_pli_stream(janus_plugin_session *handle, int mindex) {
+}
+static void bench_send_remb(janus_plugin_session *handle, guint32 bitrate) {
+}
+static void bench_close_pc(janus_plugin_session *handle) {
+}
+static void bench_end_session(janus_plugin_session *handle) {
+}
+static gboolean bench_events_is_enabled(void) {
+	return FALSE;
+}
+static void bench_notify_event(janus_plugin *plugin, janus_plugin_session *handle, json_t *event) {
+	json_decref(event);
+}
+static gboolean bench_auth_is_signed(void) {
+	return FALSE;
+}
+static gboolean bench_auth_is_signature_valid(janus_plugin *plugin, const char *token) {
+	return FALSE;
+}
+static gboolean bench_auth_signature_contains(janus_plugin *plugin, const char *token, const char *descriptor) {
+	return FALSE;
+}
+static gboolean bench_inherit_affinity(janus_plugin_session *handle) {
+	return FALSE;
+}
+
+static janus_callbacks bench_callbacks =
+	{
+		.push_event = bench_push_event,
+		.relay_rtp = bench_relay_rtp,
+		.relay_rtcp = bench_relay_rtcp,
+		.relay_data = bench_relay_data,
+		.send_pli = bench_send_pli,
+		.send_pli_stream = bench_send_pli_stream,
+		.send_remb = bench_send_remb,
+		.close_pc = bench_close_pc,
+		.end_session = bench_end_session,
+		.events_is_enabled = bench_events_is_enabled,
+		.notify_event = bench_notify_event,
+		.auth_is_signed = bench_auth_is_signed,
+		.auth_is_signature_valid = bench_auth_is_signature_valid,
+		.auth_signature_contains = bench_auth_signature_contains,
+		.inherit_affinity = bench_inherit_affinity,
+		.push_event_payload = bench_push_event_payload,
+	};
+
+static janus_plugin *bench_plugin = NULL;
+
+/* Sessions: we pass the plugin a janus_plugin_session for each of them, as the core would */
+static void bench_session_handle_free(const janus_refcount *handle_ref) {
+	/* Sessions are freed when each run ends, after the plugin is done with them */
+}
+
+/* Shared benchmark context */
+typedef struct bench_context {
+	janus_plugin_session *sessions;
+	guint num_sessions;
+	guint num_threads;
+	guint messages;
+	volatile gint errors;
+} bench_context;
+
+typedef struct bench_worker {
+	bench_context *ctx;
+	guint index;
+} bench_worker;
+
+static void *bench_worker_thread(void *data) {
+	bench_worker *w = (bench_worker *)data;
+	bench_context *ctx = w->ctx;
+	guint total = ctx->messages / ctx->num_threads;
+	char transaction[32];
+	guint i = 0;
+	for(i=0; i<total; i++) {
+		guint session = (w->index + i*ctx->num_threads) % ctx->num_sessions;
+		g_snprintf(transaction, sizeof(transaction), "%u-%u", w->index, i);
+		/* The plugin takes ownership of both the transaction and the message */
+		json_t *message = json_pack("{sssi}", "request", "double", "value", i);
+		janus_plugin_result *result = bench_plugin->handle_message(&ctx->sessions[session],
+			g_strdup(transaction), message, NULL);
+		if(result == NULL || result->type != JANUS_PLUGIN_OK ||
+				json_integer_value(json_object_get(result->content, "value")) != (json_int_t)i*2)
+			g_atomic_int_inc(&ctx->errors);
+		if(result != NULL)
+			janus_plugin_result_destroy(result);
+	}
+	return NULL;
+}
+
+/* Write the plugin configuration for a run, in a temporary folder */
+static gboolean bench_write_config(const char *folder, const char *script, guint num_states) {
+	char *filename = g_strdup_printf("%s/%s.jcfg", folder, bench_plugin->get_package());
+	char *config = g_strdup_printf("general: {\n\tpath = \"%s\"\n\tscript = \"%s\"\n\tstates = %u\n}\n",
+		folder, script, num_states);
+	GError *error = NULL;
+	gboolean ok = g_file_set_contents(filename, config, -1, &error);
+	if(!ok) {
+		fprintf(stderr, "Error writing %s: %s\n", filename, error->message);
+		g_error_free(error);
+	}
+	g_free(config);
+	g_free(filename);
+	return ok;
+}
+
+static int bench_run(const char *folder, guint num_states, guint num_threads, guint num_sessions, guint messages, const char *script) {
+	if(!bench_write_config(folder, script, num_states))
+		return -1;
+	if(bench_plugin->init(&bench_callbacks, folder) < 0) {
+		fprintf(stderr, "Couldn't initialize plugin %s\n", bench_plugin->get_package());
+		return -1;
+	}
+	bench_context ctx = { 0 };
+	ctx.num_threads = num_threads;
+	ctx.num_sessions = num_sessions;
+	ctx.messages = messages;
+	ctx.sessions = g_malloc0(num_sessions * sizeof(janus_plugin_session));
+	int ret = 0;
+	guint i = 0, created = 0;
+	for(i=0; i<num_sessions; i++) {
+		janus_refcount_init(&ctx.sessions[i].ref, bench_session_handle_free);
+		int error = 0;
+		bench_plugin->create_session(&ctx.sessions[i], &error);
+		if(error) {
+			fprintf(stderr, "Error creating plugin session: %d\n", error);
+			ret = -1;
+			break;
+		}
+		created++;
+	}
+	if(ret == 0) {
+		/* Start the clock and the threads */
+		GThread **threads = g_malloc0(num_threads * sizeof(GThread *));
+		bench_worker *workers = g_malloc0(num_threads * sizeof(bench_worker));
+		gint64 start = janus_get_monotonic_time();
+		for(i=0; i<num_threads; i++) {
+			workers[i].ctx = &ctx;
+			workers[i].index = i;
+			threads[i] = g_thread_new("bench worker", bench_worker_thread, &workers[i]);
+		}
+		for(i=0; i<num_threads; i++)
+			g_thread_join(threads[i]);
+		gint64 elapsed = janus_get_monotonic_time() - start;
+		guint handled = (messages / num_threads) * num_threads;
+		printf("states=%-3u threads=%-3u sessions=%-5u messages=%-8u time=%8.3fs rate=%10.0f msg/s errors=%d\n",
+			num_states, num_threads, num_sessions, handled, (double)elapsed/G_USEC_PER_SEC,
+			elapsed > 0 ? (double)handled*G_USEC_PER_SEC/elapsed : 0.0, g_atomic_int_get(&ctx.errors));
+		if(g_atomic_int_get(&ctx.errors) > 0)
+			ret = -1;
+		g_free(threads);
+		g_free(workers);
+	}
+	/* Done */
+	for(i=0; i<created; i++) {
+		int error = 0;
+		g_atomic_int_set(&ctx.sessions[i].stopped, 1);
+		bench_plugin->destroy_session(&ctx.sessions[i], &error);
+	}
+	bench_plugin->destroy();
+	g_free(ctx.sessions);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	gchar *plugin_path = NULL, *states = NULL, *script = NULL;
+	gint threads = 16, sessions = 256, messages = 200000, debug = LOG_ERR;
+	GOptionEntry opt_entries[] = {
+		{ "plugin", 'p', 0, G_OPTION_ARG_STRING, &plugin_path, "Path to the Lua plugin shared object", NULL },
+		{ "states", 's', 0, G_OPTION_ARG_STRING, &states, "Comma separated list of numbers of Lua states to test (default=1,4,16)", NULL },
+		{ "threads", 't', 0, G_OPTION_ARG_INT, &threads, "Number of threads sending messages (default=16)", NULL },
+		{ "sessions", 'S', 0, G_OPTION_ARG_INT, &sessions, "Number of sessions to send messages to (default=256)", NULL },
+		{ "messages", 'm', 0, G_OPTION_ARG_INT, &messages, "Number of messages to send for each run (default=200000)", NULL },
+		{ "script", 'f', 0, G_OPTION_ARG_STRING, &script, "Lua script to load in the plugin (default=built-in)", NULL },
+		{ "debug-level", 'd', 0, G_OPTION_ARG_INT, &debug, "Debug/logging level of the plugin (0=disable debugging, 7=maximum debug level; default=2)", NULL },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL },
+	};
+	GError *error = NULL;
+	GOptionContext *opts = g_option_context_new("");
+	g_option_context_set_help_enabled(opts, TRUE);
+	g_option_context_add_main_entries(opts, opt_entries, NULL);
+	if(!g_option_context_parse(opts, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(opts);
+		exit(1);
+	}
+	g_option_context_free(opts);
+	if(plugin_path == NULL || threads < 1 || sessions < 1 || messages < threads) {
+		fprintf(stderr, "Invalid arguments\n");
+		exit(1);
+	}
+	janus_log_level = debug < LOG_NONE ? LOG_NONE : (debug > LOG_MAX ? LOG_MAX : debug);
+	if(janus_log_init(FALSE, TRUE, NULL) < 0)
+		exit(1);
+
+	int ret = 1;
+	char *folder = NULL, *script_file = NULL;
+	gchar **list = NULL;
+	/* Load the plugin */
+	void *plugin = dlopen(plugin_path, RTLD_NOW | RTLD_GLOBAL);
+	if(plugin == NULL) {
+		fprintf(stderr, "Couldn't load plugin '%s': %s\n", plugin_path, dlerror());
+		goto done;
+	}
+	create_p *create = (create_p *)dlsym(plugin, "create");
+	if(create == NULL || (bench_plugin = create()) == NULL) {
+		fprintf(stderr, "Couldn't use function 'create' in '%s'\n", plugin_path);
+		goto done;
+	}
+	if(strcmp(bench_plugin->get_package(), "janus.plugin.lua")) {
+		fprintf(stderr, "Unsupported plugin %s\n", bench_plugin->get_package());
+		goto done;
+	}
+	/* The plugin configuration (and the built-in script, if needed) go in a temporary folder */
+	folder = g_dir_make_tmp("janus-bench-XXXXXX", NULL);
+	if(folder == NULL) {
+		fprintf(stderr, "Couldn't create a temporary configuration folder\n");
+		goto done;
+	}
+	if(script == NULL) {
+		script_file = g_strdup_printf("%s/janus-bench.lua", folder);
+		if(!g_file_set_contents(script_file, bench_script, -1, NULL)) {
+			fprintf(stderr, "Couldn't write the Lua script to %s\n", script_file);
+			goto done;
+		}
+	}
+	ret = 0;
+	list = g_strsplit(states ? states : "1,4,16", ",", -1);
+	gchar **n = NULL;
+	for(n=list; *n != NULL; n++) {
+		int num = atoi(*n);
+		if(num < 1) {
+			fprintf(stderr, "Invalid number of states: %s\n", *n);
+			ret = 1;
+			break;
+		}
+		if(bench_run(folder, num, threads, sessions, messages, script ? script : script_file) < 0) {
+			ret = 1;
+			break;
+		}
+	}
+
+done:
+	if(folder != NULL) {
+		char *filename = bench_plugin ? g_strdup_printf("%s/%s.jcfg", folder, bench_plugin->get_package()) : NULL;
+		if(filename != NULL)
+			unlink(filename);
+		g_free(filename);
+		if(script_file != NULL)
+			unlink(script_file);
+		rmdir(folder);
+		g_free(folder);
+	}
+	g_free(script_file);
+	g_strfreev(list);
+	janus_log_destroy();
+	g_free(plugin_path);
+	g_free(states);
+	g_free(script);
+	return ret;
+}
@@ -0,0 +1,1460 @@
+/*! \file    plugin-replay.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Packet-level replay benchmark for media plugins
+ * \details  Simple benchmark that loads a media plugin (VideoRoom,
+ * Streaming or AudioBridge) with a fake implementation of the Janus
+ * callbacks, and so without any WebRTC stack, browser or network
+ * involved, in order to measure how expensive its media path is. The
+ * benchmark creates N synthetic publishers and M subscribers, negotiates
+ * their sessions as the core would, and then replays RTP traces into
+ * the plugin at an accelerated speed, counting all the packets the plugin
+ * relays back to the core.
+ *
+ * How publishers and subscribers are mapped depends on the plugin:
+ *
+ * - \b VideoRoom: publishers join a room and feed the traces via
+ *   \c incoming_rtp, while each subscriber subscribes to all publishers;
+ * - \b Streaming: publishers are RTP mountpoints the traces are sent to
+ *   on the loopback interface, and subscribers are viewers distributed
+ *   evenly across them;
+ * - \b AudioBridge: publishers join a room and feed the (audio) trace,
+ *   while subscribers join the same room muted; notice that the mixer
+ *   works in real-time, so the trace should not be accelerated (-x 1).
+ *
+ * Traces can be Janus recordings (.mjr) or pcap captures (the packets
+ * with the configured payload type are extracted from the latter); when
+ * no trace is provided, an Opus and a VP8 trace are generated instead.
+ * Publishers also send RTCP sender reports, and subscribers receiver
+ * reports and REMB feedback, via \c incoming_rtcp.
+ *
+ * The benchmark reports the packets per second received and relayed,
+ * the latency of each relayed packet (time between the packet being
+ * handed to the plugin and the plugin relaying it, measured by stamping
+ * the tail of the payload; not available for the AudioBridge, since it
+ * mixes and re-encodes the audio), and the CPU the process used, both
+ * overall and (on Linux) per thread. Results can be saved in JSON format
+ * too, e.g., to track fan-out regressions over time.
+ *
+ * Usage: janus-bench-plugin -p plugins/.libs/libjanus_videoroom.so [-n 4] [-m 10] [-a audio.mjr] [-v video.pcap] [-x 10] [-j results.json]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "../debug.h"
+#include "../rtp.h"
+#include "../rtcp.h"
+#include "../record.h"
+#include "../rtpfwd.h"
+#include "../sdp-utils.h"
+#include "../utils.h"
+#include "../plugins/plugin.h"
+
+int janus_log_level = LOG_ERR;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+int refcount_debug = 0;
+
+static volatile gint bench_stop = 0;
+static void bench_handle_signal(int signum) {
+	g_atomic_int_set(&bench_stop, 1);
+}
+
+/* Monotonic time in nanoseconds: microseconds are too coarse for the latency of synchronous relays */
+#define BENCH_NSEC_PER_SEC	G_GINT64_CONSTANT(1000000000)
+static gint64 bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec * BENCH_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* Traces: each trace is a single RTP stream, and is mapped to an m-line */
+typedef struct bench_packet {
+	char *data;
+	int len;
+	/* Time of the packet, in us since the beginning of the trace */
+	gint64 when;
+} bench_packet;
+
+typedef struct bench_trace {
+	janus_sdp_mtype type;
+	const char *codec;
+	int pt;
+	char *source;
+	bench_packet *packets;
+	guint count, size;
+	gint64 duration;
+	/* How much sequence numbers and timestamps move forward at each loop */
+	guint16 seq_span;
+	guint32 ts_span;
+} bench_trace;
+
+static bench_trace bench_traces[2];
+static int bench_num_traces = 0;
+
+static void bench_trace_add(bench_trace *trace, const char *data, int len, gint64 when) {
+	if(trace->count == trace->size) {
+		trace->size = trace->size ? trace->size*2 : 1024;
+		trace->packets = g_realloc(trace->packets, trace->size * sizeof(bench_packet));
+	}
+	/* Make sure time never goes backwards */
+	if(trace->count > 0 && when < trace->packets[trace->count-1].when)
+		when = trace->packets[trace->count-1].when;
+	bench_packet *p = &trace->packets[trace->count];
+	p->data = g_malloc(len);
+	memcpy(p->data, data, len);
+	p->len = len;
+	p->when = when;
+	trace->count++;
+	trace->duration = when;
+}
+
+static void bench_trace_clear(bench_trace *trace) {
+	guint i = 0;
+	for(i=0; i<trace->count; i++)
+		g_free(trace->packets[i].data);
+	g_free(trace->packets);
+	g_free(trace->source);
+	memset(trace, 0, sizeof(*trace));
+}
+
+/* Janus recordings (only version 2, which is what recent versions of Janus write) */
+static int bench_trace_load_mjr(bench_trace *trace, const char *filename) {
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL) {
+		fprintf(stderr, "Couldn't open %s\n", filename);
+		return -1;
+	}
+	char header[8], buffer[65536];
+	uint16_t len = 0;
+	if(fread(header, 1, 8, file) != 8 || memcmp(header, "MJR00002", 8) ||
+			fread(&len, sizeof(uint16_t), 1, file) != 1 ||
+			fread(buffer, 1, ntohs(len), file) != ntohs(len)) {
+		fprintf(stderr, "Not a supported .mjr file: %s\n", filename);
+		fclose(file);
+		return -1;
+	}
+	buffer[ntohs(len)] = '\0';
+	json_error_t error;
+	json_t *info = json_loads(buffer, 0, &error);
+	const char *type = json_string_value(json_object_get(info, "t"));
+	const char *codec = json_string_value(json_object_get(info, "c"));
+	if(type == NULL || codec == NULL || (*type != 'a' && *type != 'v')) {
+		fprintf(stderr, "Unsupported recording (not audio or video): %s\n", filename);
+		json_decref(info);
+		fclose(file);
+		return -1;
+	}
+	trace->type = (*type == 'a') ? JANUS_SDP_AUDIO : JANUS_SDP_VIDEO;
+	trace->codec = janus_sdp_match_preferred_codec(trace->type, (char *)codec);
+	json_decref(info);
+	if(trace->codec == NULL) {
+		fprintf(stderr, "Unsupported codec %s: %s\n", codec, filename);
+		fclose(file);
+		return -1;
+	}
+	/* Each frame has a fixed header (MEET), a timestamp in ms and a length */
+	uint32_t ts = 0;
+	while(fread(header, 1, 4, file) == 4 && !memcmp(header, "MEET", 4)) {
+		if(fread(&ts, sizeof(uint32_t), 1, file) != 1 || fread(&len, sizeof(uint16_t), 1, file) != 1)
+			break;
+		len = ntohs(len);
+		if(fread(buffer, 1, len, file) != len)
+			break;
+		if(len >= 12 && janus_is_rtp(buffer, len)) {
+			if(trace->count == 0)
+				trace->pt = ((janus_rtp_header *)buffer)->type;
+			bench_trace_add(trace, buffer, len, (gint64)ntohl(ts) * 1000);
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+/* pcap captures: we only keep the RTP packets with the payload type we
+ * were told about, from the first SSRC that uses it (captures made by
+ * Janus, for instance, contain both incoming and outgoing packets) */
+typedef struct bench_pcap_header {
+	guint32 magic;
+	guint16 major, minor;
+	gint32 zone;
+	guint32 sigfigs, snaplen, network;
+} bench_pcap_header;
+typedef struct bench_pcap_record {
+	guint32 ts_sec, ts_frac, incl_len, orig_len;
+} bench_pcap_record;
+
+static int bench_trace_load_pcap(bench_trace *trace, const char *filename, int pt, int port) {
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL) {
+		fprintf(stderr, "Couldn't open %s\n", filename);
+		return -1;
+	}
+	bench_pcap_header header;
+	if(fread(&header, sizeof(header), 1, file) != 1) {
+		fprintf(stderr, "Not a pcap file: %s\n", filename);
+		fclose(file);
+		return -1;
+	}
+	gboolean swap = FALSE, nsec = FALSE;
+	if(header.magic == 0xa1b2c3d4 || header.magic == 0xa1b23c4d) {
+		nsec = (header.magic == 0xa1b23c4d);
+	} else if(header.magic == 0xd4c3b2a1 || header.magic == 0x4d3cb2a1) {
+		swap = TRUE;
+		nsec = (header.magic == 0x4d3cb2a1);
+		header.network = GUINT32_SWAP_LE_BE(header.network);
+	} else {
+		fprintf(stderr, "Not a pcap file (pcapng is not supported): %s\n", filename);
+		fclose(file);
+		return -1;
+	}
+	char buffer[65536];
+	bench_pcap_record record;
+	gint64 first = -1;
+	guint32 ssrc = 0;
+	while(fread(&record, sizeof(record), 1, file) == 1) {
+		if(swap) {
+			record.ts_sec = GUINT32_SWAP_LE_BE(record.ts_sec);
+			record.ts_frac = GUINT32_SWAP_LE_BE(record.ts_frac);
+			record.incl_len = GUINT32_SWAP_LE_BE(record.incl_len);
+		}
+		if(record.incl_len > sizeof(buffer) || fread(buffer, 1, record.incl_len, file) != record.incl_len)
+			break;
+		/* Get rid of the link layer */
+		int offset = 0, len = record.incl_len, ipv = 0;
+		if(header.network == 1) {
+			/* Ethernet (possibly with a VLAN tag) */
+			offset = 12;
+			if(len >= offset+4 && buffer[offset] == (char)0x81 && buffer[offset+1] == 0x00)
+				offset += 4;
+			if(len < offset+2)
+				continue;
+			guint16 ethertype = ((guint8)buffer[offset] << 8) | (guint8)buffer[offset+1];
+			offset += 2;
+			ipv = ethertype == 0x0800 ? 4 : (ethertype == 0x86DD ? 6 : 0);
+		} else if(header.network == 113) {
+			/* Linux cooked capture */
+			if(len < 16)
+				continue;
+			guint16 protocol = ((guint8)buffer[14] << 8) | (guint8)buffer[15];
+			offset = 16;
+			ipv = protocol == 0x0800 ? 4 : (protocol == 0x86DD ? 6 : 0);
+		} else if(header.network == 0) {
+			/* BSD loopback */
+			offset = 4;
+			ipv = len > offset ? ((guint8)buffer[offset] >> 4) : 0;
+		} else if(header.network == 101 || header.network == 228 || header.network == 229) {
+			/* Raw IP */
+			ipv = len > 0 ? ((guint8)buffer[0] >> 4) : 0;
+		} else {
+			fprintf(stderr, "Unsupported link type %"SCNu32": %s\n", header.network, filename);
+			break;
+		}
+		/* Now get rid of IP and UDP */
+		if(ipv == 4 && len >= offset+20 && buffer[offset+9] == 17) {
+			offset += ((guint8)buffer[offset] & 0x0F) * 4;
+		} else if(ipv == 6 && len >= offset+40 && buffer[offset+6] == 17) {
+			offset += 40;
+		} else {
+			continue;
+		}
+		if(len < offset+8)
+			continue;
+		guint16 dport = ((guint8)buffer[offset+2] << 8) | (guint8)buffer[offset+3];
+		offset += 8;
+		if(port > 0 && dport != port)
+			continue;
+		char *rtp = buffer + offset;
+		len -= offset;
+		if(len < 12 || !janus_is_rtp(rtp, len))
+			continue;
+		janus_rtp_header *rtp_header = (janus_rtp_header *)rtp;
+		if(rtp_header->type != pt)
+			continue;
+		if(ssrc == 0)
+			ssrc = ntohl(rtp_header->ssrc);
+		if(ntohl(rtp_header->ssrc) != ssrc)
+			continue;
+		gint64 when = (gint64)record.ts_sec * G_USEC_PER_SEC + (nsec ? record.ts_frac/1000 : record.ts_frac);
+		if(first < 0)
+			first = when;
+		bench_trace_add(trace, rtp, len, when - first);
+	}
+	fclose(file);
+	trace->pt = pt;
+	return 0;
+}
+
+/* Synthetic traces, for when no capture is provided */
+static int bench_rtp_header(char *buf, uint16_t seq, uint32_t ts, int pt, gboolean marker) {
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	memset(rtp, 0, 12);
+	rtp->version = 2;
+	rtp->markerbit = marker;
+	rtp->type = pt;
+	rtp->seq_number = htons(seq);
+	rtp->timestamp = htonl(ts);
+	rtp->ssrc = htonl(1);
+	return 12;
+}
+
+/* Opus at 20ms (the payload is random CELT data, which the decoder accepts) */
+static void bench_trace_synthetic_opus(bench_trace *trace, int seconds) {
+	char buf[12+80];
+	uint32_t seed = 1;
+	int i = 0, j = 0;
+	trace->type = JANUS_SDP_AUDIO;
+	trace->codec = "opus";
+	trace->pt = 111;
+	trace->source = g_strdup("synthetic");
+	for(i=0; i<seconds*50; i++) {
+		int hlen = bench_rtp_header(buf, i, i*960, trace->pt, FALSE);
+		buf[hlen] = 0xF8;	/* TOC: CELT, fullband, 20ms, one frame */
+		for(j=hlen+1; j<(int)sizeof(buf); j++) {
+			seed = seed * 1103515245 + 12345;
+			buf[j] = (seed >> 16) & 0xFF;
+		}
+		bench_trace_add(trace, buf, sizeof(buf), (gint64)i * 20000);
+	}
+}
+
+/* VP8 at 30fps and roughly 1Mbps, with a keyframe every 100 frames */
+static void bench_trace_synthetic_vp8(bench_trace *trace, int seconds) {
+	char buf[12+1+1100];
+	uint16_t seq = 0;
+	int frame = 0;
+	trace->type = JANUS_SDP_VIDEO;
+	trace->codec = "vp8";
+	trace->pt = 96;
+	trace->source = g_strdup("synthetic");
+	for(frame=0; frame<seconds*30; frame++) {
+		gboolean keyframe = (frame % 100 == 0);
+		int size = keyframe ? 30000 : 3800, offset = 0;
+		while(offset < size) {
+			int plen = MIN(1100, size - offset);
+			int hlen = bench_rtp_header(buf, seq++, frame*3000, trace->pt, offset + plen == size);
+			buf[hlen] = (offset == 0) ? 0x10 : 0x00;	/* S bit */
+			char *payload = buf + hlen + 1;
+			memset(payload, 0x5A, plen);
+			if(offset == 0) {
+				payload[0] = keyframe ? 0x10 : 0x11;	/* P bit */
+				if(keyframe) {
+					payload[3] = 0x9d;
+					payload[4] = 0x01;
+					payload[5] = 0x2a;
+					payload[6] = 0x80;
+					payload[7] = 0x02;
+					payload[8] = 0x68;
+					payload[9] = 0x01;
+				}
+			}
+			bench_trace_add(trace, buf, hlen + 1 + plen, (gint64)frame * G_USEC_PER_SEC / 30);
+			offset += plen;
+		}
+	}
+}
+
+/* Schedule of the packets to replay, with all traces merged in time order */
+typedef struct bench_item {
+	int trace;
+	guint packet;
+} bench_item;
+static bench_item *bench_schedule = NULL;
+static guint bench_schedule_count = 0;
+static gint64 bench_loop_span = 0;
+
+static void bench_schedule_prepare(void) {
+	guint total = 0, next[2] = { 0, 0 };
+	int t = 0;
+	bench_loop_span = 0;
+	for(t=0; t<bench_num_traces; t++) {
+		total += bench_traces[t].count;
+		if(bench_traces[t].duration > bench_loop_span)
+			bench_loop_span = bench_traces[t].duration;
+	}
+	/* Leave a small gap between loops, and move RTP forward accordingly */
+	bench_loop_span += 20000;
+	for(t=0; t<bench_num_traces; t++) {
+		bench_trace *trace = &bench_traces[t];
+		janus_rtp_header *first = (janus_rtp_header *)trace->packets[0].data;
+		janus_rtp_header *last = (janus_rtp_header *)trace->packets[trace->count-1].data;
+		trace->seq_span = ntohs(last->seq_number) - ntohs(first->seq_number) + 1;
+		guint32 ts_diff = ntohl(last->timestamp) - ntohl(first->timestamp);
+		trace->ts_span = trace->duration > 0 ? (guint32)((double)ts_diff * bench_loop_span / trace->duration) : ts_diff;
+	}
+	bench_schedule = g_malloc(total * sizeof(bench_item));
+	bench_schedule_count = 0;
+	while(bench_schedule_count < total) {
+		int pick = -1;
+		for(t=0; t<bench_num_traces; t++) {
+			if(next[t] < bench_traces[t].count && (pick < 0 ||
+					bench_traces[t].packets[next[t]].when < bench_traces[pick].packets[next[pick]].when))
+				pick = t;
+		}
+		bench_schedule[bench_schedule_count].trace = pick;
+		bench_schedule[bench_schedule_count].packet = next[pick];
+		bench_schedule_count++;
+		next[pick]++;
+	}
+}
+
+
+/* Latency stamps: the last bytes of the payload of each packet we feed
+ * are replaced with a magic and the time the packet was handed to the
+ * plugin, which we look for in the packets the plugin relays back */
+#define BENCH_STAMP_MAGIC	"JbRp"
+#define BENCH_STAMP_SIZE	12
+#define BENCH_STAMP_MIN_PAYLOAD	32
+#define BENCH_MAX_SAMPLES	(1 << 22)
+static gboolean bench_stamping = TRUE;
+static guint32 *bench_samples = NULL;
+static volatile guint bench_samples_count = 0;
+
+static void bench_stamp(char *buf, int len) {
+	int plen = 0;
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	if(rtp->padding || janus_rtp_payload(buf, len, &plen) == NULL || plen < BENCH_STAMP_MIN_PAYLOAD)
+		return;
+	char *stamp = buf + len - BENCH_STAMP_SIZE;
+	gint64 now = bench_now();
+	memcpy(stamp, BENCH_STAMP_MAGIC, 4);
+	memcpy(stamp + 4, &now, sizeof(now));
+}
+
+static void bench_stamp_check(char *buf, int len) {
+	if(len < 12 + BENCH_STAMP_MIN_PAYLOAD)
+		return;
+	char *stamp = buf + len - BENCH_STAMP_SIZE;
+	if(memcmp(stamp, BENCH_STAMP_MAGIC, 4))
+		return;
+	gint64 sent = 0;
+	memcpy(&sent, stamp + 4, sizeof(sent));
+	gint64 latency = bench_now() - sent;
+	if(latency < 0)
+		return;
+	guint index = __atomic_fetch_add(&bench_samples_count, 1, __ATOMIC_RELAXED);
+	if(index < BENCH_MAX_SAMPLES)
+		bench_samples[index] = latency > G_MAXUINT32 ? G_MAXUINT32 : (guint32)latency;
+}
+
+
+/* Counters */
+static volatile guint64 bench_packets_in = 0, bench_rtcp_in = 0,
+	bench_packets_out = 0, bench_bytes_out = 0, bench_rtcp_out = 0,
+	bench_plis = 0, bench_rembs = 0, bench_events = 0;
+static volatile gint64 bench_last_relay = 0;
+
+
+/* Peers: we pass the plugin a janus_plugin_session for each of them, as the core would */
+typedef struct bench_peer {
+	janus_plugin_session handle;
+	int index;
+	gboolean publisher;
+	gboolean attached;
+	/* VideoRoom publisher ID */
+	guint64 id;
+	/* Streaming mountpoint ports, one per trace */
+	int ports[2];
+	/* m-lines we send feedback for (subscribers only) */
+	GArray *video_mlines;
+	/* Responses and events pushed by the plugin, while we're negotiating */
+	GAsyncQueue *events;
+	volatile guint64 relayed;
+	GThread *thread;
+} bench_peer;
+
+typedef struct bench_event {
+	char *transaction;
+	json_t *event, *jsep;
+} bench_event;
+
+static void bench_event_free(bench_event *event) {
+	if(event == NULL)
+		return;
+	g_free(event->transaction);
+	json_decref(event->event);
+	if(event->jsep)
+		json_decref(event->jsep);
+	g_free(event);
+}
+
+static void bench_peer_handle_free(const janus_refcount *handle_ref) {
+	/* Peers are freed when the benchmark ends, after the plugin is gone */
+}
+
+static janus_plugin *bench_plugin = NULL;
+static bench_peer *bench_control = NULL;
+static bench_peer **bench_publishers = NULL, **bench_subscribers = NULL;
+static int bench_num_publishers = 4, bench_num_subscribers = 10;
+/* We only keep track of events while negotiating */
+static volatile gint bench_negotiating = 1;
+
+static bench_peer *bench_peer_create(int index, gboolean publisher, gboolean attach) {
+	bench_peer *peer = g_malloc0(sizeof(bench_peer));
+	peer->index = index;
+	peer->publisher = publisher;
+	peer->handle.gateway_handle = peer;
+	janus_refcount_init(&peer->handle.ref, bench_peer_handle_free);
+	peer->video_mlines = g_array_new(FALSE, FALSE, sizeof(int));
+	peer->events = g_async_queue_new_full((GDestroyNotify)bench_event_free);
+	if(attach) {
+		int error = 0;
+		bench_plugin->create_session(&peer->handle, &error);
+		if(error) {
+			fprintf(stderr, "Error creating plugin session: %d\n", error);
+			g_async_queue_unref(peer->events);
+			g_array_free(peer->video_mlines, TRUE);
+			g_free(peer);
+			return NULL;
+		}
+		peer->attached = TRUE;
+	}
+	return peer;
+}
+
+static void bench_peer_destroy(bench_peer *peer) {
+	if(peer == NULL)
+		return;
+	if(peer->attached) {
+		int error = 0;
+		bench_plugin->hangup_media(&peer->handle);
+		g_atomic_int_set(&peer->handle.stopped, 1);
+		bench_plugin->destroy_session(&peer->handle, &error);
+		peer->attached = FALSE;
+	}
+}
+
+static void bench_peer_free(bench_peer *peer) {
+	if(peer == NULL)
+		return;
+	g_async_queue_unref(peer->events);
+	g_array_free(peer->video_mlines, TRUE);
+	g_free(peer);
+}
+
+
+/* Fake core callbacks */
+static int bench_push_event(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep) {
+	if(handle == NULL || message == NULL)
+		return -1;
+	__atomic_add_fetch(&bench_events, 1, __ATOMIC_RELAXED);
+	if(!g_atomic_int_get(&bench_negotiating))
+		return 0;
+	bench_peer *peer = (bench_peer *)handle->gateway_handle;
+	bench_event *event = g_malloc0(sizeof(bench_event));
+	event->transaction = g_strdup(transaction);
+	event->event = json_incref(message);
+	event->jsep = jsep ? json_incref(jsep) : NULL;
+	g_async_queue_push(peer->events, event);
+	return 0;
+}
+static int bench_push_event_payload(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, janus_json_payload *payload, json_t *jsep) {
+	if(payload == NULL)
+		return -1;
+	return bench_push_event(handle, plugin, transaction, payload->json, jsep);
+}
+static void bench_relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet) {
+	if(handle == NULL || packet == NULL || packet->buffer == NULL)
+		return;
+	bench_peer *peer = (bench_peer *)handle->gateway_handle;
+	__atomic_add_fetch(&peer->relayed, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&bench_packets_out, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&bench_bytes_out, packet->length, __ATOMIC_RELAXED);
+	if(bench_stamping)
+		bench_stamp_check(packet->buffer, packet->length);
+	__atomic_store_n(&bench_last_relay, bench_now(), __ATOMIC_RELAXED);
+}
+static void bench_relay_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet) {
+	__atomic_add_fetch(&bench_rtcp_out, 1, __ATOMIC_RELAXED);
+}
+static void bench_relay_data(janus_plugin_session *handle, janus_plugin_data *packet) {
+}
+static void bench_send_pli(janus_plugin_session *handle) {
+	__atomic_add_fetch(&bench_plis, 1, __ATOMIC_RELAXED);
+}
+static void bench_send_pli_stream(janus_plugin_session *handle, int mindex) {
+	__atomic_add_fetch(&bench_plis, 1, __ATOMIC_RELAXED);
+}
+static void bench_send_remb(janus_plugin_session *handle, guint32 bitrate) {
+	__atomic_add_fetch(&bench_rembs, 1, __ATOMIC_RELAXED);
+}
+static void bench_close_pc(janus_plugin_session *handle) {
+}
+static void bench_end_session(janus_plugin_session *handle) {
+}
+static gboolean bench_events_is_enabled(void) {
+	return FALSE;
+}
+static void bench_notify_event(janus_plugin *plugin, janus_plugin_session *handle, json_t *event) {
+	json_decref(event);
+}
+static gboolean bench_auth_is_signed(void) {
+	return FALSE;
+}
+static gboolean bench_auth_is_signature_valid(janus_plugin *plugin, const char *token) {
+	return FALSE;
+}
+static gboolean bench_auth_signature_contains(janus_plugin *plugin, const char *token, const char *descriptor) {
+	return FALSE;
+}
+static gboolean bench_inherit_affinity(janus_plugin_session *handle) {
+	return FALSE;
+}
+
+static janus_callbacks bench_callbacks =
+	{
+		.push_event = bench_push_event,
+		.relay_rtp = bench_relay_rtp,
+		.relay_rtcp = bench_relay_rtcp,
+		.relay_data = bench_relay_data,
+		.send_pli = bench_send_pli,
+		.send_pli_stream = bench_send_pli_stream,
+		.send_remb = bench_send_remb,
+		.close_pc = bench_close_pc,
+		.end_session = bench_end_session,
+		.events_is_enabled = bench_events_is_enabled,
+		.notify_event = bench_notify_event,
+		.auth_is_signed = bench_auth_is_signed,
+		.auth_is_signature_valid = bench_auth_is_signature_valid,
+		.auth_signature_contains = bench_auth_signature_contains,
+		.inherit_affinity = bench_inherit_affinity,
+		.push_event_payload = bench_push_event_payload,
+	};
+
+
+/* Negotiation helpers */
+#define BENCH_ROOM	4242
+#define BENCH_MOUNTPOINT	4242
+#define BENCH_TIMEOUT	(10*G_USEC_PER_SEC)
+
+/* Send a request, and wait for the response, whether it's synchronous or not */
+static json_t *bench_request(bench_peer *peer, json_t *message, const char *sdp_type, const char *sdp, json_t **jsep) {
+	static volatile gint transactions = 0;
+	char transaction[32];
+	g_snprintf(transaction, sizeof(transaction), "bench-%d", g_atomic_int_add(&transactions, 1));
+	json_t *body_jsep = sdp ? json_pack("{ssss}", "type", sdp_type, "sdp", sdp) : NULL;
+	const char *request = json_string_value(json_object_get(message, "request"));
+	char *what = g_strdup(request ? request : "??");
+	json_t *response = NULL;
+	janus_plugin_result *result = bench_plugin->handle_message(&peer->handle, g_strdup(transaction), message, body_jsep);
+	if(result == NULL) {
+		fprintf(stderr, "No result for '%s' request\n", what);
+	} else if(result->type == JANUS_PLUGIN_ERROR) {
+		fprintf(stderr, "Error handling '%s' request: %s\n", what, result->text ? result->text : "??");
+	} else if(result->type == JANUS_PLUGIN_OK) {
+		response = result->content ? json_incref(result->content) : NULL;
+	} else {
+		/* Wait for the event with the same transaction */
+		while(response == NULL) {
+			bench_event *event = g_async_queue_timeout_pop(peer->events, BENCH_TIMEOUT);
+			if(event == NULL) {
+				fprintf(stderr, "Timeout waiting for a response to '%s' request\n", what);
+				break;
+			}
+			if(event->transaction && !strcmp(event->transaction, transaction)) {
+				response = json_incref(event->event);
+				if(jsep && event->jsep)
+					*jsep = json_incref(event->jsep);
+			}
+			bench_event_free(event);
+		}
+	}
+	if(result != NULL)
+		janus_plugin_result_destroy(result);
+	if(response != NULL && json_object_get(response, "error_code") != NULL) {
+		fprintf(stderr, "Error handling '%s' request: %s\n", what,
+			json_string_value(json_object_get(response, "error")));
+		json_decref(response);
+		response = NULL;
+		if(jsep && *jsep) {
+			json_decref(*jsep);
+			*jsep = NULL;
+		}
+	}
+	g_free(what);
+	return response;
+}
+
+/* Offer the traces as m-lines, in the same order */
+static char *bench_offer(janus_sdp_mdirection direction) {
+	janus_sdp *offer = janus_sdp_generate_offer("Janus bench", "127.0.0.1", JANUS_SDP_OA_DONE);
+	int t = 0;
+	for(t=0; t<bench_num_traces; t++) {
+		char mid[4];
+		g_snprintf(mid, sizeof(mid), "%d", t);
+		janus_sdp_generate_offer_mline(offer,
+			JANUS_SDP_OA_MLINE, bench_traces[t].type,
+				JANUS_SDP_OA_MID, mid,
+				JANUS_SDP_OA_PT, bench_traces[t].pt,
+				JANUS_SDP_OA_CODEC, bench_traces[t].codec,
+				JANUS_SDP_OA_DIRECTION, direction,
+			JANUS_SDP_OA_DONE);
+	}
+	char *sdp = janus_sdp_write(offer);
+	janus_sdp_destroy(offer);
+	return sdp;
+}
+
+/* Accept all the media the plugin offered us, and take note of the video m-lines */
+static char *bench_answer(bench_peer *peer, json_t *jsep) {
+	const char *sdp = json_string_value(json_object_get(jsep, "sdp"));
+	char error[200];
+	janus_sdp *offer = sdp ? janus_sdp_parse(sdp, error, sizeof(error)) : NULL;
+	if(offer == NULL) {
+		fprintf(stderr, "Invalid offer from the plugin: %s\n", sdp ? error : "no SDP");
+		return NULL;
+	}
+	janus_sdp *answer = janus_sdp_generate_answer(offer);
+	GList *temp = offer->m_lines;
+	while(temp) {
+		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
+		if((m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO) && m->port > 0) {
+			janus_sdp_generate_answer_mline(offer, answer, m,
+				JANUS_SDP_OA_MLINE, m->type,
+					JANUS_SDP_OA_DIRECTION, JANUS_SDP_RECVONLY,
+				JANUS_SDP_OA_DONE);
+			if(m->type == JANUS_SDP_VIDEO)
+				g_array_append_val(peer->video_mlines, m->index);
+		}
+		temp = temp->next;
+	}
+	char *result = janus_sdp_write(answer);
+	janus_sdp_destroy(answer);
+	janus_sdp_destroy(offer);
+	return result;
+}
+
+/* Complete a subscription the plugin sent us an offer for */
+static int bench_subscribe(bench_peer *peer, json_t *jsep) {
+	char *answer = bench_answer(peer, jsep);
+	if(answer == NULL)
+		return -1;
+	json_t *response = bench_request(peer, json_pack("{ss}", "request", "start"), "answer", answer, NULL);
+	g_free(answer);
+	if(response == NULL)
+		return -1;
+	json_decref(response);
+	bench_plugin->setup_media(&peer->handle);
+	return 0;
+}
+
+/* Join a room (VideoRoom or AudioBridge) as an active participant */
+static int bench_join(bench_peer *peer, json_t *message, janus_sdp_mdirection direction) {
+	char *offer = bench_offer(direction);
+	json_t *jsep = NULL;
+	json_t *response = bench_request(peer, message, "offer", offer, &jsep);
+	g_free(offer);
+	if(response == NULL || jsep == NULL) {
+		if(response != NULL) {
+			fprintf(stderr, "No answer from the plugin\n");
+			json_decref(response);
+		}
+		return -1;
+	}
+	peer->id = json_integer_value(json_object_get(response, "id"));
+	json_decref(response);
+	json_decref(jsep);
+	bench_plugin->setup_media(&peer->handle);
+	return 0;
+}
+
+
+/* Scenarios */
+typedef enum bench_scenario {
+	bench_scenario_videoroom = 0,
+	bench_scenario_streaming,
+	bench_scenario_audiobridge
+} bench_scenario;
+static bench_scenario bench_type = bench_scenario_videoroom;
+static int bench_port = 20000;
+
+static int bench_setup_videoroom(void) {
+	json_t *create = json_pack("{sssIsi}", "request", "create", "room", (json_int_t)BENCH_ROOM,
+		"publishers", bench_num_publishers);
+	int t = 0;
+	for(t=0; t<bench_num_traces; t++) {
+		json_object_set_new(create, bench_traces[t].type == JANUS_SDP_AUDIO ? "audiocodec" : "videocodec",
+			json_string(bench_traces[t].codec));
+	}
+	json_t *response = bench_request(bench_control, create, NULL, NULL, NULL);
+	if(response == NULL)
+		return -1;
+	json_decref(response);
+	int i = 0;
+	for(i=0; i<bench_num_publishers; i++) {
+		json_t *join = json_pack("{sssIssss}", "request", "joinandconfigure", "room", (json_int_t)BENCH_ROOM,
+			"ptype", "publisher", "display", "bench");
+		if(bench_join(bench_publishers[i], join, JANUS_SDP_SENDONLY) < 0)
+			return -1;
+	}
+	for(i=0; i<bench_num_subscribers; i++) {
+		json_t *streams = json_array();
+		int j = 0;
+		for(j=0; j<bench_num_publishers; j++)
+			json_array_append_new(streams, json_pack("{sI}", "feed", (json_int_t)bench_publishers[j]->id));
+		json_t *join = json_pack("{sssIssso}", "request", "join", "room", (json_int_t)BENCH_ROOM,
+			"ptype", "subscriber", "streams", streams);
+		json_t *jsep = NULL;
+		response = bench_request(bench_subscribers[i], join, NULL, NULL, &jsep);
+		if(response == NULL || jsep == NULL) {
+			if(response != NULL)
+				json_decref(response);
+			return -1;
+		}
+		json_decref(response);
+		int res = bench_subscribe(bench_subscribers[i], jsep);
+		json_decref(jsep);
+		if(res < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int bench_setup_streaming(void) {
+	int i = 0, t = 0;
+	for(i=0; i<bench_num_publishers; i++) {
+		json_t *media = json_array();
+		for(t=0; t<bench_num_traces; t++) {
+			bench_publishers[i]->ports[t] = bench_port + 2*(i*bench_num_traces + t);
+			json_array_append_new(media, json_pack("{sssssisiss}",
+				"type", bench_traces[t].type == JANUS_SDP_AUDIO ? "audio" : "video",
+				"mid", bench_traces[t].type == JANUS_SDP_AUDIO ? "a" : "v",
+				"port", bench_publishers[i]->ports[t],
+				"pt", bench_traces[t].pt,
+				"codec", bench_traces[t].codec));
+		}
+		json_t *create = json_pack("{sssssIso}", "request", "create", "type", "rtp",
+			"id", (json_int_t)(BENCH_MOUNTPOINT + i), "media", media);
+		json_t *response = bench_request(bench_control, create, NULL, NULL, NULL);
+		if(response == NULL)
+			return -1;
+		json_decref(response);
+	}
+	for(i=0; i<bench_num_subscribers; i++) {
+		json_t *watch = json_pack("{sssI}", "request", "watch",
+			"id", (json_int_t)(BENCH_MOUNTPOINT + (i % bench_num_publishers)));
+		json_t *jsep = NULL;
+		json_t *response = bench_request(bench_subscribers[i], watch, NULL, NULL, &jsep);
+		if(response == NULL || jsep == NULL) {
+			if(response != NULL)
+				json_decref(response);
+			return -1;
+		}
+		json_decref(response);
+		int res = bench_subscribe(bench_subscribers[i], jsep);
+		json_decref(jsep);
+		if(res < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int bench_setup_audiobridge(void) {
+	json_t *create = json_pack("{sssIsi}", "request", "create", "room", (json_int_t)BENCH_ROOM,
+		"sampling_rate", 48000);
+	json_t *response = bench_request(bench_control, create, NULL, NULL, NULL);
+	if(response == NULL)
+		return -1;
+	json_decref(response);
+	int i = 0;
+	for(i=0; i<bench_num_publishers; i++) {
+		json_t *join = json_pack("{sssIss}", "request", "join", "room", (json_int_t)BENCH_ROOM,
+			"display", "bench");
+		if(bench_join(bench_publishers[i], join, JANUS_SDP_SENDRECV) < 0)
+			return -1;
+	}
+	for(i=0; i<bench_num_subscribers; i++) {
+		json_t *join = json_pack("{sssIsssb}", "request", "join", "room", (json_int_t)BENCH_ROOM,
+			"display", "bench", "muted", TRUE);
+		if(bench_join(bench_subscribers[i], join, JANUS_SDP_SENDRECV) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+/* Replay */
+static double bench_speed = 10.0;
+static int bench_loops = 1;
+static gint64 bench_start = 0;
+
+/* Sender report for the stream mapped to this m-line, so that the plugin gets some RTCP too */
+static void bench_send_sr(bench_peer *peer, int mindex, char *rtp, guint32 packets, guint32 octets) {
+	char buf[28];
+	memset(buf, 0, sizeof(buf));
+	janus_rtcp_sr *sr = (janus_rtcp_sr *)buf;
+	sr->header.version = 2;
+	sr->header.type = RTCP_SR;
+	sr->header.length = htons(sizeof(buf)/4 - 1);
+	sr->ssrc = ((janus_rtp_header *)rtp)->ssrc;
+	gint64 now = janus_get_real_time();
+	sr->si.ntp_ts_msw = htonl(now/G_USEC_PER_SEC + 2208988800u);
+	sr->si.ntp_ts_lsw = htonl((guint32)((double)(now % G_USEC_PER_SEC) * 4294.967296));
+	sr->si.rtp_ts = ((janus_rtp_header *)rtp)->timestamp;
+	sr->si.s_packets = htonl(packets);
+	sr->si.s_octets = htonl(octets);
+	janus_plugin_rtcp rtcp = { .mindex = mindex, .video = bench_traces[mindex].type == JANUS_SDP_VIDEO,
+		.buffer = buf, .length = sizeof(buf) };
+	bench_plugin->incoming_rtcp(&peer->handle, &rtcp);
+	__atomic_add_fetch(&bench_rtcp_in, 1, __ATOMIC_RELAXED);
+}
+
+static void *bench_feeder_thread(void *data) {
+	bench_peer *peer = (bench_peer *)data;
+	char buffer[1500];
+	int fd = -1;
+	struct sockaddr_in addr;
+	if(bench_type == bench_scenario_streaming) {
+		fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+	/* Publishers don't all send their packets at the very same time */
+	gint64 offset = (gint64)((peer->index * 7919) % 20000) * 1000;
+	guint32 packets[2] = { 0, 0 }, octets[2] = { 0, 0 };
+	gint64 sr_next[2] = { 0, 0 };
+	int loop = 0;
+	guint i = 0;
+	gint64 now = bench_now();
+	if(bench_start > now)
+		g_usleep((bench_start - now) / 1000);
+	for(loop=0; loop<bench_loops && !g_atomic_int_get(&bench_stop); loop++) {
+		for(i=0; i<bench_schedule_count && !g_atomic_int_get(&bench_stop); i++) {
+			int t = bench_schedule[i].trace;
+			bench_trace *trace = &bench_traces[t];
+			bench_packet *p = &trace->packets[bench_schedule[i].packet];
+			if(p->len > (int)sizeof(buffer))
+				continue;
+			gint64 media_time = loop*bench_loop_span + p->when;
+			if(bench_speed > 0) {
+				gint64 when = bench_start + offset + (gint64)(media_time * 1000 / bench_speed);
+				now = bench_now();
+				if(when - now > 100000)
+					g_usleep((when - now) / 1000);
+			}
+			/* Each publisher gets its own SSRCs, and RTP keeps going forward when we loop */
+			memcpy(buffer, p->data, p->len);
+			janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+			rtp->ssrc = htonl(0x42000000 + peer->index*16 + t);
+			rtp->seq_number = htons(ntohs(rtp->seq_number) + loop*trace->seq_span);
+			rtp->timestamp = htonl(ntohl(rtp->timestamp) + loop*trace->ts_span);
+			if(bench_stamping)
+				bench_stamp(buffer, p->len);
+			if(fd >= 0) {
+				addr.sin_port = htons(peer->ports[t]);
+				if(sendto(fd, buffer, p->len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+					continue;
+			} else {
+				janus_plugin_rtp packet = { .mindex = t, .video = trace->type == JANUS_SDP_VIDEO,
+					.buffer = buffer, .length = p->len };
+				janus_plugin_rtp_extensions_reset(&packet.extensions);
+				bench_plugin->incoming_rtp(&peer->handle, &packet);
+			}
+			__atomic_add_fetch(&bench_packets_in, 1, __ATOMIC_RELAXED);
+			packets[t]++;
+			octets[t] += p->len - 12;
+			if(fd < 0 && media_time >= sr_next[t]) {
+				bench_send_sr(peer, t, buffer, packets[t], octets[t]);
+				sr_next[t] = media_time + G_USEC_PER_SEC;
+			}
+		}
+	}
+	if(fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/* Subscribers send a receiver report and REMB every second, for each video m-line */
+static volatile gint bench_feeding = 0;
+static void *bench_feedback_thread(void *data) {
+	char buf[32];
+	gint64 interval = bench_speed > 0 ? (gint64)(G_USEC_PER_SEC / bench_speed) : 100000;
+	while(g_atomic_int_get(&bench_feeding) && !g_atomic_int_get(&bench_stop)) {
+		int i = 0;
+		guint m = 0;
+		for(i=0; i<bench_num_subscribers; i++) {
+			bench_peer *peer = bench_subscribers[i];
+			for(m=0; m<peer->video_mlines->len; m++) {
+				memset(buf, 0, 8);
+				janus_rtcp_rr *rr = (janus_rtcp_rr *)buf;
+				rr->header.version = 2;
+				rr->header.type = RTCP_RR;
+				rr->header.length = htons(1);
+				rr->ssrc = htonl(0x43000000 + i);
+				int len = janus_rtcp_remb(buf + 8, sizeof(buf) - 8, 2000000);
+				if(len < 0)
+					continue;
+				janus_plugin_rtcp rtcp = { .mindex = g_array_index(peer->video_mlines, int, m), .video = TRUE,
+					.buffer = buf, .length = 8 + len };
+				bench_plugin->incoming_rtcp(&peer->handle, &rtcp);
+				__atomic_add_fetch(&bench_rtcp_in, 1, __ATOMIC_RELAXED);
+			}
+		}
+		g_usleep(interval);
+	}
+	return NULL;
+}
+
+
+/* CPU usage of each thread, as clock ticks (Linux only) */
+static GHashTable *bench_threads_cpu(void) {
+	GHashTable *threads = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GDir *dir = g_dir_open("/proc/self/task", 0, NULL);
+	if(dir == NULL)
+		return threads;
+	const char *tid = NULL;
+	while((tid = g_dir_read_name(dir)) != NULL) {
+		char path[64], *stat = NULL;
+		g_snprintf(path, sizeof(path), "/proc/self/task/%s/stat", tid);
+		if(!g_file_get_contents(path, &stat, NULL, NULL))
+			continue;
+		/* Fields are "tid (name) state ...", and utime and stime are the 14th and 15th */
+		char *start = strchr(stat, '('), *end = strrchr(stat, ')');
+		if(start && end && end > start) {
+			char **fields = g_strsplit(end + 2, " ", 14);
+			if(g_strv_length(fields) >= 13) {
+				guint64 ticks = g_ascii_strtoull(fields[11], NULL, 10) + g_ascii_strtoull(fields[12], NULL, 10);
+				/* We key by thread ID and name, since IDs may be reused */
+				char *key = g_strdup_printf("%s %.*s", tid, (int)(end - start - 1), start + 1);
+				g_hash_table_insert(threads, key, GSIZE_TO_POINTER(ticks));
+			}
+			g_strfreev(fields);
+		}
+		g_free(stat);
+	}
+	g_dir_close(dir);
+	return threads;
+}
+
+/* Aggregate the CPU used in between two snapshots by thread name */
+static json_t *bench_threads_summary(GHashTable *before, GHashTable *after, double seconds) {
+	GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, after);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		guint64 ticks = GPOINTER_TO_SIZE(value) - GPOINTER_TO_SIZE(g_hash_table_lookup(before, key));
+		const char *name = strchr((char *)key, ' ') + 1;
+		guint64 total = GPOINTER_TO_SIZE(g_hash_table_lookup(names, name)) + ticks;
+		g_hash_table_insert(names, g_strdup(name), GSIZE_TO_POINTER(total));
+	}
+	json_t *threads = json_object();
+	long hz = sysconf(_SC_CLK_TCK);
+	g_hash_table_iter_init(&iter, names);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		if(GPOINTER_TO_SIZE(value) > 0 && hz > 0 && seconds > 0)
+			json_object_set_new(threads, key, json_real((double)GPOINTER_TO_SIZE(value) / hz / seconds));
+	}
+	g_hash_table_destroy(names);
+	return threads;
+}
+
+static double bench_cpu_time(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / G_USEC_PER_SEC;
+}
+
+static int bench_compare_samples(const void *a, const void *b) {
+	guint32 x = *(const guint32 *)a, y = *(const guint32 *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Latency percentile, in us */
+static double bench_percentile(guint count, double p) {
+	if(count == 0)
+		return -1;
+	return (double)bench_samples[(guint)(p * (count - 1))] / 1000;
+}
+
+static json_t *bench_run(void) {
+	GHashTable *threads_before = bench_threads_cpu();
+	double cpu_before = bench_cpu_time();
+	g_atomic_int_set(&bench_negotiating, 0);
+	g_atomic_int_set(&bench_feeding, 1);
+	/* Give all threads some time to start */
+	bench_start = bench_now() + 50000000;
+	int i = 0;
+	GError *error = NULL;
+	for(i=0; i<bench_num_publishers; i++) {
+		bench_publishers[i]->thread = g_thread_try_new("bench feeder", bench_feeder_thread, bench_publishers[i], &error);
+		if(error != NULL) {
+			fprintf(stderr, "Got error %d (%s) trying to launch the feeder thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_clear_error(&error);
+			g_atomic_int_set(&bench_stop, 1);
+			break;
+		}
+	}
+	GThread *feedback = NULL;
+	if(bench_type != bench_scenario_audiobridge)
+		feedback = g_thread_try_new("bench feedback", bench_feedback_thread, NULL, NULL);
+	for(i=0; i<bench_num_publishers; i++) {
+		if(bench_publishers[i]->thread)
+			g_thread_join(bench_publishers[i]->thread);
+		bench_publishers[i]->thread = NULL;
+	}
+	gint64 fed = bench_now();
+	/* Wait for the plugin to relay whatever may still be queued */
+	guint64 relayed = 0;
+	int idle = 0;
+	while(idle < 3 && bench_now() - fed < 5*BENCH_NSEC_PER_SEC) {
+		g_usleep(100000);
+		guint64 now_relayed = __atomic_load_n(&bench_packets_out, __ATOMIC_RELAXED);
+		idle = (now_relayed == relayed) ? idle + 1 : 0;
+		relayed = now_relayed;
+	}
+	g_atomic_int_set(&bench_feeding, 0);
+	if(feedback)
+		g_thread_join(feedback);
+	gint64 end = bench_now();
+	double cpu = bench_cpu_time() - cpu_before;
+	GHashTable *threads_after = bench_threads_cpu();
+	/* Throughput is computed on the time it took to get the last packet out */
+	gint64 last = __atomic_load_n(&bench_last_relay, __ATOMIC_RELAXED);
+	double in_seconds = (double)(fed - bench_start) / BENCH_NSEC_PER_SEC;
+	double out_seconds = (double)((last > bench_start ? last : fed) - bench_start) / BENCH_NSEC_PER_SEC;
+	double seconds = (double)(end - bench_start) / BENCH_NSEC_PER_SEC;
+	guint64 packets_in = __atomic_load_n(&bench_packets_in, __ATOMIC_RELAXED);
+	guint64 packets_out = __atomic_load_n(&bench_packets_out, __ATOMIC_RELAXED);
+	double pps_in = in_seconds > 0 ? packets_in / in_seconds : 0;
+	double pps_out = out_seconds > 0 ? packets_out / out_seconds : 0;
+	/* Check how evenly packets were distributed */
+	guint64 min_out = 0, max_out = 0;
+	bench_peer **receivers = bench_num_subscribers > 0 ? bench_subscribers : bench_publishers;
+	int num_receivers = bench_num_subscribers > 0 ? bench_num_subscribers : bench_num_publishers;
+	for(i=0; i<num_receivers; i++) {
+		guint64 count = __atomic_load_n(&receivers[i]->relayed, __ATOMIC_RELAXED);
+		if(i == 0 || count < min_out)
+			min_out = count;
+		if(count > max_out)
+			max_out = count;
+	}
+	guint samples = MIN(__atomic_load_n(&bench_samples_count, __ATOMIC_RELAXED), BENCH_MAX_SAMPLES);
+	qsort(bench_samples, samples, sizeof(guint32), bench_compare_samples);
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	double cpu_cores = seconds > 0 ? cpu / seconds : 0;
+	/* Print the results */
+	printf("Packets in:    %12"SCNu64" (%.0f pps)\n", packets_in, pps_in);
+	printf("Packets out:   %12"SCNu64" (%.0f pps, %"SCNu64"-%"SCNu64" per %s)\n", packets_out, pps_out,
+		min_out, max_out, bench_num_subscribers > 0 ? "subscriber" : "publisher");
+	printf("RTCP in/out:   %12"SCNu64" / %"SCNu64" (%"SCNu64" PLIs, %"SCNu64" REMBs)\n",
+		__atomic_load_n(&bench_rtcp_in, __ATOMIC_RELAXED), __atomic_load_n(&bench_rtcp_out, __ATOMIC_RELAXED),
+		__atomic_load_n(&bench_plis, __ATOMIC_RELAXED), __atomic_load_n(&bench_rembs, __ATOMIC_RELAXED));
+	if(samples > 0) {
+		printf("Latency (us):  p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f (%u samples)\n",
+			bench_percentile(samples, 0.5), bench_percentile(samples, 0.9), bench_percentile(samples, 0.99),
+			bench_percentile(samples, 0.999), bench_percentile(samples, 1.0), samples);
+	} else {
+		printf("Latency (us):  n/a\n");
+	}
+	printf("CPU:           %.2f cores (%.1f%% of %ld cores) over %.2fs\n", cpu_cores,
+		cores > 0 ? 100 * cpu_cores / cores : 0, cores, seconds);
+	json_t *threads = bench_threads_summary(threads_before, threads_after, seconds);
+	const char *name = NULL;
+	json_t *value = NULL;
+	json_object_foreach(threads, name, value) {
+		if(json_real_value(value) >= 0.01)
+			printf("  %-16s %.2f cores\n", name, json_real_value(value));
+	}
+	g_hash_table_destroy(threads_before);
+	g_hash_table_destroy(threads_after);
+	/* Done, prepare the JSON version too */
+	json_t *result = json_object();
+	json_object_set_new(result, "packets-in", json_integer(packets_in));
+	json_object_set_new(result, "packets-in-per-second", json_real(pps_in));
+	json_object_set_new(result, "packets-out", json_integer(packets_out));
+	json_object_set_new(result, "packets-out-per-second", json_real(pps_out));
+	json_object_set_new(result, "bytes-out", json_integer(__atomic_load_n(&bench_bytes_out, __ATOMIC_RELAXED)));
+	json_object_set_new(result, "min-packets-out", json_integer(min_out));
+	json_object_set_new(result, "max-packets-out", json_integer(max_out));
+	json_object_set_new(result, "rtcp-in", json_integer(__atomic_load_n(&bench_rtcp_in, __ATOMIC_RELAXED)));
+	json_object_set_new(result, "rtcp-out", json_integer(__atomic_load_n(&bench_rtcp_out, __ATOMIC_RELAXED)));
+	json_object_set_new(result, "plis", json_integer(__atomic_load_n(&bench_plis, __ATOMIC_RELAXED)));
+	json_object_set_new(result, "rembs", json_integer(__atomic_load_n(&bench_rembs, __ATOMIC_RELAXED)));
+	json_object_set_new(result, "events", json_integer(__atomic_load_n(&bench_events, __ATOMIC_RELAXED)));
+	json_object_set_new(result, "duration", json_real(seconds));
+	if(samples > 0) {
+		json_t *latency = json_object();
+		json_object_set_new(latency, "samples", json_integer(samples));
+		json_object_set_new(latency, "p50", json_real(bench_percentile(samples, 0.5)));
+		json_object_set_new(latency, "p90", json_real(bench_percentile(samples, 0.9)));
+		json_object_set_new(latency, "p99", json_real(bench_percentile(samples, 0.99)));
+		json_object_set_new(latency, "p999", json_real(bench_percentile(samples, 0.999)));
+		json_object_set_new(latency, "max", json_real(bench_percentile(samples, 1.0)));
+		json_object_set_new(result, "latency", latency);
+	}
+	json_t *usage = json_object();
+	json_object_set_new(usage, "cores", json_real(cpu_cores));
+	json_object_set_new(usage, "available-cores", json_integer(cores));
+	json_object_set_new(usage, "threads", threads);
+	json_object_set_new(result, "cpu", usage);
+	return result;
+}
+
+
+int main(int argc, char *argv[]) {
+	gchar *plugin_path = NULL, *configs = NULL, *json = NULL,
+		*audio = NULL, *video = NULL, *audio_codec = NULL, *video_codec = NULL;
+	gboolean no_audio = FALSE, no_video = FALSE;
+	int audio_pt = 111, video_pt = 96, pcap_port = 0, duration = 10, debug = LOG_ERR;
+	GOptionEntry opt_entries[] = {
+		{ "plugin", 'p', 0, G_OPTION_ARG_STRING, &plugin_path, "Path to the plugin shared object to benchmark (VideoRoom, Streaming or AudioBridge)", NULL },
+		{ "publishers", 'n', 0, G_OPTION_ARG_INT, &bench_num_publishers, "Number of publishers (default=4)", NULL },
+		{ "subscribers", 'm', 0, G_OPTION_ARG_INT, &bench_num_subscribers, "Number of subscribers (default=10)", NULL },
+		{ "audio", 'a', 0, G_OPTION_ARG_STRING, &audio, "Audio trace to replay, as a .mjr or .pcap file (default=synthetic Opus)", NULL },
+		{ "video", 'v', 0, G_OPTION_ARG_STRING, &video, "Video trace to replay, as a .mjr or .pcap file (default=synthetic VP8)", NULL },
+		{ "no-audio", 0, 0, G_OPTION_ARG_NONE, &no_audio, "Don't replay any audio", NULL },
+		{ "no-video", 0, 0, G_OPTION_ARG_NONE, &no_video, "Don't replay any video", NULL },
+		{ "audio-pt", 0, 0, G_OPTION_ARG_INT, &audio_pt, "Payload type of the audio packets to extract from a .pcap file (default=111)", NULL },
+		{ "audio-codec", 0, 0, G_OPTION_ARG_STRING, &audio_codec, "Codec of the audio packets in a .pcap file (default=opus)", NULL },
+		{ "video-pt", 0, 0, G_OPTION_ARG_INT, &video_pt, "Payload type of the video packets to extract from a .pcap file (default=96)", NULL },
+		{ "video-codec", 0, 0, G_OPTION_ARG_STRING, &video_codec, "Codec of the video packets in a .pcap file (default=vp8)", NULL },
+		{ "pcap-port", 0, 0, G_OPTION_ARG_INT, &pcap_port, "Only extract packets sent to this UDP port from .pcap files (default=any)", NULL },
+		{ "duration", 'D', 0, G_OPTION_ARG_INT, &duration, "Duration of the synthetic traces, in seconds (default=10)", NULL },
+		{ "loops", 'l', 0, G_OPTION_ARG_INT, &bench_loops, "How many times the traces should be replayed (default=1)", NULL },
+		{ "speed", 'x', 0, G_OPTION_ARG_DOUBLE, &bench_speed, "Replay speed, compared to real-time (default=10, 0=as fast as possible)", NULL },
+		{ "port", 'P', 0, G_OPTION_ARG_INT, &bench_port, "First port to use for Streaming mountpoints (default=20000)", NULL },
+		{ "configs-folder", 'F', 0, G_OPTION_ARG_STRING, &configs, "Configuration files folder for the plugin (default=none, use the plugin defaults)", NULL },
+		{ "json", 'j', 0, G_OPTION_ARG_STRING, &json, "Save the results in JSON format to this file", NULL },
+		{ "debug-level", 'd', 0, G_OPTION_ARG_INT, &debug, "Debug/logging level of the plugin (0=disable debugging, 7=maximum debug level; default=2)", NULL },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL },
+	};
+	GError *error = NULL;
+	GOptionContext *opts = g_option_context_new("");
+	g_option_context_set_help_enabled(opts, TRUE);
+	g_option_context_add_main_entries(opts, opt_entries, NULL);
+	if(!g_option_context_parse(opts, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(opts);
+		exit(1);
+	}
+	g_option_context_free(opts);
+	if(plugin_path == NULL || bench_num_publishers < 1 || bench_num_subscribers < 0 ||
+			duration < 1 || bench_loops < 1 || bench_speed < 0 || (no_audio && no_video)) {
+		fprintf(stderr, "Invalid arguments\n");
+		exit(1);
+	}
+	janus_log_level = debug < LOG_NONE ? LOG_NONE : (debug > LOG_MAX ? LOG_MAX : debug);
+	if(janus_log_init(FALSE, TRUE, NULL) < 0)
+		exit(1);
+	signal(SIGINT, bench_handle_signal);
+	signal(SIGTERM, bench_handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	int ret = 1, i = 0, t = 0;
+	gboolean core_initialized = FALSE;
+	char *tmp_configs = NULL;
+	json_t *results = NULL;
+	/* Load the plugin */
+	void *plugin = dlopen(plugin_path, RTLD_NOW | RTLD_GLOBAL);
+	if(plugin == NULL) {
+		fprintf(stderr, "Couldn't load plugin '%s': %s\n", plugin_path, dlerror());
+		goto done;
+	}
+	create_p *create = (create_p *)dlsym(plugin, "create");
+	if(create == NULL || (bench_plugin = create()) == NULL) {
+		fprintf(stderr, "Couldn't use function 'create' in '%s'\n", plugin_path);
+		goto done;
+	}
+	const char *package = bench_plugin->get_package();
+	if(!strcmp(package, "janus.plugin.videoroom")) {
+		bench_type = bench_scenario_videoroom;
+	} else if(!strcmp(package, "janus.plugin.streaming")) {
+		bench_type = bench_scenario_streaming;
+	} else if(!strcmp(package, "janus.plugin.audiobridge")) {
+		bench_type = bench_scenario_audiobridge;
+		/* The mixer re-encodes audio, so there's nothing we could match */
+		bench_stamping = FALSE;
+		no_video = TRUE;
+		if(no_audio) {
+			fprintf(stderr, "The AudioBridge needs an audio trace\n");
+			goto done;
+		}
+	} else {
+		fprintf(stderr, "Unsupported plugin %s\n", package);
+		goto done;
+	}
+
+	/* Prepare the traces */
+	if(!no_audio) {
+		bench_trace *trace = &bench_traces[bench_num_traces++];
+		if(audio == NULL) {
+			bench_trace_synthetic_opus(trace, duration);
+		} else {
+			trace->source = g_strdup(audio);
+			trace->type = JANUS_SDP_AUDIO;
+			trace->codec = janus_sdp_match_preferred_codec(JANUS_SDP_AUDIO, audio_codec ? audio_codec : (char *)"opus");
+			int res = g_str_has_suffix(audio, ".mjr") ? bench_trace_load_mjr(trace, audio) :
+				bench_trace_load_pcap(trace, audio, audio_pt, pcap_port);
+			if(res < 0)
+				goto done;
+		}
+	}
+	if(!no_video) {
+		bench_trace *trace = &bench_traces[bench_num_traces++];
+		if(video == NULL) {
+			bench_trace_synthetic_vp8(trace, duration);
+		} else {
+			trace->source = g_strdup(video);
+			trace->type = JANUS_SDP_VIDEO;
+			trace->codec = janus_sdp_match_preferred_codec(JANUS_SDP_VIDEO, video_codec ? video_codec : (char *)"vp8");
+			int res = g_str_has_suffix(video, ".mjr") ? bench_trace_load_mjr(trace, video) :
+				bench_trace_load_pcap(trace, video, video_pt, pcap_port);
+			if(res < 0)
+				goto done;
+		}
+	}
+	for(t=0; t<bench_num_traces; t++) {
+		bench_trace *trace = &bench_traces[t];
+		if(trace->codec == NULL || trace->count == 0 || trace->type != (t == 0 && !no_audio ? JANUS_SDP_AUDIO : JANUS_SDP_VIDEO)) {
+			fprintf(stderr, "Invalid %s trace %s\n", (t == 0 && !no_audio) ? "audio" : "video", trace->source);
+			goto done;
+		}
+		printf("Trace %d: %s %s (pt %d), %u packets, %.2fs (%s)\n", t, janus_sdp_mtype_str(trace->type),
+			trace->codec, trace->pt, trace->count, (double)trace->duration / G_USEC_PER_SEC, trace->source);
+	}
+	bench_schedule_prepare();
+	bench_samples = g_malloc(BENCH_MAX_SAMPLES * sizeof(guint32));
+
+	/* Initialize the plugin: unless told otherwise, we use an empty folder for its configuration */
+	janus_recorder_init(FALSE, NULL);
+	janus_rtp_forwarders_init(0);
+	core_initialized = TRUE;
+	if(configs == NULL) {
+		tmp_configs = g_dir_make_tmp("janus-bench-XXXXXX", NULL);
+		if(tmp_configs == NULL) {
+			fprintf(stderr, "Couldn't create a temporary configuration folder\n");
+			goto done;
+		}
+	}
+	if(bench_plugin->init(&bench_callbacks, configs ? configs : tmp_configs) < 0) {
+		fprintf(stderr, "Couldn't initialize plugin %s\n", package);
+		bench_plugin = NULL;
+		goto done;
+	}
+	printf("Plugin %s: %d publishers, %d subscribers, speed %.1fx, %d loop(s)\n",
+		bench_plugin->get_name(), bench_num_publishers, bench_num_subscribers, bench_speed, bench_loops);
+
+	/* Negotiate all sessions */
+	gboolean streaming = (bench_type == bench_scenario_streaming);
+	bench_control = bench_peer_create(-1, FALSE, TRUE);
+	bench_publishers = g_malloc0(bench_num_publishers * sizeof(bench_peer *));
+	bench_subscribers = g_malloc0(MAX(1, bench_num_subscribers) * sizeof(bench_peer *));
+	if(bench_control == NULL)
+		goto done;
+	for(i=0; i<bench_num_publishers; i++) {
+		/* Streaming publishers are mountpoints we send RTP to, not sessions */
+		if((bench_publishers[i] = bench_peer_create(i, TRUE, !streaming)) == NULL)
+			goto done;
+	}
+	for(i=0; i<bench_num_subscribers; i++) {
+		if((bench_subscribers[i] = bench_peer_create(i, FALSE, TRUE)) == NULL)
+			goto done;
+	}
+	int res = -1;
+	if(bench_type == bench_scenario_videoroom)
+		res = bench_setup_videoroom();
+	else if(bench_type == bench_scenario_streaming)
+		res = bench_setup_streaming();
+	else
+		res = bench_setup_audiobridge();
+	if(res < 0) {
+		fprintf(stderr, "Error setting up the %s scenario\n", package);
+		goto done;
+	}
+
+	/* Replay the traces */
+	json_t *result = bench_run();
+	ret = 0;
+	if(json != NULL) {
+		json_t *report = json_object();
+		json_object_set_new(report, "benchmark", json_string("plugin-replay"));
+		json_object_set_new(report, "timestamp", json_integer(g_get_real_time() / G_USEC_PER_SEC));
+		json_object_set_new(report, "plugin", json_string(package));
+		json_object_set_new(report, "publishers", json_integer(bench_num_publishers));
+		json_object_set_new(report, "subscribers", json_integer(bench_num_subscribers));
+		json_object_set_new(report, "speed", json_real(bench_speed));
+		json_object_set_new(report, "loops", json_integer(bench_loops));
+		json_t *traces = json_array();
+		for(t=0; t<bench_num_traces; t++) {
+			json_t *trace = json_object();
+			json_object_set_new(trace, "type", json_string(janus_sdp_mtype_str(bench_traces[t].type)));
+			json_object_set_new(trace, "codec", json_string(bench_traces[t].codec));
+			json_object_set_new(trace, "source", json_string(bench_traces[t].source));
+			json_object_set_new(trace, "packets", json_integer(bench_traces[t].count));
+			json_object_set_new(trace, "duration", json_real((double)bench_traces[t].duration / G_USEC_PER_SEC));
+			json_array_append_new(traces, trace);
+		}
+		json_object_set_new(report, "traces", traces);
+		json_object_set_new(report, "results", result);
+		results = report;
+		if(json_dump_file(report, json, JSON_INDENT(2) | JSON_PRESERVE_ORDER) < 0) {
+			fprintf(stderr, "Error saving the results to %s\n", json);
+			ret = 1;
+		}
+	} else {
+		json_decref(result);
+	}
+
+done:
+	/* Tear everything down */
+	if(bench_plugin != NULL) {
+		g_atomic_int_set(&bench_negotiating, 0);
+		for(i=0; i<bench_num_subscribers && bench_subscribers; i++)
+			bench_peer_destroy(bench_subscribers[i]);
+		for(i=0; i<bench_num_publishers && bench_publishers; i++)
+			bench_peer_destroy(bench_publishers[i]);
+		bench_peer_destroy(bench_control);
+		bench_plugin->destroy();
+	}
+	for(i=0; i<bench_num_subscribers && bench_subscribers; i++)
+		bench_peer_free(bench_subscribers[i]);
+	for(i=0; i<bench_num_publishers && bench_publishers; i++)
+		bench_peer_free(bench_publishers[i]);
+	bench_peer_free(bench_control);
+	g_free(bench_subscribers);
+	g_free(bench_publishers);
+	if(results != NULL)
+		json_decref(results);
+	for(t=0; t<bench_num_traces; t++)
+		bench_trace_clear(&bench_traces[t]);
+	g_free(bench_schedule);
+	g_free(bench_samples);
+	if(tmp_configs != NULL) {
+		rmdir(tmp_configs);
+		g_free(tmp_configs);
+	}
+	if(core_initialized) {
+		janus_rtp_forwarders_deinit();
+		janus_recorder_deinit();
+	}
+	janus_log_destroy();
+	g_free(plugin_path);
+	g_free(configs);
+	g_free(json);
+	g_free(audio);
+	g_free(video);
+	g_free(audio_codec);
+	g_free(video_codec);
+	return ret;
+}
@@ -0,0 +1,749 @@
+/*! \file    primitives.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Microbenchmarks for the RTP, RTCP and SDP primitives
+ * \details  Simple benchmark that measures the cost of the RTP, RTCP and
+ * SDP helpers that are invoked for most packets (or sessions) handled by
+ * Janus and its plugins, e.g., janus_rtp_header_update,
+ * janus_rtp_simulcasting_context_process_rtp, janus_vp9_parse_svc,
+ * janus_rtcp_fix_ssrc or janus_sdp_parse. It links the same objects the
+ * fuzzers do, and each benchmark is fed with synthetic traces (e.g., a
+ * VP8 simulcast stream, or typical compound RTCP packets) and, when a
+ * folder is provided, with the fuzzers corpora as well.
+ *
+ * Each benchmark is run for at least the configured amount of time, and
+ * the time and the number of allocations per operation (i.e., per packet
+ * or per session description) are reported: results can optionally be
+ * saved in JSON format too, e.g., to track them over time.
+ * \note Allocations are counted by wrapping the glibc allocator, and so
+ * are not available (reported as -1) when using a different C library.
+ *
+ * Usage: janus-bench-primitives [-c fuzzers/corpora] [-f filter] [-t 0.5] [-j results.json]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "../debug.h"
+#include "../rtp.h"
+#include "../rtcp.h"
+#include "../sdp-utils.h"
+#include "../utils.h"
+
+int janus_log_level = LOG_NONE;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+
+
+/* Allocations counter: we wrap the allocator, so that we can tell how
+ * many allocations each operation results in (glib uses it as well) */
+static volatile guint64 bench_allocs = 0;
+#if defined(__GLIBC__)
+#define BENCH_COUNT_ALLOCS	1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+void *malloc(size_t size) {
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+void *calloc(size_t nmemb, size_t size) {
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+void *realloc(void *ptr, size_t size) {
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#else
+#define BENCH_COUNT_ALLOCS	0
+#endif
+
+/* Results are accumulated here, so that the compiler can't optimize calls away */
+static volatile guint64 bench_sink = 0;
+
+
+/* A packet (or session description) to feed the benchmarks with */
+typedef struct bench_input {
+	char *data;
+	int len;
+} bench_input;
+
+/* Set of inputs, which benchmarks go through in a round robin fashion */
+typedef struct bench_inputs {
+	bench_input *items;
+	guint count, size;
+} bench_inputs;
+
+static void bench_inputs_add(bench_inputs *inputs, const char *data, int len) {
+	if(inputs->count == inputs->size) {
+		inputs->size = inputs->size ? inputs->size*2 : 64;
+		inputs->items = g_realloc(inputs->items, inputs->size * sizeof(bench_input));
+	}
+	bench_input *input = &inputs->items[inputs->count++];
+	/* We add some room at the end, in case the primitive needs it (e.g., SDPs are strings) */
+	input->data = g_malloc0(len+1);
+	memcpy(input->data, data, len);
+	input->len = len;
+}
+
+static void bench_inputs_clear(bench_inputs *inputs) {
+	guint i = 0;
+	for(i=0; i<inputs->count; i++)
+		g_free(inputs->items[i].data);
+	g_free(inputs->items);
+	memset(inputs, 0, sizeof(*inputs));
+}
+
+/* Synthetic traces, and traces taken from the fuzzers corpora */
+static bench_inputs synthetic_rtp, synthetic_vp9, synthetic_rtcp, synthetic_sdp;
+static bench_inputs corpus_rtp, corpus_rtcp, corpus_sdp;
+
+
+/* Synthetic traces */
+#define BENCH_RTP_PACKETS	3000
+#define BENCH_RTP_SSRC		0x11223344
+static uint32_t bench_ssrcs[3] = { BENCH_RTP_SSRC, BENCH_RTP_SSRC+1, BENCH_RTP_SSRC+2 };
+
+/* Write an RTP header with a couple of one-byte extensions (abs-send-time
+ * with ID 3, and transport-wide CC with ID 5), and return the header size */
+static int bench_rtp_header(char *buf, uint32_t ssrc, uint16_t seq, uint32_t ts, gboolean marker, uint16_t twcc) {
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	memset(rtp, 0, 12);
+	rtp->version = 2;
+	rtp->extension = 1;
+	rtp->markerbit = marker;
+	rtp->type = 96;
+	rtp->seq_number = htons(seq);
+	rtp->timestamp = htonl(ts);
+	rtp->ssrc = htonl(ssrc);
+	uint8_t *ext = (uint8_t *)buf + 12;
+	ext[0] = 0xBE;
+	ext[1] = 0xDE;
+	ext[2] = 0;
+	ext[3] = 2;	/* Two words */
+	ext[4] = (3 << 4) | 2;
+	ext[5] = seq >> 8;
+	ext[6] = seq & 0xFF;
+	ext[7] = ts & 0xFF;
+	ext[8] = (5 << 4) | 1;
+	ext[9] = twcc >> 8;
+	ext[10] = twcc & 0xFF;
+	ext[11] = 0;
+	return 24;
+}
+
+/* VP8 simulcast (three substreams, three temporal layers), with a keyframe every 300 frames */
+static void bench_synthetic_vp8(void) {
+	char buf[1200];
+	uint16_t seq[3] = { 1000, 2000, 3000 }, twcc = 0, picid = 0;
+	uint8_t tl0picidx = 0;
+	uint32_t ts = 90000;
+	int frame = 0, substream = 0, packets = 0;
+	while(packets < BENCH_RTP_PACKETS) {
+		gboolean keyframe = (frame % 300 == 0);
+		int tid = (frame % 4 == 0) ? 0 : ((frame % 2 == 0) ? 1 : 2);
+		if(tid == 0)
+			tl0picidx++;
+		for(substream=0; substream<3; substream++) {
+			/* Higher substreams send more packets per frame */
+			int num = (keyframe ? 4 : 1) << substream, i = 0;
+			for(i=0; i<num; i++) {
+				int hlen = bench_rtp_header(buf, bench_ssrcs[substream], seq[substream]++, ts, i == num-1, twcc++);
+				uint8_t *vp8 = (uint8_t *)buf + hlen;
+				vp8[0] = 0x80 | (i == 0 ? 0x10 : 0x00);	/* X and S bits */
+				vp8[1] = 0xE0;	/* I, L and T bits */
+				vp8[2] = 0x80 | ((picid >> 8) & 0x7F);
+				vp8[3] = picid & 0xFF;
+				vp8[4] = tl0picidx;
+				vp8[5] = (tid << 6) | (tid > 0 ? 0x20 : 0x00);
+				uint8_t *payload = vp8 + 6;
+				int plen = keyframe ? 1000 : 600;
+				memset(payload, 0x5A, plen);
+				payload[0] = keyframe ? 0x10 : 0x11;	/* P bit */
+				if(keyframe) {
+					payload[3] = 0x9d;
+					payload[4] = 0x01;
+					payload[5] = 0x2a;
+					payload[6] = 0x80;
+					payload[7] = 0x02;
+					payload[8] = 0x68;
+					payload[9] = 0x01;
+				}
+				bench_inputs_add(&synthetic_rtp, buf, hlen + 6 + plen);
+				packets++;
+			}
+		}
+		picid = (picid + 1) & 0x7FFF;
+		ts += 3000;
+		frame++;
+	}
+}
+
+/* VP9 SVC payloads (three spatial and three temporal layers, flexible mode) */
+static void bench_synthetic_vp9(void) {
+	char buf[1200];
+	uint16_t picid = 0;
+	int frame = 0, packets = 0;
+	while(packets < BENCH_RTP_PACKETS) {
+		int tid = (frame % 4 == 0) ? 0 : ((frame % 2 == 0) ? 1 : 2);
+		int sid = 0;
+		for(sid=0; sid<3; sid++) {
+			/* janus_vp9_parse_svc works on the RTP payload, so that's all we need */
+			uint8_t *vp9 = (uint8_t *)buf;
+			vp9[0] = 0x80 | 0x20 | 0x10 | 0x08 | 0x04 | (frame % 300 == 0 ? 0x00 : 0x40);	/* I, (P,) L, F, B, E */
+			vp9[1] = 0x80 | ((picid >> 8) & 0x7F);
+			vp9[2] = picid & 0xFF;
+			vp9[3] = (tid << 5) | (sid << 1) | (sid > 0 ? 0x01 : 0x00);
+			vp9[4] = 0x02;	/* P_DIFF */
+			memset(vp9 + 5, 0x5A, 800);
+			bench_inputs_add(&synthetic_vp9, buf, 5 + 800);
+			packets++;
+		}
+		picid = (picid + 1) & 0x7FFF;
+		frame++;
+	}
+}
+
+/* The compound RTCP packets browsers typically send (SR or RR, with
+ * SDES, and sometimes REMB, NACK, PLI or transport-wide CC feedback) */
+static void bench_synthetic_rtcp(void) {
+	char buf[1500];
+	int i = 0;
+	for(i=0; i<64; i++) {
+		int len = 0;
+		/* SR or RR, with a report block */
+		if(i % 2 == 0) {
+			janus_rtcp_sr *sr = (janus_rtcp_sr *)buf;
+			memset(sr, 0, 52);
+			sr->header.version = 2;
+			sr->header.type = RTCP_SR;
+			sr->header.rc = 1;
+			sr->header.length = htons(12);
+			sr->ssrc = htonl(BENCH_RTP_SSRC);
+			sr->si.rtp_ts = htonl(90000 + i*3000);
+			sr->rb[0].ssrc = htonl(0x55667788);
+			len = 52;
+		} else {
+			janus_rtcp_rr *rr = (janus_rtcp_rr *)buf;
+			memset(rr, 0, 32);
+			rr->header.version = 2;
+			rr->header.type = RTCP_RR;
+			rr->header.rc = 1;
+			rr->header.length = htons(7);
+			rr->ssrc = htonl(BENCH_RTP_SSRC);
+			rr->rb[0].ssrc = htonl(0x55667788);
+			rr->rb[0].ehsnr = htonl(1000 + i*10);
+			len = 32;
+		}
+		/* SDES with a CNAME */
+		int res = janus_rtcp_sdes_cname(buf+len, sizeof(buf)-len, "janusbenchcname", 15);
+		if(res > 0)
+			len += res;
+		/* Some feedback */
+		if(i % 4 == 1) {
+			len += janus_rtcp_remb(buf+len, 24, 1000000 + i*1000);
+		} else if(i % 4 == 3) {
+			GSList *nacks = NULL;
+			int j = 0;
+			for(j=0; j<5; j++)
+				nacks = g_slist_append(nacks, GUINT_TO_POINTER(1000 + i*10 + j*3));
+			len += janus_rtcp_nacks(buf+len, 16+5*4, nacks);
+			g_slist_free(nacks);
+			if(i % 8 == 7)
+				len += janus_rtcp_pli(buf+len, 12);
+		}
+		bench_inputs_add(&synthetic_rtcp, buf, len);
+	}
+}
+
+/* An offer with audio, simulcast video and data channels, as browsers send them */
+static const char *bench_sdp =
+	"v=0\r\n"
+	"o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE 0 1 2\r\n"
+	"a=extmap-allow-mixed\r\n"
+	"a=msid-semantic: WMS stream\r\n"
+	"m=audio 9 UDP/TLS/RTP/SAVPF 111 63 9 0 8 13 110 126\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=candidate:1 1 udp 2122260223 192.168.1.10 54321 typ host generation 0 network-id 1\r\n"
+	"a=candidate:2 1 tcp 1518280447 192.168.1.10 9 typ host tcptype active generation 0 network-id 1\r\n"
+	"a=ice-ufrag:abcd\r\n"
+	"a=ice-pwd:abcdefghijklmnopqrstuvwx\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 6B:8B:5D:EA:59:04:20:23:29:C8:87:1C:CC:87:32:BE:DD:8C:66:A5:8E:50:55:EA:8C:D3:B6:5C:09:5E:D6:BC\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:0\r\n"
+	"a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+	"a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=sendrecv\r\n"
+	"a=msid:stream audio\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtpmap:111 opus/48000/2\r\n"
+	"a=rtcp-fb:111 transport-cc\r\n"
+	"a=fmtp:111 minptime=10;useinbandfec=1\r\n"
+	"a=rtpmap:63 red/48000/2\r\n"
+	"a=fmtp:63 111/111\r\n"
+	"a=rtpmap:9 G722/8000\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:13 CN/8000\r\n"
+	"a=rtpmap:110 telephone-event/48000\r\n"
+	"a=rtpmap:126 telephone-event/8000\r\n"
+	"a=ssrc:1111111111 cname:janusbenchcname\r\n"
+	"a=ssrc:1111111111 msid:stream audio\r\n"
+	"m=video 9 UDP/TLS/RTP/SAVPF 96 97 102 103 98 99 100 101\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:abcd\r\n"
+	"a=ice-pwd:abcdefghijklmnopqrstuvwx\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 6B:8B:5D:EA:59:04:20:23:29:C8:87:1C:CC:87:32:BE:DD:8C:66:A5:8E:50:55:EA:8C:D3:B6:5C:09:5E:D6:BC\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:1\r\n"
+	"a=extmap:14 urn:ietf:params:rtp-hdrext:toffset\r\n"
+	"a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:13 urn:3gpp:video-orientation\r\n"
+	"a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:5 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay\r\n"
+	"a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=extmap:10 urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id\r\n"
+	"a=extmap:11 urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id\r\n"
+	"a=sendrecv\r\n"
+	"a=msid:stream video\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtcp-rsize\r\n"
+	"a=rtpmap:96 VP8/90000\r\n"
+	"a=rtcp-fb:96 goog-remb\r\n"
+	"a=rtcp-fb:96 transport-cc\r\n"
+	"a=rtcp-fb:96 ccm fir\r\n"
+	"a=rtcp-fb:96 nack\r\n"
+	"a=rtcp-fb:96 nack pli\r\n"
+	"a=rtpmap:97 rtx/90000\r\n"
+	"a=fmtp:97 apt=96\r\n"
+	"a=rtpmap:102 H264/90000\r\n"
+	"a=rtcp-fb:102 goog-remb\r\n"
+	"a=rtcp-fb:102 transport-cc\r\n"
+	"a=rtcp-fb:102 ccm fir\r\n"
+	"a=rtcp-fb:102 nack\r\n"
+	"a=rtcp-fb:102 nack pli\r\n"
+	"a=fmtp:102 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42001f\r\n"
+	"a=rtpmap:103 rtx/90000\r\n"
+	"a=fmtp:103 apt=102\r\n"
+	"a=rtpmap:98 VP9/90000\r\n"
+	"a=rtcp-fb:98 goog-remb\r\n"
+	"a=rtcp-fb:98 transport-cc\r\n"
+	"a=rtcp-fb:98 ccm fir\r\n"
+	"a=rtcp-fb:98 nack\r\n"
+	"a=rtcp-fb:98 nack pli\r\n"
+	"a=fmtp:98 profile-id=0\r\n"
+	"a=rtpmap:99 rtx/90000\r\n"
+	"a=fmtp:99 apt=98\r\n"
+	"a=rtpmap:100 AV1/90000\r\n"
+	"a=rtcp-fb:100 goog-remb\r\n"
+	"a=rtcp-fb:100 transport-cc\r\n"
+	"a=rtcp-fb:100 ccm fir\r\n"
+	"a=rtcp-fb:100 nack\r\n"
+	"a=rtcp-fb:100 nack pli\r\n"
+	"a=rtpmap:101 rtx/90000\r\n"
+	"a=fmtp:101 apt=100\r\n"
+	"a=rid:h send\r\n"
+	"a=rid:m send\r\n"
+	"a=rid:l send\r\n"
+	"a=simulcast:send h;m;l\r\n"
+	"m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:abcd\r\n"
+	"a=ice-pwd:abcdefghijklmnopqrstuvwx\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 6B:8B:5D:EA:59:04:20:23:29:C8:87:1C:CC:87:32:BE:DD:8C:66:A5:8E:50:55:EA:8C:D3:B6:5C:09:5E:D6:BC\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:2\r\n"
+	"a=sctp-port:5000\r\n"
+	"a=max-message-size:262144\r\n";
+
+/* Load the fuzzers corpora: each file is an input */
+static void bench_load_folder(const char *folder, bench_inputs *inputs, int max_len) {
+	DIR *dir = opendir(folder);
+	if(dir == NULL)
+		return;
+	struct dirent *entry = NULL;
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] == '.' || strstr(entry->d_name, "LICENSE"))
+			continue;
+		char *path = g_build_filename(folder, entry->d_name, NULL);
+		struct stat st;
+		if(stat(path, &st) == 0) {
+			if(S_ISDIR(st.st_mode)) {
+				bench_load_folder(path, inputs, max_len);
+			} else if(S_ISREG(st.st_mode)) {
+				gchar *contents = NULL;
+				gsize len = 0;
+				if(g_file_get_contents(path, &contents, &len, NULL) && len > 0 && (max_len <= 0 || (int)len <= max_len))
+					bench_inputs_add(inputs, contents, len);
+				g_free(contents);
+			}
+		}
+		g_free(path);
+	}
+	closedir(dir);
+}
+
+static void bench_load_corpora(const char *corpora) {
+	bench_inputs all = { 0 };
+	char *folder = g_build_filename(corpora, "rtp_fuzzer", NULL);
+	bench_load_folder(folder, &all, 1472);
+	g_free(folder);
+	/* Only keep what the fuzzers would accept as well */
+	guint i = 0;
+	for(i=0; i<all.count; i++) {
+		if(janus_is_rtp(all.items[i].data, all.items[i].len))
+			bench_inputs_add(&corpus_rtp, all.items[i].data, all.items[i].len);
+	}
+	bench_inputs_clear(&all);
+	folder = g_build_filename(corpora, "rtcp_fuzzer", NULL);
+	bench_load_folder(folder, &all, 1472);
+	g_free(folder);
+	for(i=0; i<all.count; i++) {
+		if(all.items[i].len >= 8 && janus_is_rtcp(all.items[i].data, all.items[i].len))
+			bench_inputs_add(&corpus_rtcp, all.items[i].data, all.items[i].len);
+	}
+	bench_inputs_clear(&all);
+	folder = g_build_filename(corpora, "sdp_fuzzer", NULL);
+	bench_load_folder(folder, &corpus_sdp, 0);
+	g_free(folder);
+}
+
+
+/* Benchmarks: each one processes the provided number of inputs (operations) */
+typedef void (*bench_function)(bench_inputs *inputs, gpointer state, guint64 iterations);
+/* Some benchmarks need to prepare some state first, which is not measured */
+typedef gpointer (*bench_setup_function)(bench_inputs *inputs);
+typedef void (*bench_teardown_function)(bench_inputs *inputs, gpointer state);
+
+static void bench_rtp_header_update(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_rtp_switching_context context;
+	janus_rtp_switching_context_reset(&context);
+	janus_rtp_header header;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		if(input->len < 12)
+			continue;
+		/* The header is updated in place, so we work on a copy */
+		memcpy(&header, input->data, sizeof(header));
+		janus_rtp_header_update(&header, &context, TRUE, 0);
+		bench_sink += header.seq_number;
+	}
+}
+
+static void bench_rtp_extensions_parse(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_rtp_header_extensions exts;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		bench_sink += janus_rtp_header_extensions_parse(input->data, input->len, &exts);
+	}
+}
+
+static void bench_rtp_simulcasting(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_rtp_simulcasting_context context;
+	memset(&context, 0, sizeof(context));
+	janus_rtp_simulcasting_context_reset(&context);
+	context.substream_target = 2;
+	context.templayer_target = 2;
+	janus_rtp_switching_context sc;
+	janus_rtp_switching_context_reset(&sc);
+	uint32_t ssrcs[3] = { bench_ssrcs[0], bench_ssrcs[1], bench_ssrcs[2] };
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		bench_sink += janus_rtp_simulcasting_context_process_rtp(&context, input->data, input->len,
+			NULL, 0, ssrcs, NULL, JANUS_VIDEOCODEC_VP8, &sc, NULL);
+	}
+}
+
+static void bench_vp9_parse_svc(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_vp9_svc_info info;
+	gboolean found = FALSE;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		if(janus_vp9_parse_svc(input->data, input->len, &found, &info) == 0 && found)
+			bench_sink += info.spatial_layer;
+	}
+}
+
+static void bench_vp9_parse_svc_rtp(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	/* Same as above, but on the payload of RTP packets */
+	janus_vp9_svc_info info;
+	gboolean found = FALSE;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		int plen = 0;
+		char *payload = janus_rtp_payload(input->data, input->len, &plen);
+		if(payload && janus_vp9_parse_svc(payload, plen, &found, &info) == 0 && found)
+			bench_sink += info.spatial_layer;
+	}
+}
+
+static void bench_rtcp_fix_ssrc(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_rtcp_context ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		/* SSRCs are overwritten in place, but always with the same values */
+		bench_sink += janus_rtcp_fix_ssrc(&ctx, input->data, input->len, 1, BENCH_RTP_SSRC, 0x55667788);
+	}
+}
+
+static void bench_rtcp_summarize(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_rtcp_summary summary;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		bench_sink += janus_rtcp_summarize(input->data, input->len, &summary);
+		bench_sink += summary.remb + summary.pli;
+	}
+}
+
+static void bench_rtcp_get_nacks(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		GSList *nacks = janus_rtcp_get_nacks(input->data, input->len), *list = nacks;
+		while(list) {
+			bench_sink += GPOINTER_TO_UINT(list->data);
+			list = list->next;
+		}
+		g_slist_free(nacks);
+	}
+}
+
+static void bench_rtcp_nack_iter(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_rtcp_summary summary;
+	janus_rtcp_nack_iter iter;
+	uint16_t seq = 0;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		janus_rtcp_summarize(input->data, input->len, &summary);
+		if(janus_rtcp_nack_iter_init(&iter, input->data, &summary)) {
+			while(janus_rtcp_nack_iter_next(&iter, &seq))
+				bench_sink += seq;
+		}
+	}
+}
+
+static void bench_sdp_parse(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	char error[100];
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		bench_input *input = &inputs->items[i % inputs->count];
+		janus_sdp *sdp = janus_sdp_parse(input->data, error, sizeof(error));
+		if(sdp != NULL) {
+			bench_sink += g_list_length(sdp->m_lines);
+			janus_sdp_destroy(sdp);
+		}
+	}
+}
+
+static gpointer bench_sdp_write_setup(bench_inputs *inputs) {
+	/* We only measure the serialization, so we parse all the session descriptions first */
+	char error[100];
+	janus_sdp **parsed = g_malloc0(inputs->count * sizeof(janus_sdp *));
+	guint i = 0;
+	for(i=0; i<inputs->count; i++)
+		parsed[i] = janus_sdp_parse(inputs->items[i].data, error, sizeof(error));
+	return parsed;
+}
+
+static void bench_sdp_write(bench_inputs *inputs, gpointer state, guint64 iterations) {
+	janus_sdp **parsed = (janus_sdp **)state;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		janus_sdp *sdp = parsed[i % inputs->count];
+		if(sdp == NULL)
+			continue;
+		char *text = janus_sdp_write(sdp);
+		if(text != NULL)
+			bench_sink += strlen(text);
+		g_free(text);
+	}
+}
+
+static void bench_sdp_write_teardown(bench_inputs *inputs, gpointer state) {
+	janus_sdp **parsed = (janus_sdp **)state;
+	guint i = 0;
+	for(i=0; i<inputs->count; i++) {
+		if(parsed[i] != NULL)
+			janus_sdp_destroy(parsed[i]);
+	}
+	g_free(parsed);
+}
+
+/* List of benchmarks */
+typedef struct bench_case {
+	const char *name;
+	const char *source;
+	bench_inputs *inputs;
+	bench_function function;
+	bench_setup_function setup;
+	bench_teardown_function teardown;
+} bench_case;
+
+static bench_case bench_cases[] = {
+	{ "rtp-header-update", "synthetic", &synthetic_rtp, bench_rtp_header_update, NULL, NULL },
+	{ "rtp-header-update", "corpus", &corpus_rtp, bench_rtp_header_update, NULL, NULL },
+	{ "rtp-extensions-parse", "synthetic", &synthetic_rtp, bench_rtp_extensions_parse, NULL, NULL },
+	{ "rtp-extensions-parse", "corpus", &corpus_rtp, bench_rtp_extensions_parse, NULL, NULL },
+	{ "rtp-simulcasting-process", "synthetic", &synthetic_rtp, bench_rtp_simulcasting, NULL, NULL },
+	{ "rtp-simulcasting-process", "corpus", &corpus_rtp, bench_rtp_simulcasting, NULL, NULL },
+	{ "vp9-parse-svc", "synthetic", &synthetic_vp9, bench_vp9_parse_svc, NULL, NULL },
+	{ "vp9-parse-svc", "corpus", &corpus_rtp, bench_vp9_parse_svc_rtp, NULL, NULL },
+	{ "rtcp-fix-ssrc", "synthetic", &synthetic_rtcp, bench_rtcp_fix_ssrc, NULL, NULL },
+	{ "rtcp-fix-ssrc", "corpus", &corpus_rtcp, bench_rtcp_fix_ssrc, NULL, NULL },
+	{ "rtcp-summarize", "synthetic", &synthetic_rtcp, bench_rtcp_summarize, NULL, NULL },
+	{ "rtcp-summarize", "corpus", &corpus_rtcp, bench_rtcp_summarize, NULL, NULL },
+	{ "rtcp-get-nacks", "synthetic", &synthetic_rtcp, bench_rtcp_get_nacks, NULL, NULL },
+	{ "rtcp-get-nacks", "corpus", &corpus_rtcp, bench_rtcp_get_nacks, NULL, NULL },
+	{ "rtcp-nack-iter", "synthetic", &synthetic_rtcp, bench_rtcp_nack_iter, NULL, NULL },
+	{ "rtcp-nack-iter", "corpus", &corpus_rtcp, bench_rtcp_nack_iter, NULL, NULL },
+	{ "sdp-parse", "synthetic", &synthetic_sdp, bench_sdp_parse, NULL, NULL },
+	{ "sdp-parse", "corpus", &corpus_sdp, bench_sdp_parse, NULL, NULL },
+	{ "sdp-write", "synthetic", &synthetic_sdp, bench_sdp_write, bench_sdp_write_setup, bench_sdp_write_teardown },
+	{ NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+/* Run a benchmark for at least the provided amount of time */
+static json_t *bench_measure(bench_case *bc, gint64 min_time) {
+	gpointer state = bc->setup ? bc->setup(bc->inputs) : NULL;
+	guint64 iterations = 1, allocs = 0;
+	gint64 elapsed = 0;
+	while(TRUE) {
+		allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+		gint64 start = g_get_monotonic_time();
+		bc->function(bc->inputs, state, iterations);
+		elapsed = g_get_monotonic_time() - start;
+		allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - allocs;
+		if(elapsed >= min_time || iterations >= ((guint64)1 << 40))
+			break;
+		/* Guess how many iterations we need, with some margin, but don't grow too fast */
+		guint64 next = elapsed > 0 ? (guint64)((double)iterations * min_time * 1.2 / elapsed) : iterations*100;
+		if(next > iterations*100)
+			next = iterations*100;
+		if(next < iterations*2)
+			next = iterations*2;
+		iterations = next;
+	}
+	if(bc->teardown)
+		bc->teardown(bc->inputs, state);
+	double ns = (double)elapsed * 1000 / iterations;
+	double allocs_op = BENCH_COUNT_ALLOCS ? (double)allocs / iterations : -1;
+	printf("%-26s %-10s %6u inputs %12"SCNu64" ops %12.1f ns/op %10.2f allocs/op\n",
+		bc->name, bc->source, bc->inputs->count, iterations, ns, allocs_op);
+	json_t *result = json_object();
+	json_object_set_new(result, "name", json_string(bc->name));
+	json_object_set_new(result, "source", json_string(bc->source));
+	json_object_set_new(result, "inputs", json_integer(bc->inputs->count));
+	json_object_set_new(result, "iterations", json_integer(iterations));
+	json_object_set_new(result, "ns-per-op", json_real(ns));
+	json_object_set_new(result, "allocs-per-op", json_real(allocs_op));
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	gchar *corpora = NULL, *filter = NULL, *json = NULL;
+	gdouble min_time = 0.5;
+	gboolean list = FALSE;
+	GOptionEntry opt_entries[] = {
+		{ "corpora", 'c', 0, G_OPTION_ARG_STRING, &corpora, "Folder containing the fuzzers corpora (default=none, only synthetic traces)", NULL },
+		{ "filter", 'f', 0, G_OPTION_ARG_STRING, &filter, "Only run the benchmarks whose name contains this string", NULL },
+		{ "time", 't', 0, G_OPTION_ARG_DOUBLE, &min_time, "Minimum time to run each benchmark for, in seconds (default=0.5)", NULL },
+		{ "json", 'j', 0, G_OPTION_ARG_STRING, &json, "Save the results in JSON format to this file", NULL },
+		{ "list", 'l', 0, G_OPTION_ARG_NONE, &list, "List the available benchmarks and exit", NULL },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL },
+	};
+	GError *error = NULL;
+	GOptionContext *opts = g_option_context_new("");
+	g_option_context_set_help_enabled(opts, TRUE);
+	g_option_context_add_main_entries(opts, opt_entries, NULL);
+	if(!g_option_context_parse(opts, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(opts);
+		exit(1);
+	}
+	g_option_context_free(opts);
+	if(min_time <= 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		exit(1);
+	}
+	bench_case *bc = NULL;
+	if(list) {
+		for(bc=bench_cases; bc->name != NULL; bc++)
+			printf("%s (%s)\n", bc->name, bc->source);
+		exit(0);
+	}
+	/* Prepare the traces */
+	bench_synthetic_vp8();
+	bench_synthetic_vp9();
+	bench_synthetic_rtcp();
+	bench_inputs_add(&synthetic_sdp, bench_sdp, strlen(bench_sdp));
+	if(corpora != NULL) {
+		bench_load_corpora(corpora);
+		if(corpus_rtp.count == 0 && corpus_rtcp.count == 0 && corpus_sdp.count == 0)
+			fprintf(stderr, "No inputs found in the corpora folder %s\n", corpora);
+	}
+	/* Run the benchmarks */
+	json_t *results = json_array();
+	for(bc=bench_cases; bc->name != NULL; bc++) {
+		if(bc->inputs->count == 0 || (filter && !strstr(bc->name, filter)))
+			continue;
+		json_array_append_new(results, bench_measure(bc, (gint64)(min_time * G_USEC_PER_SEC)));
+	}
+	int ret = 0;
+	if(json != NULL) {
+		json_t *report = json_object();
+		json_object_set_new(report, "benchmark", json_string("primitives"));
+		json_object_set_new(report, "timestamp", json_integer(g_get_real_time() / G_USEC_PER_SEC));
+		json_object_set_new(report, "min-time", json_real(min_time));
+		json_object_set_new(report, "allocs-counted", BENCH_COUNT_ALLOCS ? json_true() : json_false());
+		json_object_set_new(report, "results", results);
+		results = NULL;
+		if(json_dump_file(report, json, JSON_INDENT(2) | JSON_PRESERVE_ORDER) < 0) {
+			fprintf(stderr, "Error saving the results to %s\n", json);
+			ret = 1;
+		}
+		json_decref(report);
+	}
+	if(results != NULL)
+		json_decref(results);
+	/* Done */
+	bench_inputs_clear(&synthetic_rtp);
+	bench_inputs_clear(&synthetic_vp9);
+	bench_inputs_clear(&synthetic_rtcp);
+	bench_inputs_clear(&synthetic_sdp);
+	bench_inputs_clear(&corpus_rtp);
+	bench_inputs_clear(&corpus_rtcp);
+	bench_inputs_clear(&corpus_sdp);
+	g_free(corpora);
+	g_free(filter);
+	g_free(json);
+	return ret;
+}
@@ -0,0 +1,519 @@
+/*! \file    bwe.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Sender side bandwidth estimation
+ * \details  Implementation of a simple sender side bandwidth estimator,
+ * fed by the transport-wide CC feedback recipients send us and by the
+ * times we sent packets at. The estimator is loosely based on the
+ * Google Congestion Control algorithm: a delay based controller looks
+ * at how the one way delay variation between groups of packets evolves
+ * (using a trendline filter and an adaptive threshold to detect overuse),
+ * and adapts the estimate in an AIMD fashion using the bitrate that was
+ * actually acknowledged by the recipient as a reference; a loss based
+ * controller then caps the estimate when too many packets are lost.
+ * Probe clusters, when used, can raise the estimate beyond what the
+ * media alone would allow us to find out.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bwe.h"
+#include "debug.h"
+
+/* Packets sent within this interval (us) are evaluated as a group */
+#define JANUS_BWE_BURST_INTERVAL	5000
+/* Smoothing factor for the accumulated delay */
+#define JANUS_BWE_SMOOTHING	0.9
+/* Gain applied to the trendline slope, and cap on the number of samples it's multiplied by */
+#define JANUS_BWE_TRENDLINE_GAIN	4.0
+#define JANUS_BWE_TRENDLINE_MAX_SAMPLES	60
+/* Adaptive threshold: initial value, bounds and gains (for when the trend is above/below it) */
+#define JANUS_BWE_THRESHOLD_START	12.5
+#define JANUS_BWE_THRESHOLD_MIN	6.0
+#define JANUS_BWE_THRESHOLD_MAX	600.0
+#define JANUS_BWE_THRESHOLD_K_UP	0.0087
+#define JANUS_BWE_THRESHOLD_K_DOWN	0.039
+/* How long (us, receiver clock) the trend must be above the threshold to signal overuse */
+#define JANUS_BWE_OVERUSE_TIME	10000
+/* Rate control: decrease factor, increase rate (per second), and minimum interval between decreases */
+#define JANUS_BWE_DECREASE_FACTOR	0.85
+#define JANUS_BWE_INCREASE_RATE	0.08
+#define JANUS_BWE_DECREASE_INTERVAL	200000
+/* Loss based control: thresholds on the fraction of lost packets */
+#define JANUS_BWE_LOSS_HIGH	0.10
+#define JANUS_BWE_LOSS_LOW	0.02
+/* Windows for the acknowledged bitrate and the loss computation */
+#define JANUS_BWE_ACKED_WINDOW	500000
+#define JANUS_BWE_LOSS_WINDOW	G_USEC_PER_SEC
+/* Owners are notified when the estimate changes by more than 5%, or every couple of seconds */
+#define JANUS_BWE_NOTIFY_CHANGE	0.05
+#define JANUS_BWE_NOTIFY_INTERVAL	(2*G_USEC_PER_SEC)
+/* Probing: how much above the current estimate we probe for, minimum
+ * padding bitrate worth a cluster, fraction of the cluster that must be
+ * received, how much of the probed bitrate we actually trust, how soon
+ * we probe again after a successful cluster, and how long we wait for
+ * feedback on a cluster before evaluating it anyway */
+#define JANUS_BWE_PROBE_FACTOR	2.0
+#define JANUS_BWE_PROBE_MIN_PADDING	50000
+#define JANUS_BWE_PROBE_MIN_RECEIVED	0.8
+#define JANUS_BWE_PROBE_BACKOFF	0.95
+#define JANUS_BWE_PROBE_FOLLOWUP	G_USEC_PER_SEC
+#define JANUS_BWE_PROBE_TIMEOUT	G_USEC_PER_SEC
+
+const char *janus_bwe_usage_str(janus_bwe_usage usage) {
+	switch(usage) {
+		case janus_bwe_usage_normal: return "normal";
+		case janus_bwe_usage_underuse: return "underuse";
+		case janus_bwe_usage_overuse: return "overuse";
+		default: break;
+	}
+	return NULL;
+}
+
+janus_bwe_context *janus_bwe_context_create(void) {
+	janus_bwe_context *bwe = g_malloc0(sizeof(janus_bwe_context));
+	bwe->threshold = JANUS_BWE_THRESHOLD_START;
+	bwe->estimate = JANUS_BWE_START_BITRATE;
+	janus_mutex_init(&bwe->mutex);
+	return bwe;
+}
+
+void janus_bwe_context_destroy(janus_bwe_context *bwe) {
+	if(bwe == NULL)
+		return;
+	janus_mutex_destroy(&bwe->mutex);
+	g_free(bwe);
+}
+
+void janus_bwe_context_add_sent(janus_bwe_context *bwe, guint16 seq, int size, guint16 cluster, gint64 now) {
+	if(bwe == NULL)
+		return;
+	janus_mutex_lock(&bwe->mutex);
+	janus_bwe_sent_packet *p = &bwe->history[seq & JANUS_BWE_HISTORY_MASK];
+	p->seq = seq;
+	p->size = size > 0xFFFF ? 0xFFFF : size;
+	p->sent = now;
+	p->cluster = 0;
+	p->lost = FALSE;
+	p->lost_window = 0;
+	bwe->packets_sent++;
+	janus_bwe_probe_cluster *c = &bwe->probe;
+	if(cluster > 0 && cluster == c->id && !c->done) {
+		p->cluster = cluster;
+		if(c->sent_packets == 0)
+			c->first_sent = now;
+		c->last_sent = now;
+		c->sent_packets++;
+		c->sent_bytes += p->size;
+	}
+	janus_mutex_unlock(&bwe->mutex);
+}
+
+/* Adaptive threshold update, so that the detector is neither starved by
+ * concurrent TCP flows nor too sensitive to the noise on the path */
+static void janus_bwe_update_threshold(janus_bwe_context *bwe, double trend, gint64 arrival) {
+	if(bwe->last_threshold_update == 0)
+		bwe->last_threshold_update = arrival;
+	double abs_trend = fabs(trend);
+	if(abs_trend > bwe->threshold + 15.0) {
+		/* Spikes are ignored */
+		bwe->last_threshold_update = arrival;
+		return;
+	}
+	double k = abs_trend < bwe->threshold ? JANUS_BWE_THRESHOLD_K_DOWN : JANUS_BWE_THRESHOLD_K_UP;
+	gint64 dt = (arrival - bwe->last_threshold_update)/1000;
+	if(dt > 100)
+		dt = 100;
+	else if(dt < 0)
+		dt = 0;
+	bwe->threshold += k * (abs_trend - bwe->threshold) * dt;
+	if(bwe->threshold < JANUS_BWE_THRESHOLD_MIN)
+		bwe->threshold = JANUS_BWE_THRESHOLD_MIN;
+	else if(bwe->threshold > JANUS_BWE_THRESHOLD_MAX)
+		bwe->threshold = JANUS_BWE_THRESHOLD_MAX;
+	bwe->last_threshold_update = arrival;
+}
+
+/* Overuse detector: compares the modified trend with the adaptive threshold */
+static void janus_bwe_detect(janus_bwe_context *bwe, gint64 arrival) {
+	int samples = bwe->delay_samples < JANUS_BWE_TRENDLINE_MAX_SAMPLES ? bwe->delay_samples : JANUS_BWE_TRENDLINE_MAX_SAMPLES;
+	double modified = samples * bwe->trend * JANUS_BWE_TRENDLINE_GAIN;
+	if(modified > bwe->threshold) {
+		if(bwe->overuse_start == 0)
+			bwe->overuse_start = arrival;
+		bwe->overuse_count++;
+		if(arrival - bwe->overuse_start >= JANUS_BWE_OVERUSE_TIME && bwe->overuse_count > 1 &&
+				bwe->trend >= bwe->prev_trend) {
+			bwe->overuse_start = 0;
+			bwe->overuse_count = 0;
+			bwe->usage = janus_bwe_usage_overuse;
+		}
+	} else if(modified < -bwe->threshold) {
+		bwe->overuse_start = 0;
+		bwe->overuse_count = 0;
+		bwe->usage = janus_bwe_usage_underuse;
+	} else {
+		bwe->overuse_start = 0;
+		bwe->overuse_count = 0;
+		bwe->usage = janus_bwe_usage_normal;
+	}
+	janus_bwe_update_threshold(bwe, modified, arrival);
+}
+
+/* Trendline filter: linear regression on the smoothed accumulated delay */
+static void janus_bwe_trendline_update(janus_bwe_context *bwe, double delta_ms, gint64 arrival) {
+	if(bwe->delay_samples == 0)
+		bwe->first_arrival = arrival;
+	bwe->delay_samples++;
+	bwe->accumulated_delay += delta_ms;
+	bwe->smoothed_delay = JANUS_BWE_SMOOTHING * bwe->smoothed_delay +
+		(1.0 - JANUS_BWE_SMOOTHING) * bwe->accumulated_delay;
+	bwe->trend_x[bwe->trend_index] = (double)(arrival - bwe->first_arrival)/1000.0;
+	bwe->trend_y[bwe->trend_index] = bwe->smoothed_delay;
+	bwe->trend_index = (bwe->trend_index + 1) % JANUS_BWE_TRENDLINE_WINDOW;
+	if(bwe->trend_samples < JANUS_BWE_TRENDLINE_WINDOW)
+		bwe->trend_samples++;
+	if(bwe->trend_samples < JANUS_BWE_TRENDLINE_WINDOW)
+		return;
+	double mean_x = 0, mean_y = 0;
+	int i = 0;
+	for(i=0; i<JANUS_BWE_TRENDLINE_WINDOW; i++) {
+		mean_x += bwe->trend_x[i];
+		mean_y += bwe->trend_y[i];
+	}
+	mean_x /= JANUS_BWE_TRENDLINE_WINDOW;
+	mean_y /= JANUS_BWE_TRENDLINE_WINDOW;
+	double num = 0, den = 0;
+	for(i=0; i<JANUS_BWE_TRENDLINE_WINDOW; i++) {
+		num += (bwe->trend_x[i] - mean_x) * (bwe->trend_y[i] - mean_y);
+		den += (bwe->trend_x[i] - mean_x) * (bwe->trend_x[i] - mean_x);
+	}
+	bwe->prev_trend = bwe->trend;
+	if(den != 0)
+		bwe->trend = num/den;
+	janus_bwe_detect(bwe, arrival);
+}
+
+/* Reset the delay based controller, e.g., after a clock jump on the receiver */
+static void janus_bwe_reset_delay(janus_bwe_context *bwe) {
+	memset(&bwe->prev_group, 0, sizeof(bwe->prev_group));
+	bwe->accumulated_delay = 0;
+	bwe->smoothed_delay = 0;
+	bwe->trend_samples = 0;
+	bwe->trend_index = 0;
+	bwe->delay_samples = 0;
+	bwe->trend = 0;
+	bwe->prev_trend = 0;
+	bwe->overuse_start = 0;
+	bwe->overuse_count = 0;
+	bwe->usage = janus_bwe_usage_normal;
+}
+
+/* Add a received packet to the current group, and evaluate the delay
+ * variation with respect to the previous group when a new one starts */
+static void janus_bwe_process_delay(janus_bwe_context *bwe, gint64 sent, gint64 arrival) {
+	janus_bwe_group *g = &bwe->group;
+	if(g->valid && sent < g->first_sent) {
+		/* Reordered packet from an old group, ignore */
+		return;
+	}
+	if(!g->valid || sent - g->first_sent > JANUS_BWE_BURST_INTERVAL) {
+		if(g->valid && bwe->prev_group.valid) {
+			gint64 send_delta = g->last_sent - bwe->prev_group.last_sent;
+			gint64 arrival_delta = g->last_arrival - bwe->prev_group.last_arrival;
+			if(llabs(arrival_delta - send_delta) > 3*G_USEC_PER_SEC) {
+				JANUS_LOG(LOG_VERB, "[BWE] Delay variation too large (%"SCNi64"us), resetting\n",
+					arrival_delta - send_delta);
+				janus_bwe_reset_delay(bwe);
+			} else {
+				janus_bwe_trendline_update(bwe, (double)(arrival_delta - send_delta)/1000.0, g->last_arrival);
+			}
+		}
+		if(g->valid)
+			bwe->prev_group = *g;
+		g->first_sent = sent;
+		g->last_sent = sent;
+		g->last_arrival = arrival;
+		g->valid = TRUE;
+		return;
+	}
+	if(sent > g->last_sent)
+		g->last_sent = sent;
+	if(arrival > g->last_arrival)
+		g->last_arrival = arrival;
+}
+
+/* AIMD rate control, driven by the network usage the detector reported */
+static void janus_bwe_update_estimate(janus_bwe_context *bwe, gint64 now) {
+	gint64 dt = bwe->last_update ? (now - bwe->last_update) : 0;
+	if(dt > G_USEC_PER_SEC)
+		dt = G_USEC_PER_SEC;
+	bwe->last_update = now;
+	double estimate = bwe->estimate;
+	if(bwe->usage == janus_bwe_usage_overuse) {
+		/* Multiplicative decrease, with respect to what actually got through */
+		if(now - bwe->last_decrease >= JANUS_BWE_DECREASE_INTERVAL) {
+			double target = JANUS_BWE_DECREASE_FACTOR * (bwe->acked_bitrate ? bwe->acked_bitrate : bwe->estimate);
+			if(target < estimate)
+				estimate = target;
+			bwe->last_decrease = now;
+		}
+	} else if(bwe->usage == janus_bwe_usage_normal && bwe->loss < JANUS_BWE_LOSS_LOW) {
+		/* Increase, but don't go too far from what actually got through */
+		double target = estimate * (1.0 + JANUS_BWE_INCREASE_RATE * dt / G_USEC_PER_SEC);
+		if(bwe->acked_bitrate > 0) {
+			double cap = 1.5 * bwe->acked_bitrate + 10000;
+			if(target > cap)
+				target = cap > estimate ? cap : estimate;
+		}
+		estimate = target;
+	}
+	/* When underusing, we hold the estimate until the queues drain */
+	if(estimate < JANUS_BWE_MIN_BITRATE)
+		estimate = JANUS_BWE_MIN_BITRATE;
+	else if(estimate > JANUS_BWE_MAX_BITRATE)
+		estimate = JANUS_BWE_MAX_BITRATE;
+	bwe->estimate = (guint32)estimate;
+}
+
+/* Evaluate the probe cluster in progress, if we're done with it: the
+ * padding got through at the lower of the rates we sent it and the
+ * recipient received it at, which added to the media gives us the
+ * bitrate the path can sustain (or at least, a lower bound for it) */
+static void janus_bwe_probe_evaluate(janus_bwe_context *bwe, gint64 now) {
+	janus_bwe_probe_cluster *c = &bwe->probe;
+	if(c->id == 0 || !c->done)
+		return;
+	if(c->received_packets < c->sent_packets && now - c->last_sent < JANUS_BWE_PROBE_TIMEOUT)
+		return;
+	guint32 result = 0;
+	if(c->received_packets >= JANUS_BWE_PROBE_MIN_PACKETS &&
+			c->received_packets >= JANUS_BWE_PROBE_MIN_RECEIVED * c->sent_packets &&
+			bwe->usage != janus_bwe_usage_overuse) {
+		/* Each rate is computed on all packets but one, as the interval covers all packets but one */
+		gint64 send_span = c->last_sent - c->first_sent;
+		gint64 recv_span = c->last_arrival - c->first_arrival;
+		double send_rate = send_span > 0 ?
+			(double)(c->sent_bytes - c->sent_bytes/c->sent_packets) * 8 * G_USEC_PER_SEC / send_span : 0;
+		double recv_rate = recv_span > 0 ?
+			(double)(c->received_bytes - c->received_bytes/c->received_packets) * 8 * G_USEC_PER_SEC / recv_span : 0;
+		double padding = (send_rate > 0 && recv_rate > 0) ? MIN(send_rate, recv_rate) : MAX(send_rate, recv_rate);
+		if(padding > 0)
+			result = c->media_bitrate + (guint32)padding;
+	}
+	bwe->probe_last_result = result;
+	double estimate = JANUS_BWE_PROBE_BACKOFF * result;
+	if(estimate > c->target)
+		estimate = c->target;
+	if(estimate > JANUS_BWE_MAX_BITRATE)
+		estimate = JANUS_BWE_MAX_BITRATE;
+	bwe->probe_last_success = (result > 0 && estimate > bwe->estimate);
+	if(bwe->probe_last_success) {
+		JANUS_LOG(LOG_VERB, "[BWE] Probe cluster %"SCNu16" succeeded: %"SCNu32" --> %"SCNu32" (target=%"SCNu32")\n",
+			c->id, bwe->estimate, (guint32)estimate, c->target);
+		bwe->estimate = (guint32)estimate;
+		bwe->probes_succeeded++;
+	} else {
+		JANUS_LOG(LOG_VERB, "[BWE] Probe cluster %"SCNu16" failed: %"SCNu32"/%"SCNu32" packets, result=%"SCNu32" (target=%"SCNu32")\n",
+			c->id, c->received_packets, c->sent_packets, result, c->target);
+		bwe->probes_failed++;
+	}
+	memset(c, 0, sizeof(*c));
+}
+
+guint32 janus_bwe_context_probe_start(janus_bwe_context *bwe, guint32 max_bitrate, gint64 interval, gint64 now, guint16 *cluster) {
+	if(bwe == NULL || cluster == NULL)
+		return 0;
+	janus_mutex_lock(&bwe->mutex);
+	/* If we never got (all the) feedback for the previous cluster, evaluate it now */
+	janus_bwe_probe_evaluate(bwe, now);
+	if(max_bitrate > JANUS_BWE_MAX_BITRATE)
+		max_bitrate = JANUS_BWE_MAX_BITRATE;
+	gint64 wait = bwe->probe_last_success ? MIN(interval, JANUS_BWE_PROBE_FOLLOWUP) : interval;
+	if(bwe->probe.id != 0 || bwe->acked_bitrate == 0 || bwe->usage != janus_bwe_usage_normal ||
+			bwe->loss >= JANUS_BWE_LOSS_LOW || bwe->estimate >= max_bitrate ||
+			(bwe->probe_last_time > 0 && now - bwe->probe_last_time < wait)) {
+		janus_mutex_unlock(&bwe->mutex);
+		return 0;
+	}
+	double target = JANUS_BWE_PROBE_FACTOR * bwe->estimate;
+	if(target > max_bitrate)
+		target = max_bitrate;
+	if(target < bwe->acked_bitrate + JANUS_BWE_PROBE_MIN_PADDING) {
+		/* Not worth it */
+		janus_mutex_unlock(&bwe->mutex);
+		return 0;
+	}
+	janus_bwe_probe_cluster *c = &bwe->probe;
+	memset(c, 0, sizeof(*c));
+	bwe->probe_last_id++;
+	if(bwe->probe_last_id == 0)
+		bwe->probe_last_id++;
+	c->id = bwe->probe_last_id;
+	c->target = (guint32)target;
+	c->media_bitrate = bwe->acked_bitrate;
+	bwe->probe_last_time = now;
+	bwe->probe_last_target = c->target;
+	bwe->probes_sent++;
+	*cluster = c->id;
+	guint32 padding = c->target - c->media_bitrate;
+	JANUS_LOG(LOG_HUGE, "[BWE] Starting probe cluster %"SCNu16": target=%"SCNu32" (estimate=%"SCNu32", padding=%"SCNu32")\n",
+		c->id, c->target, bwe->estimate, padding);
+	janus_mutex_unlock(&bwe->mutex);
+	return padding;
+}
+
+void janus_bwe_context_probe_end(janus_bwe_context *bwe, guint16 cluster, gint64 now) {
+	if(bwe == NULL || cluster == 0)
+		return;
+	janus_mutex_lock(&bwe->mutex);
+	janus_bwe_probe_cluster *c = &bwe->probe;
+	if(c->id == cluster && !c->done) {
+		c->done = TRUE;
+		if(c->sent_packets == 0) {
+			/* We couldn't send anything */
+			bwe->probe_last_success = FALSE;
+			bwe->probes_failed++;
+			memset(c, 0, sizeof(*c));
+		}
+	}
+	janus_mutex_unlock(&bwe->mutex);
+}
+
+gboolean janus_bwe_context_feedback(janus_bwe_context *bwe,
+		janus_rtcp_transport_wide_cc_report *reports, int num, gint64 now) {
+	if(bwe == NULL || reports == NULL || num < 1)
+		return FALSE;
+	janus_mutex_lock(&bwe->mutex);
+	bwe->feedbacks++;
+	int i = 0;
+	for(i=0; i<num; i++) {
+		janus_rtcp_transport_wide_cc_report *r = &reports[i];
+		janus_bwe_sent_packet *p = &bwe->history[r->seq & JANUS_BWE_HISTORY_MASK];
+		if(p->sent == 0 || p->seq != r->seq) {
+			/* Not a packet we know about (or one we already got feedback for) */
+			bwe->packets_unknown++;
+			continue;
+		}
+		if(!r->received) {
+			/* Keep the packet around, in case it's reported again later: we
+			 * only count it as lost the first time a feedback says so */
+			if(!p->lost) {
+				p->lost = TRUE;
+				p->lost_window = bwe->loss_window;
+				bwe->packets_lost++;
+				bwe->window_lost++;
+			}
+			continue;
+		}
+		if(p->lost) {
+			/* A later feedback says the packet did arrive after all (e.g., it
+			 * was reordered), so it's not lost: undo what we counted before,
+			 * as far as the loss window is concerned only if it's the same */
+			bwe->packets_lost--;
+			if(p->lost_window == bwe->loss_window && bwe->window_lost > 0)
+				bwe->window_lost--;
+			p->lost = FALSE;
+		}
+		bwe->packets_acked++;
+		bwe->window_received++;
+		bwe->acked_bytes += p->size;
+		janus_bwe_process_delay(bwe, p->sent, r->arrival);
+		if(p->cluster > 0 && p->cluster == bwe->probe.id) {
+			/* Part of the probe cluster in progress */
+			janus_bwe_probe_cluster *c = &bwe->probe;
+			if(c->received_packets == 0 || r->arrival < c->first_arrival)
+				c->first_arrival = r->arrival;
+			if(c->received_packets == 0 || r->arrival > c->last_arrival)
+				c->last_arrival = r->arrival;
+			c->received_packets++;
+			c->received_bytes += p->size;
+		}
+		p->sent = 0;
+	}
+	/* Update the acknowledged bitrate */
+	if(bwe->acked_window == 0) {
+		bwe->acked_window = now;
+	} else if(now - bwe->acked_window >= JANUS_BWE_ACKED_WINDOW) {
+		bwe->acked_bitrate = (guint32)(bwe->acked_bytes * 8 * G_USEC_PER_SEC / (now - bwe->acked_window));
+		bwe->acked_bytes = 0;
+		bwe->acked_window = now;
+	}
+	/* Update the delay based estimate */
+	janus_bwe_update_estimate(bwe, now);
+	/* Check if a probe cluster can raise it */
+	janus_bwe_probe_evaluate(bwe, now);
+	/* Check the loss, and cap the estimate if needed */
+	if(bwe->loss_window == 0) {
+		bwe->loss_window = now;
+	} else if(now - bwe->loss_window >= JANUS_BWE_LOSS_WINDOW) {
+		guint32 total = bwe->window_received + bwe->window_lost;
+		bwe->loss = total ? (double)bwe->window_lost / total : 0.0;
+		bwe->window_received = 0;
+		bwe->window_lost = 0;
+		bwe->loss_window = now;
+		if(bwe->loss > JANUS_BWE_LOSS_HIGH) {
+			guint32 estimate = (guint32)(bwe->estimate * (1.0 - 0.5 * bwe->loss));
+			bwe->estimate = estimate < JANUS_BWE_MIN_BITRATE ? JANUS_BWE_MIN_BITRATE : estimate;
+			bwe->last_decrease = now;
+		}
+	}
+	/* Should the owner be notified? */
+	gboolean notify = FALSE;
+	if(bwe->notified_time == 0 ||
+			fabs((double)bwe->estimate - bwe->notified_estimate) > JANUS_BWE_NOTIFY_CHANGE * bwe->notified_estimate ||
+			(bwe->estimate != bwe->notified_estimate && now - bwe->notified_time >= JANUS_BWE_NOTIFY_INTERVAL)) {
+		JANUS_LOG(LOG_HUGE, "[BWE] Estimate: %"SCNu32" (acked=%"SCNu32", loss=%.2f, usage=%s)\n",
+			bwe->estimate, bwe->acked_bitrate, bwe->loss, janus_bwe_usage_str(bwe->usage));
+		bwe->notified_estimate = bwe->estimate;
+		bwe->notified_time = now;
+		notify = TRUE;
+	}
+	janus_mutex_unlock(&bwe->mutex);
+	return notify;
+}
+
+guint32 janus_bwe_context_get_estimate(janus_bwe_context *bwe) {
+	if(bwe == NULL)
+		return 0;
+	janus_mutex_lock(&bwe->mutex);
+	guint32 estimate = bwe->estimate;
+	janus_mutex_unlock(&bwe->mutex);
+	return estimate;
+}
+
+json_t *janus_bwe_context_summary(janus_bwe_context *bwe) {
+	if(bwe == NULL)
+		return NULL;
+	json_t *info = json_object();
+	janus_mutex_lock(&bwe->mutex);
+	json_object_set_new(info, "estimate", json_integer(bwe->estimate));
+	json_object_set_new(info, "acked-bitrate", json_integer(bwe->acked_bitrate));
+	json_object_set_new(info, "loss", json_real(bwe->loss));
+	json_object_set_new(info, "usage", json_string(janus_bwe_usage_str(bwe->usage)));
+	json_object_set_new(info, "trend", json_real(bwe->trend));
+	json_object_set_new(info, "threshold", json_real(bwe->threshold));
+	json_object_set_new(info, "packets-sent", json_integer(bwe->packets_sent));
+	json_object_set_new(info, "packets-acked", json_integer(bwe->packets_acked));
+	json_object_set_new(info, "packets-lost", json_integer(bwe->packets_lost));
+	json_object_set_new(info, "packets-unknown", json_integer(bwe->packets_unknown));
+	json_object_set_new(info, "feedbacks", json_integer(bwe->feedbacks));
+	if(bwe->probes_sent > 0) {
+		json_t *probing = json_object();
+		json_object_set_new(probing, "clusters", json_integer(bwe->probes_sent));
+		json_object_set_new(probing, "succeeded", json_integer(bwe->probes_succeeded));
+		json_object_set_new(probing, "failed", json_integer(bwe->probes_failed));
+		json_object_set_new(probing, "in-progress", bwe->probe.id ? json_true() : json_false());
+		json_object_set_new(probing, "last-target", json_integer(bwe->probe_last_target));
+		json_object_set_new(probing, "last-result", json_integer(bwe->probe_last_result));
+		json_object_set_new(probing, "last-time", json_integer(bwe->probe_last_time));
+		json_object_set_new(info, "probing", probing);
+	}
+	janus_mutex_unlock(&bwe->mutex);
+	return info;
+}
@@ -0,0 +1,223 @@
+/*! \file    bwe.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Sender side bandwidth estimation (headers)
+ * \details  Implementation of a simple sender side bandwidth estimator,
+ * fed by the transport-wide CC feedback recipients send us and by the
+ * times we sent packets at. The estimator is loosely based on the
+ * Google Congestion Control algorithm: a delay based controller looks
+ * at how the one way delay variation between groups of packets evolves
+ * (using a trendline filter and an adaptive threshold to detect overuse),
+ * and adapts the estimate in an AIMD fashion using the bitrate that was
+ * actually acknowledged by the recipient as a reference; a loss based
+ * controller then caps the estimate when too many packets are lost.
+ *
+ * Since the estimate can't grow much beyond what we actually send, the
+ * estimator can also drive probe clusters, i.e., short bursts of padding
+ * sent at a higher rate than the media: if the recipient reports the
+ * burst arrived at (about) the rate we sent it at, the estimate is raised
+ * to the probed bitrate right away.
+ *
+ * The core creates an estimator for each PeerConnection that negotiated
+ * transport-wide CC, and notifies plugins about the estimate via the
+ * \c estimated_bandwidth callback, when available: plugins can then use
+ * it to decide what to send (e.g., which simulcast substream to relay).
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_BWE_H
+#define JANUS_BWE_H
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "rtcp.h"
+#include "mutex.h"
+
+/*! \brief Number of sent packets the estimator remembers (must be a power of 2) */
+#define JANUS_BWE_HISTORY_SIZE	4096
+#define JANUS_BWE_HISTORY_MASK	(JANUS_BWE_HISTORY_SIZE-1)
+/*! \brief Number of delay samples the trendline filter works on */
+#define JANUS_BWE_TRENDLINE_WINDOW	20
+
+/*! \brief Initial estimate, in bps */
+#define JANUS_BWE_START_BITRATE	300000
+/*! \brief Minimum estimate, in bps */
+#define JANUS_BWE_MIN_BITRATE	30000
+/*! \brief Maximum estimate, in bps */
+#define JANUS_BWE_MAX_BITRATE	20000000
+/*! \brief Minimum number of packets a probe cluster must be made of to be evaluated */
+#define JANUS_BWE_PROBE_MIN_PACKETS	5
+
+/*! \brief Network usage, as detected by the delay based controller */
+typedef enum janus_bwe_usage {
+	janus_bwe_usage_normal = 0,
+	janus_bwe_usage_underuse,
+	janus_bwe_usage_overuse
+} janus_bwe_usage;
+/*! \brief Helper to get a string representation of a network usage
+ * @param[in] usage The janus_bwe_usage value
+ * @returns The string representation */
+const char *janus_bwe_usage_str(janus_bwe_usage usage);
+
+/*! \brief Packet we sent, as tracked by the estimator */
+typedef struct janus_bwe_sent_packet {
+	/*! \brief Transport-wide sequence number of the packet */
+	guint16 seq;
+	/*! \brief Size of the packet, in bytes */
+	guint16 size;
+	/*! \brief Probe cluster the packet belongs to (0 for media) */
+	guint16 cluster;
+	/*! \brief When the packet was sent (monotonic time, in us), 0 if the slot is unused */
+	gint64 sent;
+	/*! \brief Whether a feedback already reported this packet as lost */
+	gboolean lost;
+	/*! \brief Loss window the packet was counted as lost in, if so */
+	gint64 lost_window;
+} janus_bwe_sent_packet;
+
+/*! \brief Group of packets sent in a short burst, whose delay is evaluated as a whole */
+typedef struct janus_bwe_group {
+	/*! \brief Send time of the first and last packet in the group */
+	gint64 first_sent, last_sent;
+	/*! \brief Arrival time of the last packet in the group (receiver clock) */
+	gint64 last_arrival;
+	/*! \brief Whether the group contains any packet */
+	gboolean valid;
+} janus_bwe_group;
+
+/*! \brief Probe cluster, i.e., a burst of padding we sent to check if there's more bandwidth available */
+typedef struct janus_bwe_probe_cluster {
+	/*! \brief Identifier of the cluster (0 if no cluster is in progress) */
+	guint16 id;
+	/*! \brief Whether we're done sending packets for this cluster */
+	gboolean done;
+	/*! \brief Bitrate we're probing for (media plus padding), and bitrate of the media when we started, in bps */
+	guint32 target, media_bitrate;
+	/*! \brief Packets and bytes we sent, and when we sent the first and last packet */
+	guint32 sent_packets;
+	guint64 sent_bytes;
+	gint64 first_sent, last_sent;
+	/*! \brief Packets and bytes the recipient received, and when it received the first and last packet (receiver clock) */
+	guint32 received_packets;
+	guint64 received_bytes;
+	gint64 first_arrival, last_arrival;
+} janus_bwe_probe_cluster;
+
+/*! \brief Bandwidth estimator context */
+typedef struct janus_bwe_context {
+	/*! \brief Packets we sent, indexed by transport-wide sequence number */
+	janus_bwe_sent_packet history[JANUS_BWE_HISTORY_SIZE];
+	/*! \brief Group being filled, and last complete group */
+	janus_bwe_group group, prev_group;
+	/*! \brief Arrival time of the first group (receiver clock), used as a reference for the trendline */
+	gint64 first_arrival;
+	/*! \brief Accumulated and smoothed delay variation (ms) */
+	double accumulated_delay, smoothed_delay;
+	/*! \brief Trendline samples (arrival time and smoothed delay, in ms) */
+	double trend_x[JANUS_BWE_TRENDLINE_WINDOW], trend_y[JANUS_BWE_TRENDLINE_WINDOW];
+	/*! \brief Number of trendline samples, and index of the next one */
+	int trend_samples, trend_index;
+	/*! \brief Total number of delay samples processed so far */
+	guint32 delay_samples;
+	/*! \brief Latest (modified) trend, and previous one */
+	double trend, prev_trend;
+	/*! \brief Adaptive overuse threshold */
+	double threshold;
+	/*! \brief When the threshold was last updated */
+	gint64 last_threshold_update;
+	/*! \brief When we first detected the current overuse (receiver clock), and how many times in a row */
+	gint64 overuse_start;
+	int overuse_count;
+	/*! \brief Current network usage */
+	janus_bwe_usage usage;
+	/*! \brief Bytes acknowledged by the recipient in the current window, and when the window started */
+	guint64 acked_bytes;
+	gint64 acked_window;
+	/*! \brief Bitrate that was acknowledged by the recipient in the last window, in bps */
+	guint32 acked_bitrate;
+	/*! \brief Packets reported as received and lost in the current window */
+	guint32 window_received, window_lost;
+	/*! \brief When the loss window started */
+	gint64 loss_window;
+	/*! \brief Fraction of packets that were lost in the last window (0.0-1.0) */
+	double loss;
+	/*! \brief Current estimate, in bps */
+	guint32 estimate;
+	/*! \brief When we last updated, and last decreased, the estimate */
+	gint64 last_update, last_decrease;
+	/*! \brief Last estimate the owner was notified about, and when */
+	guint32 notified_estimate;
+	gint64 notified_time;
+	/*! \brief Counters, for the Admin API */
+	guint64 packets_sent, packets_acked, packets_lost, packets_unknown, feedbacks;
+	/*! \brief Probe cluster in progress, if any, and identifier of the last one we started */
+	janus_bwe_probe_cluster probe;
+	guint16 probe_last_id;
+	/*! \brief When we started the last probe cluster, and whether it raised the estimate */
+	gint64 probe_last_time;
+	gboolean probe_last_success;
+	/*! \brief Bitrate we probed for, and bitrate we measured, in the last probe cluster */
+	guint32 probe_last_target, probe_last_result;
+	/*! \brief Probing counters, for the Admin API */
+	guint32 probes_sent, probes_succeeded, probes_failed;
+	/*! \brief Mutex to lock this context */
+	janus_mutex mutex;
+} janus_bwe_context;
+
+/*! \brief Create a new bandwidth estimator
+ * @returns A new janus_bwe_context instance */
+janus_bwe_context *janus_bwe_context_create(void);
+/*! \brief Destroy a bandwidth estimator
+ * @param[in] bwe The janus_bwe_context instance to destroy */
+void janus_bwe_context_destroy(janus_bwe_context *bwe);
+/*! \brief Keep track of a packet we just sent
+ * @param[in] bwe The janus_bwe_context instance to update
+ * @param[in] seq The transport-wide sequence number of the packet
+ * @param[in] size The size of the packet, in bytes
+ * @param[in] cluster The probe cluster this packet is part of, if it's a probe (0 otherwise)
+ * @param[in] now The current monotonic time */
+void janus_bwe_context_add_sent(janus_bwe_context *bwe, guint16 seq, int size, guint16 cluster, gint64 now);
+/*! \brief Update the estimate with some transport-wide CC feedback
+ * @param[in] bwe The janus_bwe_context instance to update
+ * @param[in] reports The packets statuses, as parsed by janus_rtcp_transport_wide_cc_parse
+ * @param[in] num The number of reports
+ * @param[in] now The current monotonic time
+ * @returns TRUE if the owner of the estimator should be notified about
+ * the new estimate (it changed significantly, or hasn't been notified in
+ * a while), FALSE otherwise */
+gboolean janus_bwe_context_feedback(janus_bwe_context *bwe,
+	janus_rtcp_transport_wide_cc_report *reports, int num, gint64 now);
+/*! \brief Check whether it's a good time to probe for more bandwidth, and start a new probe cluster if so
+ * \note Probing only happens when the network looks healthy (no overuse and
+ * little loss), when the estimate is below the maximum we want to probe for,
+ * and not more often than the provided interval (unless the previous probe
+ * was successful, in which case we keep on ramping up sooner). The owner is
+ * expected to send padding at the returned bitrate for a short while, marking
+ * the packets with the cluster identifier, and then call janus_bwe_context_probe_end.
+ * @param[in] bwe The janus_bwe_context instance to update
+ * @param[in] max_bitrate Maximum bitrate to probe for, in bps
+ * @param[in] interval Minimum interval between probe clusters, in us
+ * @param[in] now The current monotonic time
+ * @param[out] cluster The identifier of the new probe cluster
+ * @returns The bitrate to send padding at (in bps) if a probe cluster was started, 0 otherwise */
+guint32 janus_bwe_context_probe_start(janus_bwe_context *bwe, guint32 max_bitrate, gint64 interval, gint64 now, guint16 *cluster);
+/*! \brief Notify the estimator we're done sending packets for a probe cluster
+ * \note The cluster is evaluated when feedback for all of its packets has
+ * been received, or after a timeout
+ * @param[in] bwe The janus_bwe_context instance to update
+ * @param[in] cluster The identifier of the probe cluster
+ * @param[in] now The current monotonic time */
+void janus_bwe_context_probe_end(janus_bwe_context *bwe, guint16 cluster, gint64 now);
+/*! \brief Get the current estimate
+ * @param[in] bwe The janus_bwe_context instance to query
+ * @returns The estimate, in bps */
+guint32 janus_bwe_context_get_estimate(janus_bwe_context *bwe);
+/*! \brief Get a summary of the estimator state, for the Admin API
+ * @param[in] bwe The janus_bwe_context instance to query
+ * @returns A JSON object with the summary */
+json_t *janus_bwe_context_summary(janus_bwe_context *bwe);
+
+#endif
@@ -112,6 +112,24 @@ do { \
 			##__VA_ARGS__); \
 	} \
 } while (0)
+
+/*! \brief Rate limited version of JANUS_LOG, for lines that may be triggered
+ * by remote peers on hot paths (e.g., for each incoming packet): no more than
+ * \c burst lines per second are logged from the same call site, and when
+ * lines have been suppressed, how many is reported before the next one */
+#define JANUS_LOG_RATELIMITED(level, burst, format, ...) \
+do { \
+	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
+		static janus_log_ratelimit janus_log_rl = { 0, 0, 0 }; \
+		int janus_log_suppressed = janus_log_ratelimit_check(&janus_log_rl, burst); \
+		if (janus_log_suppressed > 0) { \
+			JANUS_LOG(level, "[%s:%d] Suppressed %d similar messages\n", \
+				__FILE__, __LINE__, janus_log_suppressed); \
+		} \
+		if (janus_log_suppressed >= 0) \
+			JANUS_LOG(level, format, ##__VA_ARGS__); \
+	} \
+} while (0)
 ///@}
 
 #endif
@@ -131,6 +131,152 @@ gchar *janus_dtls_get_local_fingerprint(void) {
 	return (gchar *)local_fingerprint;
 }
 
+/* SRTP profiles we offer, in order of preference: AES-GCM comes first, as
+ * it's much cheaper than AES-CM+HMAC-SHA1 on CPUs with AES acceleration */
+#ifdef HAVE_SRTP_AESGCM
+#define DTLS_DEFAULT_SRTP_PROFILES	"SRTP_AEAD_AES_128_GCM:SRTP_AEAD_AES_256_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#else
+#define DTLS_DEFAULT_SRTP_PROFILES	"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#endif
+/* SRTP profiles we support, and how much they're used */
+typedef struct janus_dtls_srtp_profile_info {
+	/* Profile, as exported by the DTLS-SRTP handshake */
+	int id;
+	/* Position in the list of profiles we offer (0 if we don't) */
+	int preference;
+	/* Number of SRTP sessions currently using the profile, and since startup */
+	volatile gint active, total;
+	/* Cost of protecting/unprotecting a packet, according to the self-test (ns) */
+	guint64 protect_ns, unprotect_ns;
+} janus_dtls_srtp_profile_info;
+static janus_dtls_srtp_profile_info srtp_profiles[] = {
+#ifdef HAVE_SRTP_AESGCM
+	{ .id = SRTP_AEAD_AES_128_GCM },
+	{ .id = SRTP_AEAD_AES_256_GCM },
+#endif
+	{ .id = SRTP_AES128_CM_SHA1_80 },
+	{ .id = SRTP_AES128_CM_SHA1_32 },
+	{ .id = 0 }
+};
+static janus_dtls_srtp_profile_info *janus_dtls_srtp_profile_find(int id) {
+	janus_dtls_srtp_profile_info *info = srtp_profiles;
+	while(info->id != 0) {
+		if(info->id == id)
+			return info;
+		info++;
+	}
+	return NULL;
+}
+/* Parse the configured list of SRTP profiles, and validate it */
+static char *janus_dtls_srtp_profiles_parse(const char *profiles) {
+	GString *list = g_string_new(NULL);
+	int preference = 0;
+	gchar **names = g_strsplit_set(profiles, ":, ", -1);
+	int i = 0;
+	for(i=0; names[i] != NULL; i++) {
+		if(strlen(names[i]) == 0)
+			continue;
+		janus_dtls_srtp_profile_info *info = srtp_profiles;
+		while(info->id != 0) {
+			if(!strcasecmp(names[i], janus_get_dtls_srtp_profile(info->id)))
+				break;
+			info++;
+		}
+		if(info->id == 0) {
+			JANUS_LOG(LOG_WARN, "Unsupported SRTP profile '%s', skipping\n", names[i]);
+			continue;
+		}
+		if(info->preference > 0)
+			continue;
+		info->preference = ++preference;
+		g_string_append_printf(list, "%s%s", list->len ? ":" : "", janus_get_dtls_srtp_profile(info->id));
+	}
+	g_strfreev(names);
+	return g_string_free(list, list->len == 0);
+}
+
+/* SRTP self-test: how many packets to protect/unprotect, and how large */
+#define DTLS_SRTP_SELFTEST_PACKETS	2000
+#define DTLS_SRTP_SELFTEST_SIZE		1200
+static int janus_dtls_srtp_selftest_profile(janus_dtls_srtp_profile_info *info, char *buffers) {
+	srtp_policy_t policy;
+	memset(&policy, 0, sizeof(policy));
+	int master_length = 0;
+	switch(info->id) {
+		case SRTP_AES128_CM_SHA1_80:
+			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
+			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+			master_length = SRTP_MASTER_LENGTH;
+			break;
+		case SRTP_AES128_CM_SHA1_32:
+			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(&policy.rtp);
+			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+			master_length = SRTP_MASTER_LENGTH;
+			break;
+#ifdef HAVE_SRTP_AESGCM
+		case SRTP_AEAD_AES_256_GCM:
+			srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtp);
+			srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtcp);
+			master_length = SRTP_AESGCM256_MASTER_LENGTH;
+			break;
+		case SRTP_AEAD_AES_128_GCM:
+			srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtp);
+			srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtcp);
+			master_length = SRTP_AESGCM128_MASTER_LENGTH;
+			break;
+#endif
+		default:
+			return -1;
+	}
+	unsigned char key[SRTP_AESGCM256_MASTER_LENGTH];
+	srtp_crypto_get_random(key, master_length);
+	policy.key = key;
+	policy.next = NULL;
+	srtp_t srtp_out = NULL, srtp_in = NULL;
+	policy.ssrc.type = ssrc_any_outbound;
+	if(srtp_create(&srtp_out, &policy) != srtp_err_status_ok)
+		return -1;
+	policy.ssrc.type = ssrc_any_inbound;
+	if(srtp_create(&srtp_in, &policy) != srtp_err_status_ok) {
+		srtp_dealloc(srtp_out);
+		return -1;
+	}
+	/* Prepare the packets, and protect them all first */
+	int ret = -1, i = 0;
+	int lengths[DTLS_SRTP_SELFTEST_PACKETS];
+	for(i=0; i<DTLS_SRTP_SELFTEST_PACKETS; i++) {
+		char *buf = buffers + i*(DTLS_SRTP_SELFTEST_SIZE+SRTP_MAX_TAG_LEN);
+		memset(buf, i & 0xFF, DTLS_SRTP_SELFTEST_SIZE);
+		janus_rtp_header *rtp = (janus_rtp_header *)buf;
+		memset(rtp, 0, sizeof(*rtp));
+		rtp->version = 2;
+		rtp->type = 96;
+		rtp->seq_number = htons(i+1);
+		rtp->timestamp = htonl(i*3000);
+		rtp->ssrc = htonl(0x4A414E55);
+		lengths[i] = DTLS_SRTP_SELFTEST_SIZE;
+	}
+	gint64 start = janus_get_monotonic_time();
+	for(i=0; i<DTLS_SRTP_SELFTEST_PACKETS; i++) {
+		if(srtp_protect(srtp_out, buffers + i*(DTLS_SRTP_SELFTEST_SIZE+SRTP_MAX_TAG_LEN), &lengths[i]) != srtp_err_status_ok)
+			goto done;
+	}
+	gint64 protected = janus_get_monotonic_time();
+	for(i=0; i<DTLS_SRTP_SELFTEST_PACKETS; i++) {
+		if(srtp_unprotect(srtp_in, buffers + i*(DTLS_SRTP_SELFTEST_SIZE+SRTP_MAX_TAG_LEN), &lengths[i]) != srtp_err_status_ok ||
+				lengths[i] != DTLS_SRTP_SELFTEST_SIZE)
+			goto done;
+	}
+	gint64 end = janus_get_monotonic_time();
+	info->protect_ns = (protected - start) * 1000 / DTLS_SRTP_SELFTEST_PACKETS;
+	info->unprotect_ns = (end - protected) * 1000 / DTLS_SRTP_SELFTEST_PACKETS;
+	ret = 0;
+done:
+	srtp_dealloc(srtp_out);
+	srtp_dealloc(srtp_in);
+	return ret;
+}
+
 
 #if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
 /*
@@ -396,7 +542,7 @@ const char *janus_get_ssl_version(void) {
 
 /* DTLS-SRTP initialization */
 gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password,
-		const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned) {
+		const char *ciphers, const char *profiles, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned) {
 	const char *crypto_lib = NULL;
 #if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
 #if defined(LIBRESSL_VERSION_NUMBER)
@@ -438,12 +584,21 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -1;
 	}
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_dtls_verify_callback);
-	SSL_CTX_set_tlsext_use_srtp(ssl_ctx,
-#ifdef HAVE_SRTP_AESGCM
-		"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#else
-		"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#endif
+	/* When we're the DTLS server, the order of the SRTP profiles is our
+	 * preference: when we're the client, it's a hint for the peer */
+	char *srtp_list = janus_dtls_srtp_profiles_parse(profiles ? profiles : DTLS_DEFAULT_SRTP_PROFILES);
+	if(srtp_list == NULL) {
+		JANUS_LOG(LOG_FATAL, "No valid SRTP profile in '%s'\n", profiles);
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "SRTP profiles: %s\n", srtp_list);
+	/* Notice that, unlike most OpenSSL methods, this returns 0 in case of success */
+	if(SSL_CTX_set_tlsext_use_srtp(ssl_ctx, srtp_list) != 0) {
+		JANUS_LOG(LOG_FATAL, "Error setting SRTP profiles (%s)\n", ERR_reason_error_string(ERR_get_error()));
+		g_free(srtp_list);
+		return -1;
+	}
+	g_free(srtp_list);
 
 	if(!server_pem && !server_key) {
 		JANUS_LOG(LOG_INFO, "No cert/key specified, autogenerating some...\n");
@@ -520,6 +675,59 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 	return 0;
 }
 
+void janus_dtls_srtp_selftest(void) {
+	char *buffers = g_malloc(DTLS_SRTP_SELFTEST_PACKETS * (DTLS_SRTP_SELFTEST_SIZE+SRTP_MAX_TAG_LEN));
+	janus_dtls_srtp_profile_info *info = NULL, *preferred = NULL;
+	for(info = srtp_profiles; info->id != 0; info++) {
+		if(info->preference == 0)
+			continue;
+		if(janus_dtls_srtp_selftest_profile(info, buffers) < 0) {
+			JANUS_LOG(LOG_WARN, "SRTP self-test failed for %s\n", janus_get_dtls_srtp_profile(info->id));
+			continue;
+		}
+		guint64 cost = info->protect_ns + info->unprotect_ns;
+		JANUS_LOG(LOG_INFO, "SRTP self-test: %s, %"SCNu64"ns to protect and %"SCNu64"ns to unprotect %d bytes (~%"SCNu64" Mbps per core)\n",
+			janus_get_dtls_srtp_profile(info->id), info->protect_ns, info->unprotect_ns, DTLS_SRTP_SELFTEST_SIZE,
+			cost ? (guint64)DTLS_SRTP_SELFTEST_SIZE * 8 * 1000 / cost : 0);
+		if(preferred == NULL || info->preference < preferred->preference)
+			preferred = info;
+	}
+	g_free(buffers);
+	if(preferred == NULL)
+		return;
+	/* Compare the profile we prefer to the one most endpoints would pick otherwise */
+	janus_dtls_srtp_profile_info *fallback = janus_dtls_srtp_profile_find(SRTP_AES128_CM_SHA1_80);
+	guint64 cost = preferred->protect_ns + preferred->unprotect_ns;
+	if(fallback != NULL && fallback != preferred && fallback->preference > 0 && (fallback->protect_ns + fallback->unprotect_ns) > 0) {
+		JANUS_LOG(LOG_INFO, "Preferred SRTP profile is %s: expected cost %"SCNu64"ns per packet (%.0f%% of %s)\n",
+			janus_get_dtls_srtp_profile(preferred->id), cost,
+			(double)cost * 100 / (fallback->protect_ns + fallback->unprotect_ns),
+			janus_get_dtls_srtp_profile(fallback->id));
+	} else {
+		JANUS_LOG(LOG_INFO, "Preferred SRTP profile is %s: expected cost %"SCNu64"ns per packet\n",
+			janus_get_dtls_srtp_profile(preferred->id), cost);
+	}
+}
+
+json_t *janus_dtls_srtp_profiles_info(void) {
+	json_t *list = json_array();
+	janus_dtls_srtp_profile_info *info = NULL;
+	for(info = srtp_profiles; info->id != 0; info++) {
+		json_t *p = json_object();
+		json_object_set_new(p, "profile", json_string(janus_get_dtls_srtp_profile(info->id)));
+		if(info->preference > 0)
+			json_object_set_new(p, "preference", json_integer(info->preference));
+		json_object_set_new(p, "active-sessions", json_integer(g_atomic_int_get(&info->active)));
+		json_object_set_new(p, "total-sessions", json_integer((guint)g_atomic_int_get(&info->total)));
+		if(info->protect_ns > 0 || info->unprotect_ns > 0) {
+			json_object_set_new(p, "protect-ns", json_integer(info->protect_ns));
+			json_object_set_new(p, "unprotect-ns", json_integer(info->unprotect_ns));
+		}
+		json_array_append_new(list, p);
+	}
+	return list;
+}
+
 static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 	janus_dtls_srtp *dtls = janus_refcount_containerof(dtls_ref, janus_dtls_srtp, ref);
 	/* This stack can be destroyed, free all the resources */
@@ -532,6 +740,9 @@ static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 	dtls->read_bio = NULL;
 	dtls->write_bio = NULL;
 	if(dtls->srtp_valid) {
+		janus_dtls_srtp_profile_info *info = janus_dtls_srtp_profile_find(dtls->srtp_profile);
+		if(info != NULL)
+			g_atomic_int_add(&info->active, -1);
 		if(dtls->srtp_in) {
 			srtp_dealloc(dtls->srtp_in);
 			dtls->srtp_in = NULL;
@@ -950,6 +1161,11 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 				}
 				dtls->srtp_profile = srtp_profile->id;
 				dtls->srtp_valid = 1;
+				janus_dtls_srtp_profile_info *info = janus_dtls_srtp_profile_find(srtp_profile->id);
+				if(info != NULL) {
+					g_atomic_int_inc(&info->active);
+					g_atomic_int_inc(&info->total);
+				}
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Created outbound SRTP session for component %d in stream %d\n", handle->handle_id, pc->component_id, pc->stream_id);
 #ifdef HAVE_SCTP
 				if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS)) {
@@ -1058,11 +1274,11 @@ void janus_dtls_sctp_data_ready(janus_dtls_srtp *dtls) {
 	janus_ice_notify_data_ready(handle);
 }
 
-void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *label, char *protocol, gboolean textdata, char *buf, int len) {
+void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *label, char *protocol, gboolean textdata, char *buf, int len, gboolean more) {
 	if(dtls == NULL || !dtls->ready || dtls->sctp == NULL || buf == NULL || len < 1)
 		return;
 	janus_refcount_increase(&dtls->sctp->ref);
-	janus_sctp_send_data(dtls->sctp, label, protocol, textdata, buf, len);
+	janus_sctp_send_data(dtls->sctp, label, protocol, textdata, buf, len, more);
 	janus_refcount_decrease(&dtls->sctp->ref);
 }
 
@@ -17,6 +17,7 @@
 
 #include <inttypes.h>
 #include <glib.h>
+#include <jansson.h>
 
 #include "rtp.h"
 #include "rtpsrtp.h"
@@ -33,12 +34,20 @@ const char *janus_get_ssl_version(void);
  * @param[in] server_key Path to the key to use
  * @param[in] password Password needed to use the key, if any
  * @param[in] ciphers DTLS ciphers to use (will use hardcoded defaults, if NULL)
+ * @param[in] profiles SRTP profiles to offer, in order of preference (will use hardcoded defaults, if NULL)
  * @param[in] timeout DTLS timeout base, in ms, to use for retransmissions (ignored if not using BoringSSL)
  * @param[in] rsa_private_key Whether RSA certificates should be generated, instead of NIST P-256
  * @param[in] accept_selfsigned Whether to accept self-signed certificates (default) or enforce validation
  * @returns 0 in case of success, a negative integer on errors */
 gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password,
-	const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned);
+	const char *ciphers, const char *profiles, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned);
+/*! \brief Method to measure how expensive protecting and unprotecting packets
+ * is with each of the SRTP profiles we offer, and log the results
+ * \note Meant to be called once at startup, after janus_dtls_srtp_init */
+void janus_dtls_srtp_selftest(void);
+/*! \brief Method to get a summary of the SRTP profiles, for the Admin API
+ * @returns A JSON array with the preference, number of sessions and cost (if measured) of each profile */
+json_t *janus_dtls_srtp_profiles_info(void);
 /*! \brief Method to cleanup DTLS stuff before exiting */
 void janus_dtls_srtp_cleanup(void);
 /*! \brief Method to return a string representation (SHA-256) of the certificate fingerprint */
@@ -157,8 +166,9 @@ void janus_dtls_sctp_data_ready(janus_dtls_srtp *dtls);
  * @param[in] protocol The protocol of the data channel to use
  * @param[in] textdata Whether the buffer is text (domstring) or binary data
  * @param[in] buf The data buffer to encapsulate
- * @param[in] len The data length */
-void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *label, char *protocol, gboolean textdata, char *buf, int len);
+ * @param[in] len The data length
+ * @param[in] more Whether more messages will be wrapped right after this one (see janus_sctp_send_data) */
+void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *label, char *protocol, gboolean textdata, char *buf, int len, gboolean more);
 
 /*! \brief Callback (called from the SCTP stack) to encapsulate in DTLS outgoing SCTP data (DataChannel)
  * @param[in] dtls The janus_dtls_srtp instance to use
@@ -204,10 +204,41 @@ typedef struct janus_ice_static_event_loop {
 	GMainContext *mainctx;
 	GMainLoop *mainloop;
 	GThread *thread;
-	uint16_t handles;
+	int cpu;
+	volatile gint handles;
+	/* Coalesced RTCP/stats/TWCC timers for all the PeerConnections on this loop */
+	GSource *timers;
+	GPtrArray *scheduled;
+	janus_mutex timers_mutex;
+	/* Tasks that are due on the current tick (only accessed by the loop thread) */
+	GArray *due;
+	/* Load tracking, sampled by the loop thread itself once per second */
+	GSource *load_source;
+	gint64 last_sample, last_cpu_time;
+	guint64 packets, last_packets;
+	volatile gint load, packet_rate, recent_handles;
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_ice_static_event_loop;
+/* Each PeerConnection served by a static loop has its own deadlines, which
+ * the loop scheduler checks on every tick: the first deadlines get a random
+ * offset within the period, and later ones are always moved ahead by whole
+ * periods, so that handles keep that spread and don't all fire on the same tick */
+typedef struct janus_ice_scheduled_pc {
+	janus_ice_handle *handle;
+	gint64 next_rtcp;
+	gint64 next_stats;
+	gint64 next_twcc;
+} janus_ice_scheduled_pc;
+/* Tasks of a PeerConnection that are due on a scheduler tick */
+typedef struct janus_ice_scheduled_task {
+	janus_ice_handle *handle;
+	gboolean rtcp, twcc, stats;
+} janus_ice_scheduled_task;
+/* How often (in ms) the scheduler of a static loop checks the deadlines */
+#define JANUS_ICE_LOOP_SCHEDULER_TICK	20
+/* Difference in CPU usage (permille) between two loops before we move an idle handle */
+#define JANUS_ICE_LOOP_REBALANCE_THRESHOLD	100
 static void janus_ice_static_event_loop_destroy(janus_ice_static_event_loop *loop) {
 	if(!g_atomic_int_compare_and_exchange(&loop->destroyed, 0, 1))
 		return;
@@ -215,15 +246,85 @@ static void janus_ice_static_event_loop_destroy(janus_ice_static_event_loop *loo
 }
 static void janus_ice_static_event_loop_free(const janus_refcount *loop_ref) {
 	janus_ice_static_event_loop *loop = janus_refcount_containerof(loop_ref, janus_ice_static_event_loop, ref);
+	if(loop->timers != NULL) {
+		g_source_destroy(loop->timers);
+		g_source_unref(loop->timers);
+	}
+	if(loop->load_source != NULL) {
+		g_source_destroy(loop->load_source);
+		g_source_unref(loop->load_source);
+	}
+	if(loop->scheduled != NULL)
+		g_ptr_array_free(loop->scheduled, TRUE);
+	if(loop->due != NULL)
+		g_array_free(loop->due, TRUE);
+	janus_mutex_destroy(&loop->timers_mutex);
 	g_free(loop);
 }
 static int static_event_loops = 0;
 static gboolean allow_loop_indication = FALSE;
+static gboolean loop_rebalancing = FALSE;
+static GArray *loops_cpus = NULL;
+static int loops_numa_node = -1;
 static GSList *event_loops = NULL;
 static janus_mutex event_loops_mutex = JANUS_MUTEX_INITIALIZER;
+/* Helper to sample the CPU time used by the loop thread and the packets it handled */
+static gboolean janus_ice_static_event_loop_load(gpointer user_data) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)user_data;
+	gint64 now = janus_get_monotonic_time(), cpu_time = 0;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		cpu_time = (gint64)ts.tv_sec*G_USEC_PER_SEC + ts.tv_nsec/1000;
+#endif
+	if(loop->last_sample > 0 && now > loop->last_sample) {
+		gint64 elapsed = now - loop->last_sample;
+		g_atomic_int_set(&loop->load, (gint)((cpu_time - loop->last_cpu_time)*1000/elapsed));
+		g_atomic_int_set(&loop->packet_rate, (gint)((loop->packets - loop->last_packets)*G_USEC_PER_SEC/elapsed));
+	}
+	loop->last_sample = now;
+	loop->last_cpu_time = cpu_time;
+	loop->last_packets = loop->packets;
+	g_atomic_int_set(&loop->recent_handles, 0);
+	return G_SOURCE_CONTINUE;
+}
+/* Helper to estimate how busy a loop is: handles added since the last sample
+ * are weighted with the average cost of the existing ones, and loads in the
+ * same 2% bucket are considered equivalent, so the number of handles decides */
+static gint64 janus_ice_static_event_loop_weight(janus_ice_static_event_loop *loop) {
+	gint64 load = g_atomic_int_get(&loop->load);
+	int recent = g_atomic_int_get(&loop->recent_handles);
+	int handles = g_atomic_int_get(&loop->handles);
+	if(load > 0 && handles > recent)
+		load += recent * load / (handles - recent);
+	return ((load/20) << 16) + handles;
+}
+/* Helper to pick the least loaded loop (must be called with event_loops_mutex locked) */
+static janus_ice_static_event_loop *janus_ice_static_event_loop_pick(void) {
+	gint64 weight = -1;
+	janus_ice_static_event_loop *loop = NULL;
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *el = (janus_ice_static_event_loop *)l->data;
+		if(g_atomic_int_get(&el->handles) == 0) {
+			/* Best option, stop here */
+			loop = el;
+			break;
+		}
+		gint64 w = janus_ice_static_event_loop_weight(el);
+		if(weight == -1 || w < weight) {
+			weight = w;
+			loop = el;
+		}
+		l = l->next;
+	}
+	return loop;
+}
 static void *janus_ice_static_event_loop_thread(void *data) {
 	janus_ice_static_event_loop *loop = data;
 	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread started\n", loop->id);
+	if(loop->cpu > -1 && janus_thread_set_affinity(&loop->cpu, 1) == 0)
+		JANUS_LOG(LOG_VERB, "[loop#%d] Pinned to CPU %d\n", loop->id, loop->cpu);
 	if(loop->mainloop == NULL) {
 		JANUS_LOG(LOG_ERR, "[loop#%d] Invalid loop...\n", loop->id);
 		g_thread_unref(g_thread_self());
@@ -245,6 +346,80 @@ int janus_ice_get_static_event_loops(void) {
 gboolean janus_ice_is_loop_indication_allowed(void) {
 	return allow_loop_indication;
 }
+void janus_ice_set_loop_rebalancing(gboolean enabled) {
+	if(static_event_loops < 1)
+		return;
+	loop_rebalancing = enabled;
+	JANUS_LOG(LOG_INFO, "  -- Idle handles %s be moved to less loaded event loops\n",
+		loop_rebalancing ? "will" : "will NOT");
+}
+gboolean janus_ice_is_loop_rebalancing_enabled(void) {
+	return loop_rebalancing;
+}
+void janus_ice_set_static_event_loops_affinity(const char *cpus, const char *iface) {
+	if(cpus != NULL) {
+		loops_cpus = janus_cpu_list_parse(cpus);
+		if(loops_cpus == NULL)
+			JANUS_LOG(LOG_WARN, "Invalid CPU list for the static event loops (%s), ignoring\n", cpus);
+	}
+	if(iface != NULL) {
+		/* Only use the CPUs on the same NUMA node as the network interface */
+		loops_numa_node = janus_network_get_numa_node(iface);
+		GArray *node_cpus = janus_numa_node_cpus(loops_numa_node);
+		if(node_cpus == NULL) {
+			JANUS_LOG(LOG_WARN, "Couldn't get the NUMA node CPUs for %s, ignoring\n", iface);
+			loops_numa_node = -1;
+			return;
+		}
+		if(loops_cpus == NULL) {
+			loops_cpus = node_cpus;
+		} else {
+			/* Intersect the configured CPUs with the ones on the NUMA node */
+			GArray *cpus_list = g_array_new(FALSE, FALSE, sizeof(int));
+			guint i = 0, j = 0;
+			for(i=0; i<loops_cpus->len; i++) {
+				int cpu = g_array_index(loops_cpus, int, i);
+				for(j=0; j<node_cpus->len; j++) {
+					if(g_array_index(node_cpus, int, j) == cpu) {
+						g_array_append_val(cpus_list, cpu);
+						break;
+					}
+				}
+			}
+			g_array_free(node_cpus, TRUE);
+			if(cpus_list->len == 0) {
+				JANUS_LOG(LOG_WARN, "None of the configured CPUs is on NUMA node %d (%s), ignoring the node\n",
+					loops_numa_node, iface);
+				g_array_free(cpus_list, TRUE);
+				loops_numa_node = -1;
+			} else {
+				g_array_free(loops_cpus, TRUE);
+				loops_cpus = cpus_list;
+			}
+		}
+	}
+	if(loops_cpus != NULL) {
+		char *list = janus_cpu_list_print((int *)loops_cpus->data, loops_cpus->len);
+		JANUS_LOG(LOG_INFO, "Static event loops will be pinned to CPUs %s\n", list);
+		g_free(list);
+	}
+}
+char *janus_ice_get_static_event_loops_affinity(void) {
+	if(loops_cpus == NULL)
+		return NULL;
+	return janus_cpu_list_print((int *)loops_cpus->data, loops_cpus->len);
+}
+int janus_ice_get_static_event_loops_numa_node(void) {
+	return loops_numa_node;
+}
+int janus_ice_handle_inherit_affinity(janus_ice_handle *handle) {
+	if(handle == NULL || handle->static_event_loop == NULL)
+		return -1;
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_event_loop;
+	if(loop->cpu < 0)
+		return -1;
+	return janus_thread_set_affinity(&loop->cpu, 1);
+}
 void janus_ice_set_static_event_loops(int loops, gboolean allow_api) {
 	if(loops == 0)
 		return;
@@ -257,8 +432,16 @@ void janus_ice_set_static_event_loops(int loops, gboolean allow_api) {
 	for(i=0; i<loops; i++) {
 		janus_ice_static_event_loop *loop = g_malloc0(sizeof(janus_ice_static_event_loop));
 		loop->id = static_event_loops;
+		/* If we have a CPU list, loops are pinned to its CPUs in a round robin fashion */
+		loop->cpu = loops_cpus ? g_array_index(loops_cpus, int, loop->id % loops_cpus->len) : -1;
 		loop->mainctx = g_main_context_new();
 		loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
+		loop->scheduled = g_ptr_array_new_with_free_func((GDestroyNotify)g_free);
+		janus_mutex_init(&loop->timers_mutex);
+		loop->load_source = g_timeout_source_new_seconds(1);
+		g_source_set_priority(loop->load_source, G_PRIORITY_DEFAULT);
+		g_source_set_callback(loop->load_source, janus_ice_static_event_loop_load, loop, NULL);
+		g_source_attach(loop->load_source, loop->mainctx);
 		janus_refcount_init(&loop->ref, janus_ice_static_event_loop_free);
 		/* Now spawn a thread for this loop */
 		GError *error = NULL;
@@ -295,7 +478,14 @@ json_t *janus_ice_static_event_loops_info(void) {
 		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
 		json_t *info = json_object();
 		json_object_set_new(info, "id", json_integer(loop->id));
-		json_object_set_new(info, "handles", json_integer(loop->handles));
+		json_object_set_new(info, "handles", json_integer(g_atomic_int_get(&loop->handles)));
+		if(loop->cpu > -1)
+			json_object_set_new(info, "cpu", json_integer(loop->cpu));
+		janus_mutex_lock(&loop->timers_mutex);
+		json_object_set_new(info, "scheduled", json_integer(loop->scheduled ? loop->scheduled->len : 0));
+		janus_mutex_unlock(&loop->timers_mutex);
+		json_object_set_new(info, "cpu-usage", json_real((double)g_atomic_int_get(&loop->load)/10));
+		json_object_set_new(info, "packet-rate", json_integer(g_atomic_int_get(&loop->packet_rate)));
 		json_array_append_new(list, info);
 		l = l->next;
 	}
@@ -316,6 +506,9 @@ void janus_ice_stop_static_event_loops(void) {
 		l = l->next;
 	}
 	g_slist_free_full(event_loops, (GDestroyNotify)janus_ice_static_event_loop_destroy);
+	if(loops_cpus != NULL)
+		g_array_free(loops_cpus, TRUE);
+	loops_cpus = NULL;
 	janus_mutex_unlock(&event_loops_mutex);
 }
 
@@ -470,10 +663,17 @@ typedef struct janus_ice_queued_packet {
 	char *protocol;
 	janus_plugin_rtp_extensions extensions;
 	gint length;
+	/* Size of the data buffer: for SRTP-ready buffers, it includes the
+	 * room to add RTP extensions and protect the packet in place */
+	gint size;
 	gint type;
 	gboolean control;
 	gboolean retransmission;
 	gboolean encrypted;
+	/* For padding-only packets, the probe cluster they're part of */
+	guint16 probe;
+	/* For data packets, whether more data packets follow in the same batch */
+	gboolean more;
 	gint64 added;
 } janus_ice_queued_packet;
 /* A few static, fake, messages we use as a trigger: e.g., to start a
@@ -535,27 +735,113 @@ typedef struct janus_ice_outgoing_traffic {
 	GSource parent;
 	janus_ice_handle *handle;
 	GDestroyNotify destroy;
+	/* Set when the handle was moved to a different static loop */
+	volatile gint migrated;
+	/* Whether we set a ready time on the source, to release paced packets */
+	gboolean paced;
 } janus_ice_outgoing_traffic;
 static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data);
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data);
+static void janus_ice_static_event_loop_unschedule(janus_ice_handle *handle);
 static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janus_ice_queued_packet *pkt);
+static void janus_ice_free_queued_packet(janus_ice_queued_packet *pkt);
 static gboolean janus_ice_outgoing_traffic_prepare(GSource *source, gint *timeout) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
 	return (g_async_queue_length(t->handle->queued_packets) > 0);
 }
+/* Maximum number of consecutive DataChannel messages we pass to the SCTP
+ * stack as a single batch, so that they can be bundled in the same packets */
+#define JANUS_ICE_SCTP_MAX_BATCH	32
+/* Outgoing media is paced at a multiple of the bandwidth we think is available */
+#define JANUS_ICE_PACING_FACTOR	2.5
+static void janus_ice_pacer_update_rate(janus_ice_peerconnection *pc) {
+	if(pc == NULL || pc->pacer == NULL)
+		return;
+	guint32 target = pc->bwe ? janus_bwe_context_get_estimate(pc->bwe) : pc->remb_bitrate;
+	janus_pacer_set_rate(pc->pacer, (guint32)(JANUS_ICE_PACING_FACTOR * target));
+}
+/* Helper to check whether a packet should go through the pacer: audio is
+ * never paced (it's just accounted for), while video and retransmissions are */
+static gboolean janus_ice_pacer_enqueue(janus_ice_handle *handle, janus_ice_queued_packet *pkt, gint64 now) {
+	janus_ice_peerconnection *pc = handle->pc;
+	if(pc == NULL || pkt->data == NULL || pkt->control ||
+			(pkt->type != JANUS_ICE_PACKET_AUDIO && pkt->type != JANUS_ICE_PACKET_VIDEO))
+		return FALSE;
+	if(pkt->type == JANUS_ICE_PACKET_AUDIO && !pkt->retransmission) {
+		janus_pacer_account(pc->pacer, pkt->length, now);
+		return FALSE;
+	}
+	if(pc->pacer == NULL) {
+		if(!g_atomic_int_get(&handle->pacing))
+			return FALSE;
+		pc->pacer = janus_pacer_create((GDestroyNotify)janus_ice_free_queued_packet);
+		janus_ice_pacer_update_rate(pc);
+	}
+	/* If pacing was disabled, or we have no idea of the bandwidth yet, we
+	 * only queue packets when needed to preserve their order */
+	if((!g_atomic_int_get(&handle->pacing) || janus_pacer_get_rate(pc->pacer) == 0) && janus_pacer_is_empty(pc->pacer))
+		return FALSE;
+	janus_pacer_enqueue(pc->pacer, pkt, pkt->length, pkt->retransmission ?
+		janus_pacer_priority_retransmission : janus_pacer_priority_video, now);
+	return TRUE;
+}
+/* Send the packets the pacer allows us to, and check when we'll have to do that again */
+static void janus_ice_pacer_drain(janus_ice_outgoing_traffic *t) {
+	janus_ice_handle *handle = t->handle;
+	janus_ice_peerconnection *pc = handle->pc;
+	gint64 next = -1;
+	if(pc != NULL && pc->pacer != NULL) {
+		gint64 now = janus_get_monotonic_time();
+		gboolean flush = (!g_atomic_int_get(&handle->pacing) || janus_pacer_get_rate(pc->pacer) == 0);
+		janus_ice_queued_packet *pkt = NULL;
+		while((pkt = janus_pacer_dequeue(pc->pacer, now, flush)) != NULL)
+			janus_ice_outgoing_traffic_handle(handle, pkt);
+		next = janus_pacer_next(pc->pacer, now);
+	}
+	if(next < 0 && !t->paced)
+		return;
+	/* Wake the loop up when the next packet can be sent */
+	t->paced = (next >= 0);
+	g_source_set_ready_time((GSource *)t, next < 0 ? -1 : g_source_get_time((GSource *)t) + next);
+}
 static gboolean janus_ice_outgoing_traffic_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
 	int ret = G_SOURCE_CONTINUE;
-	janus_ice_queued_packet *pkt = NULL;
-	while((pkt = g_async_queue_try_pop(t->handle->queued_packets)) != NULL) {
+	janus_ice_queued_packet *pkt = NULL, *next = NULL;
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)t->handle->static_event_loop;
+	int batch = 0;
+	while((pkt = (next ? next : g_async_queue_try_pop(t->handle->queued_packets))) != NULL) {
+		next = NULL;
+		if(pkt->type == JANUS_ICE_PACKET_TEXT || pkt->type == JANUS_ICE_PACKET_BINARY) {
+			/* We look one packet ahead, to know whether this DataChannel message
+			 * is followed by another one, and so part of a batch we can bundle */
+			next = g_async_queue_try_pop(t->handle->queued_packets);
+			batch++;
+			pkt->more = (next != NULL && batch < JANUS_ICE_SCTP_MAX_BATCH &&
+				(next->type == JANUS_ICE_PACKET_TEXT || next->type == JANUS_ICE_PACKET_BINARY));
+			if(!pkt->more)
+				batch = 0;
+		}
+		if(loop != NULL)
+			loop->packets++;
+		/* When pacing, media packets may have to wait for their turn */
+		if(janus_ice_pacer_enqueue(t->handle, pkt, janus_get_monotonic_time()))
+			continue;
 		if(janus_ice_outgoing_traffic_handle(t->handle, pkt) == G_SOURCE_REMOVE)
 			ret = G_SOURCE_REMOVE;
 	}
+	if(ret == G_SOURCE_CONTINUE)
+		janus_ice_pacer_drain(t);
 	return ret;
 }
 static void janus_ice_outgoing_traffic_finalize(GSource *source) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Finalizing loop source\n", t->handle->handle_id);
+	if(g_atomic_int_get(&t->migrated)) {
+		/* The handle was moved to another loop, which has a new source for it */
+		janus_refcount_decrease(&t->handle->ref);
+		return;
+	}
 	if(static_event_loops > 0) {
 		/* This handle was sharing an event loop with others */
 		janus_ice_webrtc_free(t->handle);
@@ -634,6 +920,53 @@ uint janus_get_twcc_period(void) {
 	return twcc_period;
 }
 
+/* Pacing of outgoing media: it's disabled by default, and can be overridden on a per-handle basis */
+static gboolean pacing = FALSE;
+void janus_set_pacing_enabled(gboolean enabled) {
+	pacing = enabled;
+	JANUS_LOG(LOG_VERB, "%s pacing of outgoing media\n", pacing ? "Enabling" : "Disabling");
+}
+gboolean janus_is_pacing_enabled(void) {
+	return pacing;
+}
+
+/* Probing for more bandwidth on PeerConnections we have an estimate for:
+ * it's disabled by default, and can be overridden on a per-handle basis */
+#define DEFAULT_BWE_PROBING_INTERVAL	5000
+#define DEFAULT_BWE_PROBING_MAX		2500000
+static gboolean bwe_probing = FALSE;
+static uint bwe_probing_interval = DEFAULT_BWE_PROBING_INTERVAL;
+static uint32_t bwe_probing_max = DEFAULT_BWE_PROBING_MAX;
+void janus_set_bwe_probing_enabled(gboolean enabled) {
+	bwe_probing = enabled;
+	JANUS_LOG(LOG_VERB, "%s bandwidth probing\n", bwe_probing ? "Enabling" : "Disabling");
+}
+gboolean janus_is_bwe_probing_enabled(void) {
+	return bwe_probing;
+}
+void janus_set_bwe_probing_interval(uint interval) {
+	if(interval < 1000) {
+		JANUS_LOG(LOG_WARN, "Invalid bandwidth probing interval, falling back to default\n");
+		interval = DEFAULT_BWE_PROBING_INTERVAL;
+	}
+	bwe_probing_interval = interval;
+	JANUS_LOG(LOG_VERB, "Setting bandwidth probing interval to %ums\n", bwe_probing_interval);
+}
+uint janus_get_bwe_probing_interval(void) {
+	return bwe_probing_interval;
+}
+void janus_set_bwe_probing_max(uint32_t max_bitrate) {
+	if(max_bitrate == 0) {
+		JANUS_LOG(LOG_WARN, "Invalid bandwidth probing maximum, falling back to default\n");
+		max_bitrate = DEFAULT_BWE_PROBING_MAX;
+	}
+	bwe_probing_max = max_bitrate;
+	JANUS_LOG(LOG_VERB, "Setting bandwidth probing maximum to %"SCNu32"bps\n", bwe_probing_max);
+}
+uint32_t janus_get_bwe_probing_max(void) {
+	return bwe_probing_max;
+}
+
 /* DSCP value, which we can set via libnice: it's disabled by default */
 static int dscp_ef = 0;
 void janus_set_dscp(int dscp) {
@@ -1410,6 +1743,10 @@ janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque
 	handle->app_handle = NULL;
 	handle->queued_candidates = g_async_queue_new();
 	handle->queued_packets = g_async_queue_new();
+	g_atomic_int_set(&handle->pacing, pacing);
+	g_atomic_int_set(&handle->bwe_probing, bwe_probing);
+	handle->bwe_probing_interval = bwe_probing_interval;
+	handle->bwe_probing_max = bwe_probing_max;
 	janus_mutex_init(&handle->mutex);
 	janus_session_handles_insert(session, handle);
 	return handle;
@@ -1470,30 +1807,19 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 				automatic_selection = FALSE;
 				handle->mainctx = loop->mainctx;
 				handle->mainloop = loop->mainloop;
-				loop->handles++;
+				handle->static_event_loop = loop;
+				handle->static_event_loop_pinned = TRUE;
+				g_atomic_int_inc(&loop->handles);
+				g_atomic_int_inc(&loop->recent_handles);
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Manually added handle to loop #%d\n", handle->handle_id, loop->id);
 			}
 		}
 		if(automatic_selection) {
 			/* Pick an available loop automatically (least loaded) */
-			int handles = -1;
-			janus_ice_static_event_loop *loop = NULL;
-			GSList *l = event_loops;
-			while(l) {
-				janus_ice_static_event_loop *el = (janus_ice_static_event_loop *)l->data;
-				if(el->handles == 0) {
-					/* Best option, stop here */
-					loop = el;
-					break;
-				}
-				if(handles == -1 || el->handles < handles) {
-					handles = el->handles;
-					loop = el;
-				}
-				l = l->next;
-			}
+			janus_ice_static_event_loop *loop = janus_ice_static_event_loop_pick();
 			janus_refcount_increase(&loop->ref);
-			loop->handles++;
+			g_atomic_int_inc(&loop->handles);
+			g_atomic_int_inc(&loop->recent_handles);
 			handle->mainctx = loop->mainctx;
 			handle->mainloop = loop->mainloop;
 			handle->static_event_loop = loop;
@@ -1551,7 +1877,7 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 	janus_mutex_lock(&event_loops_mutex);
 	if(handle->static_event_loop != NULL) {
 		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_event_loop;
-		loop->handles--;
+		g_atomic_int_add(&loop->handles, -1);
 		janus_refcount_decrease(&loop->ref);
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Manually removed handle from loop #%d\n", handle->handle_id, loop->id);
 	}
@@ -1807,8 +2133,12 @@ static void janus_ice_peerconnection_free(const janus_refcount *pc_ref) {
 	pc->ruser = NULL;
 	g_free(pc->rpass);
 	pc->rpass = NULL;
-	g_slist_free_full(pc->transport_wide_received_seq_nums, (GDestroyNotify)g_free);
-	pc->transport_wide_received_seq_nums = NULL;
+	janus_rtcp_transport_wide_cc_ring_destroy(pc->transport_wide_cc_ring);
+	pc->transport_wide_cc_ring = NULL;
+	janus_bwe_context_destroy(pc->bwe);
+	pc->bwe = NULL;
+	janus_pacer_destroy(pc->pacer);
+	pc->pacer = NULL;
 	if(pc->candidates != NULL) {
 		GSList *i = NULL, *candidates = pc->candidates;
 		for(i = candidates; i; i = i->next) {
@@ -1992,6 +2322,14 @@ static void janus_ice_peerconnection_medium_free(const janus_refcount *medium_re
 	//~ janus_mutex_unlock(&handle->mutex);
 }
 
+/* Call plugin estimated_bandwidth callback, if the plugin implements it */
+static void janus_ice_notify_estimated_bandwidth(janus_ice_handle *handle, uint32_t estimate) {
+	janus_plugin *plugin = (janus_plugin *)handle->app;
+	if(plugin && plugin->estimated_bandwidth && janus_plugin_session_is_alive(handle->app_handle) &&
+			!g_atomic_int_get(&handle->destroyed))
+		plugin->estimated_bandwidth(handle->app_handle, estimate);
+}
+
 /* Call plugin slow_link callback if a minimum of lost packets are detected within a second */
 static void
 janus_slow_link_update(janus_ice_peerconnection_medium *medium, janus_ice_handle *handle,
@@ -2578,6 +2916,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Forced to stop it here...\n", handle->handle_id);
 		return;
 	}
+	if(handle->static_event_loop != NULL)
+		((janus_ice_static_event_loop *)handle->static_event_loop)->packets++;
 	/* What is this? */
 	if(janus_is_dtls(buf) || (!janus_is_rtp(buf, len) && !janus_is_rtcp(buf, len))) {
 		/* This is DTLS: either handshake stuff, or data coming from SCTP DataChannels */
@@ -2598,7 +2938,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 	if(janus_is_rtp(buf, len)) {
 		/* This is RTP */
 		if(janus_is_webrtc_encryption_enabled() && (!pc->dtls || !pc->dtls->srtp_valid || !pc->dtls->srtp_in)) {
-			JANUS_LOG(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
+			JANUS_LOG_RATELIMITED(LOG_WARN, 10, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
 		} else {
 			janus_rtp_header *header = (janus_rtp_header *)buf;
 			guint32 packet_ssrc = ntohl(header->ssrc);
@@ -2609,7 +2949,10 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				/* SSRC not found, try the mid/rid RTP extensions if in use */
 				if(pc->mid_ext_id > 0) {
 					char sdes_item[16];
-					if(janus_rtp_header_extension_parse_mid(buf, len, pc->mid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
+					/* Parse the extensions once, as we may need mid, rid and repaired-rid */
+					janus_rtp_header_extensions exts;
+					janus_rtp_header_extensions_parse(buf, len, &exts);
+					if(janus_rtp_header_extensions_get_mid(&exts, pc->mid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 						medium = g_hash_table_lookup(pc->media_bymid, sdes_item);
 						if(medium != NULL) {
 							/* Found! Associate this SSRC to this stream */
@@ -2622,7 +2965,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								medium->ssrc_peer[0] = packet_ssrc;
 								found = TRUE;
 							} else {
-								if(janus_rtp_header_extension_parse_rid(buf, len, pc->rid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
+								if(janus_rtp_header_extensions_get_rid(&exts, pc->rid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 									/* Try the RTP stream ID */
 									if(medium->rid[0] != NULL && !strcmp(medium->rid[0], sdes_item)) {
 										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s\n", handle->handle_id, sdes_item);
@@ -2637,10 +2980,10 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 										medium->ssrc_peer[2] = packet_ssrc;
 										found = TRUE;
 									} else {
-										JANUS_LOG(LOG_WARN, "[%"SCNu64"]  -- Simulcasting: unknown rid %s..?\n", handle->handle_id, sdes_item);
+										JANUS_LOG_RATELIMITED(LOG_WARN, 10, "[%"SCNu64"]  -- Simulcasting: unknown rid %s..?\n", handle->handle_id, sdes_item);
 									}
 								} else if(pc->ridrtx_ext_id > 0 &&
-										janus_rtp_header_extension_parse_rid(buf, len, pc->ridrtx_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
+										janus_rtp_header_extensions_get_rid(&exts, pc->ridrtx_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 									/* Try the repaired RTP stream ID */
 									if(medium->rid[0] != NULL && !strcmp(medium->rid[0], sdes_item)) {
 										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s (rtx)\n", handle->handle_id, sdes_item);
@@ -2655,7 +2998,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 										medium->ssrc_peer_rtx[2] = packet_ssrc;
 										found = TRUE;
 									} else {
-										JANUS_LOG(LOG_WARN, "[%"SCNu64"]  -- Simulcasting: unknown rid %s..?\n", handle->handle_id, sdes_item);
+										JANUS_LOG_RATELIMITED(LOG_WARN, 10, "[%"SCNu64"]  -- Simulcasting: unknown rid %s..?\n", handle->handle_id, sdes_item);
 									}
 								}
 							}
@@ -2671,7 +3014,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 			}
 			if(medium == NULL) {
-				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Unknown SSRC, dropping packet (SSRC %"SCNu32")...\n",
+				JANUS_LOG_RATELIMITED(LOG_WARN, 10, "[%"SCNu64"] Unknown SSRC, dropping packet (SSRC %"SCNu32")...\n",
 					handle->handle_id, packet_ssrc);
 				return;
 			}
@@ -2719,7 +3062,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Only print the error if it's not a 'replay fail' or 'replay old' (which is probably just the result of us NACKing a packet) */
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
+					JANUS_LOG_RATELIMITED(LOG_ERR, 10, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
 				}
 			} else {
 				if((!video && medium->ssrc_peer[0] == 0) || (vindex == 0 && medium->ssrc_peer[0] == 0)) {
@@ -2760,16 +3103,19 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						}
 					}
 				}
+				/* Find all the RTP extensions in a single pass: all the lookups
+				 * we do from now on (transport-wide CC, and the extensions we
+				 * pass to the plugin) will not need to parse the packet again */
+				janus_rtp_header_extensions exts;
+				janus_rtp_header_extensions_parse(buf, buflen, &exts);
 				/* Check if we need to handle transport wide cc */
 				if(pc->do_transport_wide_cc) {
 					guint16 transport_seq_num;
 					/* Get transport wide seq num */
-					if(janus_rtp_header_extension_parse_transport_wide_cc(buf, buflen, pc->transport_wide_cc_ext_id, &transport_seq_num) == 0) {
+					if(janus_rtp_header_extensions_get_transport_wide_cc(&exts, pc->transport_wide_cc_ext_id, &transport_seq_num) == 0) {
 						/* Get current timestamp */
 						struct timeval now;
 						gettimeofday(&now,0);
-						/* Create <seq num, time> pair */
-						janus_rtcp_transport_wide_cc_stats *stats = g_malloc0(sizeof(janus_rtcp_transport_wide_cc_stats));
 						/* Check if we have a sequence wrap */
 						if(transport_seq_num<0x0FFF && (pc->transport_wide_cc_last_seq_num&0xFFFF)>0xF000) {
 							/* Increase cycles */
@@ -2779,12 +3125,12 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						guint32 transport_ext_seq_num = pc->transport_wide_cc_cycles<<16 | transport_seq_num;
 						/* Store last received transport seq num */
 						pc->transport_wide_cc_last_seq_num = transport_seq_num;
-						/* Set stats values */
-						stats->transport_seq_num = transport_ext_seq_num;
-						stats->timestamp = (((guint64)now.tv_sec)*1E6+now.tv_usec);
-						/* Lock and append to received list */
+						/* Lock and track the arrival time in the ring */
 						janus_mutex_lock(&pc->mutex);
-						pc->transport_wide_received_seq_nums = g_slist_prepend(pc->transport_wide_received_seq_nums, stats);
+						if(pc->transport_wide_cc_ring == NULL)
+							pc->transport_wide_cc_ring = janus_rtcp_transport_wide_cc_ring_create();
+						janus_rtcp_transport_wide_cc_ring_add(pc->transport_wide_cc_ring,
+							transport_ext_seq_num, ((guint64)now.tv_sec)*G_USEC_PER_SEC + now.tv_usec);
 						janus_mutex_unlock(&pc->mutex);
 					}
 				}
@@ -2857,7 +3203,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(!video && pc->audiolevel_ext_id != -1) {
 					gboolean vad = FALSE;
 					int level = -1;
-					if(janus_rtp_header_extension_parse_audio_level(buf, buflen,
+					if(janus_rtp_header_extensions_get_audio_level(&exts,
 							pc->audiolevel_ext_id, &vad, &level) == 0) {
 						rtp.extensions.audio_level = level;
 						rtp.extensions.audio_level_vad = vad;
@@ -2865,7 +3211,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 				if(video && pc->videoorientation_ext_id != -1) {
 					gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-					if(janus_rtp_header_extension_parse_video_orientation(buf, buflen,
+					if(janus_rtp_header_extensions_get_video_orientation(&exts,
 							pc->videoorientation_ext_id, &c, &f, &r1, &r0) == 0) {
 						rtp.extensions.video_rotation = 0;
 						if(r1 && r0)
@@ -2880,7 +3226,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 				if(video && pc->playoutdelay_ext_id != -1) {
 					uint16_t min = 0, max = 0;
-					if(janus_rtp_header_extension_parse_playout_delay(buf, buflen,
+					if(janus_rtp_header_extensions_get_playout_delay(&exts,
 							pc->playoutdelay_ext_id, &min, &max) == 0) {
 						rtp.extensions.min_delay = min;
 						rtp.extensions.max_delay = max;
@@ -2889,7 +3235,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(video && pc->dependencydesc_ext_id != -1) {
 					uint8_t dd[256];
 					int len = sizeof(dd);
-					if(janus_rtp_header_extension_parse_dependency_desc(buf, buflen,
+					if(janus_rtp_header_extensions_get_dependency_desc(&exts,
 							pc->dependencydesc_ext_id, dd, &len) == 0 && len > 0) {
 						/* We copy the DD bytes as they are: it's up to plugins to parse it, if needed */
 						rtp.extensions.dd_len = len;
@@ -2898,7 +3244,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 				if(pc->abs_capture_time_ext_id != -1) {
 					uint64_t abs_ts = 0;
-					if(janus_rtp_header_extension_parse_abs_capture_time(buf, buflen,
+					if(janus_rtp_header_extensions_get_abs_capture_time(&exts,
 							pc->abs_capture_time_ext_id, &abs_ts) == 0) {
 						rtp.extensions.abs_capture_ts = abs_ts;
 					}
@@ -3083,20 +3429,23 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		/* This is RTCP */
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"]  Got an RTCP packet\n", handle->handle_id);
 		if(janus_is_webrtc_encryption_enabled() && (!pc->dtls || !pc->dtls->srtp_valid || !pc->dtls->srtp_in)) {
-			JANUS_LOG(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
+			JANUS_LOG_RATELIMITED(LOG_WARN, 10, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
 		} else {
 			int buflen = len;
 			srtp_err_status_t res = janus_is_webrtc_encryption_enabled() ?
 				srtp_unprotect_rtcp(pc->dtls->srtp_in, buf, &buflen) : srtp_err_status_ok;
 			if(res != srtp_err_status_ok) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
+				JANUS_LOG_RATELIMITED(LOG_ERR, 10, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
 			} else {
 				/* Do we need to dump this packet for debugging? */
 				if(g_atomic_int_get(&handle->dump_packets))
 					janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTCP, TRUE, buf, buflen,
 						"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
+				/* Parse the compound packet once, to see what's in there */
+				janus_rtcp_summary summary;
+				janus_rtcp_summarize(buf, buflen, &summary);
 				/* Check if there's an RTCP BYE: in case, let's log it */
-				if(janus_rtcp_has_bye(buf, buflen)) {
+				if(summary.bye) {
 					/* Note: we used to use this as a trigger to close the PeerConnection, but not anymore
 					 * Discussion here, https://groups.google.com/forum/#!topic/meetecho-janus/4XtfbYB7Jvc */
 					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got RTCP BYE on stream %u (component %u)\n", handle->handle_id, stream_id, component_id);
@@ -3158,23 +3507,37 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Got %s RTCP (%d bytes)\n", handle->handle_id, video ? "video" : "audio", buflen);
 				/* See if there's any REMB bitrate to track */
-				uint32_t bitrate = janus_rtcp_get_remb(buf, buflen);
-				if(bitrate > 0)
-					pc->remb_bitrate = bitrate;
+				if(summary.remb > 0) {
+					pc->remb_bitrate = summary.remb;
+					if(pc->bwe == NULL)
+						janus_ice_pacer_update_rate(pc);
+				}
+				/* If we're estimating the bandwidth, see if there's any transport-wide CC feedback */
+				if(pc->bwe != NULL && summary.twcc >= 0) {
+					janus_rtcp_transport_wide_cc_report reports[JANUS_RTCP_TWCC_MAX_FEEDBACK];
+					int reports_num = janus_rtcp_transport_wide_cc_parse(buf, buflen, reports, JANUS_RTCP_TWCC_MAX_FEEDBACK);
+					if(reports_num > 0 && janus_bwe_context_feedback(pc->bwe, reports, reports_num, janus_get_monotonic_time())) {
+						janus_ice_notify_estimated_bandwidth(handle, janus_bwe_context_get_estimate(pc->bwe));
+						janus_ice_pacer_update_rate(pc);
+					}
+				}
 
 				/* Now let's see if there are any NACKs to handle */
 				gint64 now = janus_get_monotonic_time();
-				GSList *nacks = janus_rtcp_get_nacks(buf, buflen);
-				guint nacks_count = g_slist_length(nacks);
-				if(nacks_count && medium->do_nacks) {
+				janus_rtcp_nack_iter nacks;
+				if(janus_rtcp_nack_iter_init(&nacks, buf, &summary) && medium->do_nacks) {
 					/* Handle NACK */
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"]     Just got some NACKS (%d) we should handle...\n", handle->handle_id, nacks_count);
+					JANUS_LOG(LOG_HUGE, "[%"SCNu64"]     Just got some NACKS (%d) we should handle...\n", handle->handle_id, summary.nack_count);
 					GHashTable *retransmit_seqs = medium->retransmit_seqs;
-					GSList *list = (retransmit_seqs != NULL ? nacks : NULL);
+					guint nacks_count = 0;
 					int retransmits_cnt = 0;
+					uint16_t seq = 0;
 					janus_mutex_lock(&medium->mutex);
-					while(list) {
-						unsigned int seqnr = GPOINTER_TO_UINT(list->data);
+					while(janus_rtcp_nack_iter_next(&nacks, &seq)) {
+						nacks_count++;
+						if(retransmit_seqs == NULL)
+							continue;
+						unsigned int seqnr = seq;
 						JANUS_LOG(LOG_DBG, "[%"SCNu64"]   >> %u\n", handle->handle_id, seqnr);
 						int in_rb = 0;
 						/* Check if we have the packet */
@@ -3185,7 +3548,6 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							/* Should we retransmit this packet? */
 							if((p->last_retransmit > 0) && (now-p->last_retransmit < MAX_NACK_IGNORE)) {
 								JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Packet %u was retransmitted just %"SCNi64"ms ago, skipping\n", handle->handle_id, seqnr, now-p->last_retransmit);
-								list = list->next;
 								continue;
 							}
 							in_rb = 1;
@@ -3195,13 +3557,13 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							/* Enqueue it */
 							janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
 							pkt->mindex = medium->mindex;
-							pkt->data = g_malloc(p->length+SRTP_MAX_TAG_LEN);
-							memcpy(pkt->data, p->data, p->length);
+							pkt->data = janus_srtp_buffer_dup(p->data, p->length, &pkt->size);
 							pkt->length = p->length;
 							pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 							pkt->extensions = p->extensions;
 							pkt->control = FALSE;
 							pkt->retransmission = TRUE;
+							pkt->probe = 0;
 							pkt->label = NULL;
 							pkt->protocol = NULL;
 							pkt->added = janus_get_monotonic_time();
@@ -3232,7 +3594,6 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						if(rtcp_ctx != NULL && in_rb) {
 							g_atomic_int_inc(&rtcp_ctx->nack_count);
 						}
-						list = list->next;
 					}
 					medium->retransmit_recent_cnt += retransmits_cnt;
 					/* FIXME Remove the NACK compound packet, we've handled it */
@@ -3240,8 +3601,6 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Update stats */
 					medium->in_stats.info[vindex].nacks += nacks_count;
 					janus_mutex_unlock(&medium->mutex);
-					g_slist_free(nacks);
-					nacks = NULL;
 				}
 				if(medium->retransmit_recent_cnt &&
 						now - medium->retransmit_log_ts > 5*G_USEC_PER_SEC) {
@@ -3571,6 +3930,124 @@ void janus_ice_setup_remote_candidates(janus_ice_handle *handle, guint stream_id
 	pc->process_started = TRUE;
 }
 
+/* Moving a handle to a different static loop is done by the loop the
+ * handle is currently on, as that's the only thread that can safely get
+ * rid of the outgoing traffic source: the thread setting up the handle
+ * waits for that to happen before creating the agent on the new loop */
+typedef struct janus_ice_loop_migration {
+	janus_ice_handle *handle;
+	janus_ice_static_event_loop *current, *target;
+	janus_mutex mutex;
+	janus_condition cond;
+	gboolean done, cancelled;
+	volatile gint refs;
+} janus_ice_loop_migration;
+static void janus_ice_loop_migration_unref(gpointer user_data) {
+	janus_ice_loop_migration *m = (janus_ice_loop_migration *)user_data;
+	if(!g_atomic_int_dec_and_test(&m->refs))
+		return;
+	janus_refcount_decrease(&m->handle->ref);
+	janus_refcount_decrease(&m->current->ref);
+	janus_refcount_decrease(&m->target->ref);
+	janus_mutex_destroy(&m->mutex);
+	janus_condition_destroy(&m->cond);
+	g_free(m);
+}
+/* Must be called by the thread of the loop the handle is currently on */
+static void janus_ice_loop_migration_do(janus_ice_loop_migration *m) {
+	janus_ice_handle *handle = m->handle;
+	janus_ice_static_event_loop *current = m->current, *target = m->target;
+	/* Make sure nothing changed in the meanwhile: we can only move handles that
+	 * have no agent or PeerConnection yet, as libnice is bound to the context;
+	 * packets already queued are fine, as the new source will take care of them */
+	if(g_atomic_int_get(&handle->destroyed) || handle->agent != NULL || handle->pc != NULL ||
+			handle->rtp_source == NULL || handle->static_event_loop != current)
+		return;
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Moving handle from loop #%d (%.1f%%) to loop #%d (%.1f%%)\n",
+		handle->handle_id, current->id, (double)g_atomic_int_get(&current->load)/10,
+		target->id, (double)g_atomic_int_get(&target->load)/10);
+	/* Get rid of the source on the old loop: the handle references stay with the new one */
+	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)handle->rtp_source;
+	g_atomic_int_set(&t->migrated, 1);
+	g_source_destroy(handle->rtp_source);
+	g_source_unref(handle->rtp_source);
+	janus_mutex_lock(&event_loops_mutex);
+	g_atomic_int_add(&current->handles, -1);
+	janus_refcount_decrease(&current->ref);
+	janus_refcount_increase(&target->ref);
+	g_atomic_int_inc(&target->handles);
+	g_atomic_int_inc(&target->recent_handles);
+	handle->mainctx = target->mainctx;
+	handle->mainloop = target->mainloop;
+	handle->static_event_loop = target;
+	janus_mutex_unlock(&event_loops_mutex);
+	handle->rtp_source = janus_ice_outgoing_traffic_create(handle, (GDestroyNotify)g_free);
+	g_source_set_priority(handle->rtp_source, G_PRIORITY_DEFAULT);
+	g_source_attach(handle->rtp_source, handle->mainctx);
+	g_main_context_wakeup(handle->mainctx);
+}
+static gboolean janus_ice_loop_migration_handle(gpointer user_data) {
+	janus_ice_loop_migration *m = (janus_ice_loop_migration *)user_data;
+	janus_mutex_lock(&m->mutex);
+	if(!m->cancelled)
+		janus_ice_loop_migration_do(m);
+	m->done = TRUE;
+	janus_condition_signal(&m->cond);
+	janus_mutex_unlock(&m->mutex);
+	return G_SOURCE_REMOVE;
+}
+/* Helper to move an idle handle to a less loaded static loop, if needed */
+static void janus_ice_static_event_loop_rebalance(janus_ice_handle *handle) {
+	if(!loop_rebalancing || handle->static_event_loop == NULL || handle->static_event_loop_pinned)
+		return;
+	if(handle->agent != NULL || handle->pc != NULL || handle->rtp_source == NULL)
+		return;
+	janus_mutex_lock(&event_loops_mutex);
+	janus_ice_static_event_loop *current = (janus_ice_static_event_loop *)handle->static_event_loop;
+	janus_ice_static_event_loop *target = janus_ice_static_event_loop_pick();
+	if(target == NULL || target == current || g_atomic_int_get(&current->load) -
+			g_atomic_int_get(&target->load) < JANUS_ICE_LOOP_REBALANCE_THRESHOLD) {
+		janus_mutex_unlock(&event_loops_mutex);
+		return;
+	}
+	janus_ice_loop_migration *m = g_malloc0(sizeof(janus_ice_loop_migration));
+	janus_refcount_increase(&handle->ref);
+	m->handle = handle;
+	janus_refcount_increase(&current->ref);
+	m->current = current;
+	janus_refcount_increase(&target->ref);
+	m->target = target;
+	janus_mutex_unlock(&event_loops_mutex);
+	janus_mutex_init(&m->mutex);
+	janus_condition_init(&m->cond);
+	if(g_main_context_is_owner(current->mainctx)) {
+		/* We're on the loop thread already, no need to wait */
+		g_atomic_int_set(&m->refs, 1);
+		janus_ice_loop_migration_do(m);
+		janus_ice_loop_migration_unref(m);
+		return;
+	}
+	/* Ask the current loop to move the handle, and wait for it to be done */
+	g_atomic_int_set(&m->refs, 2);
+	GSource *source = g_idle_source_new();
+	g_source_set_priority(source, G_PRIORITY_DEFAULT);
+	g_source_set_callback(source, janus_ice_loop_migration_handle, m, janus_ice_loop_migration_unref);
+	g_source_attach(source, current->mainctx);
+	g_source_unref(source);
+	gint64 deadline = janus_get_monotonic_time() + G_USEC_PER_SEC;
+	janus_mutex_lock(&m->mutex);
+	while(!m->done && janus_get_monotonic_time() < deadline)
+		janus_condition_wait_until(&m->cond, &m->mutex, deadline);
+	if(!m->done) {
+		/* The loop is too busy, stay where we are */
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Timeout moving handle from loop #%d, not moving it\n",
+			handle->handle_id, current->id);
+		m->cancelled = TRUE;
+	}
+	janus_mutex_unlock(&m->mutex);
+	janus_ice_loop_migration_unref(m);
+}
+
 int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean trickle, janus_dtls_role dtls_role) {
 	if(!handle || g_atomic_int_get(&handle->destroyed))
 		return -1;
@@ -3601,6 +4078,8 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALL_TRICKLES);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE_SYNCED);
 
+	/* Before creating the agent, check if this handle would be better off on another loop */
+	janus_ice_static_event_loop_rebalance(handle);
 	/* Note: NICE_COMPATIBILITY_RFC5245 is only available in more recent versions of libnice */
 	handle->controlling = janus_ice_lite_enabled ? FALSE : !offer;
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Creating ICE agent (ICE %s mode, %s)\n", handle->handle_id,
@@ -4128,10 +4607,13 @@ static void janus_ice_rtp_extension_update(janus_ice_handle *handle, janus_ice_p
 		extlen = 4 + (words*4);
 		totlen += extlen;
 	}
-	/* Check if we need to resize this packet buffer first */
+	/* Check if we need to resize this packet buffer first: this should
+	 * only happen when the room SRTP-ready buffers reserve isn't enough */
 	uint16_t payload_start = payload ? (payload - packet->data) : 0;
-	if(packet->length < totlen)
-		packet->data = g_realloc(packet->data, totlen + SRTP_MAX_TAG_LEN);
+	if(totlen + JANUS_SRTP_TAILROOM > packet->size) {
+		packet->size = totlen + JANUS_SRTP_HEADROOM + JANUS_SRTP_TAILROOM;
+		packet->data = g_realloc(packet->data, packet->size);
+	}
 	/* Now check if we need to move the payload */
 	payload = payload_start ? (packet->data + payload_start) : NULL;
 	if(payload != NULL && plen > 0 && packet->length != totlen)
@@ -4144,9 +4626,6 @@ static void janus_ice_rtp_extension_update(janus_ice_handle *handle, janus_ice_p
 	packet->length = totlen;
 }
 
-static gint rtcp_transport_wide_cc_stats_comparator(gconstpointer item1, gconstpointer item2) {
-	return ((rtcp_transport_wide_cc_stats*)item1)->transport_seq_num - ((rtcp_transport_wide_cc_stats*)item2)->transport_seq_num;
-}
 static gboolean janus_ice_outgoing_transport_wide_cc_feedback(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
 	janus_ice_peerconnection *pc = handle->pc;
@@ -4190,83 +4669,22 @@ static gboolean janus_ice_outgoing_transport_wide_cc_feedback(gpointer user_data
 		/* Create a transport wide feedback message */
 		size_t size = 1300;
 		char rtcpbuf[1300];
-		/* Order packet list */
-		pc->transport_wide_received_seq_nums = g_slist_sort(pc->transport_wide_received_seq_nums,
-			rtcp_transport_wide_cc_stats_comparator);
-		/* Create full stats queue */
-		GQueue *packets = g_queue_new();
-		/* For all packets */
-		GSList *it = NULL;
-		for(it = pc->transport_wide_received_seq_nums; it; it = it->next) {
-			/* Get stat */
-			janus_rtcp_transport_wide_cc_stats *stats = (janus_rtcp_transport_wide_cc_stats *)it->data;
-			/* Get transport seq */
-			guint32 transport_seq_num = stats->transport_seq_num;
-			/* Check if it is an out of order  */
-			if(transport_seq_num < pc->transport_wide_cc_last_feedback_seq_num) {
-				/* Skip, it was already reported as lost */
-				g_free(stats);
-				continue;
-			}
-			/* If not first */
-			if(pc->transport_wide_cc_last_feedback_seq_num) {
-				/* For each lost */
-				guint32 i = 0;
-				for(i = pc->transport_wide_cc_last_feedback_seq_num+1; i<transport_seq_num; ++i) {
-					/* Create new stat */
-					janus_rtcp_transport_wide_cc_stats *missing = g_malloc(sizeof(janus_rtcp_transport_wide_cc_stats));
-					/* Add missing packet */
-					missing->transport_seq_num = i;
-					missing->timestamp = 0;
-					/* Add it */
-					g_queue_push_tail(packets, missing);
-				}
-			}
-			/* Store last */
-			pc->transport_wide_cc_last_feedback_seq_num = transport_seq_num;
-			/* Add this one */
-			g_queue_push_tail(packets, stats);
-		}
-		/* Free and reset stats list */
-		g_slist_free(pc->transport_wide_received_seq_nums);
-		pc->transport_wide_received_seq_nums = NULL;
-		/* Create and enqueue RTCP packets */
-		guint packets_len = 0;
-		while((packets_len = g_queue_get_length(packets)) > 0) {
-			GQueue *packets_to_process;
-			/* If we have more than 400 packets to acknowledge, let's send more than one message */
-			if(packets_len > 400) {
-				/* Split the queue into two */
-				GList *new_head = g_queue_peek_nth_link(packets, 400);
-				GList *new_tail = new_head->prev;
-				new_head->prev = NULL;
-				new_tail->next = NULL;
-				packets_to_process = g_queue_new();
-				packets_to_process->head = packets->head;
-				packets_to_process->tail = new_tail;
-				packets_to_process->length = 400;
-				packets->head = new_head;
-				/* packets->tail is unchanged */
-				packets->length = packets_len - 400;
-			} else {
-				packets_to_process = packets;
-			}
+		/* The arrival ring is already in order: if we have more than
+		 * 400 packets to acknowledge, we'll send more than one message */
+		janus_mutex_lock(&pc->mutex);
+		while(janus_rtcp_transport_wide_cc_ring_pending(pc->transport_wide_cc_ring)) {
 			/* Get feedback packet count and increase it for next one */
 			guint8 feedback_packet_count = pc->transport_wide_cc_feedback_count++;
 			/* Create RTCP packet */
 			int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, size,
-				medium->ssrc, ssrc_peer, feedback_packet_count, packets_to_process);
+				medium->ssrc, ssrc_peer, feedback_packet_count, pc->transport_wide_cc_ring);
+			if(len <= 0)
+				break;
 			/* Enqueue it, we'll send it later */
-			if(len > 0) {
-				janus_plugin_rtcp rtcp = { .mindex = medium->mindex, .video = TRUE, .buffer = rtcpbuf, .length = len };
-				janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
-			}
-			if(packets_to_process != packets) {
-				g_queue_free(packets_to_process);
-			}
+			janus_plugin_rtcp rtcp = { .mindex = medium->mindex, .video = TRUE, .buffer = rtcpbuf, .length = len };
+			janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
 		}
-		/* Free mem */
-		g_queue_free(packets);
+		janus_mutex_unlock(&pc->mutex);
 	}
 	return G_SOURCE_CONTINUE;
 }
@@ -4361,6 +4779,125 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 	return G_SOURCE_CONTINUE;
 }
 
+/* Probe clusters are paced in a few short bursts of padding over a short
+ * interval, rather than sent all at once, using padding-only packets on
+ * the RTX SSRC so that recipients will just drop them after the feedback */
+#define JANUS_ICE_PROBE_DURATION	30000
+#define JANUS_ICE_PROBE_TICK		5
+#define JANUS_ICE_PROBE_PADDING		255
+#define JANUS_ICE_PROBE_MAX_PACKETS	250
+/* Helper to find the medium we can send padding on, i.e., video with RFC4588 */
+static janus_ice_peerconnection_medium *janus_ice_probe_medium(janus_ice_handle *handle) {
+	janus_ice_peerconnection *pc = handle->pc;
+	if(pc == NULL || !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX))
+		return NULL;
+	janus_ice_peerconnection_medium *medium = NULL;
+	uint mi=0;
+	for(mi=0; mi<g_hash_table_size(pc->media); mi++) {
+		medium = g_hash_table_lookup(pc->media, GUINT_TO_POINTER(mi));
+		if(medium && medium->type == JANUS_MEDIA_VIDEO && medium->send &&
+				medium->ssrc_rtx > 0 && medium->rtx_payload_type > 0)
+			return medium;
+	}
+	return NULL;
+}
+/* Helper to send a padding-only packet that is part of a probe cluster */
+static int janus_ice_probe_send(janus_ice_handle *handle, janus_ice_peerconnection_medium *medium, guint16 cluster) {
+	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
+	pkt->mindex = medium->mindex;
+	pkt->length = RTP_HEADER_SIZE + JANUS_ICE_PROBE_PADDING;
+	pkt->data = janus_srtp_buffer_new(pkt->length, &pkt->size);
+	memset(pkt->data, 0, pkt->length);
+	janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+	header->version = 2;
+	header->padding = 1;
+	header->type = medium->rtx_payload_type;
+	medium->rtx_seq_number++;
+	header->seq_number = htons(medium->rtx_seq_number);
+	header->timestamp = htonl(medium->last_rtp_ts);
+	header->ssrc = htonl(medium->ssrc_rtx);
+	/* The last byte of the padding tells how much padding there is */
+	*(uint8_t *)(pkt->data + pkt->length - 1) = JANUS_ICE_PROBE_PADDING;
+	pkt->type = JANUS_ICE_PACKET_VIDEO;
+	janus_plugin_rtp_extensions_reset(&pkt->extensions);
+	pkt->control = FALSE;
+	pkt->encrypted = FALSE;
+	/* We treat it as a retransmission, so that the RTX SSRC is preserved */
+	pkt->retransmission = TRUE;
+	pkt->probe = cluster;
+	pkt->label = NULL;
+	pkt->protocol = NULL;
+	pkt->added = janus_get_monotonic_time();
+	int length = pkt->length;
+	/* Probes don't go through the pacer queues, as they must follow the
+	 * timing of their cluster, but we charge the pacer for them, so that
+	 * the media we send after them doesn't exceed the budget */
+	if(handle->pc != NULL)
+		janus_pacer_account(handle->pc->pacer, length, pkt->added);
+	/* We're in the loop thread already, so we send the packet right away */
+	janus_ice_outgoing_traffic_handle(handle, pkt);
+	return length;
+}
+static gboolean janus_ice_outgoing_probe_handle(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	janus_ice_peerconnection *pc = handle->pc;
+	gint64 now = janus_get_monotonic_time();
+	gboolean done = TRUE;
+	if(pc != NULL && pc->probe_cluster > 0 && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT)) {
+		janus_ice_peerconnection_medium *medium = janus_ice_probe_medium(handle);
+		if(medium != NULL) {
+			/* Send as much padding as needed to stick to the bitrate we're probing for */
+			gint64 elapsed = now - pc->probe_started + JANUS_ICE_PROBE_TICK*G_TIME_SPAN_MILLISECOND;
+			if(elapsed > JANUS_ICE_PROBE_DURATION)
+				elapsed = JANUS_ICE_PROBE_DURATION;
+			guint64 due = (guint64)pc->probe_bitrate * elapsed / (8*G_USEC_PER_SEC);
+			while(pc->probe_bytes < due && pc->probe_packets < JANUS_ICE_PROBE_MAX_PACKETS) {
+				pc->probe_bytes += janus_ice_probe_send(handle, medium, pc->probe_cluster);
+				pc->probe_packets++;
+			}
+			done = (elapsed >= JANUS_ICE_PROBE_DURATION || pc->probe_packets >= JANUS_ICE_PROBE_MAX_PACKETS);
+		}
+	}
+	if(!done)
+		return G_SOURCE_CONTINUE;
+	/* We're done with this cluster, the estimator will evaluate it when the feedback comes in */
+	if(pc != NULL && pc->probe_cluster > 0) {
+		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Sent probe cluster %"SCNu16" (%"SCNu32" packets, %"SCNu32" bytes)\n",
+			handle->handle_id, pc->probe_cluster, pc->probe_packets, pc->probe_bytes);
+		janus_bwe_context_probe_end(pc->bwe, pc->probe_cluster, now);
+		pc->probe_cluster = 0;
+	}
+	if(handle->probe_source != NULL) {
+		g_source_unref(handle->probe_source);
+		handle->probe_source = NULL;
+	}
+	return G_SOURCE_REMOVE;
+}
+/* Check whether we should start probing for more bandwidth on this handle */
+static void janus_ice_outgoing_probe_start(janus_ice_handle *handle, gint64 now) {
+	janus_ice_peerconnection *pc = handle->pc;
+	if(pc == NULL || pc->bwe == NULL || handle->probe_source != NULL || !g_atomic_int_get(&handle->bwe_probing) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) ||
+			janus_ice_probe_medium(handle) == NULL)
+		return;
+	guint16 cluster = 0;
+	guint32 padding = janus_bwe_context_probe_start(pc->bwe, handle->bwe_probing_max,
+		(gint64)handle->bwe_probing_interval*G_TIME_SPAN_MILLISECOND, now, &cluster);
+	if(padding == 0)
+		return;
+	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Starting probe cluster %"SCNu16" (%"SCNu32"bps of padding)\n",
+		handle->handle_id, cluster, padding);
+	pc->probe_cluster = cluster;
+	pc->probe_bitrate = padding;
+	pc->probe_started = now;
+	pc->probe_packets = 0;
+	pc->probe_bytes = 0;
+	handle->probe_source = g_timeout_source_new(JANUS_ICE_PROBE_TICK);
+	g_source_set_priority(handle->probe_source, G_PRIORITY_DEFAULT);
+	g_source_set_callback(handle->probe_source, janus_ice_outgoing_probe_handle, handle, NULL);
+	g_source_attach(handle->probe_source, handle->mainctx);
+}
+
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
 	/* This callback is for stats and other things we need to do on a regular basis (typically called once per second) */
@@ -4489,6 +5026,8 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 		handle->last_event_stats = 0;
 	/* Should we clean up old NACK buffers for any of the streams? */
 	janus_cleanup_nack_buffer(now, handle->pc, TRUE, TRUE);
+	/* Check if it's time to probe for more bandwidth */
+	janus_ice_outgoing_probe_start(handle, now);
 	/* Check if we should also print a summary of SRTP-related errors */
 	handle->last_srtp_summary++;
 	if(handle->last_srtp_summary == 0 || handle->last_srtp_summary == 2) {
@@ -4590,6 +5129,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			plugin->hangup_media(handle->app_handle);
 		}
 		/* Get rid of the attached sources */
+		janus_ice_static_event_loop_unschedule(handle);
 		if(handle->rtcp_source) {
 			g_source_destroy(handle->rtcp_source);
 			g_source_unref(handle->rtcp_source);
@@ -4605,6 +5145,11 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			g_source_unref(handle->stats_source);
 			handle->stats_source = NULL;
 		}
+		if(handle->probe_source) {
+			g_source_destroy(handle->probe_source);
+			g_source_unref(handle->probe_source);
+			handle->probe_source = NULL;
+		}
 		/* If event handlers are active, send stats one last time */
 		if(janus_events_is_enabled()) {
 			handle->last_event_stats = janus_ice_event_stats_period;
@@ -4714,30 +5259,30 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			/* Check if there's anything we need to do before sending */
 			uint32_t bitrate = janus_rtcp_get_remb(pkt->data, pkt->length);
 			if(bitrate > 0) {
-				/* There's a REMB, prepend a RR as it won't work otherwise */
+				/* There's a REMB, prepend a RR as it won't work otherwise: the
+				 * SRTP-ready buffer usually has enough room to do that in place */
 				int rrlen = 8;
-				char *rtcpbuf = g_malloc0(rrlen+pkt->length+SRTP_MAX_TAG_LEN+4);
-				rtcp_rr *rr = (rtcp_rr *)rtcpbuf;
+				if(rrlen + pkt->length + JANUS_SRTP_TAILROOM > pkt->size) {
+					pkt->size = rrlen + pkt->length + JANUS_SRTP_TAILROOM;
+					pkt->data = g_realloc(pkt->data, pkt->size);
+				}
+				memmove(pkt->data+rrlen, pkt->data, pkt->length);
+				memset(pkt->data, 0, rrlen);
+				rtcp_rr *rr = (rtcp_rr *)pkt->data;
 				rr->header.version = 2;
 				rr->header.type = RTCP_RR;
 				rr->header.rc = 0;
 				rr->header.length = htons((rrlen/4)-1);
-				/* Append REMB */
-				memcpy(rtcpbuf+rrlen, pkt->data, pkt->length);
 				/* If we're simulcasting, set the extra SSRCs (the first one will be set by janus_rtcp_fix_ssrc) */
 				if(medium->ssrc_peer[1] && pkt->length >= 28) {
-					rtcp_fb *rtcpfb = (rtcp_fb *)(rtcpbuf+rrlen);
+					rtcp_fb *rtcpfb = (rtcp_fb *)(pkt->data+rrlen);
 					rtcp_remb *remb = (rtcp_remb *)rtcpfb->fci;
 					remb->ssrc[1] = htonl(medium->ssrc_peer[1]);
 					if(medium->ssrc_peer[2] && pkt->length >= 32) {
 						remb->ssrc[2] = htonl(medium->ssrc_peer[2]);
 					}
 				}
-				/* Free old packet and update */
-				char *prev_data = pkt->data;
-				pkt->data = rtcpbuf;
 				pkt->length = rrlen+pkt->length;
-				g_clear_pointer(&prev_data, g_free);
 			}
 			/* Do we need to dump this packet for debugging? */
 			if(g_atomic_int_get(&handle->dump_packets))
@@ -4910,6 +5455,12 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 							medium->out_stats.info[0].updated = now;
 						}
 						medium->out_stats.info[0].bytes_lastsec_temp += pkt->length;
+						/* Keep track of when we sent this packet, to estimate the bandwidth from transport-wide CC feedback */
+						if(video && pc->transport_wide_cc_ext_id > 0) {
+							if(pc->bwe == NULL)
+								pc->bwe = janus_bwe_context_create();
+							janus_bwe_context_add_sent(pc->bwe, pc->transport_wide_cc_out_seq_num, protected, pkt->probe, now);
+						}
 						struct timeval tv;
 						gettimeofday(&tv, NULL);
 						if(medium->last_ntp_ts == 0 || (gint32)(timestamp - medium->last_rtp_ts) > 0) {
@@ -4942,16 +5493,18 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 							return G_SOURCE_CONTINUE;
 						}
 						if(p == NULL) {
-							/* If we're not doing RFC4588, we're saving the SRTP packet as it is */
+							/* If we're not doing RFC4588, we're saving the SRTP packet as it is:
+							 * we're done with it, so we move the buffer instead of copying it */
 							p = g_malloc(sizeof(janus_rtp_packet));
-							p->data = g_malloc(protected);
-							memcpy(p->data, pkt->data, protected);
+							p->data = pkt->data;
 							p->length = protected;
+							pkt->data = NULL;
 							janus_plugin_rtp_extensions_reset(&p->extensions);
 						}
 						p->created = janus_get_monotonic_time();
 						p->last_retransmit = 0;
-						janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+						/* The RTP header is never encrypted, so we can get the sequence number from there */
+						janus_rtp_header *header = (janus_rtp_header *)p->data;
 						guint16 seq = ntohs(header->seq_number);
 						if(medium->retransmit_buffer == NULL) {
 							medium->retransmit_buffer = g_queue_new();
@@ -4983,7 +5536,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			medium->noerrorlog = FALSE;
 			/* TODO Support binary data */
 			janus_dtls_wrap_sctp_data(pc->dtls, pkt->label, pkt->protocol,
-				pkt->type == JANUS_ICE_PACKET_TEXT, pkt->data, pkt->length);
+				pkt->type == JANUS_ICE_PACKET_TEXT, pkt->data, pkt->length, pkt->more);
 #endif
 		} else if(pkt->type == JANUS_ICE_PACKET_SCTP) {
 			/* SCTP data to push */
@@ -5030,14 +5583,14 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
 	/* Queue this packet as it is (we'll prune/update/set extensions later) */
 	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
 	pkt->mindex = packet->mindex;
-	pkt->data = g_malloc(packet->length + SRTP_MAX_TAG_LEN);
-	memcpy(pkt->data, packet->buffer, packet->length);
+	pkt->data = janus_srtp_buffer_dup(packet->buffer, packet->length, &pkt->size);
 	pkt->length = packet->length;
 	pkt->type = packet->video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	pkt->extensions = packet->extensions;
 	pkt->control = FALSE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
+	pkt->probe = 0;
 	pkt->label = NULL;
 	pkt->protocol = NULL;
 	pkt->added = janus_get_monotonic_time();
@@ -5072,14 +5625,14 @@ void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, janus_ice_peerconne
 	/* Queue this packet */
 	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
 	pkt->mindex = medium->mindex;
-	pkt->data = g_malloc(rtcp_len+SRTP_MAX_TAG_LEN+4);
-	memcpy(pkt->data, rtcp_buf, rtcp_len);
+	pkt->data = janus_srtp_buffer_dup(rtcp_buf, rtcp_len, &pkt->size);
 	pkt->length = rtcp_len;
 	pkt->type = packet->video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	memset(&pkt->extensions, 0, sizeof(pkt->extensions));
 	pkt->control = TRUE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
+	pkt->probe = 0;
 	pkt->label = NULL;
 	pkt->protocol = NULL;
 	pkt->added = janus_get_monotonic_time();
@@ -5174,11 +5727,14 @@ void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet) {
 	pkt->mindex = -1;
 	memcpy(pkt->data, packet->buffer, packet->length);
 	pkt->length = packet->length;
+	pkt->size = packet->length;
 	pkt->type = packet->binary ? JANUS_ICE_PACKET_BINARY : JANUS_ICE_PACKET_TEXT;
 	memset(&pkt->extensions, 0, sizeof(pkt->extensions));
 	pkt->control = FALSE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
+	pkt->probe = 0;
+	pkt->more = FALSE;
 	pkt->label = packet->label ? g_strdup(packet->label) : NULL;
 	pkt->protocol = packet->protocol ? g_strdup(packet->protocol) : NULL;
 	pkt->added = janus_get_monotonic_time();
@@ -5201,11 +5757,13 @@ void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
 	pkt->mindex = medium->mindex;
 	memcpy(pkt->data, buffer, length);
 	pkt->length = length;
+	pkt->size = length;
 	pkt->type = JANUS_ICE_PACKET_SCTP;
 	memset(&pkt->extensions, 0, sizeof(pkt->extensions));
 	pkt->control = FALSE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
+	pkt->probe = 0;
 	pkt->label = NULL;
 	pkt->protocol = NULL;
 	pkt->added = janus_get_monotonic_time();
@@ -5239,6 +5797,127 @@ void janus_ice_notify_media_stopped(janus_ice_handle *handle) {
 	g_main_context_wakeup(handle->mainctx);
 }
 
+/* Helper to move a deadline to the next period: if we fell behind (e.g., the
+ * loop was busy), we don't try to catch up with all the ticks we missed, but
+ * we still skip whole periods, so that the offset of the deadline is preserved */
+static gint64 janus_ice_scheduled_next(gint64 deadline, gint64 period, gint64 now) {
+	deadline += period;
+	if(deadline <= now)
+		deadline += ((now - deadline)/period + 1) * period;
+	return deadline;
+}
+/* Scheduler for the timed tasks of all PeerConnections on a static loop */
+static gboolean janus_ice_static_event_loop_timers(gpointer user_data) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)user_data;
+	gint64 now = janus_get_monotonic_time();
+	gint64 twcc_interval = (gint64)twcc_period*G_TIME_SPAN_MILLISECOND;
+	if(loop->due == NULL)
+		loop->due = g_array_new(FALSE, FALSE, sizeof(janus_ice_scheduled_task));
+	/* Only check what's due while holding the lock: the tasks themselves are
+	 * executed after releasing it, as they may need other locks in turn */
+	janus_mutex_lock(&loop->timers_mutex);
+	guint i = 0;
+	for(i=0; i<loop->scheduled->len; i++) {
+		janus_ice_scheduled_pc *spc = g_ptr_array_index(loop->scheduled, i);
+		janus_ice_handle *handle = spc->handle;
+		if(handle->pc == NULL || !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY))
+			continue;
+		janus_ice_scheduled_task task = { 0 };
+		if(now >= spc->next_rtcp) {
+			task.rtcp = TRUE;
+			spc->next_rtcp = janus_ice_scheduled_next(spc->next_rtcp, G_USEC_PER_SEC, now);
+		}
+		if(twcc_period != 1000 && now >= spc->next_twcc) {
+			task.twcc = TRUE;
+			spc->next_twcc = janus_ice_scheduled_next(spc->next_twcc, twcc_interval, now);
+		}
+		if(now >= spc->next_stats) {
+			task.stats = TRUE;
+			spc->next_stats = janus_ice_scheduled_next(spc->next_stats, G_USEC_PER_SEC, now);
+		}
+		if(!task.rtcp && !task.twcc && !task.stats)
+			continue;
+		janus_refcount_increase(&handle->ref);
+		task.handle = handle;
+		g_array_append_val(loop->due, task);
+	}
+	janus_mutex_unlock(&loop->timers_mutex);
+	for(i=0; i<loop->due->len; i++) {
+		janus_ice_scheduled_task *task = &g_array_index(loop->due, janus_ice_scheduled_task, i);
+		if(task->rtcp)
+			janus_ice_outgoing_rtcp_handle(task->handle);
+		if(task->twcc)
+			janus_ice_outgoing_transport_wide_cc_feedback(task->handle);
+		if(task->stats)
+			janus_ice_outgoing_stats_handle(task->handle);
+		janus_refcount_decrease(&task->handle->ref);
+	}
+	g_array_set_size(loop->due, 0);
+	return G_SOURCE_CONTINUE;
+}
+
+static void janus_ice_static_event_loop_schedule(janus_ice_handle *handle) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_event_loop;
+	if(loop == NULL)
+		return;
+	janus_mutex_lock(&loop->timers_mutex);
+	guint i = 0;
+	for(i=0; i<loop->scheduled->len; i++) {
+		janus_ice_scheduled_pc *spc = g_ptr_array_index(loop->scheduled, i);
+		if(spc->handle == handle) {
+			/* Already scheduled */
+			janus_mutex_unlock(&loop->timers_mutex);
+			return;
+		}
+	}
+	janus_ice_scheduled_pc *spc = g_malloc0(sizeof(janus_ice_scheduled_pc));
+	janus_refcount_increase(&handle->ref);
+	spc->handle = handle;
+	/* Spread the first deadlines over the period, to avoid bursts: the
+	 * scheduler keeps this offset when moving to the next deadlines */
+	gint64 now = janus_get_monotonic_time();
+	spc->next_rtcp = now + G_USEC_PER_SEC + g_random_int_range(0, G_USEC_PER_SEC);
+	spc->next_stats = now + G_USEC_PER_SEC + g_random_int_range(0, G_USEC_PER_SEC);
+	spc->next_twcc = now + (gint64)twcc_period*G_TIME_SPAN_MILLISECOND +
+		g_random_int_range(0, twcc_period*G_TIME_SPAN_MILLISECOND);
+	g_ptr_array_add(loop->scheduled, spc);
+	if(loop->timers == NULL) {
+		/* First PeerConnection on this loop, start the scheduler */
+		loop->timers = g_timeout_source_new(MIN(JANUS_ICE_LOOP_SCHEDULER_TICK, twcc_period));
+		g_source_set_priority(loop->timers, G_PRIORITY_DEFAULT);
+		g_source_set_callback(loop->timers, janus_ice_static_event_loop_timers, loop, NULL);
+		g_source_attach(loop->timers, loop->mainctx);
+	}
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Added PeerConnection to the scheduler of loop #%d (%u scheduled)\n",
+		handle->handle_id, loop->id, loop->scheduled->len);
+	janus_mutex_unlock(&loop->timers_mutex);
+}
+
+static void janus_ice_static_event_loop_unschedule(janus_ice_handle *handle) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_event_loop;
+	if(loop == NULL)
+		return;
+	janus_mutex_lock(&loop->timers_mutex);
+	guint i = 0;
+	for(i=0; i<loop->scheduled->len; i++) {
+		janus_ice_scheduled_pc *spc = g_ptr_array_index(loop->scheduled, i);
+		if(spc->handle == handle) {
+			g_ptr_array_remove_index_fast(loop->scheduled, i);
+			janus_refcount_decrease(&handle->ref);
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Removed PeerConnection from the scheduler of loop #%d (%u scheduled)\n",
+				handle->handle_id, loop->id, loop->scheduled->len);
+			break;
+		}
+	}
+	if(loop->scheduled->len == 0 && loop->timers != NULL) {
+		/* No PeerConnection left, no need to keep on ticking */
+		g_source_destroy(loop->timers);
+		g_source_unref(loop->timers);
+		loop->timers = NULL;
+	}
+	janus_mutex_unlock(&loop->timers_mutex);
+}
+
 void janus_ice_dtls_handshake_done(janus_ice_handle *handle) {
 	if(!handle || !handle->pc)
 		return;
@@ -5252,25 +5931,29 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle) {
 		return;
 	}
 	janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY);
-	/* Create a source for RTCP and one for stats */
-	handle->rtcp_source = g_timeout_source_new_seconds(1);
-	g_source_set_priority(handle->rtcp_source, G_PRIORITY_DEFAULT);
-	g_source_set_callback(handle->rtcp_source, janus_ice_outgoing_rtcp_handle, handle, NULL);
-	g_source_attach(handle->rtcp_source, handle->mainctx);
-	if(twcc_period != 1000) {
-		/* The Transport Wide CC feedback period is different, create another source */
-		handle->twcc_source = g_timeout_source_new(twcc_period);
-		g_source_set_priority(handle->twcc_source, G_PRIORITY_DEFAULT);
-		g_source_set_callback(handle->twcc_source, janus_ice_outgoing_transport_wide_cc_feedback, handle, NULL);
-		g_source_attach(handle->twcc_source, handle->mainctx);
-	}
 	handle->last_event_stats = 0;
 	handle->last_srtp_summary = -1;
-	handle->stats_source = g_timeout_source_new_seconds(1);
-	g_source_set_callback(handle->stats_source, janus_ice_outgoing_stats_handle, handle, NULL);
-	g_source_set_priority(handle->stats_source, G_PRIORITY_DEFAULT);
-	g_source_attach(handle->stats_source, handle->mainctx);
+	if(handle->static_event_loop == NULL) {
+		/* Create a source for RTCP and one for stats */
+		handle->rtcp_source = g_timeout_source_new_seconds(1);
+		g_source_set_priority(handle->rtcp_source, G_PRIORITY_DEFAULT);
+		g_source_set_callback(handle->rtcp_source, janus_ice_outgoing_rtcp_handle, handle, NULL);
+		g_source_attach(handle->rtcp_source, handle->mainctx);
+		if(twcc_period != 1000) {
+			/* The Transport Wide CC feedback period is different, create another source */
+			handle->twcc_source = g_timeout_source_new(twcc_period);
+			g_source_set_priority(handle->twcc_source, G_PRIORITY_DEFAULT);
+			g_source_set_callback(handle->twcc_source, janus_ice_outgoing_transport_wide_cc_feedback, handle, NULL);
+			g_source_attach(handle->twcc_source, handle->mainctx);
+		}
+		handle->stats_source = g_timeout_source_new_seconds(1);
+		g_source_set_callback(handle->stats_source, janus_ice_outgoing_stats_handle, handle, NULL);
+		g_source_set_priority(handle->stats_source, G_PRIORITY_DEFAULT);
+		g_source_attach(handle->stats_source, handle->mainctx);
+	}
 	janus_mutex_unlock(&handle->mutex);
+	/* When using static loops, the loop scheduler takes care of the timers instead */
+	janus_ice_static_event_loop_schedule(handle);
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] The DTLS handshake has been completed\n", handle->handle_id);
 	/* Notify the plugin that the WebRTC PeerConnection is ready to be used */
 	janus_plugin *plugin = (janus_plugin *)handle->app;
@@ -28,6 +28,8 @@
 #include "dtls.h"
 #include "sctp.h"
 #include "rtcp.h"
+#include "bwe.h"
+#include "pacer.h"
 #include "text2pcap.h"
 #include "utils.h"
 #include "ip-utils.h"
@@ -208,6 +210,37 @@ void janus_set_twcc_period(uint period);
 /*! \brief Method to get the current TWCC period (see above)
  * @returns The current TWCC period */
 uint janus_get_twcc_period(void);
+/*! \brief Method to enable or disable probing for more bandwidth on PeerConnections, where possible
+ * \note Probing is done by sending short bursts of RTX padding, when the
+ * bandwidth estimate we have for a PeerConnection could be higher than what
+ * we're sending: it's disabled by default, and can be overridden per handle
+ * @param[in] enabled Whether probing should be enabled or not by default */
+void janus_set_bwe_probing_enabled(gboolean enabled);
+/*! \brief Method to check whether probing for more bandwidth is enabled by default
+ * @returns TRUE if probing is enabled by default, FALSE otherwise */
+gboolean janus_is_bwe_probing_enabled(void);
+/*! \brief Method to modify the default minimum interval between probe clusters on a PeerConnection
+ * @param[in] interval The new interval, in milliseconds (at least 1000) */
+void janus_set_bwe_probing_interval(uint interval);
+/*! \brief Method to get the default minimum interval between probe clusters (see above)
+ * @returns The current interval, in milliseconds */
+uint janus_get_bwe_probing_interval(void);
+/*! \brief Method to modify the default maximum bitrate we probe for
+ * @param[in] max_bitrate The new maximum, in bps */
+void janus_set_bwe_probing_max(uint32_t max_bitrate);
+/*! \brief Method to get the default maximum bitrate we probe for (see above)
+ * @returns The current maximum, in bps */
+uint32_t janus_get_bwe_probing_max(void);
+/*! \brief Method to enable or disable pacing of outgoing media on PeerConnections
+ * \note When pacing is enabled, outgoing video and retransmissions are not
+ * sent right away, but released at a rate that depends on the bandwidth
+ * estimate (or the REMB feedback) for the PeerConnection, to avoid bursts
+ * when sending keyframes: it's disabled by default, and can be overridden per handle
+ * @param[in] enabled Whether pacing should be enabled or not by default */
+void janus_set_pacing_enabled(gboolean enabled);
+/*! \brief Method to check whether pacing of outgoing media is enabled by default
+ * @returns TRUE if pacing is enabled by default, FALSE otherwise */
+gboolean janus_is_pacing_enabled(void);
 /*! \brief Method to modify the DSCP value to set, which is disabled by default
  * @param[in] dscp The new DSCP value (0 to disable) */
 void janus_set_dscp(int dscp);
@@ -376,10 +409,16 @@ struct janus_ice_handle {
 	GMainLoop *mainloop;
 	/*! \brief In case static event loops are used, opaque pointer to the loop */
 	void *static_event_loop;
+	/*! \brief Whether the loop was chosen via API, in which case the handle is never moved to another loop */
+	gboolean static_event_loop_pinned;
 	/*! \brief GLib thread for the handle and libnice */
 	GThread *thread;
-	/*! \brief GLib sources for outgoing traffic, recurring RTCP, and stats (and optionally TWCC) */
+	/*! \brief GLib sources for outgoing traffic, recurring RTCP, and stats (and optionally TWCC)
+	 * \note When static event loops are used, only the outgoing traffic source is per-handle:
+	 * RTCP, stats and TWCC are driven by a single scheduler per loop instead */
 	GSource *rtp_source, *rtcp_source, *stats_source, *twcc_source;
+	/*! \brief GLib source pacing the padding of a probe cluster, while we're sending one */
+	GSource *probe_source;
 	/*! \brief libnice ICE agent */
 	NiceAgent *agent;
 	/*! \brief Monotonic time of when the ICE agent has been created */
@@ -418,6 +457,13 @@ struct janus_ice_handle {
 	volatile gint dump_packets;
 	/*! \brief In case this session must be saved to text2pcap, the instance to dump packets to */
 	janus_text2pcap *text2pcap;
+	/*! \brief Whether outgoing media on this handle's PeerConnection should be paced */
+	volatile gint pacing;
+	/*! \brief Whether we should probe for more bandwidth on this handle's PeerConnection */
+	volatile gint bwe_probing;
+	/*! \brief Minimum interval between probe clusters (ms), and maximum bitrate to probe for (bps) */
+	guint bwe_probing_interval;
+	guint32 bwe_probing_max;
 	/*! \brief Mutex to lock/unlock the ICE session */
 	janus_mutex mutex;
 	/*! \brief Atomic flag to check whether a PeerConnection was established */
@@ -488,14 +534,22 @@ struct janus_ice_peerconnection {
 	guint16 transport_wide_cc_out_seq_num;
 	/*! \brief Last received transport wide seq num */
 	guint32 transport_wide_cc_last_seq_num;
-	/*! \brief Last transport wide seq num sent on feedback */
-	guint32 transport_wide_cc_last_feedback_seq_num;
 	/*! \brief Transport wide cc transport seq num wrap cycles */
 	guint16 transport_wide_cc_cycles;
 	/*! \brief Transport wide cc rtp ext ID */
 	guint transport_wide_cc_feedback_count;
-	/*! \brief GLib list of transport wide cc stats in reverse received order */
-	GSList *transport_wide_received_seq_nums;
+	/*! \brief Arrival times of the packets we still have to send transport wide cc feedback for */
+	janus_rtcp_transport_wide_cc_ring *transport_wide_cc_ring;
+	/*! \brief Sender side bandwidth estimator, fed by the transport wide cc feedback we receive */
+	janus_bwe_context *bwe;
+	/*! \brief Pacer for outgoing media, if pacing is enabled */
+	janus_pacer *pacer;
+	/*! \brief Probe cluster we're sending padding for, if any, and padding bitrate */
+	guint16 probe_cluster;
+	guint32 probe_bitrate;
+	/*! \brief When we started sending the probe cluster, and how many packets and bytes we sent so far */
+	gint64 probe_started;
+	guint32 probe_packets, probe_bytes;
 	/*! \brief Latest REMB feedback we received */
 	uint32_t remb_bitrate;
 	/*! \brief DTLS role of the server for this stream */
@@ -797,16 +851,41 @@ void janus_ice_resend_trickles(janus_ice_handle *handle);
  * @param[in] loops The number of static event loops to start (0 to disable the feature)
  * @param[in] allow_api Whether allocation on a specific loop driven via API should be allowed or not (false by default) */
 void janus_ice_set_static_event_loops(int loops, gboolean allow_api);
+/*! \brief Method to configure which CPUs the static event loops should be pinned to
+ * @note This must be called before janus_ice_set_static_event_loops. Loops are
+ * pinned to one CPU each, picking them from the list in a round robin fashion
+ * @param[in] cpus The list of CPUs to use (e.g., "0-3,8-11"), or NULL to use all of them
+ * @param[in] iface If provided, only the CPUs on the same NUMA node as this network interface are used */
+void janus_ice_set_static_event_loops_affinity(const char *cpus, const char *iface);
+/*! \brief Method to get the list of CPUs the static event loops are pinned to, if any
+ * @returns A string with the CPUs list (to be freed by the caller), or NULL if loops aren't pinned */
+char *janus_ice_get_static_event_loops_affinity(void);
+/*! \brief Method to get the NUMA node the static event loops were bound to, if any
+ * @returns The NUMA node, or -1 if loops weren't bound to a NUMA node */
+int janus_ice_get_static_event_loops_numa_node(void);
 /*! \brief Method to return the number of static event loops, if enabled
  * @returns The number of static event loops, if configured, or 0 if the feature is disabled */
 int janus_ice_get_static_event_loops(void);
 /*! \brief Method to check whether loop indication via API is allowed
  * @returns true if allowed, false otherwise */
 gboolean janus_ice_is_loop_indication_allowed(void);
+/*! \brief Method to enable or disable moving idle handles to less loaded static loops
+ * @note Handles are only moved right before a new PeerConnection is set up, and
+ * never if they were assigned to a specific loop via API
+ * @param[in] enabled Whether rebalancing should be enabled or not (false by default) */
+void janus_ice_set_loop_rebalancing(gboolean enabled);
+/*! \brief Method to check whether moving idle handles across static loops is enabled
+ * @returns true if enabled, false otherwise */
+gboolean janus_ice_is_loop_rebalancing_enabled(void);
 /*! \brief Helper method to return a summary of the static loops activity
  * @note This is only used by the Admin API
  * @returns a json_t array with the required info */
 json_t *janus_ice_static_event_loops_info(void);
+/*! \brief Method to pin the calling thread to the same CPU as the static event loop a handle is on
+ * @note This is what plugins can use to have their media threads inherit the loop affinity
+ * @param[in] handle The Janus ICE handle
+ * @returns 0 if the thread was pinned, a negative integer otherwise (e.g., no affinity configured) */
+int janus_ice_handle_inherit_affinity(janus_ice_handle *handle);
 /*! \brief Method to stop all the static event loops, if enabled
  * @note This will wait for the related threads to exit, and so may delay the shutdown process */
 void janus_ice_stop_static_event_loops(void);
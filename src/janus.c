@@ -189,6 +189,14 @@ static struct janus_json_parameter text2pcap_parameters[] = {
 	{"filename", JSON_STRING, 0},
 	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
+static struct janus_json_parameter pacing_parameters[] = {
+	{"pacing", JANUS_JSON_BOOL, JANUS_JSON_PARAM_REQUIRED}
+};
+static struct janus_json_parameter bweprobing_parameters[] = {
+	{"bwe_probing", JANUS_JSON_BOOL, JANUS_JSON_PARAM_REQUIRED},
+	{"interval", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_bitrate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter handleinfo_parameters[] = {
 	{"plugin_only", JANUS_JSON_BOOL, 0}
 };
@@ -374,6 +382,8 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "min-nack-queue", json_integer(janus_get_min_nack_queue()));
 	json_object_set_new(info, "nack-optimizations", janus_is_nack_optimizations_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "twcc-period", json_integer(janus_get_twcc_period()));
+	json_object_set_new(info, "pacing", janus_is_pacing_enabled() ? json_true() : json_false());
+	json_object_set_new(info, "bwe-probing", janus_is_bwe_probing_enabled() ? json_true() : json_false());
 	if(janus_get_dscp() > 0)
 		json_object_set_new(info, "dscp", json_integer(janus_get_dscp()));
 	json_object_set_new(info, "dtls-mtu", json_integer(janus_dtls_bio_agent_get_mtu()));
@@ -390,8 +400,19 @@ static json_t *janus_info(const char *transaction) {
 	if(janus_ice_is_force_relay_allowed())
 		json_object_set_new(info, "allow-force-relay", json_true());
 	json_object_set_new(info, "static-event-loops", json_integer(janus_ice_get_static_event_loops()));
-	if(janus_ice_get_static_event_loops())
+	if(janus_ice_get_static_event_loops()) {
 		json_object_set_new(info, "loop-indication", janus_ice_is_loop_indication_allowed() ? json_true() : json_false());
+		json_object_set_new(info, "loop-rebalancing", janus_ice_is_loop_rebalancing_enabled() ? json_true() : json_false());
+		char *loops_cpus = janus_ice_get_static_event_loops_affinity();
+		if(loops_cpus != NULL) {
+			json_object_set_new(info, "loops-affinity", json_string(loops_cpus));
+			g_free(loops_cpus);
+		}
+		if(janus_ice_get_static_event_loops_numa_node() > -1)
+			json_object_set_new(info, "loops-numa-node", json_integer(janus_ice_get_static_event_loops_numa_node()));
+	}
+	if(janus_rtp_forwarders_get_egress_threads() > 0)
+		json_object_set_new(info, "rtpfwd-threads", json_integer(janus_rtp_forwarders_get_egress_threads()));
 	json_object_set_new(info, "api_secret", api_secret ? json_true() : json_false());
 	json_object_set_new(info, "auth_token", janus_auth_is_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "event_handlers", janus_events_is_enabled() ? json_true() : json_false());
@@ -605,6 +626,7 @@ void janus_transport_task(gpointer data, gpointer user_data);
  */
 ///@{
 int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+int janus_plugin_push_event_payload(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, janus_json_payload *payload, json_t *jsep);
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart);
 void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, janus_plugin_rtp *packet);
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, janus_plugin_rtcp *packet);
@@ -618,6 +640,7 @@ void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugi
 gboolean janus_plugin_auth_is_signed(void);
 gboolean janus_plugin_auth_is_signature_valid(janus_plugin *plugin, const char *token);
 gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *token, const char *desc);
+gboolean janus_plugin_inherit_affinity(janus_plugin_session *plugin_session);
 static janus_callbacks janus_handler_plugin =
 	{
 		.push_event = janus_plugin_push_event,
@@ -634,6 +657,8 @@ static janus_callbacks janus_handler_plugin =
 		.auth_is_signed = janus_plugin_auth_is_signed,
 		.auth_is_signature_valid = janus_plugin_auth_is_signature_valid,
 		.auth_signature_contains = janus_plugin_auth_signature_contains,
+		.inherit_affinity = janus_plugin_inherit_affinity,
+		.push_event_payload = janus_plugin_push_event_payload,
 	};
 ///@}
 
@@ -808,13 +833,23 @@ janus_session *janus_session_find(guint64 session_id) {
 	return session;
 }
 
-void janus_session_notify_event(janus_session *session, json_t *event) {
+/* Same as janus_session_notify_event, but for plugin events whose data was
+ * serialized in advance: the payload reference is stolen, and the payload
+ * content is added to the event here if the transport can't splice it itself */
+static void janus_session_notify_event_payload(janus_session *session, json_t *event, janus_json_payload *payload) {
 	if(session != NULL && !g_atomic_int_get(&session->destroyed)) {
 		janus_request *source = janus_session_get_request(session);
 		if(source != NULL && source->transport != NULL) {
 			/* Send this to the transport client */
 			JANUS_LOG(LOG_HUGE, "Sending event to %s (%p)\n", source->transport->get_package(), source->instance);
-			source->transport->send_message(source->instance, NULL, FALSE, event);
+			if(payload != NULL && source->transport->send_message_payload != NULL) {
+				source->transport->send_message_payload(source->instance, NULL, FALSE, event, payload);
+				payload = NULL;
+			} else {
+				if(payload != NULL)
+					json_object_set(json_object_get(event, "plugindata"), "data", payload->json);
+				source->transport->send_message(source->instance, NULL, FALSE, event);
+			}
 		} else {
 			/* No transport, free the event */
 			json_decref(event);
@@ -824,6 +859,11 @@ void janus_session_notify_event(janus_session *session, json_t *event) {
 		/* No session, free the event */
 		json_decref(event);
 	}
+	janus_json_payload_unref(payload);
+}
+
+void janus_session_notify_event(janus_session *session, json_t *event) {
+	janus_session_notify_event_payload(session, event, NULL);
 }
 
 
@@ -2811,6 +2851,16 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "srtp_info")) {
+			/* Query the Janus core to see which SRTP profiles we offer, how
+			 * many sessions are using them, and how expensive they are */
+			json_t *list = janus_dtls_srtp_profiles_info();
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "profiles", list);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else {
 			/* No message we know of */
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
@@ -3007,8 +3057,60 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "set_pacing")) {
+			/* Enable/disable pacing of the outgoing media of this handle, overriding the default */
+			JANUS_VALIDATE_JSON_OBJECT(root, pacing_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			g_atomic_int_set(&handle->pacing, json_is_true(json_object_get(root, "pacing")));
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", session_id, transaction_text);
+			json_object_set_new(reply, "pacing", g_atomic_int_get(&handle->pacing) ? json_true() : json_false());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "set_bwe_probing")) {
+			/* Enable/disable probing for more bandwidth on this handle, overriding the defaults */
+			JANUS_VALIDATE_JSON_OBJECT(root, bweprobing_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			json_t *interval = json_object_get(root, "interval");
+			if(interval && json_integer_value(interval) < 1000) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"Invalid element type (interval should be at least 1000ms)");
+				goto jsondone;
+			}
+			json_t *max_bitrate = json_object_get(root, "max_bitrate");
+			if(max_bitrate && json_integer_value(max_bitrate) == 0) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"Invalid element type (max_bitrate should be a positive integer)");
+				goto jsondone;
+			}
+			janus_mutex_lock(&handle->mutex);
+			if(interval)
+				handle->bwe_probing_interval = json_integer_value(interval);
+			if(max_bitrate)
+				handle->bwe_probing_max = json_integer_value(max_bitrate);
+			janus_mutex_unlock(&handle->mutex);
+			g_atomic_int_set(&handle->bwe_probing, json_is_true(json_object_get(root, "bwe_probing")));
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", session_id, transaction_text);
+			json_object_set_new(reply, "bwe-probing", g_atomic_int_get(&handle->bwe_probing) ? json_true() : json_false());
+			json_object_set_new(reply, "bwe-probing-interval", json_integer(handle->bwe_probing_interval));
+			json_object_set_new(reply, "bwe-probing-max", json_integer(handle->bwe_probing_max));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		}
-		/* If this is not a request to start/stop debugging to text2pcap, it must be a handle_info */
+		/* If this is not a request to start/stop debugging to text2pcap, or to tweak pacing or probing, it must be a handle_info */
 		if(strcasecmp(message_text, "handle_info")) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
@@ -3245,6 +3347,14 @@ json_t *janus_admin_peerconnection_summary(janus_ice_peerconnection *pc) {
 #ifdef HAVE_SCTP
 		/* FIXME Actually check if this succeeded? */
 		json_object_set_new(d, "sctp-association", dtls->sctp ? json_true() : json_false());
+		janus_sctp_association *sctp = dtls->sctp;
+		if(sctp != NULL) {
+			janus_refcount_increase(&sctp->ref);
+			json_t *sctp_stats = janus_sctp_association_summary(sctp);
+			if(sctp_stats != NULL)
+				json_object_set_new(d, "sctp-stats", sctp_stats);
+			janus_refcount_decrease(&sctp->ref);
+		}
 #endif
 		json_t *stats = json_object();
 		json_t *in_stats = json_object();
@@ -3284,7 +3394,24 @@ json_t *janus_admin_peerconnection_summary(janus_ice_peerconnection *pc) {
 	json_object_set_new(bwe, "twcc", pc->do_transport_wide_cc ? json_true() : json_false());
 	if(pc->transport_wide_cc_ext_id >= 0)
 		json_object_set_new(bwe, "twcc-ext-id", json_integer(pc->transport_wide_cc_ext_id));
+	if(pc->handle != NULL) {
+		json_object_set_new(bwe, "probing", g_atomic_int_get(&pc->handle->bwe_probing) ? json_true() : json_false());
+		json_object_set_new(bwe, "probing-interval", json_integer(pc->handle->bwe_probing_interval));
+		json_object_set_new(bwe, "probing-max", json_integer(pc->handle->bwe_probing_max));
+	}
+	if(pc->bwe != NULL) {
+		json_t *estimator = janus_bwe_context_summary(pc->bwe);
+		if(estimator != NULL)
+			json_object_set_new(bwe, "estimator", estimator);
+	}
 	json_object_set_new(w, "bwe", bwe);
+	if(pc->handle != NULL)
+		json_object_set_new(w, "pacing", g_atomic_int_get(&pc->handle->pacing) ? json_true() : json_false());
+	if(pc->pacer != NULL) {
+		json_t *pacer = janus_pacer_summary(pc->pacer, janus_get_monotonic_time());
+		if(pacer != NULL)
+			json_object_set_new(w, "pacer", pacer);
+	}
 	json_t *media = json_object();
 	/* Iterate on all media */
 	janus_ice_peerconnection_medium *medium = NULL;
@@ -3658,7 +3785,9 @@ janus_plugin *janus_plugin_find(const gchar *package) {
 
 
 /* Plugin callback interface */
-int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep) {
+static int janus_plugin_push_event_internal(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, janus_json_payload *payload, json_t *jsep) {
+	if(payload != NULL)
+		message = payload->json;
 	if(!plugin || !message)
 		return -1;
 	if(!janus_plugin_session_is_alive(plugin_session))
@@ -3707,7 +3836,10 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 		}
 	}
 	/* Reference the payload, as the plugin may still need it and will do a decref itself */
-	json_incref(message);
+	if(payload != NULL)
+		janus_json_payload_ref(payload);
+	else
+		json_incref(message);
 	/* Prepare JSON event */
 	json_t *event = janus_create_message("event", session->session_id, transaction);
 	json_object_set_new(event, "sender", json_integer(ice_handle->handle_id));
@@ -3715,7 +3847,8 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 		json_object_set_new(event, "opaque_id", json_string(ice_handle->opaque_id));
 	json_t *plugin_data = json_object();
 	json_object_set_new(plugin_data, "plugin", json_string(plugin->get_package()));
-	json_object_set_new(plugin_data, "data", message);
+	if(payload == NULL)
+		json_object_set_new(plugin_data, "data", message);
 	json_object_set_new(event, "plugindata", plugin_data);
 	if(merged_jsep != NULL) {
 		if(e2ee)
@@ -3734,7 +3867,7 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 	}
 	/* Send the event */
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...\n", ice_handle->handle_id);
-	janus_session_notify_event(session, event);
+	janus_session_notify_event_payload(session, event, payload);
 
 	if((restart || janus_flags_is_set(&ice_handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RESEND_TRICKLES))
 			&& janus_ice_is_full_trickle_enabled()) {
@@ -3747,6 +3880,16 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 	return JANUS_OK;
 }
 
+int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep) {
+	return janus_plugin_push_event_internal(plugin_session, plugin, transaction, message, NULL, jsep);
+}
+
+int janus_plugin_push_event_payload(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, janus_json_payload *payload, json_t *jsep) {
+	if(payload == NULL)
+		return -1;
+	return janus_plugin_push_event_internal(plugin_session, plugin, transaction, NULL, payload, jsep);
+}
+
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart) {
 	if(!janus_plugin_session_is_alive(plugin_session) ||
 			plugin == NULL || sdp_type == NULL || sdp == NULL) {
@@ -4276,6 +4419,15 @@ void janus_plugin_send_remb(janus_plugin_session *plugin_session, uint32_t bitra
 	janus_ice_send_remb(handle, bitrate);
 }
 
+gboolean janus_plugin_inherit_affinity(janus_plugin_session *plugin_session) {
+	if(!janus_plugin_session_is_alive(plugin_session))
+		return FALSE;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle)
+		return FALSE;
+	return janus_ice_handle_inherit_affinity(handle) == 0;
+}
+
 static gboolean janus_plugin_close_pc_internal(gpointer user_data) {
 	/* We actually enforce the close_pc here */
 	janus_plugin_session *plugin_session = (janus_plugin_session *) user_data;
@@ -5040,6 +5192,15 @@ gint main(int argc, char *argv[]) {
 	} else {
 		janus_recorder_init(FALSE, NULL);
 	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "recordings_index");
+	if(item && item->value) {
+		int interval = atoi(item->value);
+		if(interval < 0) {
+			JANUS_LOG(LOG_WARN, "Invalid recordings index interval (%d), disabling index files\n", interval);
+		} else {
+			janus_recorder_set_index_interval(interval);
+		}
+	}
 
 	/* Check if we should hide dependencies in "info" requests */
 	item = janus_config_get(config, config_general, janus_config_type_item, "hide_dependencies");
@@ -5196,7 +5357,21 @@ gint main(int argc, char *argv[]) {
 		item = janus_config_get(config, config_general, janus_config_type_item, "allow_loop_indication");
 		if(item && item->value)
 			loops_api = janus_is_true(item->value);
+		/* Check if the loops should be pinned to specific CPUs and/or NUMA node */
+		const char *loops_cpus = NULL, *loops_nic = NULL;
+		item = janus_config_get(config, config_general, janus_config_type_item, "event_loops_affinity");
+		if(item && item->value)
+			loops_cpus = item->value;
+		item = janus_config_get(config, config_general, janus_config_type_item, "event_loops_numa_interface");
+		if(item && item->value)
+			loops_nic = item->value;
+		if(loops_cpus || loops_nic)
+			janus_ice_set_static_event_loops_affinity(loops_cpus, loops_nic);
 		janus_ice_set_static_event_loops(loops, loops_api);
+		/* Check if idle handles can be moved to less loaded loops */
+		item = janus_config_get(config, config_general, janus_config_type_item, "loop_rebalancing");
+		if(item && item->value)
+			janus_ice_set_loop_rebalancing(janus_is_true(item->value));
 	}
 	/* Also check if we need a cap on the size of the task pool (default is no limit) */
 	int task_pool_size = -1;
@@ -5357,6 +5532,32 @@ gint main(int argc, char *argv[]) {
 			janus_set_twcc_period(tp);
 		}
 	}
+	/* Pacing of outgoing media */
+	item = janus_config_get(config, config_media, janus_config_type_item, "pacing");
+	if(item && item->value)
+		janus_set_pacing_enabled(janus_is_true(item->value));
+	/* Probing for more bandwidth */
+	item = janus_config_get(config, config_media, janus_config_type_item, "bwe_probing");
+	if(item && item->value)
+		janus_set_bwe_probing_enabled(janus_is_true(item->value));
+	item = janus_config_get(config, config_media, janus_config_type_item, "bwe_probing_interval");
+	if(item && item->value) {
+		int pi = atoi(item->value);
+		if(pi < 1000) {
+			JANUS_LOG(LOG_WARN, "Ignoring bwe_probing_interval value as it's lower than 1000ms\n");
+		} else {
+			janus_set_bwe_probing_interval(pi);
+		}
+	}
+	item = janus_config_get(config, config_media, janus_config_type_item, "bwe_probing_max");
+	if(item && item->value) {
+		int pm = atoi(item->value);
+		if(pm <= 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring bwe_probing_max value as it's not a positive integer\n");
+		} else {
+			janus_set_bwe_probing_max(pm);
+		}
+	}
 
 	/* Setup OpenSSL stuff */
 	const char *server_pem;
@@ -5396,6 +5597,10 @@ gint main(int argc, char *argv[]) {
 	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_ciphers");
 	if(item && item->value)
 		dtls_ciphers = item->value;
+	const char *srtp_profiles = NULL;
+	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_srtp_profiles");
+	if(item && item->value)
+		srtp_profiles = item->value;
 	guint16 dtls_timeout = 1000;
 	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_timeout");
 	if(item && item->value && janus_string_to_uint16(item->value, &dtls_timeout) < 0) {
@@ -5410,10 +5615,14 @@ gint main(int argc, char *argv[]) {
 	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_accept_selfsigned");
 	if(item && item->value)
 		dtls_accept_selfsigned = janus_is_true(item->value);
-	if(janus_dtls_srtp_init(server_pem, server_key, password, dtls_ciphers, dtls_timeout, rsa_private_key, dtls_accept_selfsigned) < 0) {
+	if(janus_dtls_srtp_init(server_pem, server_key, password, dtls_ciphers, srtp_profiles, dtls_timeout, rsa_private_key, dtls_accept_selfsigned) < 0) {
 		janus_options_destroy();
 		exit(1);
 	}
+	/* Check how expensive each SRTP profile is on this machine, unless disabled */
+	item = janus_config_get(config, config_media, janus_config_type_item, "srtp_selftest");
+	if(!item || !item->value || janus_is_true(item->value))
+		janus_dtls_srtp_selftest();
 	/* Check if there's any custom value for the starting MTU to use in the BIO filter */
 	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_mtu");
 	if(item && item->value)
@@ -5429,8 +5638,17 @@ gint main(int argc, char *argv[]) {
 	JANUS_LOG(LOG_WARN, "Data Channels support not compiled\n");
 #endif
 
-	/* Initialize the RTP forwarders functionality */
-	if(janus_rtp_forwarders_init() < 0) {
+	/* Initialize the RTP forwarders functionality: check if packets must be sent by egress threads */
+	int rtpfwd_threads = 0;
+	item = janus_config_get(config, config_media, janus_config_type_item, "rtpfwd_threads");
+	if(item && item->value) {
+		rtpfwd_threads = atoi(item->value);
+		if(rtpfwd_threads < 0) {
+			JANUS_LOG(LOG_WARN, "Invalid number of RTP forwarders egress threads (%d), disabling them\n", rtpfwd_threads);
+			rtpfwd_threads = 0;
+		}
+	}
+	if(janus_rtp_forwarders_init(rtpfwd_threads) < 0) {
 		janus_options_destroy();
 		exit(1);
 	}
@@ -7,6 +7,10 @@
  * saved and reused to reduce allocation calls. The logger output can then
  * be printed to stdout and/or a log file. If external loggers are added
  * to the core, the logger output is passed to those as well.
+ * Each thread that logs something gets its own lock-free ring of pending
+ * lines, plus its own pool of reusable buffers: the log thread drains all
+ * the rings, merges the lines by timestamp and gives the buffers back,
+ * which means threads never contend on a global lock just to log.
  *
  * \ingroup core
  * \ref core
@@ -22,16 +26,42 @@
 
 #define THREAD_NAME "log"
 
+typedef struct janus_log_queue janus_log_queue;
 typedef struct janus_log_buffer janus_log_buffer;
 struct janus_log_buffer {
 	int64_t timestamp;
 	size_t allocated;
+	janus_log_queue *owner;
+	/* Order of the line in the thread that wrote it */
+	guint seq;
 	janus_log_buffer *next;
 	/* str is grown by allocating beyond the struct */
 	char str[1];
 };
 
 #define INITIAL_BUFSZ		2000
+/* Number of lines each thread can have pending before falling back to the shared list */
+#define RING_SIZE			1024
+
+/* Per-thread queue: the owner thread is the only producer of the ring,
+ * and the log thread the only consumer; buffers go back to the owner
+ * via a lock-free stack, which the owner always empties in one go */
+struct janus_log_queue {
+	janus_log_buffer *ring[RING_SIZE];
+	volatile gint head;
+	volatile gint tail;
+	/* Buffers the owner can reuse right away (only touched by the owner) */
+	janus_log_buffer *pool;
+	/* Buffers given back by the log thread */
+	janus_log_buffer * volatile returned;
+	volatile gint pooled;
+	volatile gint orphaned;
+	/* Set when the logger is destroyed while the owner thread is still alive */
+	volatile gint dead;
+	/* Sequence number of the next line (only touched by the owner) */
+	guint seq;
+	janus_log_queue *next;
+};
 
 static gboolean janus_log_console = TRUE;
 static char *janus_log_filepath = NULL;
@@ -41,16 +71,22 @@ static GHashTable *external_loggers = NULL;
 
 static volatile gint initialized = 0;
 static gint stopping = 0;
-static gint poolsz = 0;
+static volatile gint sleeping = 0;
 static gint maxpoolsz = 32;
 /* Buffers over this size will be freed */
 static size_t maxbuffersz = 8000;
+/* Statically allocated and never cleared, as threads may outlive the logger */
 static GMutex lock;
 static GCond cond;
 static GThread *printthread = NULL;
+/* Lines that didn't fit in the ring of their thread */
 static janus_log_buffer *printhead = NULL;
 static janus_log_buffer *printtail = NULL;
-static janus_log_buffer *bufferpool = NULL;
+/* All the per-thread queues */
+static janus_log_queue *queues = NULL;
+
+static void janus_log_queue_orphan(gpointer data);
+static GPrivate janus_log_thread_queue = G_PRIVATE_INIT(janus_log_queue_orphan);
 
 
 gboolean janus_log_is_stdout_enabled(void) {
@@ -77,79 +113,163 @@ static void janus_log_freebuffers(janus_log_buffer **list) {
 	*list = NULL;
 }
 
-static janus_log_buffer *janus_log_getbuf(void) {
-	janus_log_buffer *b;
+static janus_log_buffer *janus_log_steal_returned(janus_log_queue *q) {
+	janus_log_buffer *head;
+	do {
+		head = g_atomic_pointer_get(&q->returned);
+	} while (head && !g_atomic_pointer_compare_and_exchange(&q->returned, head, NULL));
+	return head;
+}
 
+/* Frees a queue that isn't in the list anymore, with whatever it still holds */
+static void janus_log_queue_free(janus_log_queue *q) {
+	guint head = (guint)g_atomic_int_get(&q->head);
+	guint tail = (guint)g_atomic_int_get(&q->tail);
+	for (; tail != head; tail++)
+		g_free(q->ring[tail % RING_SIZE]);
+	janus_log_freebuffers((janus_log_buffer **)&q->returned);
+	janus_log_freebuffers(&q->pool);
+	g_free(q);
+}
+
+static void janus_log_queue_orphan(gpointer data) {
+	/* The owner thread is leaving: the log thread will get rid of the queue,
+	 * unless the logger was destroyed in the meanwhile, in which case we do */
+	janus_log_queue *q = (janus_log_queue *)data;
 	g_mutex_lock(&lock);
-	b = bufferpool;
+	if (g_atomic_int_get(&q->dead)) {
+		g_mutex_unlock(&lock);
+		janus_log_queue_free(q);
+		return;
+	}
+	janus_log_freebuffers(&q->pool);
+	g_atomic_int_set(&q->orphaned, 1);
+	g_mutex_unlock(&lock);
+}
+
+static janus_log_queue *janus_log_get_queue(void) {
+	janus_log_queue *q = g_private_get(&janus_log_thread_queue);
+	if (q != NULL && g_atomic_int_get(&q->dead)) {
+		/* The logger was destroyed and initialized again since we last logged */
+		janus_log_queue_free(q);
+		q = NULL;
+	}
+	if (q == NULL) {
+		q = g_malloc0(sizeof(janus_log_queue));
+		g_private_set(&janus_log_thread_queue, q);
+		g_mutex_lock(&lock);
+		q->next = queues;
+		queues = q;
+		g_mutex_unlock(&lock);
+	}
+	return q;
+}
+
+static janus_log_buffer *janus_log_getbuf(janus_log_queue *q) {
+	janus_log_buffer *b;
+
+	if (q->pool == NULL)
+		q->pool = janus_log_steal_returned(q);
+	b = q->pool;
 	if (b) {
-		bufferpool = b->next;
+		q->pool = b->next;
 		b->next = NULL;
+		g_atomic_int_add(&q->pooled, -1);
 	} else {
-		poolsz++;
-	}
-	g_mutex_unlock(&lock);
-	if (b == NULL) {
 		b = g_malloc(INITIAL_BUFSZ + sizeof(*b));
 		b->allocated = INITIAL_BUFSZ;
 		b->next = NULL;
 	}
+	b->owner = q;
 	return b;
 }
 
-static void *janus_log_thread(void *ctx) {
-	janus_log_buffer *head, *b, *tofree = NULL;
+static void janus_log_putbuf(janus_log_buffer *b) {
+	/* Give the buffer back to its owner, unless it's gone or has enough already */
+	janus_log_queue *q = b->owner;
+	if (q == NULL || g_atomic_int_get(&q->orphaned) || b->allocated > maxbuffersz ||
+			g_atomic_int_get(&q->pooled) >= maxpoolsz) {
+		g_free(b);
+		return;
+	}
+	g_atomic_int_inc(&q->pooled);
+	janus_log_buffer *head;
+	do {
+		head = g_atomic_pointer_get(&q->returned);
+		b->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(&q->returned, head, b));
+}
 
-	while (!g_atomic_int_get(&stopping)) {
-		g_mutex_lock(&lock);
-		if (!printhead) {
-			g_cond_wait(&cond, &lock);
-		}
-		head = printhead;
-		printhead = printtail = NULL;
-		g_mutex_unlock(&lock);
+/* Must be called with the lock held */
+static gboolean janus_log_pending(void) {
+	if (printhead)
+		return TRUE;
+	janus_log_queue *q;
+	for (q = queues; q; q = q->next) {
+		if (g_atomic_int_get(&q->head) != g_atomic_int_get(&q->tail))
+			return TRUE;
+	}
+	return FALSE;
+}
 
-		if (head) {
-			for (b = head; b; b = b->next) {
-				if(janus_log_console)
-					fputs(b->str, stdout);
-				if(janus_log_file)
-					fputs(b->str, janus_log_file);
-				if(external_loggers != NULL) {
-					GHashTableIter iter;
-					gpointer value;
-					g_hash_table_iter_init(&iter, external_loggers);
-					while(g_hash_table_iter_next(&iter, NULL, &value)) {
-						janus_logger *l = value;
-						if(l == NULL)
-							continue;
-						l->incoming_logline(b->timestamp, b->str);
-					}
-				}
-			}
-			g_mutex_lock(&lock);
-			while (head) {
-				b = head;
-				head = b->next;
-				if (poolsz >= maxpoolsz || b->allocated > maxbuffersz) {
-					b->next = tofree;
-					tofree = b;
-					poolsz--;
-				} else {
-					b->next = bufferpool;
-					bufferpool = b;
-				}
+/* Must be called with the lock held: orphaned queues are freed here too */
+static void janus_log_collect(GPtrArray *lines) {
+	janus_log_buffer *b;
+	for (b = printhead; b; b = b->next)
+		g_ptr_array_add(lines, b);
+	printhead = printtail = NULL;
+	janus_log_queue *q = queues, *prev = NULL;
+	while (q) {
+		guint head = (guint)g_atomic_int_get(&q->head);
+		guint tail = (guint)q->tail;
+		while (tail != head) {
+			g_ptr_array_add(lines, q->ring[tail % RING_SIZE]);
+			tail++;
+		}
+		g_atomic_int_set(&q->tail, (gint)tail);
+		if (g_atomic_int_get(&q->orphaned) && (guint)g_atomic_int_get(&q->head) == tail) {
+			/* The thread is gone and we drained everything, get rid of the queue */
+			janus_log_queue *orphan = q;
+			q = q->next;
+			if (prev)
+				prev->next = q;
+			else
+				queues = q;
+			for (b = orphan->returned; b; b = b->next)
+				b->owner = NULL;
+			janus_log_freebuffers((janus_log_buffer **)&orphan->returned);
+			/* Lines we just collected mustn't be given back to the queue */
+			guint i;
+			for (i = 0; i < lines->len; i++) {
+				b = g_ptr_array_index(lines, i);
+				if (b->owner == orphan)
+					b->owner = NULL;
 			}
-			g_mutex_unlock(&lock);
-			if(janus_log_console)
-				fflush(stdout);
-			if(janus_log_file)
-				fflush(janus_log_file);
-			janus_log_freebuffers(&tofree);
+			g_free(orphan);
+			continue;
 		}
+		prev = q;
+		q = q->next;
 	}
-	/* print any remaining messages, stdout flushed on exit */
-	for (b = printhead; b; b = b->next) {
+}
+
+static gint janus_log_compare(gconstpointer a, gconstpointer b) {
+	const janus_log_buffer *ba = *(janus_log_buffer * const *)a;
+	const janus_log_buffer *bb = *(janus_log_buffer * const *)b;
+	if (ba->timestamp != bb->timestamp)
+		return ba->timestamp > bb->timestamp ? 1 : -1;
+	/* Same timestamp: keep lines from the same thread in the order they were written */
+	if (ba->owner != bb->owner)
+		return ba->owner > bb->owner ? 1 : -1;
+	return (gint)(ba->seq - bb->seq);
+}
+
+static void janus_log_print(GPtrArray *lines) {
+	/* Merge the lines from the different threads by timestamp */
+	g_ptr_array_sort(lines, janus_log_compare);
+	guint i;
+	for (i = 0; i < lines->len; i++) {
+		janus_log_buffer *b = g_ptr_array_index(lines, i);
 		if(janus_log_console)
 			fputs(b->str, stdout);
 		if(janus_log_file)
@@ -166,15 +286,45 @@ static void *janus_log_thread(void *ctx) {
 			}
 		}
 	}
+}
+
+static void *janus_log_thread(void *ctx) {
+	GPtrArray *lines = g_ptr_array_new();
+	guint i;
+
+	while (!g_atomic_int_get(&stopping)) {
+		g_mutex_lock(&lock);
+		g_atomic_int_set(&sleeping, 1);
+		if (!janus_log_pending())
+			g_cond_wait_until(&cond, &lock, g_get_monotonic_time() + G_USEC_PER_SEC);
+		g_atomic_int_set(&sleeping, 0);
+		janus_log_collect(lines);
+		g_mutex_unlock(&lock);
+
+		if (lines->len > 0) {
+			janus_log_print(lines);
+			if(janus_log_console)
+				fflush(stdout);
+			if(janus_log_file)
+				fflush(janus_log_file);
+			for (i = 0; i < lines->len; i++)
+				janus_log_putbuf(g_ptr_array_index(lines, i));
+			g_ptr_array_set_size(lines, 0);
+		}
+	}
+	/* print any remaining messages, stdout flushed on exit */
+	g_mutex_lock(&lock);
+	janus_log_collect(lines);
+	g_mutex_unlock(&lock);
+	janus_log_print(lines);
+	for (i = 0; i < lines->len; i++)
+		janus_log_putbuf(g_ptr_array_index(lines, i));
+	g_ptr_array_free(lines, TRUE);
 	janus_log_set_loggers(NULL);
 	if(janus_log_console)
 		fflush(stdout);
 	if(janus_log_file)
 		fflush(janus_log_file);
-	janus_log_freebuffers(&printhead);
-	janus_log_freebuffers(&bufferpool);
-	g_mutex_clear(&lock);
-	g_cond_clear(&cond);
 
 	if(janus_log_file)
 		fclose(janus_log_file);
@@ -188,8 +338,19 @@ static void *janus_log_thread(void *ctx) {
 void janus_vprintf(const char *format, ...) {
 	int len;
 	va_list ap, ap2;
-	janus_log_buffer *b = janus_log_getbuf();
+	if (!g_atomic_int_get(&initialized) || g_atomic_int_get(&stopping)) {
+		/* No log thread to hand the line to, print it directly */
+		va_start(ap, format);
+		char *line = g_strdup_vprintf(format, ap);
+		va_end(ap);
+		g_print("%s", line);
+		g_free(line);
+		return;
+	}
+	janus_log_queue *q = janus_log_get_queue();
+	janus_log_buffer *b = janus_log_getbuf(q);
 	b->timestamp = janus_get_real_time();
+	b->seq = q->seq++;
 
 	va_start(ap, format);
 	va_copy(ap2, ap);
@@ -204,6 +365,20 @@ void janus_vprintf(const char *format, ...) {
 	}
 	va_end(ap2);
 
+	guint head = (guint)q->head;
+	if (head - (guint)g_atomic_int_get(&q->tail) < RING_SIZE) {
+		/* Lock-free path: add the line to the ring of this thread */
+		q->ring[head % RING_SIZE] = b;
+		g_atomic_int_set(&q->head, (gint)(head + 1));
+		/* Only wake the log thread up if it's waiting for something to do */
+		if (g_atomic_int_get(&sleeping) && g_atomic_int_compare_and_exchange(&sleeping, 1, 0)) {
+			g_mutex_lock(&lock);
+			g_cond_signal(&cond);
+			g_mutex_unlock(&lock);
+		}
+		return;
+	}
+	/* The ring is full, append to the shared list */
 	g_mutex_lock(&lock);
 	if (!printhead) {
 		printhead = printtail = b;
@@ -215,12 +390,29 @@ void janus_vprintf(const char *format, ...) {
 	g_mutex_unlock(&lock);
 }
 
+int janus_log_ratelimit_check(janus_log_ratelimit *rl, int burst) {
+	gint now = (gint)(janus_get_monotonic_time()/G_USEC_PER_SEC);
+	gint window = g_atomic_int_get(&rl->window);
+	if (window != now && g_atomic_int_compare_and_exchange(&rl->window, window, now))
+		g_atomic_int_set(&rl->count, 0);
+	if (g_atomic_int_add(&rl->count, 1) >= burst) {
+		/* Too many lines from this call site in this second, suppress */
+		g_atomic_int_inc(&rl->suppressed);
+		return -1;
+	}
+	/* Return how many lines were suppressed so far, so that they can be reported */
+	gint suppressed;
+	do {
+		suppressed = g_atomic_int_get(&rl->suppressed);
+	} while (suppressed && !g_atomic_int_compare_and_exchange(&rl->suppressed, suppressed, 0));
+	return suppressed;
+}
+
 int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
 	if (!g_atomic_int_compare_and_exchange(&initialized, 0, 1)) {
 		return 0;
 	}
-	g_mutex_init(&lock);
-	g_cond_init(&cond);
+	g_atomic_int_set(&stopping, 0);
 	if(console) {
 		/* Set stdout to block buffering, see BUFSIZ in stdio.h */
 		setvbuf(stdout, NULL, _IOFBF, 0);
@@ -273,4 +465,23 @@ void janus_log_destroy(void) {
 	g_cond_signal(&cond);
 	g_mutex_unlock(&lock);
 	g_thread_join(printthread);
+	printthread = NULL;
+	/* The log thread printed everything it could: free the queues of the
+	 * threads that are gone, while the ones of the threads that are still
+	 * alive are only marked as dead, and freed by their owner later on */
+	g_mutex_lock(&lock);
+	janus_log_queue *q = queues;
+	while (q) {
+		janus_log_queue *next = q->next;
+		if (g_atomic_int_get(&q->orphaned))
+			janus_log_queue_free(q);
+		else
+			g_atomic_int_set(&q->dead, 1);
+		q = next;
+	}
+	queues = NULL;
+	janus_log_freebuffers(&printhead);
+	printtail = NULL;
+	g_atomic_int_set(&initialized, 0);
+	g_mutex_unlock(&lock);
 }
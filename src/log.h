@@ -24,6 +24,23 @@
 * \note This output is buffered and may not appear immediately on stdout. */
 void janus_vprintf(const char *format, ...) G_GNUC_PRINTF(1, 2);
 
+/*! \brief Per-call-site state of a rate limited log line
+ * \note Instances are declared automatically by JANUS_LOG_RATELIMITED */
+typedef struct janus_log_ratelimit {
+	/*! \brief Second the current window refers to */
+	volatile gint window;
+	/*! \brief Lines logged in the current window */
+	volatile gint count;
+	/*! \brief Lines suppressed since the last one that was logged */
+	volatile gint suppressed;
+} janus_log_ratelimit;
+/*! \brief Helper to check whether a rate limited line can be logged
+ * @param[in] rl The state of the call site
+ * @param[in] burst How many lines per second can be logged from this call site
+ * @returns -1 if the line should be suppressed, or how many lines were suppressed
+ * before this one otherwise (0 if none was) */
+int janus_log_ratelimit_check(janus_log_ratelimit *rl, int burst);
+
 /*! \brief Log initialization
 * \note This should be called before attempting to use the logger. A buffer
 * pool and processing thread are created.
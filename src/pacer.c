@@ -0,0 +1,247 @@
+/*! \file    pacer.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Outgoing media pacer
+ * \details  Implementation of a simple leaky bucket pacer for outgoing
+ * media: packets are queued by priority, and released at a configured
+ * rate, with a short burst allowed when we've been idle for a while.
+ * When packets have been waiting for too long, the pacer temporarily
+ * goes faster, so that queues can be drained in a reasonable time.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <string.h>
+
+#include "pacer.h"
+#include "debug.h"
+
+/* Budget we can accumulate while idle, in us worth of the pacing rate */
+#define JANUS_PACER_MAX_BURST	10000
+/* Maximum time (us) we want packets to wait: when the queues would need
+ * more than this to be drained, we go faster than the pacing rate */
+#define JANUS_PACER_MAX_QUEUE_TIME	500000
+/* Minimum pacing rate, in bps */
+#define JANUS_PACER_MIN_RATE	100000
+/* Initial size of the queues */
+#define JANUS_PACER_QUEUE_SIZE	64
+
+janus_pacer *janus_pacer_create(GDestroyNotify item_free) {
+	janus_pacer *pacer = g_malloc0(sizeof(janus_pacer));
+	pacer->item_free = item_free;
+	janus_mutex_init(&pacer->mutex);
+	return pacer;
+}
+
+void janus_pacer_destroy(janus_pacer *pacer) {
+	if(pacer == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<janus_pacer_priority_count; i++) {
+		janus_pacer_queue *q = &pacer->queues[i];
+		while(q->count > 0) {
+			if(pacer->item_free)
+				pacer->item_free(q->items[q->head].data);
+			q->head = (q->head + 1) % q->size;
+			q->count--;
+		}
+		g_free(q->items);
+	}
+	janus_mutex_destroy(&pacer->mutex);
+	g_free(pacer);
+}
+
+void janus_pacer_set_rate(janus_pacer *pacer, guint32 rate) {
+	if(pacer == NULL)
+		return;
+	if(rate > 0 && rate < JANUS_PACER_MIN_RATE)
+		rate = JANUS_PACER_MIN_RATE;
+	janus_mutex_lock(&pacer->mutex);
+	pacer->rate = rate;
+	janus_mutex_unlock(&pacer->mutex);
+}
+
+guint32 janus_pacer_get_rate(janus_pacer *pacer) {
+	if(pacer == NULL)
+		return 0;
+	janus_mutex_lock(&pacer->mutex);
+	guint32 rate = pacer->rate;
+	janus_mutex_unlock(&pacer->mutex);
+	return rate;
+}
+
+/* Rate we should actually send at: the pacing rate, unless the queues got too long */
+static double janus_pacer_effective_rate(janus_pacer *pacer) {
+	guint64 bytes = 0;
+	int i = 0;
+	for(i=0; i<janus_pacer_priority_count; i++)
+		bytes += pacer->queues[i].bytes;
+	double drain = (double)bytes * 8 * G_USEC_PER_SEC / JANUS_PACER_MAX_QUEUE_TIME;
+	return drain > pacer->rate ? drain : pacer->rate;
+}
+
+static void janus_pacer_refill(janus_pacer *pacer, gint64 now) {
+	if(pacer->last_refill == 0 || now < pacer->last_refill) {
+		pacer->last_refill = now;
+		return;
+	}
+	double rate = janus_pacer_effective_rate(pacer);
+	pacer->budget += rate * (now - pacer->last_refill) / (8 * G_USEC_PER_SEC);
+	double max = rate * JANUS_PACER_MAX_BURST / (8 * G_USEC_PER_SEC);
+	if(pacer->budget > max)
+		pacer->budget = max;
+	pacer->last_refill = now;
+}
+
+void janus_pacer_enqueue(janus_pacer *pacer, gpointer data, int size, janus_pacer_priority priority, gint64 now) {
+	if(pacer == NULL || data == NULL || priority >= janus_pacer_priority_count)
+		return;
+	janus_mutex_lock(&pacer->mutex);
+	janus_pacer_queue *q = &pacer->queues[priority];
+	if(q->count == q->size) {
+		/* Grow the ring, moving the packets to the beginning */
+		guint size = q->size ? q->size*2 : JANUS_PACER_QUEUE_SIZE;
+		janus_pacer_item *items = g_malloc(size * sizeof(janus_pacer_item));
+		guint i = 0;
+		for(i=0; i<q->count; i++)
+			items[i] = q->items[(q->head + i) % q->size];
+		g_free(q->items);
+		q->items = items;
+		q->size = size;
+		q->head = 0;
+	}
+	janus_pacer_item *item = &q->items[(q->head + q->count) % q->size];
+	item->data = data;
+	item->size = size;
+	item->queued = now;
+	q->count++;
+	q->bytes += size;
+	janus_mutex_unlock(&pacer->mutex);
+}
+
+void janus_pacer_account(janus_pacer *pacer, int size, gint64 now) {
+	if(pacer == NULL)
+		return;
+	janus_mutex_lock(&pacer->mutex);
+	if(pacer->rate > 0) {
+		janus_pacer_refill(pacer, now);
+		pacer->budget -= size;
+	}
+	pacer->packets_unpaced++;
+	pacer->bytes_unpaced += size;
+	janus_mutex_unlock(&pacer->mutex);
+}
+
+gpointer janus_pacer_dequeue(janus_pacer *pacer, gint64 now, gboolean flush) {
+	if(pacer == NULL)
+		return NULL;
+	janus_mutex_lock(&pacer->mutex);
+	janus_pacer_queue *q = NULL;
+	int i = 0;
+	for(i=0; i<janus_pacer_priority_count; i++) {
+		if(pacer->queues[i].count > 0) {
+			q = &pacer->queues[i];
+			break;
+		}
+	}
+	if(q == NULL) {
+		janus_mutex_unlock(&pacer->mutex);
+		return NULL;
+	}
+	if(pacer->rate > 0 && !flush) {
+		janus_pacer_refill(pacer, now);
+		if(pacer->budget <= 0) {
+			janus_mutex_unlock(&pacer->mutex);
+			return NULL;
+		}
+	}
+	janus_pacer_item *item = &q->items[q->head];
+	gpointer data = item->data;
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	q->bytes -= item->size;
+	if(pacer->rate > 0)
+		pacer->budget -= item->size;
+	/* Update the stats */
+	gint64 delay = now - item->queued;
+	if(delay < 0)
+		delay = 0;
+	pacer->avg_delay = pacer->packets_paced ? (0.95 * pacer->avg_delay + 0.05 * delay) : delay;
+	if(delay > pacer->max_delay)
+		pacer->max_delay = delay;
+	pacer->packets_paced++;
+	pacer->bytes_paced += item->size;
+	janus_mutex_unlock(&pacer->mutex);
+	return data;
+}
+
+gboolean janus_pacer_is_empty(janus_pacer *pacer) {
+	if(pacer == NULL)
+		return TRUE;
+	janus_mutex_lock(&pacer->mutex);
+	gboolean empty = TRUE;
+	int i = 0;
+	for(i=0; i<janus_pacer_priority_count; i++) {
+		if(pacer->queues[i].count > 0) {
+			empty = FALSE;
+			break;
+		}
+	}
+	janus_mutex_unlock(&pacer->mutex);
+	return empty;
+}
+
+gint64 janus_pacer_next(janus_pacer *pacer, gint64 now) {
+	if(pacer == NULL)
+		return -1;
+	janus_mutex_lock(&pacer->mutex);
+	gint64 next = -1;
+	int i = 0;
+	for(i=0; i<janus_pacer_priority_count; i++) {
+		if(pacer->queues[i].count > 0) {
+			next = 0;
+			break;
+		}
+	}
+	if(next == 0 && pacer->rate > 0) {
+		janus_pacer_refill(pacer, now);
+		if(pacer->budget <= 0) {
+			/* Wait until we paid our debt */
+			double rate = janus_pacer_effective_rate(pacer);
+			next = (gint64)(-pacer->budget * 8 * G_USEC_PER_SEC / rate) + 1;
+		}
+	}
+	janus_mutex_unlock(&pacer->mutex);
+	return next;
+}
+
+json_t *janus_pacer_summary(janus_pacer *pacer, gint64 now) {
+	if(pacer == NULL)
+		return NULL;
+	json_t *info = json_object();
+	janus_mutex_lock(&pacer->mutex);
+	guint64 packets = 0, bytes = 0;
+	gint64 oldest = 0;
+	int i = 0;
+	for(i=0; i<janus_pacer_priority_count; i++) {
+		janus_pacer_queue *q = &pacer->queues[i];
+		packets += q->count;
+		bytes += q->bytes;
+		if(q->count > 0 && (oldest == 0 || q->items[q->head].queued < oldest))
+			oldest = q->items[q->head].queued;
+	}
+	json_object_set_new(info, "rate", json_integer(pacer->rate));
+	json_object_set_new(info, "queued-packets", json_integer(packets));
+	json_object_set_new(info, "queued-bytes", json_integer(bytes));
+	/* Delays are in milliseconds */
+	json_object_set_new(info, "queue-delay", json_integer(oldest > 0 && now > oldest ? (now - oldest)/1000 : 0));
+	json_object_set_new(info, "avg-queue-delay", json_real(pacer->avg_delay/1000));
+	json_object_set_new(info, "max-queue-delay", json_integer(pacer->max_delay/1000));
+	json_object_set_new(info, "packets-paced", json_integer(pacer->packets_paced));
+	json_object_set_new(info, "bytes-paced", json_integer(pacer->bytes_paced));
+	json_object_set_new(info, "packets-unpaced", json_integer(pacer->packets_unpaced));
+	json_object_set_new(info, "bytes-unpaced", json_integer(pacer->bytes_unpaced));
+	janus_mutex_unlock(&pacer->mutex);
+	return info;
+}
@@ -0,0 +1,127 @@
+/*! \file    pacer.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Outgoing media pacer (headers)
+ * \details  Implementation of a simple leaky bucket pacer for outgoing
+ * media. Rather than sending packets as soon as they're available, which
+ * for large keyframes means dozens of packets leaving the NIC back to back,
+ * packets are queued and released at a configured rate, which is usually
+ * a multiple of the bandwidth we think is available. Packets are queued
+ * in different queues depending on their priority, e.g., so that
+ * retransmissions go out before new video packets: traffic that is not
+ * paced at all (e.g., audio) can still be accounted for, so that it
+ * consumes part of the budget.
+ *
+ * The pacer is agnostic to what it queues: the core creates one for each
+ * PeerConnection that has pacing enabled, and feeds it with the packets
+ * its plugin is sending.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_PACER_H
+#define JANUS_PACER_H
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "mutex.h"
+
+/*! \brief Priority of a paced packet: queues with a lower value are always emptied first */
+typedef enum janus_pacer_priority {
+	janus_pacer_priority_retransmission = 0,
+	janus_pacer_priority_video,
+	janus_pacer_priority_count
+} janus_pacer_priority;
+
+/*! \brief Packet waiting in a pacer queue */
+typedef struct janus_pacer_item {
+	/*! \brief Opaque pointer to the packet */
+	gpointer data;
+	/*! \brief Size of the packet, in bytes */
+	int size;
+	/*! \brief When the packet was queued (monotonic time) */
+	gint64 queued;
+} janus_pacer_item;
+
+/*! \brief Queue of packets with the same priority, implemented as a growing ring */
+typedef struct janus_pacer_queue {
+	/*! \brief Ring of packets */
+	janus_pacer_item *items;
+	/*! \brief Size of the ring, index of the oldest packet, and number of packets */
+	guint size, head, count;
+	/*! \brief Number of bytes in the queue */
+	guint64 bytes;
+} janus_pacer_queue;
+
+/*! \brief Pacer context */
+typedef struct janus_pacer {
+	/*! \brief Queues, one per priority */
+	janus_pacer_queue queues[janus_pacer_priority_count];
+	/*! \brief Method to free packets that are still queued when the pacer is destroyed */
+	GDestroyNotify item_free;
+	/*! \brief Pacing rate, in bps (0 means no limit) */
+	guint32 rate;
+	/*! \brief Bytes we can currently send (can be negative, when we're in debt) */
+	double budget;
+	/*! \brief When the budget was last refilled */
+	gint64 last_refill;
+	/*! \brief Smoothed and maximum time packets spent in the queue, in us */
+	double avg_delay;
+	gint64 max_delay;
+	/*! \brief Counters, for the Admin API */
+	guint64 packets_paced, bytes_paced, packets_unpaced, bytes_unpaced;
+	/*! \brief Mutex to lock this context */
+	janus_mutex mutex;
+} janus_pacer;
+
+/*! \brief Create a new pacer
+ * @param[in] item_free Method to free packets still queued when the pacer is destroyed
+ * @returns A new janus_pacer instance */
+janus_pacer *janus_pacer_create(GDestroyNotify item_free);
+/*! \brief Destroy a pacer, and free all the packets still queued
+ * @param[in] pacer The janus_pacer instance to destroy */
+void janus_pacer_destroy(janus_pacer *pacer);
+/*! \brief Change the pacing rate
+ * @param[in] pacer The janus_pacer instance to update
+ * @param[in] rate The new pacing rate, in bps (0 to disable pacing) */
+void janus_pacer_set_rate(janus_pacer *pacer, guint32 rate);
+/*! \brief Get the current pacing rate
+ * @param[in] pacer The janus_pacer instance to query
+ * @returns The pacing rate, in bps */
+guint32 janus_pacer_get_rate(janus_pacer *pacer);
+/*! \brief Queue a packet
+ * @param[in] pacer The janus_pacer instance to update
+ * @param[in] data Opaque pointer to the packet
+ * @param[in] size Size of the packet, in bytes
+ * @param[in] priority Priority of the packet
+ * @param[in] now The current monotonic time */
+void janus_pacer_enqueue(janus_pacer *pacer, gpointer data, int size, janus_pacer_priority priority, gint64 now);
+/*! \brief Take into account a packet that was sent without being paced (e.g., audio)
+ * @param[in] pacer The janus_pacer instance to update
+ * @param[in] size Size of the packet, in bytes
+ * @param[in] now The current monotonic time */
+void janus_pacer_account(janus_pacer *pacer, int size, gint64 now);
+/*! \brief Get the next packet that can be sent, if the budget allows it
+ * @param[in] pacer The janus_pacer instance to update
+ * @param[in] now The current monotonic time
+ * @param[in] flush Whether the budget should be ignored (e.g., because pacing was disabled)
+ * @returns The opaque pointer to the packet, or NULL if there's nothing to send right now */
+gpointer janus_pacer_dequeue(janus_pacer *pacer, gint64 now, gboolean flush);
+/*! \brief Check whether there are packets waiting in the pacer
+ * @param[in] pacer The janus_pacer instance to query
+ * @returns TRUE if no packet is queued, FALSE otherwise */
+gboolean janus_pacer_is_empty(janus_pacer *pacer);
+/*! \brief Check when the next packet can be sent
+ * @param[in] pacer The janus_pacer instance to query
+ * @param[in] now The current monotonic time
+ * @returns How long to wait (in us) before the next packet can be sent, or -1 if no packet is queued */
+gint64 janus_pacer_next(janus_pacer *pacer, gint64 now);
+/*! \brief Get a summary of the pacer state, for the Admin API
+ * @param[in] pacer The janus_pacer instance to query
+ * @param[in] now The current monotonic time
+ * @returns A JSON object with the summary */
+json_t *janus_pacer_summary(janus_pacer *pacer, gint64 now);
+
+#endif
@@ -8593,6 +8593,9 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Thread is for participant %s (%s)\n",
 		participant->user_id_str, participant->display ? participant->display : "??");
 	janus_audiobridge_session *session = participant->session;
+	/* Stick to the same CPU as the participant's event loop, if pinned */
+	if(session && session->handle)
+		gateway->inherit_affinity(session->handle);
 
 	/* Output buffer */
 	janus_audiobridge_rtp_relay_packet *outpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
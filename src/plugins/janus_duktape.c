@@ -74,7 +74,10 @@
  * receive events on substream and/or temporal layer changes happening
  * for receiving sessions via the \c substreamChanged() and the
  * \c temporalLayerChanged() callbacks: this may be useful to track
- * which layer is actually being sent, vs. what was requested.
+ * which layer is actually being sent, vs. what was requested. Scripts
+ * that rely on native media routing (see \ref jrouting) can implement
+ * \c mediaStats() to receive periodic summaries of the media sessions
+ * are sending, instead of handling each packet in \c incomingRtp().
  *
  * \section dtcapi C interfaces
  *
@@ -96,7 +99,11 @@
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
  * - \c setSubstream(): set the target simulcast substream;
- * - \c setTemporalLayer(): set the target simulcast temporal layer;
+ * - \c setTemporalLayer(): set the target simulcast (or SVC) temporal layer;
+ * - \c setSpatialLayer(): set the target SVC spatial layer;
+ * - \c setSvc(): specify whether the video a user sends uses SVC;
+ * - \c setMediaRoute(): specify how the C code should handle a user's audio or video;
+ * - \c setMediaStats(): specify how often \c mediaStats() should be invoked for a user;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
@@ -117,7 +124,8 @@
  * JavaScript scripts, you can leverage a scheduler implemented in the C code.
  *
  * More specifically, when the plugin starts a dedicated thread is devoted
- * to the only purpose of acting as a scheduler for JavaScript coroutines. This
+ * to the only purpose of acting as a scheduler for JavaScript coroutines
+ * (one per heap, when \ref jheaps are configured). This
  * means that, whenever this C scheduler is awaken, it will call the
  * \c resumeScheduler() function in the JavaScript script, thus allowing the
  * JavaScript script to execute one or more pending coroutines. The C scheduler
@@ -185,6 +193,72 @@ timeCallback("resumeScheduler", null, 0);
  * Anyway, \c pokeScheduler() and \c resumeScheduler() is much more
  * compact and less verbose, and as such is preferred in cases where
  * timing and opaque arguments are not needed.
+ *
+ * \section jheaps Multiple Duktape heaps
+ *
+ * By default, the script is loaded in a single Duktape heap, which means
+ * that all requests and callbacks, for all sessions, are serialized on
+ * the same lock, and a JavaScript application can't use more than one
+ * core. Setting the \c heaps property in the plugin configuration to a
+ * value higher than 1 loads the script in that many independent heaps
+ * instead, each with its own lock and its own scheduler thread, which
+ * takes care of both \c resumeScheduler() calls and \c timeCallback()
+ * timers for that heap. Sessions are pinned to a heap using their ID as
+ * a hash, and all the callbacks related to them are always invoked in
+ * that heap, as are the scheduler calls and timed callbacks the script
+ * triggers while serving them. All heaps get \c init() and \c destroy()
+ * calls, while requests that are not related to a specific session
+ * (e.g., \c handleAdminMessage() or \c getVersion()) are always handled
+ * by the first heap. Since heaps don't share any global, only scripts
+ * that don't need sessions to see each other's state (e.g., the
+ * \c echotest.js sample, but not \c videoroom.js) should use more
+ * than one heap.
+ *
+ * To help choose the right number of heaps, the plugin keeps track of
+ * how long callbacks wait for the lock of their heap and how long they
+ * take to execute. Sending a \c heaps request via the Admin API (e.g.,
+ * <code>{"request":"heaps"}</code> as the plugin message) returns, for
+ * each heap, the number of sessions pinned to it, the number of callbacks
+ * invoked so far, the average wait and execution times, and the maximum
+ * overall latency, all in microseconds. This request is handled by the
+ * plugin itself, and never passed to \c handleAdminMessage().
+ *
+ * \section jrouting Native media routing
+ *
+ * As soon as a script implements \c incomingRtp(), every RTP packet the
+ * plugin receives is passed to the script, which means it needs to lock
+ * the heap the session is pinned to: this is very expensive, and limits
+ * what a JavaScript application can do with media. To avoid that, scripts
+ * can tell the C code what to do with the media of a session via
+ * \c setMediaRoute(), which expects the session ID, the medium (\c "audio"
+ * or \c "video") and an action among the following:
+ *
+ * - \c "script": pass packets to \c incomingRtp() if the script
+ * implements it, and route them in C otherwise (the default);
+ * - \c "forward": record the packets, if a recording is in progress,
+ * and relay them to all the recipients added with \c addRecipient();
+ * - \c "record": only record the packets, if a recording is in progress;
+ * - \c "drop": drop all packets.
+ *
+ * All of this is done by the media thread of the session, without ever
+ * entering the JavaScript script. When forwarding simulcast or SVC video
+ * (for the latter, \c setSvc() must be called on the sender first), each
+ * recipient only gets the layers it asked for via \c setSubstream(),
+ * \c setSpatialLayer() and \c setTemporalLayer(), and layer changes
+ * are notified via \c substreamChanged() and \c temporalLayerChanged()
+ * (for SVC, the substream is the spatial layer). Since the script doesn't
+ * see packets anymore, \c setMediaStats() can be used to get a summary of
+ * what a session is sending every few seconds instead: the \c mediaStats()
+ * function is then invoked by the scheduler thread of the session heap
+ * with the session ID and a JSON string, e.g.:
+ *
+ * \verbatim
+{
+	"period": 5000,
+	"audio": { "route": "forward", "packets": 250, "bytes": 24110, "bitrate": 38576, "dropped": 0 },
+	"video": { "route": "forward", "packets": 2170, "bytes": 2081433, "bitrate": 3330292, "dropped": 0, "substreams": [ 750, 710, 710 ] }
+}
+\endverbatim
  *
  * Refer to the \ref jspapi section for more information on how you
  * can register your own C functions.
@@ -272,6 +346,9 @@ static char *duktape_folder = NULL;
 /* Duktape stuff */
 duk_context *duktape_ctx = NULL;
 janus_mutex duktape_mutex = JANUS_MUTEX_INITIALIZER;
+janus_duktape_heap *duktape_heaps = NULL;
+guint duktape_heaps_num = 0;
+#define JANUS_DUKTAPE_MAX_HEAPS	64
 static const char *duktape_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -302,29 +379,21 @@ static gboolean has_data_ready = FALSE;
 static gboolean has_slow_link = FALSE;
 static gboolean has_substream_changed = FALSE;
 static gboolean has_temporal_changed = FALSE;
-/* JavaScript C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+static gboolean has_media_stats = FALSE;
+/* JavaScript C scheduler (for coroutines and scheduled callbacks), one per heap */
 static void *janus_duktape_scheduler(void *data);
-static GAsyncQueue *events = NULL;
-typedef enum janus_duktape_event {
-	janus_duktape_event_none = 0,
-	janus_duktape_event_resume,		/* Resume one or more pending coroutines */
-	janus_duktape_event_exit		/* Break the scheduler loop */
-} janus_duktape_event;
-/* JavaScript timer loop (for scheduled callbacks) */
-static GMainContext *timer_context = NULL;
-static GMainLoop *timer_loop = NULL;
-static GThread *timer_thread = NULL;
-static void *janus_duktape_timer(void *data);
+static gboolean janus_duktape_resume_cb(void *data);
 static gboolean janus_duktape_timer_cb(void *data);
 typedef struct janus_duktape_callback {
 	guint id;
 	uint32_t ms;
 	GSource *source;
+	janus_duktape_heap *heap;
 	char *function;
 	char *argument;
 } janus_duktape_callback;
 static GHashTable *callbacks = NULL;
+static janus_mutex callbacks_mutex = JANUS_MUTEX_INITIALIZER;
 static void janus_duktape_callback_free(janus_duktape_callback *cb) {
 	if(!cb)
 		return;
@@ -341,6 +410,35 @@ static void janus_duktape_stackdump(duk_context *ctx) {
 	JANUS_LOG(LOG_HUGE, "Total in Duktape stack: %d\n", top);
 }
 
+/* Helper to find out which heap a Duktape context (or thread) belongs to */
+janus_duktape_heap *janus_duktape_heap_get(duk_context *ctx) {
+	if(ctx == NULL)
+		return NULL;
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "janusHeap");
+	janus_duktape_heap *heap = (janus_duktape_heap *)duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+	return heap;
+}
+
+/* Helpers to lock and unlock a heap when invoking a callback, keeping
+ * track of how long we waited for the lock and how long the call took */
+static gint64 janus_duktape_heap_lock(janus_duktape_heap *heap) {
+	gint64 requested = janus_get_monotonic_time();
+	janus_mutex_lock(heap->mutex);
+	heap->locked = janus_get_monotonic_time();
+	return requested;
+}
+static void janus_duktape_heap_unlock(janus_duktape_heap *heap, gint64 requested) {
+	gint64 now = janus_get_monotonic_time();
+	heap->calls++;
+	heap->wait_total += heap->locked - requested;
+	heap->exec_total += now - heap->locked;
+	if(now - requested > heap->latency_max)
+		heap->latency_max = now - requested;
+	janus_mutex_unlock(heap->mutex);
+}
+
 /* janus_duktape_session is defined in janus_duktape_data.h, but it's managed here */
 GHashTable *duktape_sessions, *duktape_ids;
 janus_mutex duktape_sessions_mutex = JANUS_MUTEX_INITIALIZER;
@@ -378,12 +476,123 @@ typedef struct janus_duktape_rtp_relay_packet {
 	uint32_t ssrc[3];
 	uint32_t timestamp;
 	uint16_t seq_number;
+	/* The following are only relevant for SVC */
+	gboolean svc;
+	janus_vp9_svc_info svc_info;
 	/* The following is only relevant for datachannels */
 	gboolean textdata;
 } janus_duktape_rtp_relay_packet;
 static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data);
 static void janus_duktape_relay_data_packet(gpointer data, gpointer user_data);
 
+/* Native media routing helpers */
+static int janus_duktape_route_from_string(const char *action) {
+	if(action == NULL)
+		return -1;
+	if(!strcasecmp(action, "script"))
+		return janus_duktape_route_script;
+	if(!strcasecmp(action, "forward"))
+		return janus_duktape_route_forward;
+	if(!strcasecmp(action, "record"))
+		return janus_duktape_route_record;
+	if(!strcasecmp(action, "drop"))
+		return janus_duktape_route_drop;
+	return -1;
+}
+static const char *janus_duktape_route_str(int route) {
+	switch(route) {
+		case janus_duktape_route_script:
+			return "script";
+		case janus_duktape_route_forward:
+			return "forward";
+		case janus_duktape_route_record:
+			return "record";
+		case janus_duktape_route_drop:
+			return "drop";
+		default:
+			break;
+	}
+	return NULL;
+}
+static void janus_duktape_media_stats_reset(janus_duktape_session *session) {
+	memset(&session->stats, 0, sizeof(session->stats));
+	session->stats_latest = 0;
+}
+/* Summary of the media a session is sending, to pass to mediaStats() */
+typedef struct janus_duktape_media_stats_event {
+	janus_duktape_heap *heap;
+	guint32 session;
+	char *stats;
+} janus_duktape_media_stats_event;
+static void janus_duktape_media_stats_event_free(janus_duktape_media_stats_event *event) {
+	if(!event)
+		return;
+	g_free(event->stats);
+	g_free(event);
+}
+static gboolean janus_duktape_media_stats_cb(void *data);
+/* Update the stats of a session with a new packet (invoked by the media
+ * thread), and if it's time, have the scheduler thread of the heap the
+ * session is pinned to invoke mediaStats() in the script with a summary */
+static void janus_duktape_media_stats_update(janus_duktape_session *session, gboolean video, int sc, int len, gboolean dropped) {
+	guint period = (guint)g_atomic_int_get(&session->stats_period);
+	if(!has_media_stats || period == 0)
+		return;
+	janus_duktape_media_stats *ms = &session->stats[video ? 1 : 0];
+	ms->packets++;
+	ms->bytes += len;
+	if(dropped)
+		ms->dropped++;
+	else if(video && sc >= 0 && sc < 3)
+		ms->layers[sc]++;
+	gint64 now = janus_get_monotonic_time();
+	if(session->stats_latest == 0)
+		session->stats_latest = now;
+	gint64 elapsed = now - session->stats_latest;
+	if(elapsed < (gint64)period*G_USEC_PER_SEC)
+		return;
+	/* Prepare the summary */
+	json_t *stats = json_object();
+	json_object_set_new(stats, "period", json_integer(elapsed/1000));
+	int i = 0;
+	for(i=0; i<2; i++) {
+		ms = &session->stats[i];
+		if(ms->packets == 0)
+			continue;
+		json_t *medium = json_object();
+		json_object_set_new(medium, "route", json_string(janus_duktape_route_str(g_atomic_int_get(&session->route[i]))));
+		json_object_set_new(medium, "packets", json_integer(ms->packets));
+		json_object_set_new(medium, "bytes", json_integer(ms->bytes));
+		json_object_set_new(medium, "bitrate", json_integer(ms->bytes*8*G_USEC_PER_SEC/elapsed));
+		json_object_set_new(medium, "dropped", json_integer(ms->dropped));
+		if(i == 1 && (ms->layers[1] > 0 || ms->layers[2] > 0)) {
+			json_t *layers = json_array();
+			json_array_append_new(layers, json_integer(ms->layers[0]));
+			json_array_append_new(layers, json_integer(ms->layers[1]));
+			json_array_append_new(layers, json_integer(ms->layers[2]));
+			json_object_set_new(medium, "substreams", layers);
+		}
+		json_object_set_new(stats, i ? "video" : "audio", medium);
+	}
+	janus_duktape_media_stats_reset(session);
+	session->stats_latest = now;
+	char *text = json_dumps(stats, JSON_PRESERVE_ORDER);
+	json_decref(stats);
+	if(text == NULL || session->heap->context == NULL) {
+		free(text);
+		return;
+	}
+	janus_duktape_media_stats_event *event = g_malloc0(sizeof(janus_duktape_media_stats_event));
+	event->heap = session->heap;
+	event->session = session->id;
+	event->stats = g_strdup(text);
+	free(text);
+	GSource *source = g_idle_source_new();
+	g_source_set_callback(source, janus_duktape_media_stats_cb, event, (GDestroyNotify)janus_duktape_media_stats_event_free);
+	g_source_attach(source, session->heap->context);
+	g_source_unref(source);
+}
+
 
 /* Helper struct to address outgoing notifications, e.g., involving PeerConnections */
 typedef enum janus_duktape_async_event_type {
@@ -491,7 +700,15 @@ static duk_ret_t janus_duktape_method_readfile(duk_context *ctx) {
 
 static duk_ret_t janus_duktape_method_pokescheduler(duk_context *ctx) {
 	/* This method allows the JavaScript script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_duktape_event_resume));
+	janus_duktape_heap *heap = janus_duktape_heap_get(ctx);
+	if(heap == NULL || heap->context == NULL) {
+		duk_push_int(ctx, -1);
+		return 1;
+	}
+	GSource *source = g_idle_source_new();
+	g_source_set_callback(source, janus_duktape_resume_cb, heap, NULL);
+	g_source_attach(source, heap->context);
+	g_source_unref(source);
 	duk_push_int(ctx, 0);
 	return 1;
 }
@@ -513,6 +730,11 @@ static duk_ret_t janus_duktape_method_timecallback(duk_context *ctx) {
 			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 2)));
 		return duk_throw(ctx);
 	}
+	janus_duktape_heap *heap = janus_duktape_heap_get(ctx);
+	if(heap == NULL || heap->context == NULL) {
+		duk_push_int(ctx, -1);
+		return 1;
+	}
 	const char *function = duk_get_string(ctx, 0);
 	const char *argument = duk_get_string(ctx, 1);
 	uint32_t ms = (uint32_t)duk_get_number(ctx, 2);
@@ -522,10 +744,13 @@ static duk_ret_t janus_duktape_method_timecallback(duk_context *ctx) {
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
 	cb->ms = ms;
+	cb->heap = heap;
 	cb->source = g_timeout_source_new(ms);
 	g_source_set_callback(cb->source, janus_duktape_timer_cb, cb, NULL);
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_insert(callbacks, cb, cb);
-	cb->id = g_source_attach(cb->source, timer_context);
+	cb->id = g_source_attach(cb->source, cb->heap->context);
+	janus_mutex_unlock(&callbacks_mutex);
 	JANUS_LOG(LOG_VERB, "Created scheduled callback (%"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
 	/* Done */
 	duk_push_int(ctx, 0);
@@ -1025,8 +1250,152 @@ static duk_ret_t janus_duktape_method_settemporallayer(duk_context *ctx) {
 	}
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&duktape_sessions_mutex);
-	if(temporal <= 2)
+	if(temporal <= 2) {
 		session->sim_context.templayer_target = temporal;
+		session->svc_context.temporal_target = temporal;
+	}
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_setspatiallayer(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	uint16_t spatial = (uint16_t)duk_get_number(ctx, 1);
+	/* Find the session */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	if(spatial <= 2)
+		session->svc_context.spatial_target = spatial;
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_setsvc(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_BOOLEAN) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_BOOLEAN), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	int svc = duk_get_boolean(ctx, 1);
+	/* Find the session */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	session->svc = svc ? TRUE : FALSE;
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_setmediaroute(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_STRING) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 2) != DUK_TYPE_STRING) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 2)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	const char *medium = duk_get_string(ctx, 1);
+	const char *action = duk_get_string(ctx, 2);
+	int index = -1;
+	if(medium && !strcasecmp(medium, "audio"))
+		index = 0;
+	else if(medium && !strcasecmp(medium, "video"))
+		index = 1;
+	int route = janus_duktape_route_from_string(action);
+	if(index < 0 || route < 0) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid media route (%s, %s)\n", medium, action);
+		return duk_throw(ctx);
+	}
+	/* Find the session */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	g_atomic_int_set(&session->route[index], route);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_setmediastats(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	double value = duk_get_number(ctx, 1);
+	if(!(value >= 0 && value <= G_MAXUINT16)) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid media stats period (%g, expected 0-%d)\n", value, G_MAXUINT16);
+		return duk_throw(ctx);
+	}
+	gint period = (gint)value;
+	/* Find the session */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	g_atomic_int_set(&session->stats_period, period);
 	/* Done */
 	janus_refcount_decrease(&session->ref);
 	duk_push_int(ctx, 0);
@@ -1481,58 +1850,85 @@ static duk_ret_t janus_duktape_method_stoprecording(duk_context *ctx) {
 
 
 /* Plugin implementation */
-int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
-	if(g_atomic_int_get(&duktape_stopping)) {
-		/* Still stopping from before */
-		return -1;
-	}
-	if(callback == NULL || config_path == NULL) {
-		/* Invalid arguments */
-		return -1;
-	}
+/* Helper to stop the scheduler thread of a heap: we quit the loop from
+ * within the loop itself, as a g_main_loop_quit() issued before the
+ * thread got to g_main_loop_run() would be lost, and the join would hang */
+static gboolean janus_duktape_quit_cb(void *data) {
+	g_main_loop_quit((GMainLoop *)data);
+	return G_SOURCE_REMOVE;
+}
+static void janus_duktape_heap_quit(janus_duktape_heap *heap) {
+	GSource *source = g_idle_source_new();
+	g_source_set_priority(source, G_PRIORITY_HIGH);
+	g_source_set_callback(source, janus_duktape_quit_cb, heap->loop, NULL);
+	g_source_attach(source, heap->context);
+	g_source_unref(source);
+}
 
-	/* Read configuration */
-	char filename[255];
-	g_snprintf(filename, 255, "%s/%s.jcfg", config_path, JANUS_DUKTAPE_PACKAGE);
-	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
-	janus_config *config = janus_config_parse(filename);
-	if(config == NULL) {
-		JANUS_LOG(LOG_WARN, "Couldn't find .jcfg configuration file (%s), trying .cfg\n", JANUS_DUKTAPE_PACKAGE);
-		g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_DUKTAPE_PACKAGE);
-		JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
-		config = janus_config_parse(filename);
-	}
-	if(config == NULL) {
-		/* No config means no JS script */
-		JANUS_LOG(LOG_ERR, "Failed to load configuration file for Duktape plugin...\n");
-		return -1;
-	}
-	janus_config_print(config);
-	janus_config_category *config_general = janus_config_get_create(config, NULL, janus_config_type_category, "general");
-	janus_config_item *folder = janus_config_get(config, config_general, janus_config_type_item, "path");
-	if(folder && folder->value)
-		duktape_folder = g_strdup(folder->value);
-	janus_config_item *script = janus_config_get(config, config_general, janus_config_type_item, "script");
-	if(script == NULL || script->value == NULL) {
-		JANUS_LOG(LOG_ERR, "Missing script path in Duktape plugin configuration...\n");
-		janus_config_destroy(config);
-		g_free(duktape_folder);
-		return -1;
+/* Helper to destroy all the Duktape heaps, and free the related resources */
+static void janus_duktape_heaps_close(void) {
+	if(duktape_heaps == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<duktape_heaps_num; i++) {
+		janus_duktape_heap *heap = &duktape_heaps[i];
+		if(heap->thread != NULL) {
+			janus_duktape_heap_quit(heap);
+			g_thread_join(heap->thread);
+			heap->thread = NULL;
+		}
+		if(heap->loop != NULL) {
+			g_main_loop_unref(heap->loop);
+			heap->loop = NULL;
+		}
+		if(heap->context != NULL) {
+			g_main_context_unref(heap->context);
+			heap->context = NULL;
+		}
+		if(heap->ctx != NULL) {
+			janus_mutex_lock(heap->mutex);
+			duk_destroy_heap(heap->ctx);
+			heap->ctx = NULL;
+			janus_mutex_unlock(heap->mutex);
+		}
+		if(i > 0)
+			janus_mutex_destroy(&heap->lock);
 	}
-	char *duktape_file = g_strdup(script->value);
-	char *duktape_config = NULL;
-	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
-	if(conf && conf->value)
-		duktape_config = g_strdup(conf->value);
-	janus_config_destroy(config);
+	g_free(duktape_heaps);
+	duktape_heaps = NULL;
+	duktape_ctx = NULL;
+	duktape_heaps_num = 0;
+}
 
+/* Helper to release what janus_duktape_init created, when it fails after
+ * the scheduler threads were launched or the script initialized */
+static void janus_duktape_init_cleanup(void) {
+	janus_mutex_lock(&callbacks_mutex);
+	g_hash_table_destroy(callbacks);
+	callbacks = NULL;
+	janus_mutex_unlock(&callbacks_mutex);
+	janus_mutex_lock(&duktape_sessions_mutex);
+	g_hash_table_destroy(duktape_sessions);
+	duktape_sessions = NULL;
+	g_hash_table_destroy(duktape_ids);
+	duktape_ids = NULL;
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	janus_duktape_heaps_close();
+}
+
+/* Helper to create a new Duktape heap, and load the script in it */
+static int janus_duktape_heap_setup(janus_duktape_heap *heap, const char *buf, size_t len, const char *duktape_file) {
 	/* Initialize Duktape */
-	duktape_ctx = duk_create_heap_default();
+	duk_context *duktape_ctx = duk_create_heap_default();
 	if(duktape_ctx == NULL) {
 		JANUS_LOG(LOG_ERR, "Error creating Duktape heap...\n");
-		g_free(duktape_folder);
 		return -1;
 	}
+	/* Keep track of the heap this context belongs to */
+	duk_push_heap_stash(duktape_ctx);
+	duk_push_pointer(duktape_ctx, heap);
+	duk_put_prop_string(duktape_ctx, -2, "janusHeap");
+	duk_pop(duktape_ctx);
 	duk_console_init(duktape_ctx, DUK_CONSOLE_PROXY_WRAPPER);
 	duk_module_duktape_init(duktape_ctx);
 
@@ -1569,6 +1965,14 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	duk_put_global_string(duktape_ctx, "setSubstream");
 	duk_push_c_function(duktape_ctx, janus_duktape_method_settemporallayer, 2);
 	duk_put_global_string(duktape_ctx, "setTemporalLayer");
+	duk_push_c_function(duktape_ctx, janus_duktape_method_setspatiallayer, 2);
+	duk_put_global_string(duktape_ctx, "setSpatialLayer");
+	duk_push_c_function(duktape_ctx, janus_duktape_method_setsvc, 2);
+	duk_put_global_string(duktape_ctx, "setSvc");
+	duk_push_c_function(duktape_ctx, janus_duktape_method_setmediaroute, 3);
+	duk_put_global_string(duktape_ctx, "setMediaRoute");
+	duk_push_c_function(duktape_ctx, janus_duktape_method_setmediastats, 2);
+	duk_put_global_string(duktape_ctx, "setMediaStats");
 	duk_push_c_function(duktape_ctx, janus_duktape_method_sendpli, 1);
 	duk_put_global_string(duktape_ctx, "sendPli");
 	duk_push_c_function(duktape_ctx, janus_duktape_method_relayrtp, 4);
@@ -1590,11 +1994,88 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	/* Register all extra functions, if any were added */
 	janus_duktape_register_extra_functions(duktape_ctx);
 
-	/* Now load the script (FIXME badly) */
+	duk_push_lstring(duktape_ctx, buf, (duk_size_t)len);
+	if(duk_peval(duktape_ctx) != 0) {
+		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(duktape_ctx, -1));
+		duk_destroy_heap(duktape_ctx);
+		return -1;
+	}
+	duk_pop(duktape_ctx);
+	/* Make sure that all the functions we need are there */
+	uint i=0;
+	for(i=0; i<duktape_funcsize; i++) {
+		duk_get_global_string(duktape_ctx, duktape_functions[i]);
+		if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) == 0) {
+			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", duktape_functions[i], duktape_file);
+			duk_destroy_heap(duktape_ctx);
+			return -1;
+		}
+		duk_pop(duktape_ctx);
+	}
+	heap->ctx = duktape_ctx;
+	return 0;
+}
+
+int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
+	if(g_atomic_int_get(&duktape_stopping)) {
+		/* Still stopping from before */
+		return -1;
+	}
+	if(callback == NULL || config_path == NULL) {
+		/* Invalid arguments */
+		return -1;
+	}
+
+	/* Read configuration */
+	char filename[255];
+	g_snprintf(filename, 255, "%s/%s.jcfg", config_path, JANUS_DUKTAPE_PACKAGE);
+	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
+	janus_config *config = janus_config_parse(filename);
+	if(config == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't find .jcfg configuration file (%s), trying .cfg\n", JANUS_DUKTAPE_PACKAGE);
+		g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_DUKTAPE_PACKAGE);
+		JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
+		config = janus_config_parse(filename);
+	}
+	if(config == NULL) {
+		/* No config means no JS script */
+		JANUS_LOG(LOG_ERR, "Failed to load configuration file for Duktape plugin...\n");
+		return -1;
+	}
+	janus_config_print(config);
+	janus_config_category *config_general = janus_config_get_create(config, NULL, janus_config_type_category, "general");
+	janus_config_item *folder = janus_config_get(config, config_general, janus_config_type_item, "path");
+	if(folder && folder->value)
+		duktape_folder = g_strdup(folder->value);
+	janus_config_item *script = janus_config_get(config, config_general, janus_config_type_item, "script");
+	if(script == NULL || script->value == NULL) {
+		JANUS_LOG(LOG_ERR, "Missing script path in Duktape plugin configuration...\n");
+		janus_config_destroy(config);
+		g_free(duktape_folder);
+		return -1;
+	}
+	char *duktape_file = g_strdup(script->value);
+	char *duktape_config = NULL;
+	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
+	if(conf && conf->value)
+		duktape_config = g_strdup(conf->value);
+	duktape_heaps_num = 1;
+	janus_config_item *heaps = janus_config_get(config, config_general, janus_config_type_item, "heaps");
+	if(heaps && heaps->value) {
+		int num = atoi(heaps->value);
+		if(num < 1 || num > JANUS_DUKTAPE_MAX_HEAPS) {
+			JANUS_LOG(LOG_WARN, "Invalid number of Duktape heaps (%s), using %d instead\n", heaps->value,
+				num < 1 ? 1 : JANUS_DUKTAPE_MAX_HEAPS);
+			num = num < 1 ? 1 : JANUS_DUKTAPE_MAX_HEAPS;
+		}
+		duktape_heaps_num = num;
+	}
+	janus_config_destroy(config);
+
+	/* Now read the script (FIXME badly) */
 	FILE *f = fopen(duktape_file, "rb");
 	if(f == NULL) {
 		JANUS_LOG(LOG_ERR, "Error loading JS script %s: no such file\n", duktape_file);
-		duk_destroy_heap(duktape_ctx);
 		g_free(duktape_folder);
 		g_free(duktape_file);
 		return -1;
@@ -1604,7 +2085,6 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	if(fs < 1) {
 		JANUS_LOG(LOG_ERR, "Error loading JS script %s: empty file\n", duktape_file);
 		fclose(f);
-		duk_destroy_heap(duktape_ctx);
 		g_free(duktape_folder);
 		g_free(duktape_file);
 		return -1;
@@ -1616,34 +2096,39 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Error reading JS script %s: %s\n", duktape_file, g_strerror(errno));
 		g_free(buf);
 		fclose(f);
-		duk_destroy_heap(duktape_ctx);
 		g_free(duktape_folder);
 		g_free(duktape_file);
 		return -1;
 	}
 	fclose(f);
-	duk_push_lstring(duktape_ctx, (const char *)buf, (duk_size_t)len);
-	g_free(buf);
-	if(duk_peval(duktape_ctx) != 0) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(duktape_ctx, -1));
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
-	}
-	duk_pop(duktape_ctx);
-	/* Make sure that all the functions we need are there */
-	uint i=0;
-	for(i=0; i<duktape_funcsize; i++) {
-		duk_get_global_string(duktape_ctx, duktape_functions[i]);
-		if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) == 0) {
-			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", duktape_functions[i], duktape_file);
-			duk_destroy_heap(duktape_ctx);
+	/* Initialize the Duktape heaps: each heap loads its own copy of the script */
+	duktape_heaps = g_malloc0(duktape_heaps_num * sizeof(janus_duktape_heap));
+	guint i = 0;
+	for(i=0; i<duktape_heaps_num; i++) {
+		janus_duktape_heap *heap = &duktape_heaps[i];
+		heap->id = i;
+		if(i == 0) {
+			heap->mutex = &duktape_mutex;
+		} else {
+			janus_mutex_init(&heap->lock);
+			heap->mutex = &heap->lock;
+		}
+		/* The loop must exist before the script is loaded, as top level code
+		 * may already call pokeScheduler() or timeCallback() */
+		heap->context = g_main_context_new();
+		heap->loop = g_main_loop_new(heap->context, FALSE);
+		if(janus_duktape_heap_setup(heap, buf, len, duktape_file) < 0) {
+			janus_duktape_heaps_close();
+			g_free(buf);
 			g_free(duktape_folder);
 			g_free(duktape_file);
 			return -1;
 		}
 	}
+	g_free(buf);
+	duktape_ctx = duktape_heaps[0].ctx;
+	if(duktape_heaps_num > 1)
+		JANUS_LOG(LOG_INFO, "Loaded the JS script in %u different heaps\n", duktape_heaps_num);
 	/* Some JS functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with JavaScript only dictating
 	 * the logic, or those overriding the plugin namespace and versioning information */
@@ -1698,64 +2183,62 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	duk_get_global_string(duktape_ctx, "temporalLayerChanged");
 	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
 		has_temporal_changed = TRUE;
+	duk_get_global_string(duktape_ctx, "mediaStats");
+	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+		has_media_stats = TRUE;
 
 	duktape_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_duktape_session_destroy);
 	duktape_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
 	callbacks = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_duktape_callback_free);
 
 	g_atomic_int_set(&duktape_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* This is the callback we'll need to invoke to contact the Janus core */
+	duktape_janus_core = callback;
+
+	/* Init the JS script in all heaps, in case it's needed */
+	for(i=0; i<duktape_heaps_num; i++) {
+		janus_mutex_lock(duktape_heaps[i].mutex);
+		duk_context *ctx = duktape_heaps[i].ctx;
+		duk_get_global_string(ctx, "init");
+		duk_push_string(ctx, duktape_config);
+		int res = duk_pcall(ctx, 1);
+		if(res != DUK_EXEC_SUCCESS) {
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(ctx, -1));
+			duk_pop(ctx);
+			janus_mutex_unlock(duktape_heaps[i].mutex);
+			g_atomic_int_set(&duktape_initialized, 0);
+			janus_duktape_init_cleanup();
+			g_free(duktape_folder);
+			g_free(duktape_file);
+			g_free(duktape_config);
+			return -1;
+		}
+		duk_pop(ctx);
+		janus_mutex_unlock(duktape_heaps[i].mutex);
+	}
+
+	/* Launch the scheduler threads (which will be responsible for resuming
+	 * asynchronous coroutines and for scheduling timed callbacks): we only
+	 * do that now that all heaps have been initialized, so that a failure
+	 * above never needs to stop a loop that may not be running yet */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("duktape scheduler", janus_duktape_scheduler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape scheduler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		g_free(duktape_config);
-		return -1;
+	char tname[16];
+	for(i=0; i<duktape_heaps_num; i++) {
+		if(duktape_heaps_num == 1)
+			g_snprintf(tname, sizeof(tname), "duktape sched");
+		else
+			g_snprintf(tname, sizeof(tname), "duktape sched %u", i);
+		duktape_heaps[i].thread = g_thread_try_new(tname, janus_duktape_scheduler, &duktape_heaps[i], &error);
+		if(error != NULL)
+			break;
 	}
-	/* Launch the timer loop thread (which will be responsible for scheduling timed callbacks) */
-	timer_context = g_main_context_new();
-	timer_loop = g_main_loop_new(timer_context, FALSE);
-	timer_thread = g_thread_try_new("duktape timer", janus_duktape_timer, timer_loop, &error);
 	if(error != NULL) {
 		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape timer loop thread...\n",
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape scheduler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
-		if(timer_loop != NULL)
-			g_main_loop_unref(timer_loop);
-		if(timer_context != NULL)
-			g_main_context_unref(timer_context);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		g_free(duktape_config);
-		return -1;
-	}
-
-	/* This is the callback we'll need to invoke to contact the Janus core */
-	duktape_janus_core = callback;
-
-	/* Init the JS script, in case it's needed */
-	duk_get_global_string(duktape_ctx, "init");
-	duk_push_string(duktape_ctx, duktape_config);
-	int res = duk_pcall(duktape_ctx, 1);
-	if(res != DUK_EXEC_SUCCESS) {
-		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-		duk_pop(duktape_ctx);
-		if(timer_loop != NULL)
-			g_main_loop_unref(timer_loop);
-		if(timer_context != NULL)
-			g_main_context_unref(timer_context);
-		duk_destroy_heap(duktape_ctx);
+		janus_duktape_init_cleanup();
 		g_free(duktape_folder);
 		g_free(duktape_file);
 		g_free(duktape_config);
@@ -1774,51 +2257,43 @@ void janus_duktape_destroy(void) {
 		return;
 	g_atomic_int_set(&duktape_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_duktape_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
-	}
-	if(timer_loop != NULL)
-		g_main_loop_quit(timer_loop);
-	if(timer_thread != NULL) {
-		g_thread_join(timer_thread);
-		timer_thread = NULL;
-	}
-	if(timer_loop != NULL) {
-		g_main_loop_unref(timer_loop);
-		timer_loop = NULL;
+	/* Stop the scheduler threads */
+	guint i = 0;
+	for(i=0; i<duktape_heaps_num; i++) {
+		if(duktape_heaps[i].thread != NULL)
+			janus_duktape_heap_quit(&duktape_heaps[i]);
 	}
-	if(timer_context != NULL) {
-		g_main_context_unref(timer_context);
-		timer_context = NULL;
+	for(i=0; i<duktape_heaps_num; i++) {
+		if(duktape_heaps[i].thread != NULL) {
+			g_thread_join(duktape_heaps[i].thread);
+			duktape_heaps[i].thread = NULL;
+		}
 	}
 
-	/* Deinit the JS script, in case it's needed */
-	janus_mutex_lock(&duktape_mutex);
-	duk_get_global_string(duktape_ctx, "destroy");
-	int res = duk_pcall(duktape_ctx, 0);
-	if(res != DUK_EXEC_SUCCESS) {
-		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-		duk_pop(duktape_ctx);
+	/* Deinit the JS script in all heaps, in case it's needed */
+	for(i=0; i<duktape_heaps_num; i++) {
+		janus_mutex_lock(duktape_heaps[i].mutex);
+		duk_context *ctx = duktape_heaps[i].ctx;
+		duk_get_global_string(ctx, "destroy");
+		int res = duk_pcall(ctx, 0);
+		if(res != DUK_EXEC_SUCCESS)
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(ctx, -1));
+		duk_pop(ctx);
+		janus_mutex_unlock(duktape_heaps[i].mutex);
 	}
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_destroy(callbacks);
 	callbacks = NULL;
-	janus_mutex_unlock(&duktape_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
 
 	janus_mutex_lock(&duktape_sessions_mutex);
 	g_hash_table_destroy(duktape_sessions);
 	duktape_sessions = NULL;
 	g_hash_table_destroy(duktape_ids);
 	duktape_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
-	janus_mutex_lock(&duktape_mutex);
-	duk_destroy_heap(duktape_ctx);
-	duktape_ctx = NULL;
-	janus_mutex_unlock(&duktape_mutex);
+	janus_duktape_heaps_close();
 
 	g_free(duktape_script_version_string);
 	g_free(duktape_script_description);
@@ -2066,21 +2541,28 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 	session->sim_context.substream_target = 2;
 	session->sim_context.templayer_target = 2;
 	janus_vp8_simulcast_context_reset(&session->vp8_context);
+	janus_rtp_svc_context_reset(&session->svc_context);
+	session->svc_context.spatial_target = 2;
+	session->svc_context.temporal_target = 2;
 	session->rid_extmap_id = -1;
 	janus_mutex_init(&session->rid_mutex);
 	session->vcodec = JANUS_VIDEOCODEC_NONE;
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
 	janus_refcount_init(&session->ref, janus_duktape_session_free);
+	/* Pin the session to a heap (IDs are random, so we use them as a hash): it will always be served by that one */
+	session->heap = &duktape_heaps[id % duktape_heaps_num];
+	g_atomic_int_inc(&session->heap->sessions);
 	handle->plugin_handle = session;
 	g_hash_table_insert(duktape_sessions, handle, session);
 	g_hash_table_insert(duktape_ids, GUINT_TO_POINTER(session->id), session);
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = session->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, "createSession");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2089,8 +2571,8 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
 
 	return;
 }
@@ -2114,9 +2596,10 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = session->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, "destroySession");
 	duk_push_number(t, id);
 	int res = duk_pcall(t, 1);
@@ -2125,8 +2608,8 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -2143,6 +2626,7 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 
 	/* Finally, remove from the hashtable */
 	janus_mutex_lock(&duktape_sessions_mutex);
+	g_atomic_int_add(&heap->sessions, -1);
 	g_hash_table_remove(duktape_sessions, handle);
 	janus_mutex_unlock(&duktape_sessions_mutex);
 	janus_refcount_decrease(&session->ref);
@@ -2164,9 +2648,10 @@ json_t *janus_duktape_query_session(janus_plugin_session *handle) {
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&duktape_sessions_mutex);
 	/* Ask the JS script for information on this session */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = session->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, "querySession");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2176,19 +2661,19 @@ json_t *janus_duktape_query_session(janus_plugin_session *handle) {
 		json_t *json = json_object();
 		json_object_set_new(json, "error", json_string(duk_safe_to_string(t, -1)));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
+		duk_pop(heap->ctx);
 		janus_refcount_decrease(&session->ref);
-		janus_mutex_unlock(&duktape_mutex);
+		janus_duktape_heap_unlock(heap, requested);
 		return json;
 	}
 	janus_refcount_decrease(&session->ref);
 	const char *info = duk_get_string(t, -1);
 	duk_pop(t);
-	duk_pop(duktape_ctx);
+	duk_pop(heap->ctx);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&duktape_mutex);
+	janus_duktape_heap_unlock(heap, requested);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
 		return NULL;
@@ -2253,9 +2738,10 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		json_decref(jsep);
 	}
 	/* Invoke the script function */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = session->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, "handleMessage");
 	duk_push_number(t, session->id);
 	duk_push_string(t, transaction);
@@ -2266,8 +2752,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		/* Something went wrong... */
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
 	}
 	janus_refcount_decrease(&session->ref);
@@ -2281,8 +2767,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		/* Either an error or an asynchronous response */
 		int res = (int)duk_get_number(t, 0);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		if(res < 0) {
 			/* We got an error */
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
@@ -2295,8 +2781,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
@@ -2305,13 +2791,41 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 	}
 	/* If we got here, we didn't get what we expect */
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
 	return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
 }
 
+/* Helper to report the load and callback latency of all heaps */
+static json_t *janus_duktape_heaps_summary(void) {
+	json_t *list = json_array();
+	guint i = 0;
+	for(i=0; i<duktape_heaps_num; i++) {
+		janus_duktape_heap *heap = &duktape_heaps[i];
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(heap->id));
+		json_object_set_new(info, "sessions", json_integer(g_atomic_int_get(&heap->sessions)));
+		janus_mutex_lock(heap->mutex);
+		json_object_set_new(info, "callbacks", json_integer(heap->calls));
+		json_object_set_new(info, "avg_wait", json_integer(heap->calls ? heap->wait_total/(gint64)heap->calls : 0));
+		json_object_set_new(info, "avg_exec", json_integer(heap->calls ? heap->exec_total/(gint64)heap->calls : 0));
+		json_object_set_new(info, "max_latency", json_integer(heap->latency_max));
+		janus_mutex_unlock(heap->mutex);
+		json_array_append_new(list, info);
+	}
+	json_t *response = json_object();
+	json_object_set_new(response, "heaps", list);
+	return response;
+}
+
 json_t *janus_duktape_handle_admin_message(json_t *message) {
-	if(!has_handle_admin_message || message == NULL)
+	if(message == NULL)
+		return NULL;
+	/* The "heaps" request is handled by the plugin itself, the rest is up to the script */
+	const char *request = json_string_value(json_object_get(message, "request"));
+	if(request && !strcasecmp(request, "heaps") && g_atomic_int_get(&duktape_initialized))
+		return janus_duktape_heaps_summary();
+	if(!has_handle_admin_message)
 		return NULL;
 	char *message_text = json_dumps(message, JSON_INDENT(0) | JSON_PRESERVE_ORDER);
 	if(message_text == NULL) {
@@ -2371,9 +2885,10 @@ void janus_duktape_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = session->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, "setupMedia");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2382,8 +2897,8 @@ void janus_duktape_setup_media(janus_plugin_session *handle) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2401,11 +2916,13 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 	char *buf = rtp_packet->buffer;
 	uint16_t len = rtp_packet->length;
 	/* Check if the JS script wants to handle/manipulate RTP packets itself */
-	if(has_incoming_rtp) {
+	int route = g_atomic_int_get(&session->route[video ? 1 : 0]);
+	if(route == janus_duktape_route_script && has_incoming_rtp) {
 		/* Yep, pass the data to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_heap *heap = session->heap;
+		gint64 requested = janus_duktape_heap_lock(heap);
+		duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+		duk_context *t = duk_get_context(heap->ctx, thr_idx);
 		duk_get_global_string(t, "incomingRtp");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, video);
@@ -2417,13 +2934,15 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		return;
 	}
 	/* Is this session allowed to send media? */
-	if((video && !session->send_video) || (!video && !session->send_audio))
+	if((video && !session->send_video) || (!video && !session->send_audio) || route == janus_duktape_route_drop) {
+		janus_duktape_media_stats_update(session, video, -1, len, TRUE);
 		return;
+	}
 	/* Handle the packet */
 	janus_rtp_header *rtp = (janus_rtp_header *)buf;
 	/* Check if we're simulcasting, and if so, keep track of the "layer" */
@@ -2455,6 +2974,7 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 			janus_mutex_unlock(&session->rid_mutex);
 		}
 	}
+	janus_duktape_media_stats_update(session, video, sc, len, FALSE);
 	/* Are we recording? */
 	if(!video || (session->ssrc[0] == 0 && session->rid[0] == NULL)) {
 		janus_recorder_save_frame(video ? session->vrc : session->arc, buf, len);
@@ -2476,22 +2996,38 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 			rtp->seq_number = htons(seq_number);
 		}
 	}
-	janus_duktape_rtp_relay_packet packet;
-	packet.sender = session;
-	packet.data = rtp;
-	packet.length = len;
-	packet.is_video = video;
-	packet.extensions = rtp_packet->extensions;
-	packet.ssrc[0] = (sc != -1 ? session->ssrc[0] : 0);
-	packet.ssrc[1] = (sc != -1 ? session->ssrc[1] : 0);
-	packet.ssrc[2] = (sc != -1 ? session->ssrc[2] : 0);
-	/* Backup the actual timestamp and sequence number set by the publisher, in case switching is involved */
-	packet.timestamp = ntohl(packet.data->timestamp);
-	packet.seq_number = ntohs(packet.data->seq_number);
-	/* Relay to all recipients */
-	janus_mutex_lock_nodebug(&session->recipients_mutex);
-	g_slist_foreach(session->recipients, janus_duktape_relay_rtp_packet, &packet);
-	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	if(route != janus_duktape_route_record) {
+		janus_duktape_rtp_relay_packet packet = { 0 };
+		packet.sender = session;
+		packet.data = rtp;
+		packet.length = len;
+		packet.is_video = video;
+		packet.extensions = rtp_packet->extensions;
+		packet.ssrc[0] = (sc != -1 ? session->ssrc[0] : 0);
+		packet.ssrc[1] = (sc != -1 ? session->ssrc[1] : 0);
+		packet.ssrc[2] = (sc != -1 ? session->ssrc[2] : 0);
+		if(video && session->svc) {
+			/* We're doing SVC: let's parse this packet to see which layers are there */
+			int plen = 0;
+			char *payload = janus_rtp_payload(buf, len, &plen);
+			if(payload == NULL)
+				return;
+			if(session->vcodec == JANUS_VIDEOCODEC_VP9) {
+				gboolean found = FALSE;
+				if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0)
+					packet.svc = found;
+			} else if(session->vcodec == JANUS_VIDEOCODEC_AV1) {
+				packet.svc = (rtp_packet->extensions.dd_len > 0);
+			}
+		}
+		/* Backup the actual timestamp and sequence number set by the publisher, in case switching is involved */
+		packet.timestamp = ntohl(packet.data->timestamp);
+		packet.seq_number = ntohs(packet.data->seq_number);
+		/* Relay to all recipients */
+		janus_mutex_lock_nodebug(&session->recipients_mutex);
+		g_slist_foreach(session->recipients, janus_duktape_relay_rtp_packet, &packet);
+		janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	}
 
 	/* Check if we need to send any PLI to this media source */
 	if(video && session->pli_freq > 0) {
@@ -2520,9 +3056,10 @@ void janus_duktape_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp
 	/* Check if the JS script wants to handle/manipulate RTCP packets itself */
 	if(has_incoming_rtcp) {
 		/* Yep, pass the data to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_heap *heap = session->heap;
+		gint64 requested = janus_duktape_heap_lock(heap);
+		duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+		duk_context *t = duk_get_context(heap->ctx, thr_idx);
 		duk_get_global_string(t, "incomingRtcp");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, video);
@@ -2534,18 +3071,19 @@ void janus_duktape_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		return;
 	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
-	uint32_t bitrate = janus_rtcp_get_remb(buf, len);
-	if(bitrate > 0) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(buf, len, &summary);
+	if(summary.remb > 0) {
 		/* No limit ~= 10000000 */
 		duktape_janus_core->send_remb(handle, session->bitrate ? session->bitrate : 10000000);
 	}
 	/* If there's an incoming PLI, instead, relay it to the source of the media if any */
-	if(janus_rtcp_has_pli(buf, len)) {
+	if(summary.pli) {
 		if(session->sender != NULL) {
 			janus_mutex_lock_nodebug(&session->sender->recipients_mutex);
 			/* Send a PLI */
@@ -2578,9 +3116,10 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 		/* Yep, pass the data to the JS script and return */
 		if(packet->binary && !has_incoming_text_data)
 			JANUS_LOG(LOG_WARN, "Missing 'incomingTextData', invoking deprecated function 'incomingData' instead\n");
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_heap *heap = session->heap;
+		gint64 requested = janus_duktape_heap_lock(heap);
+		duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+		duk_context *t = duk_get_context(heap->ctx, thr_idx);
 		duk_get_global_string(t, packet->binary ? "incomingBinaryData" : (has_incoming_text_data ? "incomingTextData" : "incomingData"));
 		duk_push_number(t, session->id);
 		/* We use a string for both text and binary data */
@@ -2594,8 +3133,8 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -2632,9 +3171,10 @@ void janus_duktape_data_ready(janus_plugin_session *handle) {
 	/* Check if the JS script wants to receive this event */
 	if(has_data_ready) {
 		/* Yep, pass the event to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_heap *heap = session->heap;
+		gint64 requested = janus_duktape_heap_lock(heap);
+		duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+		duk_context *t = duk_get_context(heap->ctx, thr_idx);
 		duk_get_global_string(t, "dataReady");
 		duk_push_number(t, session->id);
 		int res = duk_pcall(t, 1);
@@ -2643,8 +3183,8 @@ void janus_duktape_data_ready(janus_plugin_session *handle) {
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 		return;
 	}
 }
@@ -2666,9 +3206,10 @@ void janus_duktape_slow_link(janus_plugin_session *handle, int mindex, gboolean
 	janus_refcount_increase(&session->ref);
 	if(has_slow_link) {
 		/* Notify the JS script */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_heap *heap = session->heap;
+		gint64 requested = janus_duktape_heap_lock(heap);
+		duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+		duk_context *t = duk_get_context(heap->ctx, thr_idx);
 		duk_get_global_string(t, "slowLink");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, uplink);
@@ -2679,8 +3220,8 @@ void janus_duktape_slow_link(janus_plugin_session *handle, int mindex, gboolean
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(heap->ctx);
+		janus_duktape_heap_unlock(heap, requested);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -2726,6 +3267,14 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 	session->sim_context.substream_target = 2;
 	session->sim_context.templayer_target = 2;
 	janus_vp8_simulcast_context_reset(&session->vp8_context);
+	session->svc = FALSE;
+	janus_rtp_svc_context_reset(&session->svc_context);
+	session->svc_context.spatial_target = 2;
+	session->svc_context.temporal_target = 2;
+	g_atomic_int_set(&session->route[0], janus_duktape_route_script);
+	g_atomic_int_set(&session->route[1], janus_duktape_route_script);
+	g_atomic_int_set(&session->stats_period, 0);
+	janus_duktape_media_stats_reset(session);
 	session->vcodec = JANUS_VIDEOCODEC_NONE;
 	janus_rtp_simulcasting_cleanup(&session->rid_extmap_id, session->ssrc, session->rid, &session->rid_mutex);
 
@@ -2741,9 +3290,10 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = session->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, "hangupMedia");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2752,8 +3302,8 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2775,7 +3325,65 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 		/* Nope, don't relay */
 		return;
 	}
-	if(packet->ssrc[0] != 0) {
+	if(packet->svc) {
+		/* Handle SVC: don't relay if it's not the layer we wanted to handle */
+		gboolean relay = janus_rtp_svc_context_process_rtp(&session->svc_context,
+			(char *)packet->data, packet->length, packet->extensions.dd_content, packet->extensions.dd_len,
+			sender->vcodec, &packet->svc_info, &session->vrtpctx);
+		if(session->svc_context.need_pli && sender->handle) {
+			/* Send a PLI */
+			JANUS_LOG(LOG_VERB, "We need a PLI for the SVC context\n");
+			duktape_janus_core->send_pli(sender->handle);
+		}
+		/* Do we need to drop this? */
+		if(!relay)
+			return;
+		/* Any event we should notify? For SVC, the substream is the spatial layer */
+		if(session->svc_context.changed_spatial && has_substream_changed) {
+			janus_duktape_heap *heap = session->heap;
+			gint64 requested = janus_duktape_heap_lock(heap);
+			duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+			duk_context *t = duk_get_context(heap->ctx, thr_idx);
+			duk_get_global_string(t, "substreamChanged");
+			duk_push_number(t, session->id);
+			duk_push_number(t, session->svc_context.spatial);
+			int res = duk_pcall(t, 2);
+			if(res != DUK_EXEC_SUCCESS) {
+				/* Something went wrong... */
+				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
+			}
+			duk_pop(t);
+			duk_pop(heap->ctx);
+			janus_duktape_heap_unlock(heap, requested);
+		}
+		if(session->svc_context.changed_temporal && has_temporal_changed) {
+			janus_duktape_heap *heap = session->heap;
+			gint64 requested = janus_duktape_heap_lock(heap);
+			duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+			duk_context *t = duk_get_context(heap->ctx, thr_idx);
+			duk_get_global_string(t, "temporalLayerChanged");
+			duk_push_number(t, session->id);
+			duk_push_number(t, session->svc_context.temporal);
+			int res = duk_pcall(t, 2);
+			if(res != DUK_EXEC_SUCCESS) {
+				/* Something went wrong... */
+				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
+			}
+			duk_pop(t);
+			duk_pop(heap->ctx);
+			janus_duktape_heap_unlock(heap, requested);
+		}
+		/* If we got here, update the RTP header and send the packet */
+		janus_rtp_header_update(packet->data, &session->vrtpctx, TRUE, 0);
+		if(duktape_janus_core != NULL) {
+			janus_plugin_rtp rtp = { .mindex = -1, .video = packet->is_video,
+				.buffer = (char *)packet->data, .length = packet->length, .extensions = packet->extensions };
+			duktape_janus_core->relay_rtp(session->handle, &rtp);
+		}
+		/* Restore the timestamp and sequence number to what the publisher set them to */
+		packet->data->timestamp = htonl(packet->timestamp);
+		packet->data->seq_number = htons(packet->seq_number);
+	} else if(packet->ssrc[0] != 0) {
 		/* Handle simulcast: make sure we have a payload to work with */
 		int plen = 0;
 		char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
@@ -2797,9 +3405,10 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 		if(session->sim_context.changed_substream) {
 			/* Notify the script about the substream change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&duktape_mutex);
-				duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-				duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+				janus_duktape_heap *heap = session->heap;
+				gint64 requested = janus_duktape_heap_lock(heap);
+				duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+				duk_context *t = duk_get_context(heap->ctx, thr_idx);
 				duk_get_global_string(t, "substreamChanged");
 				duk_push_number(t, session->id);
 				duk_push_number(t, session->sim_context.substream);
@@ -2809,16 +3418,17 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 					JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 				}
 				duk_pop(t);
-				duk_pop(duktape_ctx);
-				janus_mutex_unlock(&duktape_mutex);
+				duk_pop(heap->ctx);
+				janus_duktape_heap_unlock(heap, requested);
 			}
 		}
 		if(session->sim_context.changed_temporal) {
 			/* Notify the user about the temporal layer change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&duktape_mutex);
-				duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-				duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+				janus_duktape_heap *heap = session->heap;
+				gint64 requested = janus_duktape_heap_lock(heap);
+				duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+				duk_context *t = duk_get_context(heap->ctx, thr_idx);
 				duk_get_global_string(t, "temporalLayerChanged");
 				duk_push_number(t, session->id);
 				duk_push_number(t, session->sim_context.templayer);
@@ -2828,8 +3438,8 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 					JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 				}
 				duk_pop(t);
-				duk_pop(duktape_ctx);
-				janus_mutex_unlock(&duktape_mutex);
+				duk_pop(heap->ctx);
+				janus_duktape_heap_unlock(heap, requested);
 			}
 		}
 		/* If we got here, update the RTP header and send the packet */
@@ -2899,47 +3509,61 @@ static void janus_duktape_relay_data_packet(gpointer data, gpointer user_data) {
 }
 
 /* This is a scheduler thread: if we know there are coroutines to resume in
- * JavaScript (e.g., for asynchronous requests), we do that ourselves here */
+ * JavaScript (e.g., for asynchronous requests), we do that ourselves here.
+ * Each heap has its own, which is also used for timing callbacks, e.g.,
+ * whenever the JS script asks for asynchronously invoking one of its methods
+ * after some time, rather than immediately. */
 static void *janus_duktape_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Duktape scheduler thread\n");
-	janus_duktape_event *event = NULL;
-	/* Wait until there are events to process */
-	while(g_atomic_int_get(&duktape_initialized) && !g_atomic_int_get(&duktape_stopping)) {
-		event = g_async_queue_pop(events);
-		if(event == GUINT_TO_POINTER(janus_duktape_event_exit))
-			break;
-		if(event == GUINT_TO_POINTER(janus_duktape_event_resume)) {
-			/* There are coroutines to resume */
-			janus_mutex_lock(&duktape_mutex);
-			duk_get_global_string(duktape_ctx, "resumeScheduler");
-			int res = duk_pcall(duktape_ctx, 0);
-			if(res != DUK_EXEC_SUCCESS) {
-				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-			}
-			duk_pop(duktape_ctx);
-			/* Print the count of elements into Duktape stack */
-			janus_duktape_stackdump(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
-		}
-	}
-	JANUS_LOG(LOG_VERB, "Leaving Duktape scheduler thread\n");
-	return NULL;
-}
-
-/* This is a loop that can be used for timing callbacks, e.g., whenever
- * the JS script asks for asynchronously invoking one of its methods
- * after some time, rather than immediately (which is what the scheduler
- * would be for instead). Allows for a string parameter to be passed. */
-static void *janus_duktape_timer(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Duktape timer loop\n");
-	GMainLoop *loop = (GMainLoop *)data;
+	janus_duktape_heap *heap = (janus_duktape_heap *)data;
+	JANUS_LOG(LOG_VERB, "Joining Duktape scheduler thread (heap #%u)\n", heap->id);
 	/* Start loop */
-	g_main_loop_run(loop);
+	g_main_loop_run(heap->loop);
 	/* Done */
-	JANUS_LOG(LOG_VERB, "Leaving Duktape timer loop\n");
+	JANUS_LOG(LOG_VERB, "Leaving Duktape scheduler thread (heap #%u)\n", heap->id);
 	return NULL;
 }
 
+/* Callback to resume coroutines, after a pokeScheduler() */
+static gboolean janus_duktape_resume_cb(void *data) {
+	janus_duktape_heap *heap = (janus_duktape_heap *)data;
+	if(heap == NULL || !g_atomic_int_get(&duktape_initialized) || g_atomic_int_get(&duktape_stopping))
+		return G_SOURCE_REMOVE;
+	/* There are coroutines to resume */
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_get_global_string(heap->ctx, "resumeScheduler");
+	int res = duk_pcall(heap->ctx, 0);
+	if(res != DUK_EXEC_SUCCESS) {
+		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(heap->ctx, -1));
+	}
+	duk_pop(heap->ctx);
+	/* Print the count of elements into Duktape stack */
+	janus_duktape_stackdump(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
+	return G_SOURCE_REMOVE;
+}
+
+/* Callback to pass a media stats summary to the script, after a janus_duktape_media_stats_update() */
+static gboolean janus_duktape_media_stats_cb(void *data) {
+	janus_duktape_media_stats_event *event = (janus_duktape_media_stats_event *)data;
+	if(event == NULL || !g_atomic_int_get(&duktape_initialized) || g_atomic_int_get(&duktape_stopping))
+		return G_SOURCE_REMOVE;
+	janus_duktape_heap *heap = event->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
+	duk_get_global_string(t, "mediaStats");
+	duk_push_number(t, event->session);
+	duk_push_string(t, event->stats);
+	int res = duk_pcall(t, 2);
+	if(res != DUK_EXEC_SUCCESS) {
+		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
+	}
+	duk_pop(t);
+	duk_pop(heap->ctx);
+	janus_duktape_heap_unlock(heap, requested);
+	return G_SOURCE_REMOVE;
+}
+
 /* Callback to trigger timed callbacks */
 static gboolean janus_duktape_timer_cb(void *data) {
 	janus_duktape_callback *cb = (janus_duktape_callback *)data;
@@ -2947,9 +3571,10 @@ static gboolean janus_duktape_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_VERB, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_heap *heap = cb->heap;
+	gint64 requested = janus_duktape_heap_lock(heap);
+	duk_idx_t thr_idx = duk_push_thread(heap->ctx);
+	duk_context *t = duk_get_context(heap->ctx, thr_idx);
 	duk_get_global_string(t, cb->function);
 	if(cb->argument) {
 		duk_push_string(t, cb->argument);
@@ -2959,9 +3584,11 @@ static gboolean janus_duktape_timer_cb(void *data) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
+	duk_pop(heap->ctx);
 	/* Done */
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_remove(callbacks, cb);
-	janus_mutex_unlock(&duktape_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
+	janus_duktape_heap_unlock(heap, requested);
 	return FALSE;
 }
@@ -43,10 +43,51 @@
 extern volatile gint duktape_initialized, duktape_stopping;
 extern janus_callbacks *duktape_janus_core;
 
-/* Duktape context: we define context and mutex as extern */
+/* Duktape heaps: the script can be loaded in more than one heap, and each
+ * session is pinned to one of them; each heap has its own lock and its own
+ * scheduler thread, so that sessions pinned to different heaps can be served
+ * in parallel. The first heap also handles all the requests that are not
+ * session specific */
+typedef struct janus_duktape_heap {
+	guint id;							/* Index of this heap */
+	duk_context *ctx;					/* The Duktape context of this heap */
+	janus_mutex *mutex;					/* Mutex to lock the heap (the first heap uses duktape_mutex) */
+	janus_mutex lock;					/* Mutex storage for all the other heaps */
+	GMainContext *context;				/* Context of the scheduler loop of this heap */
+	GMainLoop *loop;					/* Scheduler loop (resumeScheduler calls and timed callbacks) */
+	GThread *thread;					/* Thread running the scheduler loop */
+	volatile gint sessions;				/* Number of sessions pinned to this heap */
+	/* Callback latency statistics, updated with the heap locked */
+	gint64 locked;						/* When the heap was last locked */
+	guint64 calls;						/* Number of callbacks invoked in this heap */
+	gint64 wait_total;					/* Total time spent waiting for the heap lock (us) */
+	gint64 exec_total;					/* Total time spent executing callbacks (us) */
+	gint64 latency_max;					/* Maximum latency (waiting plus executing) of a callback (us) */
+} janus_duktape_heap;
+extern janus_duktape_heap *duktape_heaps;
+extern guint duktape_heaps_num;
+janus_duktape_heap *janus_duktape_heap_get(duk_context *ctx);
+
+/* Duktape context: we define context and mutex as extern (they refer to the first heap) */
 extern duk_context *duktape_ctx;
 extern janus_mutex duktape_mutex;
 
+/* Native media routing: what the C code should do with incoming RTP packets
+ * for a medium, without entering the JavaScript script (see setMediaRoute()) */
+typedef enum janus_duktape_route {
+	janus_duktape_route_script = 0,		/* Pass packets to incomingRtp(), if the script implements it (default) */
+	janus_duktape_route_forward,		/* Record (if recording) and relay to recipients in C */
+	janus_duktape_route_record,			/* Only record (if recording), don't relay */
+	janus_duktape_route_drop			/* Drop packets */
+} janus_duktape_route;
+/* Per-medium counters for the sampled stats sent to mediaStats() */
+typedef struct janus_duktape_media_stats {
+	guint32 packets;					/* Packets received in the current period */
+	guint64 bytes;						/* Bytes received in the current period */
+	guint32 dropped;					/* Packets dropped because of the route */
+	guint32 layers[3];					/* Packets received per simulcast substream (video only) */
+} janus_duktape_media_stats;
+
 /* Duktape session: we keep only the barebone stuff here, the rest will be in the JavaScript script */
 typedef struct janus_duktape_session {
 	janus_plugin_session *handle;		/* Pointer to the core-plugin session */
@@ -67,6 +108,12 @@ typedef struct janus_duktape_session {
 	janus_mutex rid_mutex;				/* Mutex to protect access to the rid array and the extmap ID */
 	janus_rtp_simulcasting_context sim_context;
 	janus_vp8_simulcast_context vp8_context;
+	gboolean svc;						/* Whether the video this session sends uses SVC (VP9 or AV1) */
+	janus_rtp_svc_context svc_context;	/* SVC layer selection, when receiving from an SVC sender */
+	volatile gint route[2];				/* How incoming audio [0] and video [1] are handled (janus_duktape_route) */
+	volatile gint stats_period;			/* How often (seconds) to send mediaStats() to the script (0=disabled), set atomically */
+	gint64 stats_latest;				/* When the latest mediaStats() was sent */
+	janus_duktape_media_stats stats[2];	/* Audio [0] and video [1] counters for the current period */
 	uint32_t bitrate;					/* Bitrate limit */
 	uint16_t pli_freq;					/* Regular PLI frequency (0=disabled) */
 	gint64 pli_latest;					/* Time of latest sent PLI (to avoid flooding) */
@@ -84,6 +131,7 @@ typedef struct janus_duktape_session {
 	volatile gint dataready;			/* Whether the data channel was established on this sessions's PeerConnection */
 	volatile gint hangingup;			/* Whether this session's PeerConnection is hanging up */
 	volatile gint destroyed;			/* Whether this session's been marked as destroyed */
+	janus_duktape_heap *heap;			/* Duktape heap this session is pinned to */
 	/* If you need any additional property (e.g., for hooks you added in janus_duktape_extra.c) add them below this line */
 
 	/* Reference counter */
@@ -74,7 +74,10 @@
  * events on substream and/or temporal layer changes happening for
  * receiving sessions via the \c substreamChanged() and the
  * \c temporalLayerChanged() callbacks: this may be useful to track
- * which layer is actually being sent, vs. what was requested.
+ * which layer is actually being sent, vs. what was requested. Scripts
+ * that rely on native media routing (see \ref luarouting) can implement
+ * \c mediaStats() to receive periodic summaries of the media sessions
+ * are sending, instead of handling each packet in \c incomingRtp().
  *
  * \section capi C interfaces
  *
@@ -97,12 +100,21 @@
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
  * - \c setSubstream(): set the target simulcast substream;
- * - \c setTemporalLayer(): set the target simulcast temporal layer;
+ * - \c setTemporalLayer(): set the target simulcast (or SVC) temporal layer;
+ * - \c setSpatialLayer(): set the target SVC spatial layer;
+ * - \c setSvc(): specify whether the video a user sends uses SVC;
+ * - \c setMediaRoute(): specify how the C code should handle a user's audio or video;
+ * - \c setMediaStats(): specify how often \c mediaStats() should be invoked for a user;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
  * - \c pokeScheduler(): notify the C code that there's a coroutine to resume;
- * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds.
+ * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds;
+ * - \c getStateId(): get the ID of the Lua state the script is running in;
+ * - \c getStatesCount(): get the number of Lua states the script was loaded in;
+ * - \c postMessage(): asynchronously invoke a function in a different Lua state;
+ * - \c sharedSet(): set (or remove) a string value all Lua states can access;
+ * - \c sharedGet(): get a string value that was shared by any Lua state.
  *
  * As anticipated in the previous section, almost all these methods also
  * expect the unique session identifier to address a specific user in the
@@ -118,7 +130,8 @@
  * Lua scripts, you can leverage a scheduler implemented in the C code.
  *
  * More specifically, when the plugin starts a dedicated thread is devoted
- * to the only purpose of acting as a scheduler for Lua coroutines. This
+ * to the only purpose of acting as a scheduler for Lua coroutines (one
+ * per state, when \ref luastates are configured). This
  * means that, whenever this C scheduler is awaken, it will call the
  * \c resumeScheduler() function in the Lua script, thus allowing the
  * Lua script to execute one or more pending coroutines. The C scheduler
@@ -186,6 +199,87 @@ timeCallback("resumeScheduler", nil, 0)
  * Anyway, \c pokeScheduler() and \c resumeScheduler() is much more
  * compact and less verbose, and as such is preferred in cases where
  * timing and opaque arguments are not needed.
+ *
+ * \section luastates Multiple Lua states
+ *
+ * By default, the script is loaded in a single Lua state, which means
+ * that all requests and callbacks, for all sessions, are serialized on
+ * the same lock, and a Lua application can't use more than one core.
+ * Setting the \c states property in the plugin configuration to a value
+ * higher than 1 loads the script in that many independent Lua states
+ * instead, each with its own lock and its own coroutines scheduler
+ * thread. Sessions are bound to the least loaded state when they're
+ * created, and all the callbacks related to them (\c createSession(),
+ * \c handleMessage(), \c incomingRtp() and so on) are always invoked
+ * in that state, as are the \c resumeScheduler() calls that follow
+ * a \c pokeScheduler() and the functions scheduled via \c timeCallback().
+ * All states get \c init() and \c destroy() calls, while requests that
+ * are not related to a specific session (e.g., \c handleAdminMessage()
+ * or \c getVersion()) are always handled by the first state.
+ *
+ * Since states don't share any Lua global, scripts that need state to
+ * be shared among sessions (e.g., rooms in a conferencing application)
+ * must opt-in to that explicitly. The \c getStateId() and
+ * \c getStatesCount() functions can be used to know where the script
+ * is running, while \c sharedSet() and \c sharedGet() give access to
+ * a table of strings that is shared by all the states (a \c nil value
+ * removes the key). To notify other states about something, instead,
+ * \c postMessage() can be used: it expects the ID of the target state
+ * (or -1 to address all the other states), the name of the function to
+ * invoke and a string argument, and the function will be invoked by the
+ * scheduler of the target state with the argument and the ID of the
+ * sender state, e.g.:
+ *
+ * \verbatim
+-- Tell all the other states a room was created
+postMessage(-1, "roomCreated", "1234")
+-- Which will result in this being invoked in each of them
+function roomCreated(room, sender)
+	...
+end
+\endverbatim
+ *
+ * Media routing configured via \c addRecipient() and the other C hooks
+ * works across states, as sessions are addressed by their ID. Scripts
+ * that were not written with multiple states in mind (e.g., the
+ * \c videoroom.lua sample) should keep on using a single state.
+ *
+ * \section luarouting Native media routing
+ *
+ * As soon as a script implements \c incomingRtp(), every RTP packet the
+ * plugin receives is passed to the script, which means it needs to lock
+ * the Lua state the session is bound to: this is very expensive, and
+ * limits what a Lua application can do with media. To avoid that, scripts
+ * can tell the C code what to do with the media of a session via
+ * \c setMediaRoute(), which expects the session ID, the medium (\c "audio"
+ * or \c "video") and an action among the following:
+ *
+ * - \c "script": pass packets to \c incomingRtp() if the script
+ * implements it, and route them in C otherwise (the default);
+ * - \c "forward": record the packets, if a recording is in progress,
+ * and relay them to all the recipients added with \c addRecipient();
+ * - \c "record": only record the packets, if a recording is in progress;
+ * - \c "drop": drop all packets.
+ *
+ * All of this is done by the media thread of the session, without ever
+ * entering the Lua script. When forwarding simulcast or SVC video (for
+ * the latter, \c setSvc() must be called on the sender first), each
+ * recipient only gets the layers it asked for via \c setSubstream(),
+ * \c setSpatialLayer() and \c setTemporalLayer(), and layer changes
+ * are notified via \c substreamChanged() and \c temporalLayerChanged()
+ * (for SVC, the substream is the spatial layer). Since the script doesn't
+ * see packets anymore, \c setMediaStats() can be used to get a summary of
+ * what a session is sending every few seconds instead: the \c mediaStats()
+ * function is then invoked by the scheduler of the session state with the
+ * session ID and a JSON string, e.g.:
+ *
+ * \verbatim
+{
+	"period": 5000,
+	"audio": { "route": "forward", "packets": 250, "bytes": 24110, "bitrate": 38576, "dropped": 0 },
+	"video": { "route": "forward", "packets": 2170, "bytes": 2081433, "bitrate": 3330292, "dropped": 0, "substreams": [ 750, 710, 710 ] }
+}
+\endverbatim
  *
  * Refer to the \ref luapapi section for more information on how you
  * can register your own C functions.
@@ -272,6 +366,9 @@ janus_callbacks *lua_janus_core = NULL;
 /* Lua stuff */
 lua_State *lua_state = NULL;
 janus_mutex lua_mutex = JANUS_MUTEX_INITIALIZER;
+janus_lua_state *lua_states = NULL;
+guint lua_states_num = 0;
+#define JANUS_LUA_MAX_STATES	64
 static const char *lua_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -302,15 +399,32 @@ static gboolean has_data_ready = FALSE;
 static gboolean has_slow_link = FALSE;
 static gboolean has_substream_changed = FALSE;
 static gboolean has_temporal_changed = FALSE;
-/* Lua C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+static gboolean has_media_stats = FALSE;
+/* Lua C scheduler (for coroutines), one per state */
 static void *janus_lua_scheduler(void *data);
-static GAsyncQueue *events = NULL;
 typedef enum janus_lua_event {
 	janus_lua_event_none = 0,
 	janus_lua_event_resume,		/* Resume one or more pending coroutines */
 	janus_lua_event_exit		/* Break the scheduler loop */
 } janus_lua_event;
+/* Messages states can send each other via postMessage(), which are
+ * queued as events for the scheduler of the target state */
+typedef struct janus_lua_message {
+	guint sender;		/* ID of the state that sent the message */
+	guint32 session;	/* Session the message is about, if it comes from the C code (e.g., mediaStats) */
+	char *function;		/* Function to invoke in the target state */
+	char *argument;		/* Argument to pass to the function, if any */
+} janus_lua_message;
+static void janus_lua_message_free(janus_lua_message *msg) {
+	if(!msg)
+		return;
+	g_free(msg->function);
+	g_free(msg->argument);
+	g_free(msg);
+}
+/* Opt-in table of strings all states can share, via sharedSet() and sharedGet() */
+static GHashTable *shared_table = NULL;
+static janus_mutex shared_mutex = JANUS_MUTEX_INITIALIZER;
 /* Lua timer loop (for scheduled callbacks) */
 static GMainContext *timer_context = NULL;
 static GMainLoop *timer_loop = NULL;
@@ -321,10 +435,12 @@ typedef struct janus_lua_callback {
 	guint id;
 	uint32_t ms;
 	GSource *source;
+	janus_lua_state *lstate;
 	char *function;
 	char *argument;
 } janus_lua_callback;
 static GHashTable *callbacks = NULL;
+static janus_mutex callbacks_mutex = JANUS_MUTEX_INITIALIZER;
 static void janus_lua_callback_free(janus_lua_callback *cb) {
 	if(!cb)
 		return;
@@ -341,6 +457,16 @@ static void janus_lua_stackdump(lua_State* l) {
     JANUS_LOG(LOG_HUGE, "Total in lua stack %d\n", top);
 }
 
+/* Helper to find out which state in the pool a Lua state (or thread) belongs to */
+janus_lua_state *janus_lua_state_get(lua_State *s) {
+	if(s == NULL)
+		return NULL;
+	lua_getfield(s, LUA_REGISTRYINDEX, "janus_lua_state");
+	janus_lua_state *ls = (janus_lua_state *)lua_touserdata(s, -1);
+	lua_pop(s, 1);
+	return ls;
+}
+
 /* janus_lua_session is defined in janus_lua_data.h, but it's managed here */
 GHashTable *lua_sessions, *lua_ids;
 janus_mutex lua_sessions_mutex = JANUS_MUTEX_INITIALIZER;
@@ -378,12 +504,106 @@ typedef struct janus_lua_rtp_relay_packet {
 	uint32_t ssrc[3];
 	uint32_t timestamp;
 	uint16_t seq_number;
+	/* The following are only relevant for SVC */
+	gboolean svc;
+	janus_vp9_svc_info svc_info;
 	/* The following is only relevant for datachannels */
 	gboolean textdata;
 } janus_lua_rtp_relay_packet;
 static void janus_lua_relay_rtp_packet(gpointer data, gpointer user_data);
 static void janus_lua_relay_data_packet(gpointer data, gpointer user_data);
 
+/* Native media routing helpers */
+static int janus_lua_route_from_string(const char *action) {
+	if(action == NULL)
+		return -1;
+	if(!strcasecmp(action, "script"))
+		return janus_lua_route_script;
+	if(!strcasecmp(action, "forward"))
+		return janus_lua_route_forward;
+	if(!strcasecmp(action, "record"))
+		return janus_lua_route_record;
+	if(!strcasecmp(action, "drop"))
+		return janus_lua_route_drop;
+	return -1;
+}
+static const char *janus_lua_route_str(int route) {
+	switch(route) {
+		case janus_lua_route_script:
+			return "script";
+		case janus_lua_route_forward:
+			return "forward";
+		case janus_lua_route_record:
+			return "record";
+		case janus_lua_route_drop:
+			return "drop";
+		default:
+			break;
+	}
+	return NULL;
+}
+static void janus_lua_media_stats_reset(janus_lua_session *session) {
+	memset(&session->stats, 0, sizeof(session->stats));
+	session->stats_latest = 0;
+}
+/* Update the stats of a session with a new packet (invoked by the media
+ * thread), and if it's time, queue a summary to the scheduler of the state
+ * the session is bound to, which will invoke mediaStats() in the script */
+static void janus_lua_media_stats_update(janus_lua_session *session, gboolean video, int sc, int len, gboolean dropped) {
+	guint period = (guint)g_atomic_int_get(&session->stats_period);
+	if(!has_media_stats || period == 0)
+		return;
+	janus_lua_media_stats *ms = &session->stats[video ? 1 : 0];
+	ms->packets++;
+	ms->bytes += len;
+	if(dropped)
+		ms->dropped++;
+	else if(video && sc >= 0 && sc < 3)
+		ms->layers[sc]++;
+	gint64 now = janus_get_monotonic_time();
+	if(session->stats_latest == 0)
+		session->stats_latest = now;
+	gint64 elapsed = now - session->stats_latest;
+	if(elapsed < (gint64)period*G_USEC_PER_SEC)
+		return;
+	/* Prepare the summary */
+	json_t *stats = json_object();
+	json_object_set_new(stats, "period", json_integer(elapsed/1000));
+	int i = 0;
+	for(i=0; i<2; i++) {
+		ms = &session->stats[i];
+		if(ms->packets == 0)
+			continue;
+		json_t *medium = json_object();
+		json_object_set_new(medium, "route", json_string(janus_lua_route_str(g_atomic_int_get(&session->route[i]))));
+		json_object_set_new(medium, "packets", json_integer(ms->packets));
+		json_object_set_new(medium, "bytes", json_integer(ms->bytes));
+		json_object_set_new(medium, "bitrate", json_integer(ms->bytes*8*G_USEC_PER_SEC/elapsed));
+		json_object_set_new(medium, "dropped", json_integer(ms->dropped));
+		if(i == 1 && (ms->layers[1] > 0 || ms->layers[2] > 0)) {
+			json_t *layers = json_array();
+			json_array_append_new(layers, json_integer(ms->layers[0]));
+			json_array_append_new(layers, json_integer(ms->layers[1]));
+			json_array_append_new(layers, json_integer(ms->layers[2]));
+			json_object_set_new(medium, "substreams", layers);
+		}
+		json_object_set_new(stats, i ? "video" : "audio", medium);
+	}
+	janus_lua_media_stats_reset(session);
+	session->stats_latest = now;
+	char *text = json_dumps(stats, JSON_PRESERVE_ORDER);
+	json_decref(stats);
+	if(text == NULL)
+		return;
+	janus_lua_message *msg = g_malloc0(sizeof(janus_lua_message));
+	msg->sender = session->lstate->id;
+	msg->session = session->id;
+	msg->function = g_strdup("mediaStats");
+	msg->argument = g_strdup(text);
+	free(text);
+	g_async_queue_push(session->lstate->events, msg);
+}
+
 
 /* Helper struct to address outgoing notifications, e.g., involving PeerConnections */
 typedef enum janus_lua_async_event_type {
@@ -437,7 +657,12 @@ static int janus_lua_method_januslog(lua_State *s) {
 
 static int janus_lua_method_pokescheduler(lua_State *s) {
 	/* This method allows the Lua script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_resume));
+	janus_lua_state *ls = janus_lua_state_get(s);
+	if(ls == NULL) {
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	g_async_queue_push(ls->events, GUINT_TO_POINTER(janus_lua_event_resume));
 	lua_pushnumber(s, 0);
 	return 1;
 }
@@ -464,16 +689,109 @@ static int janus_lua_method_timecallback(lua_State *s) {
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
 	cb->ms = ms;
+	cb->lstate = janus_lua_state_get(s);
 	cb->source = g_timeout_source_new(ms);
 	g_source_set_callback(cb->source, janus_lua_timer_cb, cb, NULL);
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_insert(callbacks, cb, cb);
 	cb->id = g_source_attach(cb->source, timer_context);
+	janus_mutex_unlock(&callbacks_mutex);
 	JANUS_LOG(LOG_VERB, "Created scheduled callback (%"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
 	/* Done */
 	lua_pushnumber(s, 0);
 	return 1;
 }
 
+static int janus_lua_method_getstateid(lua_State *s) {
+	/* This method allows the Lua script to know which state in the pool it's running in */
+	janus_lua_state *ls = janus_lua_state_get(s);
+	lua_pushnumber(s, ls ? (int)ls->id : -1);
+	return 1;
+}
+
+static int janus_lua_method_getstatescount(lua_State *s) {
+	/* This method allows the Lua script to know how many states there are in the pool */
+	lua_pushnumber(s, lua_states_num);
+	return 1;
+}
+
+static int janus_lua_method_postmessage(lua_State *s) {
+	/* This method allows the Lua script to invoke a function in a different state, asynchronously */
+	int n = lua_gettop(s);
+	if(n != 3) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 3)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_lua_state *ls = janus_lua_state_get(s);
+	int target = lua_tonumber(s, 1);
+	const char *function = lua_tostring(s, 2);
+	const char *argument = lua_tostring(s, 3);
+	if(ls == NULL || function == NULL || target >= (int)lua_states_num) {
+		JANUS_LOG(LOG_ERR, "Invalid arguments (missing function name or invalid state)\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	/* A negative target means all states but this one */
+	guint i = 0;
+	for(i=0; i<lua_states_num; i++) {
+		if((target >= 0 && i != (guint)target) || (target < 0 && i == ls->id))
+			continue;
+		janus_lua_message *msg = g_malloc0(sizeof(janus_lua_message));
+		msg->sender = ls->id;
+		msg->function = g_strdup(function);
+		msg->argument = argument ? g_strdup(argument) : NULL;
+		g_async_queue_push(lua_states[i].events, msg);
+	}
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_sharedset(lua_State *s) {
+	/* This method allows the Lua script to set (or remove, if nil) a string all states can access */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	const char *value = lua_tostring(s, 2);
+	if(key == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid argument (missing key)\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_mutex_lock(&shared_mutex);
+	if(value == NULL)
+		g_hash_table_remove(shared_table, key);
+	else
+		g_hash_table_insert(shared_table, g_strdup(key), g_strdup(value));
+	janus_mutex_unlock(&shared_mutex);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_sharedget(lua_State *s) {
+	/* This method allows the Lua script to get a string that was shared by any state */
+	int n = lua_gettop(s);
+	if(n != 1) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 1)\n", n);
+		lua_pushnil(s);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	janus_mutex_lock(&shared_mutex);
+	const char *value = key ? g_hash_table_lookup(shared_table, key) : NULL;
+	/* Lua copies the string, so we can release the lock right after */
+	if(value != NULL)
+		lua_pushstring(s, value);
+	else
+		lua_pushnil(s);
+	janus_mutex_unlock(&shared_mutex);
+	return 1;
+}
+
 static int janus_lua_method_pushevent(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -924,8 +1242,137 @@ static int janus_lua_method_settemporallayer(lua_State *s) {
 	}
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&lua_sessions_mutex);
-	if(temporal <= 2)
+	if(temporal <= 2) {
 		session->sim_context.templayer_target = temporal;
+		session->svc_context.temporal_target = temporal;
+	}
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_setspatiallayer(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	guint16 spatial = lua_tonumber(s, 2);
+	/* Find the session */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	if(spatial <= 2)
+		session->svc_context.spatial_target = spatial;
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_setsvc(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	int svc = lua_toboolean(s, 2);
+	/* Find the session */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	session->svc = svc ? TRUE : FALSE;
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_setmediaroute(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 3) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 3)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	const char *medium = lua_tostring(s, 2);
+	const char *action = lua_tostring(s, 3);
+	int index = -1;
+	if(medium && !strcasecmp(medium, "audio"))
+		index = 0;
+	else if(medium && !strcasecmp(medium, "video"))
+		index = 1;
+	int route = janus_lua_route_from_string(action);
+	if(index < 0 || route < 0) {
+		JANUS_LOG(LOG_ERR, "Invalid media route (%s, %s)\n", medium, action);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	/* Find the session */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	g_atomic_int_set(&session->route[index], route);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_setmediastats(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	lua_Number value = lua_tonumber(s, 2);
+	if(!(value >= 0 && value <= G_MAXUINT16)) {
+		JANUS_LOG(LOG_ERR, "Invalid media stats period (%g, expected 0-%d)\n", (double)value, G_MAXUINT16);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	gint period = (gint)value;
+	/* Find the session */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	g_atomic_int_set(&session->stats_period, period);
 	/* Done */
 	janus_refcount_decrease(&session->ref);
 	lua_pushnumber(s, 0);
@@ -1320,55 +1767,50 @@ static int janus_lua_method_stoprecording(lua_State *s) {
 
 
 /* Plugin implementation */
-int janus_lua_init(janus_callbacks *callback, const char *config_path) {
-	if(g_atomic_int_get(&lua_stopping)) {
-		/* Still stopping from before */
-		return -1;
-	}
-	if(callback == NULL || config_path == NULL) {
-		/* Invalid arguments */
-		return -1;
-	}
-
-	/* Read configuration */
-	char filename[255];
-	g_snprintf(filename, 255, "%s/%s.jcfg", config_path, JANUS_LUA_PACKAGE);
-	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
-	janus_config *config = janus_config_parse(filename);
-	if(config == NULL) {
-		JANUS_LOG(LOG_WARN, "Couldn't find .jcfg configuration file (%s), trying .cfg\n", JANUS_LUA_PACKAGE);
-		g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_LUA_PACKAGE);
-		JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
-		config = janus_config_parse(filename);
-	}
-	if(config == NULL) {
-		/* No config means no Lua script */
-		JANUS_LOG(LOG_ERR, "Failed to load configuration file for Lua plugin...\n");
-		return -1;
-	}
-	janus_config_print(config);
-	janus_config_category *config_general = janus_config_get_create(config, NULL, janus_config_type_category, "general");
-	char *lua_folder = NULL;
-	janus_config_item *folder = janus_config_get(config, config_general, janus_config_type_item, "path");
-	if(folder && folder->value)
-		lua_folder = g_strdup(folder->value);
-	janus_config_item *script = janus_config_get(config, config_general, janus_config_type_item, "script");
-	if(script == NULL || script->value == NULL) {
-		JANUS_LOG(LOG_ERR, "Missing script path in Lua plugin configuration...\n");
-		janus_config_destroy(config);
-		g_free(lua_folder);
-		return -1;
+/* Helper to close all the Lua states in the pool, and free the related resources */
+static void janus_lua_states_close(void) {
+	if(lua_states == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *ls = &lua_states[i];
+		if(ls->scheduler != NULL) {
+			g_async_queue_push(ls->events, GUINT_TO_POINTER(janus_lua_event_exit));
+			g_thread_join(ls->scheduler);
+			ls->scheduler = NULL;
+		}
+		if(ls->events != NULL) {
+			gpointer event = NULL;
+			while((event = g_async_queue_try_pop(ls->events)) != NULL) {
+				if(event != GUINT_TO_POINTER(janus_lua_event_resume) && event != GUINT_TO_POINTER(janus_lua_event_exit))
+					janus_lua_message_free((janus_lua_message *)event);
+			}
+			g_async_queue_unref(ls->events);
+			ls->events = NULL;
+		}
+		if(ls->state != NULL) {
+			janus_mutex_lock(ls->mutex);
+			lua_close(ls->state);
+			ls->state = NULL;
+			janus_mutex_unlock(ls->mutex);
+		}
+		if(i > 0)
+			janus_mutex_destroy(&ls->lock);
 	}
-	char *lua_file = g_strdup(script->value);
-	char *lua_config = NULL;
-	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
-	if(conf && conf->value)
-		lua_config = g_strdup(conf->value);
-	janus_config_destroy(config);
+	g_free(lua_states);
+	lua_states = NULL;
+	lua_state = NULL;
+	lua_states_num = 0;
+}
 
+/* Helper to create a new Lua state in the pool, and load the script in it */
+static int janus_lua_state_setup(janus_lua_state *ls, const char *lua_folder, const char *lua_file) {
 	/* Initialize Lua */
-	lua_state = luaL_newstate();
+	lua_State *lua_state = luaL_newstate();
 	luaL_openlibs(lua_state);
+	/* Keep track of the pool state this Lua state belongs to */
+	lua_pushlightuserdata(lua_state, ls);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "janus_lua_state");
 
 	if(lua_folder != NULL) {
 		/* Add the script folder to the path, so that we can load other scripts from there */
@@ -1388,6 +1830,11 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_register(lua_state, "janusLog", janus_lua_method_januslog);
 	lua_register(lua_state, "pokeScheduler", janus_lua_method_pokescheduler);
 	lua_register(lua_state, "timeCallback", janus_lua_method_timecallback);
+	lua_register(lua_state, "getStateId", janus_lua_method_getstateid);
+	lua_register(lua_state, "getStatesCount", janus_lua_method_getstatescount);
+	lua_register(lua_state, "postMessage", janus_lua_method_postmessage);
+	lua_register(lua_state, "sharedSet", janus_lua_method_sharedset);
+	lua_register(lua_state, "sharedGet", janus_lua_method_sharedget);
 	lua_register(lua_state, "pushEvent", janus_lua_method_pushevent);
 	lua_register(lua_state, "notifyEvent", janus_lua_method_notifyevent);
 	lua_register(lua_state, "eventsIsEnabled", janus_lua_method_eventsisenabled);
@@ -1400,6 +1847,10 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_register(lua_state, "setPliFreq", janus_lua_method_setplifreq);
 	lua_register(lua_state, "setSubstream", janus_lua_method_setsubstream);
 	lua_register(lua_state, "setTemporalLayer", janus_lua_method_settemporallayer);
+	lua_register(lua_state, "setSpatialLayer", janus_lua_method_setspatiallayer);
+	lua_register(lua_state, "setSvc", janus_lua_method_setsvc);
+	lua_register(lua_state, "setMediaRoute", janus_lua_method_setmediaroute);
+	lua_register(lua_state, "setMediaStats", janus_lua_method_setmediastats);
 	lua_register(lua_state, "sendPli", janus_lua_method_sendpli);
 	lua_register(lua_state, "relayRtp", janus_lua_method_relayrtp);
 	lua_register(lua_state, "relayRtcp", janus_lua_method_relayrtcp);
@@ -1416,8 +1867,6 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	if(err) {
 		JANUS_LOG(LOG_ERR, "Error loading Lua script %s: %s\n", lua_file, lua_tostring(lua_state, -1));
 		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
 		return -1;
 	}
 	/* Make sure that all the functions we need are there */
@@ -1427,11 +1876,95 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 		if(lua_isfunction(lua_state, lua_gettop(lua_state)) == 0) {
 			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", lua_functions[i], lua_file);
 			lua_close(lua_state);
+			return -1;
+		}
+		lua_pop(lua_state, 1);
+	}
+	ls->state = lua_state;
+	return 0;
+}
+
+int janus_lua_init(janus_callbacks *callback, const char *config_path) {
+	if(g_atomic_int_get(&lua_stopping)) {
+		/* Still stopping from before */
+		return -1;
+	}
+	if(callback == NULL || config_path == NULL) {
+		/* Invalid arguments */
+		return -1;
+	}
+
+	/* Read configuration */
+	char filename[255];
+	g_snprintf(filename, 255, "%s/%s.jcfg", config_path, JANUS_LUA_PACKAGE);
+	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
+	janus_config *config = janus_config_parse(filename);
+	if(config == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't find .jcfg configuration file (%s), trying .cfg\n", JANUS_LUA_PACKAGE);
+		g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_LUA_PACKAGE);
+		JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
+		config = janus_config_parse(filename);
+	}
+	if(config == NULL) {
+		/* No config means no Lua script */
+		JANUS_LOG(LOG_ERR, "Failed to load configuration file for Lua plugin...\n");
+		return -1;
+	}
+	janus_config_print(config);
+	janus_config_category *config_general = janus_config_get_create(config, NULL, janus_config_type_category, "general");
+	char *lua_folder = NULL;
+	janus_config_item *folder = janus_config_get(config, config_general, janus_config_type_item, "path");
+	if(folder && folder->value)
+		lua_folder = g_strdup(folder->value);
+	janus_config_item *script = janus_config_get(config, config_general, janus_config_type_item, "script");
+	if(script == NULL || script->value == NULL) {
+		JANUS_LOG(LOG_ERR, "Missing script path in Lua plugin configuration...\n");
+		janus_config_destroy(config);
+		g_free(lua_folder);
+		return -1;
+	}
+	char *lua_file = g_strdup(script->value);
+	char *lua_config = NULL;
+	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
+	if(conf && conf->value)
+		lua_config = g_strdup(conf->value);
+	lua_states_num = 1;
+	janus_config_item *states = janus_config_get(config, config_general, janus_config_type_item, "states");
+	if(states && states->value) {
+		int num = atoi(states->value);
+		if(num < 1 || num > JANUS_LUA_MAX_STATES) {
+			JANUS_LOG(LOG_WARN, "Invalid number of Lua states (%s), using %d instead\n", states->value,
+				num < 1 ? 1 : JANUS_LUA_MAX_STATES);
+			num = num < 1 ? 1 : JANUS_LUA_MAX_STATES;
+		}
+		lua_states_num = num;
+	}
+	janus_config_destroy(config);
+
+	/* Initialize the pool of Lua states: each state loads its own copy of the script */
+	lua_states = g_malloc0(lua_states_num * sizeof(janus_lua_state));
+	guint i = 0;
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *ls = &lua_states[i];
+		ls->id = i;
+		if(i == 0) {
+			ls->mutex = &lua_mutex;
+		} else {
+			janus_mutex_init(&ls->lock);
+			ls->mutex = &ls->lock;
+		}
+		if(janus_lua_state_setup(ls, lua_folder, lua_file) < 0) {
+			janus_lua_states_close();
 			g_free(lua_folder);
 			g_free(lua_file);
+			g_free(lua_config);
 			return -1;
 		}
+		ls->events = g_async_queue_new();
 	}
+	lua_state = lua_states[0].state;
+	if(lua_states_num > 1)
+		JANUS_LOG(LOG_INFO, "Loaded the Lua script in %u different states\n", lua_states_num);
 	/* Some Lua functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with Lua only dictating
 	 * the logic, or those overriding the plugin namespace and versioning information */
@@ -1486,23 +2019,35 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_getglobal(lua_state, "temporalLayerChanged");
 	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
 		has_temporal_changed = TRUE;
+	lua_getglobal(lua_state, "mediaStats");
+	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+		has_media_stats = TRUE;
 
 	lua_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_lua_session_destroy);
 	lua_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
 	callbacks = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_lua_callback_free);
+	shared_table = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
 
 	g_atomic_int_set(&lua_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* Launch the scheduler threads (which will be responsible for resuming asynchronous coroutines) */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("lua scheduler", janus_lua_scheduler, NULL, &error);
+	char tname[16];
+	for(i=0; i<lua_states_num; i++) {
+		if(lua_states_num == 1)
+			g_snprintf(tname, sizeof(tname), "lua scheduler");
+		else
+			g_snprintf(tname, sizeof(tname), "lua sched %u", i);
+		lua_states[i].scheduler = g_thread_try_new(tname, janus_lua_scheduler, &lua_states[i], &error);
+		if(error != NULL)
+			break;
+	}
 	if(error != NULL) {
 		g_atomic_int_set(&lua_initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
-		lua_close(lua_state);
+		janus_lua_states_close();
 		g_free(lua_folder);
 		g_free(lua_file);
 		g_free(lua_config);
@@ -1521,7 +2066,7 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 			g_main_loop_unref(timer_loop);
 		if(timer_context != NULL)
 			g_main_context_unref(timer_context);
-		lua_close(lua_state);
+		janus_lua_states_close();
 		g_free(lua_folder);
 		g_free(lua_file);
 		g_free(lua_config);
@@ -1531,10 +2076,14 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	lua_janus_core = callback;
 
-	/* Init the Lua script, in case it's needed */
-	lua_getglobal(lua_state, "init");
-	lua_pushstring(lua_state, lua_config);
-	lua_call(lua_state, 1, 0);
+	/* Init the Lua script in all states, in case it's needed */
+	for(i=0; i<lua_states_num; i++) {
+		janus_mutex_lock(lua_states[i].mutex);
+		lua_getglobal(lua_states[i].state, "init");
+		lua_pushstring(lua_states[i].state, lua_config);
+		lua_call(lua_states[i].state, 1, 0);
+		janus_mutex_unlock(lua_states[i].mutex);
+	}
 
 	g_free(lua_folder);
 	g_free(lua_file);
@@ -1549,10 +2098,14 @@ void janus_lua_destroy(void) {
 		return;
 	g_atomic_int_set(&lua_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
+	guint i = 0;
+	for(i=0; i<lua_states_num; i++)
+		g_async_queue_push(lua_states[i].events, GUINT_TO_POINTER(janus_lua_event_exit));
+	for(i=0; i<lua_states_num; i++) {
+		if(lua_states[i].scheduler != NULL) {
+			g_thread_join(lua_states[i].scheduler);
+			lua_states[i].scheduler = NULL;
+		}
 	}
 	if(timer_loop != NULL)
 		g_main_loop_quit(timer_loop);
@@ -1569,27 +2122,30 @@ void janus_lua_destroy(void) {
 		timer_context = NULL;
 	}
 
-	/* Deinit the Lua script, in case it's needed */
-	janus_mutex_lock(&lua_mutex);
-	lua_getglobal(lua_state, "destroy");
-	lua_call(lua_state, 0, 0);
+	/* Deinit the Lua script in all states, in case it's needed */
+	for(i=0; i<lua_states_num; i++) {
+		janus_mutex_lock(lua_states[i].mutex);
+		lua_getglobal(lua_states[i].state, "destroy");
+		lua_call(lua_states[i].state, 0, 0);
+		janus_mutex_unlock(lua_states[i].mutex);
+	}
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_destroy(callbacks);
 	callbacks = NULL;
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
 
 	janus_mutex_lock(&lua_sessions_mutex);
 	g_hash_table_destroy(lua_sessions);
 	lua_sessions = NULL;
 	g_hash_table_destroy(lua_ids);
 	lua_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&lua_sessions_mutex);
 
-	janus_mutex_lock(&lua_mutex);
-	lua_close(lua_state);
-	lua_state = NULL;
-	janus_mutex_unlock(&lua_mutex);
+	janus_lua_states_close();
+	janus_mutex_lock(&shared_mutex);
+	g_hash_table_destroy(shared_table);
+	shared_table = NULL;
+	janus_mutex_unlock(&shared_mutex);
 
 	g_free(lua_script_version_string);
 	g_free(lua_script_description);
@@ -1775,25 +2331,37 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	session->sim_context.substream_target = 2;
 	session->sim_context.templayer_target = 2;
 	janus_vp8_simulcast_context_reset(&session->vp8_context);
+	janus_rtp_svc_context_reset(&session->svc_context);
+	session->svc_context.spatial_target = 2;
+	session->svc_context.temporal_target = 2;
 	session->rid_extmap_id = -1;
 	janus_mutex_init(&session->rid_mutex);
 	session->vcodec = JANUS_VIDEOCODEC_NONE;
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
 	janus_refcount_init(&session->ref, janus_lua_session_free);
+	/* Bind the session to the least loaded Lua state: it will always be served by that one */
+	session->lstate = &lua_states[0];
+	guint i = 0;
+	for(i=1; i<lua_states_num; i++) {
+		if(g_atomic_int_get(&lua_states[i].sessions) < g_atomic_int_get(&session->lstate->sessions))
+			session->lstate = &lua_states[i];
+	}
+	g_atomic_int_inc(&session->lstate->sessions);
 	handle->plugin_handle = session;
 	g_hash_table_insert(lua_sessions, handle, session);
 	g_hash_table_insert(lua_ids, GUINT_TO_POINTER(session->id), session);
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = session->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, "createSession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(ls->state, 1);
+	janus_mutex_unlock(ls->mutex);
 
 	return;
 }
@@ -1817,13 +2385,14 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = session->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, "destroySession");
 	lua_pushnumber(t, id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(ls->state, 1);
+	janus_mutex_unlock(ls->mutex);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -1840,6 +2409,7 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 
 	/* Finally, remove from the hashtable */
 	janus_mutex_lock(&lua_sessions_mutex);
+	g_atomic_int_add(&ls->sessions, -1);
 	g_hash_table_remove(lua_sessions, handle);
 	janus_mutex_unlock(&lua_sessions_mutex);
 	janus_refcount_decrease(&session->ref);
@@ -1861,19 +2431,20 @@ json_t *janus_lua_query_session(janus_plugin_session *handle) {
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&lua_sessions_mutex);
 	/* Ask the Lua script for information on this session */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = session->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, "querySession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 1);
-	lua_pop(lua_state, 1);
+	lua_pop(ls->state, 1);
 	janus_refcount_decrease(&session->ref);
 	const char *info = lua_tostring(t, -1);
 	lua_pop(t, 1);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(ls->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
 		return NULL;
@@ -1939,15 +2510,16 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 		json_decref(jsep);
 	}
 	/* Invoke the script function */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = session->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, "handleMessage");
 	lua_pushnumber(t, session->id);
 	lua_pushstring(t, transaction);
 	lua_pushstring(t, message_text);
 	lua_pushstring(t, jsep_text);
 	lua_call(t, 4, 2);
-	lua_pop(lua_state, 1);
+	lua_pop(ls->state, 1);
 	janus_refcount_decrease(&session->ref);
 	if(message_text != NULL)
 		free(message_text);
@@ -1956,7 +2528,7 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	g_free(transaction);
 	int n = lua_gettop(t);
 	if(n != 2) {
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(ls->mutex);
 		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 	}
@@ -1966,20 +2538,20 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	lua_pop(t, 2);
 	if(res < 0) {
 		/* We got an error */
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(ls->mutex);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, response ? response : "Lua error", NULL);
 	} else if(res == 0) {
 		/* Synchronous response: we need a Jansson object */
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(ls->mutex);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 		}
 		return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, json);
 	}
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(ls->mutex);
 	/* If we got here, it's an asynchronous response */
 	return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 }
@@ -2041,13 +2613,14 @@ void janus_lua_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = session->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, "setupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(ls->state, 1);
+	janus_mutex_unlock(ls->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2065,23 +2638,27 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 	char *buf = rtp_packet->buffer;
 	uint16_t len = rtp_packet->length;
 	/* Check if the Lua script wants to handle/manipulate RTP packets itself */
-	if(has_incoming_rtp) {
+	int route = g_atomic_int_get(&session->route[video ? 1 : 0]);
+	if(route == janus_lua_route_script && has_incoming_rtp) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *ls = session->lstate;
+		janus_mutex_lock(ls->mutex);
+		lua_State *t = lua_newthread(ls->state);
 		lua_getglobal(t, "incomingRtp");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, video);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(ls->state, 1);
+		janus_mutex_unlock(ls->mutex);
 		return;
 	}
 	/* Is this session allowed to send media? */
-	if((video && !session->send_video) || (!video && !session->send_audio))
+	if((video && !session->send_video) || (!video && !session->send_audio) || route == janus_lua_route_drop) {
+		janus_lua_media_stats_update(session, video, -1, len, TRUE);
 		return;
+	}
 	/* Handle the packet */
 	janus_rtp_header *rtp = (janus_rtp_header *)buf;
 	/* Check if we're simulcasting, and if so, keep track of the "layer" */
@@ -2113,6 +2690,7 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 			janus_mutex_unlock(&session->rid_mutex);
 		}
 	}
+	janus_lua_media_stats_update(session, video, sc, len, FALSE);
 	/* Are we recording? */
 	if(!video || (session->ssrc[0] == 0 && session->rid[0] == NULL)) {
 		janus_recorder_save_frame(video ? session->vrc : session->arc, buf, len);
@@ -2134,23 +2712,39 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 			rtp->seq_number = htons(seq_number);
 		}
 	}
-	janus_lua_rtp_relay_packet packet;
-	packet.sender = session;
-	packet.data = rtp;
-	packet.length = len;
-	packet.is_rtp = TRUE;
-	packet.is_video = video;
-	packet.extensions = rtp_packet->extensions;
-	packet.ssrc[0] = (sc != -1 ? session->ssrc[0] : 0);
-	packet.ssrc[1] = (sc != -1 ? session->ssrc[1] : 0);
-	packet.ssrc[2] = (sc != -1 ? session->ssrc[2] : 0);
-	/* Backup the actual timestamp and sequence number set by the publisher, in case switching is involved */
-	packet.timestamp = ntohl(packet.data->timestamp);
-	packet.seq_number = ntohs(packet.data->seq_number);
-	/* Relay to all recipients */
-	janus_mutex_lock_nodebug(&session->recipients_mutex);
-	g_slist_foreach(session->recipients, janus_lua_relay_rtp_packet, &packet);
-	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	if(route != janus_lua_route_record) {
+		janus_lua_rtp_relay_packet packet = { 0 };
+		packet.sender = session;
+		packet.data = rtp;
+		packet.length = len;
+		packet.is_rtp = TRUE;
+		packet.is_video = video;
+		packet.extensions = rtp_packet->extensions;
+		packet.ssrc[0] = (sc != -1 ? session->ssrc[0] : 0);
+		packet.ssrc[1] = (sc != -1 ? session->ssrc[1] : 0);
+		packet.ssrc[2] = (sc != -1 ? session->ssrc[2] : 0);
+		if(video && session->svc) {
+			/* We're doing SVC: let's parse this packet to see which layers are there */
+			int plen = 0;
+			char *payload = janus_rtp_payload(buf, len, &plen);
+			if(payload == NULL)
+				return;
+			if(session->vcodec == JANUS_VIDEOCODEC_VP9) {
+				gboolean found = FALSE;
+				if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0)
+					packet.svc = found;
+			} else if(session->vcodec == JANUS_VIDEOCODEC_AV1) {
+				packet.svc = (rtp_packet->extensions.dd_len > 0);
+			}
+		}
+		/* Backup the actual timestamp and sequence number set by the publisher, in case switching is involved */
+		packet.timestamp = ntohl(packet.data->timestamp);
+		packet.seq_number = ntohs(packet.data->seq_number);
+		/* Relay to all recipients */
+		janus_mutex_lock_nodebug(&session->recipients_mutex);
+		g_slist_foreach(session->recipients, janus_lua_relay_rtp_packet, &packet);
+		janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	}
 
 	/* Check if we need to send any PLI to this media source */
 	if(video && session->pli_freq > 0) {
@@ -2180,26 +2774,28 @@ void janus_lua_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *pa
 	/* Check if the Lua script wants to handle/manipulate RTCP packets itself */
 	if(has_incoming_rtcp) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *ls = session->lstate;
+		janus_mutex_lock(ls->mutex);
+		lua_State *t = lua_newthread(ls->state);
 		lua_getglobal(t, "incomingRtcp");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, video);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(ls->state, 1);
+		janus_mutex_unlock(ls->mutex);
 		return;
 	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
-	guint32 bitrate = janus_rtcp_get_remb(buf, len);
-	if(bitrate > 0) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(buf, len, &summary);
+	if(summary.remb > 0) {
 		/* No limit ~= 10000000 */
 		lua_janus_core->send_remb(handle, session->bitrate ? session->bitrate : 10000000);
 	}
 	/* If there's an incoming PLI, instead, relay it to the source of the media if any */
-	if(janus_rtcp_has_pli(buf, len)) {
+	if(summary.pli) {
 		if(session->sender != NULL) {
 			janus_mutex_lock_nodebug(&session->sender->recipients_mutex);
 			/* Send a PLI */
@@ -2232,8 +2828,9 @@ void janus_lua_incoming_data(janus_plugin_session *handle, janus_plugin_data *pa
 		/* Yep, pass the data to the Lua script and return */
 		if(!packet->binary && !has_incoming_text_data)
 			JANUS_LOG(LOG_WARN, "Missing 'incomingTextData', invoking deprecated function 'incomingData' instead\n");
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *ls = session->lstate;
+		janus_mutex_lock(ls->mutex);
+		lua_State *t = lua_newthread(ls->state);
 		lua_getglobal(t, packet->binary ? "incomingBinaryData" : (has_incoming_text_data ? "incomingTextData" : "incomingData"));
 		lua_pushnumber(t, session->id);
 		/* We use a string for both text and binary data */
@@ -2242,8 +2839,8 @@ void janus_lua_incoming_data(janus_plugin_session *handle, janus_plugin_data *pa
 		lua_pushlstring(t, label, label ? strlen(label) : 0);
 		lua_pushlstring(t, protocol, protocol ? strlen(protocol) : 0);
 		lua_call(t, 5, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(ls->state, 1);
+		janus_mutex_unlock(ls->mutex);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -2280,13 +2877,14 @@ void janus_lua_data_ready(janus_plugin_session *handle) {
 	/* Check if the Lua script wants to receive this event */
 	if(has_data_ready) {
 		/* Yep, pass the event to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *ls = session->lstate;
+		janus_mutex_lock(ls->mutex);
+		lua_State *t = lua_newthread(ls->state);
 		lua_getglobal(t, "dataReady");
 		lua_pushnumber(t, session->id);
 		lua_call(t, 1, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(ls->state, 1);
+		janus_mutex_unlock(ls->mutex);
 		return;
 	}
 }
@@ -2308,15 +2906,16 @@ void janus_lua_slow_link(janus_plugin_session *handle, int mindex, gboolean vide
 	janus_refcount_increase(&session->ref);
 	if(has_slow_link) {
 		/* Notify the Lua script */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *ls = session->lstate;
+		janus_mutex_lock(ls->mutex);
+		lua_State *t = lua_newthread(ls->state);
 		lua_getglobal(t, "slowLink");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, uplink);
 		lua_pushboolean(t, video);
 		lua_call(t, 3, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(ls->state, 1);
+		janus_mutex_unlock(ls->mutex);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -2362,6 +2961,14 @@ void janus_lua_hangup_media(janus_plugin_session *handle) {
 	session->sim_context.substream_target = 2;
 	session->sim_context.templayer_target = 2;
 	janus_vp8_simulcast_context_reset(&session->vp8_context);
+	session->svc = FALSE;
+	janus_rtp_svc_context_reset(&session->svc_context);
+	session->svc_context.spatial_target = 2;
+	session->svc_context.temporal_target = 2;
+	g_atomic_int_set(&session->route[0], janus_lua_route_script);
+	g_atomic_int_set(&session->route[1], janus_lua_route_script);
+	g_atomic_int_set(&session->stats_period, 0);
+	janus_lua_media_stats_reset(session);
 	session->vcodec = JANUS_VIDEOCODEC_NONE;
 	janus_rtp_simulcasting_cleanup(&session->rid_extmap_id, session->ssrc, session->rid, &session->rid_mutex);
 
@@ -2377,13 +2984,14 @@ void janus_lua_hangup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = session->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, "hangupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(ls->state, 1);
+	janus_mutex_unlock(ls->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2405,7 +3013,53 @@ static void janus_lua_relay_rtp_packet(gpointer data, gpointer user_data) {
 		/* Nope, don't relay */
 		return;
 	}
-	if(packet->ssrc[0] != 0) {
+	if(packet->svc) {
+		/* Handle SVC: don't relay if it's not the layer we wanted to handle */
+		gboolean relay = janus_rtp_svc_context_process_rtp(&session->svc_context,
+			(char *)packet->data, packet->length, packet->extensions.dd_content, packet->extensions.dd_len,
+			sender->vcodec, &packet->svc_info, &session->vrtpctx);
+		if(session->svc_context.need_pli && sender->handle) {
+			/* Send a PLI */
+			JANUS_LOG(LOG_VERB, "We need a PLI for the SVC context\n");
+			lua_janus_core->send_pli(sender->handle);
+		}
+		/* Do we need to drop this? */
+		if(!relay)
+			return;
+		/* Any event we should notify? For SVC, the substream is the spatial layer */
+		if(session->svc_context.changed_spatial && has_substream_changed) {
+			janus_lua_state *ls = session->lstate;
+			janus_mutex_lock(ls->mutex);
+			lua_State *t = lua_newthread(ls->state);
+			lua_getglobal(t, "substreamChanged");
+			lua_pushnumber(t, session->id);
+			lua_pushnumber(t, session->svc_context.spatial);
+			lua_call(t, 2, 0);
+			lua_pop(ls->state, 1);
+			janus_mutex_unlock(ls->mutex);
+		}
+		if(session->svc_context.changed_temporal && has_temporal_changed) {
+			janus_lua_state *ls = session->lstate;
+			janus_mutex_lock(ls->mutex);
+			lua_State *t = lua_newthread(ls->state);
+			lua_getglobal(t, "temporalLayerChanged");
+			lua_pushnumber(t, session->id);
+			lua_pushnumber(t, session->svc_context.temporal);
+			lua_call(t, 2, 0);
+			lua_pop(ls->state, 1);
+			janus_mutex_unlock(ls->mutex);
+		}
+		/* If we got here, update the RTP header and send the packet */
+		janus_rtp_header_update(packet->data, &session->vrtpctx, TRUE, 0);
+		if(lua_janus_core != NULL) {
+			janus_plugin_rtp rtp = { .mindex = -1, .video = packet->is_video,
+				.buffer = (char *)packet->data, .length = packet->length, .extensions = packet->extensions };
+			lua_janus_core->relay_rtp(session->handle, &rtp);
+		}
+		/* Restore the timestamp and sequence number to what the publisher set them to */
+		packet->data->timestamp = htonl(packet->timestamp);
+		packet->data->seq_number = htons(packet->seq_number);
+	} else if(packet->ssrc[0] != 0) {
 		/* Handle simulcast: make sure we have a payload to work with */
 		int plen = 0;
 		char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
@@ -2427,27 +3081,29 @@ static void janus_lua_relay_rtp_packet(gpointer data, gpointer user_data) {
 		if(session->sim_context.changed_substream) {
 			/* Notify the script about the substream change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&lua_mutex);
-				lua_State *t = lua_newthread(lua_state);
+				janus_lua_state *ls = session->lstate;
+				janus_mutex_lock(ls->mutex);
+				lua_State *t = lua_newthread(ls->state);
 				lua_getglobal(t, "substreamChanged");
 				lua_pushnumber(t, session->id);
 				lua_pushnumber(t, session->sim_context.substream);
 				lua_call(t, 2, 0);
-				lua_pop(lua_state, 1);
-				janus_mutex_unlock(&lua_mutex);
+				lua_pop(ls->state, 1);
+				janus_mutex_unlock(ls->mutex);
 			}
 		}
 		if(session->sim_context.changed_temporal) {
 			/* Notify the user about the temporal layer change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&lua_mutex);
-				lua_State *t = lua_newthread(lua_state);
+				janus_lua_state *ls = session->lstate;
+				janus_mutex_lock(ls->mutex);
+				lua_State *t = lua_newthread(ls->state);
 				lua_getglobal(t, "temporalLayerChanged");
 				lua_pushnumber(t, session->id);
 				lua_pushnumber(t, session->sim_context.templayer);
 				lua_call(t, 2, 0);
-				lua_pop(lua_state, 1);
-				janus_mutex_unlock(&lua_mutex);
+				lua_pop(ls->state, 1);
+				janus_mutex_unlock(ls->mutex);
 			}
 		}
 		/* If we got here, update the RTP header and send the packet */
@@ -2517,26 +3173,51 @@ static void janus_lua_relay_data_packet(gpointer data, gpointer user_data) {
 }
 
 /* This is a scheduler thread: if we know there are coroutines to resume
- * in Lua (e.g., for asynchronous requests), we do that ourselves here */
+ * in Lua (e.g., for asynchronous requests), we do that ourselves here.
+ * Each state in the pool has its own, which is also responsible for
+ * delivering the messages other states sent via postMessage() */
 static void *janus_lua_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread\n");
-	janus_lua_event *event = NULL;
+	janus_lua_state *ls = (janus_lua_state *)data;
+	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread (state #%u)\n", ls->id);
+	gpointer event = NULL;
 	/* Wait until there are events to process */
 	while(g_atomic_int_get(&lua_initialized) && !g_atomic_int_get(&lua_stopping)) {
-		event = g_async_queue_pop(events);
+		event = g_async_queue_pop(ls->events);
 		if(event == GUINT_TO_POINTER(janus_lua_event_exit))
 			break;
 		if(event == GUINT_TO_POINTER(janus_lua_event_resume)) {
 			/* There are coroutines to resume */
-			janus_mutex_lock(&lua_mutex);
-			lua_getglobal(lua_state, "resumeScheduler");
-			lua_call(lua_state, 0, 0);
+			janus_mutex_lock(ls->mutex);
+			lua_getglobal(ls->state, "resumeScheduler");
+			lua_call(ls->state, 0, 0);
 			/* Print the count of elements into Lua stack */
-			janus_lua_stackdump(lua_state);
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_stackdump(ls->state);
+			janus_mutex_unlock(ls->mutex);
+		} else if(event != NULL) {
+			/* A message from another state */
+			janus_lua_message *msg = (janus_lua_message *)event;
+			janus_mutex_lock(ls->mutex);
+			lua_State *t = lua_newthread(ls->state);
+			lua_getglobal(t, msg->function);
+			if(lua_isfunction(t, -1)) {
+				if(msg->session > 0) {
+					/* Session notification from the C code */
+					lua_pushnumber(t, msg->session);
+					lua_pushstring(t, msg->argument);
+				} else {
+					lua_pushstring(t, msg->argument);
+					lua_pushnumber(t, msg->sender);
+				}
+				lua_call(t, 2, 0);
+			} else {
+				JANUS_LOG(LOG_WARN, "Function '%s' is missing in state #%u, dropping message\n", msg->function, ls->id);
+			}
+			lua_pop(ls->state, 1);
+			janus_mutex_unlock(ls->mutex);
+			janus_lua_message_free(msg);
 		}
 	}
-	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread (state #%u)\n", ls->id);
 	return NULL;
 }
 
@@ -2561,8 +3242,9 @@ static gboolean janus_lua_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_VERB, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *ls = cb->lstate;
+	janus_mutex_lock(ls->mutex);
+	lua_State *t = lua_newthread(ls->state);
 	lua_getglobal(t, cb->function);
 	if(cb->argument == NULL) {
 		lua_call(t, 0, 0);
@@ -2570,9 +3252,11 @@ static gboolean janus_lua_timer_cb(void *data) {
 		lua_pushstring(t, cb->argument);
 		lua_call(t, 1, 0);
 	}
-	lua_pop(lua_state, 1);
+	lua_pop(ls->state, 1);
 	/* Done */
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_remove(callbacks, cb);
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
+	janus_mutex_unlock(ls->mutex);
 	return FALSE;
 }
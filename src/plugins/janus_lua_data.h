@@ -43,10 +43,43 @@
 extern volatile gint lua_initialized, lua_stopping;
 extern janus_callbacks *lua_janus_core;
 
-/* Lua state: we define state and mutex as extern */
+/* Lua states: sessions are bound to one of a pool of independent states,
+ * each with its own lock and coroutines scheduler, so that sessions bound
+ * to different states can be served in parallel. The first state also
+ * handles all the requests that are not session specific */
+typedef struct janus_lua_state {
+	guint id;							/* Index of this state in the pool */
+	lua_State *state;					/* The Lua state itself */
+	janus_mutex *mutex;					/* Mutex to lock the state (the first state uses lua_mutex) */
+	janus_mutex lock;					/* Mutex storage for all the other states */
+	GThread *scheduler;					/* Thread acting as a scheduler for coroutines in this state */
+	GAsyncQueue *events;				/* Events for the scheduler (resume requests and messages) */
+	volatile gint sessions;				/* Number of sessions bound to this state */
+} janus_lua_state;
+extern janus_lua_state *lua_states;
+extern guint lua_states_num;
+janus_lua_state *janus_lua_state_get(lua_State *s);
+
+/* Lua state: we define state and mutex as extern (they refer to the first state in the pool) */
 extern lua_State *lua_state;
 extern janus_mutex lua_mutex;
 
+/* Native media routing: what the C code should do with incoming RTP packets
+ * for a medium, without entering the Lua script (see setMediaRoute()) */
+typedef enum janus_lua_route {
+	janus_lua_route_script = 0,		/* Pass packets to incomingRtp(), if the script implements it (default) */
+	janus_lua_route_forward,		/* Record (if recording) and relay to recipients in C */
+	janus_lua_route_record,			/* Only record (if recording), don't relay */
+	janus_lua_route_drop			/* Drop packets */
+} janus_lua_route;
+/* Per-medium counters for the sampled stats sent to mediaStats() */
+typedef struct janus_lua_media_stats {
+	guint32 packets;					/* Packets received in the current period */
+	guint64 bytes;						/* Bytes received in the current period */
+	guint32 dropped;					/* Packets dropped because of the route */
+	guint32 layers[3];					/* Packets received per simulcast substream (video only) */
+} janus_lua_media_stats;
+
 /* Lua session: we keep only the barebone stuff here, the rest will be in the Lua script */
 typedef struct janus_lua_session {
 	janus_plugin_session *handle;		/* Pointer to the core-plugin session */
@@ -66,6 +99,12 @@ typedef struct janus_lua_session {
 	janus_mutex rid_mutex;				/* Mutex to protect access to the rid array and the extmap ID */
 	janus_rtp_simulcasting_context sim_context;
 	janus_vp8_simulcast_context vp8_context;
+	gboolean svc;						/* Whether the video this session sends uses SVC (VP9 or AV1) */
+	janus_rtp_svc_context svc_context;	/* SVC layer selection, when receiving from an SVC sender */
+	volatile gint route[2];				/* How incoming audio [0] and video [1] are handled (janus_lua_route) */
+	volatile gint stats_period;			/* How often (seconds) to send mediaStats() to the script (0=disabled), set atomically */
+	gint64 stats_latest;				/* When the latest mediaStats() was sent */
+	janus_lua_media_stats stats[2];		/* Audio [0] and video [1] counters for the current period */
 	uint32_t bitrate;					/* Bitrate limit */
 	uint16_t pli_freq;					/* Regular PLI frequency (0=disabled) */
 	gint64 pli_latest;					/* Time of latest sent PLI (to avoid flooding) */
@@ -83,6 +122,7 @@ typedef struct janus_lua_session {
 	volatile gint dataready;			/* Whether the data channel was established on this sessions's PeerConnection */
 	volatile gint hangingup;			/* Whether this session's PeerConnection is hanging up */
 	volatile gint destroyed;			/* Whether this session's been marked as destroyed */
+	janus_lua_state *lstate;			/* Lua state this session is bound to */
 	/* If you need any additional property (e.g., for hooks you added in janus_lua_extra.c) add them below this line */
 
 	/* Reference counter */
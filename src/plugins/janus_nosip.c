@@ -166,6 +166,7 @@
 #include "../record.h"
 #include "../rtp.h"
 #include "../rtpsrtp.h"
+#include "../reactor.h"
 #include "../rtcp.h"
 #include "../ip-utils.h"
 #include "../sdp-utils.h"
@@ -272,6 +273,9 @@ static uint16_t rtp_range_max = DEFAULT_RTP_RANGE_MAX;
 static uint16_t rtp_range_slider = DEFAULT_RTP_RANGE_MIN;
 static int dscp_audio_rtp = 0;
 static int dscp_video_rtp = 0;
+/* Shared reactor for the RTP/RTCP sockets of all sessions, if enabled */
+static int relay_threads = 0;
+static janus_reactor *relay_reactor = NULL;
 
 static GThread *handler_thread;
 static void *janus_nosip_handler(void *data);
@@ -321,6 +325,7 @@ typedef struct janus_nosip_media {
 	janus_rtp_switching_context acontext, vcontext;
 	int pipefd[2];
 	gboolean updated;
+	int pollerrs;
 	int video_orientation_extension_id;
 	int audio_level_extension_id;
 } janus_nosip_media;
@@ -336,6 +341,7 @@ typedef struct janus_nosip_session {
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
 	GThread *relayer_thread;
+	janus_reactor_source *relayer;	/* Used instead of relayer_thread when the shared reactor is enabled */
 	volatile gint hangingup;
 	volatile gint destroyed;
 	janus_refcount ref;
@@ -643,6 +649,7 @@ void janus_nosip_sdp_process(janus_nosip_session *session, janus_sdp *sdp, gbool
 char *janus_nosip_sdp_manipulate(janus_nosip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_nosip_allocate_local_ports(janus_nosip_session *session, gboolean update);
+static int janus_nosip_relay_start(janus_nosip_session *session);
 static void *janus_nosip_relay_thread(void *data);
 static void janus_nosip_media_cleanup(janus_nosip_session *session);
 
@@ -798,6 +805,17 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 			}
 		}
 
+		/* Should media from peers be received by a pool of threads, rather than a thread per session? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "relay_threads");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring relay_threads value as it's not a positive integer\n");
+			} else {
+				relay_threads = val;
+			}
+		}
+
 		janus_config_destroy(config);
 	}
 	config = NULL;
@@ -841,6 +859,13 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 		ipv6_disabled = TRUE;
 	}
 
+	if(relay_threads > 0) {
+		/* Sessions will share a pool of threads for their RTP/RTCP sockets */
+		relay_reactor = janus_reactor_create("nosiprtp", relay_threads);
+		if(relay_reactor == NULL)
+			JANUS_LOG(LOG_WARN, "Couldn't create the RTP/RTCP reactor, using a thread per session\n");
+	}
+
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
@@ -851,6 +876,8 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the NoSIP handler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
+		janus_reactor_destroy(relay_reactor);
+		relay_reactor = NULL;
 		return -1;
 	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_NOSIP_NAME);
@@ -867,6 +894,8 @@ void janus_nosip_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	janus_reactor_destroy(relay_reactor);
+	relay_reactor = NULL;
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -1288,7 +1317,7 @@ static void janus_nosip_hangup_media_internal(janus_plugin_session *handle) {
 		} while(res == -1 && errno == EINTR);
 	}
 	/* Do cleanup if media thread has not been created */
-	if(!session->media.ready && !session->relayer_thread) {
+	if(!session->media.ready && !session->relayer_thread && !session->relayer) {
 		janus_mutex_lock(&session->mutex);
 		janus_nosip_media_cleanup(session);
 		janus_mutex_unlock(&session->mutex);
@@ -1598,19 +1627,8 @@ static void *janus_nosip_handler(void *data) {
 			if(!sdp_update && !offer) {
 				/* Start the media */
 				session->media.ready = 1;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
+				if(janus_nosip_relay_start(session) < 0)
 					session->media.ready = 0;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
-				}
 			}
 		} else if(!strcasecmp(request_text, "hangup")) {
 			/* Get rid of an ongoing session */
@@ -2355,6 +2373,189 @@ static void janus_nosip_media_cleanup(janus_nosip_session *session) {
 	janus_nosip_media_reset(session);
 }
 
+/* Helper to check whether the relay for a session should keep going */
+static gboolean janus_nosip_relay_check(janus_nosip_session *session) {
+	return !g_atomic_int_get(&session->destroyed) && !g_atomic_int_get(&session->hangingup);
+}
+
+/* Helper to (re)connect the sockets after a session update, or when the relay starts */
+static void janus_nosip_relay_update(janus_nosip_session *session) {
+	/* Apparently there was a session update, or the loop has just been entered */
+	session->media.updated = FALSE;
+
+	/* Resolve the addresses, if needed */
+	gboolean have_audio_server_ip = FALSE;
+	gboolean have_video_server_ip = FALSE;
+	struct sockaddr_storage audio_server_addr = { 0 }, video_server_addr = { 0 };
+	if(session->media.remote_audio_ip && strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
+		if(janus_network_resolve_address(session->media.remote_audio_ip, &audio_server_addr) < 0) {
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't resolve audio address '%s'\n",
+				session, session->media.remote_audio_ip);
+		} else {
+			/* Address resolved */
+			have_audio_server_ip = TRUE;
+		}
+	}
+	if(session->media.remote_video_ip && strcmp(session->media.remote_video_ip, "0.0.0.0")) {
+		if(janus_network_resolve_address(session->media.remote_video_ip, &video_server_addr) < 0) {
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't resolve video address '%s'\n",
+				session, session->media.remote_video_ip);
+		} else {
+			/* Address resolved */
+			have_video_server_ip = TRUE;
+		}
+	}
+
+	if(have_audio_server_ip || have_video_server_ip) {
+		janus_nosip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
+			have_video_server_ip ? &video_server_addr : NULL);
+	} else if (session->media.remote_audio_ip == NULL && session->media.remote_video_ip == NULL) {
+		JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n", session);
+	} else {
+		if(session->media.remote_audio_ip)
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
+				session, session->media.remote_audio_ip);
+		if(session->media.remote_video_ip)
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
+				session, session->media.remote_video_ip);
+	}
+}
+
+/* Helper to handle an error on one of the sockets: returns FALSE if the relay should stop */
+static gboolean janus_nosip_relay_error(janus_nosip_session *session, int fd, int error) {
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return TRUE;
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return TRUE;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
+				session, g_strerror(error));
+			janus_mutex_lock(&session->mutex);
+			janus_reactor_source_remove(session->relayer, session->media.audio_rtcp_fd);
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			janus_mutex_unlock(&session->mutex);
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
+				session, g_strerror(error));
+			janus_mutex_lock(&session->mutex);
+			janus_reactor_source_remove(session->relayer, session->media.video_rtcp_fd);
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			janus_mutex_unlock(&session->mutex);
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return TRUE;
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling %d...\n", session, fd);
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, g_strerror(error));
+	/* FIXME Close the PeerConnection */
+	gateway->close_pc(session->handle);
+	return FALSE;
+}
+
+/* Helper to process an RTP/RTCP packet received on one of the sockets */
+static void janus_nosip_relay_incoming(janus_nosip_session *session, int fd, char *buffer, int bytes) {
+	/* Let's check what this is */
+	gboolean video = fd == session->media.video_rtp_fd || fd == session->media.video_rtcp_fd;
+	gboolean rtcp = fd == session->media.audio_rtcp_fd || fd == session->media.video_rtcp_fd;
+	if(!rtcp) {
+		/* Audio or Video RTP */
+		if(!janus_is_rtp(buffer, bytes)) {
+			/* Not an RTP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		rtp_header *header = (rtp_header *)buffer;
+		if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
+				(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
+			if(video && session->media.video_ssrc_peer == 0) {
+				session->media.video_ssrc_peer = ntohl(header->ssrc);
+			} else if(!video && session->media.audio_ssrc_peer == 0) {
+				session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			}
+			JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
+				session, video ? "video" : "audio",
+				video ? session->media.video_ssrc_peer : session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, video ? &session->media.vcontext : &session->media.acontext, video, 0);
+		/* Save the frame if we're recording */
+		header->ssrc = htonl(video ? session->media.video_ssrc_peer : session->media.audio_ssrc_peer);
+		janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
+		/* Relay to browser */
+		janus_plugin_rtp rtp = { .mindex = -1, .video = video, .buffer = buffer, .length = bytes };
+		/* Add audio-level extension, if present */
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		if(!video && session->media.audio_level_extension_id != -1) {
+			gboolean vad = FALSE;
+			int level = -1;
+			if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
+					session->media.audio_level_extension_id, &vad, &level) == 0) {
+				rtp.extensions.audio_level = level;
+				rtp.extensions.audio_level_vad = vad;
+			}
+		} else if(video && session->media.video_orientation_extension_id > 0) {
+			gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
+			if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
+					session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
+				rtp.extensions.video_rotation = 0;
+				if(r1 && r0)
+					rtp.extensions.video_rotation = 270;
+				else if(r1)
+					rtp.extensions.video_rotation = 180;
+				else if(r0)
+					rtp.extensions.video_rotation = 90;
+				rtp.extensions.video_back_camera = c;
+				rtp.extensions.video_flipped = f;
+			}
+		}
+		gateway->relay_rtp(session->handle, &rtp);
+	} else {
+		/* Audio or Video RTCP */
+		if(!janus_is_rtcp(buffer, bytes)) {
+			/* Not an RTCP packet? */
+			return;
+		}
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		janus_plugin_rtcp rtcp = { .mindex = -1, .video = video, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+	}
+}
+
 /* Thread to relay RTP/RTCP frames coming from the peer */
 static void *janus_nosip_relay_thread(void *data) {
 	janus_nosip_session *session = (janus_nosip_session *)data;
@@ -2363,11 +2564,13 @@ static void *janus_nosip_relay_thread(void *data) {
 		return NULL;
 	}
 	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay thread\n", session);
+	/* Stick to the same CPU as the session's event loop, if pinned */
+	gateway->inherit_affinity(session->handle);
 
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote = { 0 };
-	int resfd = 0, bytes = 0, pollerrs = 0;
+	int resfd = 0, bytes = 0;
 	struct pollfd fds[5];
 	int pipe_fd = session->media.pipefd[0];
 	char buffer[1500];
@@ -2385,53 +2588,12 @@ static void *janus_nosip_relay_thread(void *data) {
 	gboolean goon = TRUE;
 
 	session->media.updated = TRUE; /* Connect UDP sockets upon loop entry */
-	gboolean have_audio_server_ip = TRUE;
-	gboolean have_video_server_ip = TRUE;
-
-	while(goon && session != NULL &&
-			!g_atomic_int_get(&session->destroyed) && !g_atomic_int_get(&session->hangingup)) {
-
-		if(session->media.updated) {
-			/* Apparently there was a session update, or the loop has just been entered */
-			session->media.updated = FALSE;
-
-			/* Resolve the addresses, if needed */
-			have_audio_server_ip = FALSE;
-			have_video_server_ip = FALSE;
-			struct sockaddr_storage audio_server_addr = { 0 }, video_server_addr = { 0 };
-			if(session->media.remote_audio_ip && strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
-				if(janus_network_resolve_address(session->media.remote_audio_ip, &audio_server_addr) < 0) {
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't resolve audio address '%s'\n",
-						session, session->media.remote_audio_ip);
-				} else {
-					/* Address resolved */
-					have_audio_server_ip = TRUE;
-				}
-			}
-			if(session->media.remote_video_ip && strcmp(session->media.remote_video_ip, "0.0.0.0")) {
-				if(janus_network_resolve_address(session->media.remote_video_ip, &video_server_addr) < 0) {
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't resolve video address '%s'\n",
-						session, session->media.remote_video_ip);
-				} else {
-					/* Address resolved */
-					have_video_server_ip = TRUE;
-				}
-			}
+	session->media.pollerrs = 0;
 
-			if(have_audio_server_ip || have_video_server_ip) {
-				janus_nosip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
-					have_video_server_ip ? &video_server_addr : NULL);
-			} else if (session->media.remote_audio_ip == NULL && session->media.remote_video_ip == NULL) {
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n", session);
-			} else {
-				if(session->media.remote_audio_ip)
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
-						session, session->media.remote_audio_ip);
-				if(session->media.remote_video_ip)
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
-						session, session->media.remote_video_ip);
-			}
-		}
+	while(goon && session != NULL && janus_nosip_relay_check(session)) {
+
+		if(session->media.updated)
+			janus_nosip_relay_update(session);
 
 		/* Prepare poll */
 		num = 0;
@@ -2495,39 +2657,11 @@ static void *janus_nosip_relay_thread(void *data) {
 				int error = 0;
 				socklen_t errlen = sizeof(error);
 				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
-							session, g_strerror(error));
-						janus_mutex_lock(&session->mutex);
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						janus_mutex_unlock(&session->mutex);
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
-							session, g_strerror(error));
-						janus_mutex_lock(&session->mutex);
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						janus_mutex_unlock(&session->mutex);
-					}
+				if(!janus_nosip_relay_error(session, fds[i].fd, error)) {
+					/* Can we assume it's pretty much over, after a POLLERR? */
+					goon = FALSE;
+					break;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling %d (socket #%d): %s...\n", session,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, g_strerror(error));
-				/* Can we assume it's pretty much over, after a POLLERR? */
-				goon = FALSE;
-				/* FIXME Close the PeerConnection */
-				gateway->close_pc(session->handle);
-				break;
 			} else if(fds[i].revents & POLLIN) {
 				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
 					/* Poll interrupted for a reason, go on */
@@ -2542,100 +2676,7 @@ static void *janus_nosip_relay_thread(void *data) {
 					/* Failed to read? */
 					continue;
 				}
-				/* Let's check what this is */
-				gboolean video = fds[i].fd == session->media.video_rtp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				gboolean rtcp = fds[i].fd == session->media.audio_rtcp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				if(!rtcp) {
-					/* Audio or Video RTP */
-					if(!janus_is_rtp(buffer, bytes)) {
-						/* Not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					rtp_header *header = (rtp_header *)buffer;
-					if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
-							(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
-						if(video && session->media.video_ssrc_peer == 0) {
-							session->media.video_ssrc_peer = ntohl(header->ssrc);
-						} else if(!video && session->media.audio_ssrc_peer == 0) {
-							session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						}
-						JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
-							session, video ? "video" : "audio",
-							video ? session->media.video_ssrc_peer : session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, video ? &session->media.vcontext : &session->media.acontext, video, 0);
-					/* Save the frame if we're recording */
-					header->ssrc = htonl(video ? session->media.video_ssrc_peer : session->media.audio_ssrc_peer);
-					janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					janus_plugin_rtp rtp = { .mindex = -1, .video = video, .buffer = buffer, .length = bytes };
-					/* Add audio-level extension, if present */
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					if(!video && session->media.audio_level_extension_id != -1) {
-						gboolean vad = FALSE;
-						int level = -1;
-						if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
-								session->media.audio_level_extension_id, &vad, &level) == 0) {
-							rtp.extensions.audio_level = level;
-							rtp.extensions.audio_level_vad = vad;
-						}
-					} else if(video && session->media.video_orientation_extension_id > 0) {
-						gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-						if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
-								session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
-							rtp.extensions.video_rotation = 0;
-							if(r1 && r0)
-								rtp.extensions.video_rotation = 270;
-							else if(r1)
-								rtp.extensions.video_rotation = 180;
-							else if(r0)
-								rtp.extensions.video_rotation = 90;
-							rtp.extensions.video_back_camera = c;
-							rtp.extensions.video_flipped = f;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else {
-					/* Audio or Video RTCP */
-					if(!janus_is_rtcp(buffer, bytes)) {
-						/* Not an RTCP packet? */
-						continue;
-					}
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					janus_plugin_rtcp rtcp = { .mindex = -1, .video = video, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				}
+				janus_nosip_relay_incoming(session, fds[i].fd, buffer, bytes);
 			}
 		}
 	}
@@ -2651,3 +2692,100 @@ static void *janus_nosip_relay_thread(void *data) {
 	return NULL;
 }
 
+/* Shared reactor callbacks, used instead of the thread above when relay_threads is set */
+static void janus_nosip_relay_stop(janus_reactor_source *source) {
+	janus_nosip_session *session = (janus_nosip_session *)source->user_data;
+	/* Cleanup the media session: the sockets must not be watched anymore when closed */
+	janus_mutex_lock(&session->mutex);
+	janus_reactor_source_destroy(source);
+	janus_nosip_media_cleanup(session);
+	session->relayer = NULL;
+	janus_mutex_unlock(&session->mutex);
+	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Leaving NoSIP relay reactor\n", session);
+	janus_refcount_decrease(&session->ref);
+}
+static void janus_nosip_relay_reactor_incoming(janus_reactor_source *source, int fd, char *buf, int len) {
+	janus_nosip_session *session = (janus_nosip_session *)source->user_data;
+	if(g_atomic_int_get(&session->destroyed))
+		return;
+	janus_nosip_relay_incoming(session, fd, buf, len);
+}
+static void janus_nosip_relay_reactor_error(janus_reactor_source *source, int fd, int error) {
+	janus_nosip_session *session = (janus_nosip_session *)source->user_data;
+	if(!janus_nosip_relay_error(session, fd, error))
+		janus_nosip_relay_stop(source);
+}
+static void janus_nosip_relay_reactor_notify(janus_reactor_source *source, int fd) {
+	janus_nosip_session *session = (janus_nosip_session *)source->user_data;
+	if(!janus_nosip_relay_check(session) || session->media.pipefd[0] == -1) {
+		/* The session is over */
+		janus_nosip_relay_stop(source);
+		return;
+	}
+	if(!session->media.updated)
+		return;
+	janus_nosip_relay_update(session);
+	/* New sockets may have been created, make sure we're watching all of them */
+	janus_reactor_source_add(source, session->media.pipefd[0], TRUE);
+	if(session->media.audio_rtp_fd != -1)
+		janus_reactor_source_add(source, session->media.audio_rtp_fd, FALSE);
+	if(session->media.audio_rtcp_fd != -1)
+		janus_reactor_source_add(source, session->media.audio_rtcp_fd, FALSE);
+	if(session->media.video_rtp_fd != -1)
+		janus_reactor_source_add(source, session->media.video_rtp_fd, FALSE);
+	if(session->media.video_rtcp_fd != -1)
+		janus_reactor_source_add(source, session->media.video_rtcp_fd, FALSE);
+}
+static const janus_reactor_callbacks janus_nosip_relay_callbacks = {
+	.incoming = janus_nosip_relay_reactor_incoming,
+	.error = janus_nosip_relay_reactor_error,
+	.notify = janus_nosip_relay_reactor_notify,
+};
+
+/* Start relaying the media coming from the peer, either on the shared reactor or on a new thread */
+static int janus_nosip_relay_start(janus_nosip_session *session) {
+	janus_refcount_increase(&session->ref);
+	if(relay_reactor != NULL) {
+		janus_mutex_lock(&session->mutex);
+		if(session->media.pipefd[0] == -1 || session->media.pipefd[1] == -1) {
+			janus_mutex_unlock(&session->mutex);
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] No pipe file descriptor, not relaying media...\n", session);
+			janus_refcount_decrease(&session->ref);
+			return -1;
+		}
+		session->relayer = janus_reactor_source_create(relay_reactor, &janus_nosip_relay_callbacks, session);
+		if(session->relayer == NULL || janus_reactor_source_add(session->relayer, session->media.pipefd[0], TRUE) < 0) {
+			janus_reactor_source_destroy(session->relayer);
+			session->relayer = NULL;
+			janus_mutex_unlock(&session->mutex);
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't add the session to the RTP/RTCP reactor...\n", session);
+			janus_refcount_decrease(&session->ref);
+			return -1;
+		}
+		JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay\n", session);
+		/* Connect UDP sockets and start watching them from the reactor thread */
+		session->media.updated = TRUE;
+		session->media.pollerrs = 0;
+		int code = 1;
+		ssize_t res = 0;
+		do {
+			res = write(session->media.pipefd[1], &code, sizeof(int));
+		} while(res == -1 && errno == EINTR);
+		janus_mutex_unlock(&session->mutex);
+		return 0;
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
+	session->relayer_thread = g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
+	if(error != NULL) {
+		session->relayer_thread = NULL;
+		janus_refcount_decrease(&session->ref);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		return -1;
+	}
+	return 0;
+}
+
@@ -44,6 +44,12 @@
  *
  * Data channel recordings are supported via a \c data attribute as well.
  *
+ * By default, each viewer is served by a dedicated thread. When many
+ * viewers are expected, you can set \c playout_threads in the configuration
+ * to have a fixed pool of threads serve all of them instead. Either way,
+ * recordings are only indexed once when watched by multiple viewers at
+ * the same time, and frames are read from a memory mapped view of the file.
+ *
  * \section recplayapi Record&Play API
  *
  * The Record&Play API supports several requests, some of which are
@@ -51,11 +57,12 @@
  * (invalid JSON, invalid request) which will always result in a
  * synchronous error response even for asynchronous requests.
  *
- * \c list and \c update are synchronous requests, which means you'll
+ * \c list , \c update and \c seek are synchronous requests, which means you'll
  * get a response directly within the context of the transaction. \c list
  * lists all the available recordings, while \c update forces the plugin
  * to scan the folder of recordings again in case some were added manually
- * and not indexed in the meanwhile.
+ * and not indexed in the meanwhile; \c seek moves an active playout to
+ * a different position.
  *
  * The \c record , \c play , \c start and \c stop requests instead are
  * all asynchronous, which means you'll get a notification about their
@@ -190,7 +197,8 @@
 \verbatim
 {
 	"request" : "play",
-	"id" : <unique numeric ID of the recording to replay>
+	"id" : <unique numeric ID of the recording to replay>,
+	"position" : <position to start from, in milliseconds; optional>
 }
 \endverbatim
  *
@@ -228,6 +236,32 @@
 	}
 }
 \endverbatim
+ *
+ * While a playout is in progress, a \c seek request can move it to a
+ * different position in the recording:
+ *
+\verbatim
+{
+	"request" : "seek",
+	"position" : <position to move to, in milliseconds>
+}
+\endverbatim
+ *
+ * which will result in an immediate response:
+ *
+\verbatim
+{
+	"recordplay" : "seek",
+	"status" : "ok",
+	"position" : <position that was requested>
+}
+\endverbatim
+ *
+ * When there's video, the playout actually resumes from the last keyframe
+ * before the requested position (and so does audio, to keep them in sync).
+ * Keyframes are found using the index sidecar files the recorder writes,
+ * when enabled in the core configuration, or by inspecting the video
+ * packets when the recording is indexed otherwise.
  *
  * Just as before, a \c stop request can interrupt the playout process at
  * any time, and tear the associated PeerConnection down:
@@ -268,6 +302,9 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <jansson.h>
 
 #include "../debug.h"
@@ -366,7 +403,11 @@ static struct janus_json_parameter record_parameters[] = {
 };
 static struct janus_json_parameter play_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
-	{"restart", JANUS_JSON_BOOL, 0}
+	{"restart", JANUS_JSON_BOOL, 0},
+	{"position", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter seek_parameters[] = {
+	{"position", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
 
 /* Useful stuff */
@@ -396,11 +437,40 @@ typedef struct janus_recordplay_frame_packet {
 	uint64_t ts;	/* RTP Timestamp */
 	int len;		/* Length of the data */
 	long offset;	/* Offset of the data in the file */
+	gboolean keyframe;	/* Whether this is a video keyframe */
 	struct janus_recordplay_frame_packet *next;
 	struct janus_recordplay_frame_packet *prev;
 } janus_recordplay_frame_packet;
 janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename);
 
+/* Frame indexes are built once per .mjr file and shared by all the viewers
+ * that are watching it at the same time: a cached index is only reused as
+ * long as the file didn't change, and payloads are read from a read-only
+ * memory mapped view of the file, rather than with a seek+read each time */
+typedef struct janus_recordplay_frame_index {
+	char *path;			/* Path of the .mjr file */
+	time_t mtime;		/* Modification time of the file when it was indexed */
+	off_t size;			/* Size of the file when it was indexed */
+	janus_recordplay_frame_packet *frames;	/* Ordered list of frames */
+	janus_recordplay_frame_packet **array;	/* Same frames, as an array, to seek in them */
+	guint count;		/* Number of frames */
+	guint *keyframes;	/* Positions in the array of the video keyframes, if any */
+	guint keyframes_count;	/* Number of video keyframes */
+	int fd;				/* File descriptor, for frames we can't find in the mapped view */
+	char *map;			/* Memory mapped view of the file, if available */
+	size_t map_len;		/* Size of the memory mapped view */
+	janus_refcount ref;	/* Reference counter */
+} janus_recordplay_frame_index;
+static GHashTable *frame_indexes = NULL;
+static janus_mutex frame_indexes_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_recordplay_frame_index *janus_recordplay_frame_index_get(const char *dir, const char *filename, janus_videocodec vcodec);
+static void janus_recordplay_frame_index_release(janus_recordplay_frame_index *index);
+static void janus_recordplay_frame_index_unref(janus_recordplay_frame_index *index);
+static int janus_recordplay_frame_index_read(janus_recordplay_frame_index *index,
+	janus_recordplay_frame_packet *frame, char *buffer, int size);
+static janus_recordplay_frame_packet *janus_recordplay_frame_index_find(janus_recordplay_frame_index *index,
+	guint64 offset, gboolean keyframe);
+
 typedef struct janus_recordplay_recording {
 	guint64 id;					/* Recording unique ID */
 	char *name;					/* Name of the recording */
@@ -446,6 +516,11 @@ typedef struct janus_recordplay_session {
 	janus_recordplay_frame_packet *aframes;	/* Audio frames (for playout) */
 	janus_recordplay_frame_packet *vframes;	/* Video frames (for playout) */
 	janus_recordplay_frame_packet *dframes;	/* Data packets (for playout) */
+	janus_recordplay_frame_index *aindex;	/* Shared index the audio frames belong to */
+	janus_recordplay_frame_index *vindex;	/* Shared index the video frames belong to */
+	janus_recordplay_frame_index *dindex;	/* Shared index the data packets belong to */
+	volatile gint seek;		/* Position to seek to, in milliseconds, or -1 if none */
+	volatile gint playing;	/* Whether a playout is using the indexes above */
 	gboolean opusred;		/* Whether this user supports RED for audio (for playout) */
 	gboolean textdata;		/* Whether data format is text */
 	guint video_remb_startup;
@@ -479,6 +554,10 @@ static void janus_recordplay_session_free(const janus_refcount *session_ref) {
 	janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
 	g_free(session->video_profile);
+	/* In case a playout was prepared but never started */
+	janus_recordplay_frame_index_release(session->aindex);
+	janus_recordplay_frame_index_release(session->vindex);
+	janus_recordplay_frame_index_release(session->dindex);
 	janus_mutex_destroy(&session->rid_mutex);
 	janus_mutex_destroy(&session->rec_mutex);
 	janus_rtp_simulcasting_cleanup(NULL, NULL, session->rid, NULL);
@@ -510,6 +589,46 @@ static char *recordings_path = NULL;
 void janus_recordplay_update_recordings_list(void);
 static void *janus_recordplay_playout_thread(void *data);
 
+/* Playout state of a viewer: it's advanced either by a thread dedicated to
+ * the viewer, or by one of the shared pacers, if playout_threads is set */
+typedef struct janus_recordplay_playout {
+	janus_recordplay_session *session;	/* Viewer this playout is for */
+	janus_recordplay_recording *rec;	/* Recording that is being played */
+	janus_recordplay_frame_packet *audio, *video, *data;	/* Next frames to send */
+	gboolean astarted, vstarted;		/* Whether we sent the first audio/video frames already */
+	gint64 abefore, vbefore, dbefore;	/* When the last audio/video/data frames were due */
+	int akhz, vkhz;						/* Clock rates of audio and video */
+	janus_rtp_switching_context actx, vctx;	/* Keep sequence numbers and timestamps continuous when seeking */
+	char buffer[1500];					/* Buffer to read frames in */
+	gint64 due;							/* When this playout needs to be advanced again */
+	struct janus_recordplay_playout *next;	/* Next playout in the same pacer slot */
+} janus_recordplay_playout;
+static janus_recordplay_playout *janus_recordplay_playout_create(janus_recordplay_session *session);
+static gint64 janus_recordplay_playout_step(janus_recordplay_playout *playout, gint64 now);
+static void janus_recordplay_playout_destroy(janus_recordplay_playout *playout);
+
+/* Shared pacers: rather than a thread per viewer, a fixed pool of threads
+ * advances all playouts, each using a timer wheel to only look at the
+ * playouts that are due in the current tick */
+#define JANUS_RECORDPLAY_PACER_TICK		2000	/* Microseconds */
+#define JANUS_RECORDPLAY_PACER_SLOTS	512
+#define JANUS_RECORDPLAY_PACER_MAX_WAIT	50000	/* Microseconds, to notice hangups quickly */
+typedef struct janus_recordplay_pacer {
+	guint id;							/* Pacer ID, only used for naming the thread */
+	GThread *thread;					/* Pacer thread */
+	janus_recordplay_playout *wheel[JANUS_RECORDPLAY_PACER_SLOTS];	/* Timer wheel */
+	janus_recordplay_playout *added;	/* Playouts added since the last tick */
+	gint64 tick;						/* Next tick to process */
+	volatile gint playouts;				/* Number of playouts this pacer is handling */
+	volatile gint stop;					/* Whether this pacer should stop */
+	janus_mutex mutex;					/* Mutex for the wheel */
+} janus_recordplay_pacer;
+static int playout_threads = 0;
+static janus_recordplay_pacer *pacers = NULL;
+static int janus_recordplay_pacers_create(void);
+static void janus_recordplay_pacers_destroy(void);
+static void janus_recordplay_pacer_add(janus_recordplay_playout *playout);
+
 /* Helper to send RTCP feedback back to recorders, if needed */
 void janus_recordplay_send_rtcp_feedback(janus_plugin_session *handle, int video, char *buf, int len);
 
@@ -814,6 +933,16 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_RECORDPLAY_NAME);
 		}
+		/* Should viewers be served by a pool of threads, rather than a thread each? */
+		janus_config_item *threads = janus_config_get(config, config_general, janus_config_type_item, "playout_threads");
+		if(threads && threads->value) {
+			int val = atoi(threads->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring playout_threads value as it's not a positive integer\n");
+			} else {
+				playout_threads = val;
+			}
+		}
 		/* Done */
 		janus_config_destroy(config);
 		config = NULL;
@@ -837,9 +966,13 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 
 	sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_recordplay_session_destroy);
 	messages = g_async_queue_new_full((GDestroyNotify) janus_recordplay_message_free);
+	frame_indexes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_recordplay_frame_index_unref);
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	gateway = callback;
 
+	if(playout_threads > 0 && janus_recordplay_pacers_create() < 0)
+		JANUS_LOG(LOG_WARN, "Couldn't create the playout threads, using a thread per viewer\n");
+
 	g_atomic_int_set(&initialized, 1);
 
 	/* Launch the thread that will handle incoming messages */
@@ -850,6 +983,7 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play handler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
+		janus_recordplay_pacers_destroy();
 		return -1;
 	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_RECORDPLAY_NAME);
@@ -866,6 +1000,7 @@ void janus_recordplay_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	janus_recordplay_pacers_destroy();
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -873,6 +1008,10 @@ void janus_recordplay_destroy(void) {
 	g_hash_table_destroy(recordings);
 	recordings = NULL;
 	janus_mutex_unlock(&sessions_mutex);
+	janus_mutex_lock(&frame_indexes_mutex);
+	g_hash_table_destroy(frame_indexes);
+	frame_indexes = NULL;
+	janus_mutex_unlock(&frame_indexes_mutex);
 	g_async_queue_unref(messages);
 	messages = NULL;
 	g_atomic_int_set(&initialized, 0);
@@ -930,6 +1069,7 @@ void janus_recordplay_create_session(janus_plugin_session *handle, int *error) {
 	session->arc = NULL;
 	session->vrc = NULL;
 	session->drc = NULL;
+	g_atomic_int_set(&session->seek, -1);
 	janus_mutex_init(&session->rec_mutex);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
@@ -1120,6 +1260,28 @@ struct janus_plugin_result *janus_recordplay_handle_message(janus_plugin_session
 		json_object_set_new(settings, "video-bitrate-max", json_integer(session->video_bitrate));
 		json_object_set_new(response, "settings", settings);
 		goto plugin_response;
+	} else if(!strcasecmp(request_text, "seek")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, seek_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_RECORDPLAY_ERROR_MISSING_ELEMENT, JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		if(session->recorder || session->recording == NULL || (!session->aframes && !session->vframes)) {
+			JANUS_LOG(LOG_ERR, "Not a playout session, can't seek\n");
+			error_code = JANUS_RECORDPLAY_ERROR_INVALID_STATE;
+			g_snprintf(error_cause, 512, "Not a playout session, can't seek");
+			goto plugin_response;
+		}
+		json_int_t position = json_integer_value(json_object_get(root, "position"));
+		if(position > G_MAXINT)
+			position = G_MAXINT;
+		/* The playout will pick this up the next time it's advanced */
+		g_atomic_int_set(&session->seek, (int)position);
+		response = json_object();
+		json_object_set_new(response, "recordplay", json_string("seek"));
+		json_object_set_new(response, "status", json_string("ok"));
+		json_object_set_new(response, "position", json_integer(position));
+		goto plugin_response;
 	} else if(!strcasecmp(request_text, "record") || !strcasecmp(request_text, "play")
 			|| !strcasecmp(request_text, "start") || !strcasecmp(request_text, "stop")
 			|| !strcasecmp(request_text, "pause") || !strcasecmp(request_text, "resume")) {
@@ -1226,11 +1388,20 @@ void janus_recordplay_setup_media(janus_plugin_session *handle) {
 	g_atomic_int_set(&session->hangingup, 0);
 	/* Take note of the fact that the session is now active */
 	session->active = TRUE;
-	if(!session->recorder) {
+	if(!session->recorder)
+		g_atomic_int_set(&session->playing, 1);
+	if(!session->recorder && pacers != NULL) {
+		/* Have one of the shared pacers take care of this viewer */
+		janus_refcount_increase(&session->ref);
+		janus_recordplay_playout *playout = janus_recordplay_playout_create(session);
+		if(playout != NULL)
+			janus_recordplay_pacer_add(playout);
+	} else if(!session->recorder) {
 		GError *error = NULL;
 		janus_refcount_increase(&session->ref);
 		g_thread_try_new("recordplay playout thread", &janus_recordplay_playout_thread, session, &error);
 		if(error != NULL) {
+			g_atomic_int_set(&session->playing, 0);
 			janus_refcount_decrease(&session->ref);
 			/* FIXME Should we notify this back to the user somehow? */
 			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread...\n",
@@ -1961,23 +2132,43 @@ recdone:
 				g_snprintf(error_cause, 512, "No such recording");
 				goto error;
 			}
-			/* Access the frames */
+			/* The indexes can't be replaced while a playout is still reading from them */
+			if(g_atomic_int_get(&session->playing)) {
+				janus_refcount_decrease(&rec->ref);
+				JANUS_LOG(LOG_ERR, "A playout is already in progress\n");
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_STATE;
+				g_snprintf(error_cause, 512, "A playout is already in progress");
+				goto error;
+			}
+			/* Access the frames (indexes are shared with other viewers of the same files) */
+			janus_recordplay_frame_index_release(session->aindex);
+			janus_recordplay_frame_index_release(session->vindex);
+			janus_recordplay_frame_index_release(session->dindex);
+			session->aindex = NULL;
+			session->vindex = NULL;
+			session->dindex = NULL;
+			session->aframes = NULL;
+			session->vframes = NULL;
+			session->dframes = NULL;
 			if(rec->arc_file) {
-				session->aframes = janus_recordplay_get_frames(recordings_path, rec->arc_file);
+				session->aindex = janus_recordplay_frame_index_get(recordings_path, rec->arc_file, JANUS_VIDEOCODEC_NONE);
+				session->aframes = session->aindex ? session->aindex->frames : NULL;
 				if(session->aframes == NULL) {
 					JANUS_LOG(LOG_WARN, "Error opening audio recording, trying to go on anyway\n");
 					warning = "Broken audio file, playing video only";
 				}
 			}
 			if(rec->vrc_file) {
-				session->vframes = janus_recordplay_get_frames(recordings_path, rec->vrc_file);
+				session->vindex = janus_recordplay_frame_index_get(recordings_path, rec->vrc_file, rec->vcodec);
+				session->vframes = session->vindex ? session->vindex->frames : NULL;
 				if(session->vframes == NULL) {
 					JANUS_LOG(LOG_WARN, "Error opening video recording, trying to go on anyway\n");
 					warning = "Broken video file, playing audio only";
 				}
 			}
 			if(rec->drc_file) {
-				session->dframes = janus_recordplay_get_frames(recordings_path, rec->drc_file);
+				session->dindex = janus_recordplay_frame_index_get(recordings_path, rec->drc_file, JANUS_VIDEOCODEC_NONE);
+				session->dframes = session->dindex ? session->dindex->frames : NULL;
 				if(session->dframes == NULL) {
 					JANUS_LOG(LOG_WARN, "Error opening data recording, trying to go on anyway\n");
 					warning = "Broken data file, playing audio/video only";
@@ -1990,6 +2181,10 @@ recdone:
 			}
 			if(rec->opusred_pt > 0)
 				session->opusred = TRUE;	/* Assume the user does support RED, if it's in the recording */
+			/* Should the playout start from a specific position? */
+			json_t *position = json_object_get(root, "position");
+			json_int_t position_value = position ? json_integer_value(position) : -1;
+			g_atomic_int_set(&session->seek, position_value > G_MAXINT ? G_MAXINT : (int)position_value);
 			session->recording = rec;
 			session->recorder = FALSE;
 			rec->viewers = g_list_append(rec->viewers, session);
@@ -2533,6 +2728,7 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 			/* Generate frame packet and insert in the ordered list */
 			janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
 			p->seq = 0;
+			p->keyframe = FALSE;
 			/* We "abuse" the timestamp field for the timing info */
 			p->ts = when-c_time;
 			p->len = len;
@@ -2561,6 +2757,7 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 		/* Generate frame packet and insert in the ordered list */
 		janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
 		p->seq = ntohs(rtp->seq_number);
+		p->keyframe = FALSE;
 		if(reset == 0) {
 			/* Simple enough... */
 			p->ts = ntohl(rtp->timestamp);
@@ -2665,404 +2862,503 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 	return list;
 }
 
-static void *janus_recordplay_playout_thread(void *sessiondata) {
-	janus_recordplay_session *session = (janus_recordplay_session *)sessiondata;
+static void janus_recordplay_frame_index_free(const janus_refcount *index_ref) {
+	janus_recordplay_frame_index *index = janus_refcount_containerof(index_ref, janus_recordplay_frame_index, ref);
+	JANUS_LOG(LOG_VERB, "Freeing frame index of %s\n", index->path);
+	if(index->map != NULL)
+		munmap(index->map, index->map_len);
+	if(index->fd > -1)
+		close(index->fd);
+	janus_recordplay_frame_packet *tmp = NULL, *frame = index->frames;
+	while(frame) {
+		tmp = frame->next;
+		g_free(frame);
+		frame = tmp;
+	}
+	g_free(index->array);
+	g_free(index->keyframes);
+	g_free(index->path);
+	g_free(index);
+}
+
+static void janus_recordplay_frame_index_unref(janus_recordplay_frame_index *index) {
+	if(index)
+		janus_refcount_decrease(&index->ref);
+}
+
+/* Helper to find out which frames are video keyframes, to seek to them */
+static void janus_recordplay_frame_index_keyframes(janus_recordplay_frame_index *index, janus_videocodec vcodec) {
+	if(index->count == 0)
+		return;
+	/* Prefer the sidecar file written by the recorder, if any, as it
+	 * tells us where the keyframes are without reading the payloads */
+	GArray *offsets = NULL;
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s.idx", index->path);
+	FILE *file = fopen(path, "rb");
+	if(file != NULL) {
+		char prefix[8];
+		if(fread(prefix, sizeof(char), sizeof(prefix), file) == sizeof(prefix) &&
+				!memcmp(prefix, JANUS_RECORDER_INDEX_HEADER, sizeof(prefix))) {
+			offsets = g_array_new(FALSE, FALSE, sizeof(gint64));
+			janus_recorder_index_entry entry;
+			while(fread(&entry, sizeof(entry), 1, file) == 1) {
+				if(!(ntohl(entry.flags) & JANUS_RECORDER_INDEX_KEYFRAME))
+					continue;
+				/* The entry points to the frame header, while we have the offset of the packet */
+				gint64 offset = (gint64)ntohll(entry.offset) + 10;
+				g_array_append_val(offsets, offset);
+			}
+		} else {
+			JANUS_LOG(LOG_WARN, "Invalid index file %s, ignoring\n", path);
+		}
+		fclose(file);
+	}
+	guint i = 0;
+	if(offsets != NULL) {
+		/* Entries are sorted by offset, as that's the order the recorder wrote them in */
+		JANUS_LOG(LOG_VERB, "Index file %s has %u keyframes\n", path, offsets->len);
+		for(i=0; i<index->count; i++) {
+			gint64 offset = index->array[i]->offset;
+			guint low = 0, high = offsets->len;
+			while(low < high) {
+				guint middle = low + (high - low)/2;
+				if(g_array_index(offsets, gint64, middle) < offset)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			index->array[i]->keyframe = (low < offsets->len && g_array_index(offsets, gint64, low) == offset);
+		}
+		g_array_free(offsets, TRUE);
+	} else if(vcodec != JANUS_VIDEOCODEC_NONE) {
+		/* No sidecar file, check the payloads ourselves */
+		char buffer[1500];
+		int bytes = 0, plen = 0;
+		for(i=0; i<index->count; i++) {
+			bytes = janus_recordplay_frame_index_read(index, index->array[i], buffer, sizeof(buffer));
+			char *payload = bytes > 0 ? janus_rtp_payload(buffer, bytes, &plen) : NULL;
+			if(payload == NULL || plen < 1)
+				continue;
+			if(vcodec == JANUS_VIDEOCODEC_VP8)
+				index->array[i]->keyframe = janus_vp8_is_keyframe(payload, plen);
+			else if(vcodec == JANUS_VIDEOCODEC_VP9)
+				index->array[i]->keyframe = janus_vp9_is_keyframe(payload, plen);
+			else if(vcodec == JANUS_VIDEOCODEC_H264)
+				index->array[i]->keyframe = janus_h264_is_keyframe(payload, plen);
+			else if(vcodec == JANUS_VIDEOCODEC_AV1)
+				index->array[i]->keyframe = janus_av1_is_keyframe(payload, plen);
+			else if(vcodec == JANUS_VIDEOCODEC_H265)
+				index->array[i]->keyframe = janus_h265_is_keyframe(payload, plen);
+		}
+	} else {
+		return;
+	}
+	/* Keep track of where each keyframe starts: there may be more packets with the same timestamp */
+	GArray *keyframes = g_array_new(FALSE, FALSE, sizeof(guint));
+	for(i=0; i<index->count; i++) {
+		if(!index->array[i]->keyframe)
+			continue;
+		guint first = i;
+		while(first > 0 && index->array[first-1]->ts == index->array[i]->ts)
+			first--;
+		if(keyframes->len == 0 || g_array_index(keyframes, guint, keyframes->len-1) != first)
+			g_array_append_val(keyframes, first);
+	}
+	index->keyframes_count = keyframes->len;
+	index->keyframes = (guint *)g_array_free(keyframes, FALSE);
+	JANUS_LOG(LOG_VERB, "Found %u keyframes in %s\n", index->keyframes_count, index->path);
+}
+
+static janus_recordplay_frame_index *janus_recordplay_frame_index_get(const char *dir, const char *filename, janus_videocodec vcodec) {
+	if(!dir || !filename)
+		return NULL;
+	char source[1024];
+	if(strstr(filename, ".mjr"))
+		g_snprintf(source, 1024, "%s/%s", dir, filename);
+	else
+		g_snprintf(source, 1024, "%s/%s.mjr", dir, filename);
+	struct stat st;
+	if(stat(source, &st) < 0) {
+		JANUS_LOG(LOG_ERR, "Could not access file %s: %d (%s)\n", source, errno, g_strerror(errno));
+		return NULL;
+	}
+	/* Do we have an index for this file already? */
+	janus_mutex_lock(&frame_indexes_mutex);
+	janus_recordplay_frame_index *index = frame_indexes ? g_hash_table_lookup(frame_indexes, source) : NULL;
+	if(index != NULL && index->mtime == st.st_mtime && index->size == st.st_size) {
+		janus_refcount_increase(&index->ref);
+		janus_mutex_unlock(&frame_indexes_mutex);
+		JANUS_LOG(LOG_VERB, "Reusing frame index of %s\n", source);
+		return index;
+	}
+	janus_mutex_unlock(&frame_indexes_mutex);
+	/* Not indexed yet, or the file changed in the meanwhile: parse it */
+	janus_recordplay_frame_packet *frames = janus_recordplay_get_frames(dir, filename);
+	if(frames == NULL)
+		return NULL;
+	int fd = open(source, O_RDONLY);
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s: %d (%s)\n", source, errno, g_strerror(errno));
+		janus_recordplay_frame_packet *tmp = NULL;
+		while(frames) {
+			tmp = frames->next;
+			g_free(frames);
+			frames = tmp;
+		}
+		return NULL;
+	}
+	index = g_malloc0(sizeof(janus_recordplay_frame_index));
+	index->path = g_strdup(source);
+	index->mtime = st.st_mtime;
+	index->size = st.st_size;
+	index->frames = frames;
+	index->fd = fd;
+	if(st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED) {
+			JANUS_LOG(LOG_WARN, "Could not map file %s in memory, frames will be read from the file: %d (%s)\n",
+				source, errno, g_strerror(errno));
+		} else {
+			index->map = map;
+			index->map_len = st.st_size;
+		}
+	}
+	/* Prepare an array of the frames, to seek in them */
+	janus_recordplay_frame_packet *frame = frames;
+	while(frame) {
+		index->count++;
+		frame = frame->next;
+	}
+	index->array = g_malloc(index->count * sizeof(janus_recordplay_frame_packet *));
+	guint i = 0;
+	for(frame = frames; frame != NULL; frame = frame->next)
+		index->array[i++] = frame;
+	janus_recordplay_frame_index_keyframes(index, vcodec);
+	janus_refcount_init(&index->ref, janus_recordplay_frame_index_free);
+	/* Share the index with other viewers: the table has its own reference */
+	janus_mutex_lock(&frame_indexes_mutex);
+	if(frame_indexes != NULL) {
+		janus_refcount_increase(&index->ref);
+		g_hash_table_replace(frame_indexes, index->path, index);
+	}
+	janus_mutex_unlock(&frame_indexes_mutex);
+	return index;
+}
+
+static void janus_recordplay_frame_index_release(janus_recordplay_frame_index *index) {
+	if(index == NULL)
+		return;
+	janus_mutex_lock(&frame_indexes_mutex);
+	/* If we're the last viewer using this index, get rid of it */
+	if(frame_indexes != NULL && g_atomic_int_get(&index->ref.count) == 2 &&
+			g_hash_table_lookup(frame_indexes, index->path) == index)
+		g_hash_table_remove(frame_indexes, index->path);
+	janus_refcount_decrease(&index->ref);
+	janus_mutex_unlock(&frame_indexes_mutex);
+}
+
+static int janus_recordplay_frame_index_read(janus_recordplay_frame_index *index,
+		janus_recordplay_frame_packet *frame, char *buffer, int size) {
+	if(index == NULL || frame == NULL || buffer == NULL || size < 1)
+		return -1;
+	int len = frame->len;
+	if(len > size) {
+		JANUS_LOG(LOG_WARN, "Frame is too large (%d > %d), truncating...\n", len, size);
+		len = size;
+	}
+	if(index->map != NULL && frame->offset >= 0 && (size_t)frame->offset + len <= index->map_len) {
+		/* Touching pages past the end of the file would get us a SIGBUS,
+		 * so make sure the file wasn't truncated since we mapped it */
+		struct stat st;
+		if(fstat(index->fd, &st) == 0 && frame->offset + len <= st.st_size) {
+			memcpy(buffer, index->map + frame->offset, len);
+			return len;
+		}
+	}
+	/* Not in the mapped view, read from the file */
+	ssize_t bytes = pread(index->fd, buffer, len, frame->offset);
+	return bytes < 0 ? -1 : (int)bytes;
+}
+
+static janus_recordplay_frame_packet *janus_recordplay_frame_index_find(janus_recordplay_frame_index *index,
+		guint64 offset, gboolean keyframe) {
+	/* The offset is in timestamp units, relative to the first frame */
+	if(index == NULL || index->count == 0)
+		return NULL;
+	guint64 target = index->array[0]->ts + offset;
+	guint low = 0, high = 0, middle = 0;
+	if(keyframe && index->keyframes_count > 0) {
+		/* Look for the last keyframe before the target (or the first one, if there's none) */
+		guint found = 0;
+		high = index->keyframes_count;
+		while(low < high) {
+			middle = low + (high - low)/2;
+			if(index->array[index->keyframes[middle]]->ts <= target) {
+				found = middle;
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		return index->array[index->keyframes[found]];
+	}
+	/* Look for the first frame at or after the target */
+	high = index->count;
+	while(low < high) {
+		middle = low + (high - low)/2;
+		if(index->array[middle]->ts < target)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low < index->count ? index->array[low] : NULL;
+}
+
+static janus_recordplay_playout *janus_recordplay_playout_create(janus_recordplay_session *session) {
+	/* Note: we take ownership of the session reference the caller added */
 	if(!session) {
-		JANUS_LOG(LOG_ERR, "Invalid session, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
+		JANUS_LOG(LOG_ERR, "Invalid session, can't start playout...\n");
 		return NULL;
 	}
 	if(!session->recording) {
+		g_atomic_int_set(&session->playing, 0);
 		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "No recording object, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
+		JANUS_LOG(LOG_ERR, "No recording object, can't start playout...\n");
 		return NULL;
 	}
-	janus_refcount_increase(&session->recording->ref);
-	janus_recordplay_recording *rec = session->recording;
 	if(session->recorder) {
-		janus_refcount_decrease(&rec->ref);
+		g_atomic_int_set(&session->playing, 0);
 		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
+		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout...\n");
 		return NULL;
 	}
 	if(!session->aframes && !session->vframes) {
-		janus_refcount_decrease(&rec->ref);
+		g_atomic_int_set(&session->playing, 0);
 		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
+		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout...\n");
 		return NULL;
 	}
-	JANUS_LOG(LOG_VERB, "Joining playout thread\n");
-	/* Open the files */
-	FILE *afile = NULL, *vfile = NULL, *dfile = NULL;
-	if(session->aframes) {
-		if(rec->arc_file == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "The recording session contains some audio packets but seems to lack a recording file name\n");
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-		char source[1024];
-		if(strstr(rec->arc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->arc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->arc_file);
-		afile = fopen(source, "rb");
-		if(afile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open audio file %s, can't start playout thread...\n", source);
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+	janus_recordplay_recording *rec = session->recording;
+	if((session->aframes && rec->arc_file == NULL) || (session->vframes && rec->vrc_file == NULL) ||
+			(session->dframes && rec->drc_file == NULL)) {
+		g_atomic_int_set(&session->playing, 0);
+		janus_refcount_decrease(&session->ref);
+		JANUS_LOG(LOG_ERR, "The recording session contains some packets but seems to lack a recording file name\n");
+		return NULL;
 	}
-	if(session->vframes) {
-		if(rec->vrc_file == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "The recording session contains some video packets but seems to lack a recording file name\n");
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-		char source[1024];
-		if(strstr(rec->vrc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->vrc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->vrc_file);
-		vfile = fopen(source, "rb");
-		if(vfile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open video file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
+	janus_refcount_increase(&rec->ref);
+	janus_recordplay_playout *playout = g_malloc0(sizeof(janus_recordplay_playout));
+	playout->session = session;
+	playout->rec = rec;
+	playout->audio = session->aframes;
+	playout->video = session->vframes;
+	playout->data = session->dframes;
+	playout->akhz = 48;
+	if(rec->audio_pt == 0 || rec->audio_pt == 8 || rec->audio_pt == 9)
+		playout->akhz = 8;
+	playout->vkhz = 90;
+	janus_rtp_switching_context_reset(&playout->actx);
+	janus_rtp_switching_context_reset(&playout->vctx);
+	gint64 now = janus_get_monotonic_time();
+	playout->abefore = now;
+	playout->vbefore = now;
+	playout->dbefore = now;
+	playout->due = now;
+	return playout;
+}
+
+/* Helper to read a frame and send it to the viewer */
+static void janus_recordplay_playout_send(janus_recordplay_playout *playout, janus_recordplay_frame_packet *frame, gboolean video) {
+	janus_recordplay_session *session = playout->session;
+	janus_recordplay_recording *rec = playout->rec;
+	char *buffer = playout->buffer;
+	int bytes = janus_recordplay_frame_index_read(video ? session->vindex : session->aindex,
+		frame, buffer, sizeof(playout->buffer));
+	if(bytes != frame->len)
+		JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, frame->len);
+	if(bytes < (int)sizeof(janus_rtp_header))
+		return;
+	/* Update payload type */
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	if(video) {
+		rtp->type = rec->video_pt;
+	} else {
+		if(rec->opusred_pt == 0 || rtp->type != rec->opusred_pt)
+			rtp->type = rec->audio_pt;
+		/* If the recording contains RED but the user doesn't support it, only use the primary data */
+		if(rec->opusred_pt > 0 && rtp->type == rec->opusred_pt && !session->opusred) {
+			int plen = 0;
+			char *payload = janus_rtp_payload(buffer, bytes, &plen);
+			if(payload && plen > 0) {
+				GList *blocks = janus_red_parse_blocks(payload, plen);
+				if(blocks != NULL) {
+					/* Copy the last block (primary data) to the RTP payload */
+					GList *last = g_list_last(blocks);
+					janus_red_block *rb = (janus_red_block *)(last ? last->data : NULL);
+					if(rb && rb->data && rb->length > 0) {
+						rtp->type = rec->audio_pt;
+						bytes -= (plen - rb->length);
+						memmove(payload, rb->data, rb->length);
+					}
+					g_list_free_full(blocks, (GDestroyNotify)g_free);
+				}
+			}
 		}
 	}
+	janus_rtp_header_update(rtp, video ? &playout->vctx : &playout->actx, video, 0);
+	janus_plugin_rtp prtp = { .mindex = -1, .video = video, .buffer = buffer, .length = bytes };
+	janus_plugin_rtp_extensions_reset(&prtp.extensions);
+	gateway->relay_rtp(session->handle, &prtp);
+}
 
-	if(session->dframes) {
-		if(rec->drc_file == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "The recording session contains some data packets but seems to lack a recording file name\n");
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			if(vfile)
-				fclose(vfile);
-			vfile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-		char source[1024];
-		if(strstr(rec->drc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->drc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->drc_file);
-		dfile = fopen(source, "rb");
-		if(dfile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open data file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			if(vfile)
-				fclose(vfile);
-			vfile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
+/* Helper to move a playout to a different position, in milliseconds */
+static void janus_recordplay_playout_seek(janus_recordplay_playout *playout, guint64 position, gint64 now) {
+	janus_recordplay_session *session = playout->session;
+	if(session->vframes != NULL) {
+		/* Start from the closest keyframe, and keep audio and data in sync with it */
+		playout->video = janus_recordplay_frame_index_find(session->vindex, position*playout->vkhz, TRUE);
+		if(playout->video != NULL)
+			position = (playout->video->ts - session->vframes->ts)/playout->vkhz;
+	}
+	if(session->aframes != NULL)
+		playout->audio = janus_recordplay_frame_index_find(session->aindex, position*playout->akhz, FALSE);
+	if(session->dframes != NULL) {
+		playout->data = janus_recordplay_frame_index_find(session->dindex, position*1000, FALSE);
+		if(playout->data != NULL) {
+			/* Data is paced using the distance from the previous packet */
+			uint64_t prev_ts = playout->data->prev ? playout->data->prev->ts : 0;
+			playout->dbefore = now + (gint64)prev_ts - (gint64)(session->dframes->ts + position*1000);
 		}
 	}
-	/* Timer */
-	gboolean asent = FALSE, vsent = FALSE, dsent = FALSE;
-	struct timeval now, abefore, vbefore, dbefore;
-	time_t d_s, d_us;
-	gettimeofday(&now, NULL);
-	gettimeofday(&abefore, NULL);
-	gettimeofday(&vbefore, NULL);
-	gettimeofday(&dbefore, NULL);
+	/* Send the first frames right away, and rewrite the RTP headers so
+	 * that the viewer doesn't see a gap in sequence numbers and timestamps */
+	playout->astarted = FALSE;
+	playout->vstarted = FALSE;
+	playout->actx.seq_reset = TRUE;
+	playout->actx.ts_reset = TRUE;
+	playout->vctx.seq_reset = TRUE;
+	playout->vctx.ts_reset = TRUE;
+	JANUS_LOG(LOG_VERB, "[%p] Playout moved to %"SCNu64"ms\n", session, position);
+}
 
-	janus_recordplay_frame_packet *audio = session->aframes, *video = session->vframes, *data = session->dframes;
-	char *buffer = g_malloc0(1500);
-	int bytes = 0;
-	int64_t ts_diff = 0, passed = 0;
-
-	int audio_pt = session->recording->audio_pt;
-	int video_pt = session->recording->video_pt;
-
-	int akhz = 48;
-	if(audio_pt == 0 || audio_pt == 8 || audio_pt == 9)
-		akhz = 8;
-	int vkhz = 90;
-
-	while(!g_atomic_int_get(&session->destroyed) && session->active
-			&& !g_atomic_int_get(&rec->destroyed) && (audio || video)) {
-		if(!asent && !vsent && !dsent) {
-			/* We skipped the last round, so sleep a bit (5ms) */
-			g_usleep(5000);
-		}
-		asent = FALSE;
-		vsent = FALSE;
-		dsent = FALSE;
-		if(audio) {
-			if(audio == session->aframes) {
-				/* First packet, send now */
-				fseek(afile, audio->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), audio->len, afile);
-				if(bytes != audio->len)
-					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-				/* Update payload type */
-				janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-				if(rec->opusred_pt == 0 || rtp->type != rec->opusred_pt)
-					rtp->type = audio_pt;
-				/* If the recording contains RED but the user doesn't support it, only use the primary data */
-				if(rec->opusred_pt > 0 && rtp->type == rec->opusred_pt && !session->opusred) {
-					int plen = 0;
-					char *payload = janus_rtp_payload(buffer, bytes, &plen);
-					if(payload && plen > 0) {
-						GList *blocks = janus_red_parse_blocks(payload, plen);
-						if(blocks != NULL) {
-							/* Copy the last block (primary data) to the RTP payload */
-							GList *last = g_list_last(blocks);
-							janus_red_block *rb = (janus_red_block *)(last ? last->data : NULL);
-							if(rb && rb->data && rb->length > 0) {
-								rtp->type = audio_pt;
-								bytes -= (plen - rb->length);
-								memmove(payload, rb->data, rb->length);
-							}
-							g_list_free_full(blocks, (GDestroyNotify)g_free);
-						}
-					}
-				}
-				janus_plugin_rtp prtp = { .mindex = -1, .video = FALSE, .buffer = (char *)buffer, .length = bytes };
-				janus_plugin_rtp_extensions_reset(&prtp.extensions);
-				gateway->relay_rtp(session->handle, &prtp);
-				gettimeofday(&now, NULL);
-				abefore.tv_sec = now.tv_sec;
-				abefore.tv_usec = now.tv_usec;
-				asent = TRUE;
-				audio = audio->next;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = audio->ts - audio->prev->ts;
-				ts_diff = (ts_diff*1000)/akhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - abefore.tv_sec;
-				d_us = now.tv_usec - abefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					asent = FALSE;
-				} else {
-					/* Update the reference time */
-					abefore.tv_usec += ts_diff%1000000;
-					if(abefore.tv_usec > 1000000) {
-						abefore.tv_sec++;
-						abefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						abefore.tv_sec += ts_diff/1000000;
-						abefore.tv_usec -= ts_diff/1000000;
-					}
-					/* Send now */
-					fseek(afile, audio->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), audio->len, afile);
-					if(bytes != audio->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					if(rec->opusred_pt == 0 || rtp->type != rec->opusred_pt)
-						rtp->type = audio_pt;
-					/* If the recording contains RED but the user doesn't support it, only use the primary data */
-					if(rec->opusred_pt > 0 && rtp->type == rec->opusred_pt && !session->opusred) {
-						int plen = 0;
-						char *payload = janus_rtp_payload(buffer, bytes, &plen);
-						if(payload && plen > 0) {
-							GList *blocks = janus_red_parse_blocks(payload, plen);
-							if(blocks != NULL) {
-								/* Copy the last block (primary data) to the RTP payload */
-								GList *last = g_list_last(blocks);
-								janus_red_block *rb = (janus_red_block *)(last ? last->data : NULL);
-								if(rb && rb->data && rb->length > 0) {
-									rtp->type = audio_pt;
-									bytes -= (plen - rb->length);
-									memmove(payload, rb->data, rb->length);
-								}
-								g_list_free_full(blocks, (GDestroyNotify)g_free);
-							}
-						}
-					}
-					janus_plugin_rtp prtp = { .mindex = -1, .video = FALSE, .buffer = (char *)buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&prtp.extensions);
-					gateway->relay_rtp(session->handle, &prtp);
-					asent = TRUE;
-					audio = audio->next;
-				}
-			}
+static gint64 janus_recordplay_playout_step(janus_recordplay_playout *playout, gint64 now) {
+	janus_recordplay_session *session = playout->session;
+	janus_recordplay_recording *rec = playout->rec;
+	if(g_atomic_int_get(&session->destroyed) || !session->active || g_atomic_int_get(&rec->destroyed))
+		return -1;
+	/* Did the viewer ask to move to a different position? */
+	int position = g_atomic_int_get(&session->seek);
+	if(position >= 0 && g_atomic_int_compare_and_exchange(&session->seek, position, -1))
+		janus_recordplay_playout_seek(playout, position, now);
+	if(!playout->audio && !playout->video)
+		return -1;
+	gint64 due = -1, ts_diff = 0;
+	/* Send all the audio frames that are due */
+	while(playout->audio) {
+		janus_recordplay_frame_packet *audio = playout->audio;
+		if(!playout->astarted) {
+			/* First packet, send now */
+			janus_recordplay_playout_send(playout, audio, FALSE);
+			playout->abefore = now;
+			playout->astarted = TRUE;
+			playout->audio = audio->next;
+			continue;
 		}
-		if(video) {
-			if(video == session->vframes) {
-				/* First packets: there may be many of them with the same timestamp, send them all */
-				uint64_t ts = video->ts;
-				while(video && video->ts == ts) {
-					fseek(vfile, video->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), video->len, vfile);
-					if(bytes != video->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					rtp->type = video_pt;
-					janus_plugin_rtp prtp = { .mindex = -1, .video = TRUE, .buffer = (char *)buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&prtp.extensions);
-					gateway->relay_rtp(session->handle, &prtp);
-					video = video->next;
-				}
-				vsent = TRUE;
-				gettimeofday(&now, NULL);
-				vbefore.tv_sec = now.tv_sec;
-				vbefore.tv_usec = now.tv_usec;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = video->ts - video->prev->ts;
-				ts_diff = (ts_diff*1000)/vkhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - vbefore.tv_sec;
-				d_us = now.tv_usec - vbefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					vsent = FALSE;
-				} else {
-					/* Update the reference time */
-					vbefore.tv_usec += ts_diff%1000000;
-					if(vbefore.tv_usec > 1000000) {
-						vbefore.tv_sec++;
-						vbefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						vbefore.tv_sec += ts_diff/1000000;
-						vbefore.tv_usec -= ts_diff/1000000;
-					}
-					/* There may be multiple packets with the same timestamp, send them all */
-					uint64_t ts = video->ts;
-					while(video && video->ts == ts) {
-						/* Send now */
-						fseek(vfile, video->offset, SEEK_SET);
-						bytes = fread(buffer, sizeof(char), video->len, vfile);
-						if(bytes != video->len)
-							JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-						/* Update payload type */
-						janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-						rtp->type = video_pt;
-						janus_plugin_rtp prtp = { .mindex = -1, .video = TRUE, .buffer = (char *)buffer, .length = bytes };
-						janus_plugin_rtp_extensions_reset(&prtp.extensions);
-						gateway->relay_rtp(session->handle, &prtp);
-						video = video->next;
-					}
-					vsent = TRUE;
-				}
-			}
+		/* What's the timestamp skip from the previous packet? */
+		ts_diff = (gint64)(audio->ts - audio->prev->ts);
+		ts_diff = (ts_diff*1000)/playout->akhz;
+		/* Check if it's time to send */
+		if(now - playout->abefore < ts_diff - 5000) {
+			due = playout->abefore + ts_diff - 5000;
+			break;
 		}
-		if(data) {
-			u_int64_t prev_ts = 0; /* All timestamps for data are indexed to 0, since when parsing ts = when - c_time */
-			if(data->prev)
-				prev_ts = data->prev->ts;
-			ts_diff = data->ts - prev_ts;
-
+		/* Update the reference time and send now */
+		playout->abefore += ts_diff;
+		janus_recordplay_playout_send(playout, audio, FALSE);
+		playout->audio = audio->next;
+	}
+	/* Send all the video frames that are due: there may be many of them with the same timestamp */
+	while(playout->video) {
+		janus_recordplay_frame_packet *video = playout->video;
+		if(!playout->vstarted) {
+			playout->vbefore = now;
+			playout->vstarted = TRUE;
+		} else {
+			/* What's the timestamp skip from the previous packet? */
+			ts_diff = (gint64)(video->ts - video->prev->ts);
+			ts_diff = (ts_diff*1000)/playout->vkhz;
 			/* Check if it's time to send */
-			gettimeofday(&now, NULL);
-			d_s = now.tv_sec - dbefore.tv_sec;
-			d_us = now.tv_usec - dbefore.tv_usec;
-			if(d_us < 0) {
-				d_us += 1000000;
-				--d_s;
-			}
-			passed = d_s*1000000 + d_us;
-			if(passed < (ts_diff-5000)) {
-				dsent = FALSE;
-			} else {
-				/* Update the reference time */
-				dbefore.tv_usec += ts_diff%1000000;
-				if(dbefore.tv_usec > 1000000) {
-					dbefore.tv_sec++;
-					dbefore.tv_usec -= 1000000;
-				}
-				if(ts_diff/1000000 > 0) {
-					dbefore.tv_sec += ts_diff/1000000;
-					dbefore.tv_usec -= ts_diff/1000000;
-				}
-				/* Read data packet */
-				fseek(dfile, data->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), data->len, dfile);
-				if(bytes != data->len)
-					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, data->len);
-				/* Update payload type */
-				janus_plugin_data datapacket = {
-					.label = NULL,
-					.protocol = NULL,
-					.binary = rec->textdata ? FALSE : TRUE,
-					.buffer = (char *)buffer,
-					.length = bytes
-				};
-				gateway->relay_data(session->handle, &datapacket);
-				dsent = TRUE;
-				data = data->next;
+			if(now - playout->vbefore < ts_diff - 5000) {
+				gint64 vdue = playout->vbefore + ts_diff - 5000;
+				if(due < 0 || vdue < due)
+					due = vdue;
+				break;
 			}
+			/* Update the reference time */
+			playout->vbefore += ts_diff;
+		}
+		uint64_t ts = video->ts;
+		while(video && video->ts == ts) {
+			janus_recordplay_playout_send(playout, video, TRUE);
+			video = video->next;
+		}
+		playout->video = video;
+	}
+	/* Send all the data packets that are due */
+	while(playout->data) {
+		janus_recordplay_frame_packet *data = playout->data;
+		uint64_t prev_ts = 0; /* All timestamps for data are indexed to 0, since when parsing ts = when - c_time */
+		if(data->prev)
+			prev_ts = data->prev->ts;
+		ts_diff = (gint64)(data->ts - prev_ts);
+		/* Check if it's time to send */
+		if(now - playout->dbefore < ts_diff - 5000) {
+			gint64 ddue = playout->dbefore + ts_diff - 5000;
+			if(due < 0 || ddue < due)
+				due = ddue;
+			break;
 		}
+		/* Update the reference time */
+		playout->dbefore += ts_diff;
+		/* Read data packet */
+		int bytes = janus_recordplay_frame_index_read(session->dindex, data, playout->buffer, sizeof(playout->buffer));
+		if(bytes != data->len)
+			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, data->len);
+		if(bytes > 0) {
+			janus_plugin_data datapacket = {
+				.label = NULL,
+				.protocol = NULL,
+				.binary = rec->textdata ? FALSE : TRUE,
+				.buffer = playout->buffer,
+				.length = bytes
+			};
+			gateway->relay_data(session->handle, &datapacket);
+		}
+		playout->data = data->next;
 	}
+	if(!playout->audio && !playout->video)
+		return -1;
+	return due;
+}
 
-	g_free(buffer);
+static void janus_recordplay_playout_destroy(janus_recordplay_playout *playout) {
+	if(playout == NULL)
+		return;
+	janus_recordplay_session *session = playout->session;
+	janus_recordplay_recording *rec = playout->rec;
 
-	/* Get rid of the indexes */
-	janus_recordplay_frame_packet *tmp = NULL;
-	audio = session->aframes;
-	while(audio) {
-		tmp = audio->next;
-		g_free(audio);
-		audio = tmp;
-	}
+	/* Get rid of the indexes (other viewers may still be using them) */
 	session->aframes = NULL;
-	video = session->vframes;
-	while(video) {
-		tmp = video->next;
-		g_free(video);
-		video = tmp;
-	}
 	session->vframes = NULL;
-	data = session->dframes;
-	while(data) {
-		tmp = data->next;
-		g_free(data);
-		data = tmp;
-	}
 	session->dframes = NULL;
-
-	if(afile)
-		fclose(afile);
-	afile = NULL;
-	if(vfile)
-		fclose(vfile);
-	vfile = NULL;
-	if(dfile)
-		fclose(dfile);
-	dfile = NULL;
+	janus_recordplay_frame_index_release(session->aindex);
+	janus_recordplay_frame_index_release(session->vindex);
+	janus_recordplay_frame_index_release(session->dindex);
+	session->aindex = NULL;
+	session->vindex = NULL;
+	session->dindex = NULL;
+	g_atomic_int_set(&session->playing, 0);
 
 	/* Remove from the list of viewers */
 	janus_mutex_lock(&rec->mutex);
@@ -3074,8 +3370,192 @@ static void *janus_recordplay_playout_thread(void *sessiondata) {
 
 	janus_refcount_decrease(&rec->ref);
 	janus_refcount_decrease(&session->ref);
+	g_free(playout);
+}
+
+static void *janus_recordplay_playout_thread(void *sessiondata) {
+	janus_recordplay_session *session = (janus_recordplay_session *)sessiondata;
+	janus_recordplay_playout *playout = janus_recordplay_playout_create(session);
+	if(playout == NULL) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "Joining playout thread\n");
+	/* Stick to the same CPU as the session's event loop, if pinned */
+	gateway->inherit_affinity(session->handle);
+
+	gint64 now = 0, due = 0;
+	while((due = janus_recordplay_playout_step(playout, (now = janus_get_monotonic_time()))) >= 0) {
+		/* Nothing else to send right now, so sleep a bit (5ms at most) */
+		if(due > now)
+			g_usleep(MIN(due - now, 5000));
+	}
+	janus_recordplay_playout_destroy(playout);
 
 	JANUS_LOG(LOG_VERB, "Leaving playout thread\n");
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
+
+/* Shared pacers */
+static void janus_recordplay_pacer_schedule(janus_recordplay_pacer *pacer, janus_recordplay_playout *playout) {
+	/* Note: must be called with the pacer mutex locked */
+	gint64 tick = playout->due / JANUS_RECORDPLAY_PACER_TICK;
+	if(tick < pacer->tick)
+		tick = pacer->tick;
+	int slot = tick % JANUS_RECORDPLAY_PACER_SLOTS;
+	playout->next = pacer->wheel[slot];
+	pacer->wheel[slot] = playout;
+}
+
+static void *janus_recordplay_pacer_thread(void *data) {
+	janus_recordplay_pacer *pacer = (janus_recordplay_pacer *)data;
+	JANUS_LOG(LOG_VERB, "[pacer %u] Joining Record&Play playout thread\n", pacer->id);
+	janus_recordplay_playout *ready = NULL, *later = NULL, *playout = NULL, *next = NULL;
+	gint64 now = 0, current = 0, due = 0;
+	janus_mutex_lock(&pacer->mutex);
+	pacer->tick = janus_get_monotonic_time() / JANUS_RECORDPLAY_PACER_TICK;
+	janus_mutex_unlock(&pacer->mutex);
+	while(!g_atomic_int_get(&pacer->stop)) {
+		now = janus_get_monotonic_time();
+		current = now / JANUS_RECORDPLAY_PACER_TICK;
+		ready = NULL;
+		janus_mutex_lock(&pacer->mutex);
+		/* New playouts are advanced right away */
+		ready = pacer->added;
+		pacer->added = NULL;
+		/* Collect the playouts in all the slots we went past: if we fell
+		 * behind by more than a full lap, looking at each slot once is enough */
+		if(current - pacer->tick >= JANUS_RECORDPLAY_PACER_SLOTS)
+			pacer->tick = current - JANUS_RECORDPLAY_PACER_SLOTS + 1;
+		while(pacer->tick <= current) {
+			int slot = pacer->tick % JANUS_RECORDPLAY_PACER_SLOTS;
+			playout = pacer->wheel[slot];
+			pacer->wheel[slot] = NULL;
+			while(playout) {
+				next = playout->next;
+				if(playout->due / JANUS_RECORDPLAY_PACER_TICK <= current) {
+					playout->next = ready;
+					ready = playout;
+				} else {
+					/* Due in a later lap */
+					playout->next = pacer->wheel[slot];
+					pacer->wheel[slot] = playout;
+				}
+				playout = next;
+			}
+			pacer->tick++;
+		}
+		janus_mutex_unlock(&pacer->mutex);
+		/* Advance the playouts that are due */
+		later = NULL;
+		playout = ready;
+		while(playout) {
+			next = playout->next;
+			due = janus_recordplay_playout_step(playout, now);
+			if(due < 0) {
+				/* Done */
+				janus_recordplay_playout_destroy(playout);
+				g_atomic_int_add(&pacer->playouts, -1);
+			} else {
+				/* Check again when due, but often enough to notice hangups */
+				playout->due = MIN(due, now + JANUS_RECORDPLAY_PACER_MAX_WAIT);
+				playout->next = later;
+				later = playout;
+			}
+			playout = next;
+		}
+		if(later != NULL) {
+			janus_mutex_lock(&pacer->mutex);
+			playout = later;
+			while(playout) {
+				next = playout->next;
+				janus_recordplay_pacer_schedule(pacer, playout);
+				playout = next;
+			}
+			janus_mutex_unlock(&pacer->mutex);
+		}
+		/* Sleep until the next tick */
+		due = pacer->tick * JANUS_RECORDPLAY_PACER_TICK - janus_get_monotonic_time();
+		if(due > 0)
+			g_usleep(due);
+	}
+	JANUS_LOG(LOG_VERB, "[pacer %u] Leaving Record&Play playout thread\n", pacer->id);
+	return NULL;
+}
+
+static int janus_recordplay_pacers_create(void) {
+	if(playout_threads < 1)
+		return -1;
+	pacers = g_malloc0(playout_threads * sizeof(janus_recordplay_pacer));
+	int i = 0;
+	for(i=0; i<playout_threads; i++) {
+		janus_recordplay_pacer *pacer = &pacers[i];
+		pacer->id = i+1;
+		janus_mutex_init(&pacer->mutex);
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "rplay pacer %d", i+1);
+		GError *error = NULL;
+		pacer->thread = g_thread_try_new(tname, &janus_recordplay_pacer_thread, pacer, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread #%d...\n",
+				error->code, error->message ? error->message : "??", i+1);
+			g_error_free(error);
+			janus_recordplay_pacers_destroy();
+			return -1;
+		}
+	}
+	JANUS_LOG(LOG_INFO, "Record&Play playouts will be served by %d threads\n", playout_threads);
+	return 0;
+}
+
+static void janus_recordplay_pacers_destroy(void) {
+	if(pacers == NULL)
+		return;
+	int i = 0, j = 0;
+	for(i=0; i<playout_threads; i++)
+		g_atomic_int_set(&pacers[i].stop, 1);
+	for(i=0; i<playout_threads; i++) {
+		janus_recordplay_pacer *pacer = &pacers[i];
+		if(pacer->thread != NULL)
+			g_thread_join(pacer->thread);
+		pacer->thread = NULL;
+		/* Get rid of the playouts that were still in progress */
+		janus_recordplay_playout *playout = pacer->added, *next = NULL;
+		while(playout) {
+			next = playout->next;
+			janus_recordplay_playout_destroy(playout);
+			playout = next;
+		}
+		pacer->added = NULL;
+		for(j=0; j<JANUS_RECORDPLAY_PACER_SLOTS; j++) {
+			playout = pacer->wheel[j];
+			while(playout) {
+				next = playout->next;
+				janus_recordplay_playout_destroy(playout);
+				playout = next;
+			}
+			pacer->wheel[j] = NULL;
+		}
+		janus_mutex_destroy(&pacer->mutex);
+	}
+	g_free(pacers);
+	pacers = NULL;
+}
+
+static void janus_recordplay_pacer_add(janus_recordplay_playout *playout) {
+	if(pacers == NULL || playout == NULL)
+		return;
+	/* Pick the pacer with the fewest playouts */
+	janus_recordplay_pacer *pacer = &pacers[0];
+	int i = 0;
+	for(i=1; i<playout_threads; i++) {
+		if(g_atomic_int_get(&pacers[i].playouts) < g_atomic_int_get(&pacer->playouts))
+			pacer = &pacers[i];
+	}
+	g_atomic_int_inc(&pacer->playouts);
+	janus_mutex_lock(&pacer->mutex);
+	playout->next = pacer->added;
+	pacer->added = playout;
+	janus_mutex_unlock(&pacer->mutex);
+}
@@ -659,6 +659,48 @@
  * All this is the application responsibility, and as such it's up to
  * the developer to react to events accordingly.
  *
+ * \section sipstacks Shared Sofia stacks
+ *
+ * By default, each account that registers gets a Sofia stack (and a thread)
+ * of its own. When the \c sofia_stacks property is set in the configuration
+ * file, accounts share a fixed number of stacks instead: each is assigned
+ * to the least loaded stack when it first registers, and new incoming
+ * requests are routed to the right account by looking at the user part
+ * of the Request-URI or, as a fallback, of the \c To header. Accounts
+ * that need SIPS, \c force_tcp or \c rfc2543_cancel always get a
+ * dedicated stack, as those can't be configured on an account basis.
+ * How accounts are distributed can be checked via Admin API, by sending
+ * a \c stacks request to the plugin:
+ *
+\verbatim
+{
+	"request" : "stacks"
+}
+\endverbatim
+ *
+ * which results in a response like this:
+ *
+\verbatim
+{
+	"sip" : "stacks",
+	"dedicated_stacks" : <number of accounts with a stack of their own>,
+	"shared_stacks" : [
+		{
+			"id" : <unique numeric ID of the shared stack>,
+			"accounts" : <number of accounts using this stack>,
+			"handles" : <number of NUA handles these accounts are using>
+		},
+		// Other shared stacks
+	],
+	"relay_threads" : [ <number of calls each RTP relay thread is serving, if relay_threads is set> ]
+}
+\endverbatim
+ *
+ * Independently of whether stacks are shared or not, \c register_jitter
+ * can be used to randomly shorten registration TTLs by up to a percentage,
+ * so that refreshes of accounts that registered at the same time (e.g.,
+ * after a restart) don't all happen at the same time as well.
+ *
  */
 
 #include "plugin.h"
@@ -689,6 +731,7 @@
 #include "../record.h"
 #include "../rtp.h"
 #include "../rtpsrtp.h"
+#include "../reactor.h"
 #include "../rtcp.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
@@ -716,6 +759,7 @@ const char *janus_sip_get_author(void);
 const char *janus_sip_get_package(void);
 void janus_sip_create_session(janus_plugin_session *handle, int *error);
 struct janus_plugin_result *janus_sip_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep);
+json_t *janus_sip_handle_admin_message(json_t *message);
 void janus_sip_setup_media(janus_plugin_session *handle);
 void janus_sip_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet);
 void janus_sip_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet);
@@ -739,6 +783,7 @@ static janus_plugin janus_sip_plugin =
 
 		.create_session = janus_sip_create_session,
 		.handle_message = janus_sip_handle_message,
+		.handle_admin_message = janus_sip_handle_admin_message,
 		.setup_media = janus_sip_setup_media,
 		.incoming_rtp = janus_sip_incoming_rtp,
 		.incoming_rtcp = janus_sip_incoming_rtcp,
@@ -866,6 +911,13 @@ static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
 static int dscp_audio_rtp = 0;
 static int dscp_video_rtp = 0;
+/* Shared reactor for the RTP/RTCP sockets of all calls, if enabled */
+static int relay_threads = 0;
+static janus_reactor *relay_reactor = NULL;
+/* Shared Sofia stacks for registrations and dialogs, if enabled */
+static int sofia_stacks_num = 0;
+/* Percentage the TTL of registrations can be randomly reduced by */
+static int register_jitter = 0;
 static char *sips_certs_dir = NULL;
 #define JANUS_DEFAULT_SIP_TIMER_T1X64 32000
 static int sip_timer_t1x64 = JANUS_DEFAULT_SIP_TIMER_T1X64;
@@ -968,8 +1020,26 @@ struct ssip_s {
 	GHashTable *subscriptions;
 	janus_mutex smutex;
 	struct janus_sip_session *session;
+	struct janus_sip_sofia_stack *shared;	/* Only set if the NUA is shared with other accounts */
+	GHashTable *handles;	/* NUA handles this session is using, when the NUA is shared */
+	char *shared_users[2];	/* Users this session is indexed with, when the NUA is shared */
 };
 
+/* Sofia stacks shared by multiple accounts, if enabled */
+typedef struct janus_sip_sofia_stack {
+	guint id;
+	GThread *thread;
+	su_root_t *s_root;
+	nua_t *s_nua;
+	char *contact_header;	/* Only needed for Sofia SIP >= 1.13 */
+	GHashTable *users;		/* Maps Contact/To users to a list of sessions */
+	volatile gint ready;
+	volatile gint accounts;
+	volatile gint handles;
+	janus_mutex mutex;
+} janus_sip_sofia_stack;
+static janus_sip_sofia_stack *sofia_stacks = NULL;
+
 typedef struct janus_sip_transfer {
 	struct janus_sip_session *session;
 	char *referred_by;
@@ -1045,6 +1115,7 @@ typedef struct janus_sip_media {
 	janus_rtp_switching_context acontext, vcontext;
 	int pipefd[2];
 	gboolean updated;
+	int pollerrs;
 	int video_orientation_extension_id;
 	int audio_level_extension_id;
 	int dtmf_pt;
@@ -1072,6 +1143,7 @@ typedef struct janus_sip_session {
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
 	GThread *relayer_thread;
+	janus_reactor_source *relayer;	/* Used instead of relayer_thread when the shared reactor is enabled */
 	volatile gint establishing, established;
 	volatile gint hangingup;
 	volatile gint destroyed;
@@ -1132,11 +1204,16 @@ static void janus_sip_session_dereference(janus_sip_session *session) {
 	janus_refcount_decrease(&session->ref);
 }
 
+static char *janus_sip_sofia_stack_contact(janus_sip_sofia_stack *shared, const char *user);
 static char *janus_sip_session_contact_header_retrieve(janus_sip_session *session) {
-	if(session->helper && session->master)
-		return session->master->stack->contact_header;
-	else
-		return session->stack->contact_header;
+	ssip_t *stack = (session->helper && session->master) ? session->master->stack : session->stack;
+	if(stack->contact_header == NULL && stack->shared != NULL) {
+		/* The NUA is shared, so we need a Contact with the right user in it */
+		janus_sip_account *account = session->helper && session->master ? &session->master->account : &session->account;
+		stack->contact_header = janus_sip_sofia_stack_contact(stack->shared,
+			account->authuser ? account->authuser : account->username);
+	}
+	return stack->contact_header;
 }
 
 static void janus_sip_session_free(const janus_refcount *session_ref) {
@@ -1152,6 +1229,10 @@ static void janus_sip_session_free(const janus_refcount *session_ref) {
 		su_home_deinit(session->stack->s_home);
 		su_home_unref(session->stack->s_home);
 		g_free(session->stack->contact_header);
+		if(session->stack->handles != NULL)
+			g_hash_table_destroy(session->stack->handles);
+		g_free(session->stack->shared_users[0]);
+		g_free(session->stack->shared_users[1]);
 		g_free(session->stack);
 		session->stack = NULL;
 	}
@@ -1520,7 +1601,21 @@ static void janus_sip_media_reset(janus_sip_session *session) {
 
 /* Sofia Event thread */
 gpointer janus_sip_sofia_thread(gpointer user_data);
+/* Shared Sofia stacks */
+static int janus_sip_sofia_stacks_create(void);
+static void janus_sip_sofia_stacks_destroy(void);
+static janus_sip_sofia_stack *janus_sip_sofia_stack_pick(janus_sip_session *session);
+static void janus_sip_sofia_stack_attach(janus_sip_sofia_stack *shared, janus_sip_session *session);
+static void janus_sip_sofia_stack_index(janus_sip_session *session);
+static void janus_sip_sofia_stack_detach(janus_sip_session *session);
+static json_t *janus_sip_sofia_stacks_summary(void);
+static nua_handle_t *janus_sip_nua_handle(janus_sip_session *session, nua_t *nua);
+static void janus_sip_nua_handle_track(janus_sip_session *session, nua_handle_t *nh);
+static void janus_sip_nua_handle_untrack(janus_sip_session *session, nua_handle_t *nh);
+static void janus_sip_nua_handle_destroy(janus_sip_session *session, nua_handle_t *nh);
 /* Sofia callbacks */
+static janus_sip_session *janus_sip_sofia_stack_callback(janus_sip_sofia_stack *shared, nua_event_t event,
+	int status, char const *phrase, nua_handle_t *nh, sip_t const *sip, tagi_t tags[]);
 void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]);
 void janus_sip_save_reason(sip_t const *sip, janus_sip_session *session);
 /* SDP parsing and manipulation */
@@ -1528,6 +1623,7 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean update);
+static int janus_sip_relay_start(janus_sip_session *session);
 static void *janus_sip_relay_thread(void *data);
 static void janus_sip_media_cleanup(janus_sip_session *session);
 static void janus_sip_check_rfc2833(janus_sip_session *session, char *buffer, int len);
@@ -2001,6 +2097,38 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 			}
 		}
 
+		/* Should media from SIP peers be received by a pool of threads, rather than a thread per call? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "relay_threads");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring relay_threads value as it's not a positive integer\n");
+			} else {
+				relay_threads = val;
+			}
+		}
+
+		/* Should accounts share a pool of Sofia stacks, rather than having one each? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "sofia_stacks");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring sofia_stacks value as it's not a positive integer\n");
+			} else {
+				sofia_stacks_num = val;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "register_jitter");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 0 || val > 50) {
+				JANUS_LOG(LOG_WARN, "Ignoring register_jitter value as it's not a percentage between 0 and 50\n");
+			} else {
+				register_jitter = val;
+				JANUS_LOG(LOG_VERB, "SIP registration TTL jitter set to %d%%\n", register_jitter);
+			}
+		}
+
 		/* Check if Sofia should find certificates in a custom folder  */
 		item = janus_config_get(config, config_general, janus_config_type_item, "sips_certs_dir");
 		if(item && item->value) {
@@ -2087,6 +2215,15 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 		ipv6_disabled = TRUE;
 	}
 
+	if(relay_threads > 0) {
+		/* Calls will share a pool of threads for their RTP/RTCP sockets */
+		relay_reactor = janus_reactor_create("siprtp", relay_threads);
+		if(relay_reactor == NULL)
+			JANUS_LOG(LOG_WARN, "Couldn't create the RTP/RTCP reactor, using a thread per call\n");
+	}
+	if(sofia_stacks_num > 0 && janus_sip_sofia_stacks_create() < 0)
+		JANUS_LOG(LOG_WARN, "Couldn't create the shared Sofia stacks, using a stack per account\n");
+
 	g_atomic_int_set(&initialized, 1);
 
 	/* Launch the thread that will handle incoming messages */
@@ -2097,6 +2234,9 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SIP handler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
+		janus_reactor_destroy(relay_reactor);
+		relay_reactor = NULL;
+		janus_sip_sofia_stacks_destroy();
 		return -1;
 	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_SIP_NAME);
@@ -2113,6 +2253,9 @@ void janus_sip_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	janus_reactor_destroy(relay_reactor);
+	relay_reactor = NULL;
+	janus_sip_sofia_stacks_destroy();
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -2342,15 +2485,24 @@ void janus_sip_destroy_session(janus_plugin_session *handle, int *error) {
 		g_hash_table_remove(transfers, GUINT_TO_POINTER(session->refer_id));
 		session->refer_id = 0;
 	}
-	/* Shutdown the NUA */
+	/* Shutdown the NUA, unless it's shared with other accounts */
+	gboolean shared = FALSE;
 	if(session->stack) {
 		janus_mutex_lock(&session->stack->smutex);
-		if(session->stack->s_nua)
+		shared = (session->stack->shared != NULL);
+		if(!shared && session->stack->s_nua)
 			nua_shutdown(session->stack->s_nua);
 		janus_mutex_unlock(&session->stack->smutex);
 	}
+	if(shared)
+		janus_refcount_increase(&session->ref);
 	g_hash_table_remove(sessions, handle);
 	janus_mutex_unlock(&sessions_mutex);
+	if(shared) {
+		/* Only get rid of the handles of this session in the shared stack */
+		janus_sip_sofia_stack_detach(session);
+		janus_refcount_decrease(&session->ref);
+	}
 	return;
 }
 
@@ -2447,6 +2599,60 @@ struct janus_plugin_result *janus_sip_handle_message(janus_plugin_session *handl
 	return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 }
 
+json_t *janus_sip_handle_admin_message(json_t *message) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	/* The only request we handle via Admin API is 'stacks', to check how Sofia stacks are loaded */
+	int error_code = 0;
+	char error_cause[512];
+	json_t *response = NULL;
+
+	JANUS_VALIDATE_JSON_OBJECT(message, request_parameters,
+		error_code, error_cause, TRUE,
+		JANUS_SIP_ERROR_MISSING_ELEMENT, JANUS_SIP_ERROR_INVALID_ELEMENT);
+	if(error_code != 0)
+		goto admin_response;
+	json_t *request = json_object_get(message, "request");
+	const char *request_text = json_string_value(request);
+	if(!strcasecmp(request_text, "stacks")) {
+		/* Count the accounts that have a Sofia stack of their own */
+		int dedicated = 0;
+		janus_mutex_lock(&sessions_mutex);
+		GHashTableIter iter;
+		gpointer value = NULL;
+		g_hash_table_iter_init(&iter, sessions);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_sip_session *session = (janus_sip_session *)value;
+			if(session->stack != NULL && !session->helper && session->stack->shared == NULL && session->stack->s_nua != NULL)
+				dedicated++;
+		}
+		janus_mutex_unlock(&sessions_mutex);
+		response = json_object();
+		json_object_set_new(response, "sip", json_string("stacks"));
+		json_object_set_new(response, "dedicated_stacks", json_integer(dedicated));
+		json_object_set_new(response, "shared_stacks", janus_sip_sofia_stacks_summary());
+		if(relay_reactor != NULL)
+			json_object_set_new(response, "relay_threads", janus_reactor_get_load(relay_reactor));
+	} else {
+		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
+		error_code = JANUS_SIP_ERROR_INVALID_REQUEST;
+		g_snprintf(error_cause, 512, "Unknown request '%s'", request_text);
+	}
+
+admin_response:
+		{
+			if(!response) {
+				/* Prepare JSON error event */
+				response = json_object();
+				json_object_set_new(response, "sip", json_string("event"));
+				json_object_set_new(response, "error_code", json_integer(error_code));
+				json_object_set_new(response, "error", json_string(error_cause));
+			}
+			return response;
+		}
+
+}
+
 void janus_sip_setup_media(janus_plugin_session *handle) {
 	JANUS_LOG(LOG_INFO, "[%s-%p] WebRTC media is now available\n", JANUS_SIP_PACKAGE, handle);
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
@@ -2730,7 +2936,7 @@ static void janus_sip_hangup_media_internal(janus_plugin_session *handle) {
 		return;
 	session->media.simulcast_ssrc = 0;
 	/* Do cleanup if media thread has not been created */
-	if(!session->media.ready && !session->relayer_thread) {
+	if(!session->media.ready && !session->relayer_thread && !session->relayer) {
 		janus_mutex_lock(&session->mutex);
 		janus_sip_media_cleanup(session);
 		janus_mutex_unlock(&session->mutex);
@@ -2911,6 +3117,8 @@ static void *janus_sip_handler(void *data) {
 					su_home_init(session->stack->s_home);
 					if(session->master->stack->contact_header != NULL)
 						session->stack->contact_header = g_strdup(session->master->stack->contact_header);
+					/* If the master is using a shared NUA, we'll need to keep track of our handles too */
+					session->stack->shared = session->master->stack->shared;
 				}
 				/* Check if custom headers need to be intercepted */
 				json_t *header_prefixes_json = json_object_get(root, "incoming_header_prefixes");
@@ -3048,6 +3256,14 @@ static void *janus_sip_handler(void *data) {
 				ttl = json_integer_value(reg_ttl);
 			if(ttl <= 0)
 				ttl = JANUS_DEFAULT_REGISTER_TTL;
+			if(register_jitter > 0 && ttl > 1) {
+				/* Randomly shorten the TTL a bit: since Sofia refreshes registrations
+				 * depending on when they expire, this spreads the refreshes in time,
+				 * which avoids bursts when many accounts registered at the same time */
+				int jitter = ttl * register_jitter / 100;
+				if(jitter > 0)
+					ttl -= g_random_int_range(0, jitter + 1);
+			}
 
 			/* Parse display name */
 			const char *display_name_text = NULL;
@@ -3209,7 +3425,11 @@ static void *janus_sip_handler(void *data) {
 			}
 
 			session->account.registration_status = janus_sip_registration_status_registering;
-			if(!refresh && session->stack == NULL) {
+			janus_sip_sofia_stack *shared = NULL;
+			if(!refresh && session->stack == NULL && (shared = janus_sip_sofia_stack_pick(session)) != NULL) {
+				/* Use one of the shared stacks, rather than starting a new one */
+				janus_sip_sofia_stack_attach(shared, session);
+			} else if(!refresh && session->stack == NULL) {
 				/* Start the thread first */
 				GError *error = NULL;
 				char tname[16];
@@ -3248,9 +3468,12 @@ static void *janus_sip_handler(void *data) {
 				goto error;
 			}
 			if(session->stack->s_nh_r != NULL) {
-				nua_handle_destroy(session->stack->s_nh_r);
+				janus_sip_nua_handle_destroy(session, session->stack->s_nh_r);
 				session->stack->s_nh_r = NULL;
 			}
+			/* If the NUA is shared, make sure incoming requests for this account can be routed to us */
+			if(session->stack->shared != NULL)
+				janus_sip_sofia_stack_index(session);
 
 			if(send_register) {
 				/* Check if the REGISTER needs to be enriched with custom headers */
@@ -3268,7 +3491,7 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid NUA");
 					goto error;
 				}
-				session->stack->s_nh_r = nua_handle(session->stack->s_nua, session, TAG_END());
+				session->stack->s_nh_r = janus_sip_nua_handle(session, session->stack->s_nua);
 				janus_mutex_unlock(&session->stack->smutex);
 				if(session->stack->s_nh_r == NULL) {
 					JANUS_LOG(LOG_ERR, "NUA Handle for REGISTER still null??\n");
@@ -3406,7 +3629,7 @@ static void *janus_sip_handler(void *data) {
 						g_snprintf(error_cause, 512, "Invalid NUA");
 						goto error;
 					}
-					nh = nua_handle(session->stack->s_nua, session, TAG_END());
+					nh = janus_sip_nua_handle(session, session->stack->s_nua);
 				} else {
 					/* This is a helper, we need to use the master's SIP stack */
 					if(session->master == NULL || session->master->stack == NULL) {
@@ -3422,7 +3645,7 @@ static void *janus_sip_handler(void *data) {
 						g_snprintf(error_cause, 512, "Invalid NUA");
 						goto error;
 					}
-					nh = nua_handle(session->master->stack->s_nua, session, TAG_END());
+					nh = janus_sip_nua_handle(session, session->master->stack->s_nua);
 					janus_mutex_unlock(&session->master->stack->smutex);
 				}
 				if(session->stack->subscriptions == NULL) {
@@ -3663,7 +3886,7 @@ static void *janus_sip_handler(void *data) {
 			char from_hdr[1024];
 			/* Prepare the stack */
 			if(session->stack->s_nh_i != NULL)
-				nua_handle_destroy(session->stack->s_nh_i);
+				janus_sip_nua_handle_destroy(session, session->stack->s_nh_i);
 			if(!session->helper) {
 				janus_mutex_lock(&session->stack->smutex);
 				if(session->stack->s_nua == NULL) {
@@ -3673,7 +3896,7 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid NUA");
 					goto error;
 				}
-				session->stack->s_nh_i = nua_handle(session->stack->s_nua, session, TAG_END());
+				session->stack->s_nh_i = janus_sip_nua_handle(session, session->stack->s_nua);
 				janus_mutex_unlock(&session->stack->smutex);
 				if(session->account.display_name) {
 					g_snprintf(from_hdr, sizeof(from_hdr), "\"%s\" <%s>", session->account.display_name, session->account.identity);
@@ -3700,7 +3923,7 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid NUA");
 					goto error;
 				}
-				session->stack->s_nh_i = nua_handle(session->master->stack->s_nua, session, TAG_END());
+				session->stack->s_nh_i = janus_sip_nua_handle(session, session->master->stack->s_nua);
 				janus_mutex_unlock(&session->master->stack->smutex);
 				if(session->master->account.display_name) {
 					g_snprintf(from_hdr, sizeof(from_hdr), "\"%s\" <%s>", session->master->account.display_name, session->master->account.identity);
@@ -4027,19 +4250,8 @@ static void *janus_sip_handler(void *data) {
 			if(answer) {
 				/* Start the media */
 				session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
+				if(janus_sip_relay_start(session) < 0)
 					session->media.ready = FALSE;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
-				}
 			}
 		} else if(!strcasecmp(request_text, "update")) {
 			/* Update an existing call */
@@ -4854,7 +5066,7 @@ static void *janus_sip_handler(void *data) {
 						g_snprintf(error_cause, 512, "Invalid NUA");
 						goto error;
 					}
-					nh = nua_handle(session->stack->s_nua, session, TAG_END());
+					nh = janus_sip_nua_handle(session, session->stack->s_nua);
 					janus_mutex_unlock(&session->stack->smutex);
 				} else {
 					/* This is a helper, we need to use the master's SIP stack */
@@ -4871,7 +5083,7 @@ static void *janus_sip_handler(void *data) {
 						g_snprintf(error_cause, 512, "Invalid NUA");
 						goto error;
 					}
-					nh = nua_handle(session->master->stack->s_nua, session, TAG_END());
+					nh = janus_sip_nua_handle(session, session->master->stack->s_nua);
 					janus_mutex_unlock(&session->master->stack->smutex);
 				}
 				json_t *request_callid = json_object_get(root, "call_id");
@@ -5017,6 +5229,21 @@ error:
 /* Sofia callbacks */
 void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[])
 {
+	if(hmagic == NULL && sofia_stacks != NULL) {
+		/* If this NUA is shared by multiple accounts, this may be either an event
+		 * for the stack itself, or a new request we need to find the session for */
+		int i = 0;
+		for(i=0; i<sofia_stacks_num; i++) {
+			if(sofia_stacks[i].s_nua == nua || (nua_magic_t *)&sofia_stacks[i] == magic)
+				break;
+		}
+		if(i < sofia_stacks_num) {
+			janus_sip_sofia_stack *shared = &sofia_stacks[i];
+			hmagic = (nua_hmagic_t *)janus_sip_sofia_stack_callback(shared, event, status, phrase, nh, sip, tags);
+			if(hmagic == NULL)
+				return;
+		}
+	}
 	janus_sip_session *session = (janus_sip_session *)(hmagic ? hmagic : magic);
 	ssip_t *ssip = session->stack;
 
@@ -5197,7 +5424,8 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			}
 			gboolean reinvite = FALSE, busy = FALSE;
 			if(session->stack->s_nh_i == NULL) {
-				if(g_atomic_int_get(&session->establishing) || g_atomic_int_get(&session->established) || session->relayer_thread != NULL) {
+				if(g_atomic_int_get(&session->establishing) || g_atomic_int_get(&session->established) ||
+						session->relayer_thread != NULL || session->relayer != NULL) {
 					/* Still busy establishing another call (or maybe still cleaning up the previous call) */
 					busy = TRUE;
 				}
@@ -5221,7 +5449,8 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				while(temp != NULL) {
 					helper = (janus_sip_session *)temp->data;
 					if(helper->stack->s_nh_i == NULL && !g_atomic_int_get(&helper->establishing) &&
-							!g_atomic_int_get(&helper->established) && helper->relayer_thread == NULL) {
+							!g_atomic_int_get(&helper->established) &&
+							helper->relayer_thread == NULL && helper->relayer == NULL) {
 						/* Found! */
 						break;
 					}
@@ -5234,6 +5463,9 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 					/* Bind the call to the helper and handle it there */
 					JANUS_LOG(LOG_VERB, "Passing INVITE to helper %p\n", helper);
 					nua_handle_bind(nh, helper);
+					/* If the NUA is shared, the handle now belongs to the helper */
+					janus_sip_nua_handle_untrack(session, nh);
+					janus_sip_nua_handle_track(helper, nh);
 					/* This session won't need the reference anymore, the helper will */
 					janus_sip_unref_active_call(session);
 					janus_sip_sofia_callback(event, status, phrase, nua, magic, nh, helper, sip, tags);
@@ -5981,19 +6213,8 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				break;
 			}
 			if(!session->media.earlymedia && !session->media.update) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
+				if(janus_sip_relay_start(session) < 0)
 					session->media.ready = FALSE;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
-				}
 			}
 			/* Check if there's an isfocus feature parameter in the Contact header */
 			gboolean is_focus = FALSE;
@@ -6982,6 +7203,266 @@ static void janus_sip_media_cleanup(janus_sip_session *session) {
 	janus_sip_media_reset(session);
 }
 
+/* Helper to check whether the relay for a call should keep going */
+static gboolean janus_sip_relay_check(janus_sip_session *session) {
+	return !g_atomic_int_get(&session->destroyed) &&
+		session->status > janus_sip_call_status_idle &&
+		session->status < janus_sip_call_status_closing;	/* FIXME We need a per-call watchdog as well */
+}
+
+/* Helper to (re)connect the sockets after a session update, or when the relay starts */
+static void janus_sip_relay_update(janus_sip_session *session) {
+	/* Apparently there was a session update, or the loop has just been entered */
+	session->media.updated = FALSE;
+
+	/* Resolve the addresses, if needed */
+	gboolean have_audio_server_ip = FALSE;
+	gboolean have_video_server_ip = FALSE;
+	struct sockaddr_storage audio_server_addr = { 0 }, video_server_addr = { 0 };
+	if(session->media.remote_audio_ip && strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
+		if(janus_network_resolve_address(session->media.remote_audio_ip, &audio_server_addr) < 0) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve audio address '%s'\n",
+				session->account.username, session->media.remote_audio_ip);
+		} else {
+			/* Address resolved */
+			have_audio_server_ip = TRUE;
+		}
+	}
+	if(session->media.remote_video_ip && strcmp(session->media.remote_video_ip, "0.0.0.0")) {
+		if(janus_network_resolve_address(session->media.remote_video_ip, &video_server_addr) < 0) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve video address '%s'\n",
+				session->account.username, session->media.remote_video_ip);
+		} else {
+			/* Address resolved */
+			have_video_server_ip = TRUE;
+		}
+	}
+
+	if(have_audio_server_ip || have_video_server_ip) {
+		janus_sip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
+			have_video_server_ip ? &video_server_addr : NULL);
+	} else if(session->media.remote_audio_ip == NULL && session->media.remote_video_ip == NULL) {
+		JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n",
+			session->account.username);
+	} else {
+		if(session->media.remote_audio_ip)
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
+				session->account.username, session->media.remote_audio_ip);
+		if(session->media.remote_video_ip)
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
+				session->account.username, session->media.remote_video_ip);
+	}
+
+	/* In case we're on hold (remote address is 0.0.0.0) set the send properties to FALSE */
+	if(have_audio_server_ip && !strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
+		session->media.audio_send = FALSE;
+		session->media.audio_recv = FALSE;
+	}
+	if(have_video_server_ip && !strcmp(session->media.remote_video_ip, "0.0.0.0")) {
+		session->media.video_send = FALSE;
+		session->media.video_recv = FALSE;
+	}
+}
+
+/* Helper to handle an error on one of the sockets: returns FALSE if the relay should stop */
+static gboolean janus_sip_relay_error(janus_sip_session *session, int fd, int error) {
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return TRUE;
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return TRUE;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
+				session->account.username, g_strerror(error));
+			janus_mutex_lock(&session->mutex);
+			janus_reactor_source_remove(session->relayer, session->media.audio_rtcp_fd);
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			janus_mutex_unlock(&session->mutex);
+			return TRUE;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
+				session->account.username, g_strerror(error));
+			janus_mutex_lock(&session->mutex);
+			janus_reactor_source_remove(session->relayer, session->media.video_rtcp_fd);
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			janus_mutex_unlock(&session->mutex);
+			return TRUE;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return TRUE;
+	JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d...\n", session->account.username, fd);
+	JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, g_strerror(error));
+	/* FIXME Simulate a "hangup" coming from the application */
+	janus_sip_hangup_media(session->handle);
+	return FALSE;
+}
+
+/* Helper to process an RTP/RTCP packet received on one of the sockets */
+static void janus_sip_relay_incoming(janus_sip_session *session, int fd, char *buffer, int bytes) {
+	if(session->media.audio_rtp_fd != -1 && fd == session->media.audio_rtp_fd) {
+		/* Got something audio (RTP) */
+		if(!janus_is_rtp(buffer, bytes)) {
+			/* Not an RTP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		if(!session->media.audio_recv) {
+			/* Dropping audio packet, we weren't expecting anything */
+			return;
+		}
+		if(session->media.on_hold && session->media.hold_audio_dir != JANUS_SDP_RECVONLY) {
+			/* Dropping video packet, the call is on hold and we're not receiving anything */
+			return;
+		}
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		janus_sip_check_rfc2833(session, buffer, bytes);
+		if(session->media.audio_ssrc_peer == 0) {
+			session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote_audio) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.acontext, FALSE, 0);
+		/* Save the frame if we're recording */
+		header->ssrc = htonl(session->media.audio_ssrc_peer);
+		janus_recorder_save_frame(session->arc_peer, buffer, bytes);
+		/* Relay to application */
+		janus_plugin_rtp rtp = { .mindex = -1, .video = FALSE, .buffer = buffer, .length = bytes };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		/* Add audio-level extension, if present */
+		if(session->media.audio_level_extension_id != -1) {
+			gboolean vad = FALSE;
+			int level = -1;
+			if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
+					session->media.audio_level_extension_id, &vad, &level) == 0) {
+				rtp.extensions.audio_level = level;
+				rtp.extensions.audio_level_vad = vad;
+			}
+		}
+		gateway->relay_rtp(session->handle, &rtp);
+	} else if(session->media.audio_rtcp_fd != -1 && fd == session->media.audio_rtcp_fd) {
+		/* Got something audio (RTCP) */
+		if(!janus_is_rtcp(buffer, bytes)) {
+			/* Not an RTCP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		if(!session->media.video_recv) {
+			/* Dropping video packet, we weren't expecting anything */
+			return;
+		}
+		if(session->media.on_hold && session->media.hold_video_dir != JANUS_SDP_RECVONLY) {
+			/* Dropping video packet, the call is on hold and we're not receiving anything */
+			return;
+		}
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote_audio) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to application */
+		janus_plugin_rtcp rtcp = { .mindex = -1, .video = FALSE, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+	} else if(session->media.video_rtp_fd != -1 && fd == session->media.video_rtp_fd) {
+		/* Got something video (RTP) */
+		if(!janus_is_rtp(buffer, bytes)) {
+			/* Not an RTP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.video_ssrc_peer == 0) {
+			session->media.video_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote_video) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.vcontext, TRUE, 0);
+		/* Save the frame if we're recording */
+		header->ssrc = htonl(session->media.video_ssrc_peer);
+		janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
+		/* Relay to application */
+		janus_plugin_rtp rtp = { .mindex = -1, .video = TRUE, .buffer = buffer, .length = bytes };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		/* Add video-orientation extension, if present */
+		if(session->media.video_orientation_extension_id > 0) {
+			gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
+			if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
+					session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
+				rtp.extensions.video_rotation = 0;
+				if(r1 && r0)
+					rtp.extensions.video_rotation = 270;
+				else if(r1)
+					rtp.extensions.video_rotation = 180;
+				else if(r0)
+					rtp.extensions.video_rotation = 90;
+				rtp.extensions.video_back_camera = c;
+				rtp.extensions.video_flipped = f;
+			}
+		}
+		gateway->relay_rtp(session->handle, &rtp);
+	} else if(session->media.video_rtcp_fd != -1 && fd == session->media.video_rtcp_fd) {
+		/* Got something video (RTCP) */
+		if(!janus_is_rtcp(buffer, bytes)) {
+			/* Not an RTCP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote_video) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to application */
+		janus_plugin_rtcp rtcp = { .mindex = -1, .video = TRUE, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+	}
+}
+
 /* Thread to relay RTP/RTCP frames coming from the SIP peer */
 static void *janus_sip_relay_thread(void *data) {
 	janus_sip_session *session = (janus_sip_session *)data;
@@ -6995,6 +7476,8 @@ static void *janus_sip_relay_thread(void *data) {
 		return NULL;
 	}
 	JANUS_LOG(LOG_VERB, "Starting relay thread (%s <--> %s)\n", session->account.username, session->callee);
+	/* Stick to the same CPU as the session's event loop, if pinned */
+	gateway->inherit_affinity(session->handle);
 
 	if(!session->callee) {
 		JANUS_LOG(LOG_WARN, "[SIP-%s] Leaving thread, no callee...\n", session->account.username);
@@ -7005,7 +7488,7 @@ static void *janus_sip_relay_thread(void *data) {
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
+	int resfd = 0, bytes = 0;
 	struct pollfd fds[5];
 	int pipe_fd = session->media.pipefd[0];
 	char buffer[1500];
@@ -7023,65 +7506,12 @@ static void *janus_sip_relay_thread(void *data) {
 	gboolean goon = TRUE;
 
 	session->media.updated = TRUE; /* Connect UDP sockets upon loop entry */
-	gboolean have_audio_server_ip = TRUE;
-	gboolean have_video_server_ip = TRUE;
-
-	while(goon && session != NULL && !g_atomic_int_get(&session->destroyed) &&
-			session->status > janus_sip_call_status_idle &&
-			session->status < janus_sip_call_status_closing) {	/* FIXME We need a per-call watchdog as well */
-
-		if(session->media.updated) {
-			/* Apparently there was a session update, or the loop has just been entered */
-			session->media.updated = FALSE;
-
-			/* Resolve the addresses, if needed */
-			have_audio_server_ip = FALSE;
-			have_video_server_ip = FALSE;
-			struct sockaddr_storage audio_server_addr = { 0 }, video_server_addr = { 0 };
-			if(session->media.remote_audio_ip && strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
-				if(janus_network_resolve_address(session->media.remote_audio_ip, &audio_server_addr) < 0) {
-					JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve audio address '%s'\n",
-						session->account.username, session->media.remote_audio_ip);
-				} else {
-					/* Address resolved */
-					have_audio_server_ip = TRUE;
-				}
-			}
-			if(session->media.remote_video_ip && strcmp(session->media.remote_video_ip, "0.0.0.0")) {
-				if(janus_network_resolve_address(session->media.remote_video_ip, &video_server_addr) < 0) {
-					JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve video address '%s'\n",
-						session->account.username, session->media.remote_video_ip);
-				} else {
-					/* Address resolved */
-					have_video_server_ip = TRUE;
-				}
-			}
+	session->media.pollerrs = 0;
 
-			if(have_audio_server_ip || have_video_server_ip) {
-				janus_sip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
-					have_video_server_ip ? &video_server_addr : NULL);
-			} else if(session->media.remote_audio_ip == NULL && session->media.remote_video_ip == NULL) {
-				JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n",
-					session->account.username);
-			} else {
-				if(session->media.remote_audio_ip)
-					JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
-						session->account.username, session->media.remote_audio_ip);
-				if(session->media.remote_video_ip)
-					JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
-						session->account.username, session->media.remote_video_ip);
-			}
+	while(goon && session != NULL && janus_sip_relay_check(session)) {
 
-			/* In case we're on hold (remote address is 0.0.0.0) set the send properties to FALSE */
-			if(have_audio_server_ip && !strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
-				session->media.audio_send = FALSE;
-				session->media.audio_recv = FALSE;
-			}
-			if(have_video_server_ip && !strcmp(session->media.remote_video_ip, "0.0.0.0")) {
-				session->media.video_send = FALSE;
-				session->media.video_recv = FALSE;
-			}
-		}
+		if(session->media.updated)
+			janus_sip_relay_update(session);
 
 		/* Prepare poll */
 		num = 0;
@@ -7133,9 +7563,7 @@ static void *janus_sip_relay_thread(void *data) {
 			/* No data, keep going */
 			continue;
 		}
-		if(session == NULL || g_atomic_int_get(&session->destroyed) ||
-				session->status <= janus_sip_call_status_idle ||
-				session->status >= janus_sip_call_status_closing)
+		if(session == NULL || !janus_sip_relay_check(session))
 			break;
 		int i = 0;
 		for(i=0; i<num; i++) {
@@ -7147,40 +7575,10 @@ static void *janus_sip_relay_thread(void *data) {
 				int error = 0;
 				socklen_t errlen = sizeof(error);
 				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
-							session->account.username, g_strerror(error));
-						janus_mutex_lock(&session->mutex);
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						janus_mutex_unlock(&session->mutex);
-						continue;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
-							session->account.username, g_strerror(error));
-						janus_mutex_lock(&session->mutex);
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						janus_mutex_unlock(&session->mutex);
-						continue;
-					}
+				if(!janus_sip_relay_error(session, fds[i].fd, error)) {
+					goon = FALSE;	/* Can we assume it's pretty much over, after a POLLERR? */
+					break;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, g_strerror(error));
-				goon = FALSE;	/* Can we assume it's pretty much over, after a POLLERR? */
-				/* FIXME Simulate a "hangup" coming from the application */
-				janus_sip_hangup_media(session->handle);
-				break;
 			} else if(fds[i].revents & POLLIN) {
 				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
 					/* Poll interrupted for a reason, go on */
@@ -7189,172 +7587,13 @@ static void *janus_sip_relay_thread(void *data) {
 					break;
 				}
 				/* Got an RTP/RTCP packet */
-				if(session->media.audio_rtp_fd != -1 && fds[i].fd == session->media.audio_rtp_fd) {
-					/* Got something audio (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					if(!session->media.audio_recv) {
-						/* Dropping audio packet, we weren't expecting anything */
-						continue;
-					}
-					if(session->media.on_hold && session->media.hold_audio_dir != JANUS_SDP_RECVONLY) {
-						/* Dropping video packet, the call is on hold and we're not receiving anything */
-						continue;
-					}
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					janus_sip_check_rfc2833(session, buffer, bytes);
-					if(session->media.audio_ssrc_peer == 0) {
-						session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote_audio) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.acontext, FALSE, 0);
-					/* Save the frame if we're recording */
-					header->ssrc = htonl(session->media.audio_ssrc_peer);
-					janus_recorder_save_frame(session->arc_peer, buffer, bytes);
-					/* Relay to application */
-					janus_plugin_rtp rtp = { .mindex = -1, .video = FALSE, .buffer = buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					/* Add audio-level extension, if present */
-					if(session->media.audio_level_extension_id != -1) {
-						gboolean vad = FALSE;
-						int level = -1;
-						if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
-								session->media.audio_level_extension_id, &vad, &level) == 0) {
-							rtp.extensions.audio_level = level;
-							rtp.extensions.audio_level_vad = vad;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else if(session->media.audio_rtcp_fd != -1 && fds[i].fd == session->media.audio_rtcp_fd) {
-					/* Got something audio (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
-						/* Failed to read or not an RTCP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					if(!session->media.video_recv) {
-						/* Dropping video packet, we weren't expecting anything */
-						continue;
-					}
-					if(session->media.on_hold && session->media.hold_video_dir != JANUS_SDP_RECVONLY) {
-						/* Dropping video packet, the call is on hold and we're not receiving anything */
-						continue;
-					}
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote_audio) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to application */
-					janus_plugin_rtcp rtcp = { .mindex = -1, .video = FALSE, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				} else if(session->media.video_rtp_fd != -1 && fds[i].fd == session->media.video_rtp_fd) {
-					/* Got something video (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.video_ssrc_peer == 0) {
-						session->media.video_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote_video) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.vcontext, TRUE, 0);
-					/* Save the frame if we're recording */
-					header->ssrc = htonl(session->media.video_ssrc_peer);
-					janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
-					/* Relay to application */
-					janus_plugin_rtp rtp = { .mindex = -1, .video = TRUE, .buffer = buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					/* Add video-orientation extension, if present */
-					if(session->media.video_orientation_extension_id > 0) {
-						gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-						if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
-								session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
-							rtp.extensions.video_rotation = 0;
-							if(r1 && r0)
-								rtp.extensions.video_rotation = 270;
-							else if(r1)
-								rtp.extensions.video_rotation = 180;
-							else if(r0)
-								rtp.extensions.video_rotation = 90;
-							rtp.extensions.video_back_camera = c;
-							rtp.extensions.video_flipped = f;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else if(session->media.video_rtcp_fd != -1 && fds[i].fd == session->media.video_rtcp_fd) {
-					/* Got something video (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
-						/* Failed to read or not an RTCP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote_video) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to application */
-					janus_plugin_rtcp rtcp = { .mindex = -1, .video = TRUE, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
+				addrlen = sizeof(remote);
+				bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+				if(bytes < 0) {
+					/* Failed to read? */
 					continue;
 				}
+				janus_sip_relay_incoming(session, fds[i].fd, buffer, bytes);
 			}
 		}
 	}
@@ -7370,6 +7609,524 @@ static void *janus_sip_relay_thread(void *data) {
 	return NULL;
 }
 
+/* Shared reactor callbacks, used instead of the thread above when relay_threads is set */
+static void janus_sip_relay_stop(janus_reactor_source *source) {
+	janus_sip_session *session = (janus_sip_session *)source->user_data;
+	/* Cleanup the media session: the sockets must not be watched anymore when closed */
+	janus_mutex_lock(&session->mutex);
+	janus_reactor_source_destroy(source);
+	janus_sip_media_cleanup(session);
+	session->relayer = NULL;
+	janus_mutex_unlock(&session->mutex);
+	JANUS_LOG(LOG_VERB, "[SIP-%s] Leaving SIP relay reactor\n", session->account.username);
+	janus_refcount_decrease(&session->ref);
+}
+static void janus_sip_relay_reactor_incoming(janus_reactor_source *source, int fd, char *buf, int len) {
+	janus_sip_session *session = (janus_sip_session *)source->user_data;
+	if(!janus_sip_relay_check(session))
+		return;
+	janus_sip_relay_incoming(session, fd, buf, len);
+}
+static void janus_sip_relay_reactor_error(janus_reactor_source *source, int fd, int error) {
+	janus_sip_session *session = (janus_sip_session *)source->user_data;
+	if(!janus_sip_relay_error(session, fd, error))
+		janus_sip_relay_stop(source);
+}
+static void janus_sip_relay_reactor_notify(janus_reactor_source *source, int fd) {
+	janus_sip_session *session = (janus_sip_session *)source->user_data;
+	if(!janus_sip_relay_check(session) || session->media.pipefd[0] == -1) {
+		/* The call is over */
+		janus_sip_relay_stop(source);
+		return;
+	}
+	if(!session->media.updated)
+		return;
+	janus_sip_relay_update(session);
+	/* New sockets may have been created, make sure we're watching all of them */
+	janus_reactor_source_add(source, session->media.pipefd[0], TRUE);
+	if(session->media.audio_rtp_fd != -1)
+		janus_reactor_source_add(source, session->media.audio_rtp_fd, FALSE);
+	if(session->media.audio_rtcp_fd != -1)
+		janus_reactor_source_add(source, session->media.audio_rtcp_fd, FALSE);
+	if(session->media.video_rtp_fd != -1)
+		janus_reactor_source_add(source, session->media.video_rtp_fd, FALSE);
+	if(session->media.video_rtcp_fd != -1)
+		janus_reactor_source_add(source, session->media.video_rtcp_fd, FALSE);
+}
+static const janus_reactor_callbacks janus_sip_relay_callbacks = {
+	.incoming = janus_sip_relay_reactor_incoming,
+	.error = janus_sip_relay_reactor_error,
+	.notify = janus_sip_relay_reactor_notify,
+};
+
+/* Start relaying the media coming from the SIP peer, either on the shared reactor or on a new thread */
+static int janus_sip_relay_start(janus_sip_session *session) {
+	janus_refcount_increase(&session->ref);
+	if(relay_reactor != NULL) {
+		janus_mutex_lock(&session->mutex);
+		if(session->media.pipefd[0] == -1 || session->media.pipefd[1] == -1) {
+			janus_mutex_unlock(&session->mutex);
+			JANUS_LOG(LOG_WARN, "[SIP-%s] No pipe file descriptor, not relaying media...\n", session->account.username);
+			janus_refcount_decrease(&session->ref);
+			return -1;
+		}
+		session->relayer = janus_reactor_source_create(relay_reactor, &janus_sip_relay_callbacks, session);
+		if(session->relayer == NULL || janus_reactor_source_add(session->relayer, session->media.pipefd[0], TRUE) < 0) {
+			janus_reactor_source_destroy(session->relayer);
+			session->relayer = NULL;
+			janus_mutex_unlock(&session->mutex);
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't add the call to the RTP/RTCP reactor...\n", session->account.username);
+			janus_refcount_decrease(&session->ref);
+			return -1;
+		}
+		JANUS_LOG(LOG_VERB, "Starting relay (%s <--> %s)\n", session->account.username, session->callee);
+		/* Connect UDP sockets and start watching them from the reactor thread */
+		session->media.updated = TRUE;
+		session->media.pollerrs = 0;
+		int code = 1;
+		ssize_t res = 0;
+		do {
+			res = write(session->media.pipefd[1], &code, sizeof(int));
+		} while(res == -1 && errno == EINTR);
+		janus_mutex_unlock(&session->mutex);
+		return 0;
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
+	session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
+	if(error != NULL) {
+		session->relayer_thread = NULL;
+		janus_refcount_decrease(&session->ref);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Shared Sofia stacks: rather than having a NUA (and a thread) per account,
+ * a configurable number of NUAs is created at startup, and each account is
+ * assigned to the least loaded one. Requests we originate use handles bound
+ * to the session of the account, while new incoming requests are routed to
+ * the right session by looking at the user part of the Request-URI (that is,
+ * the Contact we registered) or, as a fallback, of the To header */
+static void *janus_sip_sofia_stack_thread(void *data) {
+	janus_sip_sofia_stack *shared = (janus_sip_sofia_stack *)data;
+	JANUS_LOG(LOG_VERB, "Joining shared sofia loop thread #%u...\n", shared->id);
+	shared->s_root = su_root_create(NULL);
+	char sip_url[128];
+	char *ipv6 = strstr(local_ip, ":");
+	g_snprintf(sip_url, sizeof(sip_url), "sip:%s%s%s:*;transport=udp", ipv6 ? "[" : "", local_ip, ipv6 ? "]" : "");
+	char outbound_options[256] = "use-rport no-validate";
+	if(keepalive_interval > 0)
+		janus_strlcat(outbound_options, " options-keepalive", sizeof(outbound_options));
+	if(!behind_nat)
+		janus_strlcat(outbound_options, " no-natify", sizeof(outbound_options));
+	if(shared->s_root != NULL) {
+		shared->s_nua = nua_create(shared->s_root,
+			janus_sip_sofia_callback,
+			(nua_magic_t *)shared,
+			SIPTAG_ALLOW_STR("INVITE, ACK, BYE, CANCEL, OPTIONS, REFER, MESSAGE, INFO, NOTIFY"),
+			NUTAG_URL(sip_url),
+			SIPTAG_USER_AGENT_STR(user_agent),
+			NUTAG_KEEPALIVE(keepalive_interval * 1000),	/* Sofia expects it in milliseconds */
+			NUTAG_OUTBOUND(outbound_options),
+			NUTAG_APPL_METHOD("REFER"),			/* We'll respond to incoming REFER messages ourselves */
+			SIPTAG_SUPPORTED_STR("replaces"),	/* Advertise that we support the Replaces header */
+			SIPTAG_SUPPORTED(NULL),
+			NTATAG_SIP_T1X64(sip_timer_t1x64),
+			TAG_NULL());
+	}
+	if(shared->s_nua == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating shared Sofia stack #%u\n", shared->id);
+		if(shared->s_root != NULL)
+			su_root_destroy(shared->s_root);
+		shared->s_root = NULL;
+		g_atomic_int_set(&shared->ready, -1);
+		return NULL;
+	}
+	if(query_contact_header)
+		nua_get_params(shared->s_nua, SIPTAG_FROM_STR(""), TAG_END());
+	g_atomic_int_set(&shared->ready, 1);
+	su_root_run(shared->s_root);
+	/* When we get here, we're done */
+	janus_mutex_lock(&shared->mutex);
+	nua_t *s_nua = shared->s_nua;
+	shared->s_nua = NULL;
+	janus_mutex_unlock(&shared->mutex);
+	nua_destroy(s_nua);
+	su_root_destroy(shared->s_root);
+	shared->s_root = NULL;
+	JANUS_LOG(LOG_VERB, "Leaving shared sofia loop thread #%u...\n", shared->id);
+	return NULL;
+}
+
+static int janus_sip_sofia_stacks_create(void) {
+	sofia_stacks = g_malloc0(sofia_stacks_num * sizeof(janus_sip_sofia_stack));
+	int i = 0;
+	for(i=0; i<sofia_stacks_num; i++) {
+		janus_sip_sofia_stack *shared = &sofia_stacks[i];
+		shared->id = i+1;
+		shared->users = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+		janus_mutex_init(&shared->mutex);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "sip stack %u", shared->id);
+		shared->thread = g_thread_try_new(tname, janus_sip_sofia_stack_thread, shared, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the shared Sofia thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_atomic_int_set(&shared->ready, -1);
+		}
+		/* Wait for the NUA to be ready */
+		while(g_atomic_int_get(&shared->ready) == 0)
+			g_usleep(10000);
+		if(g_atomic_int_get(&shared->ready) < 0) {
+			janus_sip_sofia_stacks_destroy();
+			return -1;
+		}
+	}
+	JANUS_LOG(LOG_INFO, "Accounts will share %d Sofia stacks\n", sofia_stacks_num);
+	return 0;
+}
+
+static void janus_sip_sofia_stacks_destroy(void) {
+	if(sofia_stacks == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<sofia_stacks_num; i++) {
+		janus_sip_sofia_stack *shared = &sofia_stacks[i];
+		if(shared->thread == NULL)
+			continue;
+		janus_mutex_lock(&shared->mutex);
+		if(shared->s_nua != NULL)
+			nua_shutdown(shared->s_nua);
+		janus_mutex_unlock(&shared->mutex);
+		g_thread_join(shared->thread);
+		shared->thread = NULL;
+	}
+	for(i=0; i<sofia_stacks_num; i++) {
+		janus_sip_sofia_stack *shared = &sofia_stacks[i];
+		if(shared->users != NULL) {
+			GHashTableIter iter;
+			gpointer value = NULL;
+			g_hash_table_iter_init(&iter, shared->users);
+			while(g_hash_table_iter_next(&iter, NULL, &value))
+				g_list_free((GList *)value);
+			g_hash_table_destroy(shared->users);
+		}
+		g_free(shared->contact_header);
+	}
+	g_free(sofia_stacks);
+	sofia_stacks = NULL;
+	sofia_stacks_num = 0;
+}
+
+static janus_sip_sofia_stack *janus_sip_sofia_stack_pick(janus_sip_session *session) {
+	if(sofia_stacks == NULL || session == NULL)
+		return NULL;
+	if(session->account.sips || session->account.force_tcp || session->account.rfc2543_cancel) {
+		/* The shared stacks can't be configured on an account basis */
+		JANUS_LOG(LOG_VERB, "Account %s needs a dedicated Sofia stack\n", session->account.username);
+		return NULL;
+	}
+	janus_sip_sofia_stack *shared = NULL;
+	int i = 0;
+	for(i=0; i<sofia_stacks_num; i++) {
+		if(shared == NULL || g_atomic_int_get(&sofia_stacks[i].accounts) < g_atomic_int_get(&shared->accounts))
+			shared = &sofia_stacks[i];
+	}
+	return shared;
+}
+
+static void janus_sip_sofia_stack_attach(janus_sip_sofia_stack *shared, janus_sip_session *session) {
+	ssip_t *stack = g_malloc0(sizeof(ssip_t));
+	su_home_init(stack->s_home);
+	stack->session = session;
+	stack->shared = shared;
+	janus_mutex_init(&stack->smutex);
+	janus_mutex_lock(&shared->mutex);
+	stack->s_nua = shared->s_nua;
+	janus_mutex_unlock(&shared->mutex);
+	g_atomic_int_inc(&shared->accounts);
+	session->stack = stack;
+	JANUS_LOG(LOG_VERB, "Account %s is using shared Sofia stack #%u\n", session->account.username, shared->id);
+}
+
+/* Helper to remove a session from the users it was indexed with (shared stack mutex must be locked) */
+static void janus_sip_sofia_stack_unindex(janus_sip_sofia_stack *shared, janus_sip_session *session) {
+	int i = 0;
+	for(i=0; i<2; i++) {
+		char *user = session->stack->shared_users[i];
+		if(user == NULL)
+			continue;
+		GList *list = g_hash_table_lookup(shared->users, user);
+		GList *updated = g_list_remove(list, session);
+		if(updated == NULL)
+			g_hash_table_remove(shared->users, user);
+		else if(updated != list)
+			g_hash_table_insert(shared->users, g_strdup(user), updated);
+		g_free(user);
+		session->stack->shared_users[i] = NULL;
+	}
+}
+
+static void janus_sip_sofia_stack_index(janus_sip_session *session) {
+	ssip_t *stack = session->stack;
+	janus_sip_sofia_stack *shared = stack->shared;
+	if(shared == NULL || session->helper)
+		return;
+	janus_mutex_lock(&shared->mutex);
+	janus_sip_sofia_stack_unindex(shared, session);
+	/* Our Contact uses the authuser, while To will have the username */
+	const char *users[2] = { session->account.authuser, session->account.username };
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(users[i] == NULL || (i == 1 && users[0] != NULL && !strcmp(users[0], users[1])))
+			continue;
+		GList *list = g_hash_table_lookup(shared->users, users[i]);
+		if(list == NULL)
+			g_hash_table_insert(shared->users, g_strdup(users[i]), g_list_append(NULL, session));
+		else
+			list = g_list_append(list, session);
+		stack->shared_users[i] = g_strdup(users[i]);
+	}
+	janus_mutex_unlock(&shared->mutex);
+	/* The user may have changed, so make sure the Contact is recreated */
+	g_free(stack->contact_header);
+	stack->contact_header = NULL;
+}
+
+static janus_sip_session *janus_sip_sofia_stack_lookup(janus_sip_sofia_stack *shared, sip_t const *sip) {
+	if(sip == NULL)
+		return NULL;
+	const char *users[2] = {
+		(sip->sip_request && sip->sip_request->rq_url) ? sip->sip_request->rq_url->url_user : NULL,
+		sip->sip_to ? sip->sip_to->a_url->url_user : NULL
+	};
+	const char *host = sip->sip_to ? sip->sip_to->a_url->url_host : NULL;
+	janus_sip_session *session = NULL;
+	janus_mutex_lock(&shared->mutex);
+	int i = 0;
+	for(i=0; i<2 && session == NULL; i++) {
+		if(users[i] == NULL)
+			continue;
+		/* If different accounts have the same user, prefer the one in the same domain */
+		GList *temp = g_hash_table_lookup(shared->users, users[i]);
+		while(temp != NULL) {
+			janus_sip_session *s = (janus_sip_session *)temp->data;
+			if(!g_atomic_int_get(&s->destroyed)) {
+				if(session == NULL)
+					session = s;
+				if(host != NULL && s->account.identity != NULL) {
+					janus_sip_uri_t identity_uri;
+					if(janus_sip_parse_uri(&identity_uri, s->account.identity) == 0 &&
+							identity_uri.url->url_host != NULL && !g_ascii_strcasecmp(identity_uri.url->url_host, host)) {
+						session = s;
+						break;
+					}
+				}
+			}
+			temp = temp->next;
+		}
+	}
+	janus_mutex_unlock(&shared->mutex);
+	return session;
+}
+
+static char *janus_sip_sofia_stack_contact(janus_sip_sofia_stack *shared, const char *user) {
+	if(shared == NULL || user == NULL)
+		return NULL;
+	char *contact = NULL;
+	janus_mutex_lock(&shared->mutex);
+	if(shared->contact_header != NULL) {
+		/* Use the Contact of the stack, but with the user of this account */
+		const char *header = shared->contact_header;
+		const char *scheme = strchr(header, '<');
+		const char *colon = strchr(scheme ? scheme : header, ':');
+		if(colon != NULL) {
+			const char *host = colon + 1;
+			const char *at = strchr(host, '@'), *end = strpbrk(host, ";>");
+			if(at != NULL && (end == NULL || at < end))
+				host = at + 1;
+			contact = g_strdup_printf("%.*s%s@%s", (int)(colon + 1 - header), header, user, host);
+		}
+	}
+	janus_mutex_unlock(&shared->mutex);
+	return contact;
+}
+
+/* Detaching a session is done in the stack thread: this way we're sure no
+ * callback is in progress for the session, and that none will follow */
+static int janus_sip_sofia_stack_detach_internal(void *data) {
+	janus_sip_session *session = (janus_sip_session *)data;
+	ssip_t *stack = session->stack;
+	janus_sip_sofia_stack *shared = stack->shared;
+	if(!session->helper) {
+		/* Stop routing new requests to this session */
+		janus_mutex_lock(&shared->mutex);
+		janus_sip_sofia_stack_unindex(shared, session);
+		janus_mutex_unlock(&shared->mutex);
+		g_atomic_int_dec_and_test(&shared->accounts);
+	}
+	janus_mutex_lock(&stack->smutex);
+	stack->s_nua = NULL;
+	stack->s_nh_r = NULL;
+	stack->s_nh_i = NULL;
+	stack->s_nh_m = NULL;
+	if(stack->subscriptions != NULL) {
+		/* The table destroys the subscription handles itself */
+		GHashTableIter iter;
+		gpointer value = NULL;
+		g_hash_table_iter_init(&iter, stack->subscriptions);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			if(stack->handles != NULL && g_hash_table_remove(stack->handles, value))
+				g_atomic_int_dec_and_test(&shared->handles);
+		}
+		g_hash_table_unref(stack->subscriptions);
+		stack->subscriptions = NULL;
+	}
+	GHashTable *handles = stack->handles;
+	stack->handles = NULL;
+	janus_mutex_unlock(&stack->smutex);
+	if(handles != NULL) {
+		g_atomic_int_add(&shared->handles, -(gint)g_hash_table_size(handles));
+		GHashTableIter iter;
+		gpointer key = NULL;
+		g_hash_table_iter_init(&iter, handles);
+		while(g_hash_table_iter_next(&iter, &key, NULL))
+			nua_handle_destroy((nua_handle_t *)key);
+		g_hash_table_destroy(handles);
+	}
+	/* We won't get any event for those handles anymore, which means
+	 * we need to get rid of the references for calls in progress */
+	janus_sip_session *master = (session->helper && session->master) ? session->master : session;
+	janus_mutex_lock(&master->mutex);
+	while(g_list_find(master->active_calls, session) != NULL) {
+		JANUS_LOG(LOG_VERB, "[%p] Removing reference\n", session);
+		master->active_calls = g_list_remove(master->active_calls, session);
+		janus_refcount_decrease(&session->ref);
+	}
+	janus_mutex_unlock(&master->mutex);
+	return 0;
+}
+
+static void janus_sip_sofia_stack_detach(janus_sip_session *session) {
+	janus_sip_sofia_stack *shared = session->stack ? session->stack->shared : NULL;
+	if(shared == NULL || shared->s_root == NULL)
+		return;
+	su_task_execute(su_root_task(shared->s_root), janus_sip_sofia_stack_detach_internal, session, NULL);
+}
+
+static janus_sip_session *janus_sip_sofia_stack_callback(janus_sip_sofia_stack *shared, nua_event_t event,
+		int status, char const *phrase, nua_handle_t *nh, sip_t const *sip, tagi_t tags[]) {
+	switch(event) {
+		case nua_i_invite:
+		case nua_i_message:
+		case nua_i_info:
+		case nua_i_refer:
+		case nua_i_notify: {
+			/* New request, find the account it's meant for */
+			janus_sip_session *session = janus_sip_sofia_stack_lookup(shared, sip);
+			if(session == NULL) {
+				JANUS_LOG(LOG_WARN, "[stack #%u][%s]: no account for this request, rejecting it\n",
+					shared->id, nua_event_name(event));
+				nua_respond(nh, 404, sip_status_phrase(404), TAG_END());
+				nua_handle_destroy(nh);
+				return NULL;
+			}
+			nua_handle_bind(nh, session);
+			janus_sip_nua_handle_track(session, nh);
+			return session;
+		}
+		case nua_r_get_params: {
+			JANUS_LOG(LOG_VERB, "[stack #%u][%s]: %d %s\n", shared->id, nua_event_name(event), status, phrase ? phrase : "??");
+			const tagi_t *from = NULL;
+			if(status != 200 || (from = tl_find(tags, siptag_from_str)) == NULL || from->t_value == 0) {
+				JANUS_LOG(LOG_WARN, "Unable to find 'siptag_from_str' among all the tags\n");
+				break;
+			}
+			janus_mutex_lock(&shared->mutex);
+			g_free(shared->contact_header);
+			shared->contact_header = g_strdup((const char *)from->t_value);
+			janus_mutex_unlock(&shared->mutex);
+			break;
+		}
+		case nua_r_shutdown:
+			JANUS_LOG(LOG_VERB, "[stack #%u][%s]: %d %s\n", shared->id, nua_event_name(event), status, phrase ? phrase : "??");
+			/* End the event loop: su_root_run() will return */
+			if(status >= 200)
+				su_root_break(shared->s_root);
+			break;
+		default:
+			JANUS_LOG(LOG_VERB, "[stack #%u][%s]: %d %s\n", shared->id, nua_event_name(event), status, phrase ? phrase : "??");
+			break;
+	}
+	return NULL;
+}
+
+static json_t *janus_sip_sofia_stacks_summary(void) {
+	json_t *list = json_array();
+	int i = 0;
+	for(i=0; i<sofia_stacks_num; i++) {
+		janus_sip_sofia_stack *shared = &sofia_stacks[i];
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(shared->id));
+		json_object_set_new(info, "accounts", json_integer(g_atomic_int_get(&shared->accounts)));
+		json_object_set_new(info, "handles", json_integer(g_atomic_int_get(&shared->handles)));
+		json_array_append_new(list, info);
+	}
+	return list;
+}
+
+static nua_handle_t *janus_sip_nua_handle(janus_sip_session *session, nua_t *nua) {
+	if(nua == NULL)
+		return NULL;
+	nua_handle_t *nh = nua_handle(nua, session, TAG_END());
+	janus_sip_nua_handle_track(session, nh);
+	return nh;
+}
+
+static void janus_sip_nua_handle_track(janus_sip_session *session, nua_handle_t *nh) {
+	if(session == NULL || session->stack == NULL || session->stack->shared == NULL || nh == NULL)
+		return;
+	/* The NUA is shared, so the Contact must be set on a handle basis: besides,
+	 * we need to keep track of the handle, as we'll have to destroy it ourselves */
+	janus_sip_session *account = (session->helper && session->master) ? session->master : session;
+	nua_set_hparams(nh,
+		NUTAG_M_USERNAME(account->account.authuser ? account->account.authuser : account->account.username),
+		TAG_IF(account->account.user_agent, SIPTAG_USER_AGENT_STR(account->account.user_agent)),
+		TAG_END());
+	janus_mutex_lock(&session->stack->smutex);
+	if(session->stack->handles == NULL)
+		session->stack->handles = g_hash_table_new(NULL, NULL);
+	if(!g_hash_table_contains(session->stack->handles, nh)) {
+		g_hash_table_add(session->stack->handles, nh);
+		g_atomic_int_inc(&session->stack->shared->handles);
+	}
+	janus_mutex_unlock(&session->stack->smutex);
+}
+
+static void janus_sip_nua_handle_untrack(janus_sip_session *session, nua_handle_t *nh) {
+	if(session == NULL || session->stack == NULL || session->stack->shared == NULL || nh == NULL)
+		return;
+	janus_mutex_lock(&session->stack->smutex);
+	gboolean found = session->stack->handles ? g_hash_table_remove(session->stack->handles, nh) : FALSE;
+	janus_mutex_unlock(&session->stack->smutex);
+	if(found)
+		g_atomic_int_dec_and_test(&session->stack->shared->handles);
+}
+
+static void janus_sip_nua_handle_destroy(janus_sip_session *session, nua_handle_t *nh) {
+	if(nh == NULL)
+		return;
+	janus_sip_nua_handle_untrack(session, nh);
+	nua_handle_destroy(nh);
+}
 
 /* Sofia Event thread */
 gpointer janus_sip_sofia_thread(gpointer user_data) {
@@ -956,6 +956,7 @@ void janus_streaming_data_ready(janus_plugin_session *handle);
 void janus_streaming_hangup_media(janus_plugin_session *handle);
 void janus_streaming_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_streaming_query_session(janus_plugin_session *handle);
+void janus_streaming_estimated_bandwidth(janus_plugin_session *handle, uint32_t estimate);
 static int janus_streaming_get_fd_port(int fd);
 
 /* Plugin setup */
@@ -982,6 +983,7 @@ static janus_plugin janus_streaming_plugin =
 		.hangup_media = janus_streaming_hangup_media,
 		.destroy_session = janus_streaming_destroy_session,
 		.query_session = janus_streaming_query_session,
+		.estimated_bandwidth = janus_streaming_estimated_bandwidth,
 	);
 
 /* Plugin creator */
@@ -1216,6 +1218,7 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
+static gboolean bwe_layer_selection = FALSE;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_streaming_handler(void *data);
@@ -2021,6 +2024,12 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "Streaming will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *bwe = janus_config_get(config, config_general, janus_config_type_item, "bwe_layer_selection");
+		if(bwe != NULL && bwe->value != NULL)
+			bwe_layer_selection = janus_is_true(bwe->value);
+		if(bwe_layer_selection) {
+			JANUS_LOG(LOG_INFO, "Streaming will cap simulcast layers according to the bandwidth estimate for viewers\n");
+		}
 	}
 	/* Iterate on all mountpoints */
 	mountpoints = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -2981,6 +2990,12 @@ json_t *janus_streaming_query_session(janus_plugin_session *handle) {
 					json_object_set_new(simulcast, "temporal-layer-target", json_integer(s->sim_context.templayer_target));
 					if(s->sim_context.drop_trigger > 0)
 						json_object_set_new(simulcast, "fallback", json_integer(s->sim_context.drop_trigger));
+					guint32 bwe_estimate = (guint32)g_atomic_int_get(&s->sim_context.bwe_estimate);
+					if(bwe_estimate > 0) {
+						json_object_set_new(simulcast, "bwe-estimate", json_integer(bwe_estimate));
+						json_object_set_new(simulcast, "bwe-substream-cap", json_integer(s->sim_context.substream_bwe));
+						json_object_set_new(simulcast, "bwe-temporal-layer-cap", json_integer(s->sim_context.templayer_bwe));
+					}
 					json_object_set_new(info, "simulcast", simulcast);
 				}
 				if(stream->svc) {
@@ -5602,12 +5617,14 @@ void janus_streaming_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 		JANUS_LOG(LOG_HUGE, "Got video RTCP feedback from a viewer: SSRC %"SCNu32"\n",
 			janus_rtcp_get_sender_ssrc(buf, len));
 		/* We only relay PLI/FIR and REMB packets, but in a selective way */
-		if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len)) {
+		janus_rtcp_summary summary;
+		janus_rtcp_summarize(buf, len, &summary);
+		if(summary.fir || summary.pli) {
 			/* We got a PLI/FIR, pass it along unless we just sent one */
 			JANUS_LOG(LOG_HUGE, "  -- Keyframe request\n");
 			janus_streaming_rtcp_pli_send(stream);
 		}
-		uint64_t bw = janus_rtcp_get_remb(buf, len);
+		uint64_t bw = summary.remb;
 		if(bw > 0) {
 			/* Keep track of this value, if this is the lowest right now */
 			JANUS_LOG(LOG_HUGE, "  -- REMB for this PeerConnection: %"SCNu64"\n", bw);
@@ -5630,6 +5647,55 @@ void janus_streaming_data_ready(janus_plugin_session *handle) {
 	}
 }
 
+void janus_streaming_estimated_bandwidth(janus_plugin_session *handle, uint32_t estimate) {
+	/* The core estimated how much we can send to this viewer: if so configured,
+	 * we use it to cap the simulcast substreams/layers we relay */
+	if(!bwe_layer_selection || handle == NULL || g_atomic_int_get(&handle->stopped) ||
+			g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	janus_mutex_lock(&sessions_mutex);
+	janus_streaming_session *session = janus_streaming_lookup_session(handle);
+	if(!session || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->hangingup)) {
+		janus_mutex_unlock(&sessions_mutex);
+		return;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&sessions_mutex);
+	janus_mutex_lock(&session->mutex);
+	janus_streaming_mountpoint *mp = session->mountpoint;
+	if(mp != NULL)
+		janus_refcount_increase(&mp->ref);
+	janus_mutex_unlock(&session->mutex);
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp) {
+		if(mp != NULL)
+			janus_refcount_decrease(&mp->ref);
+		janus_refcount_decrease(&session->ref);
+		return;
+	}
+	/* The estimate is for the whole PeerConnection: split it among the video streams */
+	janus_mutex_lock(&mp->mutex);
+	guint32 videos = 0;
+	GList *temp = session->streams;
+	while(temp) {
+		janus_streaming_session_stream *s = (janus_streaming_session_stream *)temp->data;
+		if(s->stream->type == JANUS_STREAMING_MEDIA_VIDEO && s->send)
+			videos++;
+		temp = temp->next;
+	}
+	temp = session->streams;
+	while(temp) {
+		janus_streaming_session_stream *s = (janus_streaming_session_stream *)temp->data;
+		if(s->stream->type == JANUS_STREAMING_MEDIA_VIDEO && s->stream->simulcast)
+			g_atomic_int_set(&s->sim_context.bwe_estimate, (gint)(videos ? estimate/videos : estimate));
+		temp = temp->next;
+	}
+	janus_mutex_unlock(&mp->mutex);
+	JANUS_LOG(LOG_HUGE, "[%s-%p] Estimated bandwidth: %"SCNu32" (%"SCNu32" video streams)\n",
+		JANUS_STREAMING_PACKAGE, handle, estimate, videos);
+	janus_refcount_decrease(&mp->ref);
+	janus_refcount_decrease(&session->ref);
+}
+
 void janus_streaming_hangup_media(janus_plugin_session *handle) {
 	JANUS_LOG(LOG_INFO, "[%s-%p] No WebRTC media anymore\n", JANUS_STREAMING_PACKAGE, handle);
 	janus_mutex_lock(&sessions_mutex);
@@ -8944,6 +9010,8 @@ static void *janus_streaming_ondemand_thread(void *data) {
 		g_thread_unref(g_thread_self());
 		return NULL;
 	}
+	/* Stick to the same CPU as the viewer's event loop, if pinned */
+	gateway->inherit_affinity(session->handle);
 	janus_streaming_file_source *source = mountpoint->source;
 	if(source == NULL || source->filename == NULL) {
 		JANUS_LOG(LOG_ERR, "[%s] Invalid file source mountpoint!\n", mountpoint->name);
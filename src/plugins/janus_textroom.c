@@ -336,7 +336,8 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"username" : "<unique username to have in the room; mandatory>",
 	"display" : "<display name to use in the room; optional>",
 	"token" : "<invitation token, in case the room has an ACL; optional>",
-	"history" : <true|false, whether to retrieve history messages when available (default=true)>
+	"history" : <true|false, whether to retrieve history messages when available (default=true)>,
+	"batch" : <true|false, whether messages can be batched, see below (default=false)>
 }
 \endverbatim
  *
@@ -450,13 +451,25 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"from" : "<username of participant who sent the public message>",
 	"date" : "<date/time of when the message was sent>",
 	"text" : "<content of the message>",
-	"whisper" : <true|false, depending on whether it's a public or private message>
+	"whisper" : <true|false, depending on whether it's a public or private message>,
+	"display" : "<display name of participant who sent the message, if any>"
 }
 \endverbatim
  *
  * In case the \c whisper attribute is \c true it means the user actually
  * received a  private message from another participant in the room.
  *
+ * Messages and announcements are serialized only once, in compact form,
+ * no matter how many participants they're sent to (and no matter what the
+ * \c json setting is). In large rooms, many small messages may still
+ * result in many small DataChannel sends, though: when a \c batch_window
+ * (in milliseconds) is configured, participants that joined with \c batch
+ * set to \c true will receive messages and announcements in batches
+ * instead, that is at most once per window, as a JSON array of the
+ * events described above (a batch with a single event is sent as is).
+ * Other events are never batched, but are always delivered after any
+ * pending batch, so the order of events is preserved.
+ *
  * Another way of injecting text into rooms is by means of announcements.
  * Announcements are basically messages sent by the room itself, rather
  * than individual users: as such, only users or applications managing
@@ -639,7 +652,8 @@ static struct janus_json_parameter join_parameters[] = {
 	{"pin", JSON_STRING, 0},
 	{"token", JSON_STRING, 0},
 	{"display", JSON_STRING, 0},
-	{"history", JANUS_JSON_BOOL, 0}
+	{"history", JANUS_JSON_BOOL, 0},
+	{"batch", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter message_parameters[] = {
 	{"text", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -669,6 +683,43 @@ static void janus_textroom_hangup_media_internal(janus_plugin_session *handle);
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Batching of messages for participants that asked for it */
+#define JANUS_TEXTROOM_BATCH_MAX_WINDOW		1000
+#define JANUS_TEXTROOM_BATCH_MAX_MESSAGE	1024
+#define JANUS_TEXTROOM_BATCH_MAX_SIZE		16384
+static uint16_t batch_window = 0;
+static GThread *batch_thread = NULL;
+static void *janus_textroom_batcher(void *data);
+static GList *batch_list = NULL;
+static janus_mutex batch_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Messages and announcements are serialized once, and the same buffer is
+ * shared by all the recipients, the pending batches and the room history */
+typedef struct janus_textroom_buffer {
+	char *text;
+	size_t length;
+	janus_refcount ref;
+} janus_textroom_buffer;
+static void janus_textroom_buffer_free(const janus_refcount *buffer_ref) {
+	janus_textroom_buffer *buffer = janus_refcount_containerof(buffer_ref, janus_textroom_buffer, ref);
+	free(buffer->text);
+	g_free(buffer);
+}
+static janus_textroom_buffer *janus_textroom_buffer_create(json_t *msg) {
+	char *text = json_dumps(msg, JSON_COMPACT | JSON_PRESERVE_ORDER);
+	if(text == NULL)
+		return NULL;
+	janus_textroom_buffer *buffer = g_malloc(sizeof(janus_textroom_buffer));
+	buffer->text = text;
+	buffer->length = strlen(text);
+	janus_refcount_init(&buffer->ref, janus_textroom_buffer_free);
+	return buffer;
+}
+static void janus_textroom_buffer_unref(janus_textroom_buffer *buffer) {
+	if(buffer)
+		janus_refcount_decrease(&buffer->ref);
+}
+
 
 typedef struct janus_textroom_room {
 	guint64 room_id;			/* Unique room ID (when using integers) */
@@ -680,7 +731,9 @@ typedef struct janus_textroom_room {
 	gchar *http_backend;		/* Server to contact via HTTP POST for incoming messages, if any */
 	GHashTable *participants;	/* Map of participants */
 	uint16_t history_size;		/* Number of messages we should store in the history */
-	GQueue *history;			/* History of past messages */
+	janus_textroom_buffer **history;	/* History of past messages, as a ring of history_size buffers */
+	uint16_t history_start;		/* Index of the oldest message in the history */
+	uint16_t history_count;		/* Number of messages currently in the history */
 	gboolean check_tokens;		/* Whether to check tokens when participants join (see below) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
 	volatile gint destroyed;	/* Whether this room has been destroyed */
@@ -711,6 +764,11 @@ typedef struct janus_textroom_participant {
 	janus_textroom_room *room;	/* Room this participant is in */
 	gchar *username;			/* Unique username in the room */
 	gchar *display;				/* Display name in the room, if any */
+	gboolean batch;				/* Whether messages for this participant can be batched */
+	GList *pending;				/* Messages waiting to be sent as a batch (most recent first) */
+	size_t pending_bytes;		/* Size of the messages waiting to be sent */
+	struct janus_textroom_session *pending_session;	/* Session to send the batch to (we hold a reference) */
+	janus_mutex send_mutex;		/* Mutex to keep batches and immediate messages in order */
 	janus_mutex mutex;			/* Mutex to lock this session */
 	volatile gint destroyed;	/* Whether this participant has been destroyed */
 	janus_refcount ref;
@@ -730,11 +788,30 @@ static void janus_textroom_room_free(const janus_refcount *textroom_ref) {
 	g_free(textroom->http_backend);
 	g_hash_table_destroy(textroom->participants);
 	g_hash_table_destroy(textroom->allowed);
-	if(textroom->history)
-		g_queue_free_full(textroom->history, (GDestroyNotify)g_free);
+	if(textroom->history) {
+		uint16_t i = 0;
+		for(i=0; i<textroom->history_count; i++)
+			janus_textroom_buffer_unref(textroom->history[(textroom->history_start+i) % textroom->history_size]);
+		g_free(textroom->history);
+	}
 	g_free(textroom);
 }
 
+/* Add a message to the history of a room, replacing the oldest one if the ring is full */
+static void janus_textroom_room_history_add(janus_textroom_room *textroom, janus_textroom_buffer *buffer) {
+	if(textroom->history == NULL || textroom->history_size == 0 || buffer == NULL)
+		return;
+	janus_refcount_increase(&buffer->ref);
+	if(textroom->history_count < textroom->history_size) {
+		textroom->history[(textroom->history_start+textroom->history_count) % textroom->history_size] = buffer;
+		textroom->history_count++;
+	} else {
+		janus_textroom_buffer_unref(textroom->history[textroom->history_start]);
+		textroom->history[textroom->history_start] = buffer;
+		textroom->history_start = (textroom->history_start+1) % textroom->history_size;
+	}
+}
+
 static void janus_textroom_session_destroy(janus_textroom_session *session) {
 	if(session && g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
 		janus_refcount_decrease(&session->ref);
@@ -760,11 +837,115 @@ static void janus_textroom_participant_destroy(janus_textroom_participant *parti
 static void janus_textroom_participant_free(const janus_refcount *participant_ref) {
 	janus_textroom_participant *participant = janus_refcount_containerof(participant_ref, janus_textroom_participant, ref);
 	/* This participant can be destroyed, free all the resources */
+	g_list_free_full(participant->pending, (GDestroyNotify)janus_textroom_buffer_unref);
+	if(participant->pending_session)
+		janus_refcount_decrease(&participant->pending_session->ref);
 	g_free(participant->username);
 	g_free(participant->display);
 	g_free(participant);
 }
 
+/* Send a list of messages (oldest first) as a single JSON array, or as is if it's just one */
+static void janus_textroom_batch_send(janus_textroom_session *session, GList *pending, size_t bytes) {
+	if(session == NULL || pending == NULL)
+		return;
+	janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = NULL, .length = 0 };
+	if(pending->next == NULL) {
+		janus_textroom_buffer *buffer = (janus_textroom_buffer *)pending->data;
+		data.buffer = buffer->text;
+		data.length = buffer->length;
+		gateway->relay_data(session->handle, &data);
+		return;
+	}
+	GString *batch = g_string_sized_new(bytes + g_list_length(pending) + 2);
+	g_string_append_c(batch, '[');
+	GList *temp = pending;
+	while(temp) {
+		janus_textroom_buffer *buffer = (janus_textroom_buffer *)temp->data;
+		if(temp != pending)
+			g_string_append_c(batch, ',');
+		g_string_append_len(batch, buffer->text, buffer->length);
+		temp = temp->next;
+	}
+	g_string_append_c(batch, ']');
+	data.buffer = batch->str;
+	data.length = batch->len;
+	gateway->relay_data(session->handle, &data);
+	g_string_free(batch, TRUE);
+}
+
+/* Send any message still waiting to be batched for a participant
+ * (must be called with the participant send_mutex locked) */
+static void janus_textroom_participant_flush_locked(janus_textroom_participant *participant) {
+	janus_mutex_lock(&participant->mutex);
+	GList *pending = g_list_reverse(participant->pending);
+	size_t bytes = participant->pending_bytes;
+	janus_textroom_session *session = participant->pending_session;
+	participant->pending = NULL;
+	participant->pending_bytes = 0;
+	participant->pending_session = NULL;
+	janus_mutex_unlock(&participant->mutex);
+	if(pending == NULL)
+		return;
+	if(!g_atomic_int_get(&participant->destroyed))
+		janus_textroom_batch_send(session, pending, bytes);
+	g_list_free_full(pending, (GDestroyNotify)janus_textroom_buffer_unref);
+	if(session)
+		janus_refcount_decrease(&session->ref);
+}
+static void janus_textroom_participant_flush(janus_textroom_participant *participant) {
+	if(participant == NULL)
+		return;
+	janus_mutex_lock(&participant->send_mutex);
+	janus_textroom_participant_flush_locked(participant);
+	janus_mutex_unlock(&participant->send_mutex);
+}
+
+/* Send a message to a participant right away, after any message still pending */
+static void janus_textroom_participant_relay(janus_textroom_participant *participant, janus_plugin_data *data) {
+	if(participant == NULL || participant->session == NULL || data == NULL)
+		return;
+	janus_mutex_lock(&participant->send_mutex);
+	janus_textroom_participant_flush_locked(participant);
+	gateway->relay_data(participant->session->handle, data);
+	janus_mutex_unlock(&participant->send_mutex);
+}
+
+/* Send a message or announcement to a participant: if the participant asked
+ * for batching, small messages are queued and sent by the batcher thread */
+static void janus_textroom_participant_send(janus_textroom_participant *participant, janus_textroom_buffer *buffer) {
+	if(participant == NULL || participant->session == NULL || buffer == NULL)
+		return;
+	if(!participant->batch || batch_window == 0 || buffer->length > JANUS_TEXTROOM_BATCH_MAX_MESSAGE) {
+		/* Send right away, but make sure we don't send it before messages still pending */
+		janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = buffer->text, .length = buffer->length };
+		janus_textroom_participant_relay(participant, &data);
+		return;
+	}
+	janus_mutex_lock(&participant->send_mutex);
+	janus_mutex_lock(&participant->mutex);
+	if(participant->pending_bytes + buffer->length + 2 > JANUS_TEXTROOM_BATCH_MAX_SIZE) {
+		/* No room for this message in the current batch, send that first */
+		janus_mutex_unlock(&participant->mutex);
+		janus_textroom_participant_flush_locked(participant);
+		janus_mutex_lock(&participant->mutex);
+	}
+	if(participant->pending == NULL) {
+		/* First message of a new batch, the batcher thread will have to send it */
+		janus_refcount_increase(&participant->session->ref);
+		participant->pending_session = participant->session;
+		janus_refcount_increase(&participant->ref);
+		janus_mutex_lock(&batch_mutex);
+		batch_list = g_list_prepend(batch_list, participant);
+		janus_mutex_unlock(&batch_mutex);
+	}
+	janus_refcount_increase(&buffer->ref);
+	participant->pending = g_list_prepend(participant->pending, buffer);
+	participant->pending_bytes += buffer->length;
+	janus_mutex_unlock(&participant->mutex);
+	janus_mutex_unlock(&participant->send_mutex);
+}
+
 
 typedef struct janus_textroom_message {
 	janus_plugin_session *handle;
@@ -899,6 +1080,14 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 			}
 		}
+		/* Should messages be batched for participants that ask for it? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "batch_window");
+		if(item && item->value) {
+			if(janus_string_to_uint16(item->value, &batch_window) < 0 || batch_window > JANUS_TEXTROOM_BATCH_MAX_WINDOW) {
+				JANUS_LOG(LOG_WARN, "Invalid batch window value (%s), disabling batching...\n", item->value);
+				batch_window = 0;
+			}
+		}
 		/* Any admin key to limit who can "create"? */
 		janus_config_item *key = janus_config_get(config, config_general, janus_config_type_item, "admin_key");
 		if(key != NULL && key->value != NULL)
@@ -987,7 +1176,7 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 					JANUS_LOG(LOG_WARN, "Invalid history size value (%s), disabling history...\n", history->value);
 				} else {
 					if(textroom->history_size > 0)
-						textroom->history = g_queue_new();
+						textroom->history = g_malloc0(textroom->history_size * sizeof(janus_textroom_buffer *));
 				}
 			}
 			if(post != NULL && post->value != NULL) {
@@ -1045,6 +1234,18 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		g_error_free(error);
 		return -1;
 	}
+	if(batch_window > 0) {
+		/* Launch the thread that will send batched messages */
+		batch_thread = g_thread_try_new("textroom batcher", janus_textroom_batcher, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TextRoom batcher thread, disabling batching...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			batch_window = 0;
+		} else {
+			JANUS_LOG(LOG_INFO, "Messages will be batched every %"SCNu16"ms for participants that ask for it\n", batch_window);
+		}
+	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_TEXTROOM_NAME);
 	return 0;
 }
@@ -1059,6 +1260,10 @@ void janus_textroom_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	if(batch_thread != NULL) {
+		g_thread_join(batch_thread);
+		batch_thread = NULL;
+	}
 
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
@@ -1536,9 +1741,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		json_object_set_new(msg, "text", json_string(message));
 		if(username || usernames)
 			json_object_set_new(msg, "whisper", json_true());
-		char *msg_text = json_dumps(msg, json_format);
-		if(msg_text == NULL) {
-			json_decref(msg);
+		if(participant->display != NULL)
+			json_object_set_new(msg, "display", json_string(participant->display));
+		/* Serialize the message once: all recipients and the history will share it */
+		janus_textroom_buffer *buffer = janus_textroom_buffer_create(msg);
+		json_decref(msg);
+		if(buffer == NULL) {
 			janus_mutex_unlock(&textroom->mutex);
 			janus_refcount_decrease(&textroom->ref);
 			JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
@@ -1546,12 +1754,6 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			g_snprintf(error_cause, 512, "Failed to stringify message");
 			goto msg_response;
 		}
-		char *history_text = NULL;
-		if(textroom->history) {
-			json_object_set_new(msg, "display", json_string(participant->display));
-			history_text = json_dumps(msg, json_format);
-		}
-		json_decref(msg);
 		/* Start preparing the response too */
 		reply = json_object();
 		json_object_set_new(reply, "textroom", json_string("success"));
@@ -1564,8 +1766,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			janus_textroom_participant *top = g_hash_table_lookup(textroom->participants, to);
 			if(top) {
 				janus_refcount_increase(&top->ref);
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-				gateway->relay_data(top->session->handle, &data);
+				janus_textroom_participant_send(top, buffer);
 				janus_refcount_decrease(&top->ref);
 				json_object_set_new(sent, to, json_true());
 			} else {
@@ -1584,8 +1785,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = g_hash_table_lookup(textroom->participants, to);
 				if(top) {
 					janus_refcount_increase(&top->ref);
-					janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-					gateway->relay_data(top->session->handle, &data);
+					janus_textroom_participant_send(top, buffer);
 					janus_refcount_decrease(&top->ref);
 					json_object_set_new(sent, to, json_true());
 				} else {
@@ -1605,19 +1805,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 					janus_textroom_participant *top = value;
 					JANUS_LOG(LOG_VERB, "  >> To %s in %s: %s\n", top->username, room_id_str, message);
 					janus_refcount_increase(&top->ref);
-					janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-					gateway->relay_data(top->session->handle, &data);
+					janus_textroom_participant_send(top, buffer);
 					janus_refcount_decrease(&top->ref);
 				}
 			}
-			if(textroom->history && history_text) {
-				/* Store in the history */
-				g_queue_push_tail(textroom->history, history_text);
-				if(g_queue_get_length(textroom->history) > textroom->history_size) {
-					char *text = (char *)g_queue_pop_head(textroom->history);
-					g_free(text);
-				}
-			}
+			/* Store in the history */
+			janus_textroom_room_history_add(textroom, buffer);
 #ifdef HAVE_LIBCURL
 			/* Is there a backend waiting for this message too? */
 			if(textroom->http_backend) {
@@ -1633,7 +1826,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 					headers = curl_slist_append(headers, "Content-Type: application/json");
 					headers = curl_slist_append(headers, "charsets: utf-8");
 					curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_text);
+					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, buffer->text);
 					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
 					/* Send the request */
 					res = curl_easy_perform(curl);
@@ -1649,7 +1842,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 #endif
 		}
 		janus_refcount_decrease(&participant->ref);
-		free(msg_text);
+		janus_textroom_buffer_unref(buffer);
 		janus_mutex_unlock(&textroom->mutex);
 		janus_refcount_decrease(&textroom->ref);
 		/* By default we send a confirmation back to the user that sent this message:
@@ -1754,7 +1947,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		participant->room = textroom;
 		participant->username = g_strdup(username_text);
 		participant->display = display_text ? g_strdup(display_text) : NULL;
+		participant->batch = json_is_true(json_object_get(root, "batch"));
+		participant->pending = NULL;
+		participant->pending_bytes = 0;
+		participant->pending_session = NULL;
 		participant->destroyed = 0;
+		janus_mutex_init(&participant->send_mutex);
 		janus_mutex_init(&participant->mutex);
 		janus_refcount_init(&participant->ref, janus_textroom_participant_free);
 		janus_refcount_increase(&participant->ref);
@@ -1766,19 +1964,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		/* Check if we need to send some history back */
 		json_t *history = json_object_get(root, "history");
 		gboolean send_history = history ? json_is_true(history) : TRUE;
-		if(send_history) {
-			if(textroom->history != NULL && textroom->history->head != NULL) {
-				GList *temp = textroom->history->head;
-				char *text = NULL;
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = NULL, .length = 0 };
-				while(temp) {
-					text = (char *)temp->data;
-					data.buffer = text;
-					data.length = strlen(text);
-					gateway->relay_data(handle, &data);
-					temp = temp->next;
-				}
-			}
+		if(send_history && textroom->history != NULL) {
+			uint16_t i = 0;
+			for(i=0; i<textroom->history_count; i++)
+				janus_textroom_participant_send(participant, textroom->history[(textroom->history_start+i) % textroom->history_size]);
+			/* If the history was batched, send it before the join event */
+			janus_textroom_participant_flush(participant);
 		}
 		/* Notify all participants */
 		JANUS_LOG(LOG_VERB, "Notifying all participants about the new join\n");
@@ -1814,7 +2005,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 					continue;	/* Skip us */
 				janus_refcount_increase(&top->ref);
 				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				gateway->relay_data(top->session->handle, &data);
+				janus_textroom_participant_relay(top, &data);
 				/* Take note of this user */
 				json_t *p = json_object();
 				json_object_set_new(p, "username", json_string(top->username));
@@ -1896,6 +2087,8 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		g_hash_table_remove(textroom->participants, participant->username);
 		participant->session = NULL;
 		participant->room = NULL;
+		/* Deliver any message still waiting to be batched before the leave */
+		janus_textroom_participant_flush(participant);
 		/* Notify all participants */
 		JANUS_LOG(LOG_VERB, "Notifying all participants about the new leave\n");
 		if(textroom->participants) {
@@ -1929,7 +2122,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 					continue;	/* Skip us */
 				janus_refcount_increase(&top->ref);
 				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				gateway->relay_data(top->session->handle, &data);
+				janus_textroom_participant_relay(top, &data);
 				janus_refcount_decrease(&top->ref);
 			}
 			free(event_text);
@@ -2263,7 +2456,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = value;
 				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
 				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = event_text, .length = strlen(event_text) };
-				gateway->relay_data(top->session->handle, &data);
+				janus_textroom_participant_relay(top, &data);
 			}
 			free(event_text);
 		}
@@ -2353,9 +2546,9 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		strftime(msgTime, sizeof(msgTime), "%FT%T%z", tm_info);
 		json_object_set_new(msg, "date", json_string(msgTime));
 		json_object_set_new(msg, "text", json_string(message));
-		char *msg_text = json_dumps(msg, json_format);
+		janus_textroom_buffer *buffer = janus_textroom_buffer_create(msg);
 		json_decref(msg);
-		if(msg_text == NULL) {
+		if(buffer == NULL) {
 			janus_mutex_unlock(&textroom->mutex);
 			janus_refcount_decrease(&textroom->ref);
 			JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
@@ -2372,19 +2565,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = value;
 				JANUS_LOG(LOG_VERB, "  >> To %s in %s: %s\n", top->username, room_id_str, message);
 				janus_refcount_increase(&top->ref);
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-				gateway->relay_data(top->session->handle, &data);
+				janus_textroom_participant_send(top, buffer);
 				janus_refcount_decrease(&top->ref);
 			}
 		}
-		if(textroom->history) {
-			/* Store in the history */
-			g_queue_push_tail(textroom->history, g_strdup(msg_text));
-			if(g_queue_get_length(textroom->history) > textroom->history_size) {
-				char *text = (char *)g_queue_pop_head(textroom->history);
-				g_free(text);
-			}
-		}
+		/* Store in the history */
+		janus_textroom_room_history_add(textroom, buffer);
 #ifdef HAVE_LIBCURL
 		/* Is there a backend waiting for this message too? */
 		if(textroom->http_backend) {
@@ -2400,7 +2586,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				headers = curl_slist_append(headers, "Content-Type: application/json");
 				headers = curl_slist_append(headers, "charsets: utf-8");
 				curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_text);
+				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, buffer->text);
 				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
 				/* Send the request */
 				res = curl_easy_perform(curl);
@@ -2414,7 +2600,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			}
 		}
 #endif
-		free(msg_text);
+		janus_textroom_buffer_unref(buffer);
 		janus_mutex_unlock(&textroom->mutex);
 		janus_refcount_decrease(&textroom->ref);
 		if(!internal) {
@@ -2554,7 +2740,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		if(history) {
 			textroom->history_size = json_integer_value(history);
 			if(textroom->history_size > 0)
-				textroom->history = g_queue_new();
+				textroom->history = g_malloc0(textroom->history_size * sizeof(janus_textroom_buffer *));
 		}
 		if(post) {
 #ifdef HAVE_LIBCURL
@@ -2909,7 +3095,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = value;
 				janus_refcount_increase(&top->ref);
 				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				gateway->relay_data(top->session->handle, &data);
+				janus_textroom_participant_relay(top, &data);
 				janus_mutex_lock(&top->session->mutex);
 				g_hash_table_remove(top->session->rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
 				janus_mutex_unlock(&top->session->mutex);
@@ -3044,6 +3230,34 @@ static void janus_textroom_hangup_media_internal(janus_plugin_session *handle) {
 	g_atomic_int_set(&session->hangingup, 0);
 }
 
+/* Thread to send batched messages, for participants that asked for it */
+static void *janus_textroom_batcher(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining TextRoom batcher thread\n");
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+		g_usleep(batch_window*1000);
+		/* Send all the batches that were started in the meanwhile */
+		janus_mutex_lock(&batch_mutex);
+		GList *list = batch_list;
+		batch_list = NULL;
+		janus_mutex_unlock(&batch_mutex);
+		GList *temp = list;
+		while(temp) {
+			janus_textroom_participant *participant = (janus_textroom_participant *)temp->data;
+			janus_textroom_participant_flush(participant);
+			janus_refcount_decrease(&participant->ref);
+			temp = temp->next;
+		}
+		g_list_free(list);
+	}
+	/* Get rid of the batches we didn't send */
+	janus_mutex_lock(&batch_mutex);
+	g_list_free_full(batch_list, (GDestroyNotify)janus_textroom_participant_dereference);
+	batch_list = NULL;
+	janus_mutex_unlock(&batch_mutex);
+	JANUS_LOG(LOG_VERB, "Leaving TextRoom batcher thread\n");
+	return NULL;
+}
+
 /* Thread to handle incoming messages */
 static void *janus_textroom_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining TextRoom handler thread\n");
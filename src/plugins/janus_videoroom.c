@@ -1553,6 +1553,7 @@ void janus_videoroom_slow_link(janus_plugin_session *handle, int mindex, gboolea
 void janus_videoroom_hangup_media(janus_plugin_session *handle);
 void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_videoroom_query_session(janus_plugin_session *handle);
+void janus_videoroom_estimated_bandwidth(janus_plugin_session *handle, uint32_t estimate);
 
 /* Plugin setup */
 static janus_plugin janus_videoroom_plugin =
@@ -1580,6 +1581,7 @@ static janus_plugin janus_videoroom_plugin =
 		.hangup_media = janus_videoroom_hangup_media,
 		.destroy_session = janus_videoroom_destroy_session,
 		.query_session = janus_videoroom_query_session,
+		.estimated_bandwidth = janus_videoroom_estimated_bandwidth,
 	);
 
 /* Plugin creator */
@@ -1937,6 +1939,7 @@ static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
 static gboolean ipv6_disabled = FALSE;
+static gboolean bwe_layer_selection = FALSE;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_videoroom_handler(void *data);
@@ -2714,6 +2717,11 @@ static json_t *janus_videoroom_rtp_forwarder_summary(janus_rtp_forwarder *f) {
 	}
 	if(f->is_srtp)
 		json_object_set_new(json, "srtp", json_true());
+	if(!f->is_data) {
+		json_object_set_new(json, "packets_sent", json_integer(f->packets_sent));
+		json_object_set_new(json, "packets_dropped", json_integer(f->packets_dropped));
+		json_object_set_new(json, "send_errors", json_integer(f->send_errors));
+	}
 	return json;
 }
 
@@ -3109,6 +3117,12 @@ static json_t *janus_videoroom_subscriber_streams_summary(janus_videoroom_subscr
 				json_object_set_new(simulcast, "temporal-layer-target", json_integer(stream->sim_context.templayer_target));
 				if(stream->sim_context.drop_trigger > 0)
 					json_object_set_new(simulcast, "fallback", json_integer(stream->sim_context.drop_trigger));
+				guint32 bwe_estimate = (guint32)g_atomic_int_get(&stream->sim_context.bwe_estimate);
+				if(bwe_estimate > 0) {
+					json_object_set_new(simulcast, "bwe-estimate", json_integer(bwe_estimate));
+					json_object_set_new(simulcast, "bwe-substream-cap", json_integer(stream->sim_context.substream_bwe));
+					json_object_set_new(simulcast, "bwe-temporal-layer-cap", json_integer(stream->sim_context.templayer_bwe));
+				}
 				json_object_set_new(m, "simulcast", simulcast);
 			}
 			if(ps->svc) {
@@ -3117,6 +3131,12 @@ static json_t *janus_videoroom_subscriber_streams_summary(janus_videoroom_subscr
 				json_object_set_new(svc, "target-spatial-layer", json_integer(stream->svc_context.spatial_target));
 				json_object_set_new(svc, "temporal-layer", json_integer(stream->svc_context.temporal));
 				json_object_set_new(svc, "target-temporal-layer", json_integer(stream->svc_context.temporal_target));
+				guint32 bwe_estimate = (guint32)g_atomic_int_get(&stream->svc_context.bwe_estimate);
+				if(bwe_estimate > 0) {
+					json_object_set_new(svc, "bwe-estimate", json_integer(bwe_estimate));
+					json_object_set_new(svc, "bwe-spatial-layer-cap", json_integer(stream->svc_context.spatial_bwe));
+					json_object_set_new(svc, "bwe-temporal-layer-cap", json_integer(stream->svc_context.temporal_bwe));
+				}
 				json_object_set_new(m, "svc", svc);
 			}
 		}
@@ -3258,6 +3278,12 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "VideoRoom will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *bwe = janus_config_get(config, config_general, janus_config_type_item, "bwe_layer_selection");
+		if(bwe != NULL && bwe->value != NULL)
+			bwe_layer_selection = janus_is_true(bwe->value);
+		if(bwe_layer_selection) {
+			JANUS_LOG(LOG_INFO, "VideoRoom will cap simulcast/SVC layers according to the bandwidth estimate for subscribers\n");
+		}
 	}
 	rooms = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_videoroom_room_destroy);
@@ -3762,6 +3788,8 @@ static void janus_videoroom_notify_participants(janus_videoroom_publisher *parti
 	/* participant->room->mutex has to be locked. */
 	if(participant->room == NULL)
 		return;
+	/* The same event goes to all participants, so serialize it only once */
+	janus_json_payload *payload = janus_json_payload_create(msg);
 	GHashTableIter iter;
 	gpointer value;
 	g_hash_table_iter_init(&iter, participant->room->participants);
@@ -3769,10 +3797,12 @@ static void janus_videoroom_notify_participants(janus_videoroom_publisher *parti
 		janus_videoroom_publisher *p = value;
 		if(p && !g_atomic_int_get(&p->destroyed) && p->session && (p != participant || notify_source_participant)) {
 			JANUS_LOG(LOG_VERB, "Notifying participant %s (%s)\n", p->user_id_str, p->display ? p->display : "??");
-			int ret = gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, msg, NULL);
+			int ret = payload ? gateway->push_event_payload(p->session->handle, &janus_videoroom_plugin, NULL, payload, NULL) :
+				gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, msg, NULL);
 			JANUS_LOG(LOG_VERB, "  >> %d (%s)\n", ret, janus_get_api_error(ret));
 		}
 	}
+	janus_json_payload_unref(payload);
 }
 
 static void janus_videoroom_notify_about_publisher(janus_videoroom_publisher *p, gboolean update) {
@@ -8175,14 +8205,15 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 		}
 		janus_refcount_increase_nodebug(&ps->ref);
 		janus_mutex_unlock(&s->streams_mutex);
-		if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len)) {
+		janus_rtcp_summary summary;
+		janus_rtcp_summarize(buf, len, &summary);
+		if(summary.fir || summary.pli) {
 			/* We got a FIR or PLI, forward a PLI to the publisher */
 			janus_videoroom_publisher *p = ps->publisher;
 			if(p && p->session)
 				janus_videoroom_reqpli(ps, "PLI from subscriber");
 		}
-		uint32_t bitrate = janus_rtcp_get_remb(buf, len);
-		if(bitrate > 0) {
+		if(summary.remb > 0) {
 			/* FIXME We got a REMB from this subscriber, should we do something about it? */
 		}
 		janus_refcount_decrease_nodebug(&ps->ref);
@@ -8361,6 +8392,57 @@ void janus_videoroom_slow_link(janus_plugin_session *handle, int mindex, gboolea
 	janus_refcount_decrease(&session->ref);
 }
 
+void janus_videoroom_estimated_bandwidth(janus_plugin_session *handle, uint32_t estimate) {
+	/* The core estimated how much we can send to this peer: if so configured,
+	 * we use it to cap the substreams/layers we relay to subscribers */
+	if(!bwe_layer_selection || handle == NULL || g_atomic_int_get(&handle->stopped) ||
+			g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	janus_mutex_lock(&sessions_mutex);
+	janus_videoroom_session *session = janus_videoroom_lookup_session(handle);
+	if(!session || g_atomic_int_get(&session->destroyed) || !session->participant ||
+			session->participant_type != janus_videoroom_p_type_subscriber) {
+		janus_mutex_unlock(&sessions_mutex);
+		return;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&sessions_mutex);
+	janus_videoroom_subscriber *subscriber = janus_videoroom_session_get_subscriber(session);
+	if(subscriber == NULL) {
+		janus_refcount_decrease(&session->ref);
+		return;
+	}
+	if(g_atomic_int_get(&subscriber->destroyed)) {
+		janus_refcount_decrease(&subscriber->ref);
+		janus_refcount_decrease(&session->ref);
+		return;
+	}
+	/* The estimate is for the whole PeerConnection: split it among the video streams we're sending */
+	janus_mutex_lock(&subscriber->streams_mutex);
+	guint32 videos = 0;
+	GList *temp = subscriber->streams;
+	while(temp) {
+		janus_videoroom_subscriber_stream *stream = (janus_videoroom_subscriber_stream *)temp->data;
+		if(stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO && stream->send && stream->publisher_streams != NULL)
+			videos++;
+		temp = temp->next;
+	}
+	temp = subscriber->streams;
+	while(temp) {
+		janus_videoroom_subscriber_stream *stream = (janus_videoroom_subscriber_stream *)temp->data;
+		if(stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO) {
+			g_atomic_int_set(&stream->sim_context.bwe_estimate, (gint)(videos ? estimate/videos : estimate));
+			g_atomic_int_set(&stream->svc_context.bwe_estimate, (gint)(videos ? estimate/videos : estimate));
+		}
+		temp = temp->next;
+	}
+	janus_mutex_unlock(&subscriber->streams_mutex);
+	JANUS_LOG(LOG_HUGE, "[%s-%p] Estimated bandwidth: %"SCNu32" (%"SCNu32" video streams)\n",
+		JANUS_VIDEOROOM_PACKAGE, handle, estimate, videos);
+	janus_refcount_decrease(&subscriber->ref);
+	janus_refcount_decrease(&session->ref);
+}
+
 static void janus_videoroom_recorder_create(janus_videoroom_publisher_stream *ps) {
 	char filename[255];
 	janus_recorder *rc = NULL;
@@ -12409,7 +12491,9 @@ static void janus_videoroom_rtp_forwarder_rtcp_receive(janus_rtp_forwarder *rf,
 	if(len > 0 && janus_is_rtcp(buffer, len)) {
 		JANUS_LOG(LOG_HUGE, "Got %s RTCP packet: %d bytes\n", rf->is_video ? "video" : "audio", len);
 		/* We only handle incoming video PLIs or FIR at the moment */
-		if(!janus_rtcp_has_fir(buffer, len) && !janus_rtcp_has_pli(buffer, len))
+		janus_rtcp_summary summary;
+		janus_rtcp_summarize(buffer, len, &summary);
+		if(!summary.fir && !summary.pli)
 			return;
 		/* Check if this is a regular RTP forwarder, or a publisher remotization */
 		if(rf->metadata == NULL) {
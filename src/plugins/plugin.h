@@ -18,6 +18,8 @@
  * the syntax of the message/event is completely up to you, the only
  * important thing is that it MUST be a JSON object, as it will be included
  * as such within the Janus session/handle protocol;
+ * - \c push_event_payload(): same as above, but with a message serialized
+ * once in advance, to efficiently send the same event to many peers;
  * - \c relay_rtp(): to send/relay the peer an RTP packet;
  * - \c relay_rtcp(): to send/relay the peer an RTCP message.
  * - \c relay_data(): to send/relay the peer a SCTP DataChannel message.
@@ -69,10 +71,11 @@ janus_plugin *create(void) {
  * - \c slow_link(): a callback to notify you Janus or the peer have lost packets recently, and the media path may be slow;
  * - \c hangup_media(): a callback to notify you the peer PeerConnection has been closed (e.g., after a DTLS alert);
  * - \c query_session(): this method is called by the core to get plugin-specific info on a session between you and a peer;
- * - \c destroy_session(): this method is called by the core to destroy a session between you and a peer.
+ * - \c destroy_session(): this method is called by the core to destroy a session between you and a peer;
+ * - \c estimated_bandwidth(): a callback to notify you about the bandwidth the core estimated for the path towards the peer.
  *
  * All the above methods and callbacks, except for \c incoming_rtp ,
- * \c incoming_rtcp , \c incoming_data and \c slow_link , are mandatory:
+ * \c incoming_rtcp , \c incoming_data , \c slow_link and \c estimated_bandwidth , are mandatory:
  * the Janus core will reject a plugin that doesn't implement any of the
  * mandatory callbacks. The previously mentioned ones, instead, are
  * optional, so you're free to implement only those you care about. If
@@ -80,9 +83,9 @@ janus_plugin *create(void) {
  * sense to not implement the \c incoming_data callback at all. At the
  * same time, if your plugin is ONLY going to use data channels and
  * can't care less about RTP or RTCP, \c incoming_rtp and \c incoming_rtcp
- * can be left out. Finally, \c slow_link is just there as a helper, some
- * additional information you may be interested about, but you're not
- * forced to receive it if you don't care.
+ * can be left out. Finally, \c slow_link and \c estimated_bandwidth are
+ * just there as helpers, some additional information you may be interested
+ * about, but you're not forced to receive it if you don't care.
  *
  * The Janus core \c janus_callbacks interface is provided to a plugin, together
  * with the path to the configurations files folder, in the \c init() method.
@@ -171,7 +174,7 @@ janus_plugin *create(void) {
  * Janus instance or it will crash.
  *
  */
-#define JANUS_PLUGIN_API_VERSION	103
+#define JANUS_PLUGIN_API_VERSION	106
 
 /*! \brief Initialization of all plugin properties to NULL
  *
@@ -211,6 +214,7 @@ static janus_plugin janus_echotest_plugin =
 		.hangup_media = NULL,			\
 		.destroy_session = NULL,		\
 		.query_session = NULL, 			\
+		.estimated_bandwidth = NULL,	\
 		## __VA_ARGS__ }
 
 
@@ -234,6 +238,8 @@ typedef struct janus_plugin_data janus_plugin_data;
 
 /* Use forward declaration to avoid including jansson.h */
 typedef struct json_t json_t;
+/* Pre-serialized JSON payload, defined in utils.h */
+typedef struct janus_json_payload janus_json_payload;
 
 /*! \brief Plugin-Gateway session mapping */
 struct janus_plugin_session {
@@ -348,6 +354,16 @@ struct janus_plugin {
 	 * @param[in] handle The plugin/gateway session used for this peer
 	 * @returns A json_t object with the requested info */
 	json_t *(* const query_session)(janus_plugin_session *handle);
+	/*! \brief Callback to be notified about the bandwidth the core estimated for the path towards a peer
+	 * \note This is only invoked for PeerConnections that negotiated transport-wide CC:
+	 * the core keeps track of when it sent each packet, and uses the feedback the peer
+	 * sends to estimate how much it can send. The callback is invoked when the estimate
+	 * changes significantly, and can be used, e.g., to decide which simulcast substream
+	 * or SVC layer to relay to the peer (see the \c bwe_estimate property of the
+	 * janus_rtp_simulcasting_context and janus_rtp_svc_context helpers)
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] estimate The estimated bandwidth, in bits per second */
+	void (* const estimated_bandwidth)(janus_plugin_session *handle, uint32_t estimate);
 
 };
 
@@ -434,6 +450,32 @@ struct janus_callbacks {
 	 * @param[in] desc The descriptor to search for
 	 * @returns TRUE if the token is valid, not expired and contains the descriptor, FALSE otherwise */
 	gboolean (* const auth_signature_contains)(janus_plugin *plugin, const char *token, const char *descriptor);
+
+	/*! \brief Helper to pin the calling thread to the same CPU as the event loop of a handle
+	 * \note This only works when static event loops are pinned to CPUs in the
+	 * core configuration: plugins can call this from media threads that serve a
+	 * specific handle (e.g., when relaying media to/from it), so that they stick
+	 * to the same CPU, and so the same NUMA node, as the related event loop
+	 * @param[in] handle The plugin/gateway session whose loop affinity should be inherited
+	 * @returns TRUE if the thread was pinned, FALSE otherwise */
+	gboolean (* const inherit_affinity)(janus_plugin_session *handle);
+
+	/*! \brief Callback to push the same event/message to many peers
+	 * \details Works as push_event, but the message was serialized once in
+	 * advance via janus_json_payload_create(): transports that support it will
+	 * reuse that serialization for all recipients, rather than serializing the
+	 * same content again for each of them. Useful for room-wide notifications.
+	 * @note The Janus core takes its own references to both the payload and jsep,
+	 * so you'll still have to release yours after you're done with it.
+	 * The JSON object wrapped in the payload must not be modified after the
+	 * payload has been created.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] plugin The plugin instance that is sending the message/event
+	 * @param[in] transaction The transaction identifier this message refers to
+	 * @param[in] payload The pre-serialized JSON message
+	 * @param[in] jsep The json_t object containing the JSEP info, if any
+	 * @returns 0 in case of success, a negative integer otherwise */
+	int (* const push_event_payload)(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, janus_json_payload *payload, json_t *jsep);
 };
 
 /*! \brief The hook that plugins need to implement to be created from the Janus core */
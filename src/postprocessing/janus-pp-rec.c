@@ -93,7 +93,21 @@ Usage: janus-pp-rec [OPTIONS] source.mjr
                                 Minimum latency of moving average to reach
                                   before starting to correct timestamps.
                                   (default=500)
+  -s, --start=milliseconds      Only process packets received at least this
+                                  many milliseconds after the start of the
+                                  recording, using the index sidecar file to
+                                  skip ahead when available (default=0)
+  -E, --end=milliseconds        Only process packets received at most this
+                                  many milliseconds after the start of the
+                                  recording (default=0, until the end)
 \endverbatim
+ *
+ * When only a portion of a recording is needed, \c --start and \c --end
+ * can be used to specify a time range. If Janus was configured to write
+ * an index sidecar file for the recording (a \c .mjr.idx file next to the
+ * \c .mjr one), the tool uses it to find the frame to start from without
+ * reading the whole file: for video, processing starts from the last
+ * keyframe before the start of the range, so that the result is decodable.
  *
  * \note This utility does not do any form of transcoding. It just
  * depacketizes the RTP frames in order to get the payload, and saves
@@ -120,6 +134,7 @@ Usage: janus-pp-rec [OPTIONS] source.mjr
 
 #include "../debug.h"
 #include "../utils.h"
+#include "../record.h"
 #include "pp-options.h"
 #include "pp-rtp.h"
 #include "pp-webm.h"
@@ -172,6 +187,9 @@ typedef struct janus_pp_rtp_skew_context {
 } janus_pp_rtp_skew_context;
 static gint janus_pp_skew_compensate_audio(janus_pp_frame_packet *pkt, janus_pp_rtp_skew_context *context);
 
+/* Helper method to find where to start processing a time range from, using the index sidecar file */
+static long janus_pp_index_seek(const char *source, uint32_t start, gboolean video, uint32_t *from);
+
 /* Helper methods for timestamp correction (restamp) */
 static double get_latency(const janus_pp_frame_packet *tmp, int rate);
 static double get_moving_average_of_latency(janus_pp_frame_packet *pkt, int rate, int num_of_packets);
@@ -737,6 +755,10 @@ int main(int argc, char *argv[]) {
 		}
 		/* Skip data for now */
 		offset += len;
+		if(parsed_header && !extjson_only && (options.start_time > 0 || options.end_time > 0)) {
+			/* We'll only process a time range, no need to go through the whole file here */
+			break;
+		}
 	}
 	if(!working || jsonheader_only) {
 		g_free(metadata);
@@ -776,6 +798,20 @@ int main(int argc, char *argv[]) {
 	uint64_t max32 = UINT32_MAX;
 	int ignored = 0;
 	offset = 0;
+	/* If we only need a time range, check if there's an index we can use to skip ahead */
+	uint32_t range_start = 0;
+	if(options.start_time > 0 || options.end_time > 0) {
+		if(!has_timestamps) {
+			JANUS_LOG(LOG_WARN, "Recording has no packet timestamps, ignoring the time range\n");
+			options.start_time = 0;
+			options.end_time = 0;
+		} else {
+			JANUS_LOG(LOG_INFO, "Processing time range: %dms --> %dms\n", options.start_time, options.end_time);
+			range_start = options.start_time;
+			if(options.start_time > 0)
+				offset = janus_pp_index_seek(source, options.start_time, video, &range_start);
+		}
+	}
 	gboolean started = FALSE;
 	/* Silence suppression stuff */
 	gboolean ssup_on = FALSE;
@@ -819,6 +855,16 @@ int main(int argc, char *argv[]) {
 			offset += len;
 			continue;
 		}
+		if(options.end_time > 0 && pkt_ts > (uint32_t)options.end_time) {
+			/* We're past the time range we're interested in */
+			JANUS_LOG(LOG_VERB, "  -- Past the end of the time range, stopping here\n");
+			break;
+		}
+		if(pkt_ts < range_start) {
+			/* We're not in the time range we're interested in yet */
+			offset += len;
+			continue;
+		}
 		if(options.ignore_first_packets && ignored < options.ignore_first_packets) {
 			/* We've been told to ignore the first X packets */
 			ignored++;
@@ -1541,6 +1587,61 @@ int main(int argc, char *argv[]) {
 	return 0;
 }
 
+/* Helper method to find where to start processing a time range from */
+static long janus_pp_index_seek(const char *source, uint32_t start, gboolean video, uint32_t *from) {
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s.idx", source);
+	FILE *index = fopen(path, "rb");
+	if(index == NULL) {
+		JANUS_LOG(LOG_INFO, "No index file (%s), the whole recording will be scanned\n", path);
+		return 0;
+	}
+	char prefix[8];
+	if(fread(prefix, sizeof(char), sizeof(prefix), index) != sizeof(prefix) ||
+			memcmp(prefix, JANUS_RECORDER_INDEX_HEADER, sizeof(prefix))) {
+		JANUS_LOG(LOG_WARN, "Invalid index file (%s), the whole recording will be scanned\n", path);
+		fclose(index);
+		return 0;
+	}
+	fseek(index, 0L, SEEK_END);
+	long entries = (ftell(index) - (long)sizeof(prefix)) / (long)sizeof(janus_recorder_index_entry);
+	/* Look for the last entry before the start of the range */
+	janus_recorder_index_entry entry = { 0 };
+	long low = 0, high = entries - 1, middle = 0, found = -1;
+	while(low <= high) {
+		middle = low + (high - low)/2;
+		fseek(index, sizeof(prefix) + middle*sizeof(janus_recorder_index_entry), SEEK_SET);
+		if(fread(&entry, sizeof(janus_recorder_index_entry), 1, index) != 1)
+			break;
+		if(ntohl(entry.time) <= start) {
+			found = middle;
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+	/* For video, we need to go back to the last keyframe */
+	long offset = 0;
+	while(found >= 0) {
+		fseek(index, sizeof(prefix) + found*sizeof(janus_recorder_index_entry), SEEK_SET);
+		if(fread(&entry, sizeof(janus_recorder_index_entry), 1, index) != 1)
+			break;
+		if(!video || (ntohl(entry.flags) & JANUS_RECORDER_INDEX_KEYFRAME)) {
+			offset = (long)ntohll(entry.offset);
+			if(video)
+				*from = ntohl(entry.time);
+			JANUS_LOG(LOG_INFO, "Starting from offset %ld (%"SCNu32"ms%s)\n",
+				offset, ntohl(entry.time), video ? ", keyframe" : "");
+			break;
+		}
+		found--;
+	}
+	if(found < 0)
+		JANUS_LOG(LOG_INFO, "No suitable entry in the index file, the whole recording will be scanned\n");
+	fclose(index);
+	return offset;
+}
+
 /* Static helper to quickly find the extension data */
 static int janus_pp_rtp_header_extension_find(char *buf, int len, int id,
 		uint8_t *byte, uint32_t *word, char **ref) {
@@ -37,6 +37,8 @@ gboolean janus_pprec_options_parse(janus_pprec_options *options, int argc, char
 		{ "restamp", 'r', 0, G_OPTION_ARG_INT, &options->restamp_multiplier, "If the latency of a packet is bigger than the `moving_average_latency * (<restamp>/1000)` the timestamps will be corrected, disabled if 0 (default=0)", NULL },
 		{ "restamp-packets", 'c', 0, G_OPTION_ARG_INT, &options->restamp_packets, "Number of packets used for calculating moving average latency for timestamp correction (default=10)", NULL },
 		{ "restamp-min-th", 'n', 0, G_OPTION_ARG_INT, &options->restamp_min_th, "Minimum latency of moving average to reach before starting to correct timestamps. (default=500)", NULL },
+		{ "start", 's', 0, G_OPTION_ARG_INT, &options->start_time, "Only process packets received at least this many milliseconds after the start of the recording, using the index sidecar file to skip ahead when available (default=0)", NULL },
+		{ "end", 'E', 0, G_OPTION_ARG_INT, &options->end_time, "Only process packets received at most this many milliseconds after the start of the recording (default=0, until the end)", NULL },
 		{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &options->paths, NULL, NULL },
 		{ NULL },
 	};
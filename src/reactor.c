@@ -0,0 +1,465 @@
+/*! \file    reactor.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared media reactor for plain RTP sockets
+ * \details  Implementation of a shared, epoll based, reactor that plugins
+ * can use to receive media on plain RTP/RTCP sockets they own, e.g., the
+ * SIP and NoSIP plugins for their legs towards SIP peers. Each reactor
+ * thread has its own epoll instance: sockets are watched in edge-triggered
+ * mode, and datagrams are read in batches with recvmmsg. To avoid a busy
+ * socket starving the others, sockets with data are served round-robin,
+ * a batch at a time, until they've been drained.
+ *
+ * \ingroup protocols
+ * \ref protocols
+ */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "debug.h"
+#include "mutex.h"
+#include "utils.h"
+
+#ifdef __linux__
+
+/* Number of datagrams read from a socket at a time */
+#define JANUS_REACTOR_BATCH_SIZE	16
+/* Size of the buffers datagrams are read into */
+#define JANUS_REACTOR_BUFFER_SIZE	1500
+/* Maximum number of events returned by each epoll_wait */
+#define JANUS_REACTOR_MAX_EVENTS	64
+
+struct janus_reactor_thread {
+	int id;
+	janus_reactor *reactor;
+	GThread *thread;
+	/* Epoll instance, and eventfd to wake the thread up when stopping */
+	int epfd, wakefd;
+	janus_mutex mutex;
+	/* Sources served by this thread */
+	GHashTable *sources;
+	volatile gint sources_num;
+	/* Sources that have been destroyed, and can be freed when we're done with the current events */
+	GList *graveyard;
+};
+struct janus_reactor {
+	char *name;
+	int threads_num;
+	janus_reactor_thread *threads;
+	volatile gint stopping;
+};
+
+static guint64 janus_reactor_fd_ino(int fd) {
+	struct stat st;
+	if(fstat(fd, &st) < 0)
+		return 0;
+	return (guint64)st.st_ino;
+}
+
+/* Stop watching a descriptor: must be called with the thread mutex locked */
+static void janus_reactor_fd_clear(janus_reactor_thread *t, janus_reactor_fd *rfd) {
+	int fd = g_atomic_int_get(&rfd->fd);
+	if(fd == -1)
+		return;
+	/* If the descriptor was closed already, epoll forgot about it on its own,
+	 * and the same number may now refer to a different socket: don't touch it */
+	if(janus_reactor_fd_ino(fd) == rfd->ino)
+		epoll_ctl(t->epfd, EPOLL_CTL_DEL, fd, NULL);
+	g_atomic_int_set(&rfd->fd, -1);
+}
+
+/* Read a batch of datagrams from a socket: returns TRUE if more may be waiting */
+static gboolean janus_reactor_thread_read(janus_reactor_thread *t, janus_reactor_fd *rfd,
+		struct mmsghdr *msgs, struct iovec *iovs, char *buffers) {
+	janus_reactor_source *source = rfd->source;
+	if(g_atomic_int_get(&source->destroyed))
+		return FALSE;
+	int fd = g_atomic_int_get(&rfd->fd);
+	if(fd == -1)
+		return FALSE;
+	int i = 0;
+	for(i=0; i<JANUS_REACTOR_BATCH_SIZE; i++) {
+		iovs[i].iov_base = buffers + i*JANUS_REACTOR_BUFFER_SIZE;
+		iovs[i].iov_len = JANUS_REACTOR_BUFFER_SIZE;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int got = recvmmsg(fd, msgs, JANUS_REACTOR_BATCH_SIZE, MSG_DONTWAIT, NULL);
+	if(got < 0) {
+		if(errno == EINTR)
+			return TRUE;
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			return FALSE;
+		/* Connected sockets report ICMP errors this way too */
+		int error = errno;
+		source->callbacks->error(source, fd, error);
+		return (error == ECONNREFUSED);
+	}
+	for(i=0; i<got; i++) {
+		source->callbacks->incoming(source, fd, (char *)iovs[i].iov_base, msgs[i].msg_len);
+		/* The source may have been destroyed, or the socket removed, in the callback */
+		if(g_atomic_int_get(&source->destroyed) || g_atomic_int_get(&rfd->fd) != fd)
+			return FALSE;
+	}
+	/* A short batch means the socket was drained */
+	return (got == JANUS_REACTOR_BATCH_SIZE);
+}
+
+/* Reactor thread */
+static void *janus_reactor_thread_loop(void *data) {
+	janus_reactor_thread *t = (janus_reactor_thread *)data;
+	janus_reactor *reactor = t->reactor;
+	JANUS_LOG(LOG_VERB, "Joining %s reactor thread #%d...\n", reactor->name, t->id);
+	struct epoll_event events[JANUS_REACTOR_MAX_EVENTS];
+	struct mmsghdr msgs[JANUS_REACTOR_BATCH_SIZE];
+	struct iovec iovs[JANUS_REACTOR_BATCH_SIZE];
+	char *buffers = g_malloc(JANUS_REACTOR_BATCH_SIZE * JANUS_REACTOR_BUFFER_SIZE);
+	/* Sockets with data that haven't been drained yet */
+	GPtrArray *ready = g_ptr_array_new();
+	gint64 last_check = janus_get_monotonic_time();
+	guint i = 0;
+	while(!g_atomic_int_get(&reactor->stopping)) {
+		/* If sockets still have data, don't wait */
+		int timeout = 0;
+		if(ready->len == 0) {
+			gint64 elapsed = janus_get_monotonic_time() - last_check;
+			timeout = elapsed >= G_USEC_PER_SEC ? 0 : (int)((G_USEC_PER_SEC - elapsed) / 1000) + 1;
+		}
+		int num = epoll_wait(t->epfd, events, JANUS_REACTOR_MAX_EVENTS, timeout);
+		if(num < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s] Error waiting for events in reactor thread #%d: %d (%s)\n",
+				reactor->name, t->id, errno, g_strerror(errno));
+			break;
+		}
+		int n = 0;
+		for(n=0; n<num; n++) {
+			janus_reactor_fd *rfd = (janus_reactor_fd *)events[n].data.ptr;
+			if(rfd == NULL) {
+				/* We've been woken up */
+				eventfd_t value = 0;
+				(void)eventfd_read(t->wakefd, &value);
+				continue;
+			}
+			janus_reactor_source *source = rfd->source;
+			int fd = g_atomic_int_get(&rfd->fd);
+			if(g_atomic_int_get(&source->destroyed) || fd == -1)
+				continue;
+			if(rfd->notify) {
+				/* Drain the notification descriptor, and let the owner know */
+				char buf[64];
+				ssize_t res = 0;
+				do {
+					res = read(fd, buf, sizeof(buf));
+				} while(res > 0 || (res == -1 && errno == EINTR));
+				source->callbacks->notify(source, fd);
+				continue;
+			}
+			if(events[n].events & EPOLLERR) {
+				int error = 0;
+				socklen_t errlen = sizeof(error);
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+				if(error != 0)
+					source->callbacks->error(source, fd, error);
+				if(g_atomic_int_get(&source->destroyed) || g_atomic_int_get(&rfd->fd) != fd)
+					continue;
+			}
+			if((events[n].events & EPOLLIN) && !rfd->ready) {
+				rfd->ready = TRUE;
+				g_ptr_array_add(ready, rfd);
+			}
+		}
+		/* Serve the sockets with data a batch at a time, round-robin */
+		guint kept = 0;
+		for(i=0; i<ready->len; i++) {
+			janus_reactor_fd *rfd = g_ptr_array_index(ready, i);
+			if(janus_reactor_thread_read(t, rfd, msgs, iovs, buffers)) {
+				g_ptr_array_index(ready, kept) = rfd;
+				kept++;
+			} else {
+				rfd->ready = FALSE;
+			}
+		}
+		g_ptr_array_set_size(ready, kept);
+		/* Once a second, give all sources a chance to check their state */
+		gint64 now = janus_get_monotonic_time();
+		if(now - last_check >= G_USEC_PER_SEC) {
+			last_check = now;
+			janus_mutex_lock(&t->mutex);
+			GList *sources = g_hash_table_get_keys(t->sources), *l = sources;
+			janus_mutex_unlock(&t->mutex);
+			while(l) {
+				janus_reactor_source *source = (janus_reactor_source *)l->data;
+				if(!g_atomic_int_get(&source->destroyed))
+					source->callbacks->notify(source, -1);
+				l = l->next;
+			}
+			g_list_free(sources);
+		}
+		/* Free the sources that have been destroyed in the meanwhile */
+		janus_mutex_lock(&t->mutex);
+		GList *graveyard = t->graveyard;
+		t->graveyard = NULL;
+		janus_mutex_unlock(&t->mutex);
+		if(graveyard != NULL) {
+			kept = 0;
+			for(i=0; i<ready->len; i++) {
+				janus_reactor_fd *rfd = g_ptr_array_index(ready, i);
+				if(!g_atomic_int_get(&rfd->source->destroyed)) {
+					g_ptr_array_index(ready, kept) = rfd;
+					kept++;
+				}
+			}
+			g_ptr_array_set_size(ready, kept);
+			g_list_free_full(graveyard, (GDestroyNotify)g_free);
+		}
+	}
+	g_ptr_array_free(ready, TRUE);
+	g_free(buffers);
+	JANUS_LOG(LOG_VERB, "Leaving %s reactor thread #%d...\n", reactor->name, t->id);
+	return NULL;
+}
+
+janus_reactor *janus_reactor_create(const char *name, int threads) {
+	if(name == NULL || threads < 1)
+		return NULL;
+	janus_reactor *reactor = g_malloc0(sizeof(janus_reactor));
+	reactor->name = g_strdup(name);
+	reactor->threads = g_malloc0(threads * sizeof(janus_reactor_thread));
+	int i = 0;
+	for(i=0; i<threads; i++) {
+		janus_reactor_thread *t = &reactor->threads[i];
+		t->id = i;
+		t->reactor = reactor;
+		t->wakefd = -1;
+		t->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(t->epfd < 0) {
+			JANUS_LOG(LOG_ERR, "[%s] Error creating epoll instance: %d (%s)\n", name, errno, g_strerror(errno));
+			break;
+		}
+		t->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+		if(t->wakefd < 0 || epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->wakefd, &event) < 0) {
+			JANUS_LOG(LOG_ERR, "[%s] Error creating reactor eventfd: %d (%s)\n", name, errno, g_strerror(errno));
+			close(t->epfd);
+			if(t->wakefd != -1)
+				close(t->wakefd);
+			break;
+		}
+		janus_mutex_init(&t->mutex);
+		t->sources = g_hash_table_new(NULL, NULL);
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "%s %d", name, i);
+		GError *error = NULL;
+		t->thread = g_thread_try_new(tname, janus_reactor_thread_loop, t, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "[%s] Got error %d (%s) trying to launch reactor thread #%d...\n",
+				name, error->code, error->message ? error->message : "??", i);
+			g_error_free(error);
+			g_hash_table_destroy(t->sources);
+			close(t->epfd);
+			close(t->wakefd);
+			break;
+		}
+		reactor->threads_num++;
+	}
+	if(reactor->threads_num < threads) {
+		janus_reactor_destroy(reactor);
+		return NULL;
+	}
+	JANUS_LOG(LOG_INFO, "[%s] Started reactor with %d thread(s)\n", name, threads);
+	return reactor;
+}
+
+void janus_reactor_destroy(janus_reactor *reactor) {
+	if(reactor == NULL)
+		return;
+	g_atomic_int_set(&reactor->stopping, 1);
+	int i = 0;
+	for(i=0; i<reactor->threads_num; i++)
+		(void)eventfd_write(reactor->threads[i].wakefd, 1);
+	for(i=0; i<reactor->threads_num; i++) {
+		janus_reactor_thread *t = &reactor->threads[i];
+		g_thread_join(t->thread);
+		janus_mutex_lock(&t->mutex);
+		GList *sources = g_hash_table_get_keys(t->sources);
+		g_list_free_full(sources, (GDestroyNotify)g_free);
+		g_hash_table_destroy(t->sources);
+		g_list_free_full(t->graveyard, (GDestroyNotify)g_free);
+		t->graveyard = NULL;
+		janus_mutex_unlock(&t->mutex);
+		close(t->epfd);
+		close(t->wakefd);
+	}
+	g_free(reactor->threads);
+	g_free(reactor->name);
+	g_free(reactor);
+}
+
+int janus_reactor_get_threads(janus_reactor *reactor) {
+	return reactor ? reactor->threads_num : 0;
+}
+
+json_t *janus_reactor_get_load(janus_reactor *reactor) {
+	json_t *load = json_array();
+	int i = 0;
+	for(i=0; reactor && i<reactor->threads_num; i++)
+		json_array_append_new(load, json_integer(g_atomic_int_get(&reactor->threads[i].sources_num)));
+	return load;
+}
+
+janus_reactor_source *janus_reactor_source_create(janus_reactor *reactor,
+		const janus_reactor_callbacks *callbacks, void *user_data) {
+	if(reactor == NULL || callbacks == NULL || g_atomic_int_get(&reactor->stopping))
+		return NULL;
+	/* Pick the thread serving the fewest sources */
+	janus_reactor_thread *t = &reactor->threads[0];
+	int i = 0;
+	for(i=1; i<reactor->threads_num; i++) {
+		if(g_atomic_int_get(&reactor->threads[i].sources_num) < g_atomic_int_get(&t->sources_num))
+			t = &reactor->threads[i];
+	}
+	janus_reactor_source *source = g_malloc0(sizeof(janus_reactor_source));
+	source->thread = t;
+	source->callbacks = callbacks;
+	source->user_data = user_data;
+	for(i=0; i<JANUS_REACTOR_MAX_FDS; i++) {
+		source->fds[i].source = source;
+		source->fds[i].fd = -1;
+	}
+	janus_mutex_lock(&t->mutex);
+	g_hash_table_add(t->sources, source);
+	g_atomic_int_inc(&t->sources_num);
+	janus_mutex_unlock(&t->mutex);
+	return source;
+}
+
+int janus_reactor_source_add(janus_reactor_source *source, int fd, gboolean notify) {
+	if(source == NULL || fd < 0 || g_atomic_int_get(&source->destroyed))
+		return -1;
+	janus_reactor_thread *t = source->thread;
+	guint64 ino = janus_reactor_fd_ino(fd);
+	janus_mutex_lock(&t->mutex);
+	janus_reactor_fd *rfd = NULL;
+	int i = 0;
+	for(i=0; i<JANUS_REACTOR_MAX_FDS; i++) {
+		if(g_atomic_int_get(&source->fds[i].fd) == fd) {
+			if(source->fds[i].ino == ino && source->fds[i].notify == notify) {
+				/* Already watching this descriptor */
+				janus_mutex_unlock(&t->mutex);
+				return 0;
+			}
+			/* Same number, different socket: the old one was closed */
+			janus_reactor_fd_clear(t, &source->fds[i]);
+		}
+		if(rfd == NULL && g_atomic_int_get(&source->fds[i].fd) == -1)
+			rfd = &source->fds[i];
+	}
+	if(rfd == NULL) {
+		janus_mutex_unlock(&t->mutex);
+		JANUS_LOG(LOG_ERR, "[%s] Too many descriptors for reactor source %p\n", t->reactor->name, source);
+		return -1;
+	}
+	int flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		janus_mutex_unlock(&t->mutex);
+		JANUS_LOG(LOG_ERR, "[%s] Error making descriptor %d non-blocking: %d (%s)\n",
+			t->reactor->name, fd, errno, g_strerror(errno));
+		return -1;
+	}
+	rfd->notify = notify;
+	rfd->ino = ino;
+	g_atomic_int_set(&rfd->fd, fd);
+	struct epoll_event event = { .events = EPOLLIN | EPOLLET, .data.ptr = rfd };
+	int res = epoll_ctl(t->epfd, EPOLL_CTL_ADD, fd, &event);
+	if(res < 0 && errno == EEXIST) {
+		/* Still registered on behalf of someone else, take it over */
+		res = epoll_ctl(t->epfd, EPOLL_CTL_MOD, fd, &event);
+	}
+	if(res < 0) {
+		g_atomic_int_set(&rfd->fd, -1);
+		janus_mutex_unlock(&t->mutex);
+		JANUS_LOG(LOG_ERR, "[%s] Error watching descriptor %d: %d (%s)\n",
+			t->reactor->name, fd, errno, g_strerror(errno));
+		return -1;
+	}
+	janus_mutex_unlock(&t->mutex);
+	return 0;
+}
+
+void janus_reactor_source_remove(janus_reactor_source *source, int fd) {
+	if(source == NULL || fd < 0)
+		return;
+	janus_reactor_thread *t = source->thread;
+	janus_mutex_lock(&t->mutex);
+	int i = 0;
+	for(i=0; i<JANUS_REACTOR_MAX_FDS; i++) {
+		if(g_atomic_int_get(&source->fds[i].fd) == fd)
+			janus_reactor_fd_clear(t, &source->fds[i]);
+	}
+	janus_mutex_unlock(&t->mutex);
+}
+
+void janus_reactor_source_destroy(janus_reactor_source *source) {
+	if(source == NULL || !g_atomic_int_compare_and_exchange(&source->destroyed, 0, 1))
+		return;
+	janus_reactor_thread *t = source->thread;
+	janus_mutex_lock(&t->mutex);
+	int i = 0;
+	for(i=0; i<JANUS_REACTOR_MAX_FDS; i++)
+		janus_reactor_fd_clear(t, &source->fds[i]);
+	g_hash_table_remove(t->sources, source);
+	g_atomic_int_add(&t->sources_num, -1);
+	/* The reactor thread may still have pending events for this source */
+	t->graveyard = g_list_prepend(t->graveyard, source);
+	janus_mutex_unlock(&t->mutex);
+}
+
+#else
+
+/* No epoll: plugins will use their own threads */
+janus_reactor *janus_reactor_create(const char *name, int threads) {
+	JANUS_LOG(LOG_WARN, "[%s] Shared media reactor not supported on this platform\n", name);
+	return NULL;
+}
+
+void janus_reactor_destroy(janus_reactor *reactor) {
+}
+
+int janus_reactor_get_threads(janus_reactor *reactor) {
+	return 0;
+}
+
+json_t *janus_reactor_get_load(janus_reactor *reactor) {
+	return json_array();
+}
+
+janus_reactor_source *janus_reactor_source_create(janus_reactor *reactor,
+		const janus_reactor_callbacks *callbacks, void *user_data) {
+	return NULL;
+}
+
+int janus_reactor_source_add(janus_reactor_source *source, int fd, gboolean notify) {
+	return -1;
+}
+
+void janus_reactor_source_remove(janus_reactor_source *source, int fd) {
+}
+
+void janus_reactor_source_destroy(janus_reactor_source *source) {
+}
+
+#endif
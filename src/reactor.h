@@ -0,0 +1,142 @@
+/*! \file    reactor.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared media reactor for plain RTP sockets (headers)
+ * \details  Implementation of a shared, epoll based, reactor that plugins
+ * can use to receive media on plain RTP/RTCP sockets they own, e.g., the
+ * SIP and NoSIP plugins for their legs towards SIP peers. Rather than
+ * spawning a thread per call that polls the sockets of that call only,
+ * a reactor has a fixed pool of threads, and the sockets of each call
+ * (a "source") are served by one of them: datagrams are read in batches
+ * and passed to the plugin via callbacks, which means the number of
+ * threads is a configuration value rather than a function of the number
+ * of active calls. Since epoll is needed, the reactor is only available
+ * on Linux: on other platforms, janus_reactor_create will always fail,
+ * and plugins are expected to fall back to their own threads.
+ *
+ * \ingroup protocols
+ * \ref protocols
+ */
+
+#ifndef JANUS_REACTOR_H
+#define JANUS_REACTOR_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Reactor (opaque) */
+typedef struct janus_reactor janus_reactor;
+/*! \brief Reactor thread (opaque) */
+typedef struct janus_reactor_thread janus_reactor_thread;
+typedef struct janus_reactor_source janus_reactor_source;
+
+/*! \brief Callbacks a reactor notifies sources events with: all of them
+ * are always invoked by the reactor thread serving the source, which
+ * means that, for a specific source, they're never invoked concurrently */
+typedef struct janus_reactor_callbacks {
+	/*! \brief A datagram was received on one of the sockets of a source
+	 * @note The buffer belongs to the reactor, and is only valid for the
+	 * duration of the callback, but it can be modified in place (e.g., to
+	 * decrypt SRTP packets); its size is always at least 1500 bytes
+	 * @param[in] source The source the socket belongs to
+	 * @param[in] fd The socket the datagram was received on
+	 * @param[in] buf The datagram
+	 * @param[in] len The size of the datagram */
+	void (* const incoming)(janus_reactor_source *source, int fd, char *buf, int len);
+	/*! \brief One of the sockets of a source reported an error
+	 * @param[in] source The source the socket belongs to
+	 * @param[in] fd The socket that reported the error
+	 * @param[in] error The socket error (as returned by SO_ERROR) */
+	void (* const error)(janus_reactor_source *source, int fd, int error);
+	/*! \brief A notification descriptor of the source (e.g., the read end
+	 * of a pipe) was written to, or a second has passed since the last
+	 * check: this can be used to react to session updates or hangups
+	 * @note Notification descriptors are drained by the reactor itself
+	 * @param[in] source The source
+	 * @param[in] fd The notification descriptor, or -1 if this is the periodic check */
+	void (* const notify)(janus_reactor_source *source, int fd);
+} janus_reactor_callbacks;
+
+/*! \brief File descriptor watched by a reactor on behalf of a source */
+typedef struct janus_reactor_fd {
+	/*! \brief Source this descriptor belongs to */
+	janus_reactor_source *source;
+	/*! \brief The descriptor, or -1 if this slot is unused */
+	volatile gint fd;
+	/*! \brief Whether this is a notification descriptor, rather than a datagram socket */
+	gboolean notify;
+	/*! \brief Inode of the descriptor, to detect when a descriptor was
+	 * closed without being removed first, and its number reused */
+	guint64 ino;
+	/*! \brief Whether this socket is in the list of those with data to read */
+	gboolean ready;
+} janus_reactor_fd;
+
+#define JANUS_REACTOR_MAX_FDS	8
+/*! \brief A group of sockets (e.g., all the RTP/RTCP sockets of a call)
+ * that are always served by the same reactor thread */
+struct janus_reactor_source {
+	/*! \brief Reactor thread this source has been assigned to */
+	janus_reactor_thread *thread;
+	/*! \brief Callbacks to notify the owner with */
+	const janus_reactor_callbacks *callbacks;
+	/*! \brief Opaque pointer to the owner of this source (e.g., a plugin session) */
+	void *user_data;
+	/*! \brief File descriptors currently registered for this source */
+	janus_reactor_fd fds[JANUS_REACTOR_MAX_FDS];
+	/*! \brief Whether this source has been destroyed */
+	volatile gint destroyed;
+};
+
+/*! \brief Create a new reactor
+ * @param[in] name Name of the reactor, used for naming its threads (e.g., "siprtp")
+ * @param[in] threads Number of threads the reactor will have
+ * @returns A pointer to the new reactor, if successful, or NULL otherwise
+ * (which includes platforms where the reactor is not supported) */
+janus_reactor *janus_reactor_create(const char *name, int threads);
+/*! \brief Stop and destroy a reactor
+ * @note Sources that have not been destroyed yet are released without
+ * notifying their owners, and their descriptors are not closed
+ * @param[in] reactor The reactor to destroy */
+void janus_reactor_destroy(janus_reactor *reactor);
+/*! \brief Helper method to retrieve the number of threads of a reactor
+ * @param[in] reactor The reactor to inspect
+ * @returns The number of threads */
+int janus_reactor_get_threads(janus_reactor *reactor);
+/*! \brief Helper method to retrieve a summary of the reactor load, that is
+ * the number of sources each thread is serving
+ * @param[in] reactor The reactor to inspect
+ * @returns A JSON array with the number of sources per thread */
+json_t *janus_reactor_get_load(janus_reactor *reactor);
+
+/*! \brief Create a new source, and assign it to the least loaded reactor thread
+ * @param[in] reactor The reactor to add the source to
+ * @param[in] callbacks The callbacks to notify about events
+ * @param[in] user_data Opaque pointer to the owner of the source
+ * @returns A pointer to the new source, if successful, or NULL otherwise */
+janus_reactor_source *janus_reactor_source_create(janus_reactor *reactor,
+	const janus_reactor_callbacks *callbacks, void *user_data);
+/*! \brief Start watching a file descriptor as part of a source
+ * @note The descriptor is made non-blocking. Adding a descriptor that is
+ * already part of the source is a no-op, which means this method can be
+ * safely used to resync the source with the sockets of the owner
+ * @param[in] source The source to add the descriptor to
+ * @param[in] fd The descriptor to add
+ * @param[in] notify Whether this is a notification descriptor (e.g., the
+ * read end of a pipe), rather than a datagram socket
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_reactor_source_add(janus_reactor_source *source, int fd, gboolean notify);
+/*! \brief Stop watching a file descriptor that is part of a source
+ * @note This must be called before closing the descriptor
+ * @param[in] source The source to remove the descriptor from
+ * @param[in] fd The descriptor to remove */
+void janus_reactor_source_remove(janus_reactor_source *source, int fd);
+/*! \brief Destroy a source, stop watching all its descriptors
+ * @note This is meant to be called from the source callbacks, that is from
+ * the reactor thread: no callback is invoked for the source after that, and
+ * the memory is released by the reactor thread when it's safe to do so. If
+ * called from a different thread, a callback may still be in progress
+ * @param[in] source The source to destroy */
+void janus_reactor_source_destroy(janus_reactor_source *source);
+
+#endif
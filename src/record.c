@@ -39,6 +39,8 @@ static const char *frame_header = "MEET";
 static gboolean rec_tempname = FALSE;
 /* Extension to add in case tempnames is true (default="tmp" --> ".tmp") */
 static char *rec_tempext = NULL;
+/* How often to add an entry to the index sidecar files, in ms (default=0, no sidecar files) */
+static guint rec_index_interval = 0;
 
 void janus_recorder_init(gboolean tempnames, const char *extension) {
 	JANUS_LOG(LOG_INFO, "Initializing recorder code\n");
@@ -57,6 +59,93 @@ void janus_recorder_init(gboolean tempnames, const char *extension) {
 void janus_recorder_deinit(void) {
 	rec_tempname = FALSE;
 	g_free(rec_tempext);
+	rec_index_interval = 0;
+}
+
+void janus_recorder_set_index_interval(guint interval) {
+	rec_index_interval = interval;
+	if(interval > 0)
+		JANUS_LOG(LOG_INFO, "Recordings will have an index sidecar file (an entry every %ums at least)\n", interval);
+}
+
+/* Helper to open the index sidecar file of a recording */
+static void janus_recorder_index_open(janus_recorder *recorder, const char *dir, const char *file) {
+	char newname[1024];
+	if(!rec_tempname)
+		g_snprintf(newname, sizeof(newname), "%s.mjr.idx", file);
+	else
+		g_snprintf(newname, sizeof(newname), "%s.mjr.idx.%s", file, rec_tempext);
+	char path[1024];
+	if(dir != NULL)
+		g_snprintf(path, sizeof(path), "%s/%s", dir, newname);
+	else
+		g_snprintf(path, sizeof(path), "%s", newname);
+	recorder->index = fopen(path, "wb");
+	if(recorder->index == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't create index file %s, recording won't be seekable: %d (%s)\n",
+			path, errno, g_strerror(errno));
+		return;
+	}
+	size_t res = fwrite(JANUS_RECORDER_INDEX_HEADER, sizeof(char), strlen(JANUS_RECORDER_INDEX_HEADER), recorder->index);
+	if(res != strlen(JANUS_RECORDER_INDEX_HEADER)) {
+		JANUS_LOG(LOG_WARN, "Couldn't write index file header (%zu != %zu, %s), recording won't be seekable\n",
+			res, strlen(JANUS_RECORDER_INDEX_HEADER), g_strerror(errno));
+		fclose(recorder->index);
+		recorder->index = NULL;
+		remove(path);
+		return;
+	}
+	recorder->index_filename = g_strdup(newname);
+	recorder->index_last = -1;
+}
+
+/* Helper to check if a video packet contains a keyframe */
+static gboolean janus_recorder_is_keyframe(janus_recorder *recorder, char *buffer, uint length) {
+	if(recorder->type != JANUS_RECORDER_VIDEO || recorder->encrypted)
+		return FALSE;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, length, &plen);
+	if(payload == NULL || plen < 1)
+		return FALSE;
+	if(!strcasecmp(recorder->codec, "vp8"))
+		return janus_vp8_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "vp9"))
+		return janus_vp9_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "h264"))
+		return janus_h264_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "av1"))
+		return janus_av1_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "h265"))
+		return janus_h265_is_keyframe(payload, plen);
+	return FALSE;
+}
+
+/* Helper to add an entry to the index sidecar file, if needed */
+static void janus_recorder_index_add(janus_recorder *recorder, long offset, uint32_t when,
+		char *buffer, uint length, uint32_t rtp_ts) {
+	uint32_t flags = 0;
+	if(janus_recorder_is_keyframe(recorder, buffer, length)) {
+		/* Only index the first packet of each keyframe */
+		if(recorder->index_last < 0 || rtp_ts != recorder->index_keyframe_ts)
+			flags |= JANUS_RECORDER_INDEX_KEYFRAME;
+	}
+	if(flags == 0 && recorder->index_last >= 0 && (int64_t)when - recorder->index_last < rec_index_interval)
+		return;
+	janus_recorder_index_entry entry = {
+		.offset = htonll((uint64_t)offset),
+		.time = htonl(when),
+		.flags = htonl(flags)
+	};
+	if(fwrite(&entry, sizeof(entry), 1, recorder->index) != 1) {
+		JANUS_LOG(LOG_WARN, "Couldn't write entry to index file %s (%s), recording won't be seekable\n",
+			recorder->index_filename, g_strerror(errno));
+		fclose(recorder->index);
+		recorder->index = NULL;
+		return;
+	}
+	recorder->index_last = when;
+	if(flags & JANUS_RECORDER_INDEX_KEYFRAME)
+		recorder->index_keyframe_ts = rtp_ts;
 }
 
 static void janus_recorder_free(const janus_refcount *recorder_ref) {
@@ -70,6 +159,11 @@ static void janus_recorder_free(const janus_refcount *recorder_ref) {
 	if(recorder->file != NULL)
 		fclose(recorder->file);
 	recorder->file = NULL;
+	if(recorder->index != NULL)
+		fclose(recorder->index);
+	recorder->index = NULL;
+	g_free(recorder->index_filename);
+	recorder->index_filename = NULL;
 	g_free(recorder->codec);
 	recorder->codec = NULL;
 	g_free(recorder->fmtp);
@@ -245,6 +339,18 @@ janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, c
 		g_free(copy_for_base);
 		return NULL;
 	}
+	/* Check if we need an index sidecar file too */
+	if(rec_index_interval > 0) {
+		char random_file[64];
+		if(rec_file == NULL) {
+			/* Use the same random name we picked for the recording */
+			g_snprintf(random_file, sizeof(random_file), "%s", newname);
+			char *ext = strstr(random_file, ".mjr");
+			if(ext != NULL)
+				*ext = '\0';
+		}
+		janus_recorder_index_open(rc, rec_dir, rec_file ? rec_file : random_file);
+	}
 	g_atomic_int_set(&rc->writable, 1);
 	/* We still need to also write the info header first */
 	g_atomic_int_set(&rc->header, 0);
@@ -415,14 +521,16 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		recorder->started = now;
 		g_atomic_int_set(&recorder->header, 1);
 	}
+	/* Take note of where this frame starts, in case we need to index it */
+	long frame_offset = recorder->index ? ftell(recorder->file) : -1;
 	/* Write frame header (fixed part[4], timestamp[4], length[2]) */
 	size_t res = fwrite(frame_header, sizeof(char), strlen(frame_header), recorder->file);
 	if(res != strlen(frame_header)) {
 		JANUS_LOG(LOG_WARN, "Couldn't write frame header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
 			res, strlen(frame_header), g_strerror(errno));
 	}
-	uint32_t timestamp = (uint32_t)(now > recorder->started ? ((now - recorder->started)/1000) : 0);
-	timestamp = htonl(timestamp);
+	uint32_t frame_time = (uint32_t)(now > recorder->started ? ((now - recorder->started)/1000) : 0);
+	uint32_t timestamp = htonl(frame_time);
 	res = fwrite(&timestamp, sizeof(uint32_t), 1, recorder->file);
 	if(res != 1) {
 		JANUS_LOG(LOG_WARN, "Couldn't write frame timestamp in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
@@ -476,6 +584,9 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		header->seq_number = htons(seq);
 		header->timestamp = htonl(timestamp);
 	}
+	/* Update the index sidecar file, if needed */
+	if(recorder->index != NULL && frame_offset >= 0)
+		janus_recorder_index_add(recorder, frame_offset, frame_time, buffer, length, timestamp);
 	/* Done */
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
@@ -491,6 +602,10 @@ int janus_recorder_close(janus_recorder *recorder) {
 		fseek(recorder->file, 0L, SEEK_SET);
 		JANUS_LOG(LOG_INFO, "File is %zu bytes: %s\n", fsize, recorder->filename);
 	}
+	if(recorder->index) {
+		fclose(recorder->index);
+		recorder->index = NULL;
+	}
 	if(rec_tempname) {
 		/* We need to rename the file, to remove the temporary extension */
 		char newname[1024];
@@ -514,6 +629,23 @@ int janus_recorder_close(janus_recorder *recorder) {
 			g_free(recorder->filename);
 			recorder->filename = g_strdup(newname);
 		}
+		if(recorder->index_filename) {
+			/* Rename the index sidecar file as well */
+			g_snprintf(newname, strlen(recorder->index_filename)-strlen(rec_tempext), "%s", recorder->index_filename);
+			if(recorder->dir) {
+				g_snprintf(newpath, 1024, "%s/%s", recorder->dir, newname);
+				g_snprintf(oldpath, 1024, "%s/%s", recorder->dir, recorder->index_filename);
+			} else {
+				g_snprintf(newpath, 1024, "%s", newname);
+				g_snprintf(oldpath, 1024, "%s", recorder->index_filename);
+			}
+			if(rename(oldpath, newpath) != 0) {
+				JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", recorder->index_filename, newname);
+			} else {
+				g_free(recorder->index_filename);
+				recorder->index_filename = g_strdup(newname);
+			}
+		}
 	}
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
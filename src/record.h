@@ -37,6 +37,20 @@ typedef enum janus_recorder_medium {
 	JANUS_RECORDER_DATA
 } janus_recorder_medium;
 
+/*! \brief Prefix of the optional index sidecar files (.mjr.idx) */
+#define JANUS_RECORDER_INDEX_HEADER		"MJRIDX01"
+/*! \brief Flag of index entries that point to the first packet of a video keyframe */
+#define JANUS_RECORDER_INDEX_KEYFRAME	0x01
+/*! \brief Entry in an index sidecar file: all fields are in network byte order */
+typedef struct janus_recorder_index_entry {
+	/*! \brief Offset of the frame in the .mjr file (i.e., where its \c MEET prefix starts) */
+	uint64_t offset;
+	/*! \brief When the frame was received, in milliseconds (same as the .mjr frame header) */
+	uint32_t time;
+	/*! \brief Flags (e.g., JANUS_RECORDER_INDEX_KEYFRAME) */
+	uint32_t flags;
+} janus_recorder_index_entry;
+
 /*! \brief Structure that represents a recorder */
 typedef struct janus_recorder {
 	/*! \brief Absolute path to the directory where the recorder file is stored */
@@ -45,6 +59,14 @@ typedef struct janus_recorder {
 	char *filename;
 	/*! \brief Recording file */
 	FILE *file;
+	/*! \brief Filename of the index sidecar file, if any */
+	char *index_filename;
+	/*! \brief Index sidecar file, if any */
+	FILE *index;
+	/*! \brief Time of the last entry written to the index sidecar file, if any */
+	int64_t index_last;
+	/*! \brief RTP timestamp of the last keyframe written to the index sidecar file */
+	uint32_t index_keyframe_ts;
 	/*! \brief Codec the packets to record are encoded in ("vp8", "vp9", "h264", "opus", "pcma", "pcmu", "g722") */
 	char *codec;
 	/*! \brief Codec-specific info (e.g., H.264 or VP9 profile) */
@@ -83,6 +105,13 @@ typedef struct janus_recorder {
 void janus_recorder_init(gboolean tempnames, const char *extension);
 /*! \brief De-initialize the recorder code */
 void janus_recorder_deinit(void);
+/*! \brief Configure the index sidecar files for new recordings
+ * \details When enabled, a \c .mjr.idx file is written next to each \c .mjr
+ * file, with an entry for each video keyframe and, in general, at least one
+ * entry every \c interval milliseconds, which allows readers to seek in the
+ * recording without scanning it from the start
+ * @param[in] interval How often to add an entry, in milliseconds (0 disables the sidecar files) */
+void janus_recorder_set_index_interval(guint interval);
 
 /*! \brief Create a new recorder
  * \note If no target directory is provided, the current directory will be used. If no filename
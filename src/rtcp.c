@@ -226,38 +226,34 @@ static void janus_rtcp_incoming_sr(janus_rtcp_context *ctx, janus_rtcp_sr *sr) {
 	ctx->lsr = (ntp >> 16);
 }
 
-/* Helper to handle an incoming transport-cc feedback: triggered by a call to janus_rtcp_fix_ssrc a valid context pointer */
-static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp_fb *twcc, int total) {
-	if(ctx == NULL || twcc == NULL || total < 20)
-		return;
+/* Helper to parse a single transport-cc feedback message */
+static int janus_rtcp_transport_wide_cc_parse_fb(janus_rtcp_fb *twcc, int total,
+		janus_rtcp_transport_wide_cc_report *reports, int max) {
+	if(twcc == NULL || total < 20 || reports == NULL || max < 1)
+		return 0;
 	if(!janus_rtcp_check_fci((janus_rtcp_header *)twcc, total, 4))
-		return;
+		return 0;
 	/* Parse the header first */
 	uint8_t *data = (uint8_t *)twcc->fci;
 	uint16_t base_seq = 0, status_count = 0;
 	uint32_t reference = 0;
-	uint8_t fb_pkt = 0;
 	memcpy(&base_seq, data, sizeof(uint16_t));
 	base_seq = ntohs(base_seq);
 	memcpy(&status_count, data+2, sizeof(uint16_t));
 	status_count = ntohs(status_count);
 	memcpy(&reference, data+4, sizeof(uint32_t));
 	reference = ntohl(reference) >> 8;
-	fb_pkt = *(data+7);
 	JANUS_LOG(LOG_HUGE, "[TWCC] seq=%"SCNu16", psc=%"SCNu16", ref=%"SCNu32", fbpc=%"SCNu8"\n",
-		base_seq, status_count, reference, fb_pkt);
+		base_seq, status_count, reference, *(data+7));
 	/* Now traverse the feedback: packet chunks first, and then recv deltas */
 	total -= 20;
 	data += 8;
-	uint16_t psc = status_count;
-	uint16_t chunk = 0;
-	uint8_t t = 0, ss = 0, s = 0, length = 0;
-	/* Iterate on all packet chunks */
-	JANUS_LOG(LOG_HUGE, "[TWCC] Chunks:\n");
-	uint16_t num = 0;
-	GList *list = NULL;
+	uint16_t psc = status_count, chunk = 0, length = 0;
+	uint8_t t = 0, ss = 0, s = 0;
+	int num = 0;
+	/* Iterate on all packet chunks: we only keep the statuses we have room for,
+	 * but we still need to go through all chunks to find where deltas start */
 	while(psc > 0 && total > 1) {
-		num++;
 		memcpy(&chunk, data, sizeof(uint16_t));
 		chunk = ntohs(chunk);
 		t = (chunk & 0x8000) >> 15;
@@ -265,10 +261,12 @@ static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp
 			/* Run length */
 			s = (chunk & 0x6000) >> 13;
 			length = (chunk & 0x1FFF);
-			JANUS_LOG(LOG_HUGE, "  [%"SCNu16"] t=run-length, s=%s, l=%"SCNu8"\n", num,
-				janus_rtp_packet_status_description(s), length);
 			while(length > 0 && psc > 0) {
-				list = g_list_prepend(list, GUINT_TO_POINTER(s));
+				if(num < max) {
+					reports[num].seq = base_seq + num;
+					reports[num].status = s;
+				}
+				num++;
 				length--;
 				psc--;
 			}
@@ -276,14 +274,16 @@ static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp
 			/* Status vector */
 			ss = (chunk & 0x4000) >> 14;
 			length = (ss ? 7 : 14);
-			JANUS_LOG(LOG_HUGE, "  [%"SCNu16"] t=status-vector, ss=%ss, l=%"SCNu8"\n", num,
-				ss ? "2-bit" : "bit", length);
 			while(length > 0 && psc > 0) {
 				if(!ss)
 					s = (chunk & (1 << (length-1))) ? janus_rtp_packet_status_smalldelta : janus_rtp_packet_status_notreceived;
 				else
 					s = (chunk & (3 << (2*length-2))) >> (2*length-2);
-				list = g_list_prepend(list, GUINT_TO_POINTER(s));
+				if(num < max) {
+					reports[num].seq = base_seq + num;
+					reports[num].status = s;
+				}
+				num++;
 				length--;
 				psc--;
 			}
@@ -293,42 +293,86 @@ static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp
 	}
 	if(psc > 0) {
 		/* Incomplete feedback? Drop... */
-		g_list_free(list);
-		return;
+		return 0;
 	}
-	list = g_list_reverse(list);
-	/* Iterate on all recv deltas */
-	JANUS_LOG(LOG_HUGE, "[TWCC] Recv Deltas (%d/%"SCNu16"):\n", g_list_length(list), status_count);
-	num = 0;
-	uint16_t delta = 0;
-	uint32_t delta_us = 0;
-	GList *iter = list;
-	while(iter != NULL && total > 0) {
-		num++;
-		delta = 0;
-		s = GPOINTER_TO_UINT(iter->data);
-		if(s == janus_rtp_packet_status_smalldelta) {
+	if(num > max)
+		num = max;
+	/* Iterate on all recv deltas: the reference time is in multiples of 64ms,
+	 * and deltas in multiples of 250us, with large deltas that can be negative */
+	gint64 arrival = (gint64)reference * 64000;
+	int i = 0;
+	for(i=0; i<num; i++) {
+		janus_rtcp_transport_wide_cc_report *r = &reports[i];
+		r->received = FALSE;
+		r->arrival = 0;
+		if(r->status == janus_rtp_packet_status_smalldelta) {
 			/* Small delta = 1 byte */
-			delta = *data;
+			if(total < 1)
+				break;
+			arrival += (gint64)(*data) * 250;
 			total--;
 			data++;
-		} else if(s == janus_rtp_packet_status_largeornegativedelta) {
+		} else if(r->status == janus_rtp_packet_status_largeornegativedelta) {
 			/* Large or negative delta = 2 bytes */
 			if(total < 2)
 				break;
+			uint16_t delta = 0;
 			memcpy(&delta, data, sizeof(uint16_t));
-			delta = ntohs(delta);
+			arrival += (gint64)((int16_t)ntohs(delta)) * 250;
 			total -= 2;
 			data += 2;
+		} else {
+			continue;
 		}
-		delta_us = delta*250;
-		/* Print summary */
-		JANUS_LOG(LOG_HUGE, "  [%02"SCNu16"][%"SCNu16"] %s (%"SCNu32"us)\n", num, (uint16_t)(base_seq+num-1),
-			janus_rtp_packet_status_description(s), delta_us);
-		iter = iter->next;
+		r->received = TRUE;
+		r->arrival = arrival;
 	}
-	/* TODO Update the context with the feedback we got */
-	g_list_free(list);
+	/* If we ran out of deltas, whatever is left can't be trusted */
+	return i;
+}
+
+/* Helper to handle an incoming transport-cc feedback: triggered by a call to janus_rtcp_fix_ssrc a valid context pointer */
+static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp_fb *twcc, int total) {
+	if(ctx == NULL || twcc == NULL || total < 20)
+		return;
+	if(janus_log_level < LOG_HUGE)
+		return;
+	/* The feedback is consumed by the bandwidth estimator (see janus_rtcp_transport_wide_cc_parse),
+	 * here we only print a summary of its content */
+	janus_rtcp_transport_wide_cc_report reports[JANUS_RTCP_TWCC_MAX_FEEDBACK];
+	int num = janus_rtcp_transport_wide_cc_parse_fb(twcc, total, reports, JANUS_RTCP_TWCC_MAX_FEEDBACK);
+	JANUS_LOG(LOG_HUGE, "[TWCC] Statuses and arrivals (%d):\n", num);
+	int i = 0;
+	for(i=0; i<num; i++) {
+		JANUS_LOG(LOG_HUGE, "  [%02d][%"SCNu16"] %s (%"SCNi64"us)\n", i+1, reports[i].seq,
+			janus_rtp_packet_status_description(reports[i].status), reports[i].arrival);
+	}
+}
+
+int janus_rtcp_transport_wide_cc_parse(char *packet, int len, janus_rtcp_transport_wide_cc_report *reports, int max) {
+	if(packet == NULL || len == 0 || reports == NULL || max < 1)
+		return 0;
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
+	int total = len, num = 0;
+	while(rtcp) {
+		if(!janus_rtcp_check_len(rtcp, total))
+			break;
+		if(rtcp->version != 2)
+			break;
+		if(rtcp->type == RTCP_RTPFB && rtcp->rc == 15 && num < max) {
+			/* transport-cc */
+			num += janus_rtcp_transport_wide_cc_parse_fb((janus_rtcp_fb *)rtcp, total, reports + num, max - num);
+		}
+		/* Is this a compound packet? */
+		int length = ntohs(rtcp->length);
+		if(length == 0)
+			break;
+		total -= length*4+4;
+		if(total <= 0)
+			break;
+		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+	}
+	return num;
 }
 
 /* Link quality estimate filter coefficient */
@@ -1108,22 +1152,20 @@ int janus_rtcp_fix_report_data(char *packet, int len, uint32_t base_ts, uint32_t
 	return status;
 }
 
-gboolean janus_rtcp_has_bye(char *packet, int len) {
+int janus_rtcp_walk(char *packet, int len, janus_rtcp_visitor visitor, void *user_data) {
+	if(packet == NULL || len <= 0 || visitor == NULL)
+		return 0;
 	/* Parse RTCP compound packet */
 	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
 	int pno = 0, total = len;
 	while(rtcp) {
-		if (!janus_rtcp_check_len(rtcp, total))
+		if(!janus_rtcp_check_len(rtcp, total))
 			break;
 		if(rtcp->version != 2)
 			break;
 		pno++;
-		switch(rtcp->type) {
-			case RTCP_BYE:
-				return TRUE;
-			default:
-				break;
-		}
+		if(!visitor(rtcp, total, len-total, user_data))
+			break;
 		/* Is this a compound packet? */
 		int length = ntohs(rtcp->length);
 		if(length == 0)
@@ -1133,134 +1175,155 @@ gboolean janus_rtcp_has_bye(char *packet, int len) {
 			break;
 		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
 	}
-	return FALSE;
+	return pno;
 }
 
-gboolean janus_rtcp_has_fir(char *packet, int len) {
-	/* Parse RTCP compound packet */
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	int pno = 0, total = len;
-	while(rtcp) {
-		if (!janus_rtcp_check_len(rtcp, total))
+static gboolean janus_rtcp_summary_visit(janus_rtcp_header *rtcp, int len, int offset, void *user_data) {
+	janus_rtcp_summary *summary = (janus_rtcp_summary *)user_data;
+	switch(rtcp->type) {
+		case RTCP_SR:
+			if(summary->sr < 0)
+				summary->sr = offset;
 			break;
-		if(rtcp->version != 2)
+		case RTCP_RR:
+			if(summary->rr < 0)
+				summary->rr = offset;
+			break;
+		case RTCP_BYE:
+			summary->bye = TRUE;
+			break;
+		case RTCP_FIR:
+			summary->fir = TRUE;
+			break;
+		case RTCP_RTPFB: {
+			gint fmt = rtcp->rc;
+			if(fmt == 1 && summary->nack < 0) {
+				/* As janus_rtcp_get_nacks, we only care about the first NACK */
+				summary->nack = offset;
+				/* NACK FCI size is 4 bytes */
+				int nacks = ntohs(rtcp->length)-2;	/* Skip SSRCs */
+				if(nacks > 0 && janus_rtcp_check_fci(rtcp, len, 4))
+					summary->nack_count = nacks;
+			} else if(fmt == 15 && summary->twcc < 0) {
+				summary->twcc = offset;
+			}
 			break;
-		pno++;
-		switch(rtcp->type) {
-			case RTCP_FIR:
-				return TRUE;
-			default:
-				break;
 		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
+		case RTCP_PSFB: {
+			gint fmt = rtcp->rc;
+			if(fmt == 1) {
+				summary->pli = TRUE;
+			} else if(fmt == 4) {
+				summary->fir = TRUE;
+			} else if(fmt == 15 && summary->remb == 0) {
+				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+				janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
+				if(janus_rtcp_check_remb(rtcp, len) && remb->id[0] == 'R' && remb->id[1] == 'E' && remb->id[2] == 'M' && remb->id[3] == 'B') {
+					/* FIXME From rtcp_utility.cc */
+					unsigned char *_ptrRTCPData = (unsigned char *)remb;
+					_ptrRTCPData += 4;	/* Skip unique identifier and num ssrc */
+					uint8_t brExp = (_ptrRTCPData[1] >> 2) & 0x3F;
+					uint32_t brMantissa = (_ptrRTCPData[1] & 0x03) << 16;
+					brMantissa += (_ptrRTCPData[2] << 8);
+					brMantissa += (_ptrRTCPData[3]);
+					summary->remb = (uint64_t)brMantissa << brExp;
+					JANUS_LOG(LOG_HUGE, "Got REMB bitrate %"SCNu32"\n", summary->remb);
+				}
+			}
 			break;
-		total -= length*4+4;
-		if(total <= 0)
+		}
+		default:
 			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
 	}
-	return FALSE;
+	return TRUE;
 }
 
-gboolean janus_rtcp_has_pli(char *packet, int len) {
-	/* Parse RTCP compound packet */
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	int pno = 0, total = len;
-	while(rtcp) {
-		if (!janus_rtcp_check_len(rtcp, total))
-			break;
-		if(rtcp->version != 2)
-			break;
-		pno++;
-		switch(rtcp->type) {
-			case RTCP_PSFB: {
-				gint fmt = rtcp->rc;
-				if(fmt == 1)
-					return TRUE;
-				break;
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary) {
+	if(summary == NULL)
+		return 0;
+	memset(summary, 0, sizeof(*summary));
+	summary->sr = -1;
+	summary->rr = -1;
+	summary->nack = -1;
+	summary->twcc = -1;
+	summary->messages = janus_rtcp_walk(packet, len, janus_rtcp_summary_visit, summary);
+	return summary->messages;
+}
+
+gboolean janus_rtcp_nack_iter_init(janus_rtcp_nack_iter *iter, char *packet, janus_rtcp_summary *summary) {
+	if(iter == NULL)
+		return FALSE;
+	memset(iter, 0, sizeof(*iter));
+	iter->bit = -1;
+	if(packet == NULL || summary == NULL || summary->nack < 0 || summary->nack_count <= 0)
+		return FALSE;
+	janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)(packet + summary->nack);
+	iter->fci = (janus_rtcp_nack *)rtcpfb->fci;
+	iter->count = summary->nack_count;
+	return TRUE;
+}
+
+gboolean janus_rtcp_nack_iter_next(janus_rtcp_nack_iter *iter, uint16_t *seq) {
+	if(iter == NULL || iter->fci == NULL)
+		return FALSE;
+	while(iter->index < iter->count) {
+		janus_rtcp_nack *nack = iter->fci + iter->index;
+		uint16_t pid = ntohs(nack->pid);
+		if(iter->bit < 0) {
+			/* Start with the PID itself */
+			iter->bit = 0;
+			if(seq)
+				*seq = pid;
+			return TRUE;
+		}
+		/* Then go through the bitmask of following lost packets */
+		uint16_t blp = ntohs(nack->blp);
+		while(iter->bit < 16) {
+			int j = iter->bit++;
+			if(blp & (1 << j)) {
+				if(seq)
+					*seq = pid+j+1;
+				return TRUE;
 			}
-			default:
-				break;
 		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+		iter->index++;
+		iter->bit = -1;
 	}
 	return FALSE;
 }
 
+gboolean janus_rtcp_has_bye(char *packet, int len) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(packet, len, &summary);
+	return summary.bye;
+}
+
+gboolean janus_rtcp_has_fir(char *packet, int len) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(packet, len, &summary);
+	return summary.fir;
+}
+
+gboolean janus_rtcp_has_pli(char *packet, int len) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(packet, len, &summary);
+	return summary.pli;
+}
+
 GSList *janus_rtcp_get_nacks(char *packet, int len) {
 	if(packet == NULL || len == 0)
 		return NULL;
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	/* FIXME Get list of sequence numbers we should send again */
+	/* Get list of sequence numbers we should send again */
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(packet, len, &summary);
+	janus_rtcp_nack_iter iter;
+	if(!janus_rtcp_nack_iter_init(&iter, packet, &summary))
+		return NULL;
+	JANUS_LOG(LOG_DBG, "        Got %d nacks\n", summary.nack_count);
 	GSList *list = NULL;
-	int total = len;
-	gboolean error = FALSE;
-	while(rtcp) {
-		if (!janus_rtcp_check_len(rtcp, total)) {
-			error = TRUE;
-			break;
-		}
-		if (rtcp->version != 2) {
-			error = TRUE;
-			break;
-		}
-		if(rtcp->type == RTCP_RTPFB) {
-			gint fmt = rtcp->rc;
-			if(fmt == 1) {
-				/* NACK FCI size is 4 bytes */
-				if (!janus_rtcp_check_fci(rtcp, total, 4)) {
-					error = TRUE;
-					break;
-				}
-				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-				int nacks = ntohs(rtcp->length)-2;	/* Skip SSRCs */
-				if(nacks > 0) {
-					JANUS_LOG(LOG_DBG, "        Got %d nacks\n", nacks);
-					janus_rtcp_nack *nack = NULL;
-					uint16_t pid = 0;
-					uint16_t blp = 0;
-					int i=0, j=0;
-					char bitmask[20];
-					for(i=0; i< nacks; i++) {
-						nack = (janus_rtcp_nack *)rtcpfb->fci + i;
-						pid = ntohs(nack->pid);
-						list = g_slist_prepend(list, GUINT_TO_POINTER(pid));
-						blp = ntohs(nack->blp);
-						memset(bitmask, 0, 20);
-						for(j=0; j<16; j++) {
-							bitmask[j] = (blp & ( 1 << j )) >> j ? '1' : '0';
-							if((blp & ( 1 << j )) >> j)
-								list = g_slist_prepend(list, GUINT_TO_POINTER(pid+j+1));
-						}
-						bitmask[16] = '\n';
-						JANUS_LOG(LOG_DBG, "[%d] %"SCNu16" / %s\n", i, pid, bitmask);
-					}
-				}
-				break;
-			}
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	if (error && list) {
-		g_slist_free(list);
-		list = NULL;
-	}
+	uint16_t seq = 0;
+	while(janus_rtcp_nack_iter_next(&iter, &seq))
+		list = g_slist_prepend(list, GUINT_TO_POINTER(seq));
 	list = g_slist_reverse(list);
 	return list;
 }
@@ -1323,44 +1386,9 @@ int janus_rtcp_remove_nacks(char *packet, int len) {
 uint32_t janus_rtcp_get_remb(char *packet, int len) {
 	if(packet == NULL || len == 0)
 		return 0;
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	/* Get REMB bitrate, if any */
-	int total = len;
-	while(rtcp) {
-		if (!janus_rtcp_check_len(rtcp, total))
-			break;
-		if(rtcp->version != 2)
-			break;
-		if(rtcp->type == RTCP_PSFB) {
-			gint fmt = rtcp->rc;
-			if(fmt == 15) {
-				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-				janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
-				if(janus_rtcp_check_remb(rtcp, total) && remb->id[0] == 'R' && remb->id[1] == 'E' && remb->id[2] == 'M' && remb->id[3] == 'B') {
-					/* FIXME From rtcp_utility.cc */
-					unsigned char *_ptrRTCPData = (unsigned char *)remb;
-					_ptrRTCPData += 4;	/* Skip unique identifier and num ssrc */
-					//~ JANUS_LOG(LOG_VERB, " %02X %02X %02X %02X\n", _ptrRTCPData[0], _ptrRTCPData[1], _ptrRTCPData[2], _ptrRTCPData[3]);
-					uint8_t brExp = (_ptrRTCPData[1] >> 2) & 0x3F;
-					uint32_t brMantissa = (_ptrRTCPData[1] & 0x03) << 16;
-					brMantissa += (_ptrRTCPData[2] << 8);
-					brMantissa += (_ptrRTCPData[3]);
-					uint32_t bitrate = (uint64_t)brMantissa << brExp;
-					JANUS_LOG(LOG_HUGE, "Got REMB bitrate %"SCNu32"\n", bitrate);
-					return bitrate;
-				}
-			}
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	return 0;
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize(packet, len, &summary);
+	return summary.remb;
 }
 
 /* Change an existing REMB message */
@@ -1586,8 +1614,53 @@ int janus_rtcp_nacks(char *packet, int len, GSList *nacks) {
 	return words*4+4;
 }
 
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats) {
-	if(packet == NULL || size < sizeof(janus_rtcp_header) || transport_wide_cc_stats == NULL || g_queue_is_empty(transport_wide_cc_stats))
+janus_rtcp_transport_wide_cc_ring *janus_rtcp_transport_wide_cc_ring_create(void) {
+	return g_malloc0(sizeof(janus_rtcp_transport_wide_cc_ring));
+}
+
+void janus_rtcp_transport_wide_cc_ring_destroy(janus_rtcp_transport_wide_cc_ring *ring) {
+	g_free(ring);
+}
+
+void janus_rtcp_transport_wide_cc_ring_add(janus_rtcp_transport_wide_cc_ring *ring, guint32 transport_seq_num, guint64 timestamp) {
+	if(ring == NULL)
+		return;
+	if(!ring->started) {
+		ring->started = TRUE;
+		ring->base = transport_seq_num;
+		ring->highest = transport_seq_num;
+	} else if(transport_seq_num < ring->base) {
+		/* Too late, it was already reported (as lost) */
+		return;
+	}
+	guint32 distance = transport_seq_num - ring->base;
+	if(distance >= JANUS_RTCP_TWCC_RING_SIZE) {
+		/* We haven't sent feedback in a while: the oldest packets we didn't
+		 * report yet will not fit, so we drop them from the next feedback */
+		if(distance >= 2*JANUS_RTCP_TWCC_RING_SIZE) {
+			memset(ring->arrivals, 0, sizeof(ring->arrivals));
+			ring->base = transport_seq_num - JANUS_RTCP_TWCC_RING_SIZE + 1;
+		} else {
+			while(transport_seq_num - ring->base >= JANUS_RTCP_TWCC_RING_SIZE) {
+				ring->arrivals[ring->base & JANUS_RTCP_TWCC_RING_MASK] = 0;
+				ring->base++;
+			}
+		}
+		if(ring->highest < ring->base)
+			ring->highest = ring->base;
+	}
+	/* A zero arrival time means "not received", so make sure we don't use it */
+	ring->arrivals[transport_seq_num & JANUS_RTCP_TWCC_RING_MASK] = timestamp ? timestamp : 1;
+	if(transport_seq_num > ring->highest)
+		ring->highest = transport_seq_num;
+}
+
+gboolean janus_rtcp_transport_wide_cc_ring_pending(janus_rtcp_transport_wide_cc_ring *ring) {
+	return ring != NULL && ring->started && ring->highest >= ring->base;
+}
+
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count, janus_rtcp_transport_wide_cc_ring *ring) {
+	if(packet == NULL || size < sizeof(janus_rtcp_header) || !janus_rtcp_transport_wide_cc_ring_pending(ring))
 		return -1;
 
 	memset(packet, 0, size);
@@ -1601,13 +1674,17 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	rtcpfb->ssrc = htonl(ssrc);
 	rtcpfb->media = htonl(media);
 
-	/* Get first packet */
-	janus_rtcp_transport_wide_cc_stats *stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
+	/* We report all packets from the first one we haven't reported yet,
+	 * to the highest one we received: the ones in the middle that have
+	 * no arrival time are reported as lost */
+	guint32 first_seq_num = ring->base;
+	guint packet_status_count = ring->highest - ring->base + 1;
+	if(packet_status_count > JANUS_RTCP_TWCC_MAX_FEEDBACK)
+		packet_status_count = JANUS_RTCP_TWCC_MAX_FEEDBACK;
 	/* Calculate temporal info */
-	guint16 base_seq_num = stat->transport_seq_num;
+	guint16 base_seq_num = first_seq_num;
 	gboolean first_received	= FALSE;
 	guint64 reference_time = 0;
-	guint packet_status_count = g_queue_get_length(transport_wide_cc_stats) + 1;
 
 	/*
 		0                   1                   2                   3
@@ -1637,26 +1714,33 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	/* Initial time in us */
 	guint64 timestamp = 0;
 
-	/* Store delta array */
-	GQueue *deltas = g_queue_new();
-	GQueue *statuses = g_queue_new();
+	/* Store deltas and statuses: we never have more than one per packet */
+	gint deltas[JANUS_RTCP_TWCC_MAX_FEEDBACK];
+	guint deltas_count = 0;
+	janus_rtp_packet_status statuses[JANUS_RTCP_TWCC_MAX_FEEDBACK];
+	guint statuses_head = 0, statuses_tail = 0;
 	janus_rtp_packet_status last_status = janus_rtp_packet_status_reserved;
 	janus_rtp_packet_status max_status = janus_rtp_packet_status_notreceived;
 	gboolean all_same = TRUE;
 
 	/* For each packet  */
-	while (stat != NULL) {
+	guint n = 0;
+	for (n=0; n<packet_status_count; n++) {
 		janus_rtp_packet_status status = janus_rtp_packet_status_notreceived;
+		/* Get the arrival time, and clear the slot for the next cycle */
+		guint64 *slot = &ring->arrivals[(first_seq_num + n) & JANUS_RTCP_TWCC_RING_MASK];
+		guint64 arrival = *slot;
+		*slot = 0;
 
 		/* If got packet */
-		if (stat->timestamp) {
+		if (arrival) {
 			int delta = 0;
 			/* If first received */
 			if (!first_received) {
 				/* Got it  */
 				first_received = TRUE;
 				/* Set it */
-				reference_time = stat->timestamp / 64000;
+				reference_time = arrival / 64000;
 				/* Get initial time */
 				timestamp = reference_time * 64000;
 				/* also in buffer */
@@ -1665,10 +1749,10 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			}
 
 			/* Get delta */
-			if (stat->timestamp>timestamp)
-				delta = (stat->timestamp-timestamp)/250;
+			if (arrival>timestamp)
+				delta = (arrival-timestamp)/250;
 			else
-				delta = -(int)((timestamp-stat->timestamp)/250);
+				delta = -(int)((timestamp-arrival)/250);
 			/* If it is negative or too big */
 			if (delta<0 || delta> 255) {
 				/* Big one */
@@ -1679,15 +1763,15 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			}
 			/* Store delta */
 			/* Overflows are possible here */
-			g_queue_push_tail(deltas, GINT_TO_POINTER(delta));
+			deltas[deltas_count++] = delta;
 			/* Set last time */
-			timestamp = stat->timestamp;
+			timestamp = arrival;
 		}
 
 		/* Check if all previoues ones were equal and this one the first different */
 		if (all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
 			/* How big was the same run */
-			if (g_queue_get_length(statuses)>7) {
+			if ((statuses_tail-statuses_head)>7) {
 				guint32 word = 0;
 				/* Write run! */
 				/*
@@ -1700,12 +1784,12 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				 */
 				word = janus_push_bits(word, 1, 0);
 				word = janus_push_bits(word, 2, last_status);
-				word = janus_push_bits(word, 13, g_queue_get_length(statuses));
+				word = janus_push_bits(word, 13, (statuses_tail-statuses_head));
 				/* Write word */
 				janus_set2(data, len, word);
 				len += 2;
 				/* Remove all statuses */
-				g_queue_clear(statuses);
+				statuses_head = statuses_tail = 0;
 				/* Reset status */
 				last_status = janus_rtp_packet_status_reserved;
 				max_status = janus_rtp_packet_status_notreceived;
@@ -1717,7 +1801,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		}
 
 		/* Push back statuses, it will be handled later */
-		g_queue_push_tail(statuses, GUINT_TO_POINTER(status));
+		statuses[statuses_tail++] = status;
 
 		/* If it is bigger */
 		if (status>max_status) {
@@ -1730,7 +1814,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		/* Check if we can still be enqueuing for a run */
 		if (!all_same) {
 			/* Check  */
-			if (!all_same && max_status==janus_rtp_packet_status_largeornegativedelta && g_queue_get_length(statuses)>6) {
+			if (!all_same && max_status==janus_rtp_packet_status_largeornegativedelta && (statuses_tail-statuses_head)>6) {
 				guint32 word = 0;
 				/*
 					0                   1
@@ -1747,7 +1831,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				size_t i = 0;
 				for (i=0;i<7;++i) {
 					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+					janus_rtp_packet_status status = statuses[statuses_head++];
 					/* Write */
 					word = janus_push_bits(word, 2, (guint8)status);
 				}
@@ -1760,9 +1844,9 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				all_same = TRUE;
 
 				/* We need to restore the values, as there may be more elements on the buffer */
-				for (i=0; i<g_queue_get_length(statuses); ++i) {
+				for (i=0; i<(statuses_tail-statuses_head); ++i) {
 					/* Get status */
-					status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_peek_nth(statuses, i));
+					status = statuses[statuses_head+i];
 					/* If it is bigger */
 					if (status>max_status) {
 						/* Store it */
@@ -1776,7 +1860,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 					/* Store las status */
 					last_status = status;
 				}
-			} else if (!all_same && g_queue_get_length(statuses)>13) {
+			} else if (!all_same && (statuses_tail-statuses_head)>13) {
 				guint32 word = 0;
 				/*
 					0                   1
@@ -1793,7 +1877,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				guint32 i = 0;
 				for (i=0;i<14;++i) {
 					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+					janus_rtp_packet_status status = statuses[statuses_head++];
 					/* Write */
 					word = janus_push_bits(word, 1, (guint8)status);
 				}
@@ -1806,15 +1890,12 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				all_same = TRUE;
 			}
 		}
-		/* Free mem */
-		g_free(stat);
-
-		/* Get next packet stat */
-		stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
 	}
+	/* These packets have been reported now */
+	ring->base = first_seq_num + packet_status_count;
 
 	/* Get status len */
-	size_t statuses_len = g_queue_get_length(statuses);
+	size_t statuses_len = (statuses_tail-statuses_head);
 
 	/* If not finished yet */
 	if (statuses_len>0) {
@@ -1837,7 +1918,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			unsigned int i = 0;
 			for (i=0;i<statuses_len;i++) {
 				/* Get each status */
-				janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+				janus_rtp_packet_status status = statuses[statuses_head++];
 				/* Write */
 				word = janus_push_bits(word, 2, (guint8)status);
 			}
@@ -1855,7 +1936,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			unsigned int i = 0;
 			for (i=0;i<statuses_len;i++) {
 				/* Get each status */
-				janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+				janus_rtp_packet_status status = statuses[statuses_head++];
 				/* Write */
 				word = janus_push_bits(word, 1, (guint8)status);
 			}
@@ -1868,9 +1949,9 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	}
 
 	/* Write now the deltas */
-	while (!g_queue_is_empty(deltas)) {
+	for (n=0; n<deltas_count; n++) {
 		/* Get next delta */
-		gint delta = GPOINTER_TO_INT(g_queue_pop_head (deltas));
+		gint delta = deltas[n];
 		/* Check size */
 		if (delta<0 || delta>255) {
 			short reported_delta = (short)delta;
@@ -1891,10 +1972,6 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		}
 	}
 
-	/* Clean mem */
-	g_queue_free(statuses);
-	g_queue_free(deltas);
-
 	/* Add zero padding */
 	while (len%4) {
 		/* Add padding */
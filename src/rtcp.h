@@ -296,6 +296,60 @@ typedef struct rtcp_transport_wide_cc_stats
 } rtcp_transport_wide_cc_stats;
 typedef rtcp_transport_wide_cc_stats janus_rtcp_transport_wide_cc_stats;
 
+/*! \brief Number of packets the transport-wide CC arrival ring can track (must be a power of 2) */
+#define JANUS_RTCP_TWCC_RING_SIZE	4096
+#define JANUS_RTCP_TWCC_RING_MASK	(JANUS_RTCP_TWCC_RING_SIZE-1)
+/*! \brief Maximum number of packets reported in a single transport-wide CC feedback */
+#define JANUS_RTCP_TWCC_MAX_FEEDBACK	400
+/*! \brief Arrival times of the packets we haven't sent transport-wide CC feedback
+ * for yet, indexed by extended transport-wide sequence number: this way adding
+ * a packet never allocates memory, and feedback is generated in order */
+typedef struct janus_rtcp_transport_wide_cc_ring {
+	/*! \brief Reception times, in microseconds (0 if the packet was not received) */
+	guint64 arrivals[JANUS_RTCP_TWCC_RING_SIZE];
+	/*! \brief First extended sequence number not reported in feedback yet */
+	guint32 base;
+	/*! \brief Highest extended sequence number received so far */
+	guint32 highest;
+	/*! \brief Whether we received any packet yet */
+	gboolean started;
+} janus_rtcp_transport_wide_cc_ring;
+/*! \brief Create a new transport-wide CC arrival ring
+ * @returns A new janus_rtcp_transport_wide_cc_ring instance */
+janus_rtcp_transport_wide_cc_ring *janus_rtcp_transport_wide_cc_ring_create(void);
+/*! \brief Destroy a transport-wide CC arrival ring
+ * @param[in] ring The janus_rtcp_transport_wide_cc_ring instance to destroy */
+void janus_rtcp_transport_wide_cc_ring_destroy(janus_rtcp_transport_wide_cc_ring *ring);
+/*! \brief Track the arrival of a packet in a transport-wide CC arrival ring
+ * @note Packets older than the ones already reported in feedback are ignored
+ * @param[in] ring The janus_rtcp_transport_wide_cc_ring instance to update
+ * @param[in] transport_seq_num The extended transport-wide sequence number of the packet
+ * @param[in] timestamp The reception time of the packet, in microseconds */
+void janus_rtcp_transport_wide_cc_ring_add(janus_rtcp_transport_wide_cc_ring *ring, guint32 transport_seq_num, guint64 timestamp);
+/*! \brief Check whether there are packets that have not been reported in feedback yet
+ * @param[in] ring The janus_rtcp_transport_wide_cc_ring instance to check
+ * @returns TRUE if there are packets to report, FALSE otherwise */
+gboolean janus_rtcp_transport_wide_cc_ring_pending(janus_rtcp_transport_wide_cc_ring *ring);
+
+/*! \brief Status of a packet, as reported in an incoming transport-wide CC feedback */
+typedef struct janus_rtcp_transport_wide_cc_report {
+	/*! \brief Transport-wide sequence number of the packet */
+	guint16 seq;
+	/*! \brief Packet status symbol (0=not received, 1=small delta, 2=large or negative delta) */
+	guint8 status;
+	/*! \brief Whether the packet was received */
+	gboolean received;
+	/*! \brief Arrival time of the packet (in microseconds, according to the clock of the receiver), if received */
+	gint64 arrival;
+} janus_rtcp_transport_wide_cc_report;
+/*! \brief Method to parse the transport-wide CC feedback messages in an incoming RTCP compound packet
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[out] reports Array to fill with the status of each reported packet, in sequence order
+ * @param[in] max Size of the reports array
+ * @returns The number of reports filled, 0 if no transport-wide CC feedback was available */
+int janus_rtcp_transport_wide_cc_parse(char *packet, int len, janus_rtcp_transport_wide_cc_report *reports, int max);
+
 /*! \brief Method to retrieve the estimated round-trip time from an existing RTCP context
  * @param[in] ctx The RTCP context to query
  * @returns The estimated round-trip time */
@@ -432,6 +486,71 @@ int janus_rtcp_process_incoming_rtp(janus_rtcp_context *ctx, char *packet, int l
  * @returns 0 in case of success, -1 on errors */
 int janus_rtcp_report_block(janus_rtcp_context *ctx, janus_report_block *rb);
 
+/*! \brief Callback invoked by janus_rtcp_walk for each message in an RTCP compound packet
+ * @param[in] rtcp The RTCP message (its length has already been validated)
+ * @param[in] len The data length in bytes, from this message to the end of the compound packet
+ * @param[in] offset Offset of this message in the compound packet, in bytes
+ * @param[in] user_data Opaque pointer passed to janus_rtcp_walk
+ * @returns TRUE to keep on walking, FALSE to stop */
+typedef gboolean (*janus_rtcp_visitor)(janus_rtcp_header *rtcp, int len, int offset, void *user_data);
+/*! \brief Method to walk an RTCP compound packet, invoking a visitor for each message in it
+ * \note The packet is validated the same way all the other helpers in this file do:
+ * the walk stops at the first message that is too short or has the wrong version
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[in] visitor The callback to invoke for each message
+ * @param[in] user_data Opaque pointer to pass to the callback
+ * @returns The number of messages that were visited */
+int janus_rtcp_walk(char *packet, int len, janus_rtcp_visitor visitor, void *user_data);
+
+/*! \brief Summary of what an RTCP compound packet contains, as filled in
+ * a single pass by janus_rtcp_summarize: offsets are relative to the start
+ * of the compound packet, and are -1 when the related message is missing */
+typedef struct janus_rtcp_summary {
+	/*! \brief Number of valid messages in the compound packet */
+	int messages;
+	/*! \brief Whether the packet contains a BYE, a FIR (legacy or RFC5104) or a PLI */
+	gboolean bye, fir, pli;
+	/*! \brief Bitrate of the first valid (and non-zero) REMB in the packet, 0 if none was found */
+	uint32_t remb;
+	/*! \brief Offset of the first SR and of the first RR */
+	int sr, rr;
+	/*! \brief Offset of the first NACK, and number of FCI entries it contains (0 if it's malformed) */
+	int nack, nack_count;
+	/*! \brief Offset of the first transport-wide CC feedback */
+	int twcc;
+} janus_rtcp_summary;
+/*! \brief Method to parse an RTCP compound packet in a single pass, and summarize what it contains
+ * \note No memory is allocated: the summary is meant to be allocated on the stack
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[out] summary The summary to fill
+ * @returns The number of valid messages in the packet */
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary);
+
+/*! \brief Iterator on the sequence numbers of an RTCP NACK message, which
+ * doesn't need any memory to be allocated (see janus_rtcp_nack_iter_init) */
+typedef struct janus_rtcp_nack_iter {
+	/*! \brief FCI entries of the NACK message */
+	janus_rtcp_nack *fci;
+	/*! \brief Number of FCI entries, and index of the current one */
+	int count, index;
+	/*! \brief Next bit to check in the bitmask of the current entry (-1 if we still need to return its PID) */
+	int bit;
+} janus_rtcp_nack_iter;
+/*! \brief Method to initialize an iterator on the NACK message in an RTCP compound packet
+ * @param[out] iter The iterator to initialize
+ * @param[in] packet The message data
+ * @param[in] summary The summary of the packet, as filled by janus_rtcp_summarize
+ * @returns TRUE if the packet contains a NACK to iterate on, FALSE otherwise */
+gboolean janus_rtcp_nack_iter_init(janus_rtcp_nack_iter *iter, char *packet, janus_rtcp_summary *summary);
+/*! \brief Method to get the next sequence number from a NACK iterator
+ * \note Sequence numbers are returned in the same order janus_rtcp_get_nacks would
+ * @param[in] iter The iterator to update
+ * @param[out] seq The next sequence number to send again
+ * @returns TRUE if a sequence number was returned, FALSE when there are no more */
+gboolean janus_rtcp_nack_iter_next(janus_rtcp_nack_iter *iter, uint16_t *seq);
+
 /*! \brief Method to check whether an RTCP message contains a BYE message
  * @param[in] packet The message data
  * @param[in] len The message data length in bytes
@@ -453,7 +572,9 @@ gboolean janus_rtcp_has_pli(char *packet, int len);
 /*! \brief Method to parse an RTCP NACK message
  * @param[in] packet The message data
  * @param[in] len The message data length in bytes
- * @returns A list of janus_nack elements containing the sequence numbers to send again */
+ * @returns A list of janus_nack elements containing the sequence numbers to send again
+ * \note This allocates a list: janus_rtcp_summarize and janus_rtcp_nack_iter_init
+ * can be used instead to go through the sequence numbers without allocating memory */
 GSList *janus_rtcp_get_nacks(char *packet, int len);
 
 /*! \brief Method to remove an RTCP NACK message
@@ -535,9 +656,12 @@ int janus_rtcp_nacks(char *packet, int len, GSList *nacks);
  * @param[in] len The message data length in bytes
  * @param[in] ssrc SSRC of the origin stream
  * @param[in] media SSRC of the destination stream
+ * @note At most \ref JANUS_RTCP_TWCC_MAX_FEEDBACK packets are reported in a
+ * single message: if janus_rtcp_transport_wide_cc_ring_pending still returns
+ * TRUE after this call, more messages are needed
  * @param[in] feedback_packet_count Feedback paccket count
- * @param[in] transport_wide_cc_stats List of rtp packet reception stats
+ * @param[in] ring Arrival ring of the packets to report (updated after the call)
  * @returns The message data length in bytes, if successful, -1 on errors */
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats);
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count, janus_rtcp_transport_wide_cc_ring *ring);
 
 #endif
@@ -126,97 +126,141 @@ const char *janus_rtp_header_extension_get_from_id(const char *sdp, int id) {
 	return NULL;
 }
 
-/* Static helper to quickly find the extension data */
-static int janus_rtp_header_extension_find(char *buf, int len, int id,
-		uint8_t *byte, uint32_t *word, char **ref, uint8_t *idlen) {
-	if(idlen == NULL)
+int janus_rtp_header_extensions_parse(char *buf, int len, janus_rtp_header_extensions *exts) {
+	if(exts == NULL)
 		return -1;
-	*idlen = 0;
+	exts->buf = buf;
+	exts->len = len;
+	exts->count = 0;
+	exts->others_count = 0;
 	if(!buf || len < 12)
 		return -2;
 	janus_rtp_header *rtp = (janus_rtp_header *)buf;
-	if(rtp->version != 2) {
+	if(rtp->version != 2)
 		return -3;
-	}
+	/* Fast path: no extensions at all, which means lookups will fail right
+	 * away without looking at the tables, so we don't even clear them */
 	int hlen = 12;
 	if(rtp->csrccount)	/* Skip CSRC if needed */
 		hlen += rtp->csrccount*4;
-	if(rtp->extension && (len > hlen + (int)sizeof(janus_rtp_header_extension))) {
-		janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
-		int extlen = ntohs(ext->length)*4;
-		hlen += 4;
-		if(len > (hlen + extlen)) {
-			if(ntohs(ext->type) == 0xBEDE) {
-				/* 1-Byte extension */
-				const uint8_t padding = 0x00, reserved = 0xF;
-				uint8_t extid = 0;
-				int i = 0;
-				while(i < extlen) {
-					extid = (uint8_t)buf[hlen+i] >> 4;
-					if(extid == reserved) {
-						break;
-					} else if(extid == padding) {
-						i++;
-						continue;
-					}
-					*idlen = ((uint8_t)buf[hlen+i] & 0xF)+1;
-					i++;
-					if(extid == id && ((i+*idlen) <= extlen)) {
-						/* Found! */
-						if(byte)
-							*byte = (uint8_t)buf[hlen+i];
-						if(word && *idlen >= 4 && (i+4) < extlen) {
-							memcpy(word, buf+hlen+i, sizeof(uint32_t));
-							*word = ntohl(*word);
-						}
-						if(ref)
-							*ref = &buf[hlen+i];
-						return 0;
-					}
-					i += *idlen;
-				}
-			} else if(ntohs(ext->type) == 0x1000) {
-				/* 2-Byte extension */
-				const uint8_t padding = 0x00;
-				uint8_t extid = 0;
-				int i = 0;
-				while(i < extlen) {
-					if((extlen-i) < 2)
-						break;
-					extid = buf[hlen+i];
-					if(extid == padding) {
-						i += 2;
-						continue;
-					}
-					i++;
-					*idlen = buf[hlen+i];
-					i++;
-					if(extid == id && ((i+*idlen) <= extlen)) {
-						/* Found! */
-						if(byte)
-							*byte = (uint8_t)buf[hlen+i];
-						if(word && *idlen >= 4 && (i+4) < extlen) {
-							memcpy(word, buf+hlen+i, sizeof(uint32_t));
-							*word = ntohl(*word);
-						}
-						if(ref)
-							*ref = &buf[hlen+i];
-						return 0;
-					}
-					i += *idlen;
-				}
+	if(!rtp->extension || (len <= hlen + (int)sizeof(janus_rtp_header_extension)))
+		return 0;
+	janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
+	int extlen = ntohs(ext->length)*4;
+	hlen += 4;
+	if(len <= (hlen + extlen))
+		return 0;
+	uint16_t type = ntohs(ext->type);
+	if(type != 0xBEDE && type != 0x1000)
+		return 0;
+	memset(exts->offset, 0, sizeof(exts->offset));
+	/* Walk the extensions block once, and keep track of where each one is */
+	gboolean onebyte = (type == 0xBEDE);
+	uint8_t extid = 0, idlen = 0;
+	int i = 0;
+	while(i < extlen) {
+		if(onebyte) {
+			/* 1-Byte extension */
+			extid = (uint8_t)buf[hlen+i] >> 4;
+			if(extid == 0xF) {
+				/* Reserved, stop here */
+				break;
+			} else if(extid == 0) {
+				/* Padding */
+				i++;
+				continue;
+			}
+			idlen = ((uint8_t)buf[hlen+i] & 0xF)+1;
+			i++;
+		} else {
+			/* 2-Byte extension */
+			if((extlen-i) < 2)
+				break;
+			extid = (uint8_t)buf[hlen+i];
+			if(extid == 0) {
+				/* Padding */
+				i += 2;
+				continue;
+			}
+			idlen = (uint8_t)buf[hlen+i+1];
+			i += 2;
+		}
+		if((i+idlen) > extlen)
+			break;
+		/* If the same ID appears more than once, only the first one counts */
+		if(extid < JANUS_RTP_EXTENSIONS_DIRECT_IDS) {
+			if(exts->offset[extid] == 0) {
+				exts->offset[extid] = hlen+i;
+				exts->length[extid] = idlen;
+				exts->count++;
+			}
+		} else if(exts->others_count < JANUS_RTP_EXTENSIONS_MAX_OTHERS) {
+			int j = 0;
+			for(j=0; j<exts->others_count; j++) {
+				if(exts->others[j].id == extid)
+					break;
+			}
+			if(j == exts->others_count) {
+				exts->others[j].id = extid;
+				exts->others[j].offset = hlen+i;
+				exts->others[j].length = idlen;
+				exts->others_count++;
+				exts->count++;
 			}
-			hlen += extlen;
 		}
+		i += idlen;
 	}
-	return -1;
+	return exts->count;
 }
 
-int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gboolean *vad, int *level) {
-	uint8_t byte = 0, idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, &byte, NULL, NULL, &idlen) < 0)
+char *janus_rtp_header_extensions_find(const janus_rtp_header_extensions *exts, int id, uint8_t *idlen) {
+	if(exts == NULL || exts->count == 0 || id < 1 || id > 255)
+		return NULL;
+	if(id < JANUS_RTP_EXTENSIONS_DIRECT_IDS) {
+		if(exts->offset[id] == 0)
+			return NULL;
+		if(idlen)
+			*idlen = exts->length[id];
+		return exts->buf + exts->offset[id];
+	}
+	int j = 0;
+	for(j=0; j<exts->others_count; j++) {
+		if(exts->others[j].id == id) {
+			if(idlen)
+				*idlen = exts->others[j].length;
+			return exts->buf + exts->others[j].offset;
+		}
+	}
+	return NULL;
+}
+
+/* Static helper to check if an extension that was found is large enough
+ * and doesn't reach the end of the packet (same checks as before) */
+static char *janus_rtp_header_extensions_find_checked(const janus_rtp_header_extensions *exts, int id,
+		uint8_t min, uint8_t *idlen, int *res) {
+	char *ext = janus_rtp_header_extensions_find(exts, id, idlen);
+	if(ext == NULL) {
+		*res = -1;
+		return NULL;
+	}
+	if(*idlen < min || *idlen > exts->len-(ext-exts->buf)-1) {
+		*res = -3;
+		return NULL;
+	}
+	*res = 0;
+	return ext;
+}
+
+int janus_rtp_header_extensions_get_audio_level(const janus_rtp_header_extensions *exts, int id, gboolean *vad, int *level) {
+	uint8_t idlen = 0;
+	char *ext = janus_rtp_header_extensions_find(exts, id, &idlen);
+	if(ext == NULL)
 		return -1;
+	/* Two-byte header extensions may be empty */
+	if(idlen < 1)
+		return -2;
 	/* a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level */
+	uint8_t byte = (uint8_t)*ext;
 	gboolean v = (byte & 0x80) >> 7;
 	int value = byte & 0x7F;
 	JANUS_LOG(LOG_DBG, "%02x --> v=%d, level=%d\n", byte, v, value);
@@ -227,12 +271,17 @@ int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gbo
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int id,
+int janus_rtp_header_extensions_get_video_orientation(const janus_rtp_header_extensions *exts, int id,
 		gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
-	uint8_t byte = 0, idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, &byte, NULL, NULL, &idlen) < 0)
+	uint8_t idlen = 0;
+	char *ext = janus_rtp_header_extensions_find(exts, id, &idlen);
+	if(ext == NULL)
 		return -1;
+	/* Two-byte header extensions may be empty */
+	if(idlen < 1)
+		return -2;
 	/* a=extmap:4 urn:3gpp:video-orientation */
+	uint8_t byte = (uint8_t)*ext;
 	gboolean cbit = (byte & 0x08) >> 3;
 	gboolean fbit = (byte & 0x04) >> 2;
 	gboolean r1bit = (byte & 0x02) >> 1;
@@ -249,18 +298,19 @@ int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int i
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
+int janus_rtp_header_extensions_get_playout_delay(const janus_rtp_header_extensions *exts, int id,
 		uint16_t *min_delay, uint16_t *max_delay) {
-	uint32_t bytes = 0;
 	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, &bytes, NULL, &idlen) < 0)
+	char *ext = janus_rtp_header_extensions_find(exts, id, &idlen);
+	if(ext == NULL)
 		return -1;
 	if(idlen < 3)
 		return -2;
 	/* a=extmap:6 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay */
-	uint16_t min = (bytes & 0x00FFF000) >> 12;
-	uint16_t max = bytes & 0x00000FFF;
-	JANUS_LOG(LOG_DBG, "%"SCNu32"x --> min=%"SCNu16", max=%"SCNu16"\n", bytes, min, max);
+	uint8_t *bytes = (uint8_t *)ext;
+	uint16_t min = (bytes[0] << 4) | (bytes[1] >> 4);
+	uint16_t max = ((bytes[1] & 0x0F) << 8) | bytes[2];
+	JANUS_LOG(LOG_DBG, "%02x%02x%02x --> min=%"SCNu16", max=%"SCNu16"\n", bytes[0], bytes[1], bytes[2], min, max);
 	if(min_delay)
 		*min_delay = min;
 	if(max_delay)
@@ -268,82 +318,68 @@ int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_mid(char *buf, int len, int id,
-		char *sdes_item, int sdes_len) {
-	char *ext = NULL;
+/* Static helper to copy a string extension (mid, rid) */
+static int janus_rtp_header_extensions_get_sdes(const janus_rtp_header_extensions *exts, int id,
+		char *sdes_item, int sdes_len, const char *what) {
 	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
+	char *ext = janus_rtp_header_extensions_find(exts, id, &idlen);
+	if(ext == NULL)
 		return -1;
-	/* a=extmap:3 urn:ietf:params:rtp-hdrext:sdes:mid */
-	if(ext == NULL || idlen < 1)
+	if(idlen < 1)
 		return -2;
 	if(idlen > (sdes_len-1)) {
-		JANUS_LOG(LOG_WARN, "SDES buffer is too small (%d > %d), MID will be cut\n", idlen, sdes_len);
+		JANUS_LOG(LOG_WARN, "SDES buffer is too small (%d > %d), %s will be cut\n", idlen, sdes_len, what);
 		idlen = sdes_len-1;
 	}
-	if(idlen > len-(ext-buf)-1 ) {
+	if(idlen > exts->len-(ext-exts->buf)-1)
 		return -3;
-	}
 	memcpy(sdes_item, ext, idlen);
 	*(sdes_item+idlen) = '\0';
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_rid(char *buf, int len, int id,
+int janus_rtp_header_extensions_get_mid(const janus_rtp_header_extensions *exts, int id,
+		char *sdes_item, int sdes_len) {
+	/* a=extmap:3 urn:ietf:params:rtp-hdrext:sdes:mid */
+	return janus_rtp_header_extensions_get_sdes(exts, id, sdes_item, sdes_len, "MID");
+}
+
+int janus_rtp_header_extensions_get_rid(const janus_rtp_header_extensions *exts, int id,
 		char *sdes_item, int sdes_len) {
-	char *ext = NULL;
-	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
 	/* a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id */
 	/* a=extmap:5 urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id */
-	if(ext == NULL || idlen < 1)
-		return -2;
-	if(idlen > (sdes_len-1)) {
-		JANUS_LOG(LOG_WARN, "SDES buffer is too small (%d > %d), RTP stream ID will be cut\n", idlen, sdes_len);
-		idlen = sdes_len-1;
-	}
-	if(idlen > len-(ext-buf)-1 ) {
-		return -3;
-	}
-	memcpy(sdes_item, ext, idlen);
-	*(sdes_item+idlen) = '\0';
-	return 0;
+	return janus_rtp_header_extensions_get_sdes(exts, id, sdes_item, sdes_len, "RTP stream ID");
 }
 
-int janus_rtp_header_extension_parse_dependency_desc(char *buf, int len, int id,
+int janus_rtp_header_extensions_get_dependency_desc(const janus_rtp_header_extensions *exts, int id,
 		uint8_t *dd_item, int *dd_len) {
-	char *ext = NULL;
 	uint8_t idlen = 0;
 	int buflen = *dd_len;
 	*dd_len = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
+	char *ext = janus_rtp_header_extensions_find(exts, id, &idlen);
+	if(ext == NULL)
 		return -1;
 	/* a=extmap:10 https://aomediacodec.github.io/av1-rtp-spec/#dependency-descriptor-rtp-header-extension */
-	if(ext == NULL || idlen < 1)
+	if(idlen < 1)
 		return -2;
 	if(idlen > buflen) {
 		JANUS_LOG(LOG_WARN, "SDES buffer is too small (%d > %d), dependency descriptor will be cut\n", idlen, buflen);
 		idlen = buflen;
 	}
-	if(idlen > len-(ext-buf)-1 ) {
+	if(idlen > exts->len-(ext-exts->buf)-1)
 		return -3;
-	}
 	memcpy(dd_item, ext, idlen);
 	*dd_len = idlen;
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_abs_send_time(char *buf, int len, int id, uint32_t *abs_ts) {
-	char *ext = NULL;
+int janus_rtp_header_extensions_get_abs_send_time(const janus_rtp_header_extensions *exts, int id, uint32_t *abs_ts) {
 	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
+	int res = 0;
 	/* a=extmap:4 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time */
+	char *ext = janus_rtp_header_extensions_find_checked(exts, id, 3, &idlen, &res);
 	if(ext == NULL)
-		return -2;
-	if(idlen < 3 || idlen > len-(ext-buf)-1)
-		return -3;
+		return res;
 	uint32_t abs24 = 0;
 	memcpy(&abs24, ext, 3);
 	if(abs_ts)
@@ -351,30 +387,13 @@ int janus_rtp_header_extension_parse_abs_send_time(char *buf, int len, int id, u
 	return 0;
 }
 
-int janus_rtp_header_extension_set_abs_send_time(char *buf, int len, int id, uint32_t abs_ts) {
-	char *ext = NULL;
-	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
-	if(ext == NULL)
-		return -2;
-	if(idlen < 3 || idlen > len-(ext-buf)-1)
-		return -3;
-	uint32_t abs24 = htonl(abs_ts) >> 8;
-	memcpy(ext, &abs24, 3);
-	return 0;
-}
-
-int janus_rtp_header_extension_parse_abs_capture_time(char *buf, int len, int id, uint64_t *abs_ts) {
-	char *ext = NULL;
+int janus_rtp_header_extensions_get_abs_capture_time(const janus_rtp_header_extensions *exts, int id, uint64_t *abs_ts) {
 	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
+	int res = 0;
 	/* a=extmap:7 http://www.webrtc.org/experiments/rtp-hdrext/abs-capture-time */
+	char *ext = janus_rtp_header_extensions_find_checked(exts, id, 8, &idlen, &res);
 	if(ext == NULL)
-		return -2;
-	if(idlen < 8 || idlen > len-(ext-buf)-1)
-		return -3;
+		return res;
 	uint64_t abs64 = 0;
 	memcpy(&abs64, ext, 8);
 	if(abs_ts)
@@ -382,49 +401,119 @@ int janus_rtp_header_extension_parse_abs_capture_time(char *buf, int len, int id
 	return 0;
 }
 
-int janus_rtp_header_extension_set_abs_capture_time(char *buf, int len, int id, uint64_t abs_ts) {
-	char *ext = NULL;
+int janus_rtp_header_extensions_get_transport_wide_cc(const janus_rtp_header_extensions *exts, int id, uint16_t *transSeqNum) {
 	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
-	if(ext == NULL)
-		return -2;
-	if(idlen < 8 || idlen > len-(ext-buf)-1)
-		return -3;
-	uint64_t abs64 = htonll(abs_ts);
-	memcpy(ext, &abs64, 8);
-	return 0;
-}
-
-int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id, uint16_t *transSeqNum) {
-	char *ext = NULL;
-	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
+	int res = 0;
 	/*  0                   1                   2                   3
 	    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
 	   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 	   |  ID   | L=1   |transport-wide sequence number | zero padding  |
 	   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 	*/
+	char *ext = janus_rtp_header_extensions_find_checked(exts, id, 2, &idlen, &res);
 	if(ext == NULL)
-		return -2;
-	if(idlen < 2 || idlen > len-(ext-buf)-1)
-		return -3;
+		return res;
 	memcpy(transSeqNum, ext, sizeof(uint16_t));
 	*transSeqNum = ntohs(*transSeqNum);
 	return 0;
 }
 
+/* The helpers that work on a single extension are now wrappers to the
+ * ones above: if you need to look for more than one extension in the
+ * same packet, parse it once with janus_rtp_header_extensions_parse instead */
+int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gboolean *vad, int *level) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_audio_level(&exts, id, vad, level);
+}
+
+int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int id,
+		gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_video_orientation(&exts, id, c, f, r1, r0);
+}
+
+int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
+		uint16_t *min_delay, uint16_t *max_delay) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_playout_delay(&exts, id, min_delay, max_delay);
+}
+
+int janus_rtp_header_extension_parse_mid(char *buf, int len, int id,
+		char *sdes_item, int sdes_len) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_mid(&exts, id, sdes_item, sdes_len);
+}
+
+int janus_rtp_header_extension_parse_rid(char *buf, int len, int id,
+		char *sdes_item, int sdes_len) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_rid(&exts, id, sdes_item, sdes_len);
+}
+
+int janus_rtp_header_extension_parse_dependency_desc(char *buf, int len, int id,
+		uint8_t *dd_item, int *dd_len) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_dependency_desc(&exts, id, dd_item, dd_len);
+}
+
+int janus_rtp_header_extension_parse_abs_send_time(char *buf, int len, int id, uint32_t *abs_ts) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_abs_send_time(&exts, id, abs_ts);
+}
+
+int janus_rtp_header_extension_set_abs_send_time(char *buf, int len, int id, uint32_t abs_ts) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	uint8_t idlen = 0;
+	int res = 0;
+	char *ext = janus_rtp_header_extensions_find_checked(&exts, id, 3, &idlen, &res);
+	if(ext == NULL)
+		return res;
+	uint32_t abs24 = htonl(abs_ts) >> 8;
+	memcpy(ext, &abs24, 3);
+	return 0;
+}
+
+int janus_rtp_header_extension_parse_abs_capture_time(char *buf, int len, int id, uint64_t *abs_ts) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_abs_capture_time(&exts, id, abs_ts);
+}
+
+int janus_rtp_header_extension_set_abs_capture_time(char *buf, int len, int id, uint64_t abs_ts) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	uint8_t idlen = 0;
+	int res = 0;
+	char *ext = janus_rtp_header_extensions_find_checked(&exts, id, 8, &idlen, &res);
+	if(ext == NULL)
+		return res;
+	uint64_t abs64 = htonll(abs_ts);
+	memcpy(ext, &abs64, 8);
+	return 0;
+}
+
+int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id, uint16_t *transSeqNum) {
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
+	return janus_rtp_header_extensions_get_transport_wide_cc(&exts, id, transSeqNum);
+}
+
 int janus_rtp_header_extension_set_transport_wide_cc(char *buf, int len, int id, uint16_t transSeqNum) {
-	char *ext = NULL;
+	janus_rtp_header_extensions exts;
+	janus_rtp_header_extensions_parse(buf, len, &exts);
 	uint8_t idlen = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext, &idlen) < 0)
-		return -1;
+	int res = 0;
+	char *ext = janus_rtp_header_extensions_find_checked(&exts, id, 2, &idlen, &res);
 	if(ext == NULL)
-		return -2;
-	if(idlen < 2 || idlen > len-(ext-buf)-1)
-		return -3;
+		return res;
 	transSeqNum = htons(transSeqNum);
 	memcpy(ext, &transSeqNum, sizeof(uint16_t));
 	return 0;
@@ -833,6 +922,20 @@ int srtp_crypto_get_random(uint8_t *key, int len) {
 	return 0;
 }
 #endif
+/* SRTP-ready buffers */
+char *janus_srtp_buffer_new(int len, int *size) {
+	int total = len + JANUS_SRTP_HEADROOM + JANUS_SRTP_TAILROOM;
+	if(size)
+		*size = total;
+	return g_malloc(total);
+}
+
+char *janus_srtp_buffer_dup(const char *buf, int len, int *size) {
+	char *data = janus_srtp_buffer_new(len, size);
+	memcpy(data, buf, len);
+	return data;
+}
+
 /* SRTP error codes as a string array */
 static const char *janus_srtp_error[] =
 {
@@ -1064,6 +1167,89 @@ void janus_rtp_simulcasting_context_reset(janus_rtp_simulcasting_context *contex
 	context->substream = -1;
 	context->substream_target_temp = -1;
 	context->templayer = -1;
+	context->substream_bwe = -1;
+	context->templayer_bwe = -1;
+}
+
+/* Bandwidth estimate based layer selection: we leave some headroom, and
+ * require more of it before moving up than before moving down */
+#define JANUS_RTP_BWE_HEADROOM		0.9
+#define JANUS_RTP_BWE_HEADROOM_UP	0.75
+static gboolean janus_rtp_bwe_fits(guint32 bitrate, guint32 estimate, int layer, int current) {
+	double headroom = (current == -1 || layer <= current) ? JANUS_RTP_BWE_HEADROOM : JANUS_RTP_BWE_HEADROOM_UP;
+	return bitrate <= headroom * estimate;
+}
+
+static void janus_rtp_simulcasting_bwe_select(janus_rtp_simulcasting_context *context) {
+	int substream = -1, templayer = -1, i = 0;
+	guint32 estimate = (guint32)g_atomic_int_get(&context->bwe_estimate);
+	if(estimate > 0) {
+		/* Find the highest substream that fits (the lowest is always allowed) */
+		substream = 0;
+		for(i=2; i>0; i--) {
+			if(context->substream_bitrate[i] > 0 && janus_rtp_bwe_fits(context->substream_bitrate[i],
+					estimate, i, context->substream_bwe)) {
+				substream = i;
+				break;
+			}
+		}
+		/* If even the whole substream we're relaying doesn't fit, cap the temporal layer too */
+		int top = -1;
+		for(i=2; i>=0; i--) {
+			if(context->templayer_bitrate[i] > 0) {
+				top = i;
+				break;
+			}
+		}
+		if(top > 0 && !janus_rtp_bwe_fits(context->templayer_bitrate[top], estimate, top, context->templayer_bwe)) {
+			templayer = 0;
+			for(i=top-1; i>0; i--) {
+				if(context->templayer_bitrate[i] > 0 && janus_rtp_bwe_fits(context->templayer_bitrate[i],
+						estimate, i, context->templayer_bwe)) {
+					templayer = i;
+					break;
+				}
+			}
+		}
+	}
+	if(substream != context->substream_bwe) {
+		JANUS_LOG(LOG_VERB, "Simulcasting: estimate %"SCNu32" caps substream at %d (was %d)\n",
+			estimate, substream, context->substream_bwe);
+		/* If we can go up, we'll need a keyframe on the new substream */
+		if(context->substream_bwe != -1 && (substream == -1 || substream > context->substream_bwe) &&
+				context->substream_target > context->substream_bwe)
+			context->need_pli = TRUE;
+		context->substream_bwe = substream;
+	}
+	if(templayer != context->templayer_bwe) {
+		JANUS_LOG(LOG_VERB, "Simulcasting: estimate %"SCNu32" caps temporal layer at %d (was %d)\n",
+			estimate, templayer, context->templayer_bwe);
+		context->templayer_bwe = templayer;
+	}
+}
+
+static void janus_rtp_simulcasting_bwe_update(janus_rtp_simulcasting_context *context, int substream, int len, gint64 now) {
+	context->substream_bytes[substream] += len;
+	if(context->bitrate_window == 0) {
+		context->bitrate_window = now;
+		return;
+	}
+	gint64 elapsed = now - context->bitrate_window;
+	if(elapsed < G_USEC_PER_SEC)
+		return;
+	/* Update the bitrates: for temporal layers, each includes the lower ones */
+	guint32 templayer_bitrate = 0;
+	int i = 0;
+	for(i=0; i<3; i++) {
+		context->substream_bitrate[i] = (guint32)((guint64)context->substream_bytes[i] * 8 * G_USEC_PER_SEC / elapsed);
+		context->substream_bytes[i] = 0;
+		templayer_bitrate += (guint32)((guint64)context->templayer_bytes[i] * 8 * G_USEC_PER_SEC / elapsed);
+		context->templayer_bitrate[i] = context->templayer_bytes[i] ? templayer_bitrate : 0;
+		context->templayer_bytes[i] = 0;
+	}
+	context->bitrate_window = now;
+	/* Check if the estimate we have means we should cap what we relay */
+	janus_rtp_simulcasting_bwe_select(context);
 }
 
 void janus_rtp_simulcasting_prepare(json_t *simulcast, int *rid_ext_id, uint32_t *ssrcs, char **rids) {
@@ -1169,6 +1355,8 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 	char *payload = janus_rtp_payload(buf, len, &plen);
 	if(payload == NULL)
 		return FALSE;
+	/* Keep track of the bitrate of each substream, in case we have a bandwidth estimate to honour */
+	janus_rtp_simulcasting_bwe_update(context, substream, len, now);
 	/* Check what's our target */
 	if(context->substream_target_temp != -1 && (substream > context->substream_target_temp ||
 			context->substream_target <= context->substream_target_temp)) {
@@ -1178,6 +1366,11 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 		context->substream_target_temp = -1;
 	}
 	int target = (context->substream_target_temp == -1) ? context->substream_target : context->substream_target_temp;
+	if(context->substream_bwe != -1 && target > context->substream_bwe)
+		target = context->substream_bwe;
+	int templayer_target = context->templayer_target;
+	if(context->templayer_bwe != -1 && templayer_target > context->templayer_bwe)
+		templayer_target = context->templayer_bwe;
 	/* Check what we need to do with the packet */
 	if(context->substream == -1) {
 		if((vcodec == JANUS_VIDEOCODEC_VP8 && janus_vp8_is_keyframe(payload, plen)) ||
@@ -1257,9 +1450,11 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 		uint8_t keyidx = 0;
 		if(janus_vp8_parse_descriptor(payload, plen, &m, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
 			//~ JANUS_LOG(LOG_WARN, "%"SCNu16", %u, %u, %u, %u\n", picid, tlzi, tid, ybit, keyidx);
-			if(context->templayer != context->templayer_target && tid == context->templayer_target) {
+			if(tid < 3)
+				context->templayer_bytes[tid] += len;
+			if(context->templayer != templayer_target && tid == templayer_target) {
 				/* FIXME We should be smarter in deciding when to switch */
-				context->templayer = context->templayer_target;
+				context->templayer = templayer_target;
 				/* Notify the caller that the temporal layer changed */
 				context->changed_temporal = TRUE;
 			}
@@ -1277,20 +1472,22 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 		gboolean found = FALSE;
 		janus_vp9_svc_info svc_info = { 0 };
 		if(janus_vp9_parse_svc(payload, plen, &found, &svc_info) == 0 && found) {
+			if(svc_info.temporal_layer >= 0 && svc_info.temporal_layer < 3)
+				context->templayer_bytes[svc_info.temporal_layer] += len;
 			int temporal_layer = context->templayer;
-			if(context->templayer_target > context->templayer) {
+			if(templayer_target > context->templayer) {
 				/* We need to upscale */
 				if(svc_info.ubit && svc_info.bbit &&
 						svc_info.temporal_layer > context->templayer &&
-						svc_info.temporal_layer <= context->templayer_target) {
+						svc_info.temporal_layer <= templayer_target) {
 					context->templayer = svc_info.temporal_layer;
 					temporal_layer = context->templayer;
 					context->changed_temporal = TRUE;
 				}
-			} else if(context->templayer_target < context->templayer) {
+			} else if(templayer_target < context->templayer) {
 				/* We need to downscale */
-				if(svc_info.ebit && svc_info.temporal_layer == context->templayer_target) {
-					context->templayer = context->templayer_target;
+				if(svc_info.ebit && svc_info.temporal_layer == templayer_target) {
+					context->templayer = templayer_target;
 					context->changed_temporal = TRUE;
 				}
 			}
@@ -1313,18 +1510,20 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 			if(janus_av1_svc_context_process_dd(av1ctx, dd_content, dd_len, &template, NULL)) {
 				janus_av1_svc_template *t = g_hash_table_lookup(av1ctx->templates, GUINT_TO_POINTER(template));
 				if(t) {
+					if(t->temporal >= 0 && t->temporal < 3)
+						context->templayer_bytes[t->temporal] += len;
 					int temporal_layer = context->templayer;
-					if(context->templayer_target > context->templayer) {
+					if(templayer_target > context->templayer) {
 						/* We need to upscale */
-						if(t->temporal > context->templayer && t->temporal <= context->templayer_target) {
+						if(t->temporal > context->templayer && t->temporal <= templayer_target) {
 							context->templayer = t->temporal;
 							temporal_layer = context->templayer;
 							context->changed_temporal = TRUE;
 						}
-					} else if(context->templayer_target < context->templayer) {
+					} else if(templayer_target < context->templayer) {
 						/* We need to downscale */
-						if(t->temporal == context->templayer_target) {
-							context->templayer = context->templayer_target;
+						if(t->temporal == templayer_target) {
+							context->templayer = templayer_target;
 							context->changed_temporal = TRUE;
 						}
 					}
@@ -1353,6 +1552,87 @@ void janus_rtp_svc_context_reset(janus_rtp_svc_context *context) {
 	memset(context, 0, sizeof(*context));
 	context->spatial = -1;
 	context->temporal = -1;
+	context->spatial_bwe = -1;
+	context->temporal_bwe = -1;
+}
+
+static void janus_rtp_svc_bwe_select(janus_rtp_svc_context *context) {
+	int spatial = -1, temporal = -1, s = 0, t = 0;
+	guint32 estimate = (guint32)g_atomic_int_get(&context->bwe_estimate);
+	if(estimate > 0) {
+		/* Find the highest spatial layer that fits, with all its temporal layers
+		 * (spatial layers depend on the lower ones, so we sum their bitrates) */
+		guint32 bitrate[3] = { 0 }, row = 0;
+		gboolean seen[3] = { FALSE };
+		for(s=0; s<3; s++) {
+			for(t=0; t<3; t++) {
+				row += context->layer_bitrate[s][t];
+				if(context->layer_bitrate[s][t] > 0)
+					seen[s] = TRUE;
+			}
+			bitrate[s] = row;
+		}
+		spatial = 0;
+		for(s=2; s>0; s--) {
+			if(seen[s] && janus_rtp_bwe_fits(bitrate[s], estimate, s, context->spatial_bwe)) {
+				spatial = s;
+				break;
+			}
+		}
+		if(!janus_rtp_bwe_fits(bitrate[spatial], estimate, spatial, context->spatial_bwe)) {
+			/* Even the lowest spatial layer doesn't fit, cap the temporal layer too */
+			guint32 cumulative[3] = { 0 }, sum = 0;
+			for(t=0; t<3; t++) {
+				for(s=0; s<=spatial; s++)
+					sum += context->layer_bitrate[s][t];
+				cumulative[t] = sum;
+			}
+			temporal = 0;
+			for(t=2; t>0; t--) {
+				if(cumulative[t] > cumulative[t-1] && janus_rtp_bwe_fits(cumulative[t],
+						estimate, t, context->temporal_bwe)) {
+					temporal = t;
+					break;
+				}
+			}
+		}
+	}
+	if(spatial != context->spatial_bwe) {
+		JANUS_LOG(LOG_VERB, "SVC: estimate %"SCNu32" caps spatial layer at %d (was %d)\n",
+			estimate, spatial, context->spatial_bwe);
+		/* If we can go up, we'll need a keyframe to switch */
+		if(context->spatial_bwe != -1 && (spatial == -1 || spatial > context->spatial_bwe) &&
+				context->spatial_target > context->spatial_bwe)
+			context->need_pli = TRUE;
+		context->spatial_bwe = spatial;
+	}
+	if(temporal != context->temporal_bwe) {
+		JANUS_LOG(LOG_VERB, "SVC: estimate %"SCNu32" caps temporal layer at %d (was %d)\n",
+			estimate, temporal, context->temporal_bwe);
+		context->temporal_bwe = temporal;
+	}
+}
+
+static void janus_rtp_svc_bwe_update(janus_rtp_svc_context *context, int spatial, int temporal, int len, gint64 now) {
+	if(spatial >= 0 && spatial < 3 && temporal >= 0 && temporal < 3)
+		context->layer_bytes[spatial][temporal] += len;
+	if(context->bitrate_window == 0) {
+		context->bitrate_window = now;
+		return;
+	}
+	gint64 elapsed = now - context->bitrate_window;
+	if(elapsed < G_USEC_PER_SEC)
+		return;
+	int s = 0, t = 0;
+	for(s=0; s<3; s++) {
+		for(t=0; t<3; t++) {
+			context->layer_bitrate[s][t] = (guint32)((guint64)context->layer_bytes[s][t] * 8 * G_USEC_PER_SEC / elapsed);
+			context->layer_bytes[s][t] = 0;
+		}
+	}
+	context->bitrate_window = now;
+	/* Check if the estimate we have means we should cap what we relay */
+	janus_rtp_svc_bwe_select(context);
 }
 
 gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
@@ -1388,18 +1668,25 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 			/* We couldn't find the template, relay as it is */
 			return TRUE;
 		}
+		/* Keep track of the bitrate of each layer, in case we have a bandwidth estimate to honour */
+		janus_rtp_svc_bwe_update(context, t->spatial, t->temporal, len, now);
+		int spatial_target = context->spatial_target, temporal_target = context->temporal_target;
+		if(context->spatial_bwe != -1 && spatial_target > context->spatial_bwe)
+			spatial_target = context->spatial_bwe;
+		if(context->temporal_bwe != -1 && temporal_target > context->temporal_bwe)
+			temporal_target = context->temporal_bwe;
 		/* Now let's check if we should let the packet through or not */
 		gboolean keyframe = janus_av1_is_keyframe((const char *)payload, plen);
 		gboolean override_mark_bit = FALSE, has_marker_bit = header->markerbit;
 		int spatial_layer = context->spatial;
 		if(t->spatial >= 0 && t->spatial <= 2)
 			context->last_spatial_layer[t->spatial] = now;
-		if(context->spatial_target > context->spatial) {
+		if(spatial_target > context->spatial) {
 			JANUS_LOG(LOG_HUGE, "We need to upscale spatially: (%d < %d)\n",
-				context->spatial, context->spatial_target);
+				context->spatial, spatial_target);
 			/* We need to upscale: wait for a keyframe */
 			if(keyframe) {
-				int new_spatial_layer = context->spatial_target;
+				int new_spatial_layer = spatial_target;
 				while(new_spatial_layer > context->spatial && new_spatial_layer > 0) {
 					if(now - context->last_spatial_layer[new_spatial_layer] >= (context->drop_trigger ? context->drop_trigger : 250000)) {
 						/* We haven't received packets from this layer for a while, try a lower layer */
@@ -1412,21 +1699,21 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 				}
 				if(new_spatial_layer > context->spatial) {
 					JANUS_LOG(LOG_HUGE, "  -- Upscaling spatial layer: %d --> %d (need %d)\n",
-						context->spatial, new_spatial_layer, context->spatial_target);
+						context->spatial, new_spatial_layer, spatial_target);
 					context->spatial = new_spatial_layer;
 					spatial_layer = context->spatial;
 					context->changed_spatial = TRUE;
 				}
 			}
-		} else if(context->spatial_target < context->spatial) {
+		} else if(spatial_target < context->spatial) {
 			/* We need to scale: wait for a keyframe */
 			JANUS_LOG(LOG_HUGE, "We need to downscale spatially: (%d > %d)\n",
-				context->spatial, context->spatial_target);
+				context->spatial, spatial_target);
 			/* Check the E bit to see if this is an end-of-frame */
 			if(ebit) {
 				JANUS_LOG(LOG_HUGE, "  -- Downscaling spatial layer: %d --> %d\n",
-					context->spatial, context->spatial_target);
-				context->spatial = context->spatial_target;
+					context->spatial, spatial_target);
+				context->spatial = spatial_target;
 				context->changed_spatial = TRUE;
 			}
 		}
@@ -1441,17 +1728,17 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 			override_mark_bit = TRUE;
 		}
 		int temporal = context->temporal;
-		if(context->temporal_target > context->temporal) {
+		if(temporal_target > context->temporal) {
 			/* We need to upscale */
-			if(t->temporal > context->temporal && t->temporal <= context->temporal_target) {
+			if(t->temporal > context->temporal && t->temporal <= temporal_target) {
 				context->temporal = t->temporal;
 				temporal = context->temporal;
 				context->changed_temporal = TRUE;
 			}
-		} else if(context->temporal_target < context->temporal) {
+		} else if(temporal_target < context->temporal) {
 			/* We need to downscale */
-			if(t->temporal == context->temporal_target) {
-				context->temporal = context->temporal_target;
+			if(t->temporal == temporal_target) {
+				context->temporal = temporal_target;
 				context->changed_temporal = TRUE;
 			}
 		}
@@ -1487,6 +1774,13 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 	} else {
 		svc_info = *info;
 	}
+	/* Keep track of the bitrate of each layer, in case we have a bandwidth estimate to honour */
+	janus_rtp_svc_bwe_update(context, svc_info.spatial_layer, svc_info.temporal_layer, len, now);
+	int spatial_target = context->spatial_target, temporal_target = context->temporal_target;
+	if(context->spatial_bwe != -1 && spatial_target > context->spatial_bwe)
+		spatial_target = context->spatial_bwe;
+	if(context->temporal_bwe != -1 && temporal_target > context->temporal_bwe)
+		temporal_target = context->temporal_bwe;
 	/* Note: Following code inspired by the excellent job done by Sergio Garcia Murillo here:
 	 * https://github.com/medooze/media-server/blob/master/src/vp9/VP9LayerSelector.cpp */
 	gboolean keyframe = janus_vp9_is_keyframe((const char *)payload, plen);
@@ -1494,12 +1788,12 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 	int spatial_layer = context->spatial;
 	if(svc_info.spatial_layer >= 0 && svc_info.spatial_layer <= 2)
 		context->last_spatial_layer[svc_info.spatial_layer] = now;
-	if(context->spatial_target > context->spatial) {
+	if(spatial_target > context->spatial) {
 		JANUS_LOG(LOG_HUGE, "We need to upscale spatially: (%d < %d)\n",
-			context->spatial, context->spatial_target);
+			context->spatial, spatial_target);
 		/* We need to upscale: wait for a keyframe */
 		if(keyframe) {
-			int new_spatial_layer = context->spatial_target;
+			int new_spatial_layer = spatial_target;
 			while(new_spatial_layer > context->spatial && new_spatial_layer > 0) {
 				if(now - context->last_spatial_layer[new_spatial_layer] >= (context->drop_trigger ? context->drop_trigger : 250000)) {
 					/* We haven't received packets from this layer for a while, try a lower layer */
@@ -1512,16 +1806,16 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 			}
 			if(new_spatial_layer > context->spatial) {
 				JANUS_LOG(LOG_HUGE, "  -- Upscaling spatial layer: %d --> %d (need %d)\n",
-					context->spatial, new_spatial_layer, context->spatial_target);
+					context->spatial, new_spatial_layer, spatial_target);
 				context->spatial = new_spatial_layer;
 				spatial_layer = context->spatial;
 				context->changed_spatial = TRUE;
 			}
 		}
-	} else if(context->spatial_target < context->spatial) {
+	} else if(spatial_target < context->spatial) {
 		/* We need to downscale */
 		JANUS_LOG(LOG_HUGE, "We need to downscale spatially: (%d > %d)\n",
-			context->spatial, context->spatial_target);
+			context->spatial, spatial_target);
 		gboolean downscaled = FALSE;
 		if(!svc_info.fbit && keyframe) {
 			/* Non-flexible mode: wait for a keyframe */
@@ -1532,8 +1826,8 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 		}
 		if(downscaled) {
 			JANUS_LOG(LOG_HUGE, "  -- Downscaling spatial layer: %d --> %d\n",
-				context->spatial, context->spatial_target);
-			context->spatial = context->spatial_target;
+				context->spatial, spatial_target);
+			context->spatial = spatial_target;
 			context->changed_spatial = TRUE;
 		}
 	}
@@ -1548,27 +1842,27 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 		override_mark_bit = TRUE;
 	}
 	int temporal_layer = context->temporal;
-	if(context->temporal_target > context->temporal) {
+	if(temporal_target > context->temporal) {
 		/* We need to upscale */
 		JANUS_LOG(LOG_HUGE, "We need to upscale temporally: (%d < %d)\n",
-			context->temporal, context->temporal_target);
+			context->temporal, temporal_target);
 		if(svc_info.ubit && svc_info.bbit &&
 				svc_info.temporal_layer > context->temporal &&
-				svc_info.temporal_layer <= context->temporal_target) {
+				svc_info.temporal_layer <= temporal_target) {
 			JANUS_LOG(LOG_HUGE, "  -- Upscaling temporal layer: %d --> %d (want %d)\n",
-				context->temporal, svc_info.temporal_layer, context->temporal_target);
+				context->temporal, svc_info.temporal_layer, temporal_target);
 			context->temporal = svc_info.temporal_layer;
 			temporal_layer = context->temporal;
 			context->changed_temporal = TRUE;
 		}
-	} else if(context->temporal_target < context->temporal) {
+	} else if(temporal_target < context->temporal) {
 		/* We need to downscale */
 		JANUS_LOG(LOG_HUGE, "We need to downscale temporally: (%d > %d)\n",
-			context->temporal, context->temporal_target);
-		if(svc_info.ebit && svc_info.temporal_layer == context->temporal_target) {
+			context->temporal, temporal_target);
+		if(svc_info.ebit && svc_info.temporal_layer == temporal_target) {
 			JANUS_LOG(LOG_HUGE, "  -- Downscaling temporal layer: %d --> %d\n",
-				context->temporal, context->temporal_target);
-			context->temporal = context->temporal_target;
+				context->temporal, temporal_target);
+			context->temporal = temporal_target;
 			context->changed_temporal = TRUE;
 		}
 	}
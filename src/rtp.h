@@ -171,6 +171,75 @@ int janus_rtp_header_extension_get_id(const char *sdp, const char *extension);
  * @returns The extension namespace, if found, NULL otherwise */
 const char *janus_rtp_header_extension_get_from_id(const char *sdp, int id);
 
+/*! \brief Extensions with IDs lower than this are looked up in constant time
+ * (this covers all one-byte header extensions, and most two-byte ones) */
+#define JANUS_RTP_EXTENSIONS_DIRECT_IDS	16
+/*! \brief Maximum number of two-byte header extensions with higher IDs we keep track of */
+#define JANUS_RTP_EXTENSIONS_MAX_OTHERS	8
+/*! \brief Table of the RTP extensions found in a packet: it's filled by
+ * janus_rtp_header_extensions_parse with a single walk of the extensions
+ * block, after which each extension can be looked up without parsing the
+ * packet again. Offsets are relative to the start of the packet, which
+ * means the table is still valid if the payload is modified in place
+ * (e.g., after SRTP decryption), as long as the header is left untouched */
+typedef struct janus_rtp_header_extensions {
+	/*! \brief The packet the table refers to */
+	char *buf;
+	/*! \brief The length of the packet */
+	int len;
+	/*! \brief Number of extensions found in the packet (if 0, the rest of the table is not initialized) */
+	uint8_t count;
+	/*! \brief Offset of the data of the extensions with lower IDs, indexed by ID (0 if missing) */
+	uint16_t offset[JANUS_RTP_EXTENSIONS_DIRECT_IDS];
+	/*! \brief Length of the data of the extensions with lower IDs, indexed by ID */
+	uint8_t length[JANUS_RTP_EXTENSIONS_DIRECT_IDS];
+	/*! \brief Number of two-byte header extensions with higher IDs */
+	uint8_t others_count;
+	/*! \brief Two-byte header extensions with higher IDs */
+	struct {
+		uint8_t id;
+		uint8_t length;
+		uint16_t offset;
+	} others[JANUS_RTP_EXTENSIONS_MAX_OTHERS];
+} janus_rtp_header_extensions;
+
+/*! \brief Helper to find all the RTP extensions in a packet in a single pass
+ * @note Packets with no extensions are detected right away, without initializing the table
+ * @param[in] buf The packet data
+ * @param[in] len The packet data length in bytes
+ * @param[out] exts The table to fill
+ * @returns The number of extensions found, a negative integer in case of errors */
+int janus_rtp_header_extensions_parse(char *buf, int len, janus_rtp_header_extensions *exts);
+/*! \brief Helper to look up the data of an extension in a table
+ * @param[in] exts The table, as filled by janus_rtp_header_extensions_parse
+ * @param[in] id The extension ID to look for
+ * @param[out] idlen The length of the extension data, if found
+ * @returns A pointer to the extension data in the packet, if found, or NULL otherwise */
+char *janus_rtp_header_extensions_find(const janus_rtp_header_extensions *exts, int id, uint8_t *idlen);
+/*! \brief Same as janus_rtp_header_extension_parse_audio_level, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_audio_level(const janus_rtp_header_extensions *exts, int id, gboolean *vad, int *level);
+/*! \brief Same as janus_rtp_header_extension_parse_video_orientation, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_video_orientation(const janus_rtp_header_extensions *exts, int id,
+	gboolean *c, gboolean *f, gboolean *r1, gboolean *r0);
+/*! \brief Same as janus_rtp_header_extension_parse_playout_delay, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_playout_delay(const janus_rtp_header_extensions *exts, int id,
+	uint16_t *min_delay, uint16_t *max_delay);
+/*! \brief Same as janus_rtp_header_extension_parse_mid, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_mid(const janus_rtp_header_extensions *exts, int id,
+	char *sdes_item, int sdes_len);
+/*! \brief Same as janus_rtp_header_extension_parse_rid, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_rid(const janus_rtp_header_extensions *exts, int id,
+	char *sdes_item, int sdes_len);
+/*! \brief Same as janus_rtp_header_extension_parse_dependency_desc, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_dependency_desc(const janus_rtp_header_extensions *exts, int id,
+	uint8_t *dd_item, int *dd_len);
+/*! \brief Same as janus_rtp_header_extension_parse_abs_send_time, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_abs_send_time(const janus_rtp_header_extensions *exts, int id, uint32_t *abs_ts);
+/*! \brief Same as janus_rtp_header_extension_parse_abs_capture_time, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_abs_capture_time(const janus_rtp_header_extensions *exts, int id, uint64_t *abs_ts);
+/*! \brief Same as janus_rtp_header_extension_parse_transport_wide_cc, but using a table of parsed extensions */
+int janus_rtp_header_extensions_get_transport_wide_cc(const janus_rtp_header_extensions *exts, int id, uint16_t *transSeqNum);
+
 /*! \brief Helper to parse a ssrc-audio-level RTP extension (https://tools.ietf.org/html/rfc6464)
  * @note Browsers apparently always set the VAD to 1, so it's unreliable and should be ignored:
  * only use this method if you're interested in the audio-level value itself.
@@ -405,6 +474,23 @@ typedef struct janus_rtp_simulcasting_context {
 	gboolean changed_temporal;
 	/*! \brief Whether we need to send the user a keyframe request (PLI) */
 	gboolean need_pli;
+	/*! \brief Bandwidth estimate for the recipient, in bps (0 if not available): when set, the
+	 * substream and temporal layer to relay are capped according to their measured bitrates
+	 * \note As the estimate is updated by a different thread than the one relaying
+	 * the media, it must be accessed via g_atomic_int_set and g_atomic_int_get */
+	volatile gint bwe_estimate;
+	/*! \brief Bytes received for each substream in the current measurement window */
+	guint32 substream_bytes[3];
+	/*! \brief Bitrates of each substream (bps), as measured in the last window */
+	guint32 substream_bitrate[3];
+	/*! \brief Bytes received for each temporal layer of the substream we relay in the current window */
+	guint32 templayer_bytes[3];
+	/*! \brief Bitrates of each temporal layer (bps, including the lower layers), as measured in the last window */
+	guint32 templayer_bitrate[3];
+	/*! \brief When the current measurement window started */
+	gint64 bitrate_window;
+	/*! \brief Highest substream and temporal layer the bandwidth estimate allows, -1 if not capped */
+	int substream_bwe, templayer_bwe;
 } janus_rtp_simulcasting_context;
 
 /*! \brief Set (or reset) the context fields to their default values
@@ -430,6 +516,9 @@ void janus_rtp_simulcasting_cleanup(int *rid_ext_id, uint32_t *ssrcs, char **rid
 /*! \brief Process an RTP packet, and decide whether this should be relayed or not, updating the context accordingly
  * \note Calling this method resets the \c changed_substream , \c changed_temporal and \c need_pli
  * properties, and updates them according to the decisions made after processing the packet
+ * \note If \c bwe_estimate is set, the substream and temporal layer targets are
+ * capped to the highest ones whose bitrate fits the estimate (and \c need_pli is
+ * set when the cap is raised, since a keyframe is needed to switch up)
  * @param[in] context The simulcasting context to use
  * @param[in] buf The RTP packet to process
  * @param[in] len The length of the RTP packet (header, extension and payload)
@@ -471,6 +560,19 @@ typedef struct janus_rtp_svc_context {
 	gboolean changed_temporal;
 	/*! \brief Whether we need to send the user a keyframe request (PLI) */
 	gboolean need_pli;
+	/*! \brief Bandwidth estimate for the recipient, in bps (0 if not available): when set, the
+	 * spatial and temporal layers to relay are capped according to their measured bitrates
+	 * \note As the estimate is updated by a different thread than the one relaying
+	 * the media, it must be accessed via g_atomic_int_set and g_atomic_int_get */
+	volatile gint bwe_estimate;
+	/*! \brief Bytes received for each spatial/temporal layer in the current measurement window */
+	guint32 layer_bytes[3][3];
+	/*! \brief Bitrates of each spatial/temporal layer (bps, that layer only), as measured in the last window */
+	guint32 layer_bitrate[3][3];
+	/*! \brief When the current measurement window started */
+	gint64 bitrate_window;
+	/*! \brief Highest spatial and temporal layer the bandwidth estimate allows, -1 if not capped */
+	int spatial_bwe, temporal_bwe;
 } janus_rtp_svc_context;
 
 /*! \brief Set (or reset) the context fields to their default values
@@ -480,6 +582,8 @@ void janus_rtp_svc_context_reset(janus_rtp_svc_context *context);
 /*! \brief Process an RTP packet, and decide whether this should be relayed or not, updating the context accordingly
  * \note Calling this method resets the \c changed_spatial , \c changed_temporal and \c need_pli
  * properties, and updates them according to the decisions made after processing the packet
+ * \note If \c bwe_estimate is set, the spatial and temporal layer targets are
+ * capped to the highest ones whose bitrate fits the estimate
  * @param[in] context The VP9 SVC context to use
  * @param[in] buf The RTP packet to process
  * @param[in] len The length of the RTP packet (header, extension and payload)
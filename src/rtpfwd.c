@@ -13,6 +13,13 @@
  * \ref protocols
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/socket.h>
+#endif
+
 #include "rtpfwd.h"
 #include "rtcp.h"
 #include "utils.h"
@@ -21,6 +28,46 @@
 static janus_mutex rtpfwds_mutex;
 static GHashTable *rtpfwds = NULL;
 static gboolean ipv6_disabled = FALSE;
+
+/* Egress: when enabled, packets are not sent by the thread that feeds
+ * the forwarder (e.g., the publisher's media thread), but queued in a
+ * per-forwarder lock-free ring, which is drained by one of a pool of
+ * egress threads that takes care of the SRTP encryption and of sending
+ * the packets in batches. Packets are still sent from the socket the
+ * owner of the forwarder provided, and forwarders sharing the same socket
+ * are served together, so that their packets can be batched too */
+#define JANUS_RTP_FORWARDER_QUEUE_SIZE	128
+#define JANUS_RTP_FORWARDER_PACKET_SIZE	1500
+#define JANUS_RTP_FORWARDER_BATCH_SIZE	64
+typedef struct janus_rtp_forwarder_packet {
+	int len;
+	/* SRTP-ready, so that the egress thread can protect it in place */
+	char data[JANUS_RTP_FORWARDER_PACKET_SIZE+JANUS_SRTP_TAILROOM];
+} janus_rtp_forwarder_packet;
+/* Single producer (whoever feeds the forwarder), single consumer (the egress thread) */
+struct janus_rtp_forwarder_queue {
+	janus_rtp_forwarder_packet packets[JANUS_RTP_FORWARDER_QUEUE_SIZE];
+	volatile gint head;
+	volatile gint tail;
+	/* Next packet the egress thread will pick (only touched by the egress thread) */
+	guint consumed;
+	/* Guard against unexpected concurrent producers */
+	volatile gint producing;
+};
+/* Egress threads */
+struct janus_rtp_forwarder_egress {
+	int id;
+	GThread *thread;
+	janus_mutex mutex;
+	janus_condition cond;
+	/* Forwarders served by this thread, sorted by socket */
+	GPtrArray *forwarders;
+	volatile gint sleeping;
+};
+static janus_rtp_forwarder_egress *egress = NULL;
+static int egress_threads = 0;
+static volatile gint egress_stopping = 0;
+static void *janus_rtp_forwarder_egress_thread(void *data);
 /* RTCP stuff */
 static GMainContext *rtcpfwd_ctx = NULL;
 static GMainLoop *rtcpfwd_loop = NULL;
@@ -41,7 +88,7 @@ static void janus_rtp_forwarder_free(const janus_refcount *f_ref);
 
 /* \brief RTP forwarders code initialization
  * @returns 0 in case of success, a negative integer on errors */
-int janus_rtp_forwarders_init(void) {
+int janus_rtp_forwarders_init(int threads) {
 	/* Initialize the forwarders table and muted */
 	rtpfwds = g_hash_table_new_full(g_str_hash, g_str_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_rtp_forwarder_unref);
@@ -72,10 +119,37 @@ int janus_rtp_forwarders_init(void) {
 		g_error_free(error);
 		return -1;
 	}
+	/* Spawn the egress threads, if needed */
+	if(threads > 0) {
+		egress_threads = threads;
+		egress = g_malloc0(egress_threads * sizeof(janus_rtp_forwarder_egress));
+		int i = 0;
+		for(i=0; i<egress_threads; i++) {
+			egress[i].id = i;
+			janus_mutex_init(&egress[i].mutex);
+			janus_condition_init(&egress[i].cond);
+			egress[i].forwarders = g_ptr_array_new();
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "rtpfwd egress %d", i);
+			egress[i].thread = g_thread_try_new(tname, janus_rtp_forwarder_egress_thread, &egress[i], &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the egress thread #%d for RTP forwarders...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				return -1;
+			}
+		}
+		JANUS_LOG(LOG_INFO, "RTP forwarders will be served by %d egress thread(s)\n", egress_threads);
+	}
 	/* Donw */
 	return 0;
 }
 
+/* Number of egress threads */
+int janus_rtp_forwarders_get_egress_threads(void) {
+	return egress_threads;
+}
+
 /* \brief RTP forwarders code de-initialization */
 void janus_rtp_forwarders_deinit(void) {
 	/* Stop the RTCP receiver thread */
@@ -87,11 +161,216 @@ void janus_rtp_forwarders_deinit(void) {
 		g_thread_join(rtcpfwd_thread);
 		rtcpfwd_thread = NULL;
 	}
+	/* Stop the egress threads */
+	g_atomic_int_set(&egress_stopping, 1);
+	int i = 0;
+	for(i=0; i<egress_threads; i++) {
+		janus_mutex_lock(&egress[i].mutex);
+		janus_condition_signal(&egress[i].cond);
+		janus_mutex_unlock(&egress[i].mutex);
+		if(egress[i].thread != NULL)
+			g_thread_join(egress[i].thread);
+	}
 	/* Get rid of the table */
 	janus_mutex_lock(&rtpfwds_mutex);
 	g_hash_table_destroy(rtpfwds);
 	rtpfwds = NULL;
 	janus_mutex_unlock(&rtpfwds_mutex);
+	/* Now that no forwarder is left, get rid of the egress resources too */
+	for(i=0; i<egress_threads; i++) {
+		guint j = 0;
+		for(j=0; j<egress[i].forwarders->len; j++)
+			janus_rtp_forwarder_unref(g_ptr_array_index(egress[i].forwarders, j));
+		g_ptr_array_free(egress[i].forwarders, TRUE);
+		janus_condition_destroy(&egress[i].cond);
+		janus_mutex_destroy(&egress[i].mutex);
+	}
+	g_free(egress);
+	egress = NULL;
+	egress_threads = 0;
+}
+
+/* Helper to send a batch of packets: on Linux we use sendmmsg, to send
+ * them all with a single syscall, and a loop of sendto otherwise */
+typedef struct janus_rtp_forwarder_batch {
+	int fd;
+	int count;
+	janus_rtp_forwarder *owners[JANUS_RTP_FORWARDER_BATCH_SIZE];
+	/* Where to move the tail of the owner's queue once this packet is sent */
+	guint tails[JANUS_RTP_FORWARDER_BATCH_SIZE];
+#ifdef __linux__
+	struct mmsghdr msgs[JANUS_RTP_FORWARDER_BATCH_SIZE];
+#endif
+	struct iovec iovs[JANUS_RTP_FORWARDER_BATCH_SIZE];
+} janus_rtp_forwarder_batch;
+static void janus_rtp_forwarder_batch_flush(janus_rtp_forwarder_batch *batch) {
+	if(batch->count == 0)
+		return;
+	int i = 0;
+#ifdef __linux__
+	int sent = 0;
+	while(i < batch->count) {
+		sent = sendmmsg(batch->fd, &batch->msgs[i], batch->count - i, 0);
+		if(sent < 0) {
+			/* The first packet in what's left failed, skip it and go on */
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet... %s (len=%zu)...\n",
+				(batch->owners[i]->is_video ? "video" : "audio"), g_strerror(errno), batch->iovs[i].iov_len);
+			batch->owners[i]->send_errors++;
+			i++;
+			continue;
+		}
+		for(; sent > 0; sent--, i++)
+			batch->owners[i]->packets_sent++;
+	}
+#else
+	for(i=0; i<batch->count; i++) {
+		janus_rtp_forwarder *rf = batch->owners[i];
+		struct sockaddr *address = (rf->serv_addr.sin_family == AF_INET ?
+			(struct sockaddr *)&rf->serv_addr : (struct sockaddr *)&rf->serv_addr6);
+		size_t addrlen = (rf->serv_addr.sin_family == AF_INET ? sizeof(rf->serv_addr) : sizeof(rf->serv_addr6));
+		if(sendto(batch->fd, batch->iovs[i].iov_base, batch->iovs[i].iov_len, 0, address, addrlen) < 0) {
+			JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet... %s (len=%zu)...\n",
+				(rf->is_video ? "video" : "audio"), g_strerror(errno), batch->iovs[i].iov_len);
+			rf->send_errors++;
+		} else {
+			rf->packets_sent++;
+		}
+	}
+#endif
+	/* The packets were sent, so the slots can be reused now */
+	for(i=0; i<batch->count; i++)
+		g_atomic_int_set(&batch->owners[i]->queue->tail, (gint)batch->tails[i]);
+	batch->count = 0;
+}
+
+/* Drain the queues of all the forwarders served by an egress thread:
+ * must be called with the mutex of the egress thread locked */
+static gboolean janus_rtp_forwarder_egress_pending(janus_rtp_forwarder_egress *e) {
+	guint i = 0;
+	for(i=0; i<e->forwarders->len; i++) {
+		janus_rtp_forwarder *rf = g_ptr_array_index(e->forwarders, i);
+		if(g_atomic_int_get(&rf->destroyed) || (guint)g_atomic_int_get(&rf->queue->head) != rf->queue->consumed)
+			return TRUE;
+	}
+	return FALSE;
+}
+static void janus_rtp_forwarder_egress_drain(janus_rtp_forwarder_egress *e, janus_rtp_forwarder_batch *batch) {
+	guint i = 0;
+	for(i=0; i<e->forwarders->len; i++) {
+		janus_rtp_forwarder *rf = g_ptr_array_index(e->forwarders, i);
+		janus_rtp_forwarder_queue *q = rf->queue;
+		if(g_atomic_int_get(&rf->destroyed)) {
+			/* Forwarder gone: packets may still be in the batch, so send them first */
+			janus_rtp_forwarder_batch_flush(batch);
+			g_ptr_array_remove_index(e->forwarders, i);
+			i--;
+			janus_rtp_forwarder_unref(rf);
+			continue;
+		}
+		guint head = (guint)g_atomic_int_get(&q->head);
+		while(q->consumed != head) {
+			janus_rtp_forwarder_packet *pkt = &q->packets[q->consumed % JANUS_RTP_FORWARDER_QUEUE_SIZE];
+			q->consumed++;
+			int len = pkt->len;
+			if(rf->is_srtp) {
+				/* Encrypt the packet in place */
+				int res = srtp_protect(rf->srtp_ctx, pkt->data, &len);
+				if(res != srtp_err_status_ok) {
+					janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+					JANUS_LOG(LOG_ERR, "Error encrypting %s packet... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+						(rf->is_video ? "Video" : "Audio"), janus_srtp_error_str(res), pkt->len, len,
+						ntohl(header->timestamp), ntohs(header->seq_number));
+					rf->send_errors++;
+					continue;
+				}
+			}
+			if(batch->count == JANUS_RTP_FORWARDER_BATCH_SIZE || (batch->count > 0 && batch->fd != rf->udp_fd))
+				janus_rtp_forwarder_batch_flush(batch);
+			int n = batch->count;
+			batch->fd = rf->udp_fd;
+			batch->owners[n] = rf;
+			batch->tails[n] = q->consumed;
+			batch->iovs[n].iov_base = pkt->data;
+			batch->iovs[n].iov_len = len;
+#ifdef __linux__
+			memset(&batch->msgs[n], 0, sizeof(batch->msgs[n]));
+			batch->msgs[n].msg_hdr.msg_iov = &batch->iovs[n];
+			batch->msgs[n].msg_hdr.msg_iovlen = 1;
+			if(rf->serv_addr.sin_family == AF_INET) {
+				batch->msgs[n].msg_hdr.msg_name = &rf->serv_addr;
+				batch->msgs[n].msg_hdr.msg_namelen = sizeof(rf->serv_addr);
+			} else {
+				batch->msgs[n].msg_hdr.msg_name = &rf->serv_addr6;
+				batch->msgs[n].msg_hdr.msg_namelen = sizeof(rf->serv_addr6);
+			}
+#endif
+			batch->count++;
+		}
+	}
+	janus_rtp_forwarder_batch_flush(batch);
+	/* Everything we picked has been sent (or dropped), release all the slots */
+	for(i=0; i<e->forwarders->len; i++) {
+		janus_rtp_forwarder *rf = g_ptr_array_index(e->forwarders, i);
+		g_atomic_int_set(&rf->queue->tail, (gint)rf->queue->consumed);
+	}
+}
+
+/* Egress thread */
+static void *janus_rtp_forwarder_egress_thread(void *data) {
+	janus_rtp_forwarder_egress *e = (janus_rtp_forwarder_egress *)data;
+	JANUS_LOG(LOG_VERB, "Joining egress thread #%d for RTP forwarders...\n", e->id);
+	janus_rtp_forwarder_batch *batch = g_malloc0(sizeof(janus_rtp_forwarder_batch));
+	while(!g_atomic_int_get(&egress_stopping)) {
+		janus_mutex_lock(&e->mutex);
+		/* Producers only wake us up if we say we're waiting */
+		g_atomic_int_set(&e->sleeping, 1);
+		if(!janus_rtp_forwarder_egress_pending(e)) {
+			gint64 deadline = janus_get_monotonic_time() + G_USEC_PER_SEC;
+			janus_condition_wait_until(&e->cond, &e->mutex, deadline);
+		}
+		g_atomic_int_set(&e->sleeping, 0);
+		janus_rtp_forwarder_egress_drain(e, batch);
+		janus_mutex_unlock(&e->mutex);
+	}
+	g_free(batch);
+	JANUS_LOG(LOG_VERB, "Leaving egress thread #%d for RTP forwarders...\n", e->id);
+	return NULL;
+}
+static void janus_rtp_forwarder_egress_wakeup(janus_rtp_forwarder_egress *e) {
+	if(g_atomic_int_get(&e->sleeping) && g_atomic_int_compare_and_exchange(&e->sleeping, 1, 0)) {
+		janus_mutex_lock(&e->mutex);
+		janus_condition_signal(&e->cond);
+		janus_mutex_unlock(&e->mutex);
+	}
+}
+static gint janus_rtp_forwarder_compare_socket(gconstpointer a, gconstpointer b) {
+	const janus_rtp_forwarder *fa = *(janus_rtp_forwarder * const *)a;
+	const janus_rtp_forwarder *fb = *(janus_rtp_forwarder * const *)b;
+	return fa->udp_fd - fb->udp_fd;
+}
+/* Assign a new forwarder to the least busy egress thread */
+static void janus_rtp_forwarder_egress_add(janus_rtp_forwarder *rf) {
+	janus_rtp_forwarder_egress *e = NULL;
+	int i = 0;
+	guint min = G_MAXUINT;
+	for(i=0; i<egress_threads; i++) {
+		janus_mutex_lock(&egress[i].mutex);
+		guint count = egress[i].forwarders->len;
+		janus_mutex_unlock(&egress[i].mutex);
+		if(count < min) {
+			min = count;
+			e = &egress[i];
+		}
+	}
+	rf->egress = e;
+	janus_refcount_increase(&rf->ref);
+	janus_mutex_lock(&e->mutex);
+	g_ptr_array_add(e->forwarders, rf);
+	/* Keep forwarders sharing the same socket close, so that they're batched together */
+	g_ptr_array_sort(e->forwarders, janus_rtp_forwarder_compare_socket);
+	janus_mutex_unlock(&e->mutex);
 }
 
 /* RTCP support in RTP forwarders */
@@ -236,6 +515,11 @@ janus_rtp_forwarder *janus_rtp_forwarder_create(const char *ctx,
 	janus_refcount_init(&rf->ref, janus_rtp_forwarder_free);
 	rf->context = g_strdup(ctx);
 	rf->stream_id = stream_id;
+	if(egress_threads > 0 && !is_data && udp_fd > -1) {
+		/* Packets will be sent by one of the egress threads */
+		rf->queue = g_malloc0(sizeof(janus_rtp_forwarder_queue));
+		janus_rtp_forwarder_egress_add(rf);
+	}
 	janus_refcount_increase(&rf->ref);
 	g_hash_table_insert(rtpfwds, g_strdup(id), rf);
 	janus_mutex_unlock(&rtpfwds_mutex);
@@ -367,8 +651,28 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 		rtp->type = rf->payload_type;
 	if(rf->ssrc > 0)
 		rtp->ssrc = htonl(rf->ssrc);
-	/* Check if this is an RTP or SRTP forwarder */
-	if(!rf->is_srtp) {
+	/* Check if the packet must be queued for an egress thread, or sent right away */
+	if(rf->queue != NULL) {
+		janus_rtp_forwarder_queue *q = rf->queue;
+		if(len > JANUS_RTP_FORWARDER_PACKET_SIZE || !g_atomic_int_compare_and_exchange(&q->producing, 0, 1)) {
+			/* Too large, or somebody else is feeding this forwarder at the same time */
+			rf->packets_dropped++;
+		} else {
+			guint head = (guint)q->head;
+			if(head - (guint)g_atomic_int_get(&q->tail) >= JANUS_RTP_FORWARDER_QUEUE_SIZE) {
+				/* The egress thread can't keep up, drop the packet */
+				rf->packets_dropped++;
+				g_atomic_int_set(&q->producing, 0);
+			} else {
+				janus_rtp_forwarder_packet *pkt = &q->packets[head % JANUS_RTP_FORWARDER_QUEUE_SIZE];
+				memcpy(pkt->data, buffer, len);
+				pkt->len = len;
+				g_atomic_int_set(&q->head, (gint)(head + 1));
+				g_atomic_int_set(&q->producing, 0);
+				janus_rtp_forwarder_egress_wakeup(rf->egress);
+			}
+		}
+	} else if(!rf->is_srtp) {
 		/* Plain RTP */
 		struct sockaddr *address = (rf->serv_addr.sin_family == AF_INET ?
 			(struct sockaddr *)&rf->serv_addr : (struct sockaddr *)&rf->serv_addr6);
@@ -376,10 +680,19 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 		if(sendto(rf->udp_fd, buffer, len, 0, address, addrlen) < 0) {
 			JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet... %s (len=%d)...\n",
 				(rf->is_video ? "video" : "audio"), g_strerror(errno), len);
+			rf->send_errors++;
+		} else {
+			rf->packets_sent++;
 		}
+	} else if(len > JANUS_RTP_FORWARDER_PACKET_SIZE) {
+		/* Too large for an SRTP-ready slot */
+		rf->packets_dropped++;
 	} else {
-		/* SRTP: encrypt the packet before sending it */
-		char sbuf[1500];
+		/* SRTP: encrypt the packet before sending it. Since the buffer is not
+		 * ours (the plugin may be sending it to other recipients too), we
+		 * need a copy, which we protect in place in an SRTP-ready slot */
+		janus_rtp_forwarder_packet spkt;
+		char *sbuf = spkt.data;
 		memcpy(sbuf, buffer, len);
 		int protected = len;
 		int res = srtp_protect(rf->srtp_ctx, sbuf, &protected);
@@ -389,6 +702,7 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 			guint16 seq = ntohs(header->seq_number);
 			JANUS_LOG(LOG_ERR, "Error encrypting %s packet... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
 				(rf->is_video ? "Video" : "Audio"), janus_srtp_error_str(res), len, protected, timestamp, seq);
+			rf->send_errors++;
 		} else {
 			struct sockaddr *address = (rf->serv_addr.sin_family == AF_INET ?
 				(struct sockaddr *)&rf->serv_addr : (struct sockaddr *)&rf->serv_addr6);
@@ -396,6 +710,9 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 			if(sendto(rf->udp_fd, sbuf, protected, 0, address, addrlen) < 0) {
 				JANUS_LOG(LOG_HUGE, "Error forwarding SRTP %s packet... %s (len=%d)...\n",
 					(rf->is_video ? "video" : "audio"), g_strerror(errno), protected);
+				rf->send_errors++;
+			} else {
+				rf->packets_sent++;
 			}
 		}
 	}
@@ -419,6 +736,16 @@ void janus_rtp_forwarder_destroy(janus_rtp_forwarder *rf) {
 		if(rtpfwds != NULL)
 			g_hash_table_remove(rtpfwds, id);
 		janus_mutex_unlock(&rtpfwds_mutex);
+		/* Detach from the egress thread: as it holds the mutex while sending,
+		 * once we get it we know the socket won't be used on our behalf anymore,
+		 * which means the owner is free to close it as soon as we return */
+		if(rf->egress != NULL) {
+			janus_mutex_lock(&rf->egress->mutex);
+			gboolean removed = g_ptr_array_remove(rf->egress->forwarders, rf);
+			janus_mutex_unlock(&rf->egress->mutex);
+			if(removed)
+				janus_rtp_forwarder_unref(rf);
+		}
 		janus_refcount_decrease(&rf->ref);
 	}
 }
@@ -438,6 +765,7 @@ static void janus_rtp_forwarder_free(const janus_refcount *f_ref) {
 		srtp_dealloc(rf->srtp_ctx);
 		g_free(rf->srtp_policy.key);
 	}
+	g_free(rf->queue);
 	g_free(rf->context);
 	g_free(rf->metadata);
 	g_free(rf);
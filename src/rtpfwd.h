@@ -21,10 +21,19 @@
 
 
 /* \brief RTP forwarders code initialization
+ * @param[in] threads Number of egress threads to send packets from (0 to send
+ * them right away from the thread feeding the forwarder, as it happened before)
  * @returns 0 in case of success, a negative integer on errors */
-int janus_rtp_forwarders_init(void);
+int janus_rtp_forwarders_init(int threads);
 /* \brief RTP forwarders code de-initialization */
 void janus_rtp_forwarders_deinit(void);
+/* \brief Helper method to return the number of egress threads for RTP forwarders
+ * @returns The number of egress threads, or 0 if packets are sent synchronously */
+int janus_rtp_forwarders_get_egress_threads(void);
+
+/* Egress resources (opaque) */
+typedef struct janus_rtp_forwarder_queue janus_rtp_forwarder_queue;
+typedef struct janus_rtp_forwarder_egress janus_rtp_forwarder_egress;
 
 /*! \brief Helper struct for implementing RTP forwarders */
 typedef struct janus_rtp_forwarder {
@@ -70,6 +79,16 @@ typedef struct janus_rtp_forwarder {
 	srtp_t srtp_ctx;
 	/* \brief The SRTP policy, in case SRTP is enabled */
 	srtp_policy_t srtp_policy;
+	/* \brief Queue of packets to send, if an egress thread takes care of that */
+	janus_rtp_forwarder_queue *queue;
+	/* \brief Egress thread this forwarder is served by, if any */
+	janus_rtp_forwarder_egress *egress;
+	/* \brief Number of packets sent so far */
+	guint64 packets_sent;
+	/* \brief Number of packets dropped because the queue was full or the packet too large */
+	guint64 packets_dropped;
+	/* \brief Number of packets that couldn't be encrypted or sent */
+	guint64 send_errors;
 	/* \brief Opaque metadata property, in case it's useful to the owner
 	 * \note This can be anything (e.g., a string, an allocated struct, etc.),
 	 * as long as it can be freed with a single call to g_free(), as
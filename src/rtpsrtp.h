@@ -60,6 +60,25 @@ typedef enum janus_srtp_profile {
 	#undef HAVE_SRTP_AESGCM
 #endif
 
+/* SRTP-ready buffers: the packets the core sends are allocated with some
+ * room to spare, so that the RTP header extensions can be rewritten and
+ * the packet can then be protected in place, with no further allocation */
+/*! \brief Room an SRTP-ready buffer reserves for the SRTP/SRTCP trailer (authentication tag and SRTCP index) */
+#define JANUS_SRTP_TAILROOM	(SRTP_MAX_TAG_LEN+4)
+/*! \brief Room an SRTP-ready buffer reserves for the packet to grow, e.g., for the RTP header extensions the core adds */
+#define JANUS_SRTP_HEADROOM	64
+/*! \brief Helper method to allocate an SRTP-ready buffer
+ * @param[in] len The size of the packet the buffer will contain
+ * @param[out] size The size of the allocated buffer (optional)
+ * @returns A buffer of at least len+JANUS_SRTP_HEADROOM+JANUS_SRTP_TAILROOM bytes, to free with g_free */
+char *janus_srtp_buffer_new(int len, int *size);
+/*! \brief Helper method to allocate an SRTP-ready buffer, and copy a packet in it
+ * @param[in] buf The packet to copy
+ * @param[in] len The size of the packet
+ * @param[out] size The size of the allocated buffer (optional)
+ * @returns A buffer of at least len+JANUS_SRTP_HEADROOM+JANUS_SRTP_TAILROOM bytes, to free with g_free */
+char *janus_srtp_buffer_dup(const char *buf, int len, int *size);
+
 /*! \brief Helper method to get a string representation of a libsrtp error code
  * @param[in] error The libsrtp error code
  * @returns A string representation of the error code */
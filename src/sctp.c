@@ -89,6 +89,77 @@ static void janus_sctp_pending_message_free(janus_sctp_pending_message *m) {
 	}
 }
 
+/* Throughput is measured on windows of this length */
+#define JANUS_SCTP_STATS_WINDOW	G_USEC_PER_SEC
+static void janus_sctp_stats_window_update(janus_sctp_stats *stats, gint64 now) {
+	if(stats->window_start == 0) {
+		stats->window_start = now;
+		return;
+	}
+	gint64 elapsed = now - stats->window_start;
+	if(elapsed < JANUS_SCTP_STATS_WINDOW)
+		return;
+	/* A window ended, compute the bitrates: if more than one window passed
+	 * without any traffic, the bitrates are reset */
+	if(elapsed < 2*JANUS_SCTP_STATS_WINDOW) {
+		stats->bitrate_out = (guint32)(((guint64)stats->window_out * 8 * G_USEC_PER_SEC) / elapsed);
+		stats->bitrate_in = (guint32)(((guint64)stats->window_in * 8 * G_USEC_PER_SEC) / elapsed);
+	} else {
+		stats->bitrate_out = 0;
+		stats->bitrate_in = 0;
+	}
+	stats->window_out = 0;
+	stats->window_in = 0;
+	stats->window_start = now;
+}
+/* Same computation, but read-only, for when the stats are only being queried */
+static void janus_sctp_stats_bitrates(const janus_sctp_stats *stats, gint64 now, guint32 *bitrate_out, guint32 *bitrate_in) {
+	gint64 elapsed = now - stats->window_start;
+	if(stats->window_start == 0 || elapsed < JANUS_SCTP_STATS_WINDOW) {
+		*bitrate_out = stats->bitrate_out;
+		*bitrate_in = stats->bitrate_in;
+	} else if(elapsed < 2*JANUS_SCTP_STATS_WINDOW) {
+		*bitrate_out = (guint32)(((guint64)stats->window_out * 8 * G_USEC_PER_SEC) / elapsed);
+		*bitrate_in = (guint32)(((guint64)stats->window_in * 8 * G_USEC_PER_SEC) / elapsed);
+	} else {
+		*bitrate_out = 0;
+		*bitrate_in = 0;
+	}
+}
+
+/* Helper to enable/disable Nagle on an association, which we use to have
+ * usrsctp bundle multiple messages in the same packet when sending batches */
+static void janus_sctp_set_nodelay(janus_sctp_association *sctp, gboolean nodelay) {
+	if(sctp->nodelay == nodelay || sctp->sock == NULL)
+		return;
+	uint32_t value = nodelay ? 1 : 0;
+	if(usrsctp_setsockopt(sctp->sock, IPPROTO_SCTP, SCTP_NODELAY, &value, sizeof(value)) < 0) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] setsockopt error: SCTP_NODELAY (%d, %s)\n",
+			sctp->handle_id, errno, g_strerror(errno));
+		return;
+	}
+	sctp->nodelay = nodelay;
+}
+
+/* Helper to have usrsctp send the chunks it's holding because of Nagle:
+ * there's no explicit flush, but an empty SCTP_SENDALL send carries no
+ * data and still gets the stack to output what's queued, now that Nagle
+ * is disabled again */
+static void janus_sctp_flush(janus_sctp_association *sctp) {
+	sctp->corked = FALSE;
+	if(sctp->sock == NULL)
+		return;
+	struct sctp_sndinfo sndinfo;
+	memset(&sndinfo, 0, sizeof(struct sctp_sndinfo));
+	sndinfo.snd_flags = SCTP_SENDALL;
+	char empty = 0;
+	if(usrsctp_sendv(sctp->sock, &empty, 0, NULL, 0,
+			&sndinfo, (socklen_t)sizeof(struct sctp_sndinfo), SCTP_SENDV_SNDINFO, 0) < 0) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Error flushing SCTP association (%d, %s)\n",
+			sctp->handle_id, errno, g_strerror(errno));
+	}
+}
+
 /* usrsctp callbacks and methods */
 int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t tos, uint8_t set_df);
 static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore addr, void *data, size_t datalen, struct sctp_rcvinfo rcv, int flags, void *ulp_info);
@@ -102,6 +173,7 @@ int janus_sctp_send_open_ack_message(struct socket *sock, uint16_t stream);
 void janus_sctp_send_deferred_messages(janus_sctp_association *sctp);
 int janus_sctp_open_channel(janus_sctp_association *sctp, char *label, char *protocol, uint8_t unordered, uint16_t pr_policy, uint32_t pr_value);
 int janus_sctp_send_text_or_binary(janus_sctp_association *sctp, uint16_t id, gboolean textdata, char *text, size_t length);
+static void janus_sctp_send_data_internal(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len, gboolean more);
 void janus_sctp_reset_outgoing_stream(janus_sctp_association *sctp, uint16_t stream);
 void janus_sctp_send_outgoing_stream_reset(janus_sctp_association *sctp);
 int janus_sctp_close_channel(janus_sctp_association *sctp, uint16_t id);
@@ -168,6 +240,7 @@ static void janus_sctp_association_free(const janus_refcount *sctp_ref) {
 	janus_refcount_decrease(&sctp->dtls->ref);
 	if(sctp->pending_messages != NULL)
 		g_queue_free_full(sctp->pending_messages, (GDestroyNotify)janus_sctp_pending_message_free);
+	janus_mutex_destroy(&sctp->stats_mutex);
 #ifdef DEBUG_SCTP
 	if(sctp->debug_dump != NULL)
 		fclose(sctp->debug_dump);
@@ -200,6 +273,7 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 	sctp->buflen = 0;
 	sctp->offset = 0;
 	sctp->pending_messages = NULL;
+	janus_mutex_init(&sctp->stats_mutex);
 #ifdef DEBUG_SCTP
 	sctp->debug_dump = NULL;
 #endif
@@ -291,6 +365,7 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 		janus_sctp_association_destroy(sctp);
 		return NULL;
 	}
+	sctp->nodelay = TRUE;
 	/* Enable the events of interest */
 	struct sctp_event event;
 	memset(&event, 0, sizeof(event));
@@ -387,6 +462,9 @@ void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len)
 		}
 	}
 #endif
+	janus_mutex_lock(&sctp->stats_mutex);
+	sctp->stats.packets_in++;
+	janus_mutex_unlock(&sctp->stats_mutex);
 	usrsctp_conninput(GUINT_TO_POINTER(sctp->map_id), buf, len, 0);
 }
 
@@ -408,6 +486,22 @@ int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t
 		}
 	}
 #endif
+	gboolean direct = (sctp->sender != NULL && sctp->sender == g_thread_self() && sctp->dtls != NULL);
+	janus_mutex_lock(&sctp->stats_mutex);
+	sctp->stats.packets_out++;
+	if(direct)
+		sctp->stats.packets_direct++;
+	janus_mutex_unlock(&sctp->stats_mutex);
+	if(direct) {
+		/* This packet was generated synchronously while we were pushing a
+		 * message from the ICE loop: since that's the thread that owns the
+		 * DTLS context, we can encrypt and send it right away, which spares
+		 * us a copy and a trip through the queue of the handle */
+		janus_dtls_send_sctp_data(sctp->dtls, buffer, (int)length);
+		return 0;
+	}
+	/* Generated by one of the usrsctp threads (e.g., retransmissions or SACKs):
+	 * queue it, so that it's sent by the ICE loop of the handle */
 	janus_ice_relay_sctp(sctp->handle, buffer, length);
 	return 0;
 }
@@ -431,12 +525,28 @@ static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore ad
 	return 1;
 }
 
-void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len) {
+void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len, gboolean more) {
 	if(sctp == NULL)
 		return;
 
 	if(buf == NULL || len <= 0)
 		return;
+	/* Any packet the stack sends while we're in here (including the DCEP
+	 * open request, if a channel needs to be created) can go to DTLS directly */
+	sctp->sender = g_thread_self();
+	janus_sctp_send_data_internal(sctp, label, protocol, textdata, buf, len, more);
+	/* Whatever happened, don't leave Nagle enabled after the last message of a
+	 * batch: if that message didn't make it to the stack, the ones before it
+	 * may still be held there, so make sure they're sent now */
+	if(!more) {
+		janus_sctp_set_nodelay(sctp, TRUE);
+		if(sctp->corked)
+			janus_sctp_flush(sctp);
+	}
+	sctp->sender = NULL;
+}
+
+static void janus_sctp_send_data_internal(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len, gboolean more) {
 	if(label == NULL)
 		label = (char *)default_label;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP data to send (label=%s, %d bytes) coming from a plugin.\n",
@@ -481,11 +591,31 @@ void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *proto
 			if(sctp->pending_messages == NULL)
 				sctp->pending_messages = g_queue_new();
 			g_queue_push_tail(sctp->pending_messages, m);
+			janus_mutex_lock(&sctp->stats_mutex);
+			sctp->stats.pending_messages++;
+			sctp->stats.pending_bytes += len;
+			janus_mutex_unlock(&sctp->stats_mutex);
 		}
+		janus_sctp_set_nodelay(sctp, TRUE);
 		return;
 	}
+	/* If more messages are coming, enable Nagle so that usrsctp holds the
+	 * chunks while there's data in flight, and bundles them: for the last
+	 * message of a batch we disable it again, which flushes all of them */
+	janus_sctp_set_nodelay(sctp, !more);
 	int res = janus_sctp_send_text_or_binary(sctp, i, textdata, buf, len);
-	if(res == -2) {
+	if(res == 0) {
+		/* A message sent with Nagle disabled flushes whatever was held before it */
+		sctp->corked = more;
+		janus_mutex_lock(&sctp->stats_mutex);
+		if(more)
+			sctp->stats.messages_batched++;
+		sctp->stats.messages_out++;
+		sctp->stats.bytes_out += len;
+		janus_sctp_stats_window_update(&sctp->stats, janus_get_monotonic_time());
+		sctp->stats.window_out += len;
+		janus_mutex_unlock(&sctp->stats_mutex);
+	} else if(res == -2) {
 		/* Delivery failed with an EAGAIN, queue and retry later */
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Got EAGAIN when trying to send message on channel %d, retrying later\n",
 			sctp->handle_id, i);
@@ -493,7 +623,56 @@ void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *proto
 		if(sctp->pending_messages == NULL)
 			sctp->pending_messages = g_queue_new();
 		g_queue_push_tail(sctp->pending_messages, m);
+		janus_mutex_lock(&sctp->stats_mutex);
+		sctp->stats.pending_messages++;
+		sctp->stats.pending_bytes += len;
+		janus_mutex_unlock(&sctp->stats_mutex);
+		janus_sctp_set_nodelay(sctp, TRUE);
+	}
+}
+
+json_t *janus_sctp_association_summary(janus_sctp_association *sctp) {
+	if(sctp == NULL)
+		return NULL;
+	/* Take a snapshot of the stats: we don't update them from here, as
+	 * they're owned by the threads sending and receiving the messages */
+	guint32 bitrate_out = 0, bitrate_in = 0;
+	janus_mutex_lock(&sctp->stats_mutex);
+	janus_sctp_stats stats = sctp->stats;
+	janus_sctp_stats_bitrates(&sctp->stats, janus_get_monotonic_time(), &bitrate_out, &bitrate_in);
+	janus_mutex_unlock(&sctp->stats_mutex);
+	json_t *info = json_object();
+	json_t *out = json_object();
+	json_object_set_new(out, "messages", json_integer(stats.messages_out));
+	json_object_set_new(out, "bytes", json_integer(stats.bytes_out));
+	json_object_set_new(out, "bitrate", json_integer(bitrate_out));
+	json_object_set_new(out, "packets", json_integer(stats.packets_out));
+	json_object_set_new(out, "packets-direct", json_integer(stats.packets_direct));
+	json_object_set_new(out, "messages-batched", json_integer(stats.messages_batched));
+	json_object_set_new(info, "out", out);
+	json_t *in = json_object();
+	json_object_set_new(in, "messages", json_integer(stats.messages_in));
+	json_object_set_new(in, "bytes", json_integer(stats.bytes_in));
+	json_object_set_new(in, "bitrate", json_integer(bitrate_in));
+	json_object_set_new(in, "packets", json_integer(stats.packets_in));
+	json_object_set_new(info, "in", in);
+	/* Backlog: messages we couldn't pass to the stack yet, and data the
+	 * stack has in its own buffers, either unacknowledged or not sent yet */
+	json_t *backlog = json_object();
+	json_object_set_new(backlog, "pending-messages", json_integer(stats.pending_messages));
+	json_object_set_new(backlog, "pending-bytes", json_integer(stats.pending_bytes));
+	if(sctp->sock != NULL && !g_atomic_int_get(&sctp->destroyed)) {
+		struct sctp_status status;
+		socklen_t len = sizeof(status);
+		memset(&status, 0, sizeof(status));
+		if(usrsctp_getsockopt(sctp->sock, IPPROTO_SCTP, SCTP_STATUS, &status, &len) == 0) {
+			json_object_set_new(backlog, "unacked-chunks", json_integer(status.sstat_unackdata));
+			json_object_set_new(backlog, "pending-chunks", json_integer(status.sstat_penddata));
+			json_object_set_new(backlog, "peer-rwnd", json_integer(status.sstat_rwnd));
+		}
 	}
+	json_object_set_new(info, "backlog", backlog);
+	return info;
 }
 
 
@@ -903,6 +1082,16 @@ void janus_sctp_data_ready(janus_sctp_association *sctp) {
 				break;
 			}
 			(void)g_queue_pop_head(sctp->pending_messages);
+			janus_mutex_lock(&sctp->stats_mutex);
+			if(res == 0) {
+				sctp->stats.messages_out++;
+				sctp->stats.bytes_out += m->len;
+				janus_sctp_stats_window_update(&sctp->stats, janus_get_monotonic_time());
+				sctp->stats.window_out += m->len;
+			}
+			sctp->stats.pending_messages--;
+			sctp->stats.pending_bytes -= m->len;
+			janus_mutex_unlock(&sctp->stats_mutex);
 			janus_sctp_pending_message_free(m);
 			m = g_queue_peek_head(sctp->pending_messages);
 		}
@@ -1094,6 +1283,12 @@ void janus_sctp_handle_data_message(janus_sctp_association *sctp, gboolean textd
 			sctp->handle_id, length, channel->id);
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Incoming SCTP contents: %.*s\n",
 			sctp->handle_id, (int)length, buffer);
+		janus_mutex_lock(&sctp->stats_mutex);
+		sctp->stats.messages_in++;
+		sctp->stats.bytes_in += length;
+		janus_sctp_stats_window_update(&sctp->stats, janus_get_monotonic_time());
+		sctp->stats.window_in += length;
+		janus_mutex_unlock(&sctp->stats_mutex);
 		/* Pass this to the core */
 		janus_dtls_notify_sctp_data(sctp->dtls, channel->label,
 			strlen(channel->protocol) ? channel->protocol : NULL,
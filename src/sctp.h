@@ -42,6 +42,7 @@
 #include <errno.h>
 #include <usrsctp.h>
 #include <glib.h>
+#include <jansson.h>
 
 #include "mutex.h"
 #include "refcount.h"
@@ -98,6 +99,29 @@ typedef struct janus_sctp_channel {
 	uint32_t flags;
 } janus_sctp_channel;
 
+/*! \brief Traffic statistics of an SCTP association */
+typedef struct janus_sctp_stats {
+	/*! \brief Messages sent and received on data channels */
+	guint64 messages_out, messages_in;
+	/*! \brief Bytes sent and received on data channels (payload only) */
+	guint64 bytes_out, bytes_in;
+	/*! \brief SCTP packets the stack sent and received */
+	guint64 packets_out, packets_in;
+	/*! \brief SCTP packets that were DTLS-encrypted right away, without being queued */
+	guint64 packets_direct;
+	/*! \brief Messages that were sent with more messages following (i.e., that could be bundled) */
+	guint64 messages_batched;
+	/*! \brief Start of the current throughput window */
+	gint64 window_start;
+	/*! \brief Bytes sent and received in the current throughput window */
+	guint32 window_out, window_in;
+	/*! \brief Throughput (bits per second) measured in the last completed window */
+	guint32 bitrate_out, bitrate_in;
+	/*! \brief Messages waiting in the pending buffer, and their size in bytes */
+	guint32 pending_messages;
+	guint64 pending_bytes;
+} janus_sctp_stats;
+
 typedef struct janus_sctp_association {
 	/*! \brief Unique (local) ID of this association (needed for an internal map) */
 	uint32_t map_id;
@@ -129,6 +153,18 @@ typedef struct janus_sctp_association {
 	size_t offset;
 	/*! \brief Buffer of pending messages */
 	GQueue *pending_messages;
+	/*! \brief Thread currently pushing a message in the stack, if any: packets
+	 * the stack generates synchronously on that thread can be passed to DTLS
+	 * right away, rather than copied and queued for the ICE loop */
+	GThread *sender;
+	/*! \brief Whether Nagle is currently disabled on the socket */
+	gboolean nodelay;
+	/*! \brief Whether messages were passed to the stack with Nagle enabled, and not flushed yet */
+	gboolean corked;
+	/*! \brief Traffic statistics */
+	janus_sctp_stats stats;
+	/*! \brief Mutex protecting the statistics, as they're read by the Admin API */
+	janus_mutex stats_mutex;
 #ifdef DEBUG_SCTP
 	FILE *debug_dump;
 #endif
@@ -207,13 +243,24 @@ void janus_sctp_association_destroy(janus_sctp_association *sctp);
 void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len);
 
 /*! \brief Method to send data via SCTP to the peer
+ * \note When \c more is TRUE, Nagle is enabled on the association before
+ * passing the message to the stack, so that the messages that follow can
+ * be bundled in the same SCTP packet(s) rather than sent one by one: the
+ * last message of a batch must always have \c more set to FALSE, which
+ * disables Nagle again and gets whatever is pending sent out
  * \param[in] sctp The SCTP association this data is from
  * @param[in] label The label of the data channel to use
  * @param[in] protocol The protocol of the data channel to use
  * @param[in] textdata Whether the buffer is text (domstring) or binary data
  * \param[in] buf The data buffer
- * \param[in] len The buffer length */
-void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len);
+ * \param[in] len The buffer length
+ * \param[in] more Whether more messages will be sent right after this one */
+void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len, gboolean more);
+
+/*! \brief Method to get a summary of the traffic and backlog of an SCTP association
+ * \param[in] sctp The SCTP association to inspect
+ * \returns A JSON object with the summary, for the Admin API */
+json_t *janus_sctp_association_summary(janus_sctp_association *sctp);
 
 #endif
 
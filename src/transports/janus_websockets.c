@@ -63,6 +63,7 @@ const char *janus_websockets_get_package(void);
 gboolean janus_websockets_is_janus_api_enabled(void);
 gboolean janus_websockets_is_admin_api_enabled(void);
 int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_websockets_send_message_payload(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_json_payload *payload);
 void janus_websockets_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_websockets_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_websockets_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -88,6 +89,7 @@ static janus_transport janus_websockets_transport =
 		.is_admin_api_enabled = janus_websockets_is_admin_api_enabled,
 
 		.send_message = janus_websockets_send_message,
+		.send_message_payload = janus_websockets_send_message_payload,
 		.session_created = janus_websockets_session_created,
 		.session_over = janus_websockets_session_over,
 		.session_claimed = janus_websockets_session_claimed,
@@ -109,15 +111,13 @@ static gboolean ws_janus_api_enabled = FALSE;
 static gboolean ws_admin_api_enabled = FALSE;
 static gboolean notify_events = TRUE;
 
-/* Clients maps */
-#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-static GHashTable *clients = NULL, *writable_clients = NULL;
-#endif
-static janus_mutex writable_mutex;
-
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Placeholder for pre-serialized plugin payloads in the envelope (see
+ * janus_websockets_send_message_payload for details) */
+static char payload_placeholder[40];
+
 /* Parameter validation (for tweaking and queries via Admin API) */
 static struct janus_json_parameter request_parameters[] = {
 	{"request", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
@@ -173,8 +173,21 @@ static void janus_websockets_log_emit_function(int level, const char *line) {
 	JANUS_LOG(LOG_INFO, "[libwebsockets][%s] %s", janus_websockets_get_level_str(level), line);
 }
 
-/* WebSockets service thread */
-static GThread *ws_thread = NULL;
+/* WebSockets service threads: libwebsockets spreads the new connections
+ * across them, and each thread keeps track of its own clients */
+typedef struct janus_websockets_service {
+	int tsi;								/* Index of the libwebsockets service thread */
+	GThread *thread;						/* The thread serving this instance */
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+	GHashTable *clients;					/* Clients served by this thread */
+	GHashTable *writable_clients;			/* Clients served by this thread that have something to send */
+#endif
+	janus_mutex writable_mutex;				/* Mutex to protect the maps */
+} janus_websockets_service;
+static janus_websockets_service *services = NULL;
+static int services_num = 1;
+/* Service instance of the current thread, if it's a service thread */
+static GPrivate janus_websockets_current_service;
 void *janus_websockets_thread(void *data);
 
 
@@ -188,6 +201,7 @@ typedef struct janus_websockets_client {
 	size_t bufpending;							/* Data an interrupted previous write couldn't send */
 	size_t bufoffset;							/* Offset from where the interrupted previous write should resume */
 	volatile gint destroyed;				/* Whether this libwebsockets client instance has been closed */
+	janus_websockets_service *service;		/* Service thread this client belongs to */
 	janus_transport_session *ts;			/* Janus core-transport session */
 } janus_websockets_client;
 
@@ -737,8 +751,21 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 		}
 #endif
 #endif
-		/* Force single-thread server */
-		wscinfo.count_threads = 1;
+		/* Check how many service threads we should use */
+		services_num = 1;
+		item = janus_config_get(config, config_general, janus_config_type_item, "threads");
+		if(item && item->value) {
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+			services_num = atoi(item->value);
+			if(services_num < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid number of threads (%s), falling back to 1...\n", item->value);
+				services_num = 1;
+			}
+#else
+			JANUS_LOG(LOG_WARN, "Multiple WebSockets service threads only supported in libwebsockets >= 3\n");
+#endif
+		}
+		wscinfo.count_threads = services_num;
 
 		/* Create the base context */
 		wsc = lws_create_context(&wscinfo);
@@ -747,6 +774,15 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			janus_config_destroy(config);
 			return -1;	/* No point in keeping the plugin loaded */
 		}
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+		/* libwebsockets may have been built with a lower limit (LWS_MAX_SMP) */
+		if(lws_get_count_threads(wsc) < services_num) {
+			JANUS_LOG(LOG_WARN, "libwebsockets only supports %d service threads, using those\n",
+				lws_get_count_threads(wsc));
+			services_num = lws_get_count_threads(wsc);
+		}
+#endif
+		JANUS_LOG(LOG_INFO, "Using %d WebSockets service thread(s)\n", services_num);
 
 		/* Setup the Janus API WebSockets server(s) */
 		wss = janus_websockets_create_ws_server(config, config_general, NULL, "ws",
@@ -769,24 +805,36 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 	ws_janus_api_enabled = wss || swss;
 	ws_admin_api_enabled = admin_wss || admin_swss;
 
+	services = g_malloc0(services_num * sizeof(janus_websockets_service));
+	int i = 0;
+	for(i=0; i<services_num; i++) {
+		services[i].tsi = i;
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-	clients = g_hash_table_new(NULL, NULL);
-	writable_clients = g_hash_table_new(NULL, NULL);
+		services[i].clients = g_hash_table_new(NULL, NULL);
+		services[i].writable_clients = g_hash_table_new(NULL, NULL);
 #endif
-	janus_mutex_init(&writable_mutex);
+		janus_mutex_init(&services[i].writable_mutex);
+	}
+	/* Placeholder for the plugin payloads that were serialized in advance */
+	g_snprintf(payload_placeholder, sizeof(payload_placeholder), "janus-ws-%08"SCNx32"%08"SCNx32,
+		janus_random_uint32(), janus_random_uint32());
 
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
-	/* Start the WebSocket service thread */
+	/* Start the WebSocket service threads */
 	if(ws_janus_api_enabled || ws_admin_api_enabled) {
-		ws_thread = g_thread_try_new("ws thread", &janus_websockets_thread, wsc, &error);
-		if(error != NULL) {
-			g_atomic_int_set(&initialized, 0);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-			return -1;
+		for(i=0; i<services_num; i++) {
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "ws thread %d", i);
+			services[i].thread = g_thread_try_new(tname, &janus_websockets_thread, &services[i], &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread #%d...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				janus_websockets_destroy();
+				return -1;
+			}
 		}
 	}
 
@@ -803,10 +851,13 @@ void janus_websockets_destroy(void) {
 	lws_cancel_service(wsc);
 #endif
 
-	/* Stop the service thread */
-	if(ws_thread != NULL) {
-		g_thread_join(ws_thread);
-		ws_thread = NULL;
+	/* Stop the service threads */
+	int i = 0;
+	for(i=0; i<services_num; i++) {
+		if(services[i].thread != NULL) {
+			g_thread_join(services[i].thread);
+			services[i].thread = NULL;
+		}
 	}
 
 	/* Destroy the context */
@@ -815,14 +866,19 @@ void janus_websockets_destroy(void) {
 		wsc = NULL;
 	}
 
+	for(i=0; i<services_num; i++) {
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-	janus_mutex_lock(&writable_mutex);
-	g_hash_table_destroy(clients);
-	clients = NULL;
-	g_hash_table_destroy(writable_clients);
-	writable_clients = NULL;
-	janus_mutex_unlock(&writable_mutex);
+		janus_mutex_lock(&services[i].writable_mutex);
+		g_hash_table_destroy(services[i].clients);
+		services[i].clients = NULL;
+		g_hash_table_destroy(services[i].writable_clients);
+		services[i].writable_clients = NULL;
+		janus_mutex_unlock(&services[i].writable_mutex);
 #endif
+		janus_mutex_destroy(&services[i].writable_mutex);
+	}
+	g_free(services);
+	services = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -843,10 +899,13 @@ static void janus_websockets_destroy_client(
 	/* Cleanup */
 	JANUS_LOG(LOG_INFO, "[%s-%p] Destroying WebSocket client\n", log_prefix, wsi);
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-	janus_mutex_lock(&writable_mutex);
-	g_hash_table_remove(clients, ws_client);
-	g_hash_table_remove(writable_clients, ws_client);
-	janus_mutex_unlock(&writable_mutex);
+	janus_websockets_service *service = ws_client->service;
+	if(service != NULL) {
+		janus_mutex_lock(&service->writable_mutex);
+		g_hash_table_remove(service->clients, ws_client);
+		g_hash_table_remove(service->writable_clients, ws_client);
+		janus_mutex_unlock(&service->writable_mutex);
+	}
 #endif
 	ws_client->wsi = NULL;
 	/* Notify handlers about this transport being gone */
@@ -915,7 +974,37 @@ gboolean janus_websockets_is_admin_api_enabled(void) {
 	return ws_admin_api_enabled;
 }
 
-int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+/* Helper to serialize a message whose plugin data was serialized in advance:
+ * we serialize the envelope only, with a placeholder instead of the data,
+ * and then replace the placeholder (quotes included) with the payload text */
+static char *janus_websockets_serialize_payload(json_t *message, janus_json_payload *payload) {
+	json_t *plugindata = json_object_get(message, "plugindata");
+	if(plugindata == NULL)
+		return json_dumps(message, json_format);
+	json_object_set_new(plugindata, "data", json_string(payload_placeholder));
+	char *text = json_dumps(message, json_format);
+	char *placeholder = text ? strstr(text, payload_placeholder) : NULL;
+	size_t placeholder_len = strlen(payload_placeholder);
+	if(placeholder == NULL || placeholder == text || *(placeholder-1) != '"' || placeholder[placeholder_len] != '"' ||
+			strstr(placeholder + placeholder_len, payload_placeholder) != NULL) {
+		/* Shouldn't happen, but just in case serialize the whole message */
+		free(text);
+		json_object_set(plugindata, "data", payload->json);
+		return json_dumps(message, json_format);
+	}
+	placeholder--;
+	placeholder_len += 2;
+	/* The payload is not indented like the envelope, but it's still valid JSON */
+	size_t text_len = strlen(text), prefix = placeholder - text;
+	char *serialized = malloc(text_len - placeholder_len + payload->len + 1);
+	memcpy(serialized, text, prefix);
+	memcpy(serialized + prefix, payload->text, payload->len);
+	memcpy(serialized + prefix + payload->len, placeholder + placeholder_len, text_len - prefix - placeholder_len + 1);
+	free(text);
+	return serialized;
+}
+
+static int janus_websockets_queue_message(janus_transport_session *transport, json_t *message, janus_json_payload *payload) {
 	if(message == NULL)
 		return -1;
 	if(transport == NULL || g_atomic_int_get(&transport->destroyed)) {
@@ -930,32 +1019,44 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 		return -1;
 	}
 	/* Convert to string and enqueue */
-	char *payload = json_dumps(message, json_format);
-	if(payload == NULL) {
+	char *text = payload ? janus_websockets_serialize_payload(message, payload) : json_dumps(message, json_format);
+	if(text == NULL) {
 		JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
 		json_decref(message);
 		janus_mutex_unlock(&transport->mutex);
 		return -1;
 	}
-	g_async_queue_push(client->messages, payload);
+	g_async_queue_push(client->messages, text);
+	janus_websockets_service *service = client->service;
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-	/* On libwebsockets >= 3.x we use lws_cancel_service */
-	janus_mutex_lock(&writable_mutex);
-	if(g_hash_table_lookup(clients, client) == client)
-		g_hash_table_insert(writable_clients, client, client);
-	janus_mutex_unlock(&writable_mutex);
-	lws_cancel_service(wsc);
+	/* On libwebsockets >= 3.x we use lws_cancel_service_pt, so that
+	 * we only wake up the service thread this client belongs to */
+	janus_mutex_lock(&service->writable_mutex);
+	if(g_hash_table_lookup(service->clients, client) == client)
+		g_hash_table_insert(service->writable_clients, client, client);
+	janus_mutex_unlock(&service->writable_mutex);
+	lws_cancel_service_pt(client->wsi);
 #else
 	/* On libwebsockets < 3.x we use lws_callback_on_writable */
-	janus_mutex_lock(&writable_mutex);
+	janus_mutex_lock(&service->writable_mutex);
 	lws_callback_on_writable(client->wsi);
-	janus_mutex_unlock(&writable_mutex);
+	janus_mutex_unlock(&service->writable_mutex);
 #endif
 	janus_mutex_unlock(&transport->mutex);
 	json_decref(message);
 	return 0;
 }
 
+int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_websockets_queue_message(transport, message, NULL);
+}
+
+int janus_websockets_send_message_payload(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_json_payload *payload) {
+	int res = janus_websockets_queue_message(transport, message, payload);
+	janus_json_payload_unref(payload);
+	return res;
+}
+
 void janus_websockets_session_created(janus_transport_session *transport, guint64 session_id) {
 	/* We don't care */
 }
@@ -1081,11 +1182,16 @@ json_t *janus_websockets_query_transport(json_t *request) {
 		/* Return the number of active connections currently handled by the plugin */
 		json_object_set_new(response, "result", json_integer(200));
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-		janus_mutex_lock(&writable_mutex);
-		guint connections = g_hash_table_size(clients);
-		janus_mutex_unlock(&writable_mutex);
+		guint connections = 0;
+		int i = 0;
+		for(i=0; i<services_num; i++) {
+			janus_mutex_lock(&services[i].writable_mutex);
+			connections += g_hash_table_size(services[i].clients);
+			janus_mutex_unlock(&services[i].writable_mutex);
+		}
 		json_object_set_new(response, "connections", json_integer(connections));
 #endif
+		json_object_set_new(response, "threads", json_integer(services_num));
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
 		error_code = JANUS_WEBSOCKETS_ERROR_INVALID_REQUEST;
@@ -1106,23 +1212,24 @@ plugin_response:
 
 /* Thread */
 void *janus_websockets_thread(void *data) {
-	struct lws_context *service = (struct lws_context *)data;
-	if(service == NULL) {
+	janus_websockets_service *service = (janus_websockets_service *)data;
+	if(service == NULL || wsc == NULL) {
 		JANUS_LOG(LOG_ERR, "Invalid service\n");
 		return NULL;
 	}
+	g_private_set(&janus_websockets_current_service, service);
 
-	JANUS_LOG(LOG_INFO, "WebSockets thread started\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d started\n", service->tsi);
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* libwebsockets is single thread, we cycle through events here */
-		lws_service(service, 50);
+		/* Each service thread only cycles through the events of its own connections */
+		lws_service_tsi(wsc, 50, service->tsi);
 	}
 
 	/* Get rid of the WebSockets server */
-	lws_cancel_service(service);
+	lws_cancel_service(wsc);
 	/* Done */
-	JANUS_LOG(LOG_INFO, "WebSockets thread ended\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d ended\n", service->tsi);
 	return NULL;
 }
 
@@ -1217,11 +1324,15 @@ static int janus_websockets_common_callback(
 			ws_client->bufpending = 0;
 			ws_client->bufoffset = 0;
 			g_atomic_int_set(&ws_client->destroyed, 0);
+			/* This callback is invoked by the service thread the connection was assigned to */
+			ws_client->service = g_private_get(&janus_websockets_current_service);
+			if(ws_client->service == NULL)
+				ws_client->service = &services[0];
 			ws_client->ts = janus_transport_session_create(ws_client, NULL);
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-			janus_mutex_lock(&writable_mutex);
-			g_hash_table_insert(clients, ws_client, ws_client);
-			janus_mutex_unlock(&writable_mutex);
+			janus_mutex_lock(&ws_client->service->writable_mutex);
+			g_hash_table_insert(ws_client->service->clients, ws_client, ws_client);
+			janus_mutex_unlock(&ws_client->service->writable_mutex);
 #endif
 			/* Let us know when the WebSocket channel becomes writeable */
 			lws_callback_on_writable(wsi);
@@ -1386,19 +1497,23 @@ static int janus_websockets_common_callback(
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 		/* On libwebsockets >= 3.x, we use this event to mark connections as writable in the event loop */
 		case LWS_CALLBACK_EVENT_WAIT_CANCELLED: {
-			janus_mutex_lock(&writable_mutex);
+			/* Only touch the clients served by this thread */
+			janus_websockets_service *service = g_private_get(&janus_websockets_current_service);
+			if(service == NULL)
+				return 0;
+			janus_mutex_lock(&service->writable_mutex);
 			/* We iterate on all the clients we marked as writable and act on them */
 			GHashTableIter iter;
 			gpointer value;
-			g_hash_table_iter_init(&iter, writable_clients);
+			g_hash_table_iter_init(&iter, service->writable_clients);
 			while(g_hash_table_iter_next(&iter, NULL, &value)) {
 				janus_websockets_client *client = value;
 				if(client == NULL || client->wsi == NULL)
 					continue;
 				lws_callback_on_writable(client->wsi);
 			}
-			g_hash_table_remove_all(writable_clients);
-			janus_mutex_unlock(&writable_mutex);
+			g_hash_table_remove_all(service->writable_clients);
+			janus_mutex_unlock(&service->writable_mutex);
 			return 0;
 		}
 #endif
@@ -61,7 +61,10 @@ janus_transport *create(void) {
  *
  * All the above methods and callbacks are mandatory: the Janus core will
  * reject a transport plugin that doesn't implement any of the
- * mandatory callbacks.
+ * mandatory callbacks. Transports can optionally implement \c send_message_payload()
+ * as well, to send plugin events whose content was serialized once in advance
+ * (e.g., the same notification sent to all participants in a room) without
+ * serializing it again for each recipient.
  *
  * The Janus core \c janus_transport_callbacks interface is provided to a
  * transport plugin, together with the path to the configurations files
@@ -94,10 +97,11 @@ janus_transport *create(void) {
 #include <jansson.h>
 
 #include "refcount.h"
+#include "utils.h"
 
 
 /*! \brief Version of the API, to match the one transport plugins were compiled against */
-#define JANUS_TRANSPORT_API_VERSION		8
+#define JANUS_TRANSPORT_API_VERSION		9
 
 /*! \brief Initialization of all transport plugin properties to NULL
  *
@@ -130,6 +134,7 @@ static janus_transport janus_http_transport_plugin =
 		.session_over = NULL,			\
 		.session_claimed = NULL,		\
 		.query_transport = NULL,		\
+		.send_message_payload = NULL,	\
 		## __VA_ARGS__ }
 
 
@@ -243,6 +248,21 @@ struct janus_transport {
 	 * @param[in] request Jansson object containing the request
 	 * @returns A Jansson object containing the response for the client */
 	json_t *(* const query_transport)(json_t *request);
+	/*! \brief Method to send a plugin event whose plugin data was serialized in advance
+	 * \note This method is optional: if it's not implemented, the core will add the
+	 * JSON object in \c payload to \c message and call send_message() instead.
+	 * The message contains the usual "plugindata" object, but with no "data"
+	 * property: the transport is expected to add \c payload->text as its
+	 * content when serializing the message. As with send_message(), it's the
+	 * transport plugin's responsibility to free the message, and to release the
+	 * reference to the payload it's been handed, via janus_json_payload_unref().
+	 * @param[in] transport Pointer to the transport session instance
+	 * @param[in] request_id Will be not-NULL in case this is a response to a previous request
+	 * @param[in] admin Whether this is an admin API or a Janus API message
+	 * @param[in] message The message envelope as a Jansson json_t object
+	 * @param[in] payload The pre-serialized content of "plugindata.data"
+	 * @returns 0 on success, a negative integer otherwise */
+	int (* const send_message_payload)(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_json_payload *payload);
 
 };
 
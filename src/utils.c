@@ -9,6 +9,13 @@
  * \ref core
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <pthread.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -655,6 +662,33 @@ void janus_get_json_type_name(int jtype, unsigned int flags, char *type_name) {
 	}
 }
 
+janus_json_payload *janus_json_payload_create(json_t *json) {
+	if(json == NULL)
+		return NULL;
+	char *text = json_dumps(json, JSON_PRESERVE_ORDER);
+	if(text == NULL)
+		return NULL;
+	janus_json_payload *payload = g_malloc0(sizeof(janus_json_payload));
+	payload->json = json_incref(json);
+	payload->text = text;
+	payload->len = strlen(text);
+	g_atomic_int_set(&payload->ref, 1);
+	return payload;
+}
+
+void janus_json_payload_ref(janus_json_payload *payload) {
+	if(payload != NULL)
+		g_atomic_int_inc(&payload->ref);
+}
+
+void janus_json_payload_unref(janus_json_payload *payload) {
+	if(payload == NULL || !g_atomic_int_dec_and_test(&payload->ref))
+		return;
+	json_decref(payload->json);
+	free(payload->text);
+	g_free(payload);
+}
+
 gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags) {
 	gboolean is_valid = (json_typeof(val) == jtype || (jtype == JSON_TRUE && json_typeof(val) == JSON_FALSE));
 	if(!is_valid)
@@ -1450,3 +1484,126 @@ size_t janus_gzip_compress(int compression, char *text, size_t tlen, char *compr
 	return zs.total_out;
 }
 #endif
+
+/* CPU affinity helpers */
+GArray *janus_cpu_list_parse(const char *list) {
+	if(list == NULL)
+		return NULL;
+	GArray *cpus = g_array_new(FALSE, FALSE, sizeof(int));
+	gchar **items = g_strsplit(list, ",", -1);
+	int i = 0;
+	for(i=0; items[i] != NULL; i++) {
+		char *item = g_strstrip(items[i]);
+		if(*item == '\0')
+			continue;
+		int first = -1, last = -1;
+		if(strchr(item, '-') != NULL) {
+			if(sscanf(item, "%d-%d", &first, &last) != 2)
+				first = -1;
+		} else {
+			if(sscanf(item, "%d", &first) != 1)
+				first = -1;
+			last = first;
+		}
+		if(first < 0 || last < first) {
+			JANUS_LOG(LOG_ERR, "Invalid CPU list item '%s'\n", item);
+			g_strfreev(items);
+			g_array_free(cpus, TRUE);
+			return NULL;
+		}
+		int cpu = 0;
+		for(cpu=first; cpu<=last; cpu++)
+			g_array_append_val(cpus, cpu);
+	}
+	g_strfreev(items);
+	if(cpus->len == 0) {
+		g_array_free(cpus, TRUE);
+		return NULL;
+	}
+	return cpus;
+}
+
+char *janus_cpu_list_print(const int *cpus, int count) {
+	if(cpus == NULL || count < 1)
+		return NULL;
+	GString *list = g_string_new(NULL);
+	int i = 0;
+	for(i=0; i<count; i++) {
+		/* Collapse consecutive CPUs in ranges */
+		int first = cpus[i];
+		while(i+1 < count && cpus[i+1] == cpus[i]+1)
+			i++;
+		if(list->len > 0)
+			g_string_append_c(list, ',');
+		if(cpus[i] > first)
+			g_string_append_printf(list, "%d-%d", first, cpus[i]);
+		else
+			g_string_append_printf(list, "%d", first);
+	}
+	return g_string_free(list, FALSE);
+}
+
+int janus_thread_set_affinity(const int *cpus, int count) {
+	if(cpus == NULL || count < 1)
+		return -1;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int i = 0;
+	for(i=0; i<count; i++) {
+		if(cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+			CPU_SET(cpus[i], &set);
+	}
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(res != 0) {
+		JANUS_LOG(LOG_WARN, "Error setting thread affinity: %d (%s)\n", res, g_strerror(res));
+		return -1;
+	}
+	return 0;
+#else
+	JANUS_LOG(LOG_WARN, "Thread affinity not supported on this platform\n");
+	return -1;
+#endif
+}
+
+int janus_network_get_numa_node(const char *iface) {
+	if(iface == NULL)
+		return -1;
+#ifdef __linux__
+	char path[256], value[32];
+	g_snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", iface);
+	FILE *f = fopen(path, "rt");
+	if(f == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't find the NUMA node of interface %s\n", iface);
+		return -1;
+	}
+	int node = -1;
+	if(fgets(value, sizeof(value), f) != NULL)
+		node = atoi(value);
+	fclose(f);
+	return node;
+#else
+	return -1;
+#endif
+}
+
+GArray *janus_numa_node_cpus(int node) {
+	if(node < 0)
+		return NULL;
+#ifdef __linux__
+	char path[256], value[1024];
+	g_snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *f = fopen(path, "rt");
+	if(f == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't find the CPUs of NUMA node %d\n", node);
+		return NULL;
+	}
+	GArray *cpus = NULL;
+	if(fgets(value, sizeof(value), f) != NULL)
+		cpus = janus_cpu_list_parse(g_strstrip(value));
+	fclose(f);
+	return cpus;
+#else
+	return NULL;
+#endif
+}
@@ -245,6 +245,33 @@ void janus_get_json_type_name(int jtype, unsigned int flags, char *type_name);
  * @returns TRUE if the value is valid */
 gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags);
 
+/*! \brief A JSON object serialized once and shared among many recipients
+ * \details Plugins sending the same event to many handles (e.g., room
+ * notifications) can create one of these and pass it to the core via
+ * \c push_event_payload, so that transports that support it can reuse
+ * \c text instead of serializing the same object once per recipient. */
+typedef struct janus_json_payload {
+	/*! \brief The JSON object (a reference is held) */
+	json_t *json;
+	/*! \brief The compact serialization of \c json */
+	char *text;
+	/*! \brief Length of \c text */
+	size_t len;
+	/*! \brief Reference counter for this instance */
+	volatile gint ref;
+} janus_json_payload;
+/*! \brief Creates a shared payload out of a JSON object
+ * @note The object is serialized right away, so it must not be modified afterwards
+ * @param json The JSON object to share (a new reference is taken)
+ * @returns A new janus_json_payload instance with a reference, or NULL on error */
+janus_json_payload *janus_json_payload_create(json_t *json);
+/*! \brief Takes a reference on a shared payload
+ * @param payload The janus_json_payload instance */
+void janus_json_payload_ref(janus_json_payload *payload);
+/*! \brief Releases a reference on a shared payload
+ * @param payload The janus_json_payload instance */
+void janus_json_payload_unref(janus_json_payload *payload);
+
 /*! \brief Validates the JSON object against the description of its parameters
  * @param missing_format printf format to indicate a missing required parameter; needs one %s for the parameter name
  * @param invalid_format printf format to indicate an invalid parameter; needs two %s for parameter name and type description from janus_get_json_type_name
@@ -496,4 +523,32 @@ uint32_t janus_bitstream_getbits(uint8_t *base, uint8_t num, uint32_t *offset);
  */
 size_t janus_gzip_compress(int compression, char *text, size_t tlen, char *compressed, size_t zlen);
 
+/** @name CPU affinity helpers
+ */
+///@{
+/*! \brief Helper method to parse a list of CPUs (e.g., "0-3,8,10-11")
+ * @param[in] list The list to parse
+ * @returns An array of int CPU identifiers, if successful, or NULL otherwise */
+GArray *janus_cpu_list_parse(const char *list);
+/*! \brief Helper method to print a list of CPUs, collapsing consecutive CPUs in ranges
+ * @param[in] cpus The array of CPU identifiers
+ * @param[in] count The number of CPU identifiers in the array
+ * @returns A string describing the list (to be freed with g_free), or NULL in case of errors */
+char *janus_cpu_list_print(const int *cpus, int count);
+/*! \brief Helper method to pin the calling thread to one or more CPUs
+ * @note Only supported on Linux at the moment
+ * @param[in] cpus The array of CPU identifiers
+ * @param[in] count The number of CPU identifiers in the array
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_thread_set_affinity(const int *cpus, int count);
+/*! \brief Helper method to find out the NUMA node a network interface is attached to
+ * @param[in] iface The name of the network interface (e.g., "eth0")
+ * @returns The NUMA node, if available, or -1 otherwise */
+int janus_network_get_numa_node(const char *iface);
+/*! \brief Helper method to get the list of CPUs belonging to a NUMA node
+ * @param[in] node The NUMA node
+ * @returns An array of int CPU identifiers, if successful, or NULL otherwise */
+GArray *janus_numa_node_cpus(int node);
+///@}
+
 #endif